@@ -710,6 +710,8 @@ typedef enum VBOXLOGGROUP
     LOG_GROUP_VD,
     /** CUE/BIN virtual disk backend. */
     LOG_GROUP_VD_CUE,
+    /** DDI (deduplicating) virtual disk backend. */
+    LOG_GROUP_VD_DDI,
     /** DMG virtual disk backend. */
     LOG_GROUP_VD_DMG,
     /** iSCSI virtual disk backend. */
@@ -1089,6 +1091,7 @@ typedef enum VBOXLOGGROUP
     "VBGL", \
     "VD", \
     "VD_CUE", \
+    "VD_DDI", \
     "VD_DMG", \
     "VD_ISCSI", \
     "VD_PARALLELS", \
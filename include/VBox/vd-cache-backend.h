@@ -148,9 +148,12 @@ typedef struct VDCACHEBACKEND
      *                          that could be written in a full block write,
      *                          when prefixed/postfixed by the appropriate
      *                          amount of (previously read) padding data.
+     *                          VERR_DISK_FULL sets this to the number of bytes
+     *                          the cache has no room for.
+     * @param   fWrite          Write flags, combination of VD_CACHE_WRITE_F_*.
      */
     DECLR3CALLBACKMEMBER(int, pfnWrite, (void *pBackendData, uint64_t uOffset, size_t cbToWrite,
-                                         PVDIOCTX pIoCtx, size_t *pcbWriteProcess));
+                                         PVDIOCTX pIoCtx, size_t *pcbWriteProcess, uint32_t fWrite));
 
     /**
      * Flush data to disk.
@@ -180,6 +183,45 @@ typedef struct VDCACHEBACKEND
                                            void   **ppbmAllocationBitmap,
                                            unsigned fDiscard));
 
+    /**
+     * Returns the next range of dirty data which needs to be written back to
+     * the image chain. Ranges are returned in the order they were last modified.
+     *
+     * @returns VBox status code.
+     * @retval  VERR_NOT_FOUND if there is no dirty data after the given position.
+     * @param   pBackendData    Opaque state data for this image.
+     * @param   puSeq           On input the sequence number to start searching at,
+     *                          0 to start with the oldest dirty range.
+     *                          On output the sequence number of the returned range.
+     * @param   puOffset        On input the offset to continue at for ranges with
+     *                          the sequence number given in puSeq.
+     *                          On output the start offset of the returned range.
+     * @param   pcbDirty        Where to store the size of the range in bytes.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnDirtyQueryNext, (void *pBackendData, uint64_t *puSeq,
+                                                  uint64_t *puOffset, size_t *pcbDirty));
+
+    /**
+     * Marks a dirty range returned by pfnDirtyQueryNext as written back.
+     * The range stays dirty if it was modified after it was queried.
+     *
+     * @returns VBox status code.
+     * @param   pBackendData    Opaque state data for this image.
+     * @param   uSeq            The sequence number pfnDirtyQueryNext returned.
+     * @param   uOffset         Start offset of the range.
+     * @param   cbRange         Size of the range in bytes.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnDirtyClear, (void *pBackendData, uint64_t uSeq,
+                                              uint64_t uOffset, size_t cbRange));
+
+    /**
+     * Returns the amount of dirty data in the cache.
+     *
+     * @returns Number of bytes which still need to be written back.
+     * @param   pBackendData    Opaque state data for this image.
+     */
+    DECLR3CALLBACKMEMBER(uint64_t, pfnGetDirtySize, (void *pBackendData));
+
     /**
      * Get the version of a cache image.
      *
@@ -317,6 +359,14 @@ typedef VDCACHEBACKEND *PVDCACHEBACKEND;
 typedef const VDCACHEBACKEND *PCVDCACHEBACKEND;
 
 /** The current version of the VDCACHEBACKEND structure. */
-#define VD_CACHEBACKEND_VERSION                 VD_VERSION_MAKE(0xff03, 1, 0)
+#define VD_CACHEBACKEND_VERSION                 VD_VERSION_MAKE(0xff03, 2, 0)
+
+/** @name Cache write flags.
+ * @{ */
+/** The data is newer than the data in the image chain and must be kept until it
+ * was written back (write-back mode). Data written without this flag is only
+ * a copy of the image content and can be dropped at any time. */
+#define VD_CACHE_WRITE_F_DIRTY                  RT_BIT_32(0)
+/** @} */
 
 #endif /* !VBOX_INCLUDED_vd_cache_backend_h */
@@ -77,6 +77,8 @@ typedef enum VDINTERFACETYPE
     VDINTERFACETYPE_TRAVERSEMETADATA,
     /** Interface for crypto operations. Per-filter. */
     VDINTERFACETYPE_CRYPTO,
+    /** Interface for tracing the processing stages of I/O requests. Per-disk. */
+    VDINTERFACETYPE_IOTRACE,
     /** invalid interface. */
     VDINTERFACETYPE_INVALID
 } VDINTERFACETYPE;
@@ -1741,6 +1743,106 @@ DECLINLINE(int) vdIfCryptoKeyStoreReturnParameters(PVDINTERFACECRYPTO pIfCrypto,
     return VINF_SUCCESS;
 }
 
+/**
+ * I/O request type reported through the I/O tracing interface.
+ */
+typedef enum VDIOTRACEREQTYPE
+{
+    /** Invalid request type. */
+    VDIOTRACEREQTYPE_INVALID = 0,
+    /** Read request. */
+    VDIOTRACEREQTYPE_READ,
+    /** Write request. */
+    VDIOTRACEREQTYPE_WRITE,
+    /** Flush request. */
+    VDIOTRACEREQTYPE_FLUSH,
+    /** Discard request. */
+    VDIOTRACEREQTYPE_DISCARD,
+    /** 32bit hack. */
+    VDIOTRACEREQTYPE_32BIT_HACK = 0x7fffffff
+} VDIOTRACEREQTYPE;
+
+/**
+ * Timing record of a completed I/O request.
+ *
+ * All timestamps are taken with RTTimeNanoTS(). A stage which was not passed
+ * by the request (a request which didn't need the disk lock or was satisfied
+ * without touching the backend storage) has a timestamp of 0.
+ */
+typedef struct VDIOTRACEREC
+{
+    /** The request type. */
+    VDIOTRACEREQTYPE    enmType;
+    /** Status code of the request. */
+    int32_t             rcReq;
+    /** Start offset of the request, 0 for flush and discard requests. */
+    uint64_t            off;
+    /** Size of the request in bytes, 0 for flush and discard requests. */
+    size_t              cbTransfer;
+    /** Number of metadata transfers issued by the backend on behalf of the request. */
+    uint32_t            cMetaXfers;
+    /** Number of data transfers issued by the backend on behalf of the request. */
+    uint32_t            cDataXfers;
+    /** When the request was queued to the disk. */
+    uint64_t            tsQueued;
+    /** When the request acquired the disk lock. */
+    uint64_t            tsLocked;
+    /** When the first transfer for the request was submitted to the I/O interface. */
+    uint64_t            tsSubmitted;
+    /** When the request completed. */
+    uint64_t            tsCompleted;
+} VDIOTRACEREC;
+/** Pointer to an I/O request timing record. */
+typedef VDIOTRACEREC *PVDIOTRACEREC;
+/** Pointer to a const I/O request timing record. */
+typedef const VDIOTRACEREC *PCVDIOTRACEREC;
+
+/**
+ * Interface to trace the processing stages of I/O requests.
+ *
+ * Per-disk interface. Optional, timestamps are only taken if it is present.
+ */
+typedef struct VDINTERFACEIOTRACE
+{
+    /**
+     * Common interface header.
+     */
+    VDINTERFACE    Core;
+
+    /**
+     * Called when an I/O request completed, right before the completion
+     * callback of the request is invoked.
+     *
+     * @param   pvUser          The opaque data passed on container creation.
+     * @param   pRec            The timing record of the request, only valid
+     *                          during the call.
+     *
+     * @note This can be called from any thread doing I/O for the disk concurrently
+     *       and must not block.
+     */
+    DECLR3CALLBACKMEMBER(void, pfnIoReqCompleted, (void *pvUser, PCVDIOTRACEREC pRec));
+
+} VDINTERFACEIOTRACE, *PVDINTERFACEIOTRACE;
+
+/**
+ * Get I/O tracing interface from interface list.
+ *
+ * @return Pointer to the first I/O tracing interface in the list.
+ * @param  pVDIfs    Pointer to the interface list.
+ */
+DECLINLINE(PVDINTERFACEIOTRACE) VDIfIoTraceGet(PVDINTERFACE pVDIfs)
+{
+    PVDINTERFACE pIf = VDInterfaceGet(pVDIfs, VDINTERFACETYPE_IOTRACE);
+
+    /* Check that the interface descriptor is an I/O tracing interface. */
+    AssertMsgReturn(   !pIf
+                    || (   (pIf->enmInterface == VDINTERFACETYPE_IOTRACE)
+                        && (pIf->cbSize == sizeof(VDINTERFACEIOTRACE))),
+                    ("Not an I/O tracing interface"), NULL);
+
+    return (PVDINTERFACEIOTRACE)pIf;
+}
+
 
 RT_C_DECLS_END
 
@@ -255,8 +255,16 @@ typedef struct VDISKRAW
  * can lead to corrupted images in read-write mode.
  */
 #define VD_OPEN_FLAGS_SKIP_CONSISTENCY_CHECKS  RT_BIT(10)
+/**
+ * Use the cache in write-back mode. Only valid for VDCacheOpen() and
+ * VDCreateCache(). Writes complete as soon as the data is in the cache and are
+ * written back to the image chain later, a guest flush only flushes the cache.
+ * Dirty data is written back when the cache is closed and when a cache with
+ * dirty data is opened without this flag.
+ */
+#define VD_OPEN_FLAGS_CACHE_WRITE_BACK         RT_BIT(11)
 /** Mask of valid flags. */
-#define VD_OPEN_FLAGS_MASK          (VD_OPEN_FLAGS_NORMAL | VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_HONOR_ZEROES | VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_INFO | VD_OPEN_FLAGS_ASYNC_IO | VD_OPEN_FLAGS_SHAREABLE | VD_OPEN_FLAGS_SEQUENTIAL | VD_OPEN_FLAGS_DISCARD | VD_OPEN_FLAGS_IGNORE_FLUSH | VD_OPEN_FLAGS_INFORM_ABOUT_ZERO_BLOCKS | VD_OPEN_FLAGS_SKIP_CONSISTENCY_CHECKS)
+#define VD_OPEN_FLAGS_MASK          (VD_OPEN_FLAGS_NORMAL | VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_HONOR_ZEROES | VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_INFO | VD_OPEN_FLAGS_ASYNC_IO | VD_OPEN_FLAGS_SHAREABLE | VD_OPEN_FLAGS_SEQUENTIAL | VD_OPEN_FLAGS_DISCARD | VD_OPEN_FLAGS_IGNORE_FLUSH | VD_OPEN_FLAGS_INFORM_ABOUT_ZERO_BLOCKS | VD_OPEN_FLAGS_SKIP_CONSISTENCY_CHECKS | VD_OPEN_FLAGS_CACHE_WRITE_BACK)
 /** @}*/
 
 /** @name VBox HDD container filter flags
@@ -954,6 +962,39 @@ VBOXDDU_DECL(int) VDFilterRemove(PVDISK pDisk, uint32_t fFlags);
  */
 VBOXDDU_DECL(int) VDCacheClose(PVDISK pDisk, bool fDelete);
 
+/**
+ * Writes dirty data of a cache opened in write-back mode back to the image
+ * chain, oldest modifications first.
+ *
+ * @return  VBox status code.
+ * @return  VERR_VD_NOT_OPENED if no cache is opened in HDD container.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   cbDestage       Amount of dirty data to write back at most,
+ *                          UINT64_MAX to write back everything.
+ */
+VBOXDDU_DECL(int) VDCacheDestage(PVDISK pDisk, uint64_t cbDestage);
+
+/**
+ * Returns the amount of dirty data in the cache which was not written back
+ * to the image chain yet.
+ *
+ * @return  Amount of dirty data in bytes, 0 if no cache is opened.
+ * @param   pDisk           Pointer to HDD container.
+ */
+VBOXDDU_DECL(uint64_t) VDCacheGetDirtySize(PVDISK pDisk);
+
+/**
+ * Sets the amount of dirty data a cache opened in write-back mode may hold.
+ * VDWrite() writes the oldest data back once the limit is exceeded, users of
+ * the asynchronous interface have to call VDCacheDestage() themselves.
+ *
+ * @return  VBox status code.
+ * @return  VERR_VD_NOT_OPENED if no cache is opened in HDD container.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   cbDirtyMax      Amount of dirty data in bytes, 0 for no limit.
+ */
+VBOXDDU_DECL(int) VDCacheSetDirtyLimit(PVDISK pDisk, uint64_t cbDirtyMax);
+
 /**
  * Closes all opened image files in HDD container.
  *
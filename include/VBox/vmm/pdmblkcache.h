@@ -404,6 +404,23 @@ VMMR3DECL(int) PDMR3BlkCacheSuspend(PPDMBLKCACHE pBlkCache);
  */
 VMMR3DECL(int) PDMR3BlkCacheResume(PPDMBLKCACHE pBlkCache);
 
+/**
+ * Configures read ahead for the given block cache.
+ *
+ * Sequential read streams are detected per block cache and the data following
+ * the stream is fetched into the cache asynchronously with a window growing up
+ * to the given maximum.
+ *
+ * @returns VBox status code.
+ * @param   pBlkCache       The cache instance.
+ * @param   cbReadAheadMax  Maximum size of the read ahead window in bytes,
+ *                          0 disables read ahead and UINT32_MAX keeps the
+ *                          default configured for the VM.
+ * @param   cbMedium        Size of the medium in bytes, read ahead never goes
+ *                          beyond it. UINT64_MAX if unknown.
+ */
+VMMR3DECL(int) PDMR3BlkCacheSetReadAhead(PPDMBLKCACHE pBlkCache, uint32_t cbReadAheadMax, uint64_t cbMedium);
+
 /**
  * Clears the block cache and removes all entries.
  *
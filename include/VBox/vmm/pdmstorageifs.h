@@ -712,6 +712,30 @@ typedef struct PDMIMEDIAEXPORT
     DECLR3CALLBACKMEMBER(int, pfnIoReqQueryBuf, (PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
                                                  void *pvIoReqAlloc, void **ppvBuf, size_t *pcbBuf));
 
+    /**
+     * Queries the memory buffer of the whole request from the drive/device above as
+     * a list of mapped segments.
+     *
+     * @returns VBox status code.
+     * @retval  VERR_NOT_SUPPORTED if this is not supported for this request.
+     * @retval  VERR_BUFFER_OVERFLOW if the buffer consists of more segments than
+     *          @a paSegs can hold.
+     * @param   pInterface      Pointer to the interface structure containing the called function pointer.
+     * @param   hIoReq          The I/O request handle.
+     * @param   pvIoReqAlloc    The allocator specific memory for this request.
+     * @param   paSegs          Where to store the segments on success.
+     * @param   pcSegs          On input the number of entries in @a paSegs,
+     *                          on success the number of segments stored.
+     *
+     * @note Optional like PDMIMEDIAEXPORT::pfnIoReqQueryBuf, with the same fallback.
+     *       The segments stay valid until the request completes, the entity
+     *       implementing this interface releases them then.  Callers can only
+     *       use segments aligned on 512 byte sectors, so an unaligned buffer
+     *       should be refused with VERR_NOT_SUPPORTED before mapping anything.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnIoReqQuerySgBuf, (PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                   void *pvIoReqAlloc, PRTSGSEG paSegs, unsigned *pcSegs));
+
     /**
      * Queries the specified amount of ranges to discard from the callee for the given I/O request.
      *
@@ -752,7 +776,7 @@ typedef struct PDMIMEDIAEXPORT
 } PDMIMEDIAEXPORT;
 
 /** PDMIMEDIAAEXPORT interface ID. */
-#define PDMIMEDIAEXPORT_IID                  "0ae2e534-6c28-41d6-9a88-7f88f2cb2ff8"
+#define PDMIMEDIAEXPORT_IID                  "a8e7ac3e-7b0d-4a5f-9c53-1f2e64b0d8c7"
 
 
 /** Pointer to an extended media interface. */
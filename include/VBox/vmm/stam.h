@@ -164,6 +164,8 @@ typedef enum STAMTYPE
     STAMTYPE_BOOL,
     /** Generic boolean value. Reset to false. */
     STAMTYPE_BOOL_RESET,
+    /** Log2 histogram of sample values, STAMHISTOGRAM. */
+    STAMTYPE_HISTOGRAM,
     /** The end (exclusive). */
     STAMTYPE_END
 } STAMTYPE;
@@ -1166,6 +1168,276 @@ typedef STAMRATIOU32 *PSTAMRATIOU32;
 typedef const STAMRATIOU32 *PCSTAMRATIOU32;
 
 
+/** Number of buckets in a STAMHISTOGRAM sample.
+ * Bucket 0 counts zero values, bucket @a i counts values in the range
+ * [2^(i-1), 2^i), and the last bucket also takes everything above that. */
+#define STAM_HISTOGRAM_BUCKETS      40
+
+/**
+ * Log2 histogram sample - STAMTYPE_HISTOGRAM.
+ *
+ * Unlike STAMPROFILE this keeps the shape of the distribution, so the tail
+ * (p99, p999) of exit handling, I/O requests and such can be read out without
+ * external tracing.  The resolution is one power of two, which is plenty for
+ * spotting outliers.
+ *
+ * @remark  The recording macros use ASMBitLastSetU64, so iprt/asm.h must be
+ *          included by the user.
+ */
+typedef struct STAMHISTOGRAM
+{
+    /** Number of samples. */
+    volatile uint64_t   cSamples;
+    /** Sum of all sample values. */
+    volatile uint64_t   cTotal;
+    /** The largest sample value. */
+    volatile uint64_t   cMax;
+    /** The buckets, see STAM_HISTOGRAM_BUCKETS. */
+    volatile uint64_t   acBuckets[STAM_HISTOGRAM_BUCKETS];
+} STAMHISTOGRAM;
+/** Pointer to a histogram sample. */
+typedef STAMHISTOGRAM *PSTAMHISTOGRAM;
+/** Pointer to a const histogram sample. */
+typedef const STAMHISTOGRAM *PCSTAMHISTOGRAM;
+
+
+/** @def STAM_REL_HISTOGRAM_ADD
+ * Adds a value to the histogram.
+ *
+ * @param   pHistogram      Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   uValue          The value (ticks, nanoseconds, bytes, ...) to add.
+ *                          This is only referenced once.
+ */
+#ifndef VBOX_WITHOUT_RELEASE_STATISTICS
+# define STAM_REL_HISTOGRAM_ADD(pHistogram, uValue) \
+    do { \
+        uint64_t const StamPrefix_uValue = (uValue); \
+        unsigned       StamPrefix_iBucket = ASMBitLastSetU64(StamPrefix_uValue); \
+        if (StamPrefix_iBucket >= STAM_HISTOGRAM_BUCKETS) \
+            StamPrefix_iBucket = STAM_HISTOGRAM_BUCKETS - 1; \
+        (pHistogram)->acBuckets[StamPrefix_iBucket]++; \
+        (pHistogram)->cTotal += StamPrefix_uValue; \
+        (pHistogram)->cSamples++; \
+        if ((pHistogram)->cMax < StamPrefix_uValue) \
+            (pHistogram)->cMax = StamPrefix_uValue; \
+    } while (0)
+#else
+# define STAM_REL_HISTOGRAM_ADD(pHistogram, uValue) do { } while (0)
+#endif
+/** @def STAM_HISTOGRAM_ADD
+ * Adds a value to the histogram.
+ *
+ * @param   pHistogram      Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   uValue          The value (ticks, nanoseconds, bytes, ...) to add.
+ *                          This is only referenced once.
+ */
+#ifdef VBOX_WITH_STATISTICS
+# define STAM_HISTOGRAM_ADD(pHistogram, uValue) STAM_REL_HISTOGRAM_ADD(pHistogram, uValue)
+#else
+# define STAM_HISTOGRAM_ADD(pHistogram, uValue) do { } while (0)
+#endif
+
+
+/** @def STAM_REL_HISTOGRAM_START
+ * Samples the start time of a period to be added to a histogram.
+ *
+ * @param   pHistogram  Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   Prefix      Identifier prefix used to internal variables.
+ *
+ * @remarks Declears a stack variable that will be used by related macros.
+ */
+#ifndef VBOX_WITHOUT_RELEASE_STATISTICS
+# define STAM_REL_HISTOGRAM_START(pHistogram, Prefix) \
+    uint64_t Prefix##_tsStart; \
+    STAM_GET_TS(Prefix##_tsStart)
+#else
+# define STAM_REL_HISTOGRAM_START(pHistogram, Prefix) do { } while (0)
+#endif
+/** @def STAM_HISTOGRAM_START
+ * Samples the start time of a period to be added to a histogram.
+ *
+ * @param   pHistogram  Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   Prefix      Identifier prefix used to internal variables.
+ *
+ * @remarks Declears a stack variable that will be used by related macros.
+ */
+#ifdef VBOX_WITH_STATISTICS
+# define STAM_HISTOGRAM_START(pHistogram, Prefix) STAM_REL_HISTOGRAM_START(pHistogram, Prefix)
+#else
+# define STAM_HISTOGRAM_START(pHistogram, Prefix) do { } while (0)
+#endif
+
+
+/** @def STAM_REL_HISTOGRAM_STOP
+ * Samples the stop time of a period and adds the elapsed ticks to the
+ * histogram.
+ *
+ * @param   pHistogram  Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   Prefix      Identifier prefix used to internal variables.
+ */
+#ifndef VBOX_WITHOUT_RELEASE_STATISTICS
+# define STAM_REL_HISTOGRAM_STOP(pHistogram, Prefix) \
+    do { \
+        uint64_t Prefix##_cTicks; \
+        STAM_GET_TS(Prefix##_cTicks); \
+        STAM_REL_HISTOGRAM_ADD(pHistogram, Prefix##_cTicks - Prefix##_tsStart); \
+    } while (0)
+#else
+# define STAM_REL_HISTOGRAM_STOP(pHistogram, Prefix) do { } while (0)
+#endif
+/** @def STAM_HISTOGRAM_STOP
+ * Samples the stop time of a period and adds the elapsed ticks to the
+ * histogram.
+ *
+ * @param   pHistogram  Pointer to the STAMHISTOGRAM structure to operate on.
+ * @param   Prefix      Identifier prefix used to internal variables.
+ */
+#ifdef VBOX_WITH_STATISTICS
+# define STAM_HISTOGRAM_STOP(pHistogram, Prefix) STAM_REL_HISTOGRAM_STOP(pHistogram, Prefix)
+#else
+# define STAM_HISTOGRAM_STOP(pHistogram, Prefix) do { } while (0)
+#endif
+
+
+/**
+ * Calculates an upper bound for the given percentile of a histogram sample.
+ *
+ * @returns The upper bound of the bucket holding the percentile, clipped to
+ *          the largest value seen.  0 if there are no samples.
+ * @param   pHistogram  The histogram sample.
+ * @param   uPerMille   The percentile in 1/1000 units, e.g. 990 for p99 and
+ *                      999 for p999.
+ */
+DECLINLINE(uint64_t) STAMHistogramPercentile(PCSTAMHISTOGRAM pHistogram, uint32_t uPerMille)
+{
+    uint64_t cSamples = 0;
+    uint64_t cBuckets = 0;
+    unsigned i;
+    for (i = 0; i < STAM_HISTOGRAM_BUCKETS; i++)
+        cSamples += pHistogram->acBuckets[i];
+    if (!cSamples)
+        return 0;
+
+    /* The rank of the percentile sample, rounding up. */
+    cSamples = cSamples / 1000 * uPerMille + ((cSamples % 1000) * uPerMille + 999) / 1000;
+    for (i = 0; i < STAM_HISTOGRAM_BUCKETS - 1; i++)
+    {
+        cBuckets += pHistogram->acBuckets[i];
+        if (cBuckets >= cSamples)
+        {
+            uint64_t const uUpper = i ? (UINT64_C(1) << i) - 1 : 0;
+            return RT_MIN(uUpper, pHistogram->cMax);
+        }
+    }
+    return pHistogram->cMax;
+}
+
+
+
+
+/** @defgroup grp_stam_export   The STAM Binary Export
+ *
+ * When the "/STAM/ExportName" CFGM key is set, STAM publishes the registered
+ * samples in a shared memory object (RTShMem) of that name and refreshes the
+ * values every "/STAM/ExportIntervalMs" milliseconds from a background thread.
+ * External monitoring can map the object read-only and scrape all the
+ * statistics without calling into the VM process.
+ *
+ * The object starts with a STAMEXPORTHDR, followed by the sample table
+ * (STAMEXPORTSAMPLE), the value array (uint64_t) and the string table.  The
+ * header's uSeqNo works as a sequence lock: it is odd while the VM process
+ * updates the object.  A reader copies what it needs, and retries if uSeqNo
+ * was odd or changed in the meantime.  uGeneration changes whenever the
+ * sample table and strings are rewritten, so readers only need to reparse
+ * the names when it changes.
+ *
+ * Callback samples are not exported.
+ *
+ * @{
+ */
+
+/** Magic value of STAMEXPORTHDR::u32Magic (Ada Lovelace). */
+#define STAMEXPORTHDR_MAGIC             UINT32_C(0x18151210)
+/** The current layout version (STAMEXPORTHDR::u32Version). */
+#define STAMEXPORTHDR_VERSION           UINT32_C(0x00010000)
+/** STAMEXPORTHDR::fFlags: Not all samples fit into the shared memory object. */
+#define STAMEXPORTHDR_F_TRUNCATED       RT_BIT_32(0)
+
+/**
+ * The header of the shared memory object.
+ */
+typedef struct STAMEXPORTHDR
+{
+    /** STAMEXPORTHDR_MAGIC. */
+    uint32_t            u32Magic;
+    /** STAMEXPORTHDR_VERSION. */
+    uint32_t            u32Version;
+    /** The size of the shared memory object. */
+    uint64_t            cbShMem;
+    /** Sequence number, odd while the object is being updated. */
+    volatile uint64_t   uSeqNo;
+    /** The sample table generation. */
+    uint64_t            uGeneration;
+    /** Time of the last update (RTTimeNow, nanoseconds since the epoch). */
+    int64_t             nsTimestamp;
+    /** The update interval in milliseconds. */
+    uint32_t            cMsInterval;
+    /** STAMEXPORTHDR_F_XXX. */
+    uint32_t            fFlags;
+    /** Number of entries in the sample table. */
+    uint32_t            cSamples;
+    /** Offset of the sample table. */
+    uint32_t            offSamples;
+    /** Number of entries in the value array. */
+    uint32_t            cValues;
+    /** Offset of the value array. */
+    uint32_t            offValues;
+    /** Size of the string table. */
+    uint32_t            cbStrings;
+    /** Offset of the string table. */
+    uint32_t            offStrings;
+} STAMEXPORTHDR;
+/** Pointer to the export header. */
+typedef STAMEXPORTHDR *PSTAMEXPORTHDR;
+/** Pointer to the const export header. */
+typedef const STAMEXPORTHDR *PCSTAMEXPORTHDR;
+
+/**
+ * A sample table entry.
+ *
+ * The values are stored as uint64_t, one per field, in this order:
+ *      - STAMTYPE_COUNTER: c.
+ *      - STAMTYPE_PROFILE, STAMTYPE_PROFILE_ADV: cPeriods, cTicks, cTicksMin,
+ *        cTicksMax.
+ *      - STAMTYPE_RATIO_U32, STAMTYPE_RATIO_U32_RESET: u32A, u32B.
+ *      - STAMTYPE_HISTOGRAM: cSamples, cTotal, cMax, acBuckets[].
+ *      - The integer and boolean types: the value.
+ */
+typedef struct STAMEXPORTSAMPLE
+{
+    /** Offset of the sample name into the string table. */
+    uint32_t            offName;
+    /** Offset of the description into the string table, UINT32_MAX if none. */
+    uint32_t            offDesc;
+    /** Offset of the unit string into the string table. */
+    uint32_t            offUnit;
+    /** Index of the first value in the value array. */
+    uint32_t            iValue;
+    /** The sample type (STAMTYPE). */
+    uint8_t             enmType;
+    /** The number of values. */
+    uint8_t             cValues;
+    /** The unit (STAMUNIT). */
+    uint16_t            enmUnit;
+    /** Reserved, zero. */
+    uint32_t            u32Reserved;
+} STAMEXPORTSAMPLE;
+/** Pointer to a sample table entry. */
+typedef STAMEXPORTSAMPLE *PSTAMEXPORTSAMPLE;
+/** Pointer to a const sample table entry. */
+typedef const STAMEXPORTSAMPLE *PCSTAMEXPORTSAMPLE;
+
+/** @} */
 
 
 /** @defgroup grp_stam_r3   The STAM Host Context Ring 3 API
@@ -1174,6 +1446,8 @@ typedef const STAMRATIOU32 *PCSTAMRATIOU32;
 
 VMMR3DECL(int)  STAMR3InitUVM(PUVM pUVM);
 VMMR3DECL(void) STAMR3TermUVM(PUVM pUVM);
+VMMR3_INT_DECL(int) STAMR3InitCompleted(PVM pVM);
+VMMR3_INT_DECL(void) STAMR3Term(PVM pVM);
 VMMR3DECL(int)  STAMR3RegisterU(PUVM pUVM, void *pvSample, STAMTYPE enmType, STAMVISIBILITY enmVisibility,
                                 const char *pszName, STAMUNIT enmUnit, const char *pszDesc);
 VMMR3DECL(int)  STAMR3Register(PVM pVM, void *pvSample, STAMTYPE enmType, STAMVISIBILITY enmVisibility,
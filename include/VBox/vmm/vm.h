@@ -1350,7 +1350,7 @@ typedef struct VM
 #ifdef VMM_INCLUDED_SRC_include_TMInternal_h
         struct TM   s;
 #endif
-        uint8_t     padding[7872];      /* multiple of 64 */
+        uint8_t     padding[7936];      /* multiple of 64 */
     } tm;
 
     /** DBGF part. */
@@ -1395,7 +1395,7 @@ typedef struct VM
 #ifdef VMM_INCLUDED_SRC_include_SSMInternal_h
         struct SSM  s;
 #endif
-        uint8_t     padding[128];       /* multiple of 64 */
+        uint8_t     padding[256];       /* multiple of 64 */
     } ssm;
 
     union
@@ -1449,7 +1449,7 @@ typedef struct VM
     } R0Stats;
 
     /** Padding for aligning the structure size on a page boundrary. */
-    uint8_t         abAlignment2[4504 - sizeof(PVMCPUR3) * VMM_MAX_CPU_COUNT];
+    uint8_t         abAlignment2[4312 - sizeof(PVMCPUR3) * VMM_MAX_CPU_COUNT];
 
     /* ---- end small stuff ---- */
 
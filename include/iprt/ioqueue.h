@@ -243,6 +243,16 @@ typedef RTIOQUEUEPROVVTABLE const *PCRTIOQUEUEPROVVTABLE;
 /** @}  */
 
 
+/** @name RTIoQueueCreate() flags
+ * @{ */
+/** Hint to the provider to let the host poll the submission queue, saving a
+ * system call for each commit if supported (ignored by providers which don't). */
+#define RTIOQUEUE_F_POLL_SQ                 RT_BIT_32(0)
+/** Mask of the valid I/O queue creation flags. */
+#define RTIOQUEUE_F_VALID_MASK              UINT32_C(0x00000001)
+/** @}  */
+
+
 /**
  * Tries to return the best I/O queue provider for the given handle type on the called
  * host system.
@@ -270,7 +280,7 @@ RTDECL(PCRTIOQUEUEPROVVTABLE) RTIoQueueProviderGetById(const char *pszId);
  * @returns IPRT status code.
  * @param   phIoQueue           Where to store the handle to the I/O queue on success.
  * @param   pProvVTable         The I/O queue provider vtable which will process the requests.
- * @param   fFlags              Flags for the queue (MBZ for now).
+ * @param   fFlags              Flags for the queue, RTIOQUEUE_F_XXX.
  * @param   cSqEntries          Number of entries for the submission queue.
  * @param   cCqEntries          Number of entries for the completion queue.
  *
@@ -468,6 +468,10 @@ typedef enum RTLOGDEST
     /** Delay opening the log file, logging to the buffer untill
      * RTLogClearFileDelayFlag is called. */
     RTLOGDEST_F_DELAY_FILE  = 0x00020000,
+    /** Hand file output to a writer thread instead of writing it on the logging
+     * thread (ring-3 only).  Output is dropped (and accounted for) rather than
+     * blocking the caller when the writer falls behind. */
+    RTLOGDEST_F_ASYNC       = 0x00040000,
     /** Don't allow changes to the filename or mode of opening it. */
     RTLOGDEST_FIXED_FILE    = 0x01000000,
     /** Don't allow changing the directory. */
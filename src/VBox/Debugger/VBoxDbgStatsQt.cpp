@@ -46,7 +46,7 @@
 *   Defined Constants And Macros                                                                                                 *
 *********************************************************************************************************************************/
 /** The number of column. */
-#define DBGGUI_STATS_COLUMNS    9
+#define DBGGUI_STATS_COLUMNS    11
 
 
 /*********************************************************************************************************************************
@@ -117,6 +117,17 @@ typedef struct DBGGUISTATSNODE
         STAMPROFILEADV      ProfileAdv;
         /** STAMTYPE_RATIO_U32. */
         STAMRATIOU32        RatioU32;
+        /** STAMTYPE_HISTOGRAM.
+         * Only the summary is kept, the buckets would bloat every node. */
+        struct
+        {
+            uint64_t        cSamples;
+            uint64_t        cTotal;
+            uint64_t        cMax;
+            uint64_t        uP50;
+            uint64_t        uP99;
+            uint64_t        uP999;
+        }                   Histogram;
         /** STAMTYPE_U8 & STAMTYPE_U8_RESET. */
         uint8_t             u8;
         /** STAMTYPE_U16 & STAMTYPE_U16_RESET. */
@@ -505,6 +516,8 @@ protected:
     static QString strAvgValue(PCDBGGUISTATSNODE pNode);
     /** Gets the maximum value. */
     static QString strMaxValue(PCDBGGUISTATSNODE pNode);
+    /** Gets a percentile value (histograms only). */
+    static QString strPercentileValue(PCDBGGUISTATSNODE pNode, bool fP999);
     /** Gets the total value. */
     static QString strTotalValue(PCDBGGUISTATSNODE pNode);
     /** Gets the delta value. */
@@ -591,6 +604,20 @@ protected:
 *********************************************************************************************************************************/
 
 
+/**
+ * Copies the summary of a histogram sample into a node.
+ */
+static void summarizeHistogram(PDBGGUISTATSNODE pNode, PCSTAMHISTOGRAM pHistogram)
+{
+    pNode->Data.Histogram.cSamples = pHistogram->cSamples;
+    pNode->Data.Histogram.cTotal   = pHistogram->cTotal;
+    pNode->Data.Histogram.cMax     = pHistogram->cMax;
+    pNode->Data.Histogram.uP50     = STAMHistogramPercentile(pHistogram, 500);
+    pNode->Data.Histogram.uP99     = STAMHistogramPercentile(pHistogram, 990);
+    pNode->Data.Histogram.uP999    = STAMHistogramPercentile(pHistogram, 999);
+}
+
+
 /**
  * Formats a number into a 64-byte buffer.
  */
@@ -1059,6 +1086,10 @@ VBoxDbgStatsModel::initNode(PDBGGUISTATSNODE pNode, STAMTYPE enmType, void *pvSa
             pNode->Data.Profile = *(PSTAMPROFILE)pvSample;
             break;
 
+        case STAMTYPE_HISTOGRAM:
+            summarizeHistogram(pNode, (PCSTAMHISTOGRAM)pvSample);
+            break;
+
         case STAMTYPE_RATIO_U32:
         case STAMTYPE_RATIO_U32_RESET:
             pNode->Data.RatioU32 = *(PSTAMRATIOU32)pvSample;
@@ -1166,6 +1197,19 @@ VBoxDbgStatsModel::updateNode(PDBGGUISTATSNODE pNode, STAMTYPE enmType, void *pv
                 break;
             }
 
+            case STAMTYPE_HISTOGRAM:
+            {
+                uint64_t cPrevSamples = pNode->Data.Histogram.cSamples;
+                summarizeHistogram(pNode, (PCSTAMHISTOGRAM)pvSample);
+                iDelta = pNode->Data.Histogram.cSamples - cPrevSamples;
+                if (iDelta || pNode->i64Delta)
+                {
+                    pNode->i64Delta = iDelta;
+                    pNode->enmState = kDbgGuiStatsNodeState_kRefresh;
+                }
+                break;
+            }
+
             case STAMTYPE_RATIO_U32:
             case STAMTYPE_RATIO_U32_RESET:
             {
@@ -2113,11 +2157,13 @@ VBoxDbgStatsModel::headerData(int a_iSection, Qt::Orientation a_eOrientation, in
             case 3: return tr("Min");
             case 4: return tr("Average");
             case 5: return tr("Max");
-            case 6: return tr("Total");
-            case 7: return tr("dInt");
-            case 8: return tr("Description");
+            case 6: return tr("p99");
+            case 7: return tr("p999");
+            case 8: return tr("Total");
+            case 9: return tr("dInt");
+            case 10: return tr("Description");
             default:
-                AssertCompile(DBGGUI_STATS_COLUMNS == 9);
+                AssertCompile(DBGGUI_STATS_COLUMNS == 11);
                 return QVariant(); /* bug */
         }
     else if (   a_eOrientation == Qt::Horizontal
@@ -2133,11 +2179,13 @@ VBoxDbgStatsModel::headerData(int a_iSection, Qt::Orientation a_eOrientation, in
             case 5:
             case 6:
             case 7:
-                return (int)(Qt::AlignRight | Qt::AlignVCenter);
             case 8:
+            case 9:
+                return (int)(Qt::AlignRight | Qt::AlignVCenter);
+            case 10:
                 return QVariant();
             default:
-                AssertCompile(DBGGUI_STATS_COLUMNS == 9);
+                AssertCompile(DBGGUI_STATS_COLUMNS == 11);
                 return QVariant(); /* bug */
         }
 
@@ -2170,6 +2218,9 @@ VBoxDbgStatsModel::strValueTimes(PCDBGGUISTATSNODE pNode)
                 return "0";
             return formatNumber(sz, pNode->Data.Profile.cPeriods);
 
+        case STAMTYPE_HISTOGRAM:
+            return formatNumber(sz, pNode->Data.Histogram.cSamples);
+
         case STAMTYPE_RATIO_U32:
         case STAMTYPE_RATIO_U32_RESET:
         {
@@ -2260,6 +2311,10 @@ VBoxDbgStatsModel::strAvgValue(PCDBGGUISTATSNODE pNode)
             if (!pNode->Data.Profile.cPeriods)
                 return "0";
             return formatNumber(sz, pNode->Data.Profile.cTicks / pNode->Data.Profile.cPeriods);
+        case STAMTYPE_HISTOGRAM:
+            if (!pNode->Data.Histogram.cSamples)
+                return "0";
+            return formatNumber(sz, pNode->Data.Histogram.cTotal / pNode->Data.Histogram.cSamples);
         default:
             return "";
     }
@@ -2278,6 +2333,23 @@ VBoxDbgStatsModel::strMaxValue(PCDBGGUISTATSNODE pNode)
             if (!pNode->Data.Profile.cPeriods)
                 return "0";
             return formatNumber(sz, pNode->Data.Profile.cTicksMax);
+        case STAMTYPE_HISTOGRAM:
+            return formatNumber(sz, pNode->Data.Histogram.cMax);
+        default:
+            return "";
+    }
+}
+
+
+/*static*/ QString
+VBoxDbgStatsModel::strPercentileValue(PCDBGGUISTATSNODE pNode, bool fP999)
+{
+    char sz[128];
+
+    switch (pNode->enmType)
+    {
+        case STAMTYPE_HISTOGRAM:
+            return formatNumber(sz, fP999 ? pNode->Data.Histogram.uP999 : pNode->Data.Histogram.uP99);
         default:
             return "";
     }
@@ -2296,6 +2368,8 @@ VBoxDbgStatsModel::strTotalValue(PCDBGGUISTATSNODE pNode)
             if (!pNode->Data.Profile.cPeriods)
                 return "0";
             return formatNumber(sz, pNode->Data.Profile.cTicks);
+        case STAMTYPE_HISTOGRAM:
+            return formatNumber(sz, pNode->Data.Histogram.cTotal);
         default:
             return "";
     }
@@ -2314,6 +2388,7 @@ VBoxDbgStatsModel::strDeltaValue(PCDBGGUISTATSNODE pNode)
             if (!pNode->Data.Profile.cPeriods)
                 return "0";
             RT_FALL_THRU();
+        case STAMTYPE_HISTOGRAM:
         case STAMTYPE_COUNTER:
         case STAMTYPE_RATIO_U32:
         case STAMTYPE_RATIO_U32_RESET:
@@ -2370,13 +2445,17 @@ VBoxDbgStatsModel::data(const QModelIndex &a_rIndex, int a_eRole) const
             case 5:
                 return strMaxValue(pNode);
             case 6:
-                return strTotalValue(pNode);
+                return strPercentileValue(pNode, false /*fP999*/);
             case 7:
-                return strDeltaValue(pNode);
+                return strPercentileValue(pNode, true /*fP999*/);
             case 8:
+                return strTotalValue(pNode);
+            case 9:
+                return strDeltaValue(pNode);
+            case 10:
                 return pNode->pDescStr ? QString(*pNode->pDescStr) : QString("");
             default:
-                AssertCompile(DBGGUI_STATS_COLUMNS == 9);
+                AssertCompile(DBGGUI_STATS_COLUMNS == 11);
                 return QVariant();
         }
     }
@@ -2392,11 +2471,13 @@ VBoxDbgStatsModel::data(const QModelIndex &a_rIndex, int a_eRole) const
             case 5:
             case 6:
             case 7:
-                return (int)(Qt::AlignRight | Qt::AlignVCenter);
             case 8:
+            case 9:
+                return (int)(Qt::AlignRight | Qt::AlignVCenter);
+            case 10:
                 return QVariant();
             default:
-                AssertCompile(DBGGUI_STATS_COLUMNS == 9);
+                AssertCompile(DBGGUI_STATS_COLUMNS == 11);
                 return QVariant(); /* bug */
         }
     return QVariant();
@@ -2444,6 +2525,17 @@ VBoxDbgStatsModel::stringifyNodeNoRecursion(PDBGGUISTATSNODE a_pNode, QString &a
             break;
         }
 
+        case STAMTYPE_HISTOGRAM:
+        {
+            uint64_t u64 = a_pNode->Data.Histogram.cSamples ? a_pNode->Data.Histogram.cSamples : 1;
+            RTStrPrintf(szBuf, sizeof(szBuf),
+                        "%8llu %s (%7llu times, p50 %7llu, p99 %9llu, p999 %9llu, max %9llu)",
+                        a_pNode->Data.Histogram.cTotal / u64, STAMR3GetUnit(a_pNode->enmUnit),
+                        a_pNode->Data.Histogram.cSamples, a_pNode->Data.Histogram.uP50, a_pNode->Data.Histogram.uP99,
+                        a_pNode->Data.Histogram.uP999, a_pNode->Data.Histogram.cMax);
+            break;
+        }
+
         case STAMTYPE_RATIO_U32:
         case STAMTYPE_RATIO_U32_RESET:
             RTStrPrintf(szBuf, sizeof(szBuf),
@@ -2860,11 +2952,11 @@ VBoxDbgStatsView::updateStats(const QString &rPatStr)
 void
 VBoxDbgStatsView::resizeColumnsToContent()
 {
-    for (int i = 0; i <= 8; i++)
+    for (int i = 0; i <= 10; i++)
     {
         resizeColumnToContents(i);
-        /* Some extra room for distinguishing numbers better in Value, Min, Avg, Max, Total, dInt columns. */
-        if (i >= 2 && i <= 7)
+        /* Some extra room for distinguishing numbers better in Value, Min, Avg, Max, p99, p999, Total, dInt columns. */
+        if (i >= 2 && i <= 9)
             setColumnWidth(i, columnWidth(i) + 10);
     }
 }
@@ -0,0 +1,527 @@
+/* $Id: AudioMixBuffer-Simd.cpp.h $ */
+/** @file
+ * Audio mixing buffer - SSE2 and AVX2 kernels.
+ *
+ * Included by AudioMixBuffer.cpp.  All kernels here must produce bit for bit
+ * the same results as the generic C code they replace, tstAudioMixBuffer
+ * checks this.
+ */
+
+/*
+ * Copyright (C) 2014-2021 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*
+ * We use function level target attributes with gcc and clang so that the
+ * rest of the file is still compiled for the baseline instruction set.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+# define AUDIOMIXBUF_SSE2_FN(a_RetType)     static __attribute__((__target__("sse2"))) a_RetType
+# define AUDIOMIXBUF_AVX2_FN(a_RetType)     static __attribute__((__target__("avx2"))) a_RetType
+#else
+# define AUDIOMIXBUF_SSE2_FN(a_RetType)     static a_RetType
+# define AUDIOMIXBUF_AVX2_FN(a_RetType)     static a_RetType
+#endif
+
+
+/**
+ * Works out the best kernel set supported by the host CPU and OS.
+ */
+static AUDIOMIXBUFSIMD audioMixBufSimdDetect(void)
+{
+    AUDIOMIXBUFSIMD enmSimd = AUDIOMIXBUFSIMD_NONE;
+#ifdef RT_ARCH_X86
+    if (!ASMHasCpuId())
+        return enmSimd;
+#endif
+    uint32_t uEAX, uEBX, uECX, uEDX;
+    ASMCpuId(0, &uEAX, &uEBX, &uECX, &uEDX);
+    uint32_t const uMaxLeaf = uEAX;
+    if (!ASMIsValidStdRange(uMaxLeaf))
+        return enmSimd;
+
+    ASMCpuId(1, &uEAX, &uEBX, &uECX, &uEDX);
+#ifdef AUDIOMIXBUF_WITH_SSE2
+    if (uEDX & X86_CPUID_FEATURE_EDX_SSE2)
+        enmSimd = AUDIOMIXBUFSIMD_SSE2;
+#endif
+#ifdef AUDIOMIXBUF_WITH_AVX2
+    /* AVX2 needs the OS to save the YMM state as well, so check XCR0. */
+    if (   enmSimd == AUDIOMIXBUFSIMD_SSE2
+        && uMaxLeaf >= 7
+        && (uECX & (X86_CPUID_FEATURE_ECX_OSXSAVE | X86_CPUID_FEATURE_ECX_AVX))
+           == (X86_CPUID_FEATURE_ECX_OSXSAVE | X86_CPUID_FEATURE_ECX_AVX)
+        && (ASMGetXcr0() & (XSAVE_C_SSE | XSAVE_C_YMM)) == (XSAVE_C_SSE | XSAVE_C_YMM))
+    {
+        ASMCpuId_Idx_ECX(7, 0, &uEAX, &uEBX, &uECX, &uEDX);
+        if (uEBX & X86_CPUID_STEXT_FEATURE_EBX_AVX2)
+            enmSimd = AUDIOMIXBUFSIMD_AVX2;
+    }
+#endif
+    return enmSimd;
+}
+
+
+/*********************************************************************************************************************************
+*   SSE2                                                                                                                         *
+*********************************************************************************************************************************/
+#ifdef AUDIOMIXBUF_WITH_SSE2
+
+/**
+ * Multiplies the signed 32-bit values in the even lanes of @a s by the unsigned
+ * 32-bit values in the even lanes of @a f, giving two signed 64-bit results.
+ *
+ * SSE2 only has an unsigned 32x32->64 multiplication, so the product is
+ * corrected for negative values of @a s afterwards.
+ */
+AUDIOMIXBUF_SSE2_FN(__m128i) audioMixBufSse2MulS32U32(__m128i s, __m128i f)
+{
+    __m128i const uProd = _mm_mul_epu32(s, f);
+    __m128i const uCorr = _mm_slli_epi64(_mm_and_si128(_mm_srai_epi32(s, 31), f), 32);
+    return _mm_sub_epi64(uProd, uCorr);
+}
+
+
+/**
+ * Blends four samples, see audioMixBufBlendSample.
+ *
+ * The average is calculated as floor(a/2 + b/2) with a round towards zero
+ * correction so that it matches the 64-bit division of the C code.
+ */
+AUDIOMIXBUF_SSE2_FN(__m128i) audioMixBufSse2BlendSamples(__m128i uDst, __m128i uSrc)
+{
+    __m128i const uZero = _mm_setzero_si128();
+    __m128i const uOne  = _mm_set1_epi32(1);
+    __m128i const uFloor = _mm_add_epi32(_mm_add_epi32(_mm_srai_epi32(uDst, 1), _mm_srai_epi32(uSrc, 1)),
+                                         _mm_and_si128(_mm_and_si128(uDst, uSrc), uOne));
+    __m128i const uAvg   = _mm_add_epi32(uFloor, _mm_and_si128(_mm_and_si128(_mm_xor_si128(uDst, uSrc), uOne),
+                                                                _mm_srli_epi32(uFloor, 31)));
+    __m128i const fDstZero = _mm_cmpeq_epi32(uDst, uZero);
+    __m128i const fSrcZero = _mm_cmpeq_epi32(uSrc, uZero);
+    __m128i const uRet     = _mm_or_si128(_mm_and_si128(fDstZero, uSrc), _mm_andnot_si128(fDstZero, uAvg));
+    return _mm_or_si128(_mm_and_si128(fSrcZero, uDst), _mm_andnot_si128(fSrcZero, uRet));
+}
+
+
+/**
+ * SSE2 version of audioMixBufBlendBuffer, working on samples rather than frames.
+ */
+AUDIOMIXBUF_SSE2_FN(void) audioMixBufBlendBufferSse2(int32_t *pi32Dst, int32_t const *pi32Src, size_t cSamples)
+{
+    while (cSamples >= 4)
+    {
+        __m128i const uDst = _mm_loadu_si128((__m128i const *)pi32Dst);
+        __m128i const uSrc = _mm_loadu_si128((__m128i const *)pi32Src);
+        _mm_storeu_si128((__m128i *)pi32Dst, audioMixBufSse2BlendSamples(uDst, uSrc));
+        pi32Dst  += 4;
+        pi32Src  += 4;
+        cSamples -= 4;
+    }
+    while (cSamples-- > 0)
+        audioMixBufBlendSample(pi32Dst++, *pi32Src++);
+}
+
+
+/**
+ * SSE2 version of audioMixAdjustVolumeWorker.
+ *
+ * @param   pi32Samples The samples to adjust.
+ * @param   cSamples    Number of samples.
+ * @param   pauFactors  Four volume factors, repeating the per channel ones.
+ *                      The channel count must therefore divide four.
+ */
+AUDIOMIXBUF_SSE2_FN(void) audioMixBufAdjustVolumeSse2(int32_t *pi32Samples, size_t cSamples, uint32_t const *pauFactors)
+{
+    __m128i const uFactors = _mm_loadu_si128((__m128i const *)pauFactors);
+    __m128i const uFactorsOdd = _mm_srli_epi64(uFactors, 32);
+    __m128i const fLowDwords  = _mm_set_epi32(0, -1, 0, -1);
+    size_t i = 0;
+    for (; i + 4 <= cSamples; i += 4)
+    {
+        __m128i const uSamples = _mm_loadu_si128((__m128i const *)&pi32Samples[i]);
+        __m128i const uEven = audioMixBufSse2MulS32U32(uSamples, uFactors);
+        __m128i const uOdd  = audioMixBufSse2MulS32U32(_mm_srli_epi64(uSamples, 32), uFactorsOdd);
+        __m128i const uRet  = _mm_or_si128(_mm_and_si128(_mm_srli_epi64(uEven, AUDIOMIXBUF_VOL_SHIFT), fLowDwords),
+                                           _mm_slli_epi64(_mm_srli_epi64(uOdd, AUDIOMIXBUF_VOL_SHIFT), 32));
+        _mm_storeu_si128((__m128i *)&pi32Samples[i], uRet);
+    }
+    for (; i < cSamples; i++)
+        pi32Samples[i] = (int32_t)(ASMMult2xS32RetS64(pi32Samples[i], pauFactors[i & 3]) >> AUDIOMIXBUF_VOL_SHIFT);
+}
+
+
+/**
+ * Decodes signed 16-bit samples, see audioMixBufSampleFromS16.
+ */
+AUDIOMIXBUF_SSE2_FN(void) audioMixBufDecodeS16Sse2(int32_t *pi32Dst, int16_t const *pi16Src, size_t cSamples, bool fBlend)
+{
+    __m128i const uZero = _mm_setzero_si128();
+    while (cSamples >= 8)
+    {
+        __m128i const uSrc = _mm_loadu_si128((__m128i const *)pi16Src);
+        /* Interleaving with zero below puts each sample in the top half of a dword, i.e. shifts it left by 16. */
+        __m128i uLo = _mm_unpacklo_epi16(uZero, uSrc);
+        __m128i uHi = _mm_unpackhi_epi16(uZero, uSrc);
+        if (fBlend)
+        {
+            uLo = audioMixBufSse2BlendSamples(_mm_loadu_si128((__m128i const *)&pi32Dst[0]), uLo);
+            uHi = audioMixBufSse2BlendSamples(_mm_loadu_si128((__m128i const *)&pi32Dst[4]), uHi);
+        }
+        _mm_storeu_si128((__m128i *)&pi32Dst[0], uLo);
+        _mm_storeu_si128((__m128i *)&pi32Dst[4], uHi);
+        pi32Dst  += 8;
+        pi16Src  += 8;
+        cSamples -= 8;
+    }
+    while (cSamples-- > 0)
+    {
+        if (fBlend)
+            audioMixBufBlendSample(pi32Dst, audioMixBufSampleFromS16(*pi16Src));
+        else
+            *pi32Dst = audioMixBufSampleFromS16(*pi16Src);
+        pi32Dst++;
+        pi16Src++;
+    }
+}
+
+
+/**
+ * Encodes signed 16-bit samples, see audioMixBufSampleToS16.
+ */
+AUDIOMIXBUF_SSE2_FN(void) audioMixBufEncodeS16Sse2(int16_t *pi16Dst, int32_t const *pi32Src, size_t cSamples)
+{
+    while (cSamples >= 8)
+    {
+        /* The shifted values always fit, so the saturation of the pack never kicks in. */
+        __m128i const uLo = _mm_srai_epi32(_mm_loadu_si128((__m128i const *)&pi32Src[0]), 16);
+        __m128i const uHi = _mm_srai_epi32(_mm_loadu_si128((__m128i const *)&pi32Src[4]), 16);
+        _mm_storeu_si128((__m128i *)pi16Dst, _mm_packs_epi32(uLo, uHi));
+        pi16Dst  += 8;
+        pi32Src  += 8;
+        cSamples -= 8;
+    }
+    while (cSamples-- > 0)
+        *pi16Dst++ = audioMixBufSampleToS16(*pi32Src++);
+}
+
+
+#endif /* AUDIOMIXBUF_WITH_SSE2 */
+
+
+/*********************************************************************************************************************************
+*   AVX2                                                                                                                         *
+*********************************************************************************************************************************/
+#ifdef AUDIOMIXBUF_WITH_AVX2
+
+/** 256-bit version of audioMixBufSse2MulS32U32. */
+AUDIOMIXBUF_AVX2_FN(__m256i) audioMixBufAvx2MulS32U32(__m256i s, __m256i f)
+{
+    __m256i const uProd = _mm256_mul_epu32(s, f);
+    __m256i const uCorr = _mm256_slli_epi64(_mm256_and_si256(_mm256_srai_epi32(s, 31), f), 32);
+    return _mm256_sub_epi64(uProd, uCorr);
+}
+
+
+/** 256-bit version of audioMixBufSse2BlendSamples. */
+AUDIOMIXBUF_AVX2_FN(__m256i) audioMixBufAvx2BlendSamples(__m256i uDst, __m256i uSrc)
+{
+    __m256i const uZero = _mm256_setzero_si256();
+    __m256i const uOne  = _mm256_set1_epi32(1);
+    __m256i const uFloor = _mm256_add_epi32(_mm256_add_epi32(_mm256_srai_epi32(uDst, 1), _mm256_srai_epi32(uSrc, 1)),
+                                            _mm256_and_si256(_mm256_and_si256(uDst, uSrc), uOne));
+    __m256i const uAvg   = _mm256_add_epi32(uFloor, _mm256_and_si256(_mm256_and_si256(_mm256_xor_si256(uDst, uSrc), uOne),
+                                                                     _mm256_srli_epi32(uFloor, 31)));
+    __m256i const uRet   = _mm256_blendv_epi8(uAvg, uSrc, _mm256_cmpeq_epi32(uDst, uZero));
+    return _mm256_blendv_epi8(uRet, uDst, _mm256_cmpeq_epi32(uSrc, uZero));
+}
+
+
+/** AVX2 version of audioMixBufBlendBufferSse2. */
+AUDIOMIXBUF_AVX2_FN(void) audioMixBufBlendBufferAvx2(int32_t *pi32Dst, int32_t const *pi32Src, size_t cSamples)
+{
+    while (cSamples >= 8)
+    {
+        __m256i const uDst = _mm256_loadu_si256((__m256i const *)pi32Dst);
+        __m256i const uSrc = _mm256_loadu_si256((__m256i const *)pi32Src);
+        _mm256_storeu_si256((__m256i *)pi32Dst, audioMixBufAvx2BlendSamples(uDst, uSrc));
+        pi32Dst  += 8;
+        pi32Src  += 8;
+        cSamples -= 8;
+    }
+    while (cSamples-- > 0)
+        audioMixBufBlendSample(pi32Dst++, *pi32Src++);
+}
+
+
+/**
+ * AVX2 version of audioMixBufAdjustVolumeSse2, taking eight factors.
+ *
+ * The factors never exceed AUDIOMIXBUF_VOL_0DB, so the signed multiplication
+ * can be used directly.
+ */
+AUDIOMIXBUF_AVX2_FN(void) audioMixBufAdjustVolumeAvx2(int32_t *pi32Samples, size_t cSamples, uint32_t const *pauFactors)
+{
+    __m256i const uFactors    = _mm256_loadu_si256((__m256i const *)pauFactors);
+    __m256i const uFactorsOdd = _mm256_srli_epi64(uFactors, 32);
+    size_t i = 0;
+    for (; i + 8 <= cSamples; i += 8)
+    {
+        __m256i const uSamples = _mm256_loadu_si256((__m256i const *)&pi32Samples[i]);
+        __m256i const uEven = _mm256_mul_epi32(uSamples, uFactors);
+        __m256i const uOdd  = _mm256_mul_epi32(_mm256_srli_epi64(uSamples, 32), uFactorsOdd);
+        __m256i const uRet  = _mm256_blend_epi32(_mm256_srli_epi64(uEven, AUDIOMIXBUF_VOL_SHIFT),
+                                                 _mm256_slli_epi64(_mm256_srli_epi64(uOdd, AUDIOMIXBUF_VOL_SHIFT), 32), 0xaa);
+        _mm256_storeu_si256((__m256i *)&pi32Samples[i], uRet);
+    }
+    for (; i < cSamples; i++)
+        pi32Samples[i] = (int32_t)(ASMMult2xS32RetS64(pi32Samples[i], pauFactors[i & 7]) >> AUDIOMIXBUF_VOL_SHIFT);
+}
+
+
+/** AVX2 version of audioMixBufDecodeS16Sse2. */
+AUDIOMIXBUF_AVX2_FN(void) audioMixBufDecodeS16Avx2(int32_t *pi32Dst, int16_t const *pi16Src, size_t cSamples, bool fBlend)
+{
+    while (cSamples >= 8)
+    {
+        __m256i uSamples = _mm256_slli_epi32(_mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i const *)pi16Src)), 16);
+        if (fBlend)
+            uSamples = audioMixBufAvx2BlendSamples(_mm256_loadu_si256((__m256i const *)pi32Dst), uSamples);
+        _mm256_storeu_si256((__m256i *)pi32Dst, uSamples);
+        pi32Dst  += 8;
+        pi16Src  += 8;
+        cSamples -= 8;
+    }
+    while (cSamples-- > 0)
+    {
+        if (fBlend)
+            audioMixBufBlendSample(pi32Dst, audioMixBufSampleFromS16(*pi16Src));
+        else
+            *pi32Dst = audioMixBufSampleFromS16(*pi16Src);
+        pi32Dst++;
+        pi16Src++;
+    }
+}
+
+
+/** AVX2 version of audioMixBufEncodeS16Sse2. */
+AUDIOMIXBUF_AVX2_FN(void) audioMixBufEncodeS16Avx2(int16_t *pi16Dst, int32_t const *pi32Src, size_t cSamples)
+{
+    while (cSamples >= 16)
+    {
+        __m256i const uLo = _mm256_srai_epi32(_mm256_loadu_si256((__m256i const *)&pi32Src[0]), 16);
+        __m256i const uHi = _mm256_srai_epi32(_mm256_loadu_si256((__m256i const *)&pi32Src[8]), 16);
+        /* The pack works within 128-bit lanes, so put the quadwords back in order afterwards. */
+        _mm256_storeu_si256((__m256i *)pi16Dst, _mm256_permute4x64_epi64(_mm256_packs_epi32(uLo, uHi), 0xd8));
+        pi16Dst  += 16;
+        pi32Src  += 16;
+        cSamples -= 16;
+    }
+    while (cSamples-- > 0)
+        *pi16Dst++ = audioMixBufSampleToS16(*pi32Src++);
+}
+
+
+/**
+ * Interpolates four stereo frames, see INTERPOLATE_2CH.
+ *
+ * There is no SSE2 counterpart as emulating the signed multiplications there
+ * is no faster than the generic code.
+ *
+ * @returns The four interpolated frames.
+ * @param   uLast       The last source frames (c0, c1, c0, c1, ...).
+ * @param   uCur        The current source frames.
+ * @param   uFactorCur  The fractions (f0, f0, f1, f1, ...).
+ */
+AUDIOMIXBUF_AVX2_FN(__m256i) audioMixBufAvx2Interpolate2Ch(__m256i uLast, __m256i uCur, __m256i uFactorCur)
+{
+    __m256i const uZero = _mm256_setzero_si256();
+    /* The last factor is 4G - cur, which wraps to zero when cur is zero; that case is patched up at the end. */
+    __m256i const uFactorLast = _mm256_sub_epi32(uZero, uFactorCur);
+    __m256i const uEven = _mm256_add_epi64(audioMixBufAvx2MulS32U32(uLast, uFactorLast),
+                                           audioMixBufAvx2MulS32U32(uCur,  uFactorCur));
+    __m256i const uOdd  = _mm256_add_epi64(audioMixBufAvx2MulS32U32(_mm256_srli_epi64(uLast, 32),
+                                                                    _mm256_srli_epi64(uFactorLast, 32)),
+                                           audioMixBufAvx2MulS32U32(_mm256_srli_epi64(uCur, 32),
+                                                                    _mm256_srli_epi64(uFactorCur, 32)));
+    __m256i const uRet  = _mm256_blend_epi32(_mm256_srli_epi64(uEven, 32), uOdd, 0xaa);
+    return _mm256_blendv_epi8(uRet, uLast, _mm256_cmpeq_epi32(uFactorCur, uZero));
+}
+
+#endif /* AUDIOMIXBUF_WITH_AVX2 */
+
+
+/*********************************************************************************************************************************
+*   Stereo resampling                                                                                                            *
+*********************************************************************************************************************************/
+#ifdef AUDIOMIXBUF_WITH_AVX2
+
+/**
+ * Instantiates a stereo resampler interpolating @a a_cBlock destination frames
+ * at a time using @a a_Interpolate.
+ *
+ * The vectorized part only handles
+ * destination frames for which the generic code would interpolate between two
+ * frames inside the current source chunk, and leaves the edges to the generic
+ * code.  For each destination frame the generic code interpolates between the
+ * source frames at relative index idxLast and idxLast + 1, where idxLast is
+ * RT_HI_U32(offDst) - offSrc, provided that idxLast >= 0, or it is -1 and the
+ * previous source frame is still in the chunk (i.e. ai32LastFrame mirrors it).
+ */
+#define AUDIOMIXBUF_RESAMPLE_2CH_SIMD(a_Suffix, a_cBlock, a_Interpolate) \
+    /** @returns Number of destination frames written. */ \
+    static DECLCALLBACK(uint32_t) \
+    audioMixBufResample2Ch##a_Suffix(int32_t *pi32Dst, uint32_t cDstFrames, \
+                                     int32_t const *pi32Src, uint32_t cSrcFrames, uint32_t *pcSrcFramesRead, \
+                                     PAUDIOSTREAMRATE pRate) \
+    { \
+        Log5(("Src: %RU32 L %RU32;  Dst: %RU32 L%RU32; uDstInc=%#RX64\n", \
+              pRate->offSrc, cSrcFrames, RT_HI_U32(pRate->offDst), cDstFrames, pRate->uDstInc)); \
+        int32_t * const       pi32DstStart = pi32Dst; \
+        int32_t const * const pi32SrcStart = pi32Src; \
+        uint64_t const        uDstInc      = pRate->uDstInc; \
+        \
+        int32_t ai32LastFrame[2]; \
+        COPY_LAST_FRAME_2CH(ai32LastFrame, pRate->SrcLast.ai32Samples, 2); \
+        \
+        while (cDstFrames > 0 && cSrcFrames > 0) \
+        { \
+            /* Vectorized block? */ \
+            if (cDstFrames >= (a_cBlock)) \
+            { \
+                int32_t const idxLastFirst = (int32_t)(RT_HI_U32(pRate->offDst) - pRate->offSrc); \
+                int32_t const idxLastLast  = (int32_t)(RT_HI_U32(pRate->offDst + uDstInc * ((a_cBlock) - 1)) - pRate->offSrc); \
+                if (   (idxLastFirst >= 0 || (idxLastFirst == -1 && pi32Src != pi32SrcStart)) \
+                    && (uint32_t)(idxLastLast + 2) < cSrcFrames) \
+                { \
+                    a_Interpolate(pi32Dst, pi32Src, pRate->offDst, uDstInc, pRate->offSrc); \
+                    \
+                    uint32_t const cSrcAdvance = (uint32_t)(idxLastLast + 1); \
+                    if (cSrcAdvance > 0) \
+                    { \
+                        pRate->offSrc += cSrcAdvance; \
+                        cSrcFrames    -= cSrcAdvance; \
+                        pi32Src       += cSrcAdvance * 2; \
+                        COPY_LAST_FRAME_2CH(ai32LastFrame, &pi32Src[-2], 2); \
+                    } \
+                    pRate->offDst += uDstInc * (a_cBlock); \
+                    pi32Dst       += 2 * (a_cBlock); \
+                    cDstFrames    -= (a_cBlock); \
+                    continue; \
+                } \
+            } \
+            \
+            /* Same as audioMixBufResample2ChGeneric. */ \
+            int32_t const cSrcNeeded = RT_HI_U32(pRate->offDst) - pRate->offSrc + 1; \
+            if (cSrcNeeded > 0) \
+            { \
+                if ((uint32_t)cSrcNeeded + 1 < cSrcFrames) \
+                { \
+                    pRate->offSrc += (uint32_t)cSrcNeeded; \
+                    cSrcFrames    -= (uint32_t)cSrcNeeded; \
+                    pi32Src       += (uint32_t)cSrcNeeded * 2; \
+                    COPY_LAST_FRAME_2CH(ai32LastFrame, &pi32Src[-2], 2); \
+                } \
+                else \
+                { \
+                    pi32Src       += cSrcFrames * 2; \
+                    pRate->offSrc += cSrcFrames; \
+                    COPY_LAST_FRAME_2CH(pRate->SrcLast.ai32Samples, &pi32Src[-2], 2); \
+                    *pcSrcFramesRead = (pi32Src - pi32SrcStart) / 2; \
+                    return (pi32Dst - pi32DstStart) / 2; \
+                } \
+            } \
+            \
+            int64_t const offFactorCur  = pRate->offDst & UINT32_MAX; \
+            int64_t const offFactorLast = (int64_t)_4G - offFactorCur; \
+            INTERPOLATE_2CH(pi32Dst, pi32Src, ai32LastFrame, offFactorCur, offFactorLast, 2); \
+            \
+            pRate->offDst += uDstInc; \
+            pi32Dst       += 2; \
+            cDstFrames    -= 1; \
+        } \
+        \
+        COPY_LAST_FRAME_2CH(pRate->SrcLast.ai32Samples, ai32LastFrame, 2); \
+        *pcSrcFramesRead = (pi32Src - pi32SrcStart) / 2; \
+        return (pi32Dst - pi32DstStart) / 2; \
+    }
+
+/** Interpolates four stereo destination frames for audioMixBufResample2ChAvx2. */
+AUDIOMIXBUF_AVX2_FN(void) audioMixBufResample2ChAvx2Block(int32_t *pi32Dst, int32_t const *pi32Src,
+                                                          uint64_t offDst, uint64_t uDstInc, uint32_t offSrc)
+{
+    uint64_t const offDst1 = offDst  + uDstInc;
+    uint64_t const offDst2 = offDst1 + uDstInc;
+    uint64_t const offDst3 = offDst2 + uDstInc;
+    int32_t const *pi32Last0 = &pi32Src[(int32_t)(RT_HI_U32(offDst)  - offSrc) * 2];
+    int32_t const *pi32Last1 = &pi32Src[(int32_t)(RT_HI_U32(offDst1) - offSrc) * 2];
+    int32_t const *pi32Last2 = &pi32Src[(int32_t)(RT_HI_U32(offDst2) - offSrc) * 2];
+    int32_t const *pi32Last3 = &pi32Src[(int32_t)(RT_HI_U32(offDst3) - offSrc) * 2];
+    __m256i const uLast = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                                                      _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i const *)pi32Last0),
+                                                                         _mm_loadl_epi64((__m128i const *)pi32Last1))),
+                                                  _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i const *)pi32Last2),
+                                                                     _mm_loadl_epi64((__m128i const *)pi32Last3)), 1);
+    __m256i const uCur  = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                                                      _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i const *)&pi32Last0[2]),
+                                                                         _mm_loadl_epi64((__m128i const *)&pi32Last1[2]))),
+                                                  _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i const *)&pi32Last2[2]),
+                                                                     _mm_loadl_epi64((__m128i const *)&pi32Last3[2])), 1);
+    __m256i const uFactorCur = _mm256_set_epi32((int32_t)(uint32_t)offDst3, (int32_t)(uint32_t)offDst3,
+                                                (int32_t)(uint32_t)offDst2, (int32_t)(uint32_t)offDst2,
+                                                (int32_t)(uint32_t)offDst1, (int32_t)(uint32_t)offDst1,
+                                                (int32_t)(uint32_t)offDst,  (int32_t)(uint32_t)offDst);
+    _mm256_storeu_si256((__m256i *)pi32Dst, audioMixBufAvx2Interpolate2Ch(uLast, uCur, uFactorCur));
+}
+
+AUDIOMIXBUF_RESAMPLE_2CH_SIMD(Avx2, 4, audioMixBufResample2ChAvx2Block)
+
+#endif /* AUDIOMIXBUF_WITH_AVX2 */
+
+
+/*********************************************************************************************************************************
+*   Encoder and decoder callbacks                                                                                                *
+*********************************************************************************************************************************/
+
+/** Instantiates the S16 N ch -> N ch encoder and decoders for a kernel set. */
+#define AUDIOMIXBUF_CONV_S16_SIMD(a_cChannels, a_Suffix) \
+    static DECLCALLBACK(void) audioMixBufEncode##a_cChannels##ChTo##a_cChannels##ChS16##a_Suffix(void *pvDst, int32_t const *pi32Src, \
+                                                                                              uint32_t cFrames, \
+                                                                                              PAUDIOMIXBUFPEEKSTATE pState) \
+    { \
+        RT_NOREF_PV(pState); \
+        audioMixBufEncodeS16##a_Suffix((int16_t *)pvDst, pi32Src, (size_t)cFrames * a_cChannels); \
+    } \
+    static DECLCALLBACK(void) audioMixBufDecode##a_cChannels##ChTo##a_cChannels##ChS16##a_Suffix(int32_t *pi32Dst, void const *pvSrc, \
+                                                                                              uint32_t cFrames, \
+                                                                                              PAUDIOMIXBUFWRITESTATE pState) \
+    { \
+        RT_NOREF_PV(pState); \
+        audioMixBufDecodeS16##a_Suffix(pi32Dst, (int16_t const *)pvSrc, (size_t)cFrames * a_cChannels, false /*fBlend*/); \
+    } \
+    static DECLCALLBACK(void) audioMixBufDecode##a_cChannels##ChTo##a_cChannels##ChS16Blend##a_Suffix(int32_t *pi32Dst, \
+                                                                                                   void const *pvSrc, \
+                                                                                                   uint32_t cFrames, \
+                                                                                                   PAUDIOMIXBUFWRITESTATE pState) \
+    { \
+        RT_NOREF_PV(pState); \
+        audioMixBufDecodeS16##a_Suffix(pi32Dst, (int16_t const *)pvSrc, (size_t)cFrames * a_cChannels, true /*fBlend*/); \
+    }
+
+#ifdef AUDIOMIXBUF_WITH_SSE2
+AUDIOMIXBUF_CONV_S16_SIMD(1, Sse2)
+AUDIOMIXBUF_CONV_S16_SIMD(2, Sse2)
+#endif
+#ifdef AUDIOMIXBUF_WITH_AVX2
+AUDIOMIXBUF_CONV_S16_SIMD(1, Avx2)
+AUDIOMIXBUF_CONV_S16_SIMD(2, Avx2)
+#endif
+
@@ -72,6 +72,10 @@
 #endif
 #include <iprt/mem.h>
 #include <iprt/string.h> /* For RT_BZERO. */
+#if defined(RT_ARCH_AMD64) || defined(RT_ARCH_X86)
+# include <iprt/asm-amd64-x86.h>
+# include <iprt/x86.h>
+#endif
 
 #ifdef VBOX_AUDIO_TESTCASE
 # define LOG_ENABLED
@@ -109,6 +113,26 @@
 AssertCompile(AUDIOMIXBUF_VOL_0DB <= 0x40000000);   /* Must always hold. */
 AssertCompile(AUDIOMIXBUF_VOL_0DB == 0x40000000);   /* For now -- when only attenuation is used. */
 
+/** @def AUDIOMIXBUF_WITH_SSE2
+ * Compile the SSE2 kernels (see AudioMixBuffer-Simd.cpp.h). */
+/** @def AUDIOMIXBUF_WITH_AVX2
+ * Compile the AVX2 kernels (see AudioMixBuffer-Simd.cpp.h).  These need a
+ * compiler which can enable AVX2 for individual functions. */
+#if (defined(RT_ARCH_AMD64) || defined(RT_ARCH_X86)) && !defined(AUDIOMIXBUF_NO_SIMD)
+# if defined(_MSC_VER) || defined(__clang__) || RT_GNUC_PREREQ(4, 9)
+#  define AUDIOMIXBUF_WITH_SSE2
+# endif
+# if (defined(_MSC_VER) && _MSC_VER >= 1700) || defined(__clang__) || RT_GNUC_PREREQ(4, 9)
+#  define AUDIOMIXBUF_WITH_AVX2
+# endif
+#endif
+#ifdef AUDIOMIXBUF_WITH_SSE2
+# include <emmintrin.h>
+#endif
+#ifdef AUDIOMIXBUF_WITH_AVX2
+# include <immintrin.h>
+#endif
+
 
 /*********************************************************************************************************************************
 *   Global Variables                                                                                                             *
@@ -152,6 +176,12 @@ static uint32_t const s_aVolumeConv[256] =
     48393, 50535, 52773, 55109, 57549, 60097, 62757, 65536, /* 255 */
 };
 
+/** The kernel set to use, AUDIOMIXBUFSIMD_INVALID until first initialized.
+ * @sa audioMixBufSimdInit, AudioMixBufSetSimd */
+static AUDIOMIXBUFSIMD g_enmAudioMixBufSimd     = AUDIOMIXBUFSIMD_INVALID;
+/** The best kernel set the host supports. */
+static AUDIOMIXBUFSIMD g_enmAudioMixBufSimdHost = AUDIOMIXBUFSIMD_INVALID;
+
 
 
 #ifdef VBOX_STRICT
@@ -253,47 +283,6 @@ DECL_FORCE_INLINE(int32_t) audioMixBufBlendSampleRet(int32_t i32Sample1, int32_t
 }
 
 
-/**
- * Blends (merges) the source buffer into the destination buffer.
- *
- * We're taking a very simple approach here, working sample by sample:
- *  - if one is silent, use the other one.
- *  - otherwise sum and divide by two.
- *
- * @param   pi32Dst     The destination stream buffer (input and output).
- * @param   pi32Src     The source stream buffer.
- * @param   cFrames     Number of frames to process.
- * @param   cChannels   Number of channels.
- */
-static void audioMixBufBlendBuffer(int32_t *pi32Dst, int32_t const *pi32Src, uint32_t cFrames, uint8_t cChannels)
-{
-    switch (cChannels)
-    {
-        case 2:
-            while (cFrames-- > 0)
-            {
-                audioMixBufBlendSample(&pi32Dst[0], pi32Src[0]);
-                audioMixBufBlendSample(&pi32Dst[1], pi32Src[1]);
-                pi32Dst += 2;
-                pi32Src += 2;
-            }
-            break;
-
-        default:
-            cFrames *= cChannels;
-            RT_FALL_THROUGH();
-        case 1:
-            while (cFrames-- > 0)
-            {
-                audioMixBufBlendSample(pi32Dst, pi32Src[0]);
-                pi32Dst++;
-                pi32Src++;
-            }
-            break;
-    }
-}
-
-
 #ifdef AUDIOMIXBUF_DEBUG_MACROS
 # define AUDMIXBUF_MACRO_LOG(x) AUDMIXBUF_LOG(x)
 #elif defined(VBOX_AUDIO_TESTCASE_VERBOSE) /* Warning: VBOX_AUDIO_TESTCASE_VERBOSE will generate huge logs! */
@@ -653,6 +642,126 @@ AUDIOMIXBUF_RESAMPLE(11,Generic)
 AUDIOMIXBUF_RESAMPLE(12,Generic)
 
 
+/*
+ * SSE2 and AVX2 kernels.
+ */
+#if defined(AUDIOMIXBUF_WITH_SSE2) || defined(AUDIOMIXBUF_WITH_AVX2)
+# include "AudioMixBuffer-Simd.cpp.h"
+#endif
+
+
+/**
+ * Blends (merges) the source buffer into the destination buffer.
+ *
+ * We're taking a very simple approach here, working sample by sample:
+ *  - if one is silent, use the other one.
+ *  - otherwise sum and divide by two.
+ *
+ * @param   pi32Dst     The destination stream buffer (input and output).
+ * @param   pi32Src     The source stream buffer.
+ * @param   cFrames     Number of frames to process.
+ * @param   cChannels   Number of channels.
+ */
+static void audioMixBufBlendBuffer(int32_t *pi32Dst, int32_t const *pi32Src, uint32_t cFrames, uint8_t cChannels)
+{
+#ifdef AUDIOMIXBUF_WITH_AVX2
+    if (g_enmAudioMixBufSimd >= AUDIOMIXBUFSIMD_AVX2)
+    {
+        audioMixBufBlendBufferAvx2(pi32Dst, pi32Src, (size_t)cFrames * cChannels);
+        return;
+    }
+#endif
+#ifdef AUDIOMIXBUF_WITH_SSE2
+    if (g_enmAudioMixBufSimd >= AUDIOMIXBUFSIMD_SSE2)
+    {
+        audioMixBufBlendBufferSse2(pi32Dst, pi32Src, (size_t)cFrames * cChannels);
+        return;
+    }
+#endif
+
+    switch (cChannels)
+    {
+        case 2:
+            while (cFrames-- > 0)
+            {
+                audioMixBufBlendSample(&pi32Dst[0], pi32Src[0]);
+                audioMixBufBlendSample(&pi32Dst[1], pi32Src[1]);
+                pi32Dst += 2;
+                pi32Src += 2;
+            }
+            break;
+
+        default:
+            cFrames *= cChannels;
+            RT_FALL_THROUGH();
+        case 1:
+            while (cFrames-- > 0)
+            {
+                audioMixBufBlendSample(pi32Dst, pi32Src[0]);
+                pi32Dst++;
+                pi32Src++;
+            }
+            break;
+    }
+}
+
+
+/**
+ * Selects the kernel set on first use.
+ */
+static void audioMixBufSimdInit(void)
+{
+    if (g_enmAudioMixBufSimd != AUDIOMIXBUFSIMD_INVALID)
+    { /* likely */ }
+    else
+    {
+#if defined(AUDIOMIXBUF_WITH_SSE2) || defined(AUDIOMIXBUF_WITH_AVX2)
+        g_enmAudioMixBufSimdHost = audioMixBufSimdDetect();
+#else
+        g_enmAudioMixBufSimdHost = AUDIOMIXBUFSIMD_NONE;
+#endif
+        g_enmAudioMixBufSimd     = g_enmAudioMixBufSimdHost;
+        LogRel2(("AudioMixBuf: Using %s kernels\n", g_enmAudioMixBufSimd == AUDIOMIXBUFSIMD_AVX2 ? "AVX2"
+                 : g_enmAudioMixBufSimd == AUDIOMIXBUFSIMD_SSE2 ? "SSE2" : "generic"));
+    }
+}
+
+
+/**
+ * Gets the kernel set used by the mixing buffer code.
+ *
+ * @returns The active kernel set.
+ */
+AUDIOMIXBUFSIMD AudioMixBufGetSimd(void)
+{
+    audioMixBufSimdInit();
+    return g_enmAudioMixBufSimd;
+}
+
+
+/**
+ * Changes the kernel set used by the mixing buffer code.
+ *
+ * This is meant for testing and benchmarking.  The sample conversion and
+ * resampling callbacks are picked when a buffer, peek state or write state is
+ * initialized, so only objects initialized after the call are affected by
+ * those.
+ *
+ * @returns The previous kernel set.
+ * @param   enmSimd     The kernel set to use.  This is capped at what the host
+ *                      supports, AUDIOMIXBUFSIMD_INVALID selects the best one.
+ */
+AUDIOMIXBUFSIMD AudioMixBufSetSimd(AUDIOMIXBUFSIMD enmSimd)
+{
+    audioMixBufSimdInit();
+    AUDIOMIXBUFSIMD const enmOld = g_enmAudioMixBufSimd;
+    if (enmSimd == AUDIOMIXBUFSIMD_INVALID || enmSimd > g_enmAudioMixBufSimdHost)
+        enmSimd = g_enmAudioMixBufSimdHost;
+    g_enmAudioMixBufSimd = enmSimd;
+    return enmOld;
+}
+
+
 /**
  * Resets the resampling state unconditionally.
  *
@@ -717,6 +826,13 @@ DECLINLINE(int) audioMixBufRateInit(PAUDIOSTREAMRATE pRate, uint32_t uSrcHz, uin
         pRate->fNoConversionNeeded = false;
         pRate->uDstInc             = ((uint64_t)uSrcHz << 32) / uDstHz;
         AssertReturn(uSrcHz != 0, VERR_INVALID_PARAMETER);
+#ifdef AUDIOMIXBUF_WITH_AVX2
+        if (cChannels == 2 && g_enmAudioMixBufSimd >= AUDIOMIXBUFSIMD_AVX2)
+        {
+            pRate->pfnResample = audioMixBufResample2ChAvx2;
+            return VINF_SUCCESS;
+        }
+#endif
         switch (cChannels)
         {
             case  1: pRate->pfnResample = audioMixBufResample1ChGeneric; break;
@@ -754,6 +870,7 @@ int AudioMixBufInit(PAUDIOMIXBUF pMixBuf, const char *pszName, PCPDMAUDIOPCMPROP
     AssertPtrReturn(pszName, VERR_INVALID_POINTER);
     AssertPtrReturn(pProps,  VERR_INVALID_POINTER);
     Assert(PDMAudioPropsAreValid(pProps));
+    audioMixBufSimdInit();
 
     /*
      * Initialize all members, setting the volume to max (0dB).
@@ -1168,6 +1285,22 @@ int AudioMixBufInitPeekState(PCAUDIOMIXBUF pMixBuf, PAUDIOMIXBUFPEEKSTATE pState
                     }
                 break;
         }
+
+        /* SSE2/AVX2 versions of the common same channel count S16 case. */
+        if (cbSample == 2 && cSrcCh == cDstCh && cSrcCh <= 2)
+        {
+#ifdef AUDIOMIXBUF_WITH_AVX2
+            if (g_enmAudioMixBufSimd >= AUDIOMIXBUFSIMD_AVX2)
+                pState->pfnEncode = cSrcCh == 1 ? audioMixBufEncode1ChTo1ChS16Avx2 : audioMixBufEncode2ChTo2ChS16Avx2;
+            else
+#endif
+#ifdef AUDIOMIXBUF_WITH_SSE2
+            if (g_enmAudioMixBufSimd >= AUDIOMIXBUFSIMD_SSE2)
+                pState->pfnEncode = cSrcCh == 1 ? audioMixBufEncode1ChTo1ChS16Sse2 : audioMixBufEncode2ChTo2ChS16Sse2;
+            else
+#endif
+            { /* generic */ }
+        }
     }
     else
     {
@@ -1365,6 +1498,30 @@ int AudioMixBufInitWriteState(PCAUDIOMIXBUF pMixBuf, PAUDIOMIXBUFWRITESTATE pSta
                     }
                 break;
         }
+
+        /* SSE2/AVX2 versions of the common same channel count S16 case. */
+        if (cbSample == 2 && cSrcCh == cDstCh && cSrcCh <= 2)
+        {
+#ifdef AUDIOMIXBUF_WITH_AVX2
+            if (g_enmAudioMixBufSimd >= AUDIOMIXBUFSIMD_AVX2)
+            {
+                pState->pfnDecode      = cSrcCh == 1 ? audioMixBufDecode1ChTo1ChS16Avx2 : audioMixBufDecode2ChTo2ChS16Avx2;
+                pState->pfnDecodeBlend = cSrcCh == 1 ? audioMixBufDecode1ChTo1ChS16BlendAvx2
+                                       :               audioMixBufDecode2ChTo2ChS16BlendAvx2;
+            }
+            else
+#endif
+#ifdef AUDIOMIXBUF_WITH_SSE2
+            if (g_enmAudioMixBufSimd >= AUDIOMIXBUFSIMD_SSE2)
+            {
+                pState->pfnDecode      = cSrcCh == 1 ? audioMixBufDecode1ChTo1ChS16Sse2 : audioMixBufDecode2ChTo2ChS16Sse2;
+                pState->pfnDecodeBlend = cSrcCh == 1 ? audioMixBufDecode1ChTo1ChS16BlendSse2
+                                       :               audioMixBufDecode2ChTo2ChS16BlendSse2;
+            }
+            else
+#endif
+            { /* generic */ }
+        }
     }
     else
     {
@@ -1894,6 +2051,36 @@ void AudioMixBufAdvance(PAUDIOMIXBUF pMixBuf, uint32_t cFrames)
 static void audioMixAdjustVolumeWorker(PAUDIOMIXBUF pMixBuf, uint32_t off, uint32_t cFrames)
 {
     int32_t       *pi32Samples = &pMixBuf->pi32Samples[off * pMixBuf->cChannels];
+
+#if defined(AUDIOMIXBUF_WITH_SSE2) || defined(AUDIOMIXBUF_WITH_AVX2)
+    /*
+     * The SIMD kernels take a vector of factors, which works for channel
+     * counts dividing the vector width.
+     */
+    uint8_t const cChannels = pMixBuf->cChannels;
+    if (   g_enmAudioMixBufSimd >= AUDIOMIXBUFSIMD_SSE2
+        && (cChannels == 1 || cChannels == 2 || cChannels == 4 || cChannels == 8))
+    {
+        uint32_t auFactors[8];
+        for (uintptr_t i = 0; i < RT_ELEMENTS(auFactors); i++)
+            auFactors[i] = pMixBuf->Volume.auChannels[i % cChannels];
+# ifdef AUDIOMIXBUF_WITH_AVX2
+        if (g_enmAudioMixBufSimd >= AUDIOMIXBUFSIMD_AVX2)
+        {
+            audioMixBufAdjustVolumeAvx2(pi32Samples, (size_t)cFrames * cChannels, auFactors);
+            return;
+        }
+# endif
+# ifdef AUDIOMIXBUF_WITH_SSE2
+        if (cChannels != 8)
+        {
+            audioMixBufAdjustVolumeSse2(pi32Samples, (size_t)cFrames * cChannels, auFactors);
+            return;
+        }
+# endif
+    }
+#endif
+
     switch (pMixBuf->cChannels)
     {
         case 1:
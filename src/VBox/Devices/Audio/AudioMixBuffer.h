@@ -187,6 +187,25 @@ typedef struct AUDIOMIXBUF
     char                       *pszName;
 } AUDIOMIXBUF;
 
+/**
+ * The kernel set used by the mixing buffer code.
+ *
+ * The SIMD kernels produce exactly the same output as the generic ones.
+ */
+typedef enum AUDIOMIXBUFSIMD
+{
+    /** Invalid / not yet determined. */
+    AUDIOMIXBUFSIMD_INVALID = 0,
+    /** Generic C code only. */
+    AUDIOMIXBUFSIMD_NONE,
+    /** SSE2 kernels. */
+    AUDIOMIXBUFSIMD_SSE2,
+    /** AVX2 kernels (SSE2 ones where there are no AVX2 ones). */
+    AUDIOMIXBUFSIMD_AVX2,
+    /** Make sure the type is 32-bit wide. */
+    AUDIOMIXBUFSIMD_32BIT_HACK = 0x7fffffff
+} AUDIOMIXBUFSIMD;
+
 /** Magic value for AUDIOMIXBUF (Antonio Lucio Vivaldi). */
 #define AUDIOMIXBUF_MAGIC           UINT32_C(0x16780304)
 /** Dead mixer buffer magic. */
@@ -203,6 +222,8 @@ int         AudioMixBufInit(PAUDIOMIXBUF pMixBuf, const char *pszName, PCPDMAUDI
 void        AudioMixBufTerm(PAUDIOMIXBUF pMixBuf);
 void        AudioMixBufDrop(PAUDIOMIXBUF pMixBuf);
 void        AudioMixBufSetVolume(PAUDIOMIXBUF pMixBuf, PCPDMAUDIOVOLUME pVol);
+AUDIOMIXBUFSIMD AudioMixBufGetSimd(void);
+AUDIOMIXBUFSIMD AudioMixBufSetSimd(AUDIOMIXBUFSIMD enmSimd);
 
 /** @name Mixer buffer getters
  * @{ */
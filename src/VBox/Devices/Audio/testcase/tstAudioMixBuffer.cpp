@@ -27,6 +27,7 @@
 #include <iprt/stream.h>
 #include <iprt/string.h>
 #include <iprt/test.h>
+#include <iprt/time.h>
 
 #include <VBox/vmm/pdmaudioinline.h>
 
@@ -853,6 +854,214 @@ static void tstVolume(RTTEST hTest)
 }
 
 
+/**
+ * Runs a mixing workload with the current kernel set: S16 input at @a uSrcHz
+ * written and blended into a 48kHz buffer with the volume lowered, then read
+ * back as S16 at @a uDstHz.
+ *
+ * @returns Number of bytes produced in @a pbDst.
+ * @param   cChannels   Number of channels.
+ * @param   uSrcHz      Input rate, 22050 Hz or higher.
+ * @param   uDstHz      Output rate.
+ * @param   pai16Src    The input, 2 * @a cSrcFrames frames.  The first half is
+ *                      written, the second half blended.
+ * @param   cSrcFrames  Number of input frames to write.
+ * @param   pbDst       The output buffer.
+ * @param   cbDst       The output buffer size.
+ */
+static uint32_t tstSimdWorkload(uint8_t cChannels, uint32_t uSrcHz, uint32_t uDstHz, int16_t const *pai16Src,
+                                uint32_t cSrcFrames, uint8_t *pbDst, uint32_t cbDst)
+{
+    PDMAUDIOPCMPROPS CfgBuf;
+    PDMAudioPropsInit(&CfgBuf, 2 /*cbSample*/, true /*fSigned*/, cChannels, 48000);
+    PDMAUDIOPCMPROPS CfgSrc;
+    PDMAudioPropsInit(&CfgSrc, 2 /*cbSample*/, true /*fSigned*/, cChannels, uSrcHz);
+    PDMAUDIOPCMPROPS CfgDst;
+    PDMAudioPropsInit(&CfgDst, 2 /*cbSample*/, true /*fSigned*/, cChannels, uDstHz);
+
+    AUDIOMIXBUF MixBuf;
+    RTTESTI_CHECK_RC_OK_RET(AudioMixBufInit(&MixBuf, "Simd", &CfgBuf, 2048), 0);
+    AUDIOMIXBUFWRITESTATE WriteState;
+    RTTESTI_CHECK_RC_OK_RET(AudioMixBufInitWriteState(&MixBuf, &WriteState, &CfgSrc), 0);
+    AUDIOMIXBUFWRITESTATE BlendState;
+    RTTESTI_CHECK_RC_OK_RET(AudioMixBufInitWriteState(&MixBuf, &BlendState, &CfgSrc), 0);
+    AUDIOMIXBUFPEEKSTATE PeekState;
+    RTTESTI_CHECK_RC_OK_RET(AudioMixBufInitPeekState(&MixBuf, &PeekState, &CfgDst), 0);
+
+    /* A different volume for each channel, so the volume kernels get caught
+       if they apply a factor to the wrong channel. */
+    PDMAUDIOVOLUME Vol;
+    Vol.fMuted = false;
+    for (uintptr_t i = 0; i < RT_ELEMENTS(Vol.auChannels); i++)
+        Vol.auChannels[i] = (uint8_t)(255 - 24 - i * 9);
+    AudioMixBufSetVolume(&MixBuf, &Vol);
+
+    uint32_t const cbSrcFrame = PDMAudioPropsFrameSize(&CfgSrc);
+    uint32_t       offSrc     = 0;
+    uint32_t       offDst     = 0;
+    while (offSrc < cSrcFrames && offDst < cbDst)
+    {
+        /* An odd chunk size so the SIMD loops get to do their tails too.  The
+           buffer is drained every round, so all the input is always taken. */
+        uint32_t const cChunk = RT_MIN(cSrcFrames - offSrc, 509);
+        uint32_t cWritten = 0;
+        AudioMixBufWrite(&MixBuf, &WriteState, &pai16Src[offSrc * cChannels], cChunk * cbSrcFrame,
+                         0 /*offDstFrame*/, AudioMixBufFree(&MixBuf), &cWritten);
+        uint32_t cBlended = 0;
+        AudioMixBufBlend(&MixBuf, &BlendState, &pai16Src[(cSrcFrames + offSrc) * cChannels], cChunk * cbSrcFrame,
+                         0 /*offDstFrame*/, cWritten, &cBlended);
+        AudioMixBufCommit(&MixBuf, cWritten);
+        offSrc += cChunk;
+
+        uint32_t cLeft = AudioMixBufUsed(&MixBuf);
+        while (cLeft > 0 && offDst < cbDst)
+        {
+            uint32_t cPeeked  = 0;
+            uint32_t cbPeeked = 0;
+            AudioMixBufPeek(&MixBuf, 0 /*offSrcFrame*/, cLeft, &cPeeked, &PeekState, &pbDst[offDst], cbDst - offDst, &cbPeeked);
+            if (!cPeeked)
+                break;
+            AudioMixBufAdvance(&MixBuf, cPeeked);
+            offDst += cbPeeked;
+            cLeft  -= cPeeked;
+        }
+    }
+
+    AudioMixBufTerm(&MixBuf);
+    return offDst;
+}
+
+
+/** Kernel sets exercised by tstSimd and tstSimdBenchmark. */
+static struct
+{
+    AUDIOMIXBUFSIMD enmSimd;
+    const char     *pszName;
+} const g_aSimdKernels[] =
+{
+    { AUDIOMIXBUFSIMD_NONE, "generic" },
+    { AUDIOMIXBUFSIMD_SSE2, "SSE2" },
+    { AUDIOMIXBUFSIMD_AVX2, "AVX2" },
+};
+
+
+/* Test that the SIMD kernels produce exactly what the generic code does. */
+static void tstSimd(RTTEST hTest)
+{
+    static struct { uint8_t cChannels; uint32_t uSrcHz, uDstHz; } const s_aTests[] =
+    {
+        { 2, 48000, 48000 },
+        { 2, 44100, 48000 },
+        { 2, 22050, 44100 },
+        { 2, 48000, 11025 },
+        { 1, 44100, 44100 },
+        { 1, 32000, 22050 },
+        /* These use the generic converters and resampler, but the 4 and 8
+           channel volume kernels. */
+        { 4, 48000, 48000 },
+        { 4, 44100, 48000 },
+        { 8, 48000, 48000 },
+        { 8, 48000, 44100 },
+    };
+    uint32_t const cSrcFrames = 8192;
+    uint32_t const cbDst      = _1M;
+    int16_t *pai16Src = (int16_t *)RTMemAlloc(cSrcFrames * 2 * 8 * sizeof(int16_t));
+    uint8_t *pbExpect = (uint8_t *)RTMemAlloc(cbDst);
+    uint8_t *pbDst    = (uint8_t *)RTMemAlloc(cbDst);
+    RTTESTI_CHECK_RETV(pai16Src && pbExpect && pbDst);
+    AUDIOMIXBUFSIMD const enmSaved = AudioMixBufGetSimd();
+
+    for (uintptr_t iTest = 0; iTest < RT_ELEMENTS(s_aTests); iTest++)
+    {
+        uint8_t const cChannels = s_aTests[iTest].cChannels;
+        RTTestSubF(hTest, "SIMD kernels %u ch %u to %u Hz", cChannels, s_aTests[iTest].uSrcHz, s_aTests[iTest].uDstHz);
+
+        /* Random samples with plenty of silence and extremes for the blending. */
+        for (uint32_t i = 0; i < cSrcFrames * 2 * cChannels; i++)
+            switch (RTRandU32Ex(0, 7))
+            {
+                case 0:  pai16Src[i] = 0; break;
+                case 1:  pai16Src[i] = INT16_MIN; break;
+                case 2:  pai16Src[i] = INT16_MAX; break;
+                default: pai16Src[i] = (int16_t)RTRandU32(); break;
+            }
+
+        AudioMixBufSetSimd(AUDIOMIXBUFSIMD_NONE);
+        uint32_t const cbExpect = tstSimdWorkload(cChannels, s_aTests[iTest].uSrcHz, s_aTests[iTest].uDstHz,
+                                                  pai16Src, cSrcFrames, pbExpect, cbDst);
+        RTTESTI_CHECK(cbExpect > 0);
+
+        for (uintptr_t iSimd = 1; iSimd < RT_ELEMENTS(g_aSimdKernels); iSimd++)
+        {
+            AudioMixBufSetSimd(g_aSimdKernels[iSimd].enmSimd);
+            if (AudioMixBufGetSimd() != g_aSimdKernels[iSimd].enmSimd)
+            {
+                RTTestPrintf(hTest, RTTESTLVL_ALWAYS, "%s not supported by the host\n", g_aSimdKernels[iSimd].pszName);
+                continue;
+            }
+            uint32_t const cbActual = tstSimdWorkload(cChannels, s_aTests[iTest].uSrcHz, s_aTests[iTest].uDstHz,
+                                                      pai16Src, cSrcFrames, pbDst, cbDst);
+            RTTESTI_CHECK_MSG(cbActual == cbExpect, ("%s: cbActual=%#x cbExpect=%#x\n",
+                                                     g_aSimdKernels[iSimd].pszName, cbActual, cbExpect));
+            if (memcmp(pbDst, pbExpect, RT_MIN(cbActual, cbExpect)) != 0)
+            {
+                uint32_t off = 0;
+                while (off < RT_MIN(cbActual, cbExpect) && pbDst[off] == pbExpect[off])
+                    off++;
+                RTTestFailed(hTest, "%s output differs from the generic one at %#x\n", g_aSimdKernels[iSimd].pszName, off);
+            }
+        }
+    }
+
+    AudioMixBufSetSimd(enmSaved);
+    RTMemFree(pai16Src);
+    RTMemFree(pbExpect);
+    RTMemFree(pbDst);
+}
+
+
+/* Measure the mixing throughput of the available kernel sets. */
+static void tstSimdBenchmark(RTTEST hTest)
+{
+    RTTestSub(hTest, "SIMD kernel benchmark");
+    static struct { uint32_t uSrcHz, uDstHz; } const s_aRates[] =
+    {
+        { 48000, 48000 },
+        { 44100, 48000 },
+        { 48000, 44100 },
+    };
+    uint32_t const cSrcFrames = 48000;
+    uint32_t const cbDst      = 4 * _1M;
+    uint32_t const cRounds    = 8;
+    int16_t *pai16Src = (int16_t *)RTMemAlloc(cSrcFrames * 2 * 2 * sizeof(int16_t));
+    uint8_t *pbDst    = (uint8_t *)RTMemAlloc(cbDst);
+    RTTESTI_CHECK_RETV(pai16Src && pbDst);
+    for (uint32_t i = 0; i < cSrcFrames * 2 * 2; i++)
+        pai16Src[i] = (int16_t)RTRandU32();
+    AUDIOMIXBUFSIMD const enmSaved = AudioMixBufGetSimd();
+
+    for (uintptr_t iSimd = 0; iSimd < RT_ELEMENTS(g_aSimdKernels); iSimd++)
+    {
+        AudioMixBufSetSimd(g_aSimdKernels[iSimd].enmSimd);
+        if (AudioMixBufGetSimd() != g_aSimdKernels[iSimd].enmSimd)
+            continue;
+        for (uintptr_t iRate = 0; iRate < RT_ELEMENTS(s_aRates); iRate++)
+        {
+            uint64_t const nsStart = RTTimeNanoTS();
+            for (uint32_t iRound = 0; iRound < cRounds; iRound++)
+                tstSimdWorkload(2, s_aRates[iRate].uSrcHz, s_aRates[iRate].uDstHz, pai16Src, cSrcFrames, pbDst, cbDst);
+            uint64_t const cNsElapsed = RT_MAX(RTTimeNanoTS() - nsStart, 1);
+            RTTestValueF(hTest, (uint64_t)cSrcFrames * cRounds * RT_NS_1SEC / cNsElapsed, RTTESTUNIT_FRAMES_PER_SEC,
+                         "%s %u to %u Hz", g_aSimdKernels[iSimd].pszName, s_aRates[iRate].uSrcHz, s_aRates[iRate].uDstHz);
+        }
+    }
+
+    AudioMixBufSetSimd(enmSaved);
+    RTMemFree(pai16Src);
+    RTMemFree(pbDst);
+}
+
+
 int main(int argc, char **argv)
 {
     RTR3InitExe(argc, &argv, 0);
@@ -899,6 +1108,9 @@ int main(int argc, char **argv)
 
     tstVolume(hTest);
 
+    tstSimd(hTest);
+    tstSimdBenchmark(hTest);
+
     /*
      * Summary
      */
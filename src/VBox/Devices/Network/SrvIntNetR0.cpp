@@ -65,6 +65,12 @@
 /** The wakeup bit in the INTNETIF::cBusy and INTNETRUNKIF::cBusy counters. */
 #define INTNET_BUSY_WAKEUP_MASK     RT_BIT_32(30)
 
+/** The number of buckets in the MAC address hash of INTNETMACTAB.
+ * Must be a power of two. */
+#define INTNET_MACTAB_HASH_SIZE     256
+/** NIL index for the MAC address table hash chains and lists. */
+#define INTNET_MACTAB_NIL_IDX       UINT32_MAX
+
 
 /*********************************************************************************************************************************
 *   Structures and Typedefs                                                                                                      *
@@ -87,6 +93,12 @@ typedef struct INTNETMACTABENTRY
     bool                    fActive;
     /** Pointer to the network interface. */
     struct INTNETIF        *pIf;
+    /** Index of the next entry in the same hash bucket,
+     * INTNET_MACTAB_NIL_IDX if last. */
+    uint32_t                iHashNext;
+    /** Index of the next entry on the promiscuous or dummy MAC address list
+     * (see INTNETMACTAB::iPromiscuousHead), INTNET_MACTAB_NIL_IDX if last. */
+    uint32_t                iListNext;
 } INTNETMACTABENTRY;
 /** Pointer to a MAC address lookup table entry. */
 typedef INTNETMACTABENTRY *PINTNETMACTABENTRY;
@@ -105,6 +117,17 @@ typedef struct INTNETMACTAB
     uint32_t                cEntriesAllocated;
     /** Table entries. */
     PINTNETMACTABENTRY      paEntries;
+    /** Hash table indexing paEntries by MAC address, chained via
+     * INTNETMACTABENTRY::iHashNext.  This holds all entries, including inactive
+     * ones, and must be updated by intnetR0MacTabReindex() whenever entries are
+     * added, removed or change their MAC address or promiscuous setting. */
+    uint32_t                aiHash[INTNET_MACTAB_HASH_SIZE];
+    /** Head of the list of entries in effective promiscuous mode, chained via
+     * INTNETMACTABENTRY::iListNext. */
+    uint32_t                iPromiscuousHead;
+    /** Head of the list of entries which aren't promiscuous but have a dummy
+     * MAC address, chained via INTNETMACTABENTRY::iListNext. */
+    uint32_t                iDummyHead;
 
     /** The number of interface entries currently in promicuous mode. */
     uint32_t                cPromiscuousEntries;
@@ -1661,6 +1684,67 @@ DECL_FORCE_INLINE(bool) intnetR0AreMacAddrsEqual(PCRTMAC pDstAddr1, PCRTMAC pDst
 }
 
 
+
+/**
+ * Calculates the MAC address table hash bucket for a MAC address.
+ *
+ * @returns Index into INTNETMACTAB::aiHash.
+ * @param   pMacAddr            The address to hash.
+ */
+DECL_FORCE_INLINE(uint32_t) intnetR0MacTabHash(PCRTMAC pMacAddr)
+{
+    /* The vendor specific bytes at the end are the ones differing most. */
+    uint32_t uHash = pMacAddr->au16[0] ^ pMacAddr->au16[1] ^ ((uint32_t)pMacAddr->au16[2] << 3);
+    uHash ^= uHash >> 8;
+    return uHash & (INTNET_MACTAB_HASH_SIZE - 1);
+}
+
+
+/**
+ * Rebuilds the MAC address hash and the promiscuous and dummy lists of the MAC
+ * address table.
+ *
+ * This must be called after adding or removing entries or changing the MAC
+ * address or promiscuous setting of an entry.  These are rare events compared
+ * to frame switching, so a full rebuild is kept simple on purpose.  Activating
+ * and deactivating entries doesn't require a rebuild as the lookups check
+ * INTNETMACTABENTRY::fActive.
+ *
+ * The caller holds the MAC address table spinlock.
+ *
+ * @param   pTab                The MAC address table.
+ */
+static void intnetR0MacTabReindex(PINTNETMACTAB pTab)
+{
+    for (uint32_t i = 0; i < RT_ELEMENTS(pTab->aiHash); i++)
+        pTab->aiHash[i] = INTNET_MACTAB_NIL_IDX;
+    pTab->iPromiscuousHead = INTNET_MACTAB_NIL_IDX;
+    pTab->iDummyHead       = INTNET_MACTAB_NIL_IDX;
+
+    uint32_t iIfMac = pTab->cEntries;
+    while (iIfMac-- > 0)
+    {
+        PINTNETMACTABENTRY pEntry = &pTab->paEntries[iIfMac];
+        uint32_t const     iHash  = intnetR0MacTabHash(&pEntry->MacAddr);
+        pEntry->iHashNext   = pTab->aiHash[iHash];
+        pTab->aiHash[iHash] = iIfMac;
+
+        if (pEntry->fPromiscuousEff)
+        {
+            pEntry->iListNext      = pTab->iPromiscuousHead;
+            pTab->iPromiscuousHead = iIfMac;
+        }
+        else if (intnetR0IsMacAddrDummy(&pEntry->MacAddr))
+        {
+            pEntry->iListNext = pTab->iDummyHead;
+            pTab->iDummyHead  = iIfMac;
+        }
+        else
+            pEntry->iListNext = INTNET_MACTAB_NIL_IDX;
+    }
+}
+
+
 /**
  * Switch a unicast frame based on the network layer address (OSI level 3) and
  * return a destination table.
@@ -1793,31 +1877,47 @@ static INTNETSWDECISION intnetR0NetworkPreSwitchUnicast(PINTNETNETWORK pNetwork,
     PINTNETMACTAB       pTab            = &pNetwork->MacTab;
     RTSpinlockAcquire(pNetwork->hAddrSpinlock);
 
-    /* Iterate the internal network interfaces and look for matching source and
-       destination addresses. */
-    uint32_t iIfMac = pTab->cEntries;
-    while (iIfMac-- > 0)
+    /* Unknown interface address?  Dummy addresses live on both lists. */
+    bool     fDecided = false;
+    uint32_t iIfMac   = pTab->iDummyHead;
+    while (iIfMac != INTNET_MACTAB_NIL_IDX && !fDecided)
     {
-        if (pTab->paEntries[iIfMac].fActive)
-        {
-            /* Unknown interface address? */
-            if (intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr))
-                break;
+        fDecided = pTab->paEntries[iIfMac].fActive;
+        iIfMac   = pTab->paEntries[iIfMac].iListNext;
+    }
+    iIfMac = pTab->iPromiscuousHead;
+    while (iIfMac != INTNET_MACTAB_NIL_IDX && !fDecided)
+    {
+        fDecided = pTab->paEntries[iIfMac].fActive
+                && intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr);
+        iIfMac   = pTab->paEntries[iIfMac].iListNext;
+    }
 
-            /* Paranoia - this shouldn't happen, right? */
-            if (    pSrcAddr
-                &&  intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pSrcAddr))
-                break;
+    /* Paranoia - this shouldn't happen, right? */
+    if (pSrcAddr)
+    {
+        iIfMac = pTab->aiHash[intnetR0MacTabHash(pSrcAddr)];
+        while (iIfMac != INTNET_MACTAB_NIL_IDX && !fDecided)
+        {
+            fDecided = pTab->paEntries[iIfMac].fActive
+                    && intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pSrcAddr);
+            iIfMac   = pTab->paEntries[iIfMac].iHashNext;
+        }
+    }
 
-            /* Exact match? */
-            if (intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr))
-            {
-                enmSwDecision = pTab->fHostPromiscuousEff && fSrc == INTNETTRUNKDIR_WIRE
-                              ? INTNETSWDECISION_BROADCAST
-                              : INTNETSWDECISION_INTNET;
-                break;
-            }
+    /* Exact match? */
+    iIfMac = pTab->aiHash[intnetR0MacTabHash(pDstAddr)];
+    while (iIfMac != INTNET_MACTAB_NIL_IDX && !fDecided)
+    {
+        if (   pTab->paEntries[iIfMac].fActive
+            && intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr))
+        {
+            enmSwDecision = pTab->fHostPromiscuousEff && fSrc == INTNETTRUNKDIR_WIRE
+                          ? INTNETSWDECISION_BROADCAST
+                          : INTNETSWDECISION_INTNET;
+            fDecided = true;
         }
+        iIfMac = pTab->paEntries[iIfMac].iHashNext;
     }
 
     RTSpinlockRelease(pNetwork->hAddrSpinlock);
@@ -1853,55 +1953,70 @@ static INTNETSWDECISION intnetR0NetworkSwitchUnicast(PINTNETNETWORK pNetwork, ui
     pDstTab->pTrunk     = 0;
     pDstTab->cIfs       = 0;
 
-    /* Find exactly matching or promiscuous interfaces. */
+    /* Find exactly matching interfaces. */
     uint32_t cExactHits = 0;
-    uint32_t iIfMac     = pTab->cEntries;
-    while (iIfMac-- > 0)
+    uint32_t iIfMac     = pTab->aiHash[intnetR0MacTabHash(pDstAddr)];
+    while (iIfMac != INTNET_MACTAB_NIL_IDX)
     {
-        if (pTab->paEntries[iIfMac].fActive)
+        if (   pTab->paEntries[iIfMac].fActive
+            && intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr))
         {
-            bool fExact = intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr);
-            if (   fExact
-                || intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr)
-                || (   pTab->paEntries[iIfMac].fPromiscuousSeeTrunk
-                    || (!fSrc && pTab->paEntries[iIfMac].fPromiscuousEff) )
-               )
+            cExactHits++;
+
+            PINTNETIF pIf = pTab->paEntries[iIfMac].pIf;            AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+            if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
             {
-                cExactHits += fExact;
+                uint32_t iIfDst = pDstTab->cIfs++;
+                pDstTab->aIfs[iIfDst].pIf            = pIf;
+                pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
+                intnetR0BusyIncIf(pIf);
+            }
+        }
+        iIfMac = pTab->paEntries[iIfMac].iHashNext;
+    }
 
-                PINTNETIF pIf = pTab->paEntries[iIfMac].pIf;        AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
-                if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
-                {
-                    uint32_t iIfDst = pDstTab->cIfs++;
-                    pDstTab->aIfs[iIfDst].pIf            = pIf;
-                    pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
-                    intnetR0BusyIncIf(pIf);
-                }
+    /* Promiscuous interfaces.  Network only promicuous mode ifs should only
+       see related trunk traffic. The exact hits were taken care of above. */
+    iIfMac = pTab->iPromiscuousHead;
+    while (iIfMac != INTNET_MACTAB_NIL_IDX)
+    {
+        if (   pTab->paEntries[iIfMac].fActive
+            && !intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr)
+            && (   pTab->paEntries[iIfMac].fPromiscuousSeeTrunk
+                || !fSrc
+                || cExactHits
+                || intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr) )
+           )
+        {
+            PINTNETIF pIf = pTab->paEntries[iIfMac].pIf;            AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+            if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
+            {
+                uint32_t iIfDst = pDstTab->cIfs++;
+                pDstTab->aIfs[iIfDst].pIf            = pIf;
+                pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
+                intnetR0BusyIncIf(pIf);
             }
         }
+        iIfMac = pTab->paEntries[iIfMac].iListNext;
     }
 
-    /* Network only promicuous mode ifs should see related trunk traffic. */
-    if (   cExactHits
-        && fSrc
-        && pNetwork->MacTab.cPromiscuousNoTrunkEntries)
+    /* Interfaces we don't know the address of yet. */
+    iIfMac = pTab->iDummyHead;
+    while (iIfMac != INTNET_MACTAB_NIL_IDX)
     {
-        iIfMac = pTab->cEntries;
-        while (iIfMac-- > 0)
+        if (   pTab->paEntries[iIfMac].fActive
+            && !intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr))
         {
-            if (   pTab->paEntries[iIfMac].fPromiscuousEff
-                && !pTab->paEntries[iIfMac].fPromiscuousSeeTrunk
-                && pTab->paEntries[iIfMac].fActive
-                && !intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr)
-                && !intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr) )
+            PINTNETIF pIf = pTab->paEntries[iIfMac].pIf;            AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+            if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
             {
-                PINTNETIF pIf    = pTab->paEntries[iIfMac].pIf;     AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
-                uint32_t  iIfDst = pDstTab->cIfs++;
+                uint32_t iIfDst = pDstTab->cIfs++;
                 pDstTab->aIfs[iIfDst].pIf            = pIf;
                 pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
                 intnetR0BusyIncIf(pIf);
             }
         }
+        iIfMac = pTab->paEntries[iIfMac].iListNext;
     }
 
     /* Does it match the host, or is the host promiscuous? */
@@ -3977,7 +4092,10 @@ static INTNETSWDECISION intnetR0NetworkSend(PINTNETNETWORK pNetwork, PINTNETIF p
 
         PINTNETMACTABENTRY pIfEntry = intnetR0NetworkFindMacAddrEntry(pNetwork, pIfSender);
         if (pIfEntry)
+        {
             pIfEntry->MacAddr = EthHdr.SrcMac;
+            intnetR0MacTabReindex(&pNetwork->MacTab);
+        }
         pIfSender->MacAddr    = EthHdr.SrcMac;
 
         RTSpinlockRelease(pNetwork->hAddrSpinlock);
@@ -4346,6 +4464,7 @@ INTNETR0DECL(int) IntNetR0IfSetPromiscuousMode(INTNETIFHANDLE hIf, PSUPDRVSESSIO
                     if (!pEntry->fPromiscuousSeeTrunk)
                         pNetwork->MacTab.cPromiscuousNoTrunkEntries++;
                 }
+                intnetR0MacTabReindex(&pNetwork->MacTab);
                 Assert(pNetwork->MacTab.cPromiscuousEntries        <= pNetwork->MacTab.cEntries);
                 Assert(pNetwork->MacTab.cPromiscuousNoTrunkEntries <= pNetwork->MacTab.cEntries);
             }
@@ -4425,7 +4544,10 @@ INTNETR0DECL(int) IntNetR0IfSetMacAddress(INTNETIFHANDLE hIf, PSUPDRVSESSION pSe
             /* Update the two copies. */
             PINTNETMACTABENTRY pEntry = intnetR0NetworkFindMacAddrEntry(pNetwork, pIf); Assert(pEntry);
             if (RT_LIKELY(pEntry))
+            {
                 pEntry->MacAddr = *pMac;
+                intnetR0MacTabReindex(&pNetwork->MacTab);
+            }
             pIf->MacAddr        = *pMac;
             pIf->fMacSet        = true;
 
@@ -4950,6 +5072,7 @@ static DECLCALLBACK(void) intnetR0IfDestruct(void *pvObj, void *pvUser1, void *p
                             &pNetwork->MacTab.paEntries[iIf + 1],
                             (pNetwork->MacTab.cEntries - iIf - 1) * sizeof(pNetwork->MacTab.paEntries[0]));
                 pNetwork->MacTab.cEntries--;
+                intnetR0MacTabReindex(&pNetwork->MacTab);
                 break;
             }
 
@@ -5191,6 +5314,7 @@ static int intnetR0NetworkCreateIf(PINTNETNETWORK pNetwork, PSUPDRVSESSION pSess
                     pNetwork->MacTab.paEntries[iIf].pIf                  = pIf;
 
                     pNetwork->MacTab.cEntries = iIf + 1;
+                    intnetR0MacTabReindex(&pNetwork->MacTab);
                     pIf->pNetwork = pNetwork;
 
                     /*
@@ -6088,6 +6212,7 @@ static DECLCALLBACK(void) intnetR0NetworkDestruct(void *pvObj, void *pvUser1, vo
         {
             pIf->pNetwork = NULL;
             pNetwork->MacTab.cEntries--;
+            intnetR0MacTabReindex(&pNetwork->MacTab);
         }
     }
 
@@ -6289,6 +6414,7 @@ static int intnetR0AdaptOpenNetworkFlags(PINTNETNETWORK pNetwork, uint32_t fFlag
                     }
                 }
             }
+            intnetR0MacTabReindex(&pNetwork->MacTab);
         }
 
         RTSpinlockRelease(pNetwork->hAddrSpinlock);
@@ -6511,7 +6637,9 @@ static int intnetR0CreateNetwork(PINTNET pIntNet, PSUPDRVSESSION pSession, const
     if (RT_SUCCESS(rc))
     {
         pNetwork->MacTab.paEntries = (PINTNETMACTABENTRY)RTMemAlloc(sizeof(INTNETMACTABENTRY) * pNetwork->MacTab.cEntriesAllocated);
-        if (!pNetwork->MacTab.paEntries)
+        if (pNetwork->MacTab.paEntries)
+            intnetR0MacTabReindex(&pNetwork->MacTab);
+        else
             rc = VERR_NO_MEMORY;
     }
     if (RT_SUCCESS(rc))
@@ -730,6 +730,92 @@ static void doTest(PTSTSTATE pThis, uint32_t cbRecv, uint32_t cbSend)
     IntNetR0Term();
 }
 
+/**
+ * Measures the cost of switching a unicast frame for a growing number of
+ * interfaces on the network.
+ */
+static void doSwitchBenchmark(void)
+{
+    static uint32_t const s_acPorts[] = { 2, 8, 16, 32, 64, 128 };
+    uint32_t const        cIterations = 200000;
+    INTNETIFHANDLE        ahIfs[128];
+
+    RTTestISub("unicast switching benchmark");
+    RTTESTI_CHECK_RC_RETV(IntNetR0Init(), VINF_SUCCESS);
+
+    for (unsigned iRun = 0; iRun < RT_ELEMENTS(s_acPorts) && !RTTestIErrorCount(); iRun++)
+    {
+        uint32_t const cPorts  = s_acPorts[iRun];
+        uint32_t       cOpened = 0;
+        AssertCompile(RT_ELEMENTS(ahIfs) >= 128);
+
+        /*
+         * Create the interfaces, each with its own MAC address.
+         */
+        while (cOpened < cPorts)
+        {
+            INTNETIFHANDLE hIf = INTNET_HANDLE_INVALID;
+            int rc = IntNetR0Open(g_pSession, "bench", kIntNetTrunkType_None, "", 0 /*fFlags*/,
+                                  _4K /*cbSend*/, _4K /*cbRecv*/, &hIf);
+            if (RT_FAILURE(rc))
+            {
+                RTTestIFailed("IntNetR0Open -> %Rrc (cOpened=%u)\n", rc, cOpened);
+                break;
+            }
+            ahIfs[cOpened++] = hIf;
+
+            RTMAC Mac;
+            Mac.au16[0] = 0x8086;
+            Mac.au16[1] = 0x1234;
+            Mac.au16[2] = RT_H2BE_U16((uint16_t)cOpened);
+            RTTESTI_CHECK_RC(IntNetR0IfSetMacAddress(hIf, g_pSession, &Mac), VINF_SUCCESS);
+            RTTESTI_CHECK_RC(IntNetR0IfSetActive(hIf, g_pSession, true), VINF_SUCCESS);
+        }
+
+        /*
+         * Switch frames to each of the interfaces in turn, calling the switch
+         * directly to leave out the ring buffer and wakeup costs.
+         */
+        PINTNETDSTTAB pDstTab = NULL;
+        if (   cOpened == cPorts
+            && !RTTestIErrorCount()
+            && RT_SUCCESS(intnetR0AllocDstTab(cPorts, &pDstTab)))
+        {
+            PINTNETNETWORK pNetwork = g_pIntNet->pNetworks;
+            uint64_t const nsStart  = RTTimeNanoTS();
+            for (uint32_t i = 0; i < cIterations; i++)
+            {
+                RTMAC DstMac;
+                DstMac.au16[0] = 0x8086;
+                DstMac.au16[1] = 0x1234;
+                DstMac.au16[2] = RT_H2BE_U16((uint16_t)(i % cPorts + 1));
+
+                INTNETSWDECISION enmSwDecision = intnetR0NetworkSwitchUnicast(pNetwork, 0 /*fSrc*/, NULL /*pIfSender*/,
+                                                                              &DstMac, pDstTab);
+                if (RT_UNLIKELY(   enmSwDecision != INTNETSWDECISION_INTNET
+                                || pDstTab->cIfs != 1
+                                || !intnetR0AreMacAddrsEqual(&pDstTab->aIfs[0].pIf->MacAddr, &DstMac)))
+                {
+                    RTTestIFailed("Unicast switching to %.6Rhxs failed: enmSwDecision=%d cIfs=%u\n",
+                                  &DstMac, enmSwDecision, pDstTab->cIfs);
+                    break;
+                }
+                intnetR0BusyDecIf(pDstTab->aIfs[0].pIf);
+            }
+            uint64_t const cNsElapsed = RTTimeNanoTS() - nsStart;
+
+            RTTestIValueF(cNsElapsed / cIterations, RTTESTUNIT_NS_PER_FRAME, "unicast switch, %u ports", cPorts);
+            RTMemFree(pDstTab);
+        }
+
+        while (cOpened-- > 0)
+            RTTESTI_CHECK_RC_OK(IntNetR0IfClose(ahIfs[cOpened], g_pSession));
+        RTTESTI_CHECK(IntNetR0GetNetworkCount() == 0);
+    }
+
+    IntNetR0Term();
+}
+
 
 int main(int argc, char **argv)
 {
@@ -779,6 +865,7 @@ int main(int argc, char **argv)
     TSTSTATE This;
     RT_ZERO(This);
     doTest(&This, cbRecv, cbSend);
+    doSwitchBenchmark();
 
     return RTTestSummaryAndDestroy(g_hTest);
 }
@@ -265,6 +265,10 @@ typedef struct AHCIREQ
     bool                       fMapped;
     /** Page lock when the buffer is mapped. */
     PGMPAGEMAPLOCK             PgLck;
+    /** Number of guest pages mapped for a S/G buffer. */
+    uint32_t                   cPgLcksSg;
+    /** Page locks of the guest pages mapped for a S/G buffer. */
+    PPGMPAGEMAPLOCK            paPgLcksSg;
 } AHCIREQ;
 
 /**
@@ -3561,8 +3565,10 @@ static PAHCIREQ ahciR3ReqAlloc(PAHCIPORTR3 pAhciPortR3, uint32_t uTag)
                                                      uTag, PDMIMEDIAEX_F_SUSPEND_ON_RECOVERABLE_ERR);
     if (RT_SUCCESS(rc))
     {
-        pAhciReq->hIoReq  = hIoReq;
-        pAhciReq->fMapped = false;
+        pAhciReq->hIoReq     = hIoReq;
+        pAhciReq->fMapped    = false;
+        pAhciReq->cPgLcksSg  = 0;
+        pAhciReq->paPgLcksSg = NULL;
     }
     else
         pAhciReq = NULL;
@@ -3612,6 +3618,13 @@ static bool ahciR3TransferComplete(PPDMDEVINS pDevIns, PAHCI pThis, PAHCICC pThi
 
     if (pAhciReq->fMapped)
         PDMDevHlpPhysReleasePageMappingLock(pDevIns, &pAhciReq->PgLck);
+    if (pAhciReq->cPgLcksSg)
+    {
+        PDMDevHlpPhysBulkReleasePageMappingLocks(pDevIns, pAhciReq->cPgLcksSg, pAhciReq->paPgLcksSg);
+        RTMemFree(pAhciReq->paPgLcksSg);
+        pAhciReq->cPgLcksSg  = 0;
+        pAhciReq->paPgLcksSg = NULL;
+    }
 
     if (rcReq != VERR_PDM_MEDIAEX_IOREQ_CANCELED)
     {
@@ -3872,6 +3885,122 @@ static DECLCALLBACK(int) ahciR3IoReqQueryBuf(PPDMIMEDIAEXPORT pInterface, PDMMED
     return rc;
 }
 
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqQuerySgBuf}
+ */
+static DECLCALLBACK(int) ahciR3IoReqQuerySgBuf(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                               void *pvIoReqAlloc, PRTSGSEG paSegs, unsigned *pcSegs)
+{
+    PAHCIPORTR3 pAhciPortR3 = RT_FROM_MEMBER(pInterface, AHCIPORTR3, IMediaExPort);
+    PPDMDEVINS  pDevIns     = pAhciPortR3->pDevIns;
+    PAHCIREQ    pIoReq      = (PAHCIREQ)pvIoReqAlloc;
+    RTGCPHYS    GCPhysPrdtl = pIoReq->GCPhysPrdtl;
+    unsigned    cPrdtlEntries = pIoReq->cPrdtlEntries;
+    size_t      cbLeft      = pIoReq->cbTransfer;
+    unsigned    cSegs       = 0;
+    RT_NOREF(hIoReq);
+
+    if (   pIoReq->fMapped
+        || pIoReq->cPgLcksSg
+        || !cPrdtlEntries
+        || (   pIoReq->enmType != PDMMEDIAEXIOREQTYPE_READ
+            && pIoReq->enmType != PDMMEDIAEXIOREQTYPE_WRITE))
+        return VERR_NOT_SUPPORTED;
+
+    /* Scratch space for the page addresses and mappings, the locks are kept until the request completes. */
+    PRTGCPHYS       paGCPhysPages = (PRTGCPHYS)RTMemAlloc(*pcSegs * sizeof(RTGCPHYS));
+    void          **papvPages     = (void **)RTMemAlloc(*pcSegs * sizeof(void *));
+    PPGMPAGEMAPLOCK paPgLcks      = (PPGMPAGEMAPLOCK)RTMemAlloc(*pcSegs * sizeof(PGMPAGEMAPLOCK));
+    int rc = VINF_SUCCESS;
+
+    if (   !paGCPhysPages
+        || !papvPages
+        || !paPgLcks)
+        rc = VERR_NO_MEMORY;
+
+    /*
+     * Split the PRDT entries at guest page boundaries, each page is mapped
+     * on its own. The in page offset is kept in the segment for now.
+     */
+    while (   RT_SUCCESS(rc)
+           && cPrdtlEntries
+           && cbLeft)
+    {
+        SGLEntry aPrdtlEntries[32];
+        uint32_t const cPrdtlEntriesRead = RT_MIN(cPrdtlEntries, RT_ELEMENTS(aPrdtlEntries));
+
+        PDMDevHlpPhysRead(pDevIns, GCPhysPrdtl, &aPrdtlEntries[0], cPrdtlEntriesRead * sizeof(SGLEntry));
+
+        for (uint32_t i = 0; i < cPrdtlEntriesRead && cbLeft && RT_SUCCESS(rc); i++)
+        {
+            RTGCPHYS GCPhys = AHCI_RTGCPHYS_FROM_U32(aPrdtlEntries[i].u32DBAUp, aPrdtlEntries[i].u32DBA);
+            size_t   cbData = RT_MIN((aPrdtlEntries[i].u32DescInf & SGLENTRY_DESCINF_DBC) + 1, cbLeft);
+
+            /* The caller can't use anything not sector aligned, don't lock any pages for it. */
+            if ((GCPhys | cbData) & (512 - 1))
+            {
+                rc = VERR_NOT_SUPPORTED;
+                break;
+            }
+
+            cbLeft -= cbData;
+            while (cbData)
+            {
+                if (cSegs == *pcSegs)
+                {
+                    rc = VERR_BUFFER_OVERFLOW;
+                    break;
+                }
+
+                size_t cbThisSeg = RT_MIN(cbData, PAGE_SIZE - (GCPhys & PAGE_OFFSET_MASK));
+
+                paGCPhysPages[cSegs] = GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK;
+                paSegs[cSegs].pvSeg  = (void *)(uintptr_t)(GCPhys & PAGE_OFFSET_MASK);
+                paSegs[cSegs].cbSeg  = cbThisSeg;
+                cSegs++;
+
+                GCPhys += cbThisSeg;
+                cbData -= cbThisSeg;
+            }
+        }
+
+        GCPhysPrdtl   += cPrdtlEntriesRead * sizeof(SGLEntry);
+        cPrdtlEntries -= cPrdtlEntriesRead;
+    }
+
+    /* The PRDT is too small, leave the overflow handling to the copy path. */
+    if (   RT_SUCCESS(rc)
+        && cbLeft)
+        rc = VERR_NOT_SUPPORTED;
+
+    if (RT_SUCCESS(rc))
+    {
+        /* Data read from the medium goes into guest memory, written data only needs to be read from it. */
+        if (pIoReq->enmType == PDMMEDIAEXIOREQTYPE_READ)
+            rc = PDMDevHlpPhysBulkGCPhys2CCPtr(pDevIns, cSegs, paGCPhysPages, 0 /*fFlags*/, papvPages, paPgLcks);
+        else
+            rc = PDMDevHlpPhysBulkGCPhys2CCPtrReadOnly(pDevIns, cSegs, paGCPhysPages, 0 /*fFlags*/,
+                                                       (void const **)papvPages, paPgLcks);
+        if (RT_SUCCESS(rc))
+        {
+            for (unsigned i = 0; i < cSegs; i++)
+                paSegs[i].pvSeg = (uint8_t *)papvPages[i] + (uintptr_t)paSegs[i].pvSeg;
+
+            pIoReq->cPgLcksSg  = cSegs;
+            pIoReq->paPgLcksSg = paPgLcks;
+            paPgLcks = NULL;
+            *pcSegs = cSegs;
+        }
+        else
+            rc = VERR_NOT_SUPPORTED; /* MMIO or pages with access handlers, copy instead. */
+    }
+
+    RTMemFree(paGCPhysPages);
+    RTMemFree(papvPages);
+    RTMemFree(paPgLcks);
+    return rc;
+}
+
 /**
  * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqQueryDiscardRanges}
  */
@@ -4588,6 +4717,8 @@ static DECLCALLBACK(int) ahciAsyncIOLoop(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
                 Req.uTag       = idx;
                 Req.fFlags     = AHCI_REQ_IS_ON_STACK;
                 Req.fMapped    = false;
+                Req.cPgLcksSg  = 0;
+                Req.paPgLcksSg = NULL;
                 Req.cbTransfer = 0;
                 Req.uOffset    = 0;
                 Req.enmType    = PDMMEDIAEXIOREQTYPE_INVALID;
@@ -5965,6 +6096,7 @@ static DECLCALLBACK(int) ahciR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFG
         pAhciPortR3->IMediaExPort.pfnIoReqCopyFromBuf        = ahciR3IoReqCopyFromBuf;
         pAhciPortR3->IMediaExPort.pfnIoReqCopyToBuf          = ahciR3IoReqCopyToBuf;
         pAhciPortR3->IMediaExPort.pfnIoReqQueryBuf           = ahciR3IoReqQueryBuf;
+        pAhciPortR3->IMediaExPort.pfnIoReqQuerySgBuf         = ahciR3IoReqQuerySgBuf;
         pAhciPortR3->IMediaExPort.pfnIoReqQueryDiscardRanges = ahciR3IoReqQueryDiscardRanges;
         pAhciPortR3->IMediaExPort.pfnIoReqStateChanged       = ahciR3IoReqStateChanged;
         pAhciPortR3->IMediaExPort.pfnMediumEjected           = ahciR3MediumEjected;
@@ -5505,6 +5505,7 @@ static DECLCALLBACK(int) lsilogicR3Construct(PPDMDEVINS pDevIns, int iInstance,
         pDevice->IMediaExPort.pfnIoReqCopyFromBuf        = lsilogicR3IoReqCopyFromBuf;
         pDevice->IMediaExPort.pfnIoReqCopyToBuf          = lsilogicR3IoReqCopyToBuf;
         pDevice->IMediaExPort.pfnIoReqQueryBuf           = NULL;
+        pDevice->IMediaExPort.pfnIoReqQuerySgBuf         = NULL;
         pDevice->IMediaExPort.pfnIoReqQueryDiscardRanges = NULL;
         pDevice->IMediaExPort.pfnIoReqStateChanged       = lsilogicR3IoReqStateChanged;
         pDevice->IMediaExPort.pfnMediumEjected           = lsilogicR3MediumEjected;
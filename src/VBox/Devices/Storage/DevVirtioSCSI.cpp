@@ -2543,6 +2543,7 @@ static DECLCALLBACK(int) virtioScsiR3Construct(PPDMDEVINS pDevIns, int iInstance
         pTarget->IMediaExPort.pfnIoReqStateChanged       = virtioScsiR3IoReqStateChanged;
         pTarget->IMediaExPort.pfnMediumEjected           = virtioScsiR3MediumEjected;
         pTarget->IMediaExPort.pfnIoReqQueryBuf           = NULL; /* When used avoids copyFromBuf CopyToBuf*/
+        pTarget->IMediaExPort.pfnIoReqQuerySgBuf         = NULL;
         pTarget->IMediaExPort.pfnIoReqQueryDiscardRanges = NULL;
 
         pTarget->IBase.pfnQueryInterface                 = virtioScsiR3TargetQueryInterface;
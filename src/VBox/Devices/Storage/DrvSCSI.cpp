@@ -40,6 +40,9 @@
 
 /** The maximum number of release log entries per device. */
 #define MAX_LOG_REL_ERRORS  1024
+/** Buffers of at least this size are page allocated so the driver below can
+ * access them directly, see pfnIoReqQuerySgBuf. */
+#define DRVSCSI_PAGE_ALLOC_MIN  _4K
 
 /**
  * Eject state.
@@ -609,6 +612,39 @@ static DECLCALLBACK(int) drvscsiIoReqCopyToBuf(PPDMIMEDIAEXPORT pInterface, PDMM
     return cbCopied == cbCopy ? VINF_SUCCESS : VERR_PDM_MEDIAEX_IOBUF_UNDERRUN;
 }
 
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqQuerySgBuf}
+ */
+static DECLCALLBACK(int) drvscsiIoReqQuerySgBuf(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                void *pvIoReqAlloc, PRTSGSEG paSegs, unsigned *pcSegs)
+{
+    RT_NOREF2(pInterface, hIoReq);
+
+    VSCSIIOREQ hVScsiIoReq = DRVSCSI_PDMMEDIAEXIOREQ_2_VSCSIIOREQ(pvIoReqAlloc);
+    uint64_t  uOffset    = 0;
+    size_t    cbTransfer = 0;
+    size_t    cbSeg      = 0;
+    PCRTSGSEG paSeg      = NULL;
+    unsigned  cSeg       = 0;
+
+    int rc = VSCSIIoReqParamsGet(hVScsiIoReq, &uOffset, &cbTransfer, &cSeg, &cbSeg, &paSeg);
+    if (RT_SUCCESS(rc))
+    {
+        /* The segments are owned by the VSCSI request and stay valid until it completes. */
+        if (cSeg <= *pcSegs)
+        {
+            memcpy(paSegs, paSeg, cSeg * sizeof(RTSGSEG));
+            *pcSegs = cSeg;
+        }
+        else
+            rc = VERR_BUFFER_OVERFLOW;
+    }
+    else
+        rc = VERR_NOT_SUPPORTED;
+
+    return rc;
+}
+
 /**
  * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqQueryDiscardRanges}
  */
@@ -933,7 +969,10 @@ static DECLCALLBACK(int) drvscsiIoReqSendScsiCmd(PPDMIMEDIAEX pInterface, PDMMED
     /* Allocate and sync buffers if a data transfer is indicated. */
     if (cbBuf)
     {
-        pReq->pvBuf = RTMemAlloc(cbBuf);
+        if (cbBuf >= DRVSCSI_PAGE_ALLOC_MIN)
+            pReq->pvBuf = RTMemPageAlloc(cbBuf);
+        else
+            pReq->pvBuf = RTMemAlloc(cbBuf);
         if (RT_UNLIKELY(!pReq->pvBuf))
             rc = VERR_NO_MEMORY;
     }
@@ -1041,7 +1080,10 @@ static DECLCALLBACK(void) drvscsiIoReqVScsiReqCompleted(VSCSIDEVICE hVScsiDevice
 
     if (pReq->pvBuf)
     {
-        RTMemFree(pReq->pvBuf);
+        if (pReq->cbBuf >= DRVSCSI_PAGE_ALLOC_MIN)
+            RTMemPageFree(pReq->pvBuf, pReq->cbBuf);
+        else
+            RTMemFree(pReq->pvBuf);
         pReq->pvBuf = NULL;
     }
 
@@ -1388,6 +1430,7 @@ static DECLCALLBACK(int) drvscsiConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, ui
     pThis->IPortEx.pfnIoReqCopyFromBuf          = drvscsiIoReqCopyFromBuf;
     pThis->IPortEx.pfnIoReqCopyToBuf            = drvscsiIoReqCopyToBuf;
     pThis->IPortEx.pfnIoReqQueryBuf             = NULL;
+    pThis->IPortEx.pfnIoReqQuerySgBuf           = drvscsiIoReqQuerySgBuf;
     pThis->IPortEx.pfnIoReqQueryDiscardRanges   = drvscsiIoReqQueryDiscardRanges;
     pThis->IPortEx.pfnIoReqStateChanged         = drvscsiIoReqStateChanged;
 
@@ -98,6 +98,16 @@ extern bool DevINIPConfigured(void);
 #define DRVVD_IOREQ_SAVED_STATE_VERSION UINT32_C(1)
 /** Maximum number of request errors in the release log before muting. */
 #define DRVVD_MAX_LOG_REL_ERRORS        100
+/** Minimum request size to try working on the memory of the request initiator directly. */
+#define DRVVD_ZERO_COPY_THRESHOLD       _16K
+/** Required alignment of all segments for the zero copy path. */
+#define DRVVD_ZERO_COPY_ALIGN           512
+/** Number of records kept in the I/O trace ring (power of two). */
+#define DRVVD_IOTRACE_RECS              1024
+/** Default amount of dirty data a write-back cache may hold before it is written back. */
+#define DRVVD_CACHE_DIRTY_MAX_DEFAULT   _64M
+/** Interval in milliseconds the cache destage thread checks the amount of dirty data. */
+#define DRVVD_CACHE_DESTAGE_INTERVAL_MS 1000
 
 /** Forward declaration for the dis kcontainer. */
 typedef struct VBOXDISK *PVBOXDISK;
@@ -213,8 +223,10 @@ typedef struct PDMMEDIAEXIOREQINT
                 /** Direct buffer. */
                 struct
                 {
-                    /** Segment for the data buffer. */
-                    RTSGSEG               Seg;
+                    /** Segment array describing the memory of the request initiator. */
+                    PRTSGSEG              paSegs;
+                    /** Number of segments in the array. */
+                    unsigned              cSegs;
                     /** S/G buffer structure. */
                     RTSGBUF               SgBuf;
                 } Direct;
@@ -324,6 +336,12 @@ typedef struct VBOXDISK
     VDINTERFACEIO            VDIfIoCache;
     /** Interface list for the cache image. */
     PVDINTERFACE             pVDIfsCache;
+    /** Amount of dirty data a write-back cache may hold before it is written back. */
+    uint64_t                 cbCacheDirtyMax;
+    /** Thread writing back dirty data of a write-back cache, NULL if none. */
+    PPDMTHREAD               pCacheDestageThread;
+    /** Event to wake up the cache destage thread. */
+    RTSEMEVENT               hEvtCacheDestage;
 
     /** The block cache handle if configured. */
     PPDMBLKCACHE             pBlkCache;
@@ -340,6 +358,9 @@ typedef struct VBOXDISK
     bool                    fBiosVisible;
     /** Flag whether this medium should be presented as non rotational. */
     bool                    fNonRotational;
+    /** Flag whether large requests may use the memory of the device/driver above
+     * directly instead of bouncing it through an I/O buffer. */
+    bool                    fZeroCopy;
     /** Flag whether a suspend is in progress right now. */
     volatile bool           fSuspending;
 #ifdef VBOX_PERIODIC_FLUSH
@@ -421,6 +442,8 @@ typedef struct VBOXDISK
     STAMCOUNTER              StatQueryBufAttempts;
     /** How many attempts to query a direct buffer pointer succeeded. */
     STAMCOUNTER              StatQueryBufSuccess;
+    /** How many direct buffers were rejected because of unsuitable alignment. */
+    STAMCOUNTER              StatQueryBufUnaligned;
     /** Release statistics: number of bytes written. */
     STAMCOUNTER              StatBytesWritten;
     /** Release statistics: number of bytes read. */
@@ -442,6 +465,32 @@ typedef struct VBOXDISK
     /** Release statistics: Number of I/O requests processed per second. */
     STAMCOUNTER              StatReqsPerSec;
     /** @} */
+
+    /** @name I/O request tracing.
+     * @{ */
+    /** Flag whether I/O request tracing is enabled. */
+    bool                     fIoTrace;
+    /** I/O tracing interface. */
+    VDINTERFACEIOTRACE       VDIfIoTrace;
+    /** Ring of the most recently completed requests, DRVVD_IOTRACE_RECS entries. */
+    PVDIOTRACEREC            paIoTraceRecs;
+    /** Number of records written to the ring so far. */
+    volatile uint32_t        cIoTraceRecs;
+    /** Time from queueing until the disk lock was acquired. */
+    STAMHISTOGRAM            StatLatLockWait;
+    /** Time until the first transfer was submitted (includes metadata lookups of the backend). */
+    STAMHISTOGRAM            StatLatPrepare;
+    /** Time from the first submitted transfer until completion. */
+    STAMHISTOGRAM            StatLatIo;
+    /** Total time of read requests. */
+    STAMHISTOGRAM            StatLatRead;
+    /** Total time of write requests. */
+    STAMHISTOGRAM            StatLatWrite;
+    /** Total time of flush requests. */
+    STAMHISTOGRAM            StatLatFlush;
+    /** Total time of discard requests. */
+    STAMHISTOGRAM            StatLatDiscard;
+    /** @} */
 } VBOXDISK;
 
 
@@ -895,6 +944,101 @@ static DECLCALLBACK(int) drvvdThreadFinishWrite(void *pvUser)
 }
 
 
+/*********************************************************************************************************************************
+*   VD I/O tracing interface implementation                                                                                      *
+*********************************************************************************************************************************/
+
+/**
+ * Adds the given time span to a latency histogram.
+ *
+ * @returns nothing.
+ * @param   pHistogram  The histogram.
+ * @param   tsStart     Start of the time span.
+ * @param   tsEnd       End of the time span.
+ */
+DECLINLINE(void) drvvdIoTraceHistogramAdd(PSTAMHISTOGRAM pHistogram, uint64_t tsStart, uint64_t tsEnd)
+{
+    STAM_REL_HISTOGRAM_ADD(pHistogram, tsEnd > tsStart ? tsEnd - tsStart : 0);
+}
+
+static DECLCALLBACK(void) drvvdIoTraceIoReqCompleted(void *pvUser, PCVDIOTRACEREC pRec)
+{
+    PVBOXDISK pThis = (PVBOXDISK)pvUser;
+
+    /* Record the request in the ring, readers might see a torn record under heavy load which is fine for diagnostics. */
+    uint32_t idxRec = ASMAtomicIncU32(&pThis->cIoTraceRecs) - 1;
+    pThis->paIoTraceRecs[idxRec % DRVVD_IOTRACE_RECS] = *pRec;
+
+    if (pRec->tsLocked)
+        drvvdIoTraceHistogramAdd(&pThis->StatLatLockWait, pRec->tsQueued, pRec->tsLocked);
+    if (pRec->tsSubmitted)
+    {
+        drvvdIoTraceHistogramAdd(&pThis->StatLatPrepare, pRec->tsLocked ? pRec->tsLocked : pRec->tsQueued,
+                                 pRec->tsSubmitted);
+        drvvdIoTraceHistogramAdd(&pThis->StatLatIo, pRec->tsSubmitted, pRec->tsCompleted);
+    }
+
+    switch (pRec->enmType)
+    {
+        case VDIOTRACEREQTYPE_READ:
+            drvvdIoTraceHistogramAdd(&pThis->StatLatRead, pRec->tsQueued, pRec->tsCompleted);
+            break;
+        case VDIOTRACEREQTYPE_WRITE:
+            drvvdIoTraceHistogramAdd(&pThis->StatLatWrite, pRec->tsQueued, pRec->tsCompleted);
+            break;
+        case VDIOTRACEREQTYPE_FLUSH:
+            drvvdIoTraceHistogramAdd(&pThis->StatLatFlush, pRec->tsQueued, pRec->tsCompleted);
+            break;
+        case VDIOTRACEREQTYPE_DISCARD:
+            drvvdIoTraceHistogramAdd(&pThis->StatLatDiscard, pRec->tsQueued, pRec->tsCompleted);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @callback_method_impl{FNDBGFHANDLERDRV, Dumps the I/O trace ring.}
+ */
+static DECLCALLBACK(void) drvvdIoTraceInfo(PPDMDRVINS pDrvIns, PCDBGFINFOHLP pHlp, const char *pszArgs)
+{
+    PVBOXDISK pThis = PDMINS_2_DATA(pDrvIns, PVBOXDISK);
+    static const char * const s_apszType[] = { "INVALID", "READ", "WRITE", "FLUSH", "DISCARD" };
+
+    uint32_t cRecsDump = 64;
+    if (pszArgs && *pszArgs)
+    {
+        int rc = RTStrToUInt32Full(RTStrStripL(pszArgs), 0, &cRecsDump);
+        if (RT_FAILURE(rc))
+        {
+            pHlp->pfnPrintf(pHlp, "Invalid number of records to dump: %s\n", pszArgs);
+            return;
+        }
+    }
+
+    uint32_t cRecs = ASMAtomicReadU32(&pThis->cIoTraceRecs);
+    cRecsDump = RT_MIN(cRecsDump, RT_MIN(cRecs, DRVVD_IOTRACE_RECS));
+
+    pHlp->pfnPrintf(pHlp, "%u requests traced, showing the last %u (times in us)\n", cRecs, cRecsDump);
+    pHlp->pfnPrintf(pHlp, "%10s %-7s %16s %10s %10s %10s %10s %10s %10s %5s %5s\n",
+                    "#", "Type", "Offset", "Size", "Status", "LockWait", "Prepare", "I/O", "Total", "Meta", "Data");
+    for (uint32_t i = cRecs - cRecsDump; i != cRecs; i++)
+    {
+        VDIOTRACEREC Rec = pThis->paIoTraceRecs[i % DRVVD_IOTRACE_RECS];
+        uint64_t tsPrepStart = Rec.tsLocked ? Rec.tsLocked : Rec.tsQueued;
+
+        pHlp->pfnPrintf(pHlp, "%10u %-7s %16RX64 %10zu %10Rrc %10RU64 %10RU64 %10RU64 %10RU64 %5u %5u\n",
+                        i, Rec.enmType < RT_ELEMENTS(s_apszType) ? s_apszType[Rec.enmType] : "???",
+                        Rec.off, Rec.cbTransfer, Rec.rcReq,
+                        Rec.tsLocked    ? (Rec.tsLocked - Rec.tsQueued) / RT_NS_1US : 0,
+                        Rec.tsSubmitted ? (Rec.tsSubmitted - tsPrepStart) / RT_NS_1US : 0,
+                        Rec.tsSubmitted ? (Rec.tsCompleted - Rec.tsSubmitted) / RT_NS_1US : 0,
+                        (Rec.tsCompleted - Rec.tsQueued) / RT_NS_1US,
+                        Rec.cMetaXfers, Rec.cDataXfers);
+    }
+}
+
+
 /*********************************************************************************************************************************
 *   VD Configuration interface implementation                                                                                    *
 *********************************************************************************************************************************/
@@ -2625,34 +2769,51 @@ DECLINLINE(int) drvvdMediaExIoReqBufAlloc(PVBOXDISK pThis, PPDMMEDIAEXIOREQINT p
     int rc = VERR_NOT_SUPPORTED;
     LogFlowFunc(("pThis=%#p pIoReq=%#p cb=%zu\n", pThis, pIoReq, cb));
 
-/** @todo This does not work at all with encryption enabled because the encryption plugin
- *         encrypts the data in place trashing guest memory and causing data corruption later on!
- *
- * DO NOT ENABLE UNLESS YOU WANT YOUR DATA SHREDDED!!!
- */
-#if 0
-    if (   cb == _4K
-        && pThis->pDrvMediaExPort->pfnIoReqQueryBuf)
+    /*
+     * Try to work on the memory of the request initiator directly for large transfers.
+     * This is never done with encryption enabled because the encryption plugin encrypts
+     * the data in place which would trash guest memory.
+     */
+    if (   pThis->fZeroCopy
+        && !pThis->pCfgCrypto
+        && cb >= DRVVD_ZERO_COPY_THRESHOLD
+        && pThis->pDrvMediaExPort->pfnIoReqQuerySgBuf)
     {
-        /* Try to get a direct pointer to the buffer first. */
-        void *pvBuf = NULL;
-        size_t cbBuf = 0;
-
-        STAM_COUNTER_INC(&pThis->StatQueryBufAttempts);
-        rc = pThis->pDrvMediaExPort->pfnIoReqQueryBuf(pThis->pDrvMediaExPort, pIoReq, &pIoReq->abAlloc[0],
-                                                      &pvBuf, &cbBuf);
-        if (RT_SUCCESS(rc))
+        unsigned cSegs = (unsigned)(cb / _4K) + 2; /* Worst case for page granular guest memory. */
+        PRTSGSEG paSegs = (PRTSGSEG)RTMemAllocZ(cSegs * sizeof(RTSGSEG));
+        if (paSegs)
         {
-            STAM_COUNTER_INC(&pThis->StatQueryBufSuccess);
-            pIoReq->ReadWrite.cbIoBuf           = cbBuf;
-            pIoReq->ReadWrite.fDirectBuf        = true;
-            pIoReq->ReadWrite.Direct.Seg.pvSeg  = pvBuf;
-            pIoReq->ReadWrite.Direct.Seg.cbSeg  = cbBuf;
-            RTSgBufInit(&pIoReq->ReadWrite.Direct.SgBuf, &pIoReq->ReadWrite.Direct.Seg, 1);
-            pIoReq->ReadWrite.pSgBuf = &pIoReq->ReadWrite.Direct.SgBuf;
+            STAM_COUNTER_INC(&pThis->StatQueryBufAttempts);
+            rc = pThis->pDrvMediaExPort->pfnIoReqQuerySgBuf(pThis->pDrvMediaExPort, pIoReq, &pIoReq->abAlloc[0],
+                                                            paSegs, &cSegs);
+            if (RT_SUCCESS(rc))
+            {
+                /* The medium is accessed in sectors, reject anything which is not sector aligned. */
+                if (IOBUFMgrIsSgUsable(paSegs, cSegs, cb, DRVVD_ZERO_COPY_ALIGN))
+                {
+                    STAM_COUNTER_INC(&pThis->StatQueryBufSuccess);
+                    pIoReq->ReadWrite.cbIoBuf       = cb;
+                    pIoReq->ReadWrite.fDirectBuf    = true;
+                    pIoReq->ReadWrite.Direct.paSegs = paSegs;
+                    pIoReq->ReadWrite.Direct.cSegs  = cSegs;
+                    RTSgBufInit(&pIoReq->ReadWrite.Direct.SgBuf, paSegs, cSegs);
+                    pIoReq->ReadWrite.pSgBuf = &pIoReq->ReadWrite.Direct.SgBuf;
+                }
+                else
+                {
+                    STAM_COUNTER_INC(&pThis->StatQueryBufUnaligned);
+                    rc = VERR_INVALID_PARAMETER;
+                }
+            }
+
+            if (RT_FAILURE(rc))
+                RTMemFree(paSegs);
         }
+        else
+            rc = VERR_NO_MEMORY;
+
+        /* Fall back to the I/O buffer manager below on any failure. */
     }
-#endif
 
     if (RT_FAILURE(rc))
     {
@@ -2909,6 +3070,13 @@ static int drvvdMediaExIoReqReadWriteProcess(PVBOXDISK pThis, PPDMMEDIAEXIOREQIN
 
         size_t cbReqIo = RT_MIN(pIoReq->ReadWrite.cbReqLeft, pIoReq->ReadWrite.cbIoBuf);
 
+        if (pIoReq->ReadWrite.fDirectBuf)
+        {
+            /* Position the S/G buffer at the current offset, the request might be retried after a suspend. */
+            RTSgBufReset(pIoReq->ReadWrite.pSgBuf);
+            RTSgBufAdvance(pIoReq->ReadWrite.pSgBuf, pIoReq->ReadWrite.cbReq - pIoReq->ReadWrite.cbReqLeft);
+        }
+
         if (pIoReq->enmType == PDMMEDIAEXIOREQTYPE_READ)
             rc = drvvdMediaExIoReqReadWrapper(pThis, pIoReq, cbReqIo, &cbReqIo);
         else
@@ -3046,8 +3214,17 @@ DECLINLINE(void) drvvdMediaExIoReqBufFree(PVBOXDISK pThis, PPDMMEDIAEXIOREQINT p
 
     if (   (   pIoReq->enmType == PDMMEDIAEXIOREQTYPE_READ
             || pIoReq->enmType == PDMMEDIAEXIOREQTYPE_WRITE)
-        && !pIoReq->ReadWrite.fDirectBuf
-        && pIoReq->ReadWrite.cbIoBuf > 0)
+        && pIoReq->ReadWrite.fDirectBuf)
+    {
+        /* The memory itself belongs to the device/driver above, only the segment array is ours. */
+        RTMemFree(pIoReq->ReadWrite.Direct.paSegs);
+        pIoReq->ReadWrite.Direct.paSegs = NULL;
+        pIoReq->ReadWrite.Direct.cSegs  = 0;
+        pIoReq->ReadWrite.fDirectBuf    = false;
+    }
+    else if (   (   pIoReq->enmType == PDMMEDIAEXIOREQTYPE_READ
+                 || pIoReq->enmType == PDMMEDIAEXIOREQTYPE_WRITE)
+             && pIoReq->ReadWrite.cbIoBuf > 0)
     {
         IOBUFMgrFreeBuf(&pIoReq->ReadWrite.IoBuf);
 
@@ -4088,6 +4265,8 @@ static int drvvdStatsRegister(PVBOXDISK pThis)
                            "Number of attempts to query a direct buffer.",              "%s/QueryBufAttempts", szPrefix);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatQueryBufSuccess,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
                            "Number of succeeded attempts to query a direct buffer.",    "%s/QueryBufSuccess", szPrefix);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatQueryBufUnaligned,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
+                           "Number of direct buffers rejected because of the alignment.", "%s/QueryBufUnaligned", szPrefix);
 
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatBytesRead,          STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_BYTES,
                            "Amount of data read.",                          "%s/BytesRead", szPrefix);
@@ -4112,6 +4291,37 @@ static int drvvdStatsRegister(PVBOXDISK pThis)
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatReqsPerSec,         STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
                            "Number of processed I/O requests per second.",  "%s/ReqsPerSec", szPrefix);
 
+    if (pThis->fIoTrace)
+    {
+        static const struct
+        {
+            size_t      offStats;
+            const char *pszName;
+            const char *pszDesc;
+        } s_aHistograms[] =
+        {
+            { RT_UOFFSETOF(VBOXDISK, StatLatLockWait), "LockWait", "Time from queueing a request until it acquired the disk lock." },
+            { RT_UOFFSETOF(VBOXDISK, StatLatPrepare),  "Prepare",  "Time until the first transfer of a request was submitted." },
+            { RT_UOFFSETOF(VBOXDISK, StatLatIo),       "Io",       "Time from the first submitted transfer until a request completed." },
+            { RT_UOFFSETOF(VBOXDISK, StatLatRead),     "Read",     "Total time of read requests." },
+            { RT_UOFFSETOF(VBOXDISK, StatLatWrite),    "Write",    "Total time of write requests." },
+            { RT_UOFFSETOF(VBOXDISK, StatLatFlush),    "Flush",    "Total time of flush requests." },
+            { RT_UOFFSETOF(VBOXDISK, StatLatDiscard),  "Discard",  "Total time of discard requests." }
+        };
+
+        for (unsigned i = 0; i < RT_ELEMENTS(s_aHistograms); i++)
+            PDMDrvHlpSTAMRegisterF(pDrvIns, (uint8_t *)pThis + s_aHistograms[i].offStats, STAMTYPE_HISTOGRAM,
+                                   STAMVISIBILITY_USED, STAMUNIT_NS, s_aHistograms[i].pszDesc, "%s/Latency/%s",
+                                   szPrefix, s_aHistograms[i].pszName);
+
+        /* The info handler is deregistered automatically when the driver is destroyed. */
+        char szInfo[64];
+        RTStrPrintf(szInfo, sizeof(szInfo), "vdiotrace-%s%u-%u", pcszController, iInstance, iLUN);
+        rc = PDMDrvHlpDBGFInfoRegister(pDrvIns, szInfo, "Dumps the most recent I/O requests of the disk. "
+                                       "Argument: number of requests to dump", drvvdIoTraceInfo);
+        AssertRC(rc);
+    }
+
     return VINF_SUCCESS;
 }
 
@@ -4127,6 +4337,7 @@ static void drvvdStatsDeregister(PVBOXDISK pThis)
 
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatQueryBufAttempts);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatQueryBufSuccess);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatQueryBufUnaligned);
 
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatBytesRead);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatBytesWritten);
@@ -4138,6 +4349,17 @@ static void drvvdStatsDeregister(PVBOXDISK pThis)
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReqsRead);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReqsDiscard);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReqsPerSec);
+
+    if (pThis->fIoTrace)
+    {
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatLatLockWait);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatLatPrepare);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatLatIo);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatLatRead);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatLatWrite);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatLatFlush);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatLatDiscard);
+    }
 }
 
 
@@ -4223,6 +4445,19 @@ static void drvvdPowerOffOrDestructOrUnmount(PPDMDRVINS pDrvIns)
         AssertRC(rc);
     }
 
+    if (pThis->pCacheDestageThread)
+    {
+        int rc = PDMR3ThreadDestroy(pThis->pCacheDestageThread, NULL);
+        AssertRC(rc);
+        pThis->pCacheDestageThread = NULL;
+    }
+
+    if (pThis->hEvtCacheDestage != NIL_RTSEMEVENT)
+    {
+        RTSemEventDestroy(pThis->hEvtCacheDestage);
+        pThis->hEvtCacheDestage = NIL_RTSEMEVENT;
+    }
+
     if (RT_VALID_PTR(pThis->pBlkCache))
     {
         PDMR3BlkCacheRelease(pThis->pBlkCache);
@@ -4243,6 +4478,46 @@ static void drvvdPowerOffOrDestructOrUnmount(PPDMDRVINS pDrvIns)
     drvvdFreeImages(pThis);
 }
 
+/**
+ * @callback_method_impl{FNPDMTHREADDRV,
+ *      Writes back the oldest dirty data of a write-back cache holding more than the configured limit.}
+ */
+static DECLCALLBACK(int) drvvdCacheDestageThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    PVBOXDISK pThis = PDMINS_2_DATA(pDrvIns, PVBOXDISK);
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        uint64_t cbDirty = VDCacheGetDirtySize(pThis->pDisk);
+        if (cbDirty > pThis->cbCacheDirtyMax)
+        {
+            /* Go down to half the limit so the thread doesn't have to run after every write. */
+            int rc = VDCacheDestage(pThis->pDisk, cbDirty - pThis->cbCacheDirtyMax / 2);
+            if (RT_FAILURE(rc))
+                LogRelMax(DRVVD_MAX_LOG_REL_ERRORS,
+                          ("VD#%u: Writing back dirty data of the cache failed with %Rrc\n", pDrvIns->iInstance, rc));
+        }
+
+        RTSemEventWait(pThis->hEvtCacheDestage, DRVVD_CACHE_DESTAGE_INTERVAL_MS);
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * @callback_method_impl{FNPDMTHREADWAKEUPDRV}
+ */
+static DECLCALLBACK(int) drvvdCacheDestageThreadWakeup(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    RT_NOREF(pThread);
+    PVBOXDISK pThis = PDMINS_2_DATA(pDrvIns, PVBOXDISK);
+
+    return RTSemEventSignal(pThis->hEvtCacheDestage);
+}
+
 /**
  * @copydoc FNPDMDRVPOWEROFF
  */
@@ -4460,6 +4735,11 @@ static DECLCALLBACK(void) drvvdDestruct(PPDMDRVINS pDrvIns)
         RTMemCacheDestroy(pThis->hIoReqCache);
     if (pThis->hIoBufMgr != NIL_IOBUFMGR)
         IOBUFMgrDestroy(pThis->hIoBufMgr);
+    if (pThis->paIoTraceRecs)
+    {
+        RTMemFree(pThis->paIoTraceRecs);
+        pThis->paIoTraceRecs = NULL;
+    }
     if (RTCritSectIsInitialized(&pThis->CritSectIoReqsIoBufWait))
         RTCritSectDelete(&pThis->CritSectIoReqsIoBufWait);
     if (RTCritSectIsInitialized(&pThis->CritSectIoReqRedo))
@@ -4486,6 +4766,7 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
     char *pszFormat = NULL;      /* The format backed to use for this image. */
     char *pszCachePath = NULL;   /* The path to the cache image. */
     char *pszCacheFormat = NULL; /* The format backend to use for the cache image. */
+    bool fCacheWriteBack = false; /* True if the cache image buffers writes. */
     bool fReadOnly = false;      /* True if the media is read-only. */
     bool fMaybeReadOnly = false; /* True if the media may or may not be read-only. */
     bool fHonorZeroWrites = false; /* True if zero blocks should be written. */
@@ -4508,6 +4789,8 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
     pThis->pIfSecKey                    = NULL;
     pThis->hIoReqCache                  = NIL_RTMEMCACHE;
     pThis->hIoBufMgr                    = NIL_IOBUFMGR;
+    pThis->pCacheDestageThread          = NULL;
+    pThis->hEvtCacheDestage             = NIL_RTSEMEVENT;
     pThis->pRegionList                  = NULL;
     pThis->fSuspending                  = false;
     pThis->fRedo                        = false;
@@ -4627,6 +4910,7 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
     bool        fHostIP = false;
     bool        fUseNewIo = false;
     bool        fUseBlockCache = false;
+    uint32_t    cbBlockCacheReadAhead = UINT32_MAX;
     bool        fDiscard = false;
     bool        fInformAboutZeroBlocks = false;
     bool        fSkipConsistencyChecks = false;
@@ -4647,11 +4931,11 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                           "Format\0Path\0"
                                           "ReadOnly\0MaybeReadOnly\0TempReadOnly\0Shareable\0HonorZeroWrites\0"
                                           "HostIPStack\0UseNewIo\0BootAcceleration\0BootAccelerationBuffer\0"
-                                          "SetupMerge\0MergeSource\0MergeTarget\0BwGroup\0Type\0BlockCache\0"
-                                          "CachePath\0CacheFormat\0Discard\0InformAboutZeroBlocks\0"
+                                          "SetupMerge\0MergeSource\0MergeTarget\0BwGroup\0Type\0BlockCache\0BlockCacheReadAhead\0"
+                                          "CachePath\0CacheFormat\0CacheWriteBack\0CacheDirtyMax\0Discard\0InformAboutZeroBlocks\0"
                                           "SkipConsistencyChecks\0"
                                           "Locked\0BIOSVisible\0Cylinders\0Heads\0Sectors\0Mountable\0"
-                                          "EmptyDrive\0IoBufMax\0NonRotationalMedium\0"
+                                          "EmptyDrive\0IoBufMax\0NonRotationalMedium\0ZeroCopy\0IoTrace\0"
 #if defined(VBOX_PERIODIC_FLUSH) || defined(VBOX_IGNORE_FLUSH)
                                           "FlushInterval\0IgnoreFlush\0IgnoreFlushAsync\0"
 #endif /* !(VBOX_PERIODIC_FLUSH || VBOX_IGNORE_FLUSH) */
@@ -4768,6 +5052,13 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                       N_("DrvVD: Configuration error: Querying \"BlockCache\" as boolean failed"));
                 break;
             }
+            rc = CFGMR3QueryU32Def(pCurNode, "BlockCacheReadAhead", &cbBlockCacheReadAhead, UINT32_MAX);
+            if (RT_FAILURE(rc))
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                      N_("DrvVD: Configuration error: Querying \"BlockCacheReadAhead\" as integer failed"));
+                break;
+            }
             rc = CFGMR3QueryStringAlloc(pCurNode, "BwGroup", &pThis->pszBwGroup);
             if (RT_FAILURE(rc) && rc != VERR_CFGM_VALUE_NOT_FOUND)
             {
@@ -4838,6 +5129,22 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                           N_("DrvVD: Configuration error: Querying \"CacheFormat\" as string failed"));
                     break;
                 }
+
+                rc = CFGMR3QueryBoolDef(pCurNode, "CacheWriteBack", &fCacheWriteBack, false);
+                if (RT_FAILURE(rc))
+                {
+                    rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                          N_("DrvVD: Configuration error: Querying \"CacheWriteBack\" as boolean failed"));
+                    break;
+                }
+
+                rc = CFGMR3QueryU64Def(pCurNode, "CacheDirtyMax", &pThis->cbCacheDirtyMax, DRVVD_CACHE_DIRTY_MAX_DEFAULT);
+                if (RT_FAILURE(rc))
+                {
+                    rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                          N_("DrvVD: Configuration error: Querying \"CacheDirtyMax\" as integer failed"));
+                    break;
+                }
             }
 
             /* Mountable */
@@ -4930,6 +5237,16 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
             if (RT_FAILURE(rc))
                 return PDMDRV_SET_ERROR(pDrvIns, rc,
                                         N_("DrvVD configuration error: Querying \"NonRotationalMedium\" as boolean failed"));
+
+            rc = CFGMR3QueryBoolDef(pCfg, "ZeroCopy", &pThis->fZeroCopy, false);
+            if (RT_FAILURE(rc))
+                return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                        N_("DrvVD configuration error: Querying \"ZeroCopy\" as boolean failed"));
+
+            rc = CFGMR3QueryBoolDef(pCfg, "IoTrace", &pThis->fIoTrace, false);
+            if (RT_FAILURE(rc))
+                return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                        N_("DrvVD configuration error: Querying \"IoTrace\" as boolean failed"));
         }
 
         PCFGMNODE pParent = CFGMR3GetChild(pCurNode, "Parent");
@@ -4988,6 +5305,21 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                 }
             }
 
+            if (RT_SUCCESS(rc) && pThis->fIoTrace)
+            {
+                pThis->paIoTraceRecs = (PVDIOTRACEREC)RTMemAllocZ(DRVVD_IOTRACE_RECS * sizeof(VDIOTRACEREC));
+                if (pThis->paIoTraceRecs)
+                {
+                    pThis->VDIfIoTrace.pfnIoReqCompleted = drvvdIoTraceIoReqCompleted;
+
+                    rc = VDInterfaceAdd(&pThis->VDIfIoTrace.Core, "DrvVD_IoTrace", VDINTERFACETYPE_IOTRACE,
+                                        pThis, sizeof(VDINTERFACEIOTRACE), &pThis->pVDIfsDisk);
+                }
+                else
+                    rc = PDMDRV_SET_ERROR(pDrvIns, VERR_NO_MEMORY,
+                                          N_("DrvVD: Failed to allocate the I/O trace ring"));
+            }
+
             if (RT_SUCCESS(rc))
             {
                 rc = VDCreate(pThis->pVDIfsDisk, drvvdGetVDFromMediaType(pThis->enmType), &pThis->pDisk);
@@ -5283,9 +5615,27 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                 AssertRC(rc);
             }
 
-            rc = VDCacheOpen(pThis->pDisk, pszCacheFormat, pszCachePath, VD_OPEN_FLAGS_NORMAL, pThis->pVDIfsCache);
+            rc = VDCacheOpen(pThis->pDisk, pszCacheFormat, pszCachePath,
+                             fCacheWriteBack ? VD_OPEN_FLAGS_CACHE_WRITE_BACK : VD_OPEN_FLAGS_NORMAL,
+                             pThis->pVDIfsCache);
             if (RT_FAILURE(rc))
                 rc = PDMDRV_SET_ERROR(pDrvIns, rc, N_("DrvVD: Could not open cache image"));
+            else if (   fCacheWriteBack
+                     && pThis->cbCacheDirtyMax)
+            {
+                /*
+                 * Synchronous writes write back the oldest dirty data themselves once the
+                 * limit is exceeded, asynchronous ones rely on the destage thread.
+                 */
+                rc = VDCacheSetDirtyLimit(pThis->pDisk, pThis->cbCacheDirtyMax);
+                if (RT_SUCCESS(rc))
+                    rc = RTSemEventCreate(&pThis->hEvtCacheDestage);
+                if (RT_SUCCESS(rc))
+                    rc = PDMDrvHlpThreadCreate(pDrvIns, &pThis->pCacheDestageThread, pThis, drvvdCacheDestageThread,
+                                               drvvdCacheDestageThreadWakeup, 0, RTTHREADTYPE_IO, "VDCacheDestage");
+                if (RT_FAILURE(rc))
+                    rc = PDMDRV_SET_ERROR(pDrvIns, rc, N_("DrvVD: Could not set up writing back the cache"));
+            }
         }
 
         if (RT_VALID_PTR(pszCachePath))
@@ -5343,6 +5693,9 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                         LogRel(("VD: Block cache is not supported\n"));
                         rc = VINF_SUCCESS;
                     }
+                    else if (RT_SUCCESS(rc))
+                        rc = PDMR3BlkCacheSetReadAhead(pThis->pBlkCache, cbBlockCacheReadAhead,
+                                                       VDGetSize(pThis->pDisk, VD_LAST_IMAGE));
                     else
                         AssertRC(rc);
 
@@ -533,3 +533,19 @@ DECLHIDDEN(void) IOBUFMgrFreeBuf(PIOBUFDESC pIoBufDesc)
 #endif
 }
 
+
+DECLHIDDEN(bool) IOBUFMgrIsSgUsable(PCRTSGSEG paSegs, unsigned cSegs, size_t cbIoBuf, size_t cbAlign)
+{
+    Assert(RT_IS_POWER_OF_TWO(cbAlign));
+
+    size_t cbSegs = 0;
+    for (unsigned i = 0; i < cSegs; i++)
+    {
+        if (   ((uintptr_t)paSegs[i].pvSeg & (cbAlign - 1))
+            || (paSegs[i].cbSeg & (cbAlign - 1)))
+            return false;
+        cbSegs += paSegs[i].cbSeg;
+    }
+
+    return cbSegs == cbIoBuf;
+}
@@ -106,6 +106,20 @@ DECLHIDDEN(int) IOBUFMgrAllocBuf(IOBUFMGR hIoBufMgr, PIOBUFDESC pIoBufDesc, size
  */
 DECLHIDDEN(void) IOBUFMgrFreeBuf(PIOBUFDESC pIoBufDesc);
 
+/**
+ * Checks whether the given memory of a request initiator can be used directly
+ * instead of allocating an I/O buffer.
+ *
+ * @returns true if every segment is aligned and the segments cover exactly the
+ *          requested size, false otherwise.
+ * @param   paSegs             The segments to check.
+ * @param   cSegs              Number of segments.
+ * @param   cbIoBuf            The size of the I/O buffer the segments should replace.
+ * @param   cbAlign            The required alignment of the start and size of each
+ *                             segment, power of two.
+ */
+DECLHIDDEN(bool) IOBUFMgrIsSgUsable(PCRTSGSEG paSegs, unsigned cSegs, size_t cbIoBuf, size_t cbAlign);
+
 RT_C_DECLS_END
 
 #endif /* !VBOX_INCLUDED_SRC_Storage_IOBufMgmt_h */
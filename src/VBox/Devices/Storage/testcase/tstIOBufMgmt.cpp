@@ -0,0 +1,143 @@
+/* $Id: tstIOBufMgmt.cpp $ */
+/** @file
+ * Unit test for the I/O buffer manager and the direct buffer check of DrvVD.
+ */
+
+/*
+ * Copyright (C) 2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/err.h>
+#include <iprt/mem.h>
+#include <iprt/test.h>
+
+#include "../IOBufMgmt.h"
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The alignment DrvVD requires for the zero copy path. */
+#define TST_ALIGN       512
+/** Size of the test request. */
+#define TST_CB_REQ      _64K
+
+
+/**
+ * Page allocated buffers as handed out by DrvSCSI qualify for the zero copy path.
+ */
+static void tstIOBufMgmtDirect(void)
+{
+    RTTestISub("Direct");
+
+    uint8_t *pbBuf = (uint8_t *)RTMemPageAlloc(TST_CB_REQ);
+    RTTESTI_CHECK_RETV(pbBuf != NULL);
+
+    /* One segment covering the whole request. */
+    RTSGSEG Seg;
+    Seg.pvSeg = pbBuf;
+    Seg.cbSeg = TST_CB_REQ;
+    RTTESTI_CHECK(IOBUFMgrIsSgUsable(&Seg, 1, TST_CB_REQ, TST_ALIGN));
+
+    /* Page granular segments like the ones the AHCI PRDT walk produces. */
+    RTSGSEG aSegs[TST_CB_REQ / _4K];
+    for (unsigned i = 0; i < RT_ELEMENTS(aSegs); i++)
+    {
+        aSegs[i].pvSeg = pbBuf + i * _4K;
+        aSegs[i].cbSeg = _4K;
+    }
+    RTTESTI_CHECK(IOBUFMgrIsSgUsable(&aSegs[0], RT_ELEMENTS(aSegs), TST_CB_REQ, TST_ALIGN));
+
+    /* Sector granular segments are fine as well. */
+    aSegs[0].pvSeg = pbBuf + TST_ALIGN;
+    aSegs[0].cbSeg = _4K - TST_ALIGN;
+    aSegs[1].cbSeg = _4K + TST_ALIGN;
+    RTTESTI_CHECK(IOBUFMgrIsSgUsable(&aSegs[0], RT_ELEMENTS(aSegs), TST_CB_REQ, TST_ALIGN));
+
+    RTMemPageFree(pbBuf, TST_CB_REQ);
+}
+
+
+/**
+ * Everything the device can't hand out sector aligned must fall back to bouncing.
+ */
+static void tstIOBufMgmtUnaligned(void)
+{
+    RTTestISub("Unaligned");
+
+    uint8_t *pbBuf = (uint8_t *)RTMemPageAlloc(TST_CB_REQ + _4K);
+    RTTESTI_CHECK_RETV(pbBuf != NULL);
+
+    /* Misaligned start, what a plain heap allocation typically gives. */
+    RTSGSEG Seg;
+    Seg.pvSeg = pbBuf + 16;
+    Seg.cbSeg = TST_CB_REQ;
+    RTTESTI_CHECK(!IOBUFMgrIsSgUsable(&Seg, 1, TST_CB_REQ, TST_ALIGN));
+
+    /* Aligned start but a segment size which is not a multiple of a sector. */
+    RTSGSEG aSegs[2];
+    aSegs[0].pvSeg = pbBuf;
+    aSegs[0].cbSeg = _4K + 100;
+    aSegs[1].pvSeg = pbBuf + _8K;
+    aSegs[1].cbSeg = TST_CB_REQ - _4K - 100;
+    RTTESTI_CHECK(!IOBUFMgrIsSgUsable(&aSegs[0], RT_ELEMENTS(aSegs), TST_CB_REQ, TST_ALIGN));
+
+    /* Segments not covering the request exactly. */
+    Seg.pvSeg = pbBuf;
+    Seg.cbSeg = TST_CB_REQ - TST_ALIGN;
+    RTTESTI_CHECK(!IOBUFMgrIsSgUsable(&Seg, 1, TST_CB_REQ, TST_ALIGN));
+    Seg.cbSeg = TST_CB_REQ + TST_ALIGN;
+    RTTESTI_CHECK(!IOBUFMgrIsSgUsable(&Seg, 1, TST_CB_REQ, TST_ALIGN));
+    RTTESTI_CHECK(!IOBUFMgrIsSgUsable(&Seg, 0, TST_CB_REQ, TST_ALIGN));
+
+    RTMemPageFree(pbBuf, TST_CB_REQ + _4K);
+}
+
+
+/**
+ * The bounce buffers of the fallback path satisfy the same constraints.
+ */
+static void tstIOBufMgmtFallback(void)
+{
+    RTTestISub("Fallback");
+
+    IOBUFMGR hIoBufMgr = NIL_IOBUFMGR;
+    RTTESTI_CHECK_RC_RETV(IOBUFMgrCreate(&hIoBufMgr, _1M, IOBUFMGR_F_DEFAULT), VINF_SUCCESS);
+
+    IOBUFDESC IoBuf;
+    size_t cbAllocated = 0;
+    RTTESTI_CHECK_RC(IOBUFMgrAllocBuf(hIoBufMgr, &IoBuf, TST_CB_REQ, &cbAllocated), VINF_SUCCESS);
+    RTTESTI_CHECK(cbAllocated == TST_CB_REQ);
+    RTTESTI_CHECK(IOBUFMgrIsSgUsable(IoBuf.SgBuf.paSegs, IoBuf.SgBuf.cSegs, cbAllocated, TST_ALIGN));
+    IOBUFMgrFreeBuf(&IoBuf);
+
+    RTTESTI_CHECK_RC(IOBUFMgrDestroy(hIoBufMgr), VINF_SUCCESS);
+}
+
+
+int main()
+{
+    RTTEST hTest;
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstIOBufMgmt", &hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(hTest);
+
+    tstIOBufMgmtDirect();
+    tstIOBufMgmtUnaligned();
+    tstIOBufMgmtFallback();
+
+    return RTTestSummaryAndDestroy(hTest);
+}
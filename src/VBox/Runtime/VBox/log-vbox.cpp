@@ -472,6 +472,7 @@ RTDECL(PRTLOGGER) RTLogDefaultInit(void)
     ASSERT_LOG_GROUP(VGDRV);
     ASSERT_LOG_GROUP(VBGL);
     ASSERT_LOG_GROUP(VD);
+    ASSERT_LOG_GROUP(VD_DDI);
     ASSERT_LOG_GROUP(VD_DMG);
     ASSERT_LOG_GROUP(VD_ISCSI);
     ASSERT_LOG_GROUP(VD_PARALLELS);
@@ -133,7 +133,7 @@ RTDECL(int) RTIoQueueCreate(PRTIOQUEUE phIoQueue, PCRTIOQUEUEPROVVTABLE pProvVTa
 {
     AssertPtrReturn(phIoQueue, VERR_INVALID_POINTER);
     AssertPtrReturn(pProvVTable, VERR_INVALID_POINTER);
-    AssertReturn(!fFlags, VERR_INVALID_PARAMETER);
+    AssertReturn(!(fFlags & ~RTIOQUEUE_F_VALID_MASK), VERR_INVALID_PARAMETER);
     AssertReturn(cSqEntries > 0, VERR_INVALID_PARAMETER);
     AssertReturn(cCqEntries > 0, VERR_INVALID_PARAMETER);
 
@@ -80,6 +80,17 @@
 # define RTLOG_RINGBUF_MAX_SIZE         _1G
 # define RTLOG_RINGBUF_MIN_SIZE         _4K
 #endif
+/** @def RTLOG_ASYNC_DEFAULT_SIZE
+ * The default buffer size for asynchronous file writing. */
+/** @def RTLOG_ASYNC_MAX_SIZE
+ * The max buffer size for asynchronous file writing. */
+/** @def RTLOG_ASYNC_MIN_SIZE
+ * The min buffer size for asynchronous file writing. */
+#if defined(IN_RING3) || defined(DOXYGEN_RUNNING)
+# define RTLOG_ASYNC_DEFAULT_SIZE       _1M
+# define RTLOG_ASYNC_MAX_SIZE           _256M
+# define RTLOG_ASYNC_MIN_SIZE           _64K
+#endif
 /** The start of ring buffer eye catcher (16 bytes). */
 #define RTLOG_RINGBUF_EYE_CATCHER           "START RING BUF\0"
 AssertCompile(sizeof(RTLOG_RINGBUF_EYE_CATCHER) == 16);
@@ -204,17 +215,57 @@ typedef struct RTLOGGERINTERNAL
     /** Pointer to filename. */
     char                    szFilename[RTPATH_MAX];
     /** @} */
+
+    /** @name Asynchronous file writing (RTLOGDEST_F_ASYNC).
+     * rtlogFlush() copies the output into a buffer and a writer thread does the
+     * file I/O, so the logging thread never waits for the disk.  The producer
+     * always owns the logger lock, making this a single producer / single
+     * consumer ring with free running offsets.  When the writer falls behind and
+     * the buffer fills up, output is dropped and counted, and a note about it is
+     * written to the file once there is room again.
+     * @{ */
+    /** The buffer, NULL if asynchronous writing isn't active. */
+    char                   *pchAsyncBuf;
+    /** The buffer size (0 = default). */
+    uint32_t                cbAsyncBuf;
+    /** Set by the writer thread before it waits for more work. */
+    bool volatile           fAsyncWriterIdle;
+    /** Set while someone is waiting for the writer thread to catch up. */
+    bool volatile           fAsyncDraining;
+    /** Tells the writer thread to quit. */
+    bool volatile           fAsyncShutdown;
+    bool                    afAsyncPadding[1];
+    /** Producer offset (free running, owned by the logger lock). */
+    uint64_t volatile       offAsyncWrite;
+    /** Consumer offset (free running, owned by the writer thread). */
+    uint64_t volatile       offAsyncRead;
+    /** Number of bytes dropped since the last drop note. */
+    uint64_t                cbAsyncDropped;
+    /** Number of flushes dropped since the last drop note. */
+    uint32_t                cAsyncDropped;
+    /** Total number of flushes dropped. */
+    uint32_t                cAsyncDroppedTotal;
+    /** The writer thread. */
+    RTTHREAD                hAsyncThread;
+    /** Event semaphore the writer thread waits on. */
+    RTSEMEVENT              hAsyncEvt;
+    /** Event semaphore signalled by the writer thread when it has caught up
+     * and fAsyncDraining is set. */
+    RTSEMEVENT              hAsyncEvtIdle;
+    /** @} */
 # endif /* IN_RING3 */
 } RTLOGGERINTERNAL;
 
 /** The revision of the internal logger structure. */
-# define RTLOGGERINTERNAL_REV    UINT32_C(11)
+# define RTLOGGERINTERNAL_REV    UINT32_C(12)
 
 # ifdef IN_RING3
 /** The size of the RTLOGGERINTERNAL structure in ring-0.  */
 #  define RTLOGGERINTERNAL_R0_SIZE       RT_UOFFSETOF(RTLOGGERINTERNAL, pfnPhase)
 AssertCompileMemberAlignment(RTLOGGERINTERNAL, hFile, sizeof(void *));
 AssertCompileMemberAlignment(RTLOGGERINTERNAL, cbHistoryFileMax, sizeof(uint64_t));
+AssertCompileMemberAlignment(RTLOGGERINTERNAL, offAsyncWrite, sizeof(uint64_t));
+AssertCompileMemberAlignment(RTLOGGERINTERNAL, offAsyncRead, sizeof(uint64_t));
 # endif
 AssertCompileMemberAlignment(RTLOGGERINTERNAL, cbRingBufUnflushed, sizeof(uint64_t));
 
@@ -233,6 +284,11 @@ static void rtR0LogLoggerExFallback(uint32_t fDestFlags, uint32_t fFlags, PRTLOG
 #endif
 #ifdef IN_RING3
 static int  rtR3LogOpenFileDestination(PRTLOGGER pLogger, PRTERRINFO pErrInfo);
+static int  rtR3LogAsyncStart(PRTLOGGER pLogger);
+static char *rtR3LogAsyncDetach(PRTLOGGERINTERNAL pInt);
+static void rtR3LogAsyncTerm(PRTLOGGERINTERNAL pInt, char *pchBuf);
+static void rtR3LogAsyncStop(PRTLOGGER pLogger);
+static void rtR3LogAsyncDrain(PRTLOGGERINTERNAL pInt);
 #endif
 #ifndef IN_RC
 static void rtLogRingBufFlush(PRTLOGGER pLogger);
@@ -356,6 +412,7 @@ static struct
     { RT_STR_TUPLE("histsize"),     0 },                    /* Must be 4th! */
     { RT_STR_TUPLE("histtime"),     0 },                    /* Must be 5th! */
     { RT_STR_TUPLE("ringbuf"),      RTLOGDEST_RINGBUF },    /* Must be 6th! */
+    { RT_STR_TUPLE("async"),        RTLOGDEST_F_ASYNC },    /* Must be 7th! */
     { RT_STR_TUPLE("stdout"),       RTLOGDEST_STDOUT },
     { RT_STR_TUPLE("stderr"),       RTLOGDEST_STDERR },
     { RT_STR_TUPLE("debugger"),     RTLOGDEST_DEBUGGER },
@@ -847,6 +904,9 @@ RTDECL(int) RTLogCreateExV(PRTLOGGER *ppLogger, uint32_t fFlags, const char *psz
         pLogger->pInt->pfnPhase                 = pfnPhase;
         pLogger->pInt->hFile                    = NIL_RTFILE;
         pLogger->pInt->cHistory                 = cHistory;
+        pLogger->pInt->hAsyncThread             = NIL_RTTHREAD;
+        pLogger->pInt->hAsyncEvt                = NIL_RTSEMEVENT;
+        pLogger->pInt->hAsyncEvtIdle            = NIL_RTSEMEVENT;
         if (cbHistoryFileMax == 0)
             pLogger->pInt->cbHistoryFileMax     = UINT64_MAX;
         else
@@ -995,6 +1055,11 @@ RTDECL(int) RTLogCreateExV(PRTLOGGER *ppLogger, uint32_t fFlags, const char *psz
                         ASMAtomicWriteU32(&g_cLoggerLockCount, c);
                     }
 
+                    /* Start the file writer thread if requested.  Not fatal, we
+                       just write synchronously if it fails. */
+                    if (pLogger->fDestFlags & RTLOGDEST_F_ASYNC)
+                        rtR3LogAsyncStart(pLogger);
+
                     /* Use the callback to generate some initial log contents. */
                     Assert(VALID_PTR(pLogger->pInt->pfnPhase) || pLogger->pInt->pfnPhase == NULL);
                     if (pLogger->pInt->pfnPhase)
@@ -1076,6 +1141,9 @@ RTDECL(int) RTLogDestroy(PRTLOGGER pLogger)
     int             rc;
     uint32_t        iGroup;
     RTSEMSPINMUTEX  hSpinMtx;
+# ifdef IN_RING3
+    char           *pchAsyncBuf;
+# endif
 
     /*
      * Validate input.
@@ -1110,6 +1178,12 @@ RTDECL(int) RTLogDestroy(PRTLOGGER pLogger)
         && pLogger->pInt->hFile != NIL_RTFILE)
         pLogger->pInt->pfnPhase(pLogger, RTLOGPHASE_END, rtlogPhaseMsgLocked);
 
+    /*
+     * Let the asynchronous writer write everything and detach it.  It is
+     * terminated after we've let go of the mutex below.
+     */
+    pchAsyncBuf = rtR3LogAsyncDetach(pLogger->pInt);
+
     /*
      * Close output stuffs.
      */
@@ -1138,6 +1212,11 @@ RTDECL(int) RTLogDestroy(PRTLOGGER pLogger)
             rc = rc2;
     }
 
+# ifdef IN_RING3
+    if (pchAsyncBuf)
+        rtR3LogAsyncTerm(pLogger->pInt, pchAsyncBuf);
+# endif
+
     if (pLogger->pfnLogger)
     {
 # if defined(LOG_USE_C99) && defined(RT_WITHOUT_EXEC_ALLOC)
@@ -2390,6 +2469,29 @@ RTDECL(int) RTLogDestinations(PRTLOGGER pLogger, char const *pszValue)
                         else
                             pLogger->pInt->cSecsHistoryTimeSlot = UINT32_MAX;
                     }
+                    else if (i == 6 /* async */ && !fNo)
+                    {
+                        int rc = RTStrCopyEx(szTmp, sizeof(szTmp), pszValue, cch);
+                        uint32_t cbAsyncBuf = 0;
+                        if (RT_SUCCESS(rc))
+                            rc = RTStrToUInt32Full(szTmp, 0, &cbAsyncBuf);
+                        AssertMsgRCReturn(rc, ("Invalid async buffer size value '%s' (%Rrc)!\n", szTmp, rc), rc);
+
+                        if (cbAsyncBuf == 0)
+                            cbAsyncBuf = RTLOG_ASYNC_DEFAULT_SIZE;
+                        else if (cbAsyncBuf < RTLOG_ASYNC_MIN_SIZE)
+                            cbAsyncBuf = RTLOG_ASYNC_MIN_SIZE;
+                        else if (cbAsyncBuf > RTLOG_ASYNC_MAX_SIZE)
+                            cbAsyncBuf = RTLOG_ASYNC_MAX_SIZE;
+                        else
+                            cbAsyncBuf = RT_ALIGN_32(cbAsyncBuf, 64);
+
+                        /* The size is fixed while the writer is running, so restart it (below). */
+                        if (   pLogger->pInt->pchAsyncBuf
+                            && pLogger->pInt->cbAsyncBuf != cbAsyncBuf)
+                            rtR3LogAsyncStop(pLogger);
+                        pLogger->pInt->cbAsyncBuf = cbAsyncBuf;
+                    }
 # endif /* IN_RING3 */
                     else if (i == 5 /* ringbuf */ && !fNo)
                     {
@@ -2438,6 +2540,27 @@ RTDECL(int) RTLogDestinations(PRTLOGGER pLogger, char const *pszValue)
             pszValue++;
     } /* while more environment variable value left */
 
+# ifdef IN_RING3
+    /*
+     * Start or stop the asynchronous file writer.  During early logger init
+     * this is left to RTLogCreateExV.
+     */
+    if (pLogger->pInt->fCreated)
+    {
+        if (pLogger->fDestFlags & RTLOGDEST_F_ASYNC)
+        {
+            if (!pLogger->pInt->pchAsyncBuf)
+            {
+                int rc = rtR3LogAsyncStart(pLogger);
+                if (RT_FAILURE(rc))
+                    return rc;
+            }
+        }
+        else if (pLogger->pInt->pchAsyncBuf)
+            rtR3LogAsyncStop(pLogger);
+    }
+# endif
+
     return VINF_SUCCESS;
 }
 RT_EXPORT_SYMBOL(RTLogDestinations);
@@ -2523,7 +2646,7 @@ RTDECL(int) RTLogGetDestinations(PRTLOGGER pLogger, char *pszBuf, size_t cchBuf)
      * Add the flags in the list.
      */
     fDestFlags = pLogger->fDestFlags;
-    for (i = 6; i < RT_ELEMENTS(g_aLogDst); i++)
+    for (i = 7; i < RT_ELEMENTS(g_aLogDst); i++)
         if (g_aLogDst[i].fFlag & fDestFlags)
         {
             if (fNotFirst)
@@ -2598,6 +2721,26 @@ RTDECL(int) RTLogGetDestinations(PRTLOGGER pLogger, char *pszBuf, size_t cchBuf)
         fNotFirst = true;
     }
 
+# ifdef IN_RING3
+    /*
+     * Add asynchronous file writing.
+     */
+    if (fDestFlags & RTLOGDEST_F_ASYNC)
+    {
+        if (   pLogger->pInt->cbAsyncBuf == 0
+            || pLogger->pInt->cbAsyncBuf == RTLOG_ASYNC_DEFAULT_SIZE)
+            rc = RTStrCopyP(&pszBuf, &cchBuf, fNotFirst ? " async" : "async");
+        else
+        {
+            RTStrPrintf(szNum, sizeof(szNum), fNotFirst ? " async=%#x" : "async=%#x", pLogger->pInt->cbAsyncBuf);
+            rc = RTStrCopyP(&pszBuf, &cchBuf, szNum);
+        }
+        if (RT_FAILURE(rc))
+            return rc;
+        fNotFirst = true;
+    }
+# endif /* IN_RING3 */
+
     return VINF_SUCCESS;
 }
 RT_EXPORT_SYMBOL(RTLogGetDestinations);
@@ -2633,6 +2776,9 @@ RTDECL(void) RTLogFlush(PRTLOGGER pLogger)
     if (   pLogger->offScratch
 #ifndef IN_RC
         || (pLogger->fDestFlags & RTLOGDEST_RINGBUF)
+#endif
+#ifdef IN_RING3
+        || pLogger->pInt->pchAsyncBuf
 #endif
        )
     {
@@ -2658,6 +2804,14 @@ RTDECL(void) RTLogFlush(PRTLOGGER pLogger)
             && pLogger->pInt->pszRingBuf /* paranoia */)
             rtLogRingBufFlush(pLogger);
 
+# ifdef IN_RING3
+        /*
+         * Likewise, wait for the asynchronous file writer to get everything
+         * onto disk.
+         */
+        rtR3LogAsyncDrain(pLogger->pInt);
+# endif
+
         /*
          * Release the semaphore.
          */
@@ -3293,6 +3447,7 @@ static void rtlogRotate(PRTLOGGER pLogger, uint32_t uTimeSlot, bool fFirst, PRTE
             pLogger->pInt->pfnPhase(pLogger, RTLOGPHASE_PREROTATE, rtlogPhaseMsgLocked);
             pLogger->fDestFlags = fODestFlags;
         }
+        rtR3LogAsyncDrain(pLogger->pInt);
         RTFileClose(pLogger->pInt->hFile);
         pLogger->pInt->hFile = NIL_RTFILE;
     }
@@ -3404,6 +3559,274 @@ static int rtR3LogOpenFileDestination(PRTLOGGER pLogger, PRTERRINFO pErrInfo)
     return rc;
 }
 
+
+/**
+ * The asynchronous file writer thread.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   hThreadSelf     The thread handle.
+ * @param   pvUser          The logger instance.
+ */
+static DECLCALLBACK(int) rtR3LogAsyncThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PRTLOGGER         pLogger = (PRTLOGGER)pvUser;
+    PRTLOGGERINTERNAL pInt    = pLogger->pInt;
+    RT_NOREF(hThreadSelf);
+
+    for (;;)
+    {
+        uint64_t const offRead  = pInt->offAsyncRead;
+        uint64_t const offWrite = ASMAtomicReadU64(&pInt->offAsyncWrite);
+        if (offRead != offWrite)
+        {
+            /*
+             * Write as much as we can in one go, i.e. up to the end of the buffer.
+             * The producer only queues output while the file is open and drains
+             * us before closing it, so hFile is stable here.  Since draining is
+             * done once offAsyncRead catches up, everything touching the file,
+             * flushing included, must be done before publishing the new offset.
+             */
+            uint32_t const offBuf  = (uint32_t)(offRead % pInt->cbAsyncBuf);
+            size_t   const cbChunk = (size_t)RT_MIN(offWrite - offRead, pInt->cbAsyncBuf - offBuf);
+            RTFileWrite(pInt->hFile, &pInt->pchAsyncBuf[offBuf], cbChunk, NULL);
+            if (   offRead + cbChunk == offWrite
+                && (pLogger->fFlags & RTLOGFLAGS_FLUSH))
+                RTFileFlush(pInt->hFile);
+
+            ASMAtomicWriteU64(&pInt->offAsyncRead, offRead + cbChunk);
+            continue;
+        }
+
+        /*
+         * Caught up.  Wake up anyone waiting for that, then go idle.  The idle
+         * flag must be set before rechecking the producer offset so that
+         * rtR3LogAsyncWrite either sees it or we see the new data.
+         */
+        if (ASMAtomicReadBool(&pInt->fAsyncDraining))
+            RTSemEventSignal(pInt->hAsyncEvtIdle);
+        if (ASMAtomicReadBool(&pInt->fAsyncShutdown))
+            break;
+        ASMAtomicWriteBool(&pInt->fAsyncWriterIdle, true);
+        if (ASMAtomicReadU64(&pInt->offAsyncWrite) == offWrite)
+            RTSemEventWait(pInt->hAsyncEvt, RT_MS_1SEC);
+        ASMAtomicWriteBool(&pInt->fAsyncWriterIdle, false);
+    }
+
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Copies text into the asynchronous write buffer, wrapping around as needed.
+ *
+ * @param   pInt        The internal logger data.
+ * @param   off         The (free running) producer offset to copy to.
+ * @param   pachText    The text.
+ * @param   cchText     The number of chars (bytes) to copy.
+ */
+DECLINLINE(void) rtR3LogAsyncCopy(PRTLOGGERINTERNAL pInt, uint64_t off, const char *pachText, size_t cchText)
+{
+    uint32_t const offBuf = (uint32_t)(off % pInt->cbAsyncBuf);
+    size_t   const cch1   = RT_MIN(cchText, pInt->cbAsyncBuf - offBuf);
+    memcpy(&pInt->pchAsyncBuf[offBuf], pachText, cch1);
+    if (cch1 < cchText)
+        memcpy(pInt->pchAsyncBuf, &pachText[cch1], cchText - cch1);
+}
+
+
+/**
+ * Queues text for the asynchronous file writer.
+ *
+ * This never blocks.  If the writer thread has fallen too far behind, the text
+ * is dropped and counted, and a note about it is queued ahead of the next text
+ * that fits.
+ *
+ * @param   pLogger     The logger instance.  Caller owns the lock.
+ * @param   pachText    The text to write.
+ * @param   cchText     The number of chars (bytes) to write.
+ */
+static void rtR3LogAsyncWrite(PRTLOGGER pLogger, const char *pachText, size_t cchText)
+{
+    PRTLOGGERINTERNAL pInt     = pLogger->pInt;
+    uint64_t          offWrite = pInt->offAsyncWrite;
+    uint64_t const    cbFree   = pInt->cbAsyncBuf - (offWrite - ASMAtomicReadU64(&pInt->offAsyncRead));
+
+    char   szDropMsg[96];
+    size_t cchDropMsg = 0;
+    if (pInt->cAsyncDropped)
+    {
+        const char *pszNewLine = pLogger->fFlags & RTLOGFLAGS_USECRLF ? "\r\n" : "\n";
+        cchDropMsg = RTStrPrintf(szDropMsg, sizeof(szDropMsg), "%s[DROPPED %u writes, %llu bytes]%s",
+                                 pszNewLine, pInt->cAsyncDropped, pInt->cbAsyncDropped, pszNewLine);
+    }
+
+    if (cchDropMsg + cchText <= cbFree)
+    {
+        if (cchDropMsg)
+        {
+            rtR3LogAsyncCopy(pInt, offWrite, szDropMsg, cchDropMsg);
+            offWrite += cchDropMsg;
+            pInt->cAsyncDropped  = 0;
+            pInt->cbAsyncDropped = 0;
+        }
+        rtR3LogAsyncCopy(pInt, offWrite, pachText, cchText);
+        ASMAtomicWriteU64(&pInt->offAsyncWrite, offWrite + cchText);
+    }
+    else
+    {
+        pInt->cAsyncDropped++;
+        pInt->cAsyncDroppedTotal++;
+        pInt->cbAsyncDropped += cchText;
+    }
+
+    if (ASMAtomicXchgBool(&pInt->fAsyncWriterIdle, false))
+        RTSemEventSignal(pInt->hAsyncEvt);
+}
+
+
+/**
+ * Waits for the asynchronous file writer to write everything queued so far.
+ *
+ * @param   pInt        The internal logger data.  Caller owns the lock so
+ *                      nothing new gets queued meanwhile.
+ */
+static void rtR3LogAsyncDrain(PRTLOGGERINTERNAL pInt)
+{
+    if (!pInt->pchAsyncBuf)
+        return;
+
+    ASMAtomicWriteBool(&pInt->fAsyncDraining, true);
+    while (ASMAtomicReadU64(&pInt->offAsyncRead) != pInt->offAsyncWrite)
+    {
+        RTSemEventSignal(pInt->hAsyncEvt);
+        RTSemEventWait(pInt->hAsyncEvtIdle, 10);
+    }
+    ASMAtomicWriteBool(&pInt->fAsyncDraining, false);
+}
+
+
+/**
+ * Starts asynchronous file writing.
+ *
+ * @returns IPRT status code.
+ * @param   pLogger     The logger instance.  Caller must not own the lock.
+ */
+static int rtR3LogAsyncStart(PRTLOGGER pLogger)
+{
+    PRTLOGGERINTERNAL pInt = pLogger->pInt;
+    Assert(!pInt->pchAsyncBuf);
+    Assert(pInt->hAsyncThread == NIL_RTTHREAD);
+
+    if (pInt->cbAsyncBuf == 0)
+        pInt->cbAsyncBuf = RTLOG_ASYNC_DEFAULT_SIZE;
+    char *pchBuf = (char *)RTMemAllocTag(pInt->cbAsyncBuf, "may-leak:log-async-buf");
+    if (!pchBuf)
+        return VERR_NO_MEMORY;
+
+    int rc = RTSemEventCreate(&pInt->hAsyncEvt);
+    if (RT_SUCCESS(rc))
+    {
+        rc = RTSemEventCreate(&pInt->hAsyncEvtIdle);
+        if (RT_SUCCESS(rc))
+        {
+            pInt->offAsyncWrite     = 0;
+            pInt->offAsyncRead      = 0;
+            pInt->cbAsyncDropped    = 0;
+            pInt->cAsyncDropped     = 0;
+            pInt->fAsyncWriterIdle  = false;
+            pInt->fAsyncDraining    = false;
+            pInt->fAsyncShutdown    = false;
+            rc = RTThreadCreate(&pInt->hAsyncThread, rtR3LogAsyncThread, pLogger, 0 /*cbStack*/,
+                                RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "LogWriter");
+            if (RT_SUCCESS(rc))
+            {
+                /* Publish the buffer, the writer won't touch it before there is data. */
+                rc = rtlogLock(pLogger);
+                if (RT_SUCCESS(rc))
+                {
+                    pInt->pchAsyncBuf = pchBuf;
+                    rtlogUnlock(pLogger);
+                    return VINF_SUCCESS;
+                }
+
+                ASMAtomicWriteBool(&pInt->fAsyncShutdown, true);
+                RTSemEventSignal(pInt->hAsyncEvt);
+                RTThreadWait(pInt->hAsyncThread, RT_INDEFINITE_WAIT, NULL);
+                pInt->hAsyncThread = NIL_RTTHREAD;
+            }
+            RTSemEventDestroy(pInt->hAsyncEvtIdle);
+            pInt->hAsyncEvtIdle = NIL_RTSEMEVENT;
+        }
+        RTSemEventDestroy(pInt->hAsyncEvt);
+        pInt->hAsyncEvt = NIL_RTSEMEVENT;
+    }
+    RTMemFree(pchBuf);
+    return rc;
+}
+
+
+/**
+ * Waits for the asynchronous file writer to write everything queued and
+ * unpublishes the buffer, so rtlogFlush goes back to synchronous writing.
+ *
+ * @returns The buffer to pass to rtR3LogAsyncTerm, NULL if not active.
+ * @param   pInt        The internal logger data.  Caller owns the lock.
+ */
+static char *rtR3LogAsyncDetach(PRTLOGGERINTERNAL pInt)
+{
+    char *pchBuf = pInt->pchAsyncBuf;
+    if (pchBuf)
+    {
+        rtR3LogAsyncDrain(pInt);
+        pInt->pchAsyncBuf = NULL;
+    }
+    return pchBuf;
+}
+
+
+/**
+ * Terminates the writer thread and frees the resources of a detached
+ * asynchronous file writer.
+ *
+ * This must be called without owning the logger lock, as the writer thread may
+ * log on its way out (rtThreadMain) and would then block on the lock.
+ *
+ * @param   pInt        The internal logger data.
+ * @param   pchBuf      The buffer returned by rtR3LogAsyncDetach.
+ */
+static void rtR3LogAsyncTerm(PRTLOGGERINTERNAL pInt, char *pchBuf)
+{
+    ASMAtomicWriteBool(&pInt->fAsyncShutdown, true);
+    RTSemEventSignal(pInt->hAsyncEvt);
+    int rc = RTThreadWait(pInt->hAsyncThread, RT_INDEFINITE_WAIT, NULL);
+    AssertRC(rc);
+    pInt->hAsyncThread = NIL_RTTHREAD;
+
+    RTSemEventDestroy(pInt->hAsyncEvt);
+    pInt->hAsyncEvt = NIL_RTSEMEVENT;
+    RTSemEventDestroy(pInt->hAsyncEvtIdle);
+    pInt->hAsyncEvtIdle = NIL_RTSEMEVENT;
+
+    RTMemFree(pchBuf);
+}
+
+
+/**
+ * Stops asynchronous file writing after everything queued has been written.
+ *
+ * @param   pLogger     The logger instance.  Caller must not own the lock.
+ */
+static void rtR3LogAsyncStop(PRTLOGGER pLogger)
+{
+    int rc = rtlogLock(pLogger);
+    AssertRCReturnVoid(rc);
+    char *pchBuf = rtR3LogAsyncDetach(pLogger->pInt);
+    rtlogUnlock(pLogger);
+
+    if (pchBuf)
+        rtR3LogAsyncTerm(pLogger->pInt, pchBuf);
+}
+
 #endif /* IN_RING3 */
 
 
@@ -3462,7 +3885,11 @@ static void rtlogFlush(PRTLOGGER pLogger, bool fNeedSpace)
 # ifdef IN_RING3
         if ((pLogger->fDestFlags & (RTLOGDEST_FILE | RTLOGDEST_RINGBUF)) == RTLOGDEST_FILE)
         {
-            if (pLogger->pInt->hFile != NIL_RTFILE)
+            if (pLogger->pInt->hFile == NIL_RTFILE)
+            { /* nothing */ }
+            else if (pLogger->pInt->pchAsyncBuf)
+                rtR3LogAsyncWrite(pLogger, pLogger->achScratch, cchScratch);
+            else
             {
                 RTFileWrite(pLogger->pInt->hFile, pLogger->achScratch, cchScratch, NULL);
                 if (pLogger->fFlags & RTLOGFLAGS_FLUSH)
@@ -37,6 +37,8 @@
 #define RTZIP_LZF_BLOCK_BY_BLOCK
 //#define RTZIP_USE_LZJB 1
 //#define RTZIP_USE_LZO 1
+#define RTZIP_USE_LZ4 1
+//#define RTZIP_USE_ZSTD 1
 
 /** @todo FastLZ? QuickLZ? Others? */
 
@@ -60,6 +62,10 @@
 #ifdef RTZIP_USE_LZO
 # include <lzo/lzo1x.h>
 #endif
+#ifdef RTZIP_USE_ZSTD
+# include <zstd.h>
+# include <zstd_errors.h>
+#endif
 
 #include <iprt/zip.h>
 #include "internal/iprt.h"
@@ -115,6 +121,21 @@ typedef const RTZIPLZFHDR *PCRTZIPLZFHDR;
 
 #endif /* RTZIP_USE_LZF */
 
+#ifdef RTZIP_USE_LZ4
+/** The number of bits used for the LZ4 match finder hash. */
+# define RTZIPLZ4_HASH_LOG                      12
+/** The size of the LZ4 match finder hash table. */
+# define RTZIPLZ4_HASH_SIZE                     RT_BIT_32(RTZIPLZ4_HASH_LOG)
+/** The minimum match length of the LZ4 block format. */
+# define RTZIPLZ4_MIN_MATCH                     4
+/** The number of bytes at the end of a block which are always literals. */
+# define RTZIPLZ4_LAST_LITERALS                 5
+/** The last match must start at least this many bytes before the block end. */
+# define RTZIPLZ4_MF_LIMIT                      12
+/** The maximum match offset. */
+# define RTZIPLZ4_MAX_OFFSET                    UINT16_MAX
+#endif /* RTZIP_USE_LZ4 */
+
 
 /**
  * Compressor/Decompressor instance data.
@@ -1443,6 +1464,12 @@ RTDECL(int)     RTZipCompCreate(PRTZIPCOMP *ppZip, void *pvUser, PFNRTZIPOUT pfn
         case RTZIPTYPE_LZO:
             break;
 
+        case RTZIPTYPE_LZ4:
+        case RTZIPTYPE_ZSTD:
+            /* Block API only. */
+            rc = VERR_NOT_SUPPORTED;
+            break;
+
         default:
             AssertFailedBreak();
     }
@@ -1640,6 +1667,11 @@ static int rtzipDecompInit(PRTZIPDECOMP pZip)
 #endif
             break;
 
+        case RTZIPTYPE_LZ4:
+        case RTZIPTYPE_ZSTD:
+            AssertMsgFailed(("LZ4 and Zstd streaming support is not implemented!\n"));
+            break;
+
         default:
             AssertMsgFailed(("Invalid compression type %d (%#x)!\n", pZip->enmType, pZip->enmType));
             rc = VERR_INVALID_MAGIC;
@@ -1716,6 +1748,255 @@ RTDECL(int)     RTZipDecompDestroy(PRTZIPDECOMP pZip)
 RT_EXPORT_SYMBOL(RTZipDecompDestroy);
 
 
+#ifdef RTZIP_USE_LZ4
+
+/**
+ * Reads an unaligned 32-bit value for the LZ4 match finder.
+ */
+DECLINLINE(uint32_t) rtZipLz4Read32(uint8_t const *pb)
+{
+    uint32_t u32;
+    memcpy(&u32, pb, sizeof(u32));
+    return u32;
+}
+
+
+/**
+ * Writes an LZ4 length extension (the part exceeding the 4-bit token field).
+ *
+ * @returns Pointer to the byte following the extension.
+ * @param   pbOut       Where to write.
+ * @param   cbLength    The remaining length (i.e. the full length minus 15).
+ */
+DECLINLINE(uint8_t *) rtZipLz4WriteLength(uint8_t *pbOut, size_t cbLength)
+{
+    while (cbLength >= 255)
+    {
+        *pbOut++ = 255;
+        cbLength -= 255;
+    }
+    *pbOut++ = (uint8_t)cbLength;
+    return pbOut;
+}
+
+
+/**
+ * Compresses a block using the LZ4 block format.
+ *
+ * This is a simple greedy single pass compressor with a small hash table,
+ * which is what the reference implementation does at its default level.
+ * The output is compatible with LZ4_decompress_safe().
+ *
+ * @returns IPRT status code.
+ * @retval  VERR_BUFFER_OVERFLOW if the output buffer is too small.
+ * @param   pbSrc           The source buffer.
+ * @param   cbSrc           The number of bytes to compress.
+ * @param   pbDst           The destination buffer.
+ * @param   cbDst           The size of the destination buffer.
+ * @param   pcbDstActual    Where to return the compressed size.
+ */
+static int rtZipLz4BlockCompress(uint8_t const *pbSrc, size_t cbSrc, uint8_t *pbDst, size_t cbDst, size_t *pcbDstActual)
+{
+    AssertReturn(cbSrc <= UINT32_MAX, VERR_TOO_MUCH_DATA);
+
+    uint8_t const  *pbAnchor = pbSrc;
+    uint8_t const  *pbEnd    = pbSrc + cbSrc;
+    uint8_t        *pbOut    = pbDst;
+    uint8_t * const pbOutEnd = pbDst + cbDst;
+
+    if (cbSrc > RTZIPLZ4_MF_LIMIT)
+    {
+        uint32_t        aoffHash[RTZIPLZ4_HASH_SIZE];
+        RT_ZERO(aoffHash);
+        uint8_t const  *pbIn         = pbSrc;
+        uint8_t const  *pbMatchLimit = pbEnd - RTZIPLZ4_MF_LIMIT;
+        uint8_t const  *pbMatchEnd   = pbEnd - RTZIPLZ4_LAST_LITERALS;
+        while (pbIn < pbMatchLimit)
+        {
+            /*
+             * Look up the candidate and replace it with the current position.
+             */
+            uint32_t const  u32Cur = rtZipLz4Read32(pbIn);
+            uint32_t const  iHash  = (u32Cur * UINT32_C(2654435761)) >> (32 - RTZIPLZ4_HASH_LOG);
+            uint8_t const  *pbRef  = pbSrc + aoffHash[iHash];
+            aoffHash[iHash] = (uint32_t)(pbIn - pbSrc);
+            if (   pbRef >= pbIn
+                || (size_t)(pbIn - pbRef) > RTZIPLZ4_MAX_OFFSET
+                || rtZipLz4Read32(pbRef) != u32Cur)
+            {
+                pbIn++;
+                continue;
+            }
+
+            /*
+             * Extend the match backwards into the pending literals and forwards.
+             */
+            while (pbIn > pbAnchor && pbRef > pbSrc && pbIn[-1] == pbRef[-1])
+            {
+                pbIn--;
+                pbRef--;
+            }
+            size_t cbMatch = RTZIPLZ4_MIN_MATCH;
+            while (pbIn + cbMatch < pbMatchEnd && pbIn[cbMatch] == pbRef[cbMatch])
+                cbMatch++;
+
+            /*
+             * Emit the sequence: token, literals, offset and match length.
+             */
+            size_t const cLiterals = (size_t)(pbIn - pbAnchor);
+            size_t const cbNeeded  = 1 + cLiterals / 255 + 1 + cLiterals + 2 + (cbMatch - RTZIPLZ4_MIN_MATCH) / 255 + 1;
+            if (RT_UNLIKELY(cbNeeded > (size_t)(pbOutEnd - pbOut)))
+                return VERR_BUFFER_OVERFLOW;
+
+            uint8_t *pbToken = pbOut++;
+            if (cLiterals >= 15)
+            {
+                *pbToken = 15 << 4;
+                pbOut = rtZipLz4WriteLength(pbOut, cLiterals - 15);
+            }
+            else
+                *pbToken = (uint8_t)(cLiterals << 4);
+            memcpy(pbOut, pbAnchor, cLiterals);
+            pbOut += cLiterals;
+
+            uint16_t const offMatch = (uint16_t)(pbIn - pbRef);
+            *pbOut++ = RT_BYTE1(offMatch);
+            *pbOut++ = RT_BYTE2(offMatch);
+
+            size_t const cbMatchExtra = cbMatch - RTZIPLZ4_MIN_MATCH;
+            if (cbMatchExtra >= 15)
+            {
+                *pbToken |= 15;
+                pbOut = rtZipLz4WriteLength(pbOut, cbMatchExtra - 15);
+            }
+            else
+                *pbToken |= (uint8_t)cbMatchExtra;
+
+            pbIn    += cbMatch;
+            pbAnchor = pbIn;
+        }
+    }
+
+    /*
+     * The final sequence consists of literals only.
+     */
+    size_t const cLiterals = (size_t)(pbEnd - pbAnchor);
+    if (RT_UNLIKELY(1 + cLiterals / 255 + 1 + cLiterals > (size_t)(pbOutEnd - pbOut)))
+        return VERR_BUFFER_OVERFLOW;
+    if (cLiterals >= 15)
+    {
+        *pbOut++ = 15 << 4;
+        pbOut = rtZipLz4WriteLength(pbOut, cLiterals - 15);
+    }
+    else
+        *pbOut++ = (uint8_t)(cLiterals << 4);
+    memcpy(pbOut, pbAnchor, cLiterals);
+    pbOut += cLiterals;
+
+    *pcbDstActual = (size_t)(pbOut - pbDst);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Decompresses a block in the LZ4 block format.
+ *
+ * All input is treated as untrusted, so every length and offset is checked
+ * against the buffer bounds.
+ *
+ * @returns IPRT status code.
+ * @retval  VERR_ZIP_CORRUPTED if the input is malformed.
+ * @retval  VERR_BUFFER_OVERFLOW if the output buffer is too small.
+ * @param   pbSrc           The compressed data.
+ * @param   cbSrc           The size of the compressed data.
+ * @param   pcbSrcActual    Where to return the number of bytes consumed. Optional.
+ * @param   pbDst           The output buffer.
+ * @param   cbDst           The size of the output buffer.
+ * @param   pcbDstActual    Where to return the decompressed size. Optional.
+ */
+static int rtZipLz4BlockDecompress(uint8_t const *pbSrc, size_t cbSrc, size_t *pcbSrcActual,
+                                   uint8_t *pbDst, size_t cbDst, size_t *pcbDstActual)
+{
+    uint8_t const        *pbIn     = pbSrc;
+    uint8_t const * const pbInEnd  = pbSrc + cbSrc;
+    uint8_t              *pbOut    = pbDst;
+    uint8_t * const       pbOutEnd = pbDst + cbDst;
+
+    while (pbIn < pbInEnd)
+    {
+        uint8_t const bToken = *pbIn++;
+
+        /* Literals. */
+        size_t cLiterals = bToken >> 4;
+        if (cLiterals == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (RT_UNLIKELY(pbIn >= pbInEnd))
+                    return VERR_ZIP_CORRUPTED;
+                b = *pbIn++;
+                cLiterals += b;
+            } while (b == 255);
+        }
+        if (RT_UNLIKELY(cLiterals > (size_t)(pbInEnd - pbIn)))
+            return VERR_ZIP_CORRUPTED;
+        if (RT_UNLIKELY(cLiterals > (size_t)(pbOutEnd - pbOut)))
+            return VERR_BUFFER_OVERFLOW;
+        memcpy(pbOut, pbIn, cLiterals);
+        pbOut += cLiterals;
+        pbIn  += cLiterals;
+
+        /* The last sequence has no match part. */
+        if (pbIn == pbInEnd)
+            break;
+
+        /* Match. */
+        if (RT_UNLIKELY(pbInEnd - pbIn < 2))
+            return VERR_ZIP_CORRUPTED;
+        size_t const offMatch = RT_MAKE_U16(pbIn[0], pbIn[1]);
+        pbIn += 2;
+        if (RT_UNLIKELY(offMatch == 0 || offMatch > (size_t)(pbOut - pbDst)))
+            return VERR_ZIP_CORRUPTED;
+
+        size_t cbMatch = bToken & 15;
+        if (cbMatch == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (RT_UNLIKELY(pbIn >= pbInEnd))
+                    return VERR_ZIP_CORRUPTED;
+                b = *pbIn++;
+                cbMatch += b;
+            } while (b == 255);
+        }
+        cbMatch += RTZIPLZ4_MIN_MATCH;
+        if (RT_UNLIKELY(cbMatch > (size_t)(pbOutEnd - pbOut)))
+            return VERR_BUFFER_OVERFLOW;
+
+        /* The source and destination may overlap (run length encoding), so copy bytewise then. */
+        uint8_t const *pbRef = pbOut - offMatch;
+        if (offMatch >= cbMatch)
+        {
+            memcpy(pbOut, pbRef, cbMatch);
+            pbOut += cbMatch;
+        }
+        else
+            while (cbMatch-- > 0)
+                *pbOut++ = *pbRef++;
+    }
+
+    if (pcbDstActual)
+        *pcbDstActual = (size_t)(pbOut - pbDst);
+    if (pcbSrcActual)
+        *pcbSrcActual = (size_t)(pbIn - pbSrc);
+    return VINF_SUCCESS;
+}
+
+#endif /* RTZIP_USE_LZ4 */
+
+
 RTDECL(int) RTZipBlockCompress(RTZIPTYPE enmType, RTZIPLEVEL enmLevel, uint32_t fFlags,
                                void const *pvSrc, size_t cbSrc,
                                void *pvDst, size_t cbDst, size_t *pcbDstActual) RT_NO_THROW_DEF
@@ -1818,6 +2099,41 @@ RTDECL(int) RTZipBlockCompress(RTZIPTYPE enmType, RTZIPLEVEL enmLevel, uint32_t
 #endif
         }
 
+        case RTZIPTYPE_LZ4:
+        {
+#ifdef RTZIP_USE_LZ4
+            return rtZipLz4BlockCompress((uint8_t const *)pvSrc, cbSrc, (uint8_t *)pvDst, cbDst, pcbDstActual);
+#else
+            return VERR_NOT_SUPPORTED;
+#endif
+        }
+
+        case RTZIPTYPE_ZSTD:
+        {
+#ifdef RTZIP_USE_ZSTD
+            int iLevel;
+            switch (enmLevel)
+            {
+                case RTZIPLEVEL_STORE:
+                case RTZIPLEVEL_FAST:   iLevel = 1; break;
+                default:
+                case RTZIPLEVEL_DEFAULT: iLevel = 3; break;
+                case RTZIPLEVEL_MAX:    iLevel = 19; break;
+            }
+            size_t cbDstActual = ZSTD_compress(pvDst, cbDst, pvSrc, cbSrc, iLevel);
+            if (RT_UNLIKELY(ZSTD_isError(cbDstActual)))
+            {
+                if (ZSTD_getErrorCode(cbDstActual) == ZSTD_error_dstSize_tooSmall)
+                    return VERR_BUFFER_OVERFLOW;
+                return VERR_GENERAL_FAILURE;
+            }
+            *pcbDstActual = cbDstActual;
+            break;
+#else
+            return VERR_NOT_SUPPORTED;
+#endif
+        }
+
         case RTZIPTYPE_ZLIB:
         case RTZIPTYPE_BZLIB:
             return VERR_NOT_SUPPORTED;
@@ -1982,6 +2298,35 @@ RTDECL(int) RTZipBlockDecompress(RTZIPTYPE enmType, uint32_t fFlags,
 #endif
         }
 
+        case RTZIPTYPE_LZ4:
+        {
+#ifdef RTZIP_USE_LZ4
+            return rtZipLz4BlockDecompress((uint8_t const *)pvSrc, cbSrc, pcbSrcActual, (uint8_t *)pvDst, cbDst, pcbDstActual);
+#else
+            return VERR_NOT_SUPPORTED;
+#endif
+        }
+
+        case RTZIPTYPE_ZSTD:
+        {
+#ifdef RTZIP_USE_ZSTD
+            size_t cbDstActual = ZSTD_decompress(pvDst, cbDst, pvSrc, cbSrc);
+            if (RT_UNLIKELY(ZSTD_isError(cbDstActual)))
+            {
+                if (ZSTD_getErrorCode(cbDstActual) == ZSTD_error_dstSize_tooSmall)
+                    return VERR_BUFFER_OVERFLOW;
+                return VERR_ZIP_CORRUPTED;
+            }
+            if (pcbDstActual)
+                *pcbDstActual = cbDstActual;
+            if (pcbSrcActual)
+                *pcbSrcActual = cbSrc;
+            break;
+#else
+            return VERR_NOT_SUPPORTED;
+#endif
+        }
+
         case RTZIPTYPE_BZLIB:
             return VERR_NOT_SUPPORTED;
 
@@ -61,7 +61,7 @@
 
 #include <iprt/assertcompile.h>
 #include <iprt/asm.h>
-#include <iprt/errcore.h>
+#include <iprt/err.h>
 #include <iprt/file.h>
 #include <iprt/log.h>
 #include <iprt/mem.h>
@@ -90,6 +90,11 @@
 /** eventfd2() syscall not associated with io_uring but used for kicking waiters. */
 #define LNX_SYSCALL_EVENTFD2           19
 
+/** Number of slots in the fixed file table registered with each ring. */
+#define LNX_IOURING_FIXED_FILES_MAX    64
+/** Idle time in milliseconds before the kernel SQ polling thread goes to sleep. */
+#define LNX_IOURING_SQPOLL_IDLE_MS     10
+
 
 /*********************************************************************************************************************************
 *   Structures and Typedefs                                                                                                      *
@@ -357,9 +362,26 @@ typedef const LNXIOURINGPARAMS *PCLNXIOURINGPARAMS;
 #define LNX_IOURING_REGISTER_OPC_EVENTFD_REGISTER   4
 /** Unregisters an eventfd registered previously. */
 #define LNX_IOURING_REGISTER_OPC_EVENTFD_UNREGISTER 5
+/** Updates entries in the fixed file set registered previously (Linux 5.5+). */
+#define LNX_IOURING_REGISTER_OPC_FILES_UPDATE       6
 /** @} */
 
 
+/**
+ * Argument for LNX_IOURING_REGISTER_OPC_FILES_UPDATE.
+ */
+typedef struct LNXIOURINGFILESUPDATE
+{
+    /** Index of the first fixed file slot to update. */
+    uint32_t                    u32Off;
+    /** Reserved. */
+    uint32_t                    u32Rsvd0;
+    /** Pointer to the array of file descriptors to set, -1 clears a slot. */
+    uint64_t                    u64PtrFds;
+} LNXIOURINGFILESUPDATE;
+AssertCompileSize(LNXIOURINGFILESUPDATE, 16);
+
+
 /**
  * SQ ring structure.
  *
@@ -439,6 +461,12 @@ typedef struct RTIOQUEUEPROVINT
     size_t                      cbMMapSqes;
     /** Flag whether the waiter was woken up externally. */
     volatile bool               fExtIntr;
+    /** Flag whether the kernel polls the submission queue. */
+    bool                        fSqPoll;
+    /** Flag whether a fixed file table is registered with the ring. */
+    bool                        fFixedFiles;
+    /** The fixed file table, -1 marks a free slot. */
+    int32_t                     aiFdsFixed[LNX_IOURING_FIXED_FILES_MAX];
 } RTIOQUEUEPROVINT;
 /** Pointer to the internal I/O queue provider instance data. */
 typedef RTIOQUEUEPROVINT *PRTIOQUEUEPROVINT;
@@ -550,6 +578,46 @@ DECLINLINE(int) rtIoQueueLnxEventfd2(uint32_t uValInit, uint32_t fFlags, int *pi
 }
 
 
+/**
+ * Returns the index of the given file descriptor in the fixed file table.
+ *
+ * @returns Index of the slot or UINT32_MAX if not found.
+ * @param   pThis               The provider instance.
+ * @param   iFd                 The file descriptor to look for, -1 finds a free slot.
+ */
+DECLINLINE(uint32_t) rtIoQueueLnxIoURingFileProvFixedFileFind(PRTIOQUEUEPROVINT pThis, int32_t iFd)
+{
+    for (uint32_t i = 0; i < RT_ELEMENTS(pThis->aiFdsFixed); i++)
+        if (pThis->aiFdsFixed[i] == iFd)
+            return i;
+
+    return UINT32_MAX;
+}
+
+
+/**
+ * Updates the given slot in the fixed file table of the ring.
+ *
+ * @returns IPRT status code.
+ * @param   pThis               The provider instance.
+ * @param   idxSlot             The slot to update.
+ * @param   iFd                 The file descriptor to set, -1 to clear the slot.
+ */
+static int rtIoQueueLnxIoURingFileProvFixedFileUpdate(PRTIOQUEUEPROVINT pThis, uint32_t idxSlot, int32_t iFd)
+{
+    LNXIOURINGFILESUPDATE FilesUpdate;
+    RT_ZERO(FilesUpdate);
+
+    FilesUpdate.u32Off    = idxSlot;
+    FilesUpdate.u64PtrFds = (uint64_t)(uintptr_t)&iFd;
+    int rc = rtIoQueueLnxIoURingRegister(pThis->iFdIoCtx, LNX_IOURING_REGISTER_OPC_FILES_UPDATE, &FilesUpdate, 1 /*cArgs*/);
+    if (RT_SUCCESS(rc))
+        pThis->aiFdsFixed[idxSlot] = iFd;
+
+    return rc;
+}
+
+
 /**
  * Checks the completion event queue for pending events.
  *
@@ -641,7 +709,7 @@ static DECLCALLBACK(bool) rtIoQueueLnxIoURingFileProv_IsSupported(void)
 static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_QueueInit(RTIOQUEUEPROV hIoQueueProv, uint32_t fFlags,
                                                                uint32_t cSqEntries, uint32_t cCqEntries)
 {
-    RT_NOREF(fFlags, cCqEntries);
+    RT_NOREF(cCqEntries);
 
     PRTIOQUEUEPROVINT pThis = hIoQueueProv;
     LNXIOURINGPARAMS Params;
@@ -649,8 +717,30 @@ static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_QueueInit(RTIOQUEUEPROV hIo
 
     pThis->cSqesToCommit = 0;
     pThis->fExtIntr      = false;
+    pThis->fSqPoll       = false;
+    pThis->fFixedFiles   = false;
+
+    int rc = VERR_NOT_SUPPORTED;
+    if (fFlags & RTIOQUEUE_F_POLL_SQ)
+    {
+        /*
+         * Kernel side polling of the submission queue requires CAP_SYS_ADMIN before Linux 5.11,
+         * so just fall back to the normal mode if the setup fails.
+         */
+        Params.u32Flags        = LNX_IOURING_SETUP_F_SQPOLL;
+        Params.u32SqPollIdleMs = LNX_IOURING_SQPOLL_IDLE_MS;
+        rc = rtIoQueueLnxIoURingSetup(cSqEntries, &Params, &pThis->iFdIoCtx);
+        if (RT_SUCCESS(rc))
+            pThis->fSqPoll = true;
+        else
+        {
+            LogRel(("IoQueue: Kernel side submission queue polling is not available (%Rrc)\n", rc));
+            RT_ZERO(Params);
+        }
+    }
 
-    int rc = rtIoQueueLnxIoURingSetup(cSqEntries, &Params, &pThis->iFdIoCtx);
+    if (!pThis->fSqPoll)
+        rc = rtIoQueueLnxIoURingSetup(cSqEntries, &Params, &pThis->iFdIoCtx);
     if (RT_SUCCESS(rc))
     {
         /* Map the rings into userspace. */
@@ -695,6 +785,20 @@ static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_QueueInit(RTIOQUEUEPROV hIo
                                 pThis->Cq.fRingMask = *(uint32_t *)(pbTmp + Params.CqOffsets.u32OffRingMask);
                                 pThis->Cq.cEntries  = *(uint32_t *)(pbTmp + Params.CqOffsets.u32OffRingEntries);
                                 pThis->Cq.paCqes    = (PLNXIOURINGCQE)(pbTmp + Params.CqOffsets.u32OffCqes);
+
+                                /*
+                                 * Register a sparse fixed file table which gets populated when handles
+                                 * are registered. This saves the kernel from looking up and referencing
+                                 * the file for every request. Sparse tables need Linux 5.5+, requests
+                                 * use plain file descriptors if this fails.
+                                 */
+                                for (uint32_t i = 0; i < RT_ELEMENTS(pThis->aiFdsFixed); i++)
+                                    pThis->aiFdsFixed[i] = -1;
+
+                                int rc2 = rtIoQueueLnxIoURingRegister(pThis->iFdIoCtx, LNX_IOURING_REGISTER_OPC_FILES_REGISTER,
+                                                                      &pThis->aiFdsFixed[0], RT_ELEMENTS(pThis->aiFdsFixed));
+                                if (RT_SUCCESS(rc2))
+                                    pThis->fFixedFiles = true;
                                 return VINF_SUCCESS;
                             }
 
@@ -733,6 +837,12 @@ static DECLCALLBACK(void) rtIoQueueLnxIoURingFileProv_QueueDestroy(RTIOQUEUEPROV
     int rc = rtIoQueueLnxIoURingRegister(pThis->iFdIoCtx, LNX_IOURING_REGISTER_OPC_EVENTFD_UNREGISTER, NULL, 0);
     AssertRC(rc);
 
+    if (pThis->fFixedFiles)
+    {
+        rc = rtIoQueueLnxIoURingRegister(pThis->iFdIoCtx, LNX_IOURING_REGISTER_OPC_FILES_UNREGISTER, NULL, 0);
+        AssertRC(rc);
+    }
+
     close(pThis->iFdEvt);
     close(pThis->iFdIoCtx);
     RTMemFree(pThis->paIoVecs);
@@ -744,8 +854,24 @@ static DECLCALLBACK(void) rtIoQueueLnxIoURingFileProv_QueueDestroy(RTIOQUEUEPROV
 /** @interface_method_impl{RTIOQUEUEPROVVTABLE,pfnHandleRegister} */
 static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_HandleRegister(RTIOQUEUEPROV hIoQueueProv, PCRTHANDLE pHandle)
 {
-    RT_NOREF(hIoQueueProv, pHandle);
-    /** @todo Add support for fixed file sets later. */
+    PRTIOQUEUEPROVINT pThis = hIoQueueProv;
+
+    /*
+     * Failing to add the handle to the fixed file table is not fatal,
+     * requests for the handle will use the plain file descriptor then.
+     */
+    if (pThis->fFixedFiles)
+    {
+        uint32_t idxSlot = rtIoQueueLnxIoURingFileProvFixedFileFind(pThis, -1);
+        if (idxSlot != UINT32_MAX)
+        {
+            int rc = rtIoQueueLnxIoURingFileProvFixedFileUpdate(pThis, idxSlot, (int32_t)RTFileToNative(pHandle->u.hFile));
+            if (RT_FAILURE(rc))
+                LogFlowFunc(("Adding file %d to the fixed file table failed with %Rrc\n",
+                             (int32_t)RTFileToNative(pHandle->u.hFile), rc));
+        }
+    }
+
     return VINF_SUCCESS;
 }
 
@@ -753,9 +879,17 @@ static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_HandleRegister(RTIOQUEUEPRO
 /** @interface_method_impl{RTIOQUEUEPROVVTABLE,pfnHandleDeregister} */
 static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_HandleDeregister(RTIOQUEUEPROV hIoQueueProv, PCRTHANDLE pHandle)
 {
-    RT_NOREF(hIoQueueProv, pHandle);
-    /** @todo Add support for fixed file sets later. */
-    return VINF_SUCCESS;
+    PRTIOQUEUEPROVINT pThis = hIoQueueProv;
+    int rc = VINF_SUCCESS;
+
+    if (pThis->fFixedFiles)
+    {
+        uint32_t idxSlot = rtIoQueueLnxIoURingFileProvFixedFileFind(pThis, (int32_t)RTFileToNative(pHandle->u.hFile));
+        if (idxSlot != UINT32_MAX)
+            rc = rtIoQueueLnxIoURingFileProvFixedFileUpdate(pThis, idxSlot, -1);
+    }
+
+    return rc;
 }
 
 
@@ -767,16 +901,30 @@ static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_ReqPrepare(RTIOQUEUEPROV hI
     PRTIOQUEUEPROVINT pThis = hIoQueueProv;
     RT_NOREF(fReqFlags);
 
+    /* The kernel might not have consumed all committed entries yet when polling the submission queue. */
+    if (RT_UNLIKELY(pThis->idxSqTail - ASMAtomicReadU32(pThis->Sq.pidxHead) >= pThis->Sq.cEntries))
+        return VERR_IOQUEUE_FULL;
+
     uint32_t idx = pThis->idxSqTail & pThis->Sq.fRingMask;
     PLNXIOURINGSQE pSqe = &pThis->paSqes[idx];
     struct iovec *pIoVec = &pThis->paIoVecs[idx];
+    int32_t iFd = (int32_t)RTFileToNative(pHandle->u.hFile);
 
     pIoVec->iov_base = pvBuf;
     pIoVec->iov_len  = cbBuf;
 
     pSqe->u8Flags         = 0;
     pSqe->u16IoPrio       = 0;
-    pSqe->i32Fd           = (int32_t)RTFileToNative(pHandle->u.hFile);
+    pSqe->i32Fd           = iFd;
+    if (pThis->fFixedFiles)
+    {
+        uint32_t idxSlot = rtIoQueueLnxIoURingFileProvFixedFileFind(pThis, iFd);
+        if (idxSlot != UINT32_MAX)
+        {
+            pSqe->u8Flags = LNX_IOURING_SQE_F_FIXED_FILE;
+            pSqe->i32Fd   = (int32_t)idxSlot;
+        }
+    }
     pSqe->u64OffStart     = off;
     pSqe->u64AddrBufIoVec = (uint64_t)(uintptr_t)pIoVec;
     pSqe->u64User         = (uint64_t)(uintptr_t)pvUser;
@@ -810,13 +958,21 @@ static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_ReqPrepare(RTIOQUEUEPROV hI
 static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_Commit(RTIOQUEUEPROV hIoQueueProv, uint32_t *pcReqsCommitted)
 {
     PRTIOQUEUEPROVINT pThis = hIoQueueProv;
-    RT_NOREF(pThis, pcReqsCommitted);
 
     ASMWriteFence();
     ASMAtomicWriteU32(pThis->Sq.pidxTail, pThis->idxSqTail);
     ASMWriteFence();
 
-    int rc = rtIoQueueLnxIoURingEnter(pThis->iFdIoCtx, pThis->cSqesToCommit, 0, 0 /*fFlags*/);
+    int rc = VINF_SUCCESS;
+    if (pThis->fSqPoll)
+    {
+        /* The kernel thread picks up the new entries on its own unless it went to sleep. */
+        ASMMemoryFence();
+        if (ASMAtomicReadU32(pThis->Sq.pfFlags) & LNX_IOURING_SQ_RING_F_NEED_WAKEUP)
+            rc = rtIoQueueLnxIoURingEnter(pThis->iFdIoCtx, 0, 0, LNX_IOURING_ENTER_F_SQ_WAKEUP);
+    }
+    else
+        rc = rtIoQueueLnxIoURingEnter(pThis->iFdIoCtx, pThis->cSqesToCommit, 0, 0 /*fFlags*/);
     if (RT_SUCCESS(rc))
     {
         *pcReqsCommitted = pThis->cSqesToCommit;
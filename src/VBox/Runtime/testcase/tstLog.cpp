@@ -29,11 +29,22 @@
 *   Header Files                                                                                                                 *
 *********************************************************************************************************************************/
 #include <iprt/log.h>
+#include <iprt/err.h>
+#include <iprt/file.h>
+#include <iprt/mem.h>
+#include <iprt/path.h>
+#include <iprt/process.h>
 #include <iprt/string.h>
 #include <iprt/test.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
 #ifdef VBOX
 # include <VBox/log.h>
 #endif
+#ifndef RT_OS_WINDOWS
+# include <sys/types.h>
+# include <sys/stat.h>
+#endif
 
 
 /** Differs from normal strcmp in that '_' is considered smaller than
@@ -61,6 +72,212 @@ static int CompareLogGroups(const char *psz1, const char *psz2)
     }
 }
 
+/** Log phase callback, RTLogDestroy insists on one for file loggers. */
+static DECLCALLBACK(void) tstLogPhase(PRTLOGGER pLogger, RTLOGPHASE enmLogPhase, PFNRTLOGPHASEMSG pfnLogPhaseMsg)
+{
+    RT_NOREF(pLogger, enmLogPhase, pfnLogPhaseMsg);
+}
+
+
+/** Creates an unbuffered logger writing to the given file. */
+static PRTLOGGER tstLogCreateFileLogger(const char *pszFilename, uint32_t fFlags, uint32_t fDestFlags)
+{
+    PRTLOGGER pLogger = NULL;
+    int rc = RTLogCreateEx(&pLogger, fFlags, NULL /*pszGroupSettings*/, NULL /*pszEnvVarBase*/, 0 /*cGroups*/, NULL,
+                           UINT32_MAX, fDestFlags | RTLOGDEST_FILE, tstLogPhase, 0 /*cHistory*/, 0 /*cbHistoryFileMax*/,
+                           0 /*cSecsHistoryTimeSlot*/, NULL /*pErrInfo*/, "%s", pszFilename);
+    RTTESTI_CHECK_RC_OK(rc);
+    return RT_SUCCESS(rc) ? pLogger : NULL;
+}
+
+
+/** Reads the log file into a string, NULL on failure. */
+static char *tstLogReadFile(const char *pszFilename)
+{
+    void  *pvFile;
+    size_t cbFile;
+    int rc = RTFileReadAll(pszFilename, &pvFile, &cbFile);
+    RTTESTI_CHECK_RC_OK_RET(rc, NULL);
+    char *psz = RTStrDupN((const char *)pvFile, cbFile);
+    RTFileReadAllFree(pvFile, cbFile);
+    return psz;
+}
+
+
+/**
+ * Tests the asynchronous file destination (RTLOGDEST_F_ASYNC).
+ */
+static void tstLogAsync(void)
+{
+    char szFile[RTPATH_MAX];
+    int rc = RTPathTemp(szFile, sizeof(szFile));
+    if (RT_SUCCESS(rc))
+        rc = RTPathAppend(szFile, sizeof(szFile), "tstLog-async");
+    RTTESTI_CHECK_RC_OK_RETV(rc);
+    size_t const cchFile = strlen(szFile);
+    RTStrPrintf(&szFile[cchFile], sizeof(szFile) - cchFile, "-%u.log", RTProcSelf());
+
+    /*
+     * Destination string round trip.
+     */
+    RTTestISub("async destination string");
+    char szDst[512];
+    PRTLOGGER pLogger = tstLogCreateFileLogger(szFile, 0, 0);
+    if (pLogger)
+    {
+        RTTESTI_CHECK_RC(RTLogDestinations(pLogger, "async"), VINF_SUCCESS);
+        RTTESTI_CHECK_RC(RTLogGetDestinations(pLogger, szDst, sizeof(szDst)), VINF_SUCCESS);
+        RTTESTI_CHECK_MSG(strstr(szDst, "async") && !strstr(szDst, "async="), ("%s\n", szDst));
+
+        RTTESTI_CHECK_RC(RTLogDestinations(pLogger, "async=0x20000"), VINF_SUCCESS);
+        RTTESTI_CHECK_RC(RTLogGetDestinations(pLogger, szDst, sizeof(szDst)), VINF_SUCCESS);
+        RTTESTI_CHECK_MSG(strstr(szDst, "async=0x20000"), ("%s\n", szDst));
+
+        RTTESTI_CHECK_RC(RTLogDestinations(pLogger, "noasync"), VINF_SUCCESS);
+        RTTESTI_CHECK_RC(RTLogGetDestinations(pLogger, szDst, sizeof(szDst)), VINF_SUCCESS);
+        RTTESTI_CHECK_MSG(!strstr(szDst, "async"), ("%s\n", szDst));
+        RTTESTI_CHECK_RC(RTLogDestroy(pLogger), VINF_SUCCESS);
+    }
+
+    /*
+     * Everything logged is in the file after RTLogFlush.
+     */
+    RTTestISub("async flush");
+    pLogger = tstLogCreateFileLogger(szFile, 0, RTLOGDEST_F_ASYNC);
+    if (pLogger)
+    {
+        for (uint32_t i = 0; i < 1000; i++)
+            RTLogLoggerEx(pLogger, 0, ~0U, "line %u\n", i);
+        RTLogFlush(pLogger);
+
+        char *pszContent = tstLogReadFile(szFile);
+        if (pszContent)
+        {
+            RTTESTI_CHECK(!strncmp(pszContent, "line 0\n", sizeof("line 0\n") - 1));
+            RTTESTI_CHECK(strstr(pszContent, "\nline 999\n") != NULL);
+            RTTESTI_CHECK(strstr(pszContent, "[DROPPED") == NULL);
+            RTStrFree(pszContent);
+        }
+        RTTESTI_CHECK_RC(RTLogDestroy(pLogger), VINF_SUCCESS);
+    }
+
+    /*
+     * Switching it on and off at runtime keeps the output in order.
+     */
+    RTTestISub("async on/off");
+    pLogger = tstLogCreateFileLogger(szFile, 0, 0);
+    if (pLogger)
+    {
+        RTLogLoggerEx(pLogger, 0, ~0U, "one\n");
+        RTTESTI_CHECK_RC(RTLogDestinations(pLogger, "async"), VINF_SUCCESS);
+        RTLogLoggerEx(pLogger, 0, ~0U, "two\n");
+        RTTESTI_CHECK_RC(RTLogDestinations(pLogger, "async=0x10000"), VINF_SUCCESS);
+        RTLogLoggerEx(pLogger, 0, ~0U, "three\n");
+        RTTESTI_CHECK_RC(RTLogDestinations(pLogger, "noasync"), VINF_SUCCESS);
+        RTLogLoggerEx(pLogger, 0, ~0U, "four\n");
+        RTTESTI_CHECK_RC(RTLogDestroy(pLogger), VINF_SUCCESS);
+
+        char *pszContent = tstLogReadFile(szFile);
+        if (pszContent)
+        {
+            RTTESTI_CHECK_MSG(!strcmp(pszContent, "one\ntwo\nthree\nfour\n"), ("%s\n", pszContent));
+            RTStrFree(pszContent);
+        }
+    }
+    RTFileDelete(szFile);
+
+#ifndef RT_OS_WINDOWS
+    /*
+     * Overflow: log into a FIFO nobody reads from yet, so the writer thread
+     * stalls and the ring fills up.  Everything that doesn't fit must be
+     * dropped without blocking and show up in the drop note.
+     */
+    RTTestISub("async overflow");
+    RTStrPrintf(&szFile[cchFile], sizeof(szFile) - cchFile, "-%u.fifo", RTProcSelf());
+    RTFileDelete(szFile);
+    if (mkfifo(szFile, 0600) == 0)
+    {
+        RTFILE hFifo;
+        rc = RTFileOpen(&hFifo, szFile, RTFILE_O_READ | RTFILE_O_OPEN | RTFILE_O_DENY_NONE | RTFILE_O_NON_BLOCK);
+        RTTESTI_CHECK_RC_OK(rc);
+        if (RT_SUCCESS(rc))
+        {
+            pLogger = tstLogCreateFileLogger(szFile, RTLOGFLAGS_APPEND, RTLOGDEST_F_ASYNC);
+            if (pLogger)
+            {
+                static char s_szLine[1001];
+                memset(s_szLine, 'x', sizeof(s_szLine) - 1);
+                uint32_t const cLines = 256;
+                RTTESTI_CHECK_RC(RTLogDestinations(pLogger, "async=0x10000"), VINF_SUCCESS);
+                uint64_t const msStart = RTTimeMilliTS();
+                for (uint32_t i = 0; i < cLines; i++)
+                    RTLogLoggerEx(pLogger, 0, ~0U, "%s\n", s_szLine);
+                RTTESTI_CHECK_MSG(RTTimeMilliTS() - msStart < RT_MS_5SEC, ("Logging blocked on the writer!\n"));
+
+                /* Read what the writer gets out, then log a line to carry the drop note. */
+                size_t const cbOutput = _1M;
+                char        *pszOutput = (char *)RTMemAllocZ(cbOutput + 1);
+                size_t       offOutput = 0;
+                bool         fFinal    = false;
+                uint64_t     msLast    = RTTimeMilliTS();
+                while (pszOutput && RTTimeMilliTS() - msLast < RT_MS_10SEC)
+                {
+                    size_t cbRead = 0;
+                    rc = RTFileRead(hFifo, &pszOutput[offOutput], cbOutput - offOutput, &cbRead);
+                    if (RT_SUCCESS(rc) && cbRead > 0)
+                    {
+                        offOutput += cbRead;
+                        msLast = RTTimeMilliTS();
+                        if (fFinal && strstr(pszOutput, "final\n"))
+                            break;
+                    }
+                    else
+                    {
+                        if (!fFinal && RTTimeMilliTS() - msLast > 200)
+                        {
+                            RTLogLoggerEx(pLogger, 0, ~0U, "final\n");
+                            fFinal = true;
+                        }
+                        RTThreadSleep(1);
+                    }
+                }
+
+                if (pszOutput)
+                {
+                    const char *pszNote = strstr(pszOutput, "[DROPPED ");
+                    RTTESTI_CHECK_MSG(pszNote != NULL, ("no drop note in %zu bytes of output\n", offOutput));
+                    RTTESTI_CHECK(strstr(pszOutput, "final\n") != NULL);
+                    if (pszNote)
+                    {
+                        /* Every line either made it or is accounted for in the note. */
+                        uint32_t cLinesOut = 0;
+                        for (const char *psz = strstr(pszOutput, s_szLine); psz; psz = strstr(psz + 1, s_szLine))
+                            cLinesOut++;
+                        char    *pszNext;
+                        uint32_t cDropped  = 0;
+                        uint64_t cbDropped = 0;
+                        RTStrToUInt32Ex(pszNote + sizeof("[DROPPED ") - 1, &pszNext, 10, &cDropped);
+                        if (!strncmp(pszNext, " writes, ", sizeof(" writes, ") - 1))
+                            RTStrToUInt64Ex(pszNext + sizeof(" writes, ") - 1, NULL, 10, &cbDropped);
+                        RTTESTI_CHECK_MSG(cDropped > 0 && cLinesOut + cDropped == cLines,
+                                          ("cLinesOut=%u cDropped=%u\n", cLinesOut, cDropped));
+                        RTTESTI_CHECK_MSG(cbDropped == (uint64_t)cDropped * sizeof(s_szLine),
+                                          ("cbDropped=%RU64 cDropped=%u\n", cbDropped, cDropped));
+                    }
+                    RTMemFree(pszOutput);
+                }
+                RTTESTI_CHECK_RC(RTLogDestroy(pLogger), VINF_SUCCESS);
+            }
+            RTFileClose(hFifo);
+        }
+        RTFileDelete(szFile);
+    }
+    else
+        RTTestIFailed("mkfifo(%s) failed\n", szFile);
+#endif /* !RT_OS_WINDOWS */
+}
+
+
 int main()
 {
     RTTEST hTest;
@@ -142,6 +359,9 @@ int main()
                               s_aGroupEnumValues[iVal - 1].pszGroup, s_aGroupEnumValues[iVal].pszGroup);
         }
 #endif
+
+        tstLogAsync();
+
         rcExit = RTTestSummaryAndDestroy(hTest);
     }
     return rcExit;
@@ -30,8 +30,9 @@
 *********************************************************************************************************************************/
 #include <iprt/zip.h>
 
+#include <iprt/asm.h>
 #include <iprt/env.h>
-#include <iprt/errcore.h>
+#include <iprt/err.h>
 #include <iprt/initterm.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
@@ -61,6 +62,188 @@ static void testFile(const char *pszFilename)
 }
 
 
+/**
+ * Fills a buffer with a mix of runs, repeated text and noise.
+ */
+static void tstRTZipFill(uint8_t *pb, size_t cb, uint32_t uSeed)
+{
+    static const char s_szText[] = "The quick brown fox jumps over the lazy dog. ";
+    for (size_t off = 0; off < cb; off++)
+    {
+        uSeed = uSeed * UINT32_C(1103515245) + 12345;
+        switch ((off / 512) % 4)
+        {
+            case 0:  pb[off] = 0; break;
+            case 1:  pb[off] = (uint8_t)s_szText[off % (sizeof(s_szText) - 1)]; break;
+            case 2:  pb[off] = (uint8_t)(uSeed >> 16); break;
+            default: pb[off] = (uint8_t)(off >> 7); break;
+        }
+    }
+}
+
+
+/**
+ * Compresses and decompresses a set of buffers with the given codec.
+ */
+static void testRoundTrip(RTZIPTYPE enmType, const char *pszName)
+{
+    RTTestISubF("%s round trip", pszName);
+
+    static size_t const s_acbSrc[] = { 0, 1, 12, 13, 255, 4096, 65536 + 77, _1M };
+    size_t const cbSrcMax = _1M;
+    size_t const cbDstMax = cbSrcMax + cbSrcMax / 64 + 64;
+    uint8_t *pbSrc  = (uint8_t *)RTMemAlloc(cbSrcMax);
+    uint8_t *pbComp = (uint8_t *)RTMemAlloc(cbDstMax);
+    uint8_t *pbDst  = (uint8_t *)RTMemAlloc(cbSrcMax);
+    RTTESTI_CHECK_RETV(pbSrc && pbComp && pbDst);
+
+    for (unsigned iLevel = RTZIPLEVEL_FAST; iLevel <= RTZIPLEVEL_MAX; iLevel++)
+        for (unsigned i = 0; i < RT_ELEMENTS(s_acbSrc); i++)
+        {
+            size_t const cbSrc = s_acbSrc[i];
+            tstRTZipFill(pbSrc, cbSrc, i);
+
+            size_t cbComp = 0;
+            int rc = RTZipBlockCompress(enmType, (RTZIPLEVEL)iLevel, 0 /*fFlags*/, pbSrc, cbSrc, pbComp, cbDstMax, &cbComp);
+            if (rc == VERR_NOT_SUPPORTED)
+            {
+                RTTestSkipped(NIL_RTTEST, "%s is not supported by this build", pszName);
+                RTMemFree(pbSrc);
+                RTMemFree(pbComp);
+                RTMemFree(pbDst);
+                return;
+            }
+            RTTESTI_CHECK_MSG_RETV(RT_SUCCESS(rc), ("cbSrc=%zu level=%u: %Rrc\n", cbSrc, iLevel, rc));
+
+            size_t cbSrcActual = 0;
+            size_t cbDstActual = 0;
+            memset(pbDst, 0xf6, cbSrcMax);
+            rc = RTZipBlockDecompress(enmType, 0 /*fFlags*/, pbComp, cbComp, &cbSrcActual, pbDst, cbSrcMax, &cbDstActual);
+            RTTESTI_CHECK_MSG(RT_SUCCESS(rc), ("cbSrc=%zu level=%u: %Rrc\n", cbSrc, iLevel, rc));
+            RTTESTI_CHECK_MSG(cbSrcActual == cbComp, ("cbSrc=%zu: cbSrcActual=%zu cbComp=%zu\n", cbSrc, cbSrcActual, cbComp));
+            RTTESTI_CHECK_MSG(cbDstActual == cbSrc, ("cbSrc=%zu: cbDstActual=%zu\n", cbSrc, cbDstActual));
+            RTTESTI_CHECK_MSG(!memcmp(pbDst, pbSrc, cbSrc), ("cbSrc=%zu level=%u: content mismatch\n", cbSrc, iLevel));
+
+            /* A too small output buffer must be refused, not overrun. */
+            if (cbSrc > 1)
+            {
+                rc = RTZipBlockDecompress(enmType, 0 /*fFlags*/, pbComp, cbComp, NULL, pbDst, cbSrc - 1, &cbDstActual);
+                RTTESTI_CHECK_MSG(rc == VERR_BUFFER_OVERFLOW, ("cbSrc=%zu: %Rrc\n", cbSrc, rc));
+            }
+        }
+
+    RTMemFree(pbSrc);
+    RTMemFree(pbComp);
+    RTMemFree(pbDst);
+}
+
+
+/**
+ * Feeds the LZ4 decoder malformed blocks.
+ */
+static void testLz4Corrupt(void)
+{
+    RTTestISub("LZ4 corrupt input");
+
+    static struct
+    {
+        const char *pszDesc;
+        uint8_t     cb;
+        uint8_t     ab[8];
+    } const s_aTests[] =
+    {
+        { "literals past the end",          3, { 0x50, 'a', 'b' } },
+        { "truncated literal length",       1, { 0xf0 } },
+        { "truncated match offset",         3, { 0x10, 'a', 0x01 } },
+        { "zero match offset",              4, { 0x10, 'a', 0x00, 0x00 } },
+        { "match offset before the start",  4, { 0x10, 'a', 0x02, 0x00 } },
+        { "truncated match length",         4, { 0x1f, 'a', 0x01, 0x00 } },
+    };
+    uint8_t abDst[256];
+    for (unsigned i = 0; i < RT_ELEMENTS(s_aTests); i++)
+    {
+        size_t cbDstActual = 0;
+        int rc = RTZipBlockDecompress(RTZIPTYPE_LZ4, 0 /*fFlags*/, s_aTests[i].ab, s_aTests[i].cb, NULL,
+                                      abDst, sizeof(abDst), &cbDstActual);
+        if (rc == VERR_NOT_SUPPORTED)
+        {
+            RTTestSkipped(NIL_RTTEST, "LZ4 is not supported by this build");
+            return;
+        }
+        RTTESTI_CHECK_MSG(rc == VERR_ZIP_CORRUPTED, ("%s: %Rrc\n", s_aTests[i].pszDesc, rc));
+    }
+
+    /* A match longer than the output buffer. */
+    static uint8_t const s_abLongMatch[] = { 0x1f, 'a', 0x01, 0x00, 0xff, 0xff, 0x00 };
+    size_t cbDstActual = 0;
+    int rc = RTZipBlockDecompress(RTZIPTYPE_LZ4, 0 /*fFlags*/, s_abLongMatch, sizeof(s_abLongMatch), NULL,
+                                  abDst, sizeof(abDst), &cbDstActual);
+    RTTESTI_CHECK_RC(rc, VERR_BUFFER_OVERFLOW);
+
+    /* Randomly damaged blocks must never write outside the buffer or claim
+       more output than there is room for. */
+    uint8_t abSrc[4096];
+    uint8_t abComp[4096 + 128];
+    uint8_t abOut[4096 + 16];
+    tstRTZipFill(abSrc, sizeof(abSrc), 42);
+    size_t cbComp = 0;
+    rc = RTZipBlockCompress(RTZIPTYPE_LZ4, RTZIPLEVEL_DEFAULT, 0 /*fFlags*/, abSrc, sizeof(abSrc), abComp, sizeof(abComp), &cbComp);
+    RTTESTI_CHECK_RC_RETV(rc, VINF_SUCCESS);
+    uint32_t uSeed = 0x1234;
+    for (unsigned iRound = 0; iRound < 4096; iRound++)
+    {
+        uint8_t abDamaged[sizeof(abComp)];
+        memcpy(abDamaged, abComp, cbComp);
+        for (unsigned j = 0; j < 4; j++)
+        {
+            uSeed = uSeed * UINT32_C(1103515245) + 12345;
+            abDamaged[(uSeed >> 8) % cbComp] ^= (uint8_t)(uSeed >> 24) | 1;
+        }
+        uSeed = uSeed * UINT32_C(1103515245) + 12345;
+        size_t const cbDamaged = iRound & 1 ? cbComp : (uSeed >> 8) % cbComp;
+
+        memset(abOut, 0xf6, sizeof(abOut));
+        cbDstActual = 0;
+        rc = RTZipBlockDecompress(RTZIPTYPE_LZ4, 0 /*fFlags*/, abDamaged, cbDamaged, NULL, abOut, sizeof(abSrc), &cbDstActual);
+        RTTESTI_CHECK_MSG(RT_SUCCESS(rc) || rc == VERR_ZIP_CORRUPTED || rc == VERR_BUFFER_OVERFLOW, ("round %u: %Rrc\n", iRound, rc));
+        if (RT_SUCCESS(rc))
+            RTTESTI_CHECK(cbDstActual <= sizeof(abSrc));
+        RTTESTI_CHECK(ASMMemIsAllU8(&abOut[sizeof(abSrc)], sizeof(abOut) - sizeof(abSrc), 0xf6));
+    }
+}
+
+
+/**
+ * Checks that Zstandard rejects damaged frames.
+ */
+static void testZstdCorrupt(void)
+{
+    RTTestISub("Zstd corrupt input");
+
+    uint8_t abSrc[4096];
+    uint8_t abComp[4096 + 128];
+    uint8_t abOut[4096];
+    tstRTZipFill(abSrc, sizeof(abSrc), 7);
+    size_t cbComp = 0;
+    int rc = RTZipBlockCompress(RTZIPTYPE_ZSTD, RTZIPLEVEL_DEFAULT, 0 /*fFlags*/, abSrc, sizeof(abSrc), abComp, sizeof(abComp), &cbComp);
+    if (rc == VERR_NOT_SUPPORTED)
+    {
+        RTTestSkipped(NIL_RTTEST, "Zstd is not supported by this build");
+        return;
+    }
+    RTTESTI_CHECK_RC_RETV(rc, VINF_SUCCESS);
+
+    /* Bad magic, and a frame cut short. */
+    abComp[0] ^= 0xff;
+    size_t cbDstActual = 0;
+    rc = RTZipBlockDecompress(RTZIPTYPE_ZSTD, 0 /*fFlags*/, abComp, cbComp, NULL, abOut, sizeof(abOut), &cbDstActual);
+    RTTESTI_CHECK_RC(rc, VERR_ZIP_CORRUPTED);
+    abComp[0] ^= 0xff;
+    rc = RTZipBlockDecompress(RTZIPTYPE_ZSTD, 0 /*fFlags*/, abComp, cbComp / 2, NULL, abOut, sizeof(abOut), &cbDstActual);
+    RTTESTI_CHECK_RC(rc, VERR_ZIP_CORRUPTED);
+}
+
+
 int main(int argc, char **argv)
 {
     RTTEST hTest;
@@ -76,7 +259,10 @@ int main(int argc, char **argv)
     }
     else
     {
-        /** @todo testcase */
+        testRoundTrip(RTZIPTYPE_LZ4, "LZ4");
+        testRoundTrip(RTZIPTYPE_ZSTD, "Zstd");
+        testLz4Corrupt();
+        testZstdCorrupt();
     }
 
     /*
@@ -0,0 +1,2259 @@
+/* $Id: DDI.cpp $ */
+/** @file
+ * DDI - Deduplicating Disk Image.
+ */
+
+/*
+ * Copyright (C) 2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define LOG_GROUP LOG_GROUP_VD_DDI
+#include <VBox/vd-plugin.h>
+#include <VBox/err.h>
+
+#include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/string.h>
+#include <iprt/alloc.h>
+#include <iprt/path.h>
+#include <iprt/sha.h>
+#include <iprt/uuid.h>
+
+#include "VDBackends.h"
+#include "VDBackendsInline.h"
+
+/**
+ * The DDI backend implements a content addressed image format. The guest visible
+ * disk is divided into fixed size blocks, every block is mapped to a physical data
+ * block in the image which is identified by the SHA-256 hash of its content.
+ * Blocks with identical content written by the guest share a single physical block
+ * which is reference counted, so the image only grows for data which wasn't seen
+ * before. Because identical data ends up at the same file offset the host page
+ * cache only holds a single copy of it as well.
+ *
+ * The image consists of the following parts:
+ *    - A 4KB header including the parent filename for differencing images.
+ *    - The block map with one 32bit entry for every guest block, 0 means the block
+ *      is not allocated in this image (read from the parent), DDI_BLOCK_ZERO means
+ *      the block is all zeroes and any other value is the physical block index + 1.
+ *    - The physical block table with the hash and reference count of every physical
+ *      block. Physical blocks with a reference count of 0 are free and get reused.
+ *    - The data area, physical block i starts at offData + i * cbBlock.
+ *
+ * Blocks are never modified in place, a write always supplies a complete block
+ * (partial writes are turned into read-modify-write cycles by the VD layer) which
+ * is then either linked to an existing physical block with the same hash or stored
+ * in a newly allocated one. Sharing happens between the blocks of a single image,
+ * linked clones share the data of their base through the regular differencing image
+ * chain. Physical blocks released by overwrites are reused for new data, compaction
+ * moves all used blocks to the front of the data area and truncates the image.
+ *
+ * The reference counts are redundant with the block map and are recalculated when
+ * the image is opened, so a crash between updating the block map and the physical
+ * block table doesn't leave the image in an inconsistent state.
+ */
+
+
+/*********************************************************************************************************************************
+*   Structures in a DDI image, little endian                                                                                     *
+*********************************************************************************************************************************/
+
+/** Maximum size of the parent filename including the terminator. */
+#define DDI_PARENT_FILENAME_MAX              2048
+
+#pragma pack(1)
+typedef struct DdiHeader
+{
+    /** Magic value. */
+    uint32_t    u32Magic;
+    /** Version of the image format. */
+    uint32_t    u32Version;
+    /** Size of the header in bytes. */
+    uint32_t    cbHeader;
+    /** Image flags, see DDI_HDR_F_*. */
+    uint32_t    fFlags;
+    /** Logical image size as seen by the guest. */
+    uint64_t    cbSize;
+    /** Block size in bytes. */
+    uint32_t    cbBlock;
+    /** Number of guest blocks (entries in the block map and physical block table). */
+    uint32_t    cBlocks;
+    /** Number of physical blocks in the data area (used and free). */
+    uint32_t    cPhysBlocks;
+    /** Reserved, MBZ. */
+    uint32_t    u32Reserved;
+    /** Offset of the block map in bytes. */
+    uint64_t    offBlockMap;
+    /** Offset of the physical block table in bytes. */
+    uint64_t    offPhysTbl;
+    /** Offset of the data area in bytes. */
+    uint64_t    offData;
+    /** UUID of the image. */
+    RTUUID      UuidCreate;
+    /** UUID of the last modification. */
+    RTUUID      UuidModify;
+    /** UUID of the parent image. */
+    RTUUID      UuidParent;
+    /** UUID of the parent image when this image was created or last modified. */
+    RTUUID      UuidParentModify;
+    /** Physical geometry: Cylinders, Heads, Sectors. */
+    uint32_t    aPCHSGeometry[3];
+    /** Logical geometry: Cylinders, Heads, Sectors. */
+    uint32_t    aLCHSGeometry[3];
+    /** Size of the parent filename excluding the terminator. */
+    uint32_t    cbParentFilename;
+    /** Reserved, MBZ. */
+    uint8_t     abReserved[4096 - 156 - DDI_PARENT_FILENAME_MAX];
+    /** Filename of the parent image for differencing images, UTF-8. */
+    char        achParentFilename[DDI_PARENT_FILENAME_MAX];
+} DdiHeader;
+#pragma pack()
+AssertCompileSize(DdiHeader, 4096);
+/** Pointer to a on disk DDI header. */
+typedef DdiHeader *PDdiHeader;
+
+#pragma pack(1)
+typedef struct DdiPhysBlock
+{
+    /** SHA-256 hash of the block data. */
+    uint8_t     abHash[RTSHA256_HASH_SIZE];
+    /** Number of guest blocks referencing this physical block. */
+    uint32_t    cRefs;
+    /** Reserved, MBZ. */
+    uint32_t    u32Reserved;
+} DdiPhysBlock;
+#pragma pack()
+AssertCompileSize(DdiPhysBlock, 40);
+/** Pointer to a on disk physical block table entry. */
+typedef DdiPhysBlock *PDdiPhysBlock;
+
+/** DDI magic value. */
+#define DDI_MAGIC                            UINT32_C(0x00494444) /* DDI\0 */
+/** Current version of the format. */
+#define DDI_VERSION                          1
+/** Block size minimum. */
+#define DDI_BLOCK_SIZE_MIN                   RT_BIT(12)
+/** Block size maximum. */
+#define DDI_BLOCK_SIZE_MAX                   RT_BIT(24)
+/** DDI default block size when creating an image. */
+#define DDI_BLOCK_SIZE_DEFAULT               (64 * _1K)
+
+/** Header flags.
+ * @{
+ */
+/** Image is a differencing image. */
+#define DDI_HDR_F_DIFF                       RT_BIT_32(0)
+/** Mask of valid flags. */
+#define DDI_HDR_F_MASK                       (DDI_HDR_F_DIFF)
+/** @} */
+
+/** Block map entry for a block not allocated in this image. */
+#define DDI_BLOCK_FREE                       UINT32_C(0)
+/** Block map entry for a block consisting only of zeroes. */
+#define DDI_BLOCK_ZERO                       UINT32_C(0xffffffff)
+/** Checks whether the given block map entry references a physical block. */
+#define DDI_BLOCK_IS_ALLOCATED(a_uEntry)     ((a_uEntry) != DDI_BLOCK_FREE && (a_uEntry) != DDI_BLOCK_ZERO)
+
+
+/*********************************************************************************************************************************
+*   Constants And Macros, Structures and Typedefs                                                                                *
+*********************************************************************************************************************************/
+
+/** Nil physical block index terminating the hash chains and the free list. */
+#define DDI_PHYS_NIL                         UINT32_MAX
+
+/**
+ * In memory state of a physical block.
+ */
+typedef struct DDIPHYSBLOCK
+{
+    /** SHA-256 hash of the block data. */
+    uint8_t             abHash[RTSHA256_HASH_SIZE];
+    /** Number of guest blocks referencing this physical block. */
+    uint32_t            cRefs;
+    /** Next physical block in the hash chain or the free list. */
+    uint32_t            idxNext;
+    /** Flag whether the data is on disk and the block can be shared. */
+    bool                fCommitted;
+    /** Flag whether the data write of a new block is still pending. */
+    bool                fDataPending;
+    /** Guest block linked to this block while the data write is pending. */
+    uint32_t            idxBlockPending;
+    /** Block map entry on disk the pending guest block replaces, released once the
+     * new entry is written. DDI_BLOCK_FREE if there is nothing to release. */
+    uint32_t            uEntryOldPending;
+} DDIPHYSBLOCK, *PDDIPHYSBLOCK;
+
+/**
+ * DDI image data structure.
+ */
+typedef struct DDIIMAGE
+{
+    /** Image name. */
+    const char          *pszFilename;
+    /** Storage handle. */
+    PVDIOSTORAGE        pStorage;
+
+    /** Pointer to the per-disk VD interface list. */
+    PVDINTERFACE        pVDIfsDisk;
+    /** Pointer to the per-image VD interface list. */
+    PVDINTERFACE        pVDIfsImage;
+    /** Error interface. */
+    PVDINTERFACEERROR   pIfError;
+    /** I/O interface. */
+    PVDINTERFACEIOINT   pIfIo;
+
+    /** Open flags passed by VBoxHD layer. */
+    unsigned            uOpenFlags;
+    /** Image flags defined during creation or determined during open. */
+    unsigned            uImageFlags;
+    /** Total size of the image. */
+    uint64_t            cbSize;
+    /** Physical geometry of this image. */
+    VDGEOMETRY          PCHSGeometry;
+    /** Logical geometry of this image. */
+    VDGEOMETRY          LCHSGeometry;
+    /** The image UUIDs. */
+    RTUUID              UuidCreate;
+    RTUUID              UuidModify;
+    RTUUID              UuidParent;
+    RTUUID              UuidParentModify;
+
+    /** Filename of the parent image if any. */
+    char               *pszParentFilename;
+
+    /** Block size in bytes. */
+    uint32_t            cbBlock;
+    /** Number of guest blocks. */
+    uint32_t            cBlocks;
+    /** Offset of the block map. */
+    uint64_t            offBlockMap;
+    /** Offset of the physical block table. */
+    uint64_t            offPhysTbl;
+    /** Offset of the data area. */
+    uint64_t            offData;
+    /** The block map. */
+    uint32_t           *paBlockMap;
+
+    /** Number of physical blocks in the data area. */
+    uint32_t            cPhysBlocks;
+    /** Number of entries the physical block array has room for. */
+    uint32_t            cPhysBlocksMax;
+    /** The physical block array. */
+    PDDIPHYSBLOCK       paPhysBlocks;
+    /** Head of the free physical block list. */
+    uint32_t            idxPhysFree;
+    /** Head of the list of blocks freed since the last flush was issued. The block map
+     * on disk might still reference them, so they are reused only after a flush. */
+    uint32_t            idxPhysFreePending;
+    /** Number of hash buckets, power of two. */
+    uint32_t            cHashBuckets;
+    /** The hash buckets, each pointing to the first physical block of the chain. */
+    uint32_t           *paHashBuckets;
+    /** Scratch buffer for one block, writes are serialized by the VD layer. */
+    void               *pvBlock;
+
+    /** Number of full block writes which were linked to an existing block. */
+    uint64_t            cDedupHits;
+    /** Number of full block writes which required a new physical block. */
+    uint64_t            cDedupMisses;
+
+    /** The static region list. */
+    VDREGIONLIST        RegionList;
+} DDIIMAGE, *PDDIIMAGE;
+
+
+/*********************************************************************************************************************************
+*   Static Variables                                                                                                             *
+*********************************************************************************************************************************/
+
+/** NULL-terminated array of supported file extensions. */
+static const VDFILEEXTENSION s_aDdiFileExtensions[] =
+{
+    {"ddi", VDTYPE_HDD},
+    {NULL,  VDTYPE_INVALID}
+};
+
+
+/*********************************************************************************************************************************
+*   Internal Functions                                                                                                           *
+*********************************************************************************************************************************/
+
+/**
+ * Converts the image header to the host endianess and performs basic checks.
+ *
+ * @returns Whether the given header is valid or not.
+ * @param   pHeader    Pointer to the header to convert.
+ */
+static bool ddiHdrConvertToHostEndianess(PDdiHeader pHeader)
+{
+    pHeader->u32Magic         = RT_LE2H_U32(pHeader->u32Magic);
+    pHeader->u32Version       = RT_LE2H_U32(pHeader->u32Version);
+    pHeader->cbHeader         = RT_LE2H_U32(pHeader->cbHeader);
+    pHeader->fFlags           = RT_LE2H_U32(pHeader->fFlags);
+    pHeader->cbSize           = RT_LE2H_U64(pHeader->cbSize);
+    pHeader->cbBlock          = RT_LE2H_U32(pHeader->cbBlock);
+    pHeader->cBlocks          = RT_LE2H_U32(pHeader->cBlocks);
+    pHeader->cPhysBlocks      = RT_LE2H_U32(pHeader->cPhysBlocks);
+    pHeader->offBlockMap      = RT_LE2H_U64(pHeader->offBlockMap);
+    pHeader->offPhysTbl       = RT_LE2H_U64(pHeader->offPhysTbl);
+    pHeader->offData          = RT_LE2H_U64(pHeader->offData);
+    for (unsigned i = 0; i < RT_ELEMENTS(pHeader->aPCHSGeometry); i++)
+    {
+        pHeader->aPCHSGeometry[i] = RT_LE2H_U32(pHeader->aPCHSGeometry[i]);
+        pHeader->aLCHSGeometry[i] = RT_LE2H_U32(pHeader->aLCHSGeometry[i]);
+    }
+    pHeader->cbParentFilename = RT_LE2H_U32(pHeader->cbParentFilename);
+
+    if (   pHeader->u32Magic != DDI_MAGIC
+        || pHeader->u32Version != DDI_VERSION
+        || pHeader->cbHeader != sizeof(DdiHeader)
+        || (pHeader->fFlags & ~DDI_HDR_F_MASK)
+        || pHeader->cbBlock < DDI_BLOCK_SIZE_MIN
+        || pHeader->cbBlock > DDI_BLOCK_SIZE_MAX
+        || !RT_IS_POWER_OF_TWO(pHeader->cbBlock)
+        || pHeader->cBlocks != (pHeader->cbSize + pHeader->cbBlock - 1) / pHeader->cbBlock
+        || pHeader->cPhysBlocks > pHeader->cBlocks
+        || pHeader->cbParentFilename >= DDI_PARENT_FILENAME_MAX
+        || pHeader->offBlockMap < sizeof(DdiHeader)
+        || pHeader->offPhysTbl < pHeader->offBlockMap + (uint64_t)pHeader->cBlocks * sizeof(uint32_t)
+        || pHeader->offData < pHeader->offPhysTbl + (uint64_t)pHeader->cBlocks * sizeof(DdiPhysBlock))
+        return false;
+
+    return true;
+}
+
+/**
+ * Creates a DDI header from the given image state.
+ *
+ * @returns nothing.
+ * @param   pImage     Image instance data.
+ * @param   pHeader    Pointer to the header to convert.
+ */
+static void ddiHdrConvertFromHostEndianess(PDDIIMAGE pImage, PDdiHeader pHeader)
+{
+    RT_BZERO(pHeader, sizeof(*pHeader));
+    pHeader->u32Magic         = RT_H2LE_U32(DDI_MAGIC);
+    pHeader->u32Version       = RT_H2LE_U32(DDI_VERSION);
+    pHeader->cbHeader         = RT_H2LE_U32((uint32_t)sizeof(DdiHeader));
+    pHeader->fFlags           = RT_H2LE_U32((pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF) ? DDI_HDR_F_DIFF : 0);
+    pHeader->cbSize           = RT_H2LE_U64(pImage->cbSize);
+    pHeader->cbBlock          = RT_H2LE_U32(pImage->cbBlock);
+    pHeader->cBlocks          = RT_H2LE_U32(pImage->cBlocks);
+    pHeader->cPhysBlocks      = RT_H2LE_U32(pImage->cPhysBlocks);
+    pHeader->offBlockMap      = RT_H2LE_U64(pImage->offBlockMap);
+    pHeader->offPhysTbl       = RT_H2LE_U64(pImage->offPhysTbl);
+    pHeader->offData          = RT_H2LE_U64(pImage->offData);
+    pHeader->UuidCreate       = pImage->UuidCreate;
+    pHeader->UuidModify       = pImage->UuidModify;
+    pHeader->UuidParent       = pImage->UuidParent;
+    pHeader->UuidParentModify = pImage->UuidParentModify;
+    pHeader->aPCHSGeometry[0] = RT_H2LE_U32(pImage->PCHSGeometry.cCylinders);
+    pHeader->aPCHSGeometry[1] = RT_H2LE_U32(pImage->PCHSGeometry.cHeads);
+    pHeader->aPCHSGeometry[2] = RT_H2LE_U32(pImage->PCHSGeometry.cSectors);
+    pHeader->aLCHSGeometry[0] = RT_H2LE_U32(pImage->LCHSGeometry.cCylinders);
+    pHeader->aLCHSGeometry[1] = RT_H2LE_U32(pImage->LCHSGeometry.cHeads);
+    pHeader->aLCHSGeometry[2] = RT_H2LE_U32(pImage->LCHSGeometry.cSectors);
+    if (pImage->pszParentFilename)
+    {
+        size_t cchParent = strlen(pImage->pszParentFilename);
+        Assert(cchParent < DDI_PARENT_FILENAME_MAX);
+        pHeader->cbParentFilename = RT_H2LE_U32((uint32_t)cchParent);
+        memcpy(&pHeader->achParentFilename[0], pImage->pszParentFilename, cchParent);
+    }
+}
+
+/**
+ * Converts a physical block table entry from the in memory state to the on disk format.
+ *
+ * @returns nothing.
+ * @param   pPhysBlock    The in memory physical block state.
+ * @param   pEntry        Where to store the on disk entry.
+ */
+static void ddiPhysBlockConvertFromHostEndianess(PDDIPHYSBLOCK pPhysBlock, PDdiPhysBlock pEntry)
+{
+    memcpy(&pEntry->abHash[0], &pPhysBlock->abHash[0], sizeof(pEntry->abHash));
+    pEntry->cRefs       = RT_H2LE_U32(pPhysBlock->cRefs);
+    pEntry->u32Reserved = 0;
+}
+
+/**
+ * Returns the hash bucket for the given block hash.
+ */
+DECLINLINE(uint32_t) ddiHashBucket(PDDIIMAGE pImage, const uint8_t *pbHash)
+{
+    uint32_t u32;
+    memcpy(&u32, pbHash, sizeof(u32));
+    return u32 & (pImage->cHashBuckets - 1);
+}
+
+/**
+ * Returns the size of the given guest block, only the last block can be smaller
+ * than the block size of the image.
+ */
+DECLINLINE(uint32_t) ddiBlockGetSize(PDDIIMAGE pImage, uint32_t idxBlock)
+{
+    uint64_t offBlock = (uint64_t)idxBlock * pImage->cbBlock;
+    return (uint32_t)RT_MIN((uint64_t)pImage->cbBlock, pImage->cbSize - offBlock);
+}
+
+/**
+ * Looks up a committed physical block with the given hash.
+ *
+ * @returns Index of the physical block or DDI_PHYS_NIL if not found.
+ * @param   pImage    Image instance data.
+ * @param   pbHash    The hash to look for.
+ */
+static uint32_t ddiHashLookup(PDDIIMAGE pImage, const uint8_t *pbHash)
+{
+    uint32_t idxPhys = pImage->paHashBuckets[ddiHashBucket(pImage, pbHash)];
+    while (idxPhys != DDI_PHYS_NIL)
+    {
+        PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys];
+        if (!memcmp(&pPhysBlock->abHash[0], pbHash, RTSHA256_HASH_SIZE))
+            break;
+        idxPhys = pPhysBlock->idxNext;
+    }
+
+    return idxPhys;
+}
+
+/**
+ * Links the given physical block into the hash index.
+ */
+static void ddiHashInsert(PDDIIMAGE pImage, uint32_t idxPhys)
+{
+    PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys];
+    uint32_t idxBucket = ddiHashBucket(pImage, &pPhysBlock->abHash[0]);
+
+    pPhysBlock->idxNext = pImage->paHashBuckets[idxBucket];
+    pImage->paHashBuckets[idxBucket] = idxPhys;
+}
+
+/**
+ * Unlinks the given physical block from the hash index.
+ */
+static void ddiHashRemove(PDDIIMAGE pImage, uint32_t idxPhys)
+{
+    PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys];
+    uint32_t *pidxCur = &pImage->paHashBuckets[ddiHashBucket(pImage, &pPhysBlock->abHash[0])];
+
+    while (*pidxCur != idxPhys)
+    {
+        AssertReturnVoid(*pidxCur != DDI_PHYS_NIL);
+        pidxCur = &pImage->paPhysBlocks[*pidxCur].idxNext;
+    }
+
+    *pidxCur = pPhysBlock->idxNext;
+    pPhysBlock->idxNext = DDI_PHYS_NIL;
+}
+
+/**
+ * Puts the given physical block onto the free list.
+ */
+static void ddiPhysBlockFree(PDDIIMAGE pImage, uint32_t idxPhys)
+{
+    PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys];
+
+    Assert(!pPhysBlock->cRefs);
+    pPhysBlock->fCommitted = false;
+    pPhysBlock->idxNext    = pImage->idxPhysFree;
+    pImage->idxPhysFree    = idxPhys;
+}
+
+/**
+ * Puts the given physical block onto the list of blocks which can be reused
+ * after the next flush.
+ */
+static void ddiPhysBlockFreeDeferred(PDDIIMAGE pImage, uint32_t idxPhys)
+{
+    PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys];
+
+    Assert(!pPhysBlock->cRefs);
+    pPhysBlock->fCommitted     = false;
+    pPhysBlock->idxNext        = pImage->idxPhysFreePending;
+    pImage->idxPhysFreePending = idxPhys;
+}
+
+/**
+ * Moves the given list of deferred blocks onto the free list or back onto the
+ * deferred list.
+ *
+ * @returns nothing.
+ * @param   pImage     Image instance data.
+ * @param   idxPhys    Head of the list.
+ * @param   fReuse     Flag whether the blocks can be reused now.
+ */
+static void ddiPhysBlockFreeList(PDDIIMAGE pImage, uint32_t idxPhys, bool fReuse)
+{
+    while (idxPhys != DDI_PHYS_NIL)
+    {
+        uint32_t idxNext = pImage->paPhysBlocks[idxPhys].idxNext;
+        if (fReuse)
+            ddiPhysBlockFree(pImage, idxPhys);
+        else
+            ddiPhysBlockFreeDeferred(pImage, idxPhys);
+        idxPhys = idxNext;
+    }
+}
+
+/**
+ * Makes sure the physical block array has room for the given number of entries.
+ *
+ * @returns VBox status code.
+ * @param   pImage          Image instance data.
+ * @param   cPhysBlocks     Number of entries required.
+ */
+static int ddiPhysBlocksEnsureSpace(PDDIIMAGE pImage, uint32_t cPhysBlocks)
+{
+    if (cPhysBlocks <= pImage->cPhysBlocksMax)
+        return VINF_SUCCESS;
+
+    uint32_t cPhysBlocksMax = RT_MAX(pImage->cPhysBlocksMax, _4K);
+    while (cPhysBlocksMax < cPhysBlocks)
+        cPhysBlocksMax *= 2;
+    cPhysBlocksMax = RT_MIN(cPhysBlocksMax, pImage->cBlocks);
+
+    PDDIPHYSBLOCK paPhysBlocks = (PDDIPHYSBLOCK)RTMemRealloc(pImage->paPhysBlocks,
+                                                             cPhysBlocksMax * sizeof(DDIPHYSBLOCK));
+    if (RT_UNLIKELY(!paPhysBlocks))
+        return VERR_NO_MEMORY;
+
+    pImage->paPhysBlocks   = paPhysBlocks;
+    pImage->cPhysBlocksMax = cPhysBlocksMax;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Allocates a physical block, reusing a free one if possible.
+ *
+ * @returns VBox status code.
+ * @param   pImage      Image instance data.
+ * @param   pidxPhys    Where to store the index of the allocated block.
+ */
+static int ddiPhysBlockAlloc(PDDIIMAGE pImage, uint32_t *pidxPhys)
+{
+    uint32_t idxPhys = pImage->idxPhysFree;
+
+    if (idxPhys != DDI_PHYS_NIL)
+        pImage->idxPhysFree = pImage->paPhysBlocks[idxPhys].idxNext;
+    else
+    {
+        /* Every physical block is referenced by at least one guest block. */
+        AssertReturn(pImage->cPhysBlocks < pImage->cBlocks, VERR_INTERNAL_ERROR_3);
+
+        int rc = ddiPhysBlocksEnsureSpace(pImage, pImage->cPhysBlocks + 1);
+        if (RT_FAILURE(rc))
+            return rc;
+        idxPhys = pImage->cPhysBlocks++;
+    }
+
+    PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys];
+    pPhysBlock->cRefs            = 0;
+    pPhysBlock->idxNext          = DDI_PHYS_NIL;
+    pPhysBlock->fCommitted       = false;
+    pPhysBlock->fDataPending     = false;
+    pPhysBlock->idxBlockPending  = 0;
+    pPhysBlock->uEntryOldPending = DDI_BLOCK_FREE;
+    *pidxPhys = idxPhys;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Writes the physical block table entry of the given block to the image.
+ *
+ * @returns VBox status code.
+ * @param   pImage     Image instance data.
+ * @param   pIoCtx     The I/O context, NULL for synchronous I/O.
+ * @param   idxPhys    The physical block index.
+ */
+static int ddiPhysBlockWrite(PDDIIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxPhys)
+{
+    DdiPhysBlock Entry;
+
+    ddiPhysBlockConvertFromHostEndianess(&pImage->paPhysBlocks[idxPhys], &Entry);
+    return vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage,
+                                  pImage->offPhysTbl + (uint64_t)idxPhys * sizeof(DdiPhysBlock),
+                                  &Entry, sizeof(Entry), pIoCtx, NULL, NULL);
+}
+
+/**
+ * Writes the block map entry of the given guest block to the image.
+ *
+ * @returns VBox status code.
+ * @param   pImage      Image instance data.
+ * @param   pIoCtx      The I/O context, NULL for synchronous I/O.
+ * @param   idxBlock    The guest block index.
+ */
+static int ddiBlockMapWrite(PDDIIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxBlock)
+{
+    uint32_t u32Entry = RT_H2LE_U32(pImage->paBlockMap[idxBlock]);
+
+    return vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage,
+                                  pImage->offBlockMap + (uint64_t)idxBlock * sizeof(uint32_t),
+                                  &u32Entry, sizeof(u32Entry), pIoCtx, NULL, NULL);
+}
+
+/**
+ * Drops a reference to the given physical block, freeing it when the last
+ * reference is gone.
+ *
+ * @returns VBox status code.
+ * @param   pImage     Image instance data.
+ * @param   pIoCtx     The I/O context, NULL for synchronous I/O.
+ * @param   idxPhys    The physical block index.
+ */
+static int ddiPhysBlockRelease(PDDIIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxPhys)
+{
+    PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys];
+
+    AssertReturn(pPhysBlock->cRefs > 0, VERR_INTERNAL_ERROR_3);
+    pPhysBlock->cRefs--;
+    if (!pPhysBlock->cRefs)
+    {
+        /*
+         * Blocks with the data write still pending are freed by the completion callback.
+         * Committed blocks might still be referenced by the block map on disk until the
+         * next flush, so they can't be overwritten with new data before that. Blocks
+         * whose data write failed were never referenced on disk.
+         */
+        if (pPhysBlock->fCommitted)
+        {
+            ddiHashRemove(pImage, idxPhys);
+            ddiPhysBlockFreeDeferred(pImage, idxPhys);
+        }
+        else if (!pPhysBlock->fDataPending)
+            ddiPhysBlockFree(pImage, idxPhys);
+        RT_ZERO(pPhysBlock->abHash);
+    }
+
+    return ddiPhysBlockWrite(pImage, pIoCtx, idxPhys);
+}
+
+/**
+ * Completion callback for a block map update, drops the reference to the block
+ * the guest block was linked to before now that the new entry is on disk.
+ */
+static DECLCALLBACK(int) ddiBlockMapCommitted(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    uint32_t uEntryOld = (uint32_t)(uintptr_t)pvUser;
+
+    /*
+     * Keep the reference if the update failed, the old block is still referenced on disk.
+     * The reference counts are recalculated on open, so failing to write the physical
+     * block table entry isn't fatal either.
+     */
+    if (   RT_SUCCESS(rcReq)
+        && DDI_BLOCK_IS_ALLOCATED(uEntryOld))
+    {
+        int rc = ddiPhysBlockRelease(pImage, pIoCtx, uEntryOld - 1);
+        if (RT_FAILURE(rc) && rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+            LogRel(("DDI: Updating the physical block table of '%s' failed with %Rrc\n", pImage->pszFilename, rc));
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Writes the block map entry of the given guest block and drops the reference to
+ * the block it replaces once the entry is on disk.
+ *
+ * @returns VBox status code.
+ * @param   pImage       Image instance data.
+ * @param   pIoCtx       The I/O context.
+ * @param   idxBlock     The guest block index.
+ * @param   uEntryOld    The block map entry on disk which is replaced.
+ */
+static int ddiBlockMapUpdate(PDDIIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxBlock, uint32_t uEntryOld)
+{
+    uint32_t u32Entry = RT_H2LE_U32(pImage->paBlockMap[idxBlock]);
+
+    int rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage,
+                                    pImage->offBlockMap + (uint64_t)idxBlock * sizeof(uint32_t),
+                                    &u32Entry, sizeof(u32Entry), pIoCtx,
+                                    ddiBlockMapCommitted, (void *)(uintptr_t)uEntryOld);
+    if (rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+        ddiBlockMapCommitted(pImage, pIoCtx, (void *)(uintptr_t)uEntryOld, rc);
+    return rc;
+}
+
+/**
+ * Completion callback for the data write of a newly allocated physical block,
+ * the block can be shared from now on and the guest block is linked to it on disk.
+ */
+static DECLCALLBACK(int) ddiPhysBlockCommitted(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    uint32_t idxPhys = (uint32_t)(uintptr_t)pvUser;
+    PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys];
+
+    pPhysBlock->fDataPending = false;
+    if (!pPhysBlock->cRefs)
+    {
+        /* Overwritten before the data reached the disk, the block map on disk never referenced it. */
+        Assert(pPhysBlock->uEntryOldPending == DDI_BLOCK_FREE);
+        ddiPhysBlockFree(pImage, idxPhys);
+    }
+    else if (RT_SUCCESS(rcReq))
+    {
+        pPhysBlock->fCommitted = true;
+        ddiHashInsert(pImage, idxPhys);
+
+        /* The block map entry is written only now, so it never points to data which isn't there. */
+        uint32_t uEntryOld = pPhysBlock->uEntryOldPending;
+        pPhysBlock->uEntryOldPending = DDI_BLOCK_FREE;
+        Assert(pImage->paBlockMap[pPhysBlock->idxBlockPending] == idxPhys + 1);
+        int rc = ddiBlockMapUpdate(pImage, pIoCtx, pPhysBlock->idxBlockPending, uEntryOld);
+        if (RT_FAILURE(rc) && rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+            LogRel(("DDI: Updating the block map of '%s' failed with %Rrc\n", pImage->pszFilename, rc));
+    }
+    /* else: The block stays private to the guest block referencing it. */
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Sets up the hash index and the free list from the physical block table.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ */
+static int ddiHashIndexBuild(PDDIIMAGE pImage)
+{
+    uint32_t cHashBuckets = _4K;
+    while (cHashBuckets < pImage->cBlocks && cHashBuckets < _16M)
+        cHashBuckets *= 2;
+
+    if (cHashBuckets != pImage->cHashBuckets)
+    {
+        RTMemFree(pImage->paHashBuckets);
+        pImage->paHashBuckets = (uint32_t *)RTMemAlloc(cHashBuckets * sizeof(uint32_t));
+        if (RT_UNLIKELY(!pImage->paHashBuckets))
+        {
+            pImage->cHashBuckets = 0;
+            return VERR_NO_MEMORY;
+        }
+        pImage->cHashBuckets = cHashBuckets;
+    }
+
+    memset(pImage->paHashBuckets, 0xff, cHashBuckets * sizeof(uint32_t));
+    pImage->idxPhysFree        = DDI_PHYS_NIL;
+    pImage->idxPhysFreePending = DDI_PHYS_NIL;
+
+    /* Walk backwards so that the free list hands out the lowest blocks first. */
+    for (uint32_t idxPhys = pImage->cPhysBlocks; idxPhys-- > 0;)
+    {
+        PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys];
+
+        if (pPhysBlock->cRefs)
+        {
+            pPhysBlock->fCommitted = true;
+            ddiHashInsert(pImage, idxPhys);
+        }
+        else
+            ddiPhysBlockFree(pImage, idxPhys);
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Loads the physical block table and verifies the reference counts against the block map.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ */
+static int ddiPhysTblLoad(PDDIIMAGE pImage)
+{
+    /*
+     * The header is only updated on flush, so the physical block count in it is stale
+     * if the image wasn't closed properly. Derive it from the size of the data area
+     * and the highest block referenced by the block map instead.
+     */
+    uint64_t cbFile = 0;
+    int rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    uint64_t cPhysBlocksFile = cbFile > pImage->offData
+                             ? (cbFile - pImage->offData + pImage->cbBlock - 1) / pImage->cbBlock
+                             : 0;
+    uint32_t cPhysBlocks = (uint32_t)RT_MIN(cPhysBlocksFile, (uint64_t)pImage->cBlocks);
+    for (uint32_t idxBlock = 0; idxBlock < pImage->cBlocks; idxBlock++)
+    {
+        uint32_t uEntry = pImage->paBlockMap[idxBlock];
+
+        if (DDI_BLOCK_IS_ALLOCATED(uEntry))
+        {
+            if (RT_UNLIKELY(uEntry > pImage->cBlocks))
+                return vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                                 N_("DDI: Block %u of image '%s' references an invalid physical block"),
+                                 idxBlock, pImage->pszFilename);
+            cPhysBlocks = RT_MAX(cPhysBlocks, uEntry);
+        }
+    }
+    pImage->cPhysBlocks = cPhysBlocks;
+
+    rc = ddiPhysBlocksEnsureSpace(pImage, RT_MAX(pImage->cPhysBlocks, 1));
+    if (RT_FAILURE(rc))
+        return rc;
+
+    PDdiPhysBlock paEntries = (PDdiPhysBlock)RTMemTmpAlloc(_64K * sizeof(DdiPhysBlock));
+    if (RT_UNLIKELY(!paEntries))
+        return VERR_NO_MEMORY;
+
+    for (uint32_t idxPhys = 0; idxPhys < pImage->cPhysBlocks && RT_SUCCESS(rc); idxPhys += _64K)
+    {
+        uint32_t cEntries = RT_MIN(pImage->cPhysBlocks - idxPhys, _64K);
+
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage,
+                                   pImage->offPhysTbl + (uint64_t)idxPhys * sizeof(DdiPhysBlock),
+                                   paEntries, cEntries * sizeof(DdiPhysBlock));
+        for (uint32_t i = 0; i < cEntries && RT_SUCCESS(rc); i++)
+        {
+            PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys + i];
+
+            memcpy(&pPhysBlock->abHash[0], &paEntries[i].abHash[0], sizeof(pPhysBlock->abHash));
+            pPhysBlock->cRefs            = 0;
+            pPhysBlock->idxNext          = DDI_PHYS_NIL;
+            pPhysBlock->fCommitted       = false;
+            pPhysBlock->fDataPending     = false;
+            pPhysBlock->idxBlockPending  = 0;
+            pPhysBlock->uEntryOldPending = DDI_BLOCK_FREE;
+        }
+    }
+
+    RTMemTmpFree(paEntries);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /* The block map is authoritative, count the references. */
+    for (uint32_t idxBlock = 0; idxBlock < pImage->cBlocks; idxBlock++)
+    {
+        uint32_t uEntry = pImage->paBlockMap[idxBlock];
+
+        if (DDI_BLOCK_IS_ALLOCATED(uEntry))
+            pImage->paPhysBlocks[uEntry - 1].cRefs++;
+    }
+
+    return ddiHashIndexBuild(pImage);
+}
+
+/**
+ * Writes the complete metadata (header, block map and physical block table) synchronously.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ */
+static int ddiFlushImage(PDDIIMAGE pImage)
+{
+    if (   !pImage->pStorage
+        || (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+        return VINF_SUCCESS;
+
+    PDdiHeader pHeader = (PDdiHeader)RTMemTmpAlloc(sizeof(DdiHeader));
+    if (RT_UNLIKELY(!pHeader))
+        return VERR_NO_MEMORY;
+
+    ddiHdrConvertFromHostEndianess(pImage, pHeader);
+    int rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, 0, pHeader, sizeof(DdiHeader));
+    RTMemTmpFree(pHeader);
+
+    if (RT_SUCCESS(rc))
+    {
+#ifdef RT_BIG_ENDIAN
+        for (uint32_t i = 0; i < pImage->cBlocks; i++)
+            pImage->paBlockMap[i] = RT_H2LE_U32(pImage->paBlockMap[i]);
+#endif
+        rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, pImage->offBlockMap,
+                                    pImage->paBlockMap, pImage->cBlocks * sizeof(uint32_t));
+#ifdef RT_BIG_ENDIAN
+        for (uint32_t i = 0; i < pImage->cBlocks; i++)
+            pImage->paBlockMap[i] = RT_LE2H_U32(pImage->paBlockMap[i]);
+#endif
+    }
+
+    if (RT_SUCCESS(rc) && pImage->cPhysBlocks)
+    {
+        PDdiPhysBlock paEntries = (PDdiPhysBlock)RTMemTmpAlloc(_64K * sizeof(DdiPhysBlock));
+        if (RT_LIKELY(paEntries))
+        {
+            for (uint32_t idxPhys = 0; idxPhys < pImage->cPhysBlocks && RT_SUCCESS(rc); idxPhys += _64K)
+            {
+                uint32_t cEntries = RT_MIN(pImage->cPhysBlocks - idxPhys, _64K);
+
+                for (uint32_t i = 0; i < cEntries; i++)
+                    ddiPhysBlockConvertFromHostEndianess(&pImage->paPhysBlocks[idxPhys + i], &paEntries[i]);
+                rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage,
+                                            pImage->offPhysTbl + (uint64_t)idxPhys * sizeof(DdiPhysBlock),
+                                            paEntries, cEntries * sizeof(DdiPhysBlock));
+            }
+            RTMemTmpFree(paEntries);
+        }
+        else
+            rc = VERR_NO_MEMORY;
+    }
+
+    if (RT_SUCCESS(rc))
+        rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+
+    if (RT_SUCCESS(rc))
+    {
+        /* Everything referencing the released blocks is on disk now, they can be reused. */
+        uint32_t idxPhysFreePending = pImage->idxPhysFreePending;
+        pImage->idxPhysFreePending = DDI_PHYS_NIL;
+        ddiPhysBlockFreeList(pImage, idxPhysFreePending, true /*fReuse*/);
+    }
+
+    return rc;
+}
+
+/**
+ * Sets up the region list of the image.
+ */
+static void ddiRegionListInit(PDDIIMAGE pImage)
+{
+    PVDREGIONDESC pRegion = &pImage->RegionList.aRegions[0];
+    pImage->RegionList.fFlags   = 0;
+    pImage->RegionList.cRegions = 1;
+
+    pRegion->offRegion            = 0; /* Disk start. */
+    pRegion->cbBlock              = 512;
+    pRegion->enmDataForm          = VDREGIONDATAFORM_RAW;
+    pRegion->enmMetadataForm      = VDREGIONMETADATAFORM_NONE;
+    pRegion->cbData               = 512;
+    pRegion->cbMetadata           = 0;
+    pRegion->cRegionBlocksOrBytes = pImage->cbSize;
+}
+
+/**
+ * Internal. Free all allocated space for representing an image except pImage,
+ * and optionally delete the image from disk.
+ */
+static int ddiFreeImage(PDDIIMAGE pImage, bool fDelete)
+{
+    int rc = VINF_SUCCESS;
+
+    /* Freeing a never allocated image (e.g. because the open failed) is
+     * not signalled as an error. After all nothing bad happens. */
+    if (pImage)
+    {
+        if (pImage->pStorage)
+        {
+            /* No point updating the file that is deleted anyway. */
+            if (!fDelete)
+                ddiFlushImage(pImage);
+
+            rc = vdIfIoIntFileClose(pImage->pIfIo, pImage->pStorage);
+            pImage->pStorage = NULL;
+        }
+
+        if (pImage->paBlockMap)
+        {
+            RTMemFree(pImage->paBlockMap);
+            pImage->paBlockMap = NULL;
+        }
+
+        if (pImage->paPhysBlocks)
+        {
+            RTMemFree(pImage->paPhysBlocks);
+            pImage->paPhysBlocks   = NULL;
+            pImage->cPhysBlocksMax = 0;
+        }
+
+        if (pImage->paHashBuckets)
+        {
+            RTMemFree(pImage->paHashBuckets);
+            pImage->paHashBuckets = NULL;
+            pImage->cHashBuckets  = 0;
+        }
+
+        if (pImage->pvBlock)
+        {
+            RTMemPageFree(pImage->pvBlock, pImage->cbBlock);
+            pImage->pvBlock = NULL;
+        }
+
+        if (pImage->pszParentFilename)
+        {
+            RTStrFree(pImage->pszParentFilename);
+            pImage->pszParentFilename = NULL;
+        }
+
+        if (fDelete && pImage->pszFilename)
+            vdIfIoIntFileDelete(pImage->pIfIo, pImage->pszFilename);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Internal: Open an image, constructing all necessary data structures.
+ */
+static int ddiOpenImage(PDDIIMAGE pImage, unsigned uOpenFlags)
+{
+    pImage->uOpenFlags = uOpenFlags;
+
+    pImage->pIfError = VDIfErrorGet(pImage->pVDIfsDisk);
+    pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
+    AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
+
+    /* Open the image. */
+    int rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename,
+                               VDOpenFlagsToFileOpenFlags(uOpenFlags,
+                                                          false /* fCreate */),
+                               &pImage->pStorage);
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t cbFile;
+        rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+        if (   RT_SUCCESS(rc)
+            && cbFile >= sizeof(DdiHeader))
+        {
+            PDdiHeader pHeader = (PDdiHeader)RTMemTmpAlloc(sizeof(DdiHeader));
+            if (RT_LIKELY(pHeader))
+            {
+                rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, 0, pHeader, sizeof(DdiHeader));
+                if (   RT_SUCCESS(rc)
+                    && ddiHdrConvertToHostEndianess(pHeader))
+                {
+                    pImage->uImageFlags             = (pHeader->fFlags & DDI_HDR_F_DIFF) ? VD_IMAGE_FLAGS_DIFF : VD_IMAGE_FLAGS_NONE;
+                    pImage->cbSize                  = pHeader->cbSize;
+                    pImage->cbBlock                 = pHeader->cbBlock;
+                    pImage->cBlocks                 = pHeader->cBlocks;
+                    pImage->cPhysBlocks             = pHeader->cPhysBlocks;
+                    pImage->offBlockMap             = pHeader->offBlockMap;
+                    pImage->offPhysTbl              = pHeader->offPhysTbl;
+                    pImage->offData                 = pHeader->offData;
+                    pImage->UuidCreate              = pHeader->UuidCreate;
+                    pImage->UuidModify              = pHeader->UuidModify;
+                    pImage->UuidParent              = pHeader->UuidParent;
+                    pImage->UuidParentModify        = pHeader->UuidParentModify;
+                    pImage->PCHSGeometry.cCylinders = pHeader->aPCHSGeometry[0];
+                    pImage->PCHSGeometry.cHeads     = pHeader->aPCHSGeometry[1];
+                    pImage->PCHSGeometry.cSectors   = pHeader->aPCHSGeometry[2];
+                    pImage->LCHSGeometry.cCylinders = pHeader->aLCHSGeometry[0];
+                    pImage->LCHSGeometry.cHeads     = pHeader->aLCHSGeometry[1];
+                    pImage->LCHSGeometry.cSectors   = pHeader->aLCHSGeometry[2];
+
+                    if (pHeader->cbParentFilename)
+                    {
+                        pImage->pszParentFilename = RTStrDupN(&pHeader->achParentFilename[0], pHeader->cbParentFilename);
+                        if (pImage->pszParentFilename)
+                            rc = RTStrValidateEncoding(pImage->pszParentFilename);
+                        else
+                            rc = VERR_NO_STR_MEMORY;
+                    }
+                }
+                else if (RT_SUCCESS(rc))
+                    rc = VERR_VD_GEN_INVALID_HEADER;
+
+                RTMemTmpFree(pHeader);
+            }
+            else
+                rc = VERR_NO_MEMORY;
+
+            if (RT_SUCCESS(rc))
+            {
+                pImage->pvBlock    = RTMemPageAlloc(pImage->cbBlock);
+                pImage->paBlockMap = (uint32_t *)RTMemAlloc(pImage->cBlocks * sizeof(uint32_t));
+                if (   pImage->pvBlock
+                    && pImage->paBlockMap)
+                {
+                    rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, pImage->offBlockMap,
+                                               pImage->paBlockMap, pImage->cBlocks * sizeof(uint32_t));
+                    if (RT_SUCCESS(rc))
+                    {
+#ifdef RT_BIG_ENDIAN
+                        for (uint32_t i = 0; i < pImage->cBlocks; i++)
+                            pImage->paBlockMap[i] = RT_LE2H_U32(pImage->paBlockMap[i]);
+#endif
+                        rc = ddiPhysTblLoad(pImage);
+                        if (RT_FAILURE(rc))
+                            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                                           N_("DDI: Loading the physical block table of image '%s' failed"),
+                                           pImage->pszFilename);
+                    }
+                    else
+                        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                                       N_("DDI: Reading the block map of image '%s' failed"),
+                                       pImage->pszFilename);
+                }
+                else
+                    rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
+                                   N_("DDI: Out of memory allocating the block map of image '%s'"),
+                                   pImage->pszFilename);
+            }
+        }
+        else if (RT_SUCCESS(rc))
+            rc = VERR_VD_GEN_INVALID_HEADER;
+    }
+    /* else: Do NOT signal an appropriate error here, as the VD layer has the
+     *       choice of retrying the open if it failed. */
+
+    if (RT_SUCCESS(rc))
+        ddiRegionListInit(pImage);
+    else
+        ddiFreeImage(pImage, false);
+    return rc;
+}
+
+/**
+ * Internal: Create a DDI image.
+ */
+static int ddiCreateImage(PDDIIMAGE pImage, uint64_t cbSize,
+                          unsigned uImageFlags, const char *pszComment,
+                          PCVDGEOMETRY pPCHSGeometry,
+                          PCVDGEOMETRY pLCHSGeometry, PCRTUUID pUuid, unsigned uOpenFlags,
+                          PVDINTERFACEPROGRESS pIfProgress,
+                          unsigned uPercentStart, unsigned uPercentSpan)
+{
+    RT_NOREF1(pszComment);
+    int rc;
+
+    pImage->pIfError = VDIfErrorGet(pImage->pVDIfsDisk);
+    pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
+    AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
+
+    if (uImageFlags & VD_IMAGE_FLAGS_FIXED)
+        return vdIfError(pImage->pIfError, VERR_VD_INVALID_TYPE, RT_SRC_POS, N_("DDI: cannot create fixed image '%s'"),
+                         pImage->pszFilename);
+    if ((cbSize + DDI_BLOCK_SIZE_DEFAULT - 1) / DDI_BLOCK_SIZE_DEFAULT >= DDI_BLOCK_ZERO)
+        return vdIfError(pImage->pIfError, VERR_VD_INVALID_SIZE, RT_SRC_POS, N_("DDI: the size of image '%s' is too big"),
+                         pImage->pszFilename);
+
+    pImage->uOpenFlags   = uOpenFlags & ~VD_OPEN_FLAGS_READONLY;
+    pImage->uImageFlags  = uImageFlags;
+    pImage->PCHSGeometry = *pPCHSGeometry;
+    pImage->LCHSGeometry = *pLCHSGeometry;
+    pImage->UuidCreate   = *pUuid;
+    RTUuidClear(&pImage->UuidModify);
+    RTUuidClear(&pImage->UuidParent);
+    RTUuidClear(&pImage->UuidParentModify);
+
+    /* Create image file. */
+    uint32_t fOpen = VDOpenFlagsToFileOpenFlags(pImage->uOpenFlags, true /* fCreate */);
+    rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename, fOpen, &pImage->pStorage);
+    if (RT_SUCCESS(rc))
+    {
+        /* Init image state. */
+        pImage->cbSize      = cbSize;
+        pImage->cbBlock     = DDI_BLOCK_SIZE_DEFAULT;
+        pImage->cBlocks     = (uint32_t)((cbSize + pImage->cbBlock - 1) / pImage->cbBlock);
+        pImage->cPhysBlocks = 0;
+        pImage->offBlockMap = sizeof(DdiHeader);
+        pImage->offPhysTbl  = RT_ALIGN_64(pImage->offBlockMap + (uint64_t)pImage->cBlocks * sizeof(uint32_t), _4K);
+        /* Align the data area to the block size so the blocks line up with the host pages. */
+        pImage->offData     = RT_ALIGN_64(pImage->offPhysTbl + (uint64_t)pImage->cBlocks * sizeof(DdiPhysBlock),
+                                          pImage->cbBlock);
+        pImage->idxPhysFree        = DDI_PHYS_NIL;
+        pImage->idxPhysFreePending = DDI_PHYS_NIL;
+
+        pImage->pvBlock    = RTMemPageAlloc(pImage->cbBlock);
+        pImage->paBlockMap = (uint32_t *)RTMemAllocZ(RT_MAX(pImage->cBlocks, 1) * sizeof(uint32_t));
+        if (   pImage->pvBlock
+            && pImage->paBlockMap)
+        {
+            rc = ddiPhysBlocksEnsureSpace(pImage, 1);
+            if (RT_SUCCESS(rc))
+                rc = ddiHashIndexBuild(pImage);
+            if (RT_SUCCESS(rc))
+            {
+                vdIfProgress(pIfProgress, uPercentStart + uPercentSpan * 98 / 100);
+
+                rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, pImage->offData);
+                if (RT_SUCCESS(rc))
+                    rc = ddiFlushImage(pImage);
+                if (RT_FAILURE(rc))
+                    rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("DDI: cannot write metadata of image '%s'"),
+                                   pImage->pszFilename);
+            }
+            else
+                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("DDI: cannot allocate memory for the hash index of image '%s'"),
+                               pImage->pszFilename);
+        }
+        else
+            rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS, N_("DDI: cannot allocate memory for the block map of image '%s'"),
+                           pImage->pszFilename);
+    }
+    else
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("DDI: cannot create image '%s'"), pImage->pszFilename);
+
+    if (RT_SUCCESS(rc))
+    {
+        ddiRegionListInit(pImage);
+        vdIfProgress(pIfProgress, uPercentStart + uPercentSpan);
+    }
+    else
+        ddiFreeImage(pImage, rc != VERR_ALREADY_EXISTS);
+
+    return rc;
+}
+
+
+/** @copydoc VDIMAGEBACKEND::pfnProbe */
+static DECLCALLBACK(int) ddiProbe(const char *pszFilename, PVDINTERFACE pVDIfsDisk,
+                                  PVDINTERFACE pVDIfsImage, VDTYPE enmDesiredType, VDTYPE *penmType)
+{
+    RT_NOREF(pVDIfsDisk, enmDesiredType);
+    LogFlowFunc(("pszFilename=\"%s\" pVDIfsDisk=%#p pVDIfsImage=%#p\n", pszFilename, pVDIfsDisk, pVDIfsImage));
+    PVDIOSTORAGE pStorage = NULL;
+    int rc = VINF_SUCCESS;
+
+    /* Get I/O interface. */
+    PVDINTERFACEIOINT pIfIo = VDIfIoIntGet(pVDIfsImage);
+    AssertPtrReturn(pIfIo, VERR_INVALID_PARAMETER);
+    AssertReturn((VALID_PTR(pszFilename) && *pszFilename), VERR_INVALID_PARAMETER);
+
+    /*
+     * Open the file and read the header.
+     */
+    rc = vdIfIoIntFileOpen(pIfIo, pszFilename,
+                           VDOpenFlagsToFileOpenFlags(VD_OPEN_FLAGS_READONLY,
+                                                      false /* fCreate */),
+                           &pStorage);
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t cbFile;
+
+        rc = vdIfIoIntFileGetSize(pIfIo, pStorage, &cbFile);
+        if (   RT_SUCCESS(rc)
+            && cbFile >= sizeof(DdiHeader))
+        {
+            PDdiHeader pHeader = (PDdiHeader)RTMemTmpAlloc(sizeof(DdiHeader));
+            if (RT_LIKELY(pHeader))
+            {
+                rc = vdIfIoIntFileReadSync(pIfIo, pStorage, 0, pHeader, sizeof(DdiHeader));
+                if (   RT_SUCCESS(rc)
+                    && ddiHdrConvertToHostEndianess(pHeader))
+                    *penmType = VDTYPE_HDD;
+                else
+                    rc = VERR_VD_GEN_INVALID_HEADER;
+                RTMemTmpFree(pHeader);
+            }
+            else
+                rc = VERR_NO_MEMORY;
+        }
+        else
+            rc = VERR_VD_GEN_INVALID_HEADER;
+    }
+
+    if (pStorage)
+        vdIfIoIntFileClose(pIfIo, pStorage);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnOpen */
+static DECLCALLBACK(int) ddiOpen(const char *pszFilename, unsigned uOpenFlags,
+                                 PVDINTERFACE pVDIfsDisk, PVDINTERFACE pVDIfsImage,
+                                 VDTYPE enmType, void **ppBackendData)
+{
+    RT_NOREF1(enmType); /**< @todo r=klaus make use of the type info. */
+
+    LogFlowFunc(("pszFilename=\"%s\" uOpenFlags=%#x pVDIfsDisk=%#p pVDIfsImage=%#p enmType=%u ppBackendData=%#p\n",
+                 pszFilename, uOpenFlags, pVDIfsDisk, pVDIfsImage, enmType, ppBackendData));
+    int rc;
+
+    /* Check open flags. All valid flags are supported. */
+    AssertReturn(!(uOpenFlags & ~VD_OPEN_FLAGS_MASK), VERR_INVALID_PARAMETER);
+    AssertReturn((VALID_PTR(pszFilename) && *pszFilename), VERR_INVALID_PARAMETER);
+
+    PDDIIMAGE pImage = (PDDIIMAGE)RTMemAllocZ(RT_UOFFSETOF(DDIIMAGE, RegionList.aRegions[1]));
+    if (RT_LIKELY(pImage))
+    {
+        pImage->pszFilename = pszFilename;
+        pImage->pStorage = NULL;
+        pImage->pVDIfsDisk = pVDIfsDisk;
+        pImage->pVDIfsImage = pVDIfsImage;
+
+        rc = ddiOpenImage(pImage, uOpenFlags);
+        if (RT_SUCCESS(rc))
+            *ppBackendData = pImage;
+        else
+            RTMemFree(pImage);
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    LogFlowFunc(("returns %Rrc (pBackendData=%#p)\n", rc, *ppBackendData));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnCreate */
+static DECLCALLBACK(int) ddiCreate(const char *pszFilename, uint64_t cbSize,
+                                   unsigned uImageFlags, const char *pszComment,
+                                   PCVDGEOMETRY pPCHSGeometry, PCVDGEOMETRY pLCHSGeometry,
+                                   PCRTUUID pUuid, unsigned uOpenFlags,
+                                   unsigned uPercentStart, unsigned uPercentSpan,
+                                   PVDINTERFACE pVDIfsDisk, PVDINTERFACE pVDIfsImage,
+                                   PVDINTERFACE pVDIfsOperation, VDTYPE enmType,
+                                   void **ppBackendData)
+{
+    LogFlowFunc(("pszFilename=\"%s\" cbSize=%llu uImageFlags=%#x pszComment=\"%s\" pPCHSGeometry=%#p pLCHSGeometry=%#p Uuid=%RTuuid uOpenFlags=%#x uPercentStart=%u uPercentSpan=%u pVDIfsDisk=%#p pVDIfsImage=%#p pVDIfsOperation=%#p enmType=%d ppBackendData=%#p",
+                 pszFilename, cbSize, uImageFlags, pszComment, pPCHSGeometry, pLCHSGeometry, pUuid, uOpenFlags, uPercentStart, uPercentSpan, pVDIfsDisk, pVDIfsImage, pVDIfsOperation, enmType, ppBackendData));
+    int rc;
+
+    /* Check the VD container type. */
+    if (enmType != VDTYPE_HDD)
+        return VERR_VD_INVALID_TYPE;
+
+    /* Check open flags. All valid flags are supported. */
+    AssertReturn(!(uOpenFlags & ~VD_OPEN_FLAGS_MASK), VERR_INVALID_PARAMETER);
+    AssertReturn(   VALID_PTR(pszFilename)
+                 && *pszFilename
+                 && VALID_PTR(pPCHSGeometry)
+                 && VALID_PTR(pLCHSGeometry)
+                 && VALID_PTR(pUuid), VERR_INVALID_PARAMETER);
+
+    PDDIIMAGE pImage = (PDDIIMAGE)RTMemAllocZ(RT_UOFFSETOF(DDIIMAGE, RegionList.aRegions[1]));
+    if (RT_LIKELY(pImage))
+    {
+        PVDINTERFACEPROGRESS pIfProgress = VDIfProgressGet(pVDIfsOperation);
+
+        pImage->pszFilename = pszFilename;
+        pImage->pStorage = NULL;
+        pImage->pVDIfsDisk = pVDIfsDisk;
+        pImage->pVDIfsImage = pVDIfsImage;
+
+        rc = ddiCreateImage(pImage, cbSize, uImageFlags, pszComment,
+                            pPCHSGeometry, pLCHSGeometry, pUuid, uOpenFlags,
+                            pIfProgress, uPercentStart, uPercentSpan);
+        if (RT_SUCCESS(rc))
+        {
+            /* So far the image is opened in read/write mode. Make sure the
+             * image is opened in read-only mode if the caller requested that. */
+            if (uOpenFlags & VD_OPEN_FLAGS_READONLY)
+            {
+                ddiFreeImage(pImage, false);
+                rc = ddiOpenImage(pImage, uOpenFlags);
+            }
+
+            if (RT_SUCCESS(rc))
+                *ppBackendData = pImage;
+        }
+
+        if (RT_FAILURE(rc))
+            RTMemFree(pImage);
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    LogFlowFunc(("returns %Rrc (pBackendData=%#p)\n", rc, *ppBackendData));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnRename */
+static DECLCALLBACK(int) ddiRename(void *pBackendData, const char *pszFilename)
+{
+    LogFlowFunc(("pBackendData=%#p pszFilename=%#p\n", pBackendData, pszFilename));
+    int rc = VINF_SUCCESS;
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+
+    /* Check arguments. */
+    AssertReturn((pImage && pszFilename && *pszFilename), VERR_INVALID_PARAMETER);
+
+    /* Close the image. */
+    rc = ddiFreeImage(pImage, false);
+    if (RT_SUCCESS(rc))
+    {
+        /* Rename the file. */
+        rc = vdIfIoIntFileMove(pImage->pIfIo, pImage->pszFilename, pszFilename, 0);
+        if (RT_SUCCESS(rc))
+        {
+            /* Update pImage with the new information. */
+            pImage->pszFilename = pszFilename;
+
+            /* Open the old image with new name. */
+            rc = ddiOpenImage(pImage, pImage->uOpenFlags);
+        }
+        else
+        {
+            /* The move failed, try to reopen the original image. */
+            int rc2 = ddiOpenImage(pImage, pImage->uOpenFlags);
+            if (RT_FAILURE(rc2))
+                rc = rc2;
+        }
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnClose */
+static DECLCALLBACK(int) ddiClose(void *pBackendData, bool fDelete)
+{
+    LogFlowFunc(("pBackendData=%#p fDelete=%d\n", pBackendData, fDelete));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+
+    int rc = ddiFreeImage(pImage, fDelete);
+    RTMemFree(pImage);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnRead */
+static DECLCALLBACK(int) ddiRead(void *pBackendData, uint64_t uOffset, size_t cbToRead,
+                                 PVDIOCTX pIoCtx, size_t *pcbActuallyRead)
+{
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu pIoCtx=%#p cbToRead=%zu pcbActuallyRead=%#p\n",
+                 pBackendData, uOffset, pIoCtx, cbToRead, pcbActuallyRead));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pImage);
+    Assert(uOffset % 512 == 0);
+    Assert(cbToRead % 512 == 0);
+    AssertReturn((VALID_PTR(pIoCtx) && cbToRead), VERR_INVALID_PARAMETER);
+    AssertReturn(uOffset + cbToRead <= pImage->cbSize, VERR_INVALID_PARAMETER);
+
+    uint32_t idxBlock = (uint32_t)(uOffset / pImage->cbBlock);
+    uint32_t offBlock = (uint32_t)(uOffset % pImage->cbBlock);
+
+    /* Clip read size to remain in the block. */
+    cbToRead = RT_MIN(cbToRead, pImage->cbBlock - offBlock);
+
+    uint32_t uEntry = pImage->paBlockMap[idxBlock];
+    if (uEntry == DDI_BLOCK_FREE)
+        rc = VERR_VD_BLOCK_FREE;
+    else if (uEntry == DDI_BLOCK_ZERO)
+        vdIfIoIntIoCtxSet(pImage->pIfIo, pIoCtx, 0, cbToRead);
+    else
+        rc = vdIfIoIntFileReadUser(pImage->pIfIo, pImage->pStorage,
+                                   pImage->offData + (uint64_t)(uEntry - 1) * pImage->cbBlock + offBlock,
+                                   pIoCtx, cbToRead);
+
+    if (   (   RT_SUCCESS(rc)
+            || rc == VERR_VD_BLOCK_FREE
+            || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+        && pcbActuallyRead)
+        *pcbActuallyRead = cbToRead;
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnWrite */
+static DECLCALLBACK(int) ddiWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
+                                  PVDIOCTX pIoCtx, size_t *pcbWriteProcess, size_t *pcbPreRead,
+                                  size_t *pcbPostRead, unsigned fWrite)
+{
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu pIoCtx=%#p cbToWrite=%zu pcbWriteProcess=%#p pcbPreRead=%#p pcbPostRead=%#p\n",
+                 pBackendData, uOffset, pIoCtx, cbToWrite, pcbWriteProcess, pcbPreRead, pcbPostRead));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pImage);
+    Assert(!(uOffset % 512));
+    Assert(!(cbToWrite % 512));
+    AssertReturn((VALID_PTR(pIoCtx) && cbToWrite), VERR_INVALID_PARAMETER);
+    AssertReturn(uOffset + cbToWrite <= pImage->cbSize, VERR_INVALID_PARAMETER);
+
+    if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        return VERR_VD_IMAGE_READ_ONLY;
+
+    uint32_t idxBlock = (uint32_t)(uOffset / pImage->cbBlock);
+    uint32_t offBlock = (uint32_t)(uOffset % pImage->cbBlock);
+    uint32_t cbBlock  = ddiBlockGetSize(pImage, idxBlock);
+    uint32_t uEntryOld = pImage->paBlockMap[idxBlock];
+
+    /* Clip write size to remain in the block. */
+    cbToWrite = RT_MIN(cbToWrite, cbBlock - offBlock);
+
+    if (   cbToWrite < cbBlock
+        || (   uEntryOld == DDI_BLOCK_FREE
+            && (fWrite & VD_WRITE_NO_ALLOC)))
+    {
+        /*
+         * Blocks are never updated in place because they might be shared,
+         * let the upper layer supply the complete block.
+         */
+        *pcbPreRead  = offBlock;
+        *pcbPostRead = cbBlock - cbToWrite - offBlock;
+        *pcbWriteProcess = cbToWrite;
+        LogFlowFunc(("returns %Rrc\n", VERR_VD_BLOCK_FREE));
+        return VERR_VD_BLOCK_FREE;
+    }
+
+    *pcbPreRead  = 0;
+    *pcbPostRead = 0;
+
+    /* This accounts for the complete transfer, the data is written from the scratch buffer. */
+    vdIfIoIntIoCtxCopyFrom(pImage->pIfIo, pIoCtx, pImage->pvBlock, cbBlock);
+    if (cbBlock < pImage->cbBlock)
+        memset((uint8_t *)pImage->pvBlock + cbBlock, 0, pImage->cbBlock - cbBlock);
+
+    /*
+     * The entry on disk is replaced once the new one is written. If the previous write to
+     * the block is still waiting for its data, the entry on disk is the one before that.
+     * Take over releasing it, the pending block was never referenced on disk.
+     */
+    uint32_t uEntryOldDisk = uEntryOld;
+    if (   DDI_BLOCK_IS_ALLOCATED(uEntryOld)
+        && !pImage->paPhysBlocks[uEntryOld - 1].fCommitted)
+    {
+        PDDIPHYSBLOCK pPhysBlockOld = &pImage->paPhysBlocks[uEntryOld - 1];
+
+        Assert(pPhysBlockOld->idxBlockPending == idxBlock);
+        uEntryOldDisk = pPhysBlockOld->uEntryOldPending;
+        pPhysBlockOld->uEntryOldPending = DDI_BLOCK_FREE;
+    }
+
+    uint32_t uEntryNew;
+    bool fLinkDeferred = false;
+    if (   !(pImage->uOpenFlags & VD_OPEN_FLAGS_HONOR_ZEROES)
+        && ASMMemIsZero(pImage->pvBlock, cbBlock))
+        uEntryNew = DDI_BLOCK_ZERO;
+    else
+    {
+        uint8_t abHash[RTSHA256_HASH_SIZE];
+        RTSha256(pImage->pvBlock, cbBlock, abHash);
+
+        uint32_t idxPhys = ddiHashLookup(pImage, abHash);
+        if (idxPhys != DDI_PHYS_NIL)
+        {
+            /* Same data is already in the image, just link to it. */
+            pImage->paPhysBlocks[idxPhys].cRefs++;
+            pImage->cDedupHits++;
+            rc = ddiPhysBlockWrite(pImage, pIoCtx, idxPhys);
+        }
+        else
+        {
+            rc = ddiPhysBlockAlloc(pImage, &idxPhys);
+            if (RT_SUCCESS(rc))
+            {
+                PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys];
+
+                memcpy(&pPhysBlock->abHash[0], &abHash[0], sizeof(abHash));
+                pPhysBlock->cRefs            = 1;
+                pPhysBlock->idxBlockPending  = idxBlock;
+                pPhysBlock->uEntryOldPending = uEntryOldDisk;
+                pImage->cDedupMisses++;
+                fLinkDeferred = true;
+
+                rc = ddiPhysBlockWrite(pImage, pIoCtx, idxPhys);
+                if (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+                {
+                    /*
+                     * The block is added to the hash index and the block map entry is written
+                     * only after the data is on disk, otherwise a concurrent write could link
+                     * to data which isn't there yet and a crash could leave the block map
+                     * pointing to garbage.
+                     */
+                    pPhysBlock->fDataPending     = true;
+                    pImage->paBlockMap[idxBlock] = idxPhys + 1;
+                    int rc2 = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage,
+                                                     pImage->offData + (uint64_t)idxPhys * pImage->cbBlock,
+                                                     pImage->pvBlock, pImage->cbBlock, pIoCtx,
+                                                     ddiPhysBlockCommitted, (void *)(uintptr_t)idxPhys);
+                    if (rc2 != VERR_VD_ASYNC_IO_IN_PROGRESS)
+                        ddiPhysBlockCommitted(pImage, pIoCtx, (void *)(uintptr_t)idxPhys, rc2);
+                    if (rc2 != VINF_SUCCESS)
+                        rc = rc2;
+                }
+            }
+        }
+
+        uEntryNew = idxPhys + 1;
+    }
+
+    if (   (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+        && uEntryOld != uEntryOldDisk)
+    {
+        /* Drop the pending block of the previous write, it's freed once its data write completes. */
+        int rc2 = ddiPhysBlockRelease(pImage, pIoCtx, uEntryOld - 1);
+        if (rc2 != VINF_SUCCESS)
+            rc = rc2;
+    }
+
+    if (   (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+        && !fLinkDeferred)
+    {
+        /* The old block is released after the new entry is on disk, it might be the same one the block was linked to. */
+        pImage->paBlockMap[idxBlock] = uEntryNew;
+
+        int rc2 = ddiBlockMapUpdate(pImage, pIoCtx, idxBlock, uEntryOldDisk);
+        if (rc2 != VINF_SUCCESS)
+            rc = rc2;
+    }
+
+    if (pcbWriteProcess)
+        *pcbWriteProcess = cbToWrite;
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Flush completion callback, makes the blocks released before the flush available for reuse.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   pBackendData    The image instance data.
+ * @param   pIoCtx          The I/O context.
+ * @param   pvUser          Head of the deferred free list detached when issuing the flush.
+ * @param   rcReq           Status of the flush.
+ */
+static DECLCALLBACK(int) ddiFlushCompleted(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    RT_NOREF1(pIoCtx);
+
+    /* On failure the blocks go back to the deferred list and wait for the next flush. */
+    ddiPhysBlockFreeList(pImage, (uint32_t)(uintptr_t)pvUser, RT_SUCCESS(rcReq));
+    return VINF_SUCCESS;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnFlush */
+static DECLCALLBACK(int) ddiFlush(void *pBackendData, PVDIOCTX pIoCtx)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pImage);
+    AssertPtrReturn(pIoCtx, VERR_INVALID_PARAMETER);
+
+    if (   pImage->pStorage
+        && !(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+    {
+        /* The block map and physical block table are written as they change, only the header is left. */
+        PDdiHeader pHeader = (PDdiHeader)RTMemTmpAlloc(sizeof(DdiHeader));
+        if (RT_LIKELY(pHeader))
+        {
+            ddiHdrConvertFromHostEndianess(pImage, pHeader);
+            rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage,
+                                        0, pHeader, sizeof(DdiHeader),
+                                        pIoCtx, NULL, NULL);
+            RTMemTmpFree(pHeader);
+            if (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            {
+                /*
+                 * Blocks released so far are referenced from the old block map entries until
+                 * the updates overwriting them are on disk, only reuse them once this flush is done.
+                 */
+                uint32_t idxPhysFreePending = pImage->idxPhysFreePending;
+                pImage->idxPhysFreePending = DDI_PHYS_NIL;
+
+                rc = vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage, pIoCtx,
+                                        ddiFlushCompleted, (void *)(uintptr_t)idxPhysFreePending);
+                if (rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+                    ddiFlushCompleted(pImage, pIoCtx, (void *)(uintptr_t)idxPhysFreePending, rc);
+            }
+        }
+        else
+            rc = VERR_NO_MEMORY;
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetVersion */
+static DECLCALLBACK(unsigned) ddiGetVersion(void *pBackendData)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+
+    AssertPtrReturn(pImage, 0);
+
+    return DDI_VERSION;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetFileSize */
+static DECLCALLBACK(uint64_t) ddiGetFileSize(void *pBackendData)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    uint64_t cb = 0;
+
+    AssertPtrReturn(pImage, 0);
+
+    uint64_t cbFile;
+    if (pImage->pStorage)
+    {
+        int rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+        if (RT_SUCCESS(rc))
+            cb += cbFile;
+    }
+
+    LogFlowFunc(("returns %lld\n", cb));
+    return cb;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetPCHSGeometry */
+static DECLCALLBACK(int) ddiGetPCHSGeometry(void *pBackendData,
+                                            PVDGEOMETRY pPCHSGeometry)
+{
+    LogFlowFunc(("pBackendData=%#p pPCHSGeometry=%#p\n", pBackendData, pPCHSGeometry));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtrReturn(pImage, VERR_VD_NOT_OPENED);
+
+    if (pImage->PCHSGeometry.cCylinders)
+        *pPCHSGeometry = pImage->PCHSGeometry;
+    else
+        rc = VERR_VD_GEOMETRY_NOT_SET;
+
+    LogFlowFunc(("returns %Rrc (PCHS=%u/%u/%u)\n", rc, pPCHSGeometry->cCylinders, pPCHSGeometry->cHeads, pPCHSGeometry->cSectors));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnSetPCHSGeometry */
+static DECLCALLBACK(int) ddiSetPCHSGeometry(void *pBackendData,
+                                            PCVDGEOMETRY pPCHSGeometry)
+{
+    LogFlowFunc(("pBackendData=%#p pPCHSGeometry=%#p PCHS=%u/%u/%u\n",
+                 pBackendData, pPCHSGeometry, pPCHSGeometry->cCylinders, pPCHSGeometry->cHeads, pPCHSGeometry->cSectors));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtrReturn(pImage, VERR_VD_NOT_OPENED);
+
+    if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        rc = VERR_VD_IMAGE_READ_ONLY;
+    else
+        pImage->PCHSGeometry = *pPCHSGeometry;
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetLCHSGeometry */
+static DECLCALLBACK(int) ddiGetLCHSGeometry(void *pBackendData, PVDGEOMETRY pLCHSGeometry)
+{
+    LogFlowFunc(("pBackendData=%#p pLCHSGeometry=%#p\n", pBackendData, pLCHSGeometry));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtrReturn(pImage, VERR_VD_NOT_OPENED);
+
+    if (pImage->LCHSGeometry.cCylinders)
+        *pLCHSGeometry = pImage->LCHSGeometry;
+    else
+        rc = VERR_VD_GEOMETRY_NOT_SET;
+
+    LogFlowFunc(("returns %Rrc (LCHS=%u/%u/%u)\n", rc, pLCHSGeometry->cCylinders,
+                 pLCHSGeometry->cHeads, pLCHSGeometry->cSectors));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnSetLCHSGeometry */
+static DECLCALLBACK(int) ddiSetLCHSGeometry(void *pBackendData, PCVDGEOMETRY pLCHSGeometry)
+{
+    LogFlowFunc(("pBackendData=%#p pLCHSGeometry=%#p LCHS=%u/%u/%u\n", pBackendData,
+                 pLCHSGeometry, pLCHSGeometry->cCylinders, pLCHSGeometry->cHeads, pLCHSGeometry->cSectors));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtrReturn(pImage, VERR_VD_NOT_OPENED);
+
+    if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        rc = VERR_VD_IMAGE_READ_ONLY;
+    else
+        pImage->LCHSGeometry = *pLCHSGeometry;
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnQueryRegions */
+static DECLCALLBACK(int) ddiQueryRegions(void *pBackendData, PCVDREGIONLIST *ppRegionList)
+{
+    LogFlowFunc(("pBackendData=%#p ppRegionList=%#p\n", pBackendData, ppRegionList));
+    PDDIIMAGE pThis = (PDDIIMAGE)pBackendData;
+
+    AssertPtrReturn(pThis, VERR_VD_NOT_OPENED);
+
+    *ppRegionList = &pThis->RegionList;
+    LogFlowFunc(("returns %Rrc\n", VINF_SUCCESS));
+    return VINF_SUCCESS;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnRegionListRelease */
+static DECLCALLBACK(void) ddiRegionListRelease(void *pBackendData, PCVDREGIONLIST pRegionList)
+{
+    RT_NOREF1(pRegionList);
+    LogFlowFunc(("pBackendData=%#p pRegionList=%#p\n", pBackendData, pRegionList));
+    PDDIIMAGE pThis = (PDDIIMAGE)pBackendData;
+    AssertPtr(pThis); RT_NOREF(pThis);
+
+    /* Nothing to do here. */
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetImageFlags */
+static DECLCALLBACK(unsigned) ddiGetImageFlags(void *pBackendData)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+
+    AssertPtrReturn(pImage, 0);
+
+    LogFlowFunc(("returns %#x\n", pImage->uImageFlags));
+    return pImage->uImageFlags;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetOpenFlags */
+static DECLCALLBACK(unsigned) ddiGetOpenFlags(void *pBackendData)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+
+    AssertPtrReturn(pImage, 0);
+
+    LogFlowFunc(("returns %#x\n", pImage->uOpenFlags));
+    return pImage->uOpenFlags;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnSetOpenFlags */
+static DECLCALLBACK(int) ddiSetOpenFlags(void *pBackendData, unsigned uOpenFlags)
+{
+    LogFlowFunc(("pBackendData=%#p\n uOpenFlags=%#x", pBackendData, uOpenFlags));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    /* Image must be opened and the new flags must be valid. */
+    if (!pImage || (uOpenFlags & ~(  VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_INFO
+                                   | VD_OPEN_FLAGS_ASYNC_IO | VD_OPEN_FLAGS_SHAREABLE
+                                   | VD_OPEN_FLAGS_SEQUENTIAL | VD_OPEN_FLAGS_SKIP_CONSISTENCY_CHECKS)))
+        rc = VERR_INVALID_PARAMETER;
+    else
+    {
+        /* Implement this operation via reopening the image. */
+        rc = ddiFreeImage(pImage, false);
+        if (RT_SUCCESS(rc))
+            rc = ddiOpenImage(pImage, uOpenFlags);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetComment */
+VD_BACKEND_CALLBACK_GET_COMMENT_DEF_NOT_SUPPORTED(ddiGetComment);
+
+/** @copydoc VDIMAGEBACKEND::pfnSetComment */
+VD_BACKEND_CALLBACK_SET_COMMENT_DEF_NOT_SUPPORTED(ddiSetComment, PDDIIMAGE);
+
+/**
+ * Internal: Returns one of the UUIDs of the image.
+ */
+static int ddiUuidGet(PDDIIMAGE pImage, PCRTUUID pUuidImage, PRTUUID pUuid)
+{
+    AssertPtrReturn(pImage, VERR_VD_NOT_OPENED);
+
+    *pUuid = *pUuidImage;
+
+    LogFlowFunc(("returns %Rrc (%RTuuid)\n", VINF_SUCCESS, pUuid));
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: Updates one of the UUIDs of the image, the header is written on the next flush.
+ */
+static int ddiUuidSet(PDDIIMAGE pImage, PRTUUID pUuidImage, PCRTUUID pUuid)
+{
+    AssertPtrReturn(pImage, VERR_VD_NOT_OPENED);
+
+    int rc = VINF_SUCCESS;
+    if (!(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+        *pUuidImage = *pUuid;
+    else
+        rc = VERR_VD_IMAGE_READ_ONLY;
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetUuid */
+static DECLCALLBACK(int) ddiGetUuid(void *pBackendData, PRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p pUuid=%#p\n", pBackendData, pUuid));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    return ddiUuidGet(pImage, pImage ? &pImage->UuidCreate : NULL, pUuid);
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnSetUuid */
+static DECLCALLBACK(int) ddiSetUuid(void *pBackendData, PCRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p Uuid=%RTuuid\n", pBackendData, pUuid));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    return ddiUuidSet(pImage, pImage ? &pImage->UuidCreate : NULL, pUuid);
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetModificationUuid */
+static DECLCALLBACK(int) ddiGetModificationUuid(void *pBackendData, PRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p pUuid=%#p\n", pBackendData, pUuid));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    return ddiUuidGet(pImage, pImage ? &pImage->UuidModify : NULL, pUuid);
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnSetModificationUuid */
+static DECLCALLBACK(int) ddiSetModificationUuid(void *pBackendData, PCRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p Uuid=%RTuuid\n", pBackendData, pUuid));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    return ddiUuidSet(pImage, pImage ? &pImage->UuidModify : NULL, pUuid);
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetParentUuid */
+static DECLCALLBACK(int) ddiGetParentUuid(void *pBackendData, PRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p pUuid=%#p\n", pBackendData, pUuid));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    return ddiUuidGet(pImage, pImage ? &pImage->UuidParent : NULL, pUuid);
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnSetParentUuid */
+static DECLCALLBACK(int) ddiSetParentUuid(void *pBackendData, PCRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p Uuid=%RTuuid\n", pBackendData, pUuid));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    return ddiUuidSet(pImage, pImage ? &pImage->UuidParent : NULL, pUuid);
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetParentModificationUuid */
+static DECLCALLBACK(int) ddiGetParentModificationUuid(void *pBackendData, PRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p pUuid=%#p\n", pBackendData, pUuid));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    return ddiUuidGet(pImage, pImage ? &pImage->UuidParentModify : NULL, pUuid);
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnSetParentModificationUuid */
+static DECLCALLBACK(int) ddiSetParentModificationUuid(void *pBackendData, PCRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p Uuid=%RTuuid\n", pBackendData, pUuid));
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    return ddiUuidSet(pImage, pImage ? &pImage->UuidParentModify : NULL, pUuid);
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnDump */
+static DECLCALLBACK(void) ddiDump(void *pBackendData)
+{
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+
+    AssertPtrReturnVoid(pImage);
+
+    uint64_t cBlocksAllocated = 0;
+    uint64_t cBlocksZero = 0;
+    for (uint32_t i = 0; i < pImage->cBlocks; i++)
+    {
+        if (DDI_BLOCK_IS_ALLOCATED(pImage->paBlockMap[i]))
+            cBlocksAllocated++;
+        else if (pImage->paBlockMap[i] == DDI_BLOCK_ZERO)
+            cBlocksZero++;
+    }
+
+    uint32_t cPhysBlocksUsed = 0;
+    for (uint32_t i = 0; i < pImage->cPhysBlocks; i++)
+        if (pImage->paPhysBlocks[i].cRefs)
+            cPhysBlocksUsed++;
+
+    vdIfErrorMessage(pImage->pIfError, "Header: Geometry PCHS=%u/%u/%u LCHS=%u/%u/%u cbSector=%llu\n",
+                     pImage->PCHSGeometry.cCylinders, pImage->PCHSGeometry.cHeads, pImage->PCHSGeometry.cSectors,
+                     pImage->LCHSGeometry.cCylinders, pImage->LCHSGeometry.cHeads, pImage->LCHSGeometry.cSectors,
+                     pImage->cbSize / 512);
+    vdIfErrorMessage(pImage->pIfError, "Header: cbBlock=%u cBlocks=%u cPhysBlocks=%u offBlockMap=%llu offPhysTbl=%llu offData=%llu\n",
+                     pImage->cbBlock, pImage->cBlocks, pImage->cPhysBlocks,
+                     pImage->offBlockMap, pImage->offPhysTbl, pImage->offData);
+    vdIfErrorMessage(pImage->pIfError, "Blocks: allocated=%llu zero=%llu physical used=%u dedup hits=%llu misses=%llu\n",
+                     cBlocksAllocated, cBlocksZero, cPhysBlocksUsed, pImage->cDedupHits, pImage->cDedupMisses);
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnGetParentFilename */
+static DECLCALLBACK(int) ddiGetParentFilename(void *pBackendData, char **ppszParentFilename)
+{
+    int rc = VINF_SUCCESS;
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+
+    AssertPtrReturn(pImage, VERR_VD_NOT_OPENED);
+
+    if (pImage->pszParentFilename)
+        *ppszParentFilename = RTStrDup(pImage->pszParentFilename);
+    else
+        rc = VERR_NOT_SUPPORTED;
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnSetParentFilename */
+static DECLCALLBACK(int) ddiSetParentFilename(void *pBackendData, const char *pszParentFilename)
+{
+    int rc = VINF_SUCCESS;
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+
+    AssertPtrReturn(pImage, VERR_VD_NOT_OPENED);
+
+    if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        rc = VERR_VD_IMAGE_READ_ONLY;
+    else if (strlen(pszParentFilename) >= DDI_PARENT_FILENAME_MAX)
+        rc = VERR_FILENAME_TOO_LONG;
+    else
+    {
+        char *pszParentFilenameNew = RTStrDup(pszParentFilename);
+        if (pszParentFilenameNew)
+        {
+            if (pImage->pszParentFilename)
+                RTStrFree(pImage->pszParentFilename);
+            pImage->pszParentFilename = pszParentFilenameNew;
+            rc = ddiFlushImage(pImage);
+        }
+        else
+            rc = VERR_NO_STR_MEMORY;
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnCompact */
+static DECLCALLBACK(int) ddiCompact(void *pBackendData, unsigned uPercentStart,
+                                    unsigned uPercentSpan, PVDINTERFACE pVDIfsDisk,
+                                    PVDINTERFACE pVDIfsImage, PVDINTERFACE pVDIfsOperation)
+{
+    RT_NOREF2(pVDIfsDisk, pVDIfsImage);
+    PDDIIMAGE pImage = (PDDIIMAGE)pBackendData;
+    PVDINTERFACEPROGRESS pIfProgress = VDIfProgressGet(pVDIfsOperation);
+    int rc = VINF_SUCCESS;
+
+    AssertPtrReturn(pImage, VERR_VD_NOT_OPENED);
+    AssertReturn(!(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY), VERR_VD_IMAGE_READ_ONLY);
+
+    uint32_t cPhysBlocks = pImage->cPhysBlocks;
+    uint32_t *paidxBlockFirst = (uint32_t *)RTMemAlloc(RT_MAX(cPhysBlocks, 1) * sizeof(uint32_t));
+    uint32_t *paidxBlockNext  = (uint32_t *)RTMemAlloc(RT_MAX(pImage->cBlocks, 1) * sizeof(uint32_t));
+    if (   !paidxBlockFirst
+        || !paidxBlockNext)
+    {
+        RTMemFree(paidxBlockFirst);
+        RTMemFree(paidxBlockNext);
+        return VERR_NO_MEMORY;
+    }
+
+    /* Build the reverse mapping from physical blocks to the guest blocks referencing them. */
+    memset(paidxBlockFirst, 0xff, cPhysBlocks * sizeof(uint32_t));
+    for (uint32_t idxBlock = pImage->cBlocks; idxBlock-- > 0;)
+    {
+        uint32_t uEntry = pImage->paBlockMap[idxBlock];
+        if (DDI_BLOCK_IS_ALLOCATED(uEntry))
+        {
+            paidxBlockNext[idxBlock] = paidxBlockFirst[uEntry - 1];
+            paidxBlockFirst[uEntry - 1] = idxBlock;
+        }
+    }
+
+    /*
+     * Walk the physical blocks in ascending order and move every block still in use
+     * to the lowest free position. Blocks with the same content which were written
+     * concurrently and couldn't be linked at that time are folded on the way.
+     * The data is copied before the block map is updated and a position is only
+     * reused after all references to it are gone, so the image stays consistent
+     * at all times.
+     */
+    memset(pImage->paHashBuckets, 0xff, pImage->cHashBuckets * sizeof(uint32_t));
+    pImage->idxPhysFree        = DDI_PHYS_NIL;
+    pImage->idxPhysFreePending = DDI_PHYS_NIL;
+
+    uint32_t idxPhysNew = 0;
+    for (uint32_t idxPhys = 0; idxPhys < cPhysBlocks && RT_SUCCESS(rc); idxPhys++)
+    {
+        PDDIPHYSBLOCK pPhysBlock = &pImage->paPhysBlocks[idxPhys];
+        if (!pPhysBlock->cRefs)
+            continue;
+
+        uint32_t idxPhysDst = ddiHashLookup(pImage, &pPhysBlock->abHash[0]);
+        if (idxPhysDst == DDI_PHYS_NIL)
+        {
+            idxPhysDst = idxPhysNew++;
+            if (idxPhysDst != idxPhys)
+            {
+                rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage,
+                                           pImage->offData + (uint64_t)idxPhys * pImage->cbBlock,
+                                           pImage->pvBlock, pImage->cbBlock);
+                if (RT_SUCCESS(rc))
+                    rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage,
+                                                pImage->offData + (uint64_t)idxPhysDst * pImage->cbBlock,
+                                                pImage->pvBlock, pImage->cbBlock);
+                if (RT_FAILURE(rc))
+                    break;
+
+                PDDIPHYSBLOCK pPhysBlockDst = &pImage->paPhysBlocks[idxPhysDst];
+                memcpy(&pPhysBlockDst->abHash[0], &pPhysBlock->abHash[0], sizeof(pPhysBlockDst->abHash));
+                pPhysBlockDst->cRefs = 0;
+            }
+
+            pImage->paPhysBlocks[idxPhysDst].fCommitted = true;
+            ddiHashInsert(pImage, idxPhysDst);
+        }
+
+        if (idxPhysDst != idxPhys)
+        {
+            PDDIPHYSBLOCK pPhysBlockDst = &pImage->paPhysBlocks[idxPhysDst];
+
+            pPhysBlockDst->cRefs += pPhysBlock->cRefs;
+            rc = ddiPhysBlockWrite(pImage, NULL, idxPhysDst);
+
+            for (uint32_t idxBlock = paidxBlockFirst[idxPhys];
+                 idxBlock != UINT32_MAX && RT_SUCCESS(rc);
+                 idxBlock = paidxBlockNext[idxBlock])
+            {
+                pImage->paBlockMap[idxBlock] = idxPhysDst + 1;
+                rc = ddiBlockMapWrite(pImage, NULL, idxBlock);
+            }
+
+            if (RT_SUCCESS(rc))
+            {
+                pPhysBlock->cRefs = 0;
+                RT_ZERO(pPhysBlock->abHash);
+                rc = ddiPhysBlockWrite(pImage, NULL, idxPhys);
+            }
+        }
+
+        vdIfProgress(pIfProgress, uPercentStart + (uint64_t)idxPhys * uPercentSpan / cPhysBlocks);
+    }
+
+    if (RT_SUCCESS(rc))
+    {
+        pImage->cPhysBlocks = idxPhysNew;
+        rc = ddiFlushImage(pImage);
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage,
+                                      pImage->offData + (uint64_t)pImage->cPhysBlocks * pImage->cbBlock);
+    }
+    else
+    {
+        /* Start over with the state on disk which is consistent. */
+        int rc2 = ddiPhysTblLoad(pImage);
+        AssertRC(rc2);
+    }
+
+    RTMemFree(paidxBlockFirst);
+    RTMemFree(paidxBlockNext);
+
+    if (RT_SUCCESS(rc))
+        vdIfProgress(pIfProgress, uPercentStart + uPercentSpan);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+
+const VDIMAGEBACKEND g_DdiBackend =
+{
+    /* u32Version */
+    VD_IMGBACKEND_VERSION,
+    /* pszBackendName */
+    "DDI",
+    /* uBackendCaps */
+    VD_CAP_UUID | VD_CAP_FILE | VD_CAP_VFS | VD_CAP_CREATE_DYNAMIC | VD_CAP_DIFF | VD_CAP_ASYNC,
+    /* paFileExtensions */
+    s_aDdiFileExtensions,
+    /* paConfigInfo */
+    NULL,
+    /* pfnProbe */
+    ddiProbe,
+    /* pfnOpen */
+    ddiOpen,
+    /* pfnCreate */
+    ddiCreate,
+    /* pfnRename */
+    ddiRename,
+    /* pfnClose */
+    ddiClose,
+    /* pfnRead */
+    ddiRead,
+    /* pfnWrite */
+    ddiWrite,
+    /* pfnFlush */
+    ddiFlush,
+    /* pfnDiscard */
+    NULL,
+    /* pfnGetVersion */
+    ddiGetVersion,
+    /* pfnGetFileSize */
+    ddiGetFileSize,
+    /* pfnGetPCHSGeometry */
+    ddiGetPCHSGeometry,
+    /* pfnSetPCHSGeometry */
+    ddiSetPCHSGeometry,
+    /* pfnGetLCHSGeometry */
+    ddiGetLCHSGeometry,
+    /* pfnSetLCHSGeometry */
+    ddiSetLCHSGeometry,
+    /* pfnQueryRegions */
+    ddiQueryRegions,
+    /* pfnRegionListRelease */
+    ddiRegionListRelease,
+    /* pfnGetImageFlags */
+    ddiGetImageFlags,
+    /* pfnGetOpenFlags */
+    ddiGetOpenFlags,
+    /* pfnSetOpenFlags */
+    ddiSetOpenFlags,
+    /* pfnGetComment */
+    ddiGetComment,
+    /* pfnSetComment */
+    ddiSetComment,
+    /* pfnGetUuid */
+    ddiGetUuid,
+    /* pfnSetUuid */
+    ddiSetUuid,
+    /* pfnGetModificationUuid */
+    ddiGetModificationUuid,
+    /* pfnSetModificationUuid */
+    ddiSetModificationUuid,
+    /* pfnGetParentUuid */
+    ddiGetParentUuid,
+    /* pfnSetParentUuid */
+    ddiSetParentUuid,
+    /* pfnGetParentModificationUuid */
+    ddiGetParentModificationUuid,
+    /* pfnSetParentModificationUuid */
+    ddiSetParentModificationUuid,
+    /* pfnDump */
+    ddiDump,
+    /* pfnGetTimestamp */
+    NULL,
+    /* pfnGetParentTimestamp */
+    NULL,
+    /* pfnSetParentTimestamp */
+    NULL,
+    /* pfnGetParentFilename */
+    ddiGetParentFilename,
+    /* pfnSetParentFilename */
+    ddiSetParentFilename,
+    /* pfnComposeLocation */
+    genericFileComposeLocation,
+    /* pfnComposeName */
+    genericFileComposeName,
+    /* pfnCompact */
+    ddiCompact,
+    /* pfnResize */
+    NULL,
+    /* pfnRepair */
+    NULL,
+    /* pfnTraverseMetadata */
+    NULL,
+    /* u32Version */
+    VD_IMGBACKEND_VERSION
+};
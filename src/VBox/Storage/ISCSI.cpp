@@ -109,13 +109,23 @@ typedef enum SCSIDEVTYPE
 /** Mask to extract the CmdQue bit out of the seventh byte of the INQUIRY response. */
 #define SCSI_INQUIRY_CMDQUE_MASK 0x02
 
-/** Maximum PDU payload size we can handle in one piece. Greater or equal than
- * s_iscsiConfigDefaultWriteSplit. */
+/** Maximum PDU payload size we can handle in one piece. */
 #define ISCSI_DATA_LENGTH_MAX _256K
 
 /** Maximum PDU size we can handle in one piece. */
 #define ISCSI_RECV_PDU_BUFFER_SIZE (ISCSI_DATA_LENGTH_MAX + ISCSI_BHS_SIZE)
 
+/** Maximum burst length offered to the target, the largest value allowed by RFC 3720.
+ * Write data exceeding the immediate data is solicited by the target with R2Ts,
+ * each of them covering at most the negotiated burst length. */
+#define ISCSI_BURST_LENGTH_MAX (_16M - 1)
+
+/** Maximum number of outstanding R2Ts per task we offer to the target. */
+#define ISCSI_OUTSTANDING_R2T_MAX 64
+
+/** Maximum number of sessions to a target commands are distributed over. */
+#define ISCSI_SESSIONS_MAX 8
+
 
 /** Version of the iSCSI standard which this initiator driver can handle. */
 #define ISCSI_MY_VERSION 0
@@ -429,6 +439,15 @@ typedef struct ISCSICMD
     void                 *pvUser;
     /** Command to execute. */
     ISCSICMDTYPE          enmCmdType;
+    /** Number of Data-Out PDUs queued for answering R2Ts of this command. */
+    uint32_t              cDataOutPdus;
+    /** Number of R2Ts which were not answered completely yet. */
+    uint32_t              cR2TsActive;
+    /** Flag whether the command completed while a Data-Out PDU was still being
+     * transmitted, the completion is deferred until the PDU was sent. */
+    bool                  fCompletePending;
+    /** Status code of the deferred completion. */
+    int                   rcCmdPending;
     /** Command type dependent data. */
     union
     {
@@ -467,6 +486,11 @@ typedef struct ISCSIPDUTX
     size_t      cbSgLeft;
     /** The iSCSI command this PDU belongs to. */
     PISCSICMD   pIScsiCmd;
+    /** Flag whether this is a Data-Out PDU answering an R2T of pIScsiCmd.
+     * Data-Out PDUs don't carry a CmdSN and are not subject to the command window. */
+    bool        fDataOut;
+    /** Flag whether this is the last Data-Out PDU answering the R2T. */
+    bool        fR2TLast;
     /** Number of segments in the request segments array. */
     unsigned    cISCSIReq;
     /** The request segments - variable in size. */
@@ -529,10 +553,21 @@ typedef struct ISCSIIMAGE
     /** Total volume size in bytes. Easier than multiplying the above values all the time. */
     uint64_t            cbSize;
 
-    /** Negotiated maximum data length when sending to target. */
+    /** Negotiated maximum data length when sending to target, limits the
+     * immediate data sent along with a command. */
     uint32_t            cbSendDataLength;
     /** Negotiated maximum data length when receiving from target. */
     uint32_t            cbRecvDataLength;
+    /** Maximum data segment length of a single PDU the target accepts. */
+    uint32_t            cbSendDataSegment;
+    /** Negotiated maximum amount of data the target solicits with a single R2T. */
+    uint32_t            cbMaxBurst;
+    /** Negotiated number of R2Ts the target may have outstanding for a single task. */
+    uint32_t            cMaxOutstandingR2T;
+    /** Flag whether the target accepts immediate data in the SCSI command PDU. */
+    bool                fImmediateData;
+    /** Number of outstanding R2Ts per task offered to the target. */
+    uint32_t            cOutstandingR2TCfg;
 
     /** Current state of the connection/session. */
     ISCSISTATE          state;
@@ -622,6 +657,17 @@ typedef struct ISCSIIMAGE
 
     /** Release log counter. */
     unsigned            cLogRelErrors;
+
+    /** Number of sessions to the target configured (only used by the image itself). */
+    uint32_t            cSessionsCfg;
+    /** Number of sessions established, including the one of the image itself.
+     * Zero if no additional sessions were set up. */
+    uint32_t            cSessions;
+    /** Round robin counter for distributing commands over the sessions. */
+    volatile uint32_t   idxSessionNext;
+    /** The sessions commands are distributed over, the first entry is the image itself. */
+    PISCSIIMAGE         apSessions[ISCSI_SESSIONS_MAX];
+
     /** The static region list. */
     VDREGIONLIST        RegionList;
 } ISCSIIMAGE;
@@ -640,8 +686,16 @@ static const char *s_iscsiConfigDefaultLUN = "0";
 /** Default timeout, 10 seconds. */
 static const char *s_iscsiConfigDefaultTimeout = "10000";
 
-/** Default write split value, less or equal to ISCSI_DATA_LENGTH_MAX. */
-static const char *s_iscsiConfigDefaultWriteSplit = "262144";
+/** Default write split value. Data exceeding the immediate data limit is solicited
+ * by the target with R2Ts if the I/O thread is used, otherwise the value is
+ * clipped to ISCSI_DATA_LENGTH_MAX. */
+static const char *s_iscsiConfigDefaultWriteSplit = "1048576";
+
+/** Default number of outstanding R2Ts per task offered to the target. */
+static const char *s_iscsiConfigDefaultMaxOutstandingR2T = "8";
+
+/** Default number of sessions to the target. */
+static const char *s_iscsiConfigDefaultSessions = "1";
 
 /** Default host IP stack. */
 static const char *s_iscsiConfigDefaultHostIPStack = "1";
@@ -665,6 +719,8 @@ static const VDCONFIGINFO s_iscsiConfigInfo[] =
     { "Timeout",              s_iscsiConfigDefaultTimeout,               VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
     { "HostIPStack",          s_iscsiConfigDefaultHostIPStack,           VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
     { "DumpMalformedPackets", s_iscsiConfigDefaultDumpMalformedPackets,  VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { "MaxOutstandingR2T",    s_iscsiConfigDefaultMaxOutstandingR2T,     VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { "Sessions",             s_iscsiConfigDefaultSessions,              VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
     { NULL,                   NULL,                                      VDCFGVALUETYPE_INTEGER, 0 }
 };
 
@@ -1297,10 +1353,18 @@ static int iscsiLogin(PISCSIIMAGE pImage)
     uint32_t aResBHS[12];
     char *pszNext;
     bool fParameterNeg = true;
-    pImage->cbRecvDataLength = ISCSI_DATA_LENGTH_MAX;
-    pImage->cbSendDataLength = RT_MIN(ISCSI_DATA_LENGTH_MAX, pImage->cbWriteSplit);
+    pImage->cbRecvDataLength   = ISCSI_DATA_LENGTH_MAX;
+    pImage->cbSendDataLength   = RT_MIN(ISCSI_DATA_LENGTH_MAX, pImage->cbWriteSplit);
+    pImage->cbSendDataSegment  = ISCSI_DATA_LENGTH_MAX;
+    pImage->cbMaxBurst         = ISCSI_BURST_LENGTH_MAX;
+    pImage->cMaxOutstandingR2T = pImage->cOutstandingR2TCfg;
+    pImage->fImmediateData     = true;
     char szMaxDataLength[16];
     RTStrPrintf(szMaxDataLength, sizeof(szMaxDataLength), "%u", ISCSI_DATA_LENGTH_MAX);
+    char szMaxBurstLength[16];
+    RTStrPrintf(szMaxBurstLength, sizeof(szMaxBurstLength), "%u", ISCSI_BURST_LENGTH_MAX);
+    char szMaxOutstandingR2T[16];
+    RTStrPrintf(szMaxOutstandingR2T, sizeof(szMaxOutstandingR2T), "%u", pImage->cOutstandingR2TCfg);
     ISCSIPARAMETER aParameterNeg[] =
     {
         { "HeaderDigest", "None", 0 },
@@ -1309,14 +1373,14 @@ static int iscsiLogin(PISCSIIMAGE pImage)
         { "InitialR2T", "No", 0 },
         { "ImmediateData", "Yes", 0 },
         { "MaxRecvDataSegmentLength", szMaxDataLength, 0 },
-        { "MaxBurstLength", szMaxDataLength, 0 },
+        { "MaxBurstLength", szMaxBurstLength, 0 },
         { "FirstBurstLength", szMaxDataLength, 0 },
         { "DefaultTime2Wait", "0", 0 },
         { "DefaultTime2Retain", "60", 0 },
         { "DataPDUInOrder", "Yes", 0 },
         { "DataSequenceInOrder", "Yes", 0 },
         { "ErrorRecoveryLevel", "0", 0 },
-        { "MaxOutstandingR2T", "1", 0 }
+        { "MaxOutstandingR2T", szMaxOutstandingR2T, 0 }
     };
 
     if (!iscsiIsClientConnected(pImage))
@@ -2376,6 +2440,109 @@ static void iscsiPDUTxAdd(PISCSIIMAGE pImage, PISCSIPDUTX pIScsiPDUTx, bool fFro
     }
 }
 
+/**
+ * Inserts a chain of Data-Out PDUs answering an R2T into the list of PDUs
+ * waiting for transmission.
+ *
+ * Data-Out PDUs are not subject to the command window and are placed before
+ * all queued commands so the target can make progress with the tasks it is
+ * processing already. The order among the Data-Out PDUs is kept because
+ * the data sequences of a task must be sent in order.
+ *
+ * @param   pImage          The iSCSI connection state to be used.
+ * @param   pIScsiPDUTxHead Head of the PDU chain.
+ * @param   pIScsiPDUTxTail Tail of the PDU chain.
+ */
+static void iscsiPDUTxAddDataOut(PISCSIIMAGE pImage, PISCSIPDUTX pIScsiPDUTxHead, PISCSIPDUTX pIScsiPDUTxTail)
+{
+    PISCSIPDUTX pIScsiPDUTxPrev = NULL;
+    PISCSIPDUTX pIScsiPDUTxCur  = pImage->pIScsiPDUTxHead;
+
+    /* Skip the Data-Out and NOP-Out PDUs (the latter don't belong to a command) at the start. */
+    while (   pIScsiPDUTxCur
+           && (pIScsiPDUTxCur->fDataOut || !pIScsiPDUTxCur->pIScsiCmd))
+    {
+        pIScsiPDUTxPrev = pIScsiPDUTxCur;
+        pIScsiPDUTxCur  = pIScsiPDUTxCur->pNext;
+    }
+
+    pIScsiPDUTxTail->pNext = pIScsiPDUTxCur;
+    if (pIScsiPDUTxPrev)
+        pIScsiPDUTxPrev->pNext = pIScsiPDUTxHead;
+    else
+        pImage->pIScsiPDUTxHead = pIScsiPDUTxHead;
+    if (!pIScsiPDUTxCur)
+        pImage->pIScsiPDUTxTail = pIScsiPDUTxTail;
+}
+
+/**
+ * Frees a PDU which was transmitted or is not going to be transmitted anymore.
+ * Does the bookkeeping for Data-Out PDUs and completes the command they belong
+ * to if the completion was deferred.
+ *
+ * @param   pImage          The iSCSI connection state to be used.
+ * @param   pIScsiPDUTx     The PDU to free.
+ */
+static void iscsiPDUTxFree(PISCSIIMAGE pImage, PISCSIPDUTX pIScsiPDUTx)
+{
+    if (pIScsiPDUTx->fDataOut)
+    {
+        PISCSICMD pIScsiCmd = pIScsiPDUTx->pIScsiCmd;
+
+        Assert(pIScsiCmd->cDataOutPdus > 0);
+        pIScsiCmd->cDataOutPdus--;
+        if (   pIScsiPDUTx->fR2TLast
+            && pIScsiCmd->cR2TsActive > 0)
+            pIScsiCmd->cR2TsActive--;
+
+        if (   !pIScsiCmd->cDataOutPdus
+            && pIScsiCmd->fCompletePending)
+        {
+            pIScsiCmd->fCompletePending = false;
+            iscsiCmdComplete(pImage, pIScsiCmd, pIScsiCmd->rcCmdPending);
+        }
+    }
+
+    RTMemFree(pIScsiPDUTx);
+}
+
+/**
+ * Removes all Data-Out PDUs of the given command which are waiting for
+ * transmission. The PDU currently transmitted is not touched.
+ *
+ * @param   pImage          The iSCSI connection state to be used.
+ * @param   pIScsiCmd       The command to drop the Data-Out PDUs for.
+ */
+static void iscsiPDUTxDropDataOut(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd)
+{
+    PISCSIPDUTX pIScsiPDUTxPrev = NULL;
+    PISCSIPDUTX pIScsiPDUTxCur  = pImage->pIScsiPDUTxHead;
+
+    while (pIScsiPDUTxCur)
+    {
+        PISCSIPDUTX pIScsiPDUTxNext = pIScsiPDUTxCur->pNext;
+
+        if (   pIScsiPDUTxCur->fDataOut
+            && pIScsiPDUTxCur->pIScsiCmd == pIScsiCmd)
+        {
+            if (pIScsiPDUTxPrev)
+                pIScsiPDUTxPrev->pNext = pIScsiPDUTxNext;
+            else
+                pImage->pIScsiPDUTxHead = pIScsiPDUTxNext;
+            if (pImage->pIScsiPDUTxTail == pIScsiPDUTxCur)
+                pImage->pIScsiPDUTxTail = pIScsiPDUTxPrev;
+
+            Assert(pIScsiCmd->cDataOutPdus > 0);
+            pIScsiCmd->cDataOutPdus--;
+            RTMemFree(pIScsiPDUTxCur);
+        }
+        else
+            pIScsiPDUTxPrev = pIScsiPDUTxCur;
+
+        pIScsiPDUTxCur = pIScsiPDUTxNext;
+    }
+}
+
 /**
  * Receives a PDU in a non blocking way.
  *
@@ -2460,7 +2627,8 @@ static int iscsiSendPDUAsync(PISCSIIMAGE pImage)
         if (!pImage->pIScsiPDUTxCur)
         {
             if (   !pImage->pIScsiPDUTxHead
-                || serial_number_greater(pImage->pIScsiPDUTxHead->CmdSN, pImage->MaxCmdSN))
+                || (   !pImage->pIScsiPDUTxHead->fDataOut
+                    && serial_number_greater(pImage->pIScsiPDUTxHead->CmdSN, pImage->MaxCmdSN)))
                 break;
 
             pImage->pIScsiPDUTxCur = pImage->pIScsiPDUTxHead;
@@ -2480,13 +2648,15 @@ static int iscsiSendPDUAsync(PISCSIIMAGE pImage)
             if (!pImage->pIScsiPDUTxCur->cbSgLeft)
             {
                 /* PDU completed, free it and place the command on the waiting for response list. */
-                if (pImage->pIScsiPDUTxCur->pIScsiCmd)
+                PISCSIPDUTX pIScsiPDUTx = pImage->pIScsiPDUTxCur;
+                pImage->pIScsiPDUTxCur = NULL;
+                if (   pIScsiPDUTx->pIScsiCmd
+                    && !pIScsiPDUTx->fDataOut)
                 {
                     LogFlow(("Sent complete PDU, placing on waiting list\n"));
-                    iscsiCmdInsert(pImage, pImage->pIScsiPDUTxCur->pIScsiCmd);
+                    iscsiCmdInsert(pImage, pIScsiPDUTx->pIScsiCmd);
                 }
-                RTMemFree(pImage->pIScsiPDUTxCur);
-                pImage->pIScsiPDUTxCur = NULL;
+                iscsiPDUTxFree(pImage, pIScsiPDUTx);
             }
         }
     } while (   RT_SUCCESS(rc)
@@ -2729,8 +2899,15 @@ static int iscsiValidatePDU(PISCSIRES paRes, uint32_t cnRes)
                 ||  (RT_N2H_U32(pcrgResBHS[4]) != ISCSI_TASK_TAG_RSVD))
                 return VERR_PARSE_ERROR;
             break;
-        case ISCSIOP_SCSI_TASKMGMT_RES:
         case ISCSIOP_R2T:
+            /* R2Ts must not have the final bit unset and may not contain any data
+             * or additional header segments nor may they request no data at all. */
+            if (    ((hw0 & ISCSI_FINAL_BIT) == 0)
+                ||  (RT_N2H_U32(pcrgResBHS[1]) != 0)
+                ||  (RT_N2H_U32(pcrgResBHS[11]) == 0))
+                return VERR_PARSE_ERROR;
+            break;
+        case ISCSIOP_SCSI_TASKMGMT_RES:
         case ISCSIOP_REJECT:
         default:
             /* Do some logging, ignore PDU. */
@@ -2746,6 +2923,56 @@ static int iscsiValidatePDU(PISCSIRES paRes, uint32_t cnRes)
 }
 
 
+/**
+ * Adds the given range of the initiator to target data of a SCSI request to the
+ * segment array of the given PDU, padding the data segment to a multiple of 4 bytes.
+ *
+ * @returns Index of the next free entry in the segment array.
+ * @param   pImage      The iSCSI connection state to be used.
+ * @param   pIScsiPDU   The PDU to add the data to.
+ * @param   idxReq      Index of the first free entry in the segment array.
+ * @param   pScsiReq    The SCSI request holding the data.
+ * @param   offData     Start offset of the range in the I2T data.
+ * @param   cbData      Size of the range.
+ * @param   pcbSegs     Where to add the number of bytes in the added segments.
+ */
+static uint32_t iscsiPDUTxAddDataSegs(PISCSIIMAGE pImage, PISCSIPDUTX pIScsiPDU, uint32_t idxReq, PSCSIREQ pScsiReq,
+                                      size_t offData, size_t cbData, size_t *pcbSegs)
+{
+    size_t cbLeft = cbData;
+
+    for (unsigned iSeg = 0; iSeg < pScsiReq->cI2TSegs && cbLeft; iSeg++)
+    {
+        PCRTSGSEG pSeg = &pScsiReq->paI2TSegs[iSeg];
+
+        if (offData >= pSeg->cbSeg)
+        {
+            offData -= pSeg->cbSeg;
+            continue;
+        }
+
+        size_t cbThisSeg = RT_MIN(pSeg->cbSeg - offData, cbLeft);
+        pIScsiPDU->aISCSIReq[idxReq].pvSeg = (uint8_t *)pSeg->pvSeg + offData;
+        pIScsiPDU->aISCSIReq[idxReq].cbSeg = cbThisSeg;
+        *pcbSegs += cbThisSeg;
+        idxReq++;
+        cbLeft  -= cbThisSeg;
+        offData  = 0;
+    }
+    Assert(!cbLeft);
+
+    /* Add padding if necessary. */
+    if (cbData & 3)
+    {
+        pIScsiPDU->aISCSIReq[idxReq].pvSeg = &pImage->aPadding[0];
+        pIScsiPDU->aISCSIReq[idxReq].cbSeg = 4 - (cbData & 3);
+        *pcbSegs += pIScsiPDU->aISCSIReq[idxReq].cbSeg;
+        idxReq++;
+    }
+
+    return idxReq;
+}
+
 /**
  * Prepares a PDU to transfer for the given command and adds it to the list.
  */
@@ -2763,11 +2990,21 @@ static int iscsiPDUTxPrepare(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd)
     Assert(pIScsiCmd->enmCmdType == ISCSICMDTYPE_REQ);
 
     pIScsiCmd->Itt = iscsiNewITT(pImage);
+    pIScsiCmd->cR2TsActive = 0;
+    Assert(!pIScsiCmd->cDataOutPdus);
     pScsiReq = pIScsiCmd->CmdType.ScsiReq.pScsiReq;
 
     if (pScsiReq->cT2ISegs)
         RTSgBufInit(&pScsiReq->SgBufT2I, pScsiReq->paT2ISegs, pScsiReq->cT2ISegs);
 
+    /*
+     * Send as much data as the target accepts as immediate data with the command,
+     * the rest is solicited by the target with R2Ts.
+     */
+    size_t cbImmediate = 0;
+    if (pImage->fImmediateData)
+        cbImmediate = RT_MIN(pScsiReq->cbI2TData, pImage->cbSendDataLength);
+
     /*
      * Allocate twice as much entries as required for padding (worst case).
      * The additional segment is for the BHS.
@@ -2789,7 +3026,7 @@ static int iscsiPDUTxPrepare(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd)
     /* Setup the BHS. */
     paReqBHS[0] = RT_H2N_U32(  ISCSI_FINAL_BIT | ISCSI_TASK_ATTR_SIMPLE | ISCSIOP_SCSI_CMD
                              | (pScsiReq->enmXfer << 21)); /* I=0,F=1,Attr=Simple */
-    paReqBHS[1] = RT_H2N_U32(0x00000000 | ((uint32_t)pScsiReq->cbI2TData & 0xffffff)); /* TotalAHSLength=0 */
+    paReqBHS[1] = RT_H2N_U32(0x00000000 | ((uint32_t)cbImmediate & 0xffffff)); /* TotalAHSLength=0 */
     paReqBHS[2] = RT_H2N_U32(pImage->LUN >> 32);
     paReqBHS[3] = RT_H2N_U32(pImage->LUN & 0xffffffff);
     paReqBHS[4] = pIScsiCmd->Itt;
@@ -2809,26 +3046,11 @@ static int iscsiPDUTxPrepare(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd)
     cbSegs = sizeof(pIScsiPDU->aBHS);
     /* Padding is not necessary for the BHS. */
 
-    if (pScsiReq->cbI2TData)
+    if (cbImmediate)
     {
-        for (unsigned cSeg = 0; cSeg < pScsiReq->cI2TSegs; cSeg++)
-        {
-            Assert(cnISCSIReq < cI2TSegs);
-            pIScsiPDU->aISCSIReq[cnISCSIReq].cbSeg = pScsiReq->paI2TSegs[cSeg].cbSeg;
-            pIScsiPDU->aISCSIReq[cnISCSIReq].pvSeg = pScsiReq->paI2TSegs[cSeg].pvSeg;
-            cbSegs += pScsiReq->paI2TSegs[cSeg].cbSeg;
-            cnISCSIReq++;
-
-            /* Add padding if necessary. */
-            if (pScsiReq->paI2TSegs[cSeg].cbSeg & 3)
-            {
-                Assert(cnISCSIReq < cI2TSegs);
-                pIScsiPDU->aISCSIReq[cnISCSIReq].pvSeg = &pImage->aPadding[0];
-                pIScsiPDU->aISCSIReq[cnISCSIReq].cbSeg = 4 - (pScsiReq->paI2TSegs[cSeg].cbSeg & 3);
-                cbSegs += pIScsiPDU->aISCSIReq[cnISCSIReq].cbSeg;
-                cnISCSIReq++;
-            }
-        }
+        cnISCSIReq = iscsiPDUTxAddDataSegs(pImage, pIScsiPDU, cnISCSIReq, pScsiReq, 0 /*offData*/,
+                                           cbImmediate, &cbSegs);
+        Assert(cnISCSIReq <= cI2TSegs);
     }
 
     pIScsiPDU->cISCSIReq = cnISCSIReq;
@@ -2845,6 +3067,108 @@ static int iscsiPDUTxPrepare(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd)
     return rc;
 }
 
+/**
+ * Prepares the Data-Out PDUs answering an R2T of the target and adds them to the list.
+ *
+ * @returns VBox status code.
+ * @param   pImage      The iSCSI connection state to be used.
+ * @param   pIScsiCmd   The command the R2T was received for.
+ * @param   paResBHS    The BHS of the R2T.
+ */
+static int iscsiPDUTxPrepareDataOut(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd, const uint32_t *paResBHS)
+{
+    int rc = VINF_SUCCESS;
+    PSCSIREQ pScsiReq = pIScsiCmd->CmdType.ScsiReq.pScsiReq;
+    uint32_t offData = RT_N2H_U32(paResBHS[10]);
+    uint32_t cbData = RT_N2H_U32(paResBHS[11]);
+
+    LogFlowFunc(("pImage=%#p pIScsiCmd=%#p offData=%u cbData=%u\n", pImage, pIScsiCmd, offData, cbData));
+
+    /* The target may only solicit data announced with the command. */
+    if (   pScsiReq->enmXfer != SCSIXFER_TO_TARGET
+        || offData >= pScsiReq->cbI2TData
+        || cbData > pScsiReq->cbI2TData - offData)
+        return VERR_PARSE_ERROR;
+
+    if (   cbData > pImage->cbMaxBurst
+        || pIScsiCmd->cR2TsActive >= pImage->cMaxOutstandingR2T)
+        iscsiLogRel(pImage, "iSCSI: Target %s exceeds the negotiated R2T limits (%u bytes, %u R2Ts active)\n",
+                    pImage->pszTargetName, cbData, pIScsiCmd->cR2TsActive);
+
+    /*
+     * Split the solicited data into PDUs not exceeding the maximum data segment
+     * length of the target. The data sequence numbering starts from 0 for every R2T.
+     */
+    PISCSIPDUTX pIScsiPDUHead = NULL;
+    PISCSIPDUTX pIScsiPDUTail = NULL;
+    uint32_t DataSN = 0;
+    while (cbData)
+    {
+        uint32_t cbThisPDU = RT_MIN(cbData, pImage->cbSendDataSegment);
+        /* The BHS, the data segments and the padding. */
+        PISCSIPDUTX pIScsiPDU = (PISCSIPDUTX)RTMemAllocZ(RT_UOFFSETOF_DYN(ISCSIPDUTX, aISCSIReq[pScsiReq->cI2TSegs + 2]));
+        if (!pIScsiPDU)
+        {
+            rc = VERR_NO_MEMORY;
+            break;
+        }
+
+        pIScsiPDU->pIScsiCmd = pIScsiCmd;
+        pIScsiPDU->fDataOut  = true;
+        pIScsiPDU->fR2TLast  = cbThisPDU == cbData;
+
+        uint32_t *paReqBHS = pIScsiPDU->aBHS;
+        paReqBHS[0]  = RT_H2N_U32((pIScsiPDU->fR2TLast ? ISCSI_FINAL_BIT : 0) | ISCSIOP_SCSI_DATA_OUT);
+        paReqBHS[1]  = RT_H2N_U32(cbThisPDU); /* TotalAHSLength=0 */
+        paReqBHS[2]  = RT_H2N_U32(pImage->LUN >> 32);
+        paReqBHS[3]  = RT_H2N_U32(pImage->LUN & 0xffffffff);
+        paReqBHS[4]  = pIScsiCmd->Itt;
+        paReqBHS[5]  = paResBHS[5];         /* copy TTT from R2T */
+        paReqBHS[6]  = 0;                   /* reserved */
+        paReqBHS[7]  = RT_H2N_U32(pImage->ExpStatSN);
+        paReqBHS[8]  = 0;                   /* reserved */
+        paReqBHS[9]  = RT_H2N_U32(DataSN);
+        paReqBHS[10] = RT_H2N_U32(offData); /* buffer offset */
+        paReqBHS[11] = 0;                   /* reserved */
+
+        size_t cbSegs = sizeof(pIScsiPDU->aBHS);
+        pIScsiPDU->aISCSIReq[0].cbSeg = sizeof(pIScsiPDU->aBHS);
+        pIScsiPDU->aISCSIReq[0].pvSeg = pIScsiPDU->aBHS;
+        pIScsiPDU->cISCSIReq = iscsiPDUTxAddDataSegs(pImage, pIScsiPDU, 1, pScsiReq, offData, cbThisPDU, &cbSegs);
+        pIScsiPDU->cbSgLeft  = cbSegs;
+        RTSgBufInit(&pIScsiPDU->SgBuf, pIScsiPDU->aISCSIReq, pIScsiPDU->cISCSIReq);
+
+        if (pIScsiPDUTail)
+            pIScsiPDUTail->pNext = pIScsiPDU;
+        else
+            pIScsiPDUHead = pIScsiPDU;
+        pIScsiPDUTail = pIScsiPDU;
+        pIScsiCmd->cDataOutPdus++;
+
+        DataSN++;
+        offData += cbThisPDU;
+        cbData  -= cbThisPDU;
+    }
+
+    if (RT_SUCCESS(rc))
+    {
+        pIScsiCmd->cR2TsActive++;
+        iscsiPDUTxAddDataOut(pImage, pIScsiPDUHead, pIScsiPDUTail);
+    }
+    else
+    {
+        while (pIScsiPDUHead)
+        {
+            PISCSIPDUTX pIScsiPDU = pIScsiPDUHead;
+            pIScsiPDUHead = pIScsiPDUHead->pNext;
+            pIScsiCmd->cDataOutPdus--;
+            RTMemFree(pIScsiPDU);
+        }
+    }
+
+    return rc;
+}
+
 
 /**
  * Updates the state of a request from the PDU we received.
@@ -2949,6 +3273,11 @@ static int iscsiRecvPDUUpdateRequest(PISCSIIMAGE pImage, PISCSIRES paRes, uint32
                 }
             }
         }
+        else if (cmd == ISCSIOP_R2T)
+        {
+            /* The target is ready to receive more data of a write command. */
+            rc = iscsiPDUTxPrepareDataOut(pImage, pIScsiCmd, paResBHS);
+        }
         else
             rc = VERR_PARSE_ERROR;
     }
@@ -3173,6 +3502,8 @@ static int iscsiUpdateParameters(PISCSIIMAGE pImage, const uint8_t *pbBuf, size_
     const char *pcszMaxRecvDataSegmentLength = NULL;
     const char *pcszMaxBurstLength = NULL;
     const char *pcszFirstBurstLength = NULL;
+    const char *pcszMaxOutstandingR2T = NULL;
+    const char *pcszImmediateData = NULL;
     rc = iscsiTextGetKeyValue(pbBuf, cbBuf, "MaxRecvDataSegmentLength", &pcszMaxRecvDataSegmentLength);
     if (rc == VERR_INVALID_NAME)
         rc = VINF_SUCCESS;
@@ -3184,6 +3515,16 @@ static int iscsiUpdateParameters(PISCSIIMAGE pImage, const uint8_t *pbBuf, size_
     if (RT_FAILURE(rc))
         return VERR_PARSE_ERROR;
     rc = iscsiTextGetKeyValue(pbBuf, cbBuf, "FirstBurstLength", &pcszFirstBurstLength);
+    if (rc == VERR_INVALID_NAME)
+        rc = VINF_SUCCESS;
+    if (RT_FAILURE(rc))
+        return VERR_PARSE_ERROR;
+    rc = iscsiTextGetKeyValue(pbBuf, cbBuf, "MaxOutstandingR2T", &pcszMaxOutstandingR2T);
+    if (rc == VERR_INVALID_NAME)
+        rc = VINF_SUCCESS;
+    if (RT_FAILURE(rc))
+        return VERR_PARSE_ERROR;
+    rc = iscsiTextGetKeyValue(pbBuf, cbBuf, "ImmediateData", &pcszImmediateData);
     if (rc == VERR_INVALID_NAME)
         rc = VINF_SUCCESS;
     if (RT_FAILURE(rc))
@@ -3194,6 +3535,8 @@ static int iscsiUpdateParameters(PISCSIIMAGE pImage, const uint8_t *pbBuf, size_
         rc = RTStrToUInt32Full(pcszMaxRecvDataSegmentLength, 0, &cb);
         AssertRC(rc);
         pImage->cbSendDataLength = RT_MIN(pImage->cbSendDataLength, cb);
+        if (cb)
+            pImage->cbSendDataSegment = RT_MIN(pImage->cbSendDataSegment, cb);
     }
     if (pcszMaxBurstLength)
     {
@@ -3201,6 +3544,8 @@ static int iscsiUpdateParameters(PISCSIIMAGE pImage, const uint8_t *pbBuf, size_
         rc = RTStrToUInt32Full(pcszMaxBurstLength, 0, &cb);
         AssertRC(rc);
         pImage->cbSendDataLength = RT_MIN(pImage->cbSendDataLength, cb);
+        if (cb)
+            pImage->cbMaxBurst = RT_MIN(pImage->cbMaxBurst, cb);
     }
     if (pcszFirstBurstLength)
     {
@@ -3209,6 +3554,16 @@ static int iscsiUpdateParameters(PISCSIIMAGE pImage, const uint8_t *pbBuf, size_
         AssertRC(rc);
         pImage->cbSendDataLength = RT_MIN(pImage->cbSendDataLength, cb);
     }
+    if (pcszMaxOutstandingR2T)
+    {
+        uint32_t c = pImage->cMaxOutstandingR2T;
+        rc = RTStrToUInt32Full(pcszMaxOutstandingR2T, 0, &c);
+        AssertRC(rc);
+        if (c)
+            pImage->cMaxOutstandingR2T = RT_MIN(pImage->cMaxOutstandingR2T, c);
+    }
+    if (pcszImmediateData)
+        pImage->fImmediateData = !strcmp(pcszImmediateData, "Yes");
     return VINF_SUCCESS;
 }
 
@@ -3322,6 +3677,23 @@ static void iscsiCmdComplete(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd, int rcCmd)
     /* Remove from the table first. */
     iscsiCmdRemove(pImage, pIScsiCmd->Itt);
 
+    /*
+     * Drop any Data-Out PDUs still queued, the target has no use for the data anymore.
+     * A Data-Out PDU being transmitted right now must be sent completely to keep the
+     * stream in sync. It references the data buffers of the request, so the completion
+     * is deferred until the PDU is sent (see iscsiPDUTxFree()).
+     */
+    if (pIScsiCmd->cDataOutPdus)
+    {
+        iscsiPDUTxDropDataOut(pImage, pIScsiCmd);
+        if (pIScsiCmd->cDataOutPdus)
+        {
+            pIScsiCmd->fCompletePending = true;
+            pIScsiCmd->rcCmdPending     = rcCmd;
+            return;
+        }
+    }
+
     /* Call completion callback. */
     pIScsiCmd->pfnComplete(pImage, rcCmd, pIScsiCmd->pvUser);
 
@@ -3357,14 +3729,15 @@ static PISCSICMD iscsiPDURxTxClear(PISCSIIMAGE pImage)
         pIScsiPDUTx = pImage->pIScsiPDUTxHead;
         pImage->pIScsiPDUTxHead = pIScsiPDUTx->pNext;
 
+        /* Data-Out PDUs belong to commands already waiting for a response. */
         PISCSICMD pIScsiCmd = pIScsiPDUTx->pIScsiCmd;
-        if (pIScsiCmd)
+        if (pIScsiCmd && !pIScsiPDUTx->fDataOut)
         {
             /* Place on command list. */
             pIScsiCmd->pNext = pIScsiCmdHead;
             pIScsiCmdHead = pIScsiCmd;
         }
-        RTMemFree(pIScsiPDUTx);
+        iscsiPDUTxFree(pImage, pIScsiPDUTx);
     }
 
     /* Clear the tail pointer (safety precaution). */
@@ -3377,12 +3750,12 @@ static PISCSICMD iscsiPDURxTxClear(PISCSIIMAGE pImage)
 
         pImage->pIScsiPDUTxCur = NULL;
         PISCSICMD pIScsiCmd = pIScsiPDUTx->pIScsiCmd;
-        if (pIScsiCmd)
+        if (pIScsiCmd && !pIScsiPDUTx->fDataOut)
         {
             pIScsiCmd->pNext = pIScsiCmdHead;
             pIScsiCmdHead = pIScsiCmd;
         }
-        RTMemFree(pIScsiPDUTx);
+        iscsiPDUTxFree(pImage, pIScsiPDUTx);
     }
 
     return pIScsiCmdHead;
@@ -3853,6 +4226,15 @@ static int iscsiFreeImage(PISCSIIMAGE pImage, bool fDelete)
      * not signalled as an error. After all nothing bad happens. */
     if (pImage)
     {
+        /* Log out of the additional sessions first, the first entry is the image itself. */
+        for (uint32_t i = 1; i < pImage->cSessions; i++)
+        {
+            iscsiFreeImage(pImage->apSessions[i], false);
+            RTMemFree(pImage->apSessions[i]);
+            pImage->apSessions[i] = NULL;
+        }
+        pImage->cSessions = 0;
+
         if (pImage->Mutex != NIL_RTSEMMUTEX)
         {
             /* Detaching only makes sense when the mutex is there. Otherwise the
@@ -4019,6 +4401,8 @@ static int iscsiOpenImageParseCfg(PISCSIIMAGE pImage)
     bool fLunEncoded = false;
     uint32_t uWriteSplitDef = 0;
     uint32_t uTimeoutDef = 0;
+    uint32_t cOutstandingR2TDef = 0;
+    uint32_t cSessionsDef = 0;
     uint64_t uCfgTmp = 0;
     bool fHostIPDef = false;
     bool fDumpMalformedPacketsDef = false;
@@ -4027,6 +4411,10 @@ static int iscsiOpenImageParseCfg(PISCSIIMAGE pImage)
     AssertRC(rc);
     rc = RTStrToUInt32Full(s_iscsiConfigDefaultTimeout, 0, &uTimeoutDef);
     AssertRC(rc);
+    rc = RTStrToUInt32Full(s_iscsiConfigDefaultMaxOutstandingR2T, 0, &cOutstandingR2TDef);
+    AssertRC(rc);
+    rc = RTStrToUInt32Full(s_iscsiConfigDefaultSessions, 0, &cSessionsDef);
+    AssertRC(rc);
     rc = RTStrToUInt64Full(s_iscsiConfigDefaultHostIPStack, 0, &uCfgTmp);
     AssertRC(rc);
     fHostIPDef = RT_BOOL(uCfgTmp);
@@ -4048,7 +4436,9 @@ static int iscsiOpenImageParseCfg(PISCSIIMAGE pImage)
                            "WriteSplit\0"
                            "Timeout\0"
                            "HostIPStack\0"
-                           "DumpMalformedPackets\0"))
+                           "DumpMalformedPackets\0"
+                           "MaxOutstandingR2T\0"
+                           "Sessions\0"))
         return vdIfError(pImage->pIfError, VERR_VD_UNKNOWN_CFG_VALUES, RT_SRC_POS, N_("iSCSI: configuration error: unknown configuration keys present"));
 
     /* Query the iSCSI upper level configuration. */
@@ -4154,6 +4544,22 @@ static int iscsiOpenImageParseCfg(PISCSIIMAGE pImage)
     if (RT_FAILURE(rc))
         return vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("iSCSI: configuration error: failed to read DumpMalformedPackets as boolean"));
 
+    rc = VDCFGQueryU32Def(pImage->pIfConfig, "MaxOutstandingR2T", &pImage->cOutstandingR2TCfg, cOutstandingR2TDef);
+    if (RT_FAILURE(rc))
+        return vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("iSCSI: configuration error: failed to read MaxOutstandingR2T as U32"));
+    if (   !pImage->cOutstandingR2TCfg
+        || pImage->cOutstandingR2TCfg > ISCSI_OUTSTANDING_R2T_MAX)
+        return vdIfError(pImage->pIfError, VERR_OUT_OF_RANGE, RT_SRC_POS, N_("iSCSI: configuration error: MaxOutstandingR2T out of range (1-%u)"),
+                         ISCSI_OUTSTANDING_R2T_MAX);
+
+    rc = VDCFGQueryU32Def(pImage->pIfConfig, "Sessions", &pImage->cSessionsCfg, cSessionsDef);
+    if (RT_FAILURE(rc))
+        return vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("iSCSI: configuration error: failed to read Sessions as U32"));
+    if (   !pImage->cSessionsCfg
+        || pImage->cSessionsCfg > ISCSI_SESSIONS_MAX)
+        return vdIfError(pImage->pIfError, VERR_OUT_OF_RANGE, RT_SRC_POS, N_("iSCSI: configuration error: Sessions out of range (1-%u)"),
+                         ISCSI_SESSIONS_MAX);
+
     return VINF_SUCCESS;
 }
 
@@ -4695,6 +5101,83 @@ static int iscsiOpenImageEnableReadWriteCache(PISCSIIMAGE pImage)
     return rc;
 }
 
+/**
+ * Establishes the additional sessions to the target commands are distributed over.
+ *
+ * Each session is a complete initiator instance with its own connection, I/O thread
+ * and sequence numbers. Failing to establish a session is not fatal, the image
+ * continues with the sessions established so far.
+ *
+ * @returns VBox status code.
+ * @param   pImage          The iSCSI image instance.
+ */
+static int iscsiOpenImageSessions(PISCSIIMAGE pImage)
+{
+    pImage->apSessions[0] = pImage;
+    pImage->cSessions     = 1;
+
+    while (pImage->cSessions < pImage->cSessionsCfg)
+    {
+        PISCSIIMAGE pSession = (PISCSIIMAGE)RTMemAllocZ(RT_UOFFSETOF(ISCSIIMAGE, RegionList.aRegions[1]));
+        if (!pSession)
+            break;
+
+        pSession->pszFilename   = pImage->pszFilename;
+        pSession->pVDIfsDisk    = pImage->pVDIfsDisk;
+        pSession->pVDIfsImage   = pImage->pVDIfsImage;
+        pSession->uOpenFlags    = pImage->uOpenFlags;
+        pSession->cLogRelErrors = 0;
+
+        int rc = iscsiOpenImageInit(pSession);
+        if (RT_SUCCESS(rc))
+            rc = iscsiOpenImageParseCfg(pSession);
+        if (RT_SUCCESS(rc))
+            rc = iscsiOpenImageSocketCreate(pSession);
+        if (   RT_SUCCESS(rc)
+            && !pSession->fExtendedSelectSupported)
+            rc = VERR_NOT_SUPPORTED;
+        if (RT_SUCCESS(rc))
+        {
+            /* Take over what the first session found out about the target. */
+            pSession->LUN                  = pImage->LUN;
+            pSession->cbSector             = pImage->cbSector;
+            pSession->cVolume              = pImage->cVolume;
+            pSession->cbSize               = pImage->cbSize;
+            pSession->fCmdQueuingSupported = pImage->fCmdQueuingSupported;
+            pSession->fTargetReadOnly      = pImage->fTargetReadOnly;
+
+            rc = iscsiExecSync(pSession, iscsiAttach, pSession);
+        }
+
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("iSCSI: could not establish session %u to target %s, rc=%Rrc\n",
+                    pImage->cSessions, pImage->pszTargetName, rc));
+            iscsiFreeImage(pSession, false);
+            RTMemFree(pSession);
+            break;
+        }
+
+        pImage->apSessions[pImage->cSessions++] = pSession;
+    }
+
+    LogRel(("iSCSI: distributing commands over %u session(s) to target %s\n",
+            pImage->cSessions, pImage->pszTargetName));
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: Returns the session to issue the next read or write command on.
+ */
+DECLINLINE(PISCSIIMAGE) iscsiSessionGet(PISCSIIMAGE pImage)
+{
+    if (pImage->cSessions <= 1)
+        return pImage;
+
+    uint32_t idxSession = ASMAtomicIncU32(&pImage->idxSessionNext) % pImage->cSessions;
+    return pImage->apSessions[idxSession];
+}
+
 /**
  * Internal: Open an image, constructing all necessary data structures.
  */
@@ -4737,6 +5220,10 @@ static int iscsiOpenImage(PISCSIIMAGE pImage, unsigned uOpenFlags)
                         rc = iscsiOpenImageQueryTargetSizes(pImage);
                     if (RT_SUCCESS(rc))
                         rc = iscsiOpenImageEnableReadWriteCache(pImage);
+                    if (   RT_SUCCESS(rc)
+                        && pImage->cSessionsCfg > 1
+                        && pImage->fExtendedSelectSupported)
+                        rc = iscsiOpenImageSessions(pImage);
                 }
                 else
                     LogRel(("iSCSI: could not open target %s, rc=%Rrc\n", pImage->pszTargetName, rc));
@@ -4958,7 +5445,7 @@ static DECLCALLBACK(int) iscsiRead(void *pBackendData, uint64_t uOffset, size_t
 
         if (vdIfIoIntIoCtxIsSynchronous(pImage->pIfIo, pIoCtx))
         {
-            rc = iscsiCommandSync(pImage, pReq, true, VERR_READ_ERROR);
+            rc = iscsiCommandSync(iscsiSessionGet(pImage), pReq, true, VERR_READ_ERROR);
             if (RT_FAILURE(rc))
             {
                 LogFlow(("iscsiCommandSync(%s, %#llx) -> %Rrc\n", pImage->pszTargetName, uOffset, rc));
@@ -4969,7 +5456,7 @@ static DECLCALLBACK(int) iscsiRead(void *pBackendData, uint64_t uOffset, size_t
         }
         else
         {
-            rc = iscsiCommandAsync(pImage, pReq, iscsiCommandAsyncComplete, pReq);
+            rc = iscsiCommandAsync(iscsiSessionGet(pImage), pReq, iscsiCommandAsyncComplete, pReq);
             if (RT_FAILURE(rc))
                 AssertMsgFailed(("iscsiCommandAsync(%s, %#llx) -> %Rrc\n", pImage->pszTargetName, uOffset, rc));
             else
@@ -5007,9 +5494,15 @@ static DECLCALLBACK(int) iscsiWrite(void *pBackendData, uint64_t uOffset, size_t
         return VERR_INVALID_PARAMETER;
 
     /*
-     * Clip read size to a value which is supported by the target.
+     * Clip write size to a value which is supported by the target. The I/O thread
+     * answers R2Ts for the data exceeding the immediate data, otherwise everything
+     * has to fit into the command PDU. The transfer length field of the CDB is only
+     * 16 bits wide.
      */
-    cbToWrite = RT_MIN(cbToWrite, pImage->cbSendDataLength);
+    if (pImage->fExtendedSelectSupported)
+        cbToWrite = RT_MIN(cbToWrite, RT_MIN(pImage->cbWriteSplit, 0xffff * pImage->cbSector));
+    else
+        cbToWrite = RT_MIN(cbToWrite, pImage->cbSendDataLength);
 
     unsigned cI2TSegs = 0;
     size_t   cbSegs = 0;
@@ -5085,7 +5578,7 @@ static DECLCALLBACK(int) iscsiWrite(void *pBackendData, uint64_t uOffset, size_t
 
         if (vdIfIoIntIoCtxIsSynchronous(pImage->pIfIo, pIoCtx))
         {
-            rc = iscsiCommandSync(pImage, pReq, true, VERR_WRITE_ERROR);
+            rc = iscsiCommandSync(iscsiSessionGet(pImage), pReq, true, VERR_WRITE_ERROR);
             if (RT_FAILURE(rc))
             {
                 LogFlow(("iscsiCommandSync(%s, %#llx) -> %Rrc\n", pImage->pszTargetName, uOffset, rc));
@@ -5096,7 +5589,7 @@ static DECLCALLBACK(int) iscsiWrite(void *pBackendData, uint64_t uOffset, size_t
         }
         else
         {
-            rc = iscsiCommandAsync(pImage, pReq, iscsiCommandAsyncComplete, pReq);
+            rc = iscsiCommandAsync(iscsiSessionGet(pImage), pReq, iscsiCommandAsyncComplete, pReq);
             if (RT_FAILURE(rc))
                 AssertMsgFailed(("iscsiCommandAsync(%s, %#llx) -> %Rrc\n", pImage->pszTargetName, uOffset, rc));
             else
@@ -5338,6 +5831,12 @@ static DECLCALLBACK(int) iscsiSetOpenFlags(void *pBackendData, unsigned uOpenFla
     {
         pImage->uOpenFlags = uOpenFlags;
         pImage->fTryReconnect = true;
+
+        for (uint32_t i = 1; i < pImage->cSessions; i++)
+        {
+            pImage->apSessions[i]->uOpenFlags    = uOpenFlags;
+            pImage->apSessions[i]->fTryReconnect = true;
+        }
     }
 
     LogFlowFunc(("returns %Rrc\n", rc));
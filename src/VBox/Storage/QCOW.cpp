@@ -31,9 +31,13 @@
 #include <iprt/path.h>
 #include <iprt/list.h>
 #include <iprt/zip.h>
+#include <iprt/critsect.h>
+#include <iprt/req.h>
+#include <iprt/sg.h>
 
 #include "VDBackends.h"
 #include "VDBackendsInline.h"
+#include "VDMetaCache.h"
 
 /** @page pg_storage_qcow   QCOW Storage Backend
  * The QCOW backend implements support for the qemu copy on write format (short QCOW).
@@ -182,20 +186,35 @@ typedef QCowHeader *PQCowHeader;
  */
 typedef struct QCOWL2CACHEENTRY
 {
-    /** List node for the search list. */
-    RTLISTNODE              NodeSearch;
-    /** List node for the LRU list. */
-    RTLISTNODE              NodeLru;
-    /** Reference counter. */
-    uint32_t                cRefs;
-    /** The offset of the L2 table, used as search key. */
+    /** The metadata cache entry, keyed by the offset of the L2 table. */
+    VDMETACACHEENTRY        Core;
+    /** The offset of the L2 table. */
     uint64_t                offL2Tbl;
-    /** Pointer to the cached L2 table. */
+    /** Pointer to the cached L2 table (points to the cache entry data). */
     uint64_t               *paL2Tbl;
 } QCOWL2CACHEENTRY, *PQCOWL2CACHEENTRY;
 
-/** Maximum amount of memory the cache is allowed to use. */
-#define QCOW_L2_CACHE_MEMORY_MAX (2*_1M)
+/** Default amount of memory the cache is allowed to use, see VD_METACACHE_CFGKEY_SIZE. */
+#define QCOW_L2_CACHE_MEMORY_DEFAULT (2*_1M)
+
+/**
+ * Decompressed cluster cache entry.
+ */
+typedef struct QCOWCLUSTERCACHEENTRY
+{
+    /** List node for the LRU list. */
+    RTLISTNODE              NodeLru;
+    /** Offset of the compressed cluster in the image, used as search key.
+     * UINT64_MAX if the entry is unused. */
+    uint64_t                offFile;
+    /** The decompressed cluster data, NULL if not allocated yet. */
+    void                   *pvCluster;
+} QCOWCLUSTERCACHEENTRY, *PQCOWCLUSTERCACHEENTRY;
+
+/** Default number of decompressed clusters to cache. */
+#define QCOW_CLUSTER_CACHE_ENTRIES_DEFAULT (16)
+/** Default maximum number of threads inflating compressed clusters. */
+#define QCOW_INFLATE_THREADS_DEFAULT (2)
 
 /** QCOW default cluster size for image version 2. */
 #define QCOW2_CLUSTER_SIZE_DEFAULT (64*_1K)
@@ -271,12 +290,8 @@ typedef struct QCOWIMAGE
     uint32_t            cbL2Table;
     /** Number of entries in the L2 table. */
     uint32_t            cL2TableEntries;
-    /** Memory occupied by the L2 table cache. */
-    size_t              cbL2Cache;
-    /** The sorted L2 entry list used for searching. */
-    RTLISTNODE          ListSearch;
-    /** The LRU L2 entry list used for eviction. */
-    RTLISTNODE          ListLru;
+    /** The L2 table cache. */
+    PVDMETACACHE        pL2Cache;
 
     /** Offset of the refcount table. */
     uint64_t            offRefcountTable;
@@ -303,6 +318,24 @@ typedef struct QCOWIMAGE
     /** Buffer to hold the uncompressed data. */
     void                *pvCluster;
 
+    /** Critical section protecting the decompressed cluster cache. */
+    RTCRITSECT          CritSectClusterCache;
+    /** The LRU list of the decompressed cluster cache, most recently used first. */
+    RTLISTNODE          ListClusterCacheLru;
+    /** Array of decompressed cluster cache entries, NULL if the cache is disabled. */
+    PQCOWCLUSTERCACHEENTRY paClusterCache;
+    /** Number of entries in the decompressed cluster cache. */
+    uint32_t            cClusterCacheEntries;
+    /** Maximum number of threads inflating compressed clusters for asynchronous
+     * requests, 0 to inflate them in the context of the request. */
+    uint32_t            cInflateThreadsMax;
+    /** Request pool inflating compressed clusters, created on first use. */
+    RTREQPOOL           hReqPoolInflate;
+    /** Number of inflate requests currently being processed. */
+    volatile uint32_t   cInflateReqsPending;
+    /** List of inflate requests reading compressed data from the image. */
+    RTLISTANCHOR        ListInflateReads;
+
     /** Pointer to the L2 table we are currently allocating
      * (can be only one at a time). */
     PQCOWL2CACHEENTRY   pL2TblAlloc;
@@ -310,6 +343,38 @@ typedef struct QCOWIMAGE
     VDREGIONLIST        RegionList;
 } QCOWIMAGE, *PQCOWIMAGE;
 
+/**
+ * Request to read a compressed cluster and inflate it on a worker thread.
+ */
+typedef struct QCOWINFLATEREQ
+{
+    /** Node for the list of reads in flight or the waiting list of the
+     * read this one overlaps with. */
+    RTLISTNODE          NodeRead;
+    /** List of requests waiting for this read to complete. */
+    RTLISTANCHOR        ListWaiting;
+    /** The image instance data. */
+    PQCOWIMAGE          pImage;
+    /** The halted I/O context to complete. */
+    PVDIOCTX            pIoCtx;
+    /** Offset of the compressed cluster in the image. */
+    uint64_t            offFile;
+    /** Size of the compressed cluster in bytes. */
+    size_t              cbCompressedCluster;
+    /** Where to start reading in the uncompressed cluster. */
+    uint32_t            offCluster;
+    /** How much to copy from the uncompressed cluster. */
+    size_t              cbToRead;
+    /** Buffer holding the compressed data. */
+    void               *pvCompCluster;
+    /** Buffer holding the uncompressed data, handed over to the cache. */
+    void               *pvCluster;
+    /** Number of segments of the I/O context to copy the data to. */
+    unsigned            cSegs;
+    /** The segments of the I/O context - variable size. */
+    RTSGSEG             aSegs[1];
+} QCOWINFLATEREQ, *PQCOWINFLATEREQ;
+
 /**
  * State of the async cluster allocation.
  */
@@ -363,6 +428,21 @@ static const VDFILEEXTENSION s_aQCowFileExtensions[] =
     {NULL,  VDTYPE_INVALID}
 };
 
+static const char *s_pszQCowClusterCacheEntriesDefault = "16";
+static const char *s_pszQCowInflateThreadsDefault      = "2";
+static const char *s_pszQCowMetaCacheSizeDefault       = "2097152";
+static const char *s_pszQCowMetaCacheSizeMaxDefault    = "33554432";
+
+/** Configuration keys for the L2 table and decompressed cluster caches. */
+static const VDCONFIGINFO s_aQCowConfigInfo[] =
+{
+    { "ClusterCacheEntries",          s_pszQCowClusterCacheEntriesDefault, VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { "InflateThreads",               s_pszQCowInflateThreadsDefault,      VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { VD_METACACHE_CFGKEY_SIZE,       s_pszQCowMetaCacheSizeDefault,       VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { VD_METACACHE_CFGKEY_SIZE_MAX,   s_pszQCowMetaCacheSizeMaxDefault,    VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { NULL,                           NULL,                                VDCFGVALUETYPE_INTEGER, 0 }
+};
+
 
 /*********************************************************************************************************************************
 *   Internal Functions                                                                                                           *
@@ -522,18 +602,19 @@ static void qcowTableConvertFromHostEndianess(uint64_t *paTblImg, uint64_t *paTb
 }
 
 /**
- * Creates the L2 table cache.
+ * Creates the L2 table cache, the table geometry must be known.
  *
  * @returns VBox status code.
  * @param   pImage    The image instance data.
  */
 static int qcowL2TblCacheCreate(PQCOWIMAGE pImage)
 {
-    pImage->cbL2Cache = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
+    /* There is no point in caching more than all L2 tables of the image. */
+    uint64_t cbL2TblsAll = (uint64_t)pImage->cL1TableEntries * pImage->cbL2Table;
 
-    return VINF_SUCCESS;
+    return vdMetaCacheCreate(&pImage->pL2Cache, pImage->pVDIfsImage, sizeof(QCOWL2CACHEENTRY),
+                             pImage->cbL2Table, QCOW_L2_CACHE_MEMORY_DEFAULT,
+                             (size_t)RT_MIN(cbL2TblsAll, (uint64_t)~(size_t)0));
 }
 
 /**
@@ -544,20 +625,11 @@ static int qcowL2TblCacheCreate(PQCOWIMAGE pImage)
  */
 static void qcowL2TblCacheDestroy(PQCOWIMAGE pImage)
 {
-    PQCOWL2CACHEENTRY pL2Entry;
-    PQCOWL2CACHEENTRY pL2Next;
-    RTListForEachSafe(&pImage->ListSearch, pL2Entry, pL2Next, QCOWL2CACHEENTRY, NodeSearch)
+    if (pImage->pL2Cache)
     {
-        Assert(!pL2Entry->cRefs);
-
-        RTListNodeRemove(&pL2Entry->NodeSearch);
-        RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbL2Table);
-        RTMemFree(pL2Entry);
+        vdMetaCacheDestroy(pImage->pL2Cache);
+        pImage->pL2Cache = NULL;
     }
-
-    pImage->cbL2Cache       = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
 }
 
 /**
@@ -572,26 +644,13 @@ static PQCOWL2CACHEENTRY qcowL2TblCacheRetain(PQCOWIMAGE pImage, uint64_t offL2T
     if (   pImage->pL2TblAlloc
         && pImage->pL2TblAlloc->offL2Tbl == offL2Tbl)
     {
-        pImage->pL2TblAlloc->cRefs++;
+        pImage->pL2TblAlloc->Core.cRefs++;
         return pImage->pL2TblAlloc;
     }
 
-    PQCOWL2CACHEENTRY pL2Entry;
-    RTListForEach(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch)
-    {
-        if (pL2Entry->offL2Tbl == offL2Tbl)
-            break;
-    }
-
-    if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch))
-    {
-        /* Update LRU list. */
-        RTListNodeRemove(&pL2Entry->NodeLru);
-        RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
-        pL2Entry->cRefs++;
-        return pL2Entry;
-    }
-
+    PVDMETACACHEENTRY pEntry = vdMetaCacheRetain(pImage->pL2Cache, offL2Tbl);
+    if (pEntry)
+        return RT_FROM_MEMBER(pEntry, QCOWL2CACHEENTRY, Core);
     return NULL;
 }
 
@@ -603,8 +662,7 @@ static PQCOWL2CACHEENTRY qcowL2TblCacheRetain(PQCOWIMAGE pImage, uint64_t offL2T
  */
 static void qcowL2TblCacheEntryRelease(PQCOWL2CACHEENTRY pL2Entry)
 {
-    Assert(pL2Entry->cRefs > 0);
-    pL2Entry->cRefs--;
+    vdMetaCacheEntryRelease(&pL2Entry->Core);
 }
 
 /**
@@ -615,50 +673,16 @@ static void qcowL2TblCacheEntryRelease(PQCOWL2CACHEENTRY pL2Entry)
  */
 static PQCOWL2CACHEENTRY qcowL2TblCacheEntryAlloc(PQCOWIMAGE pImage)
 {
-    PQCOWL2CACHEENTRY pL2Entry = NULL;
-
-    if (pImage->cbL2Cache + pImage->cbL2Table <= QCOW_L2_CACHE_MEMORY_MAX)
+    PVDMETACACHEENTRY pEntry = vdMetaCacheEntryAlloc(pImage->pL2Cache);
+    if (pEntry)
     {
-        /* Add a new entry. */
-        pL2Entry = (PQCOWL2CACHEENTRY)RTMemAllocZ(sizeof(QCOWL2CACHEENTRY));
-        if (pL2Entry)
-        {
-            pL2Entry->paL2Tbl = (uint64_t *)RTMemPageAllocZ(pImage->cbL2Table);
-            if (RT_UNLIKELY(!pL2Entry->paL2Tbl))
-            {
-                RTMemFree(pL2Entry);
-                pL2Entry = NULL;
-            }
-            else
-            {
-                pL2Entry->cRefs    = 1;
-                pImage->cbL2Cache += pImage->cbL2Table;
-            }
-        }
-    }
-    else
-    {
-        /* Evict the last not in use entry and use it */
-        Assert(!RTListIsEmpty(&pImage->ListLru));
-
-        RTListForEachReverse(&pImage->ListLru, pL2Entry, QCOWL2CACHEENTRY, NodeLru)
-        {
-            if (!pL2Entry->cRefs)
-                break;
-        }
-
-        if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch))
-        {
-            RTListNodeRemove(&pL2Entry->NodeSearch);
-            RTListNodeRemove(&pL2Entry->NodeLru);
-            pL2Entry->offL2Tbl = 0;
-            pL2Entry->cRefs    = 1;
-        }
-        else
-            pL2Entry = NULL;
+        PQCOWL2CACHEENTRY pL2Entry = RT_FROM_MEMBER(pEntry, QCOWL2CACHEENTRY, Core);
+        pL2Entry->offL2Tbl = 0;
+        pL2Entry->paL2Tbl  = (uint64_t *)pEntry->pvData;
+        return pL2Entry;
     }
 
-    return pL2Entry;
+    return NULL;
 }
 
 /**
@@ -670,11 +694,7 @@ static PQCOWL2CACHEENTRY qcowL2TblCacheEntryAlloc(PQCOWIMAGE pImage)
  */
 static void qcowL2TblCacheEntryFree(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2Entry)
 {
-    Assert(!pL2Entry->cRefs);
-    RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbL2Table);
-    RTMemFree(pL2Entry);
-
-    pImage->cbL2Cache -= pImage->cbL2Table;
+    vdMetaCacheEntryFree(pImage->pL2Cache, &pL2Entry->Core);
 }
 
 /**
@@ -683,42 +703,12 @@ static void qcowL2TblCacheEntryFree(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2Entr
  * @returns nothing.
  * @param   pImage    The image instance data.
  * @param   pL2Entry  The L2 cache entry to insert.
+ * @param   idxL1     The L1 table index referencing the L2 table.
  */
-static void qcowL2TblCacheEntryInsert(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2Entry)
+static void qcowL2TblCacheEntryInsert(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2Entry, uint32_t idxL1)
 {
     Assert(pL2Entry->offL2Tbl > 0);
-
-    /* Insert at the top of the LRU list. */
-    RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
-
-    if (RTListIsEmpty(&pImage->ListSearch))
-    {
-        RTListAppend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-    }
-    else
-    {
-        /* Insert into search list. */
-        PQCOWL2CACHEENTRY pIt;
-        pIt = RTListGetFirst(&pImage->ListSearch, QCOWL2CACHEENTRY, NodeSearch);
-        if (pIt->offL2Tbl > pL2Entry->offL2Tbl)
-            RTListPrepend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-        else
-        {
-            bool fInserted = false;
-
-            RTListForEach(&pImage->ListSearch, pIt, QCOWL2CACHEENTRY, NodeSearch)
-            {
-                Assert(pIt->offL2Tbl != pL2Entry->offL2Tbl);
-                if (pIt->offL2Tbl < pL2Entry->offL2Tbl)
-                {
-                    RTListNodeInsertAfter(&pIt->NodeSearch, &pL2Entry->NodeSearch);
-                    fInserted = true;
-                    break;
-                }
-            }
-            Assert(fInserted);
-        }
-    }
+    vdMetaCacheEntryInsert(pImage->pL2Cache, &pL2Entry->Core, pL2Entry->offL2Tbl, idxL1);
 }
 
 /**
@@ -728,10 +718,11 @@ static void qcowL2TblCacheEntryInsert(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2En
  * @returns VBox status code.
  * @param   pImage    Image instance data.
  * @param   pIoCtx    The I/O context.
+ * @param   idxL1     The L1 table index referencing the L2 table.
  * @param   offL2Tbl  The offset of the L2 table in the image.
  * @param   ppL2Entry Where to store the L2 table on success.
  */
-static int qcowL2TblCacheFetch(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint64_t offL2Tbl,
+static int qcowL2TblCacheFetch(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxL1, uint64_t offL2Tbl,
                                PQCOWL2CACHEENTRY *ppL2Entry)
 {
     int rc = VINF_SUCCESS;
@@ -758,7 +749,7 @@ static int qcowL2TblCacheFetch(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint64_t offL
 #if defined(RT_LITTLE_ENDIAN)
                 qcowTableConvertToHostEndianess(pL2Entry->paL2Tbl, pImage->cL2TableEntries);
 #endif
-                qcowL2TblCacheEntryInsert(pImage, pL2Entry);
+                qcowL2TblCacheEntryInsert(pImage, pL2Entry, idxL1);
             }
             else
             {
@@ -776,6 +767,171 @@ static int qcowL2TblCacheFetch(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint64_t offL
     return rc;
 }
 
+/**
+ * Creates the decompressed cluster cache.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image instance data.
+ */
+static int qcowClusterCacheCreate(PQCOWIMAGE pImage)
+{
+    PVDINTERFACECONFIG pImgCfg = VDIfConfigGet(pImage->pVDIfsImage);
+    uint32_t cEntries = QCOW_CLUSTER_CACHE_ENTRIES_DEFAULT;
+    int rc = VINF_SUCCESS;
+
+    pImage->cInflateThreadsMax   = QCOW_INFLATE_THREADS_DEFAULT;
+    pImage->hReqPoolInflate      = NIL_RTREQPOOL;
+    pImage->cInflateReqsPending  = 0;
+    pImage->paClusterCache       = NULL;
+    RTListInit(&pImage->ListInflateReads);
+    pImage->cClusterCacheEntries = 0;
+    RTListInit(&pImage->ListClusterCacheLru);
+
+    if (pImgCfg)
+    {
+        rc = VDCFGQueryU32Def(pImgCfg, "ClusterCacheEntries", &cEntries,
+                              QCOW_CLUSTER_CACHE_ENTRIES_DEFAULT);
+        if (RT_SUCCESS(rc))
+            rc = VDCFGQueryU32Def(pImgCfg, "InflateThreads", &pImage->cInflateThreadsMax,
+                                  QCOW_INFLATE_THREADS_DEFAULT);
+        if (RT_FAILURE(rc))
+            return vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                             N_("QCow: Querying the cluster cache configuration for '%s' failed"),
+                             pImage->pszFilename);
+    }
+
+    /* The cache is required for inflating clusters on worker threads. */
+    if (!cEntries)
+    {
+        pImage->cInflateThreadsMax = 0;
+        return VINF_SUCCESS;
+    }
+
+    rc = RTCritSectInit(&pImage->CritSectClusterCache);
+    if (RT_SUCCESS(rc))
+    {
+        pImage->paClusterCache = (PQCOWCLUSTERCACHEENTRY)RTMemAllocZ(cEntries * sizeof(QCOWCLUSTERCACHEENTRY));
+        if (pImage->paClusterCache)
+        {
+            /* The buffers are allocated when an entry is used for the first time. */
+            for (uint32_t i = 0; i < cEntries; i++)
+            {
+                pImage->paClusterCache[i].offFile = UINT64_MAX;
+                RTListAppend(&pImage->ListClusterCacheLru, &pImage->paClusterCache[i].NodeLru);
+            }
+            pImage->cClusterCacheEntries = cEntries;
+        }
+        else
+        {
+            RTCritSectDelete(&pImage->CritSectClusterCache);
+            rc = VERR_NO_MEMORY;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * Destroys the decompressed cluster cache and the inflate request pool.
+ *
+ * @returns nothing.
+ * @param   pImage    The image instance data.
+ */
+static void qcowClusterCacheDestroy(PQCOWIMAGE pImage)
+{
+    /* The VD layer doesn't close an image with requests in flight. */
+    Assert(!ASMAtomicReadU32(&pImage->cInflateReqsPending));
+
+    if (pImage->hReqPoolInflate != NIL_RTREQPOOL)
+    {
+        RTReqPoolRelease(pImage->hReqPoolInflate);
+        pImage->hReqPoolInflate = NIL_RTREQPOOL;
+    }
+
+    if (pImage->paClusterCache)
+    {
+        for (uint32_t i = 0; i < pImage->cClusterCacheEntries; i++)
+            if (pImage->paClusterCache[i].pvCluster)
+                RTMemFree(pImage->paClusterCache[i].pvCluster);
+
+        RTMemFree(pImage->paClusterCache);
+        pImage->paClusterCache       = NULL;
+        pImage->cClusterCacheEntries = 0;
+        RTListInit(&pImage->ListClusterCacheLru);
+        RTCritSectDelete(&pImage->CritSectClusterCache);
+    }
+}
+
+/**
+ * Copies data from a cached decompressed cluster into the given I/O context.
+ *
+ * @returns true if the cluster was found in the cache, false otherwise.
+ * @param   pImage        The image instance data.
+ * @param   pIoCtx        The I/O context.
+ * @param   offFile       Offset of the compressed cluster in the image.
+ * @param   offCluster    Where to start reading in the uncompressed cluster.
+ * @param   cbToRead      How much to read.
+ */
+static bool qcowClusterCacheRead(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint64_t offFile,
+                                 uint32_t offCluster, size_t cbToRead)
+{
+    bool fHit = false;
+
+    if (!pImage->paClusterCache)
+        return false;
+
+    RTCritSectEnter(&pImage->CritSectClusterCache);
+    PQCOWCLUSTERCACHEENTRY pEntry;
+    RTListForEach(&pImage->ListClusterCacheLru, pEntry, QCOWCLUSTERCACHEENTRY, NodeLru)
+    {
+        if (pEntry->offFile == offFile)
+        {
+            vdIfIoIntIoCtxCopyTo(pImage->pIfIo, pIoCtx,
+                                 (uint8_t *)pEntry->pvCluster + offCluster, cbToRead);
+
+            /* Move to the front of the LRU list. */
+            RTListNodeRemove(&pEntry->NodeLru);
+            RTListPrepend(&pImage->ListClusterCacheLru, &pEntry->NodeLru);
+            fHit = true;
+            break;
+        }
+        if (pEntry->offFile == UINT64_MAX)
+            break; /* Unused entries are only at the end. */
+    }
+    RTCritSectLeave(&pImage->CritSectClusterCache);
+
+    return fHit;
+}
+
+/**
+ * Inserts a decompressed cluster into the cache, evicting the least recently
+ * used entry.
+ *
+ * @returns nothing.
+ * @param   pImage        The image instance data.
+ * @param   offFile       Offset of the compressed cluster in the image.
+ * @param   ppvCluster    Pointer to the buffer holding the decompressed cluster.
+ *                        The buffer is exchanged with the buffer of the evicted
+ *                        entry to avoid copying and might be NULL on return.
+ */
+static void qcowClusterCacheInsert(PQCOWIMAGE pImage, uint64_t offFile, void **ppvCluster)
+{
+    if (!pImage->paClusterCache)
+        return;
+
+    RTCritSectEnter(&pImage->CritSectClusterCache);
+    PQCOWCLUSTERCACHEENTRY pEntry = RTListGetLast(&pImage->ListClusterCacheLru, QCOWCLUSTERCACHEENTRY, NodeLru);
+    void *pvClusterOld = pEntry->pvCluster;
+
+    pEntry->pvCluster = *ppvCluster;
+    pEntry->offFile   = offFile;
+    *ppvCluster       = pvClusterOld;
+
+    RTListNodeRemove(&pEntry->NodeLru);
+    RTListPrepend(&pImage->ListClusterCacheLru, &pEntry->NodeLru);
+    RTCritSectLeave(&pImage->CritSectClusterCache);
+}
+
 /**
  * Sets the L1, L2 and offset bitmasks and L1 and L2 bit shift members.
  *
@@ -893,7 +1049,7 @@ static int qcowConvertToImageOffset(PQCOWIMAGE pImage, PVDIOCTX pIoCtx,
         uint64_t offL2Tbl = pImage->paL1Table[idxL1];
         if (pImage->uVersion == 2)
             offL2Tbl &= QCOW_V2_TBL_OFFSET_MASK;
-        rc = qcowL2TblCacheFetch(pImage, pIoCtx, offL2Tbl, &pL2Entry);
+        rc = qcowL2TblCacheFetch(pImage, pIoCtx, idxL1, offL2Tbl, &pL2Entry);
         if (RT_SUCCESS(rc))
         {
             /* Get real file offset. */
@@ -1089,6 +1245,7 @@ static int qcowFreeImage(PQCOWIMAGE pImage, bool fDelete)
         }
 
         qcowL2TblCacheDestroy(pImage);
+        qcowClusterCacheDestroy(pImage);
 
         if (fDelete && pImage->pszFilename)
             vdIfIoIntFileDelete(pImage->pIfIo, pImage->pszFilename);
@@ -1175,7 +1332,7 @@ static int qcowOpenImage(PQCOWIMAGE pImage, unsigned uOpenFlags)
     pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
     AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
 
-    int rc = qcowL2TblCacheCreate(pImage);
+    int rc = qcowClusterCacheCreate(pImage);
     if (RT_SUCCESS(rc))
     {
         /* Open the image. */
@@ -1281,6 +1438,15 @@ static int qcowOpenImage(PQCOWIMAGE pImage, unsigned uOpenFlags)
                                                N_("QCOW: L1 table size overflow in image '%s'"),
                                                pImage->pszFilename);
                         }
+
+                        if (RT_SUCCESS(rc))
+                        {
+                            rc = qcowL2TblCacheCreate(pImage);
+                            if (RT_FAILURE(rc))
+                                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                                               N_("QCow: Failed to create L2 cache for image '%s'"),
+                                               pImage->pszFilename);
+                        }
                     }
 
                     /** @todo Check that there are no compressed clusters in the image
@@ -1407,38 +1573,39 @@ static int qcowCreateImage(PQCOWIMAGE pImage, uint64_t cbSize,
 
     if (!(uImageFlags & VD_IMAGE_FLAGS_FIXED))
     {
-        rc = qcowL2TblCacheCreate(pImage);
+        pImage->uOpenFlags   = uOpenFlags & ~VD_OPEN_FLAGS_READONLY;
+        pImage->uImageFlags  = uImageFlags;
+        pImage->PCHSGeometry = *pPCHSGeometry;
+        pImage->LCHSGeometry = *pLCHSGeometry;
+        pImage->pIfError = VDIfErrorGet(pImage->pVDIfsDisk);
+        pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
+        AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
+
+        /* Create image file. */
+        fOpen = VDOpenFlagsToFileOpenFlags(pImage->uOpenFlags, true /* fCreate */);
+        rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename, fOpen, &pImage->pStorage);
         if (RT_SUCCESS(rc))
         {
-            pImage->uOpenFlags   = uOpenFlags & ~VD_OPEN_FLAGS_READONLY;
-            pImage->uImageFlags  = uImageFlags;
-            pImage->PCHSGeometry = *pPCHSGeometry;
-            pImage->LCHSGeometry = *pLCHSGeometry;
-            pImage->pIfError = VDIfErrorGet(pImage->pVDIfsDisk);
-            pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
-            AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
-
-            /* Create image file. */
-            fOpen = VDOpenFlagsToFileOpenFlags(pImage->uOpenFlags, true /* fCreate */);
-            rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename, fOpen, &pImage->pStorage);
+            /* Init image state. */
+            pImage->uVersion           = 1; /* We create only version 1 images at the moment. */
+            pImage->cbSize             = cbSize;
+            pImage->cbCluster          = QCOW_CLUSTER_SIZE_DEFAULT;
+            pImage->cbL2Table          = qcowCluster2Byte(pImage, QCOW_L2_CLUSTERS_DEFAULT);
+            pImage->cL2TableEntries    = pImage->cbL2Table / sizeof(uint64_t);
+            pImage->cL1TableEntries    = cbSize / (pImage->cbCluster * pImage->cL2TableEntries);
+            if (cbSize % (pImage->cbCluster * pImage->cL2TableEntries))
+                pImage->cL1TableEntries++;
+            pImage->cbL1Table          = RT_ALIGN_64(pImage->cL1TableEntries * sizeof(uint64_t), pImage->cbCluster);
+            pImage->offL1Table         = QCOW_V1_HDR_SIZE;
+            pImage->cbBackingFilename  = 0;
+            pImage->offBackingFilename = 0;
+            pImage->offNextCluster     = RT_ALIGN_64(QCOW_V1_HDR_SIZE + pImage->cbL1Table, pImage->cbCluster);
+            qcowTableMasksInit(pImage);
+
+            /* The L2 cache is sized based on the table geometry. */
+            rc = qcowL2TblCacheCreate(pImage);
             if (RT_SUCCESS(rc))
             {
-                /* Init image state. */
-                pImage->uVersion           = 1; /* We create only version 1 images at the moment. */
-                pImage->cbSize             = cbSize;
-                pImage->cbCluster          = QCOW_CLUSTER_SIZE_DEFAULT;
-                pImage->cbL2Table          = qcowCluster2Byte(pImage, QCOW_L2_CLUSTERS_DEFAULT);
-                pImage->cL2TableEntries    = pImage->cbL2Table / sizeof(uint64_t);
-                pImage->cL1TableEntries    = cbSize / (pImage->cbCluster * pImage->cL2TableEntries);
-                if (cbSize % (pImage->cbCluster * pImage->cL2TableEntries))
-                    pImage->cL1TableEntries++;
-                pImage->cbL1Table          = RT_ALIGN_64(pImage->cL1TableEntries * sizeof(uint64_t), pImage->cbCluster);
-                pImage->offL1Table         = QCOW_V1_HDR_SIZE;
-                pImage->cbBackingFilename  = 0;
-                pImage->offBackingFilename = 0;
-                pImage->offNextCluster     = RT_ALIGN_64(QCOW_V1_HDR_SIZE + pImage->cbL1Table, pImage->cbCluster);
-                qcowTableMasksInit(pImage);
-
                 /* Init L1 table. */
                 pImage->paL1Table = (uint64_t *)RTMemAllocZ(pImage->cbL1Table);
                 if (RT_LIKELY(pImage->paL1Table))
@@ -1455,11 +1622,11 @@ static int qcowCreateImage(PQCOWIMAGE pImage, uint64_t cbSize,
                                    pImage->pszFilename);
             }
             else
-                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("QCow: cannot create image '%s'"), pImage->pszFilename);
+                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("QCow: Failed to create L2 cache for image '%s'"),
+                               pImage->pszFilename);
         }
         else
-            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("QCow: Failed to create L2 cache for image '%s'"),
-                           pImage->pszFilename);
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("QCow: cannot create image '%s'"), pImage->pszFilename);
     }
     else
         rc = vdIfError(pImage->pIfError, VERR_VD_INVALID_TYPE, RT_SRC_POS, N_("QCow: cannot create fixed image '%s'"), pImage->pszFilename);
@@ -1511,7 +1678,7 @@ static int qcowAsyncClusterAllocRollback(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, PQC
             /* Assumption right now is that the L1 table is not modified on storage if the link fails. */
             rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, pClusterAlloc->offNextClusterOld);
             qcowL2TblCacheEntryRelease(pClusterAlloc->pL2Entry); /* Release L2 cache entry. */
-            Assert(!pClusterAlloc->pL2Entry->cRefs);
+            Assert(!pClusterAlloc->pL2Entry->Core.cRefs);
             qcowL2TblCacheEntryFree(pImage, pClusterAlloc->pL2Entry); /* Free it, it is not in the cache yet. */
             break;
         }
@@ -1582,7 +1749,7 @@ static DECLCALLBACK(int) qcowAsyncClusterAllocUpdate(void *pBackendData, PVDIOCT
             uint64_t offData = qcowClusterAllocate(pImage, 1);
 
             pImage->pL2TblAlloc = NULL;
-            qcowL2TblCacheEntryInsert(pImage, pClusterAlloc->pL2Entry);
+            qcowL2TblCacheEntryInsert(pImage, pClusterAlloc->pL2Entry, pClusterAlloc->idxL1);
 
             pClusterAlloc->enmAllocState     = QCOWCLUSTERASYNCALLOCSTATE_USER_ALLOC;
             pClusterAlloc->offNextClusterOld = offData;
@@ -1638,6 +1805,309 @@ static DECLCALLBACK(int) qcowAsyncClusterAllocUpdate(void *pBackendData, PVDIOCT
     return rc;
 }
 
+/**
+ * Inflates a compressed cluster.
+ *
+ * @returns VBox status code.
+ * @param   pImage              The image instance data.
+ * @param   pvCompCluster       The compressed data.
+ * @param   cbCompressedCluster Size of the compressed cluster in bytes.
+ * @param   pvCluster           Where to store the uncompressed cluster.
+ */
+static int qcowInflateClusterData(PQCOWIMAGE pImage, const void *pvCompCluster, size_t cbCompressedCluster,
+                                  void *pvCluster)
+{
+    size_t cbDecomp = 0;
+
+    int rc = RTZipBlockDecompress(RTZIPTYPE_ZLIB_NO_HEADER, 0 /*fFlags*/,
+                                  pvCompCluster, cbCompressedCluster, NULL,
+                                  pvCluster, pImage->cbCluster, &cbDecomp);
+    if (RT_SUCCESS(rc))
+        Assert(cbDecomp == pImage->cbCluster);
+
+    return rc;
+}
+
+/**
+ * Reads a compressed cluster and inflates it into the given buffer.
+ *
+ * @returns VBox status code.
+ * @param   pImage              The image instance data.
+ * @param   offFile             Offset where the compressed cluster is stored in the image.
+ * @param   cbCompressedCluster Size of the compressed cluster in bytes.
+ * @param   pvCompCluster       Buffer to read the compressed data into, at least cbCompressedCluster bytes big.
+ * @param   pvCluster           Where to store the uncompressed cluster.
+ */
+static int qcowInflateCluster(PQCOWIMAGE pImage, uint64_t offFile, size_t cbCompressedCluster,
+                              void *pvCompCluster, void *pvCluster)
+{
+    int rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offFile,
+                                   pvCompCluster, cbCompressedCluster);
+    if (RT_SUCCESS(rc))
+        rc = qcowInflateClusterData(pImage, pvCompCluster, cbCompressedCluster, pvCluster);
+
+    return rc;
+}
+
+/**
+ * Frees an inflate request.
+ *
+ * @returns nothing.
+ * @param   pReq                The inflate request to free.
+ */
+static void qcowInflateReqFree(PQCOWINFLATEREQ pReq)
+{
+    if (pReq->pvCluster)
+        RTMemFree(pReq->pvCluster);
+    if (pReq->pvCompCluster)
+        RTMemFree(pReq->pvCompCluster);
+    RTMemFree(pReq);
+}
+
+/**
+ * Completes the halted I/O context of an inflate request and frees the request.
+ *
+ * @returns nothing.
+ * @param   pImage              The image instance data.
+ * @param   pReq                The inflate request.
+ * @param   rc                  The status code to complete the I/O context with.
+ */
+static void qcowInflateReqComplete(PQCOWIMAGE pImage, PQCOWINFLATEREQ pReq, int rc)
+{
+    PVDIOCTX pIoCtx   = pReq->pIoCtx;
+    size_t   cbToRead = pReq->cbToRead;
+
+    qcowInflateReqFree(pReq);
+    ASMAtomicDecU32(&pImage->cInflateReqsPending);
+    pImage->pIfIo->pfnIoCtxCompleted(pImage->pIfIo->Core.pvUser, pIoCtx, rc,
+                                     RT_SUCCESS(rc) ? cbToRead : 0);
+}
+
+/**
+ * Worker thread callback inflating a compressed cluster for an asynchronous
+ * request.
+ *
+ * @returns nothing.
+ * @param   pReq                The inflate request, freed when done.
+ */
+static DECLCALLBACK(void) qcowInflateWorker(PQCOWINFLATEREQ pReq)
+{
+    PQCOWIMAGE pImage = pReq->pImage;
+    size_t     cbToRead = pReq->cbToRead;
+
+    int rc = qcowInflateClusterData(pImage, pReq->pvCompCluster, pReq->cbCompressedCluster,
+                                    pReq->pvCluster);
+    if (RT_SUCCESS(rc))
+    {
+        /*
+         * The I/O context is halted and the segments were taken from it
+         * before queuing the request, so it is safe to copy without
+         * holding the disk lock.
+         */
+        RTSGBUF SgBuf;
+        RTSgBufInit(&SgBuf, &pReq->aSegs[0], pReq->cSegs);
+        size_t cbCopied = RTSgBufCopyFromBuf(&SgBuf, (uint8_t *)pReq->pvCluster + pReq->offCluster, cbToRead);
+        Assert(cbCopied == cbToRead); RT_NOREF(cbCopied);
+
+        qcowClusterCacheInsert(pImage, pReq->offFile, &pReq->pvCluster);
+    }
+
+    qcowInflateReqComplete(pImage, pReq, rc);
+}
+
+/**
+ * Hands the compressed data of an inflate request over to the worker pool.
+ *
+ * @returns nothing.
+ * @param   pImage              The image instance data.
+ * @param   pReq                The inflate request with the compressed data read.
+ */
+static void qcowInflateReqQueue(PQCOWIMAGE pImage, PQCOWINFLATEREQ pReq)
+{
+    int rc = RTReqPoolCallEx(pImage->hReqPoolInflate, 0 /*cMillies*/, NULL /*phReq*/,
+                             RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
+                             (PFNRT)qcowInflateWorker, 1, pReq);
+    if (RT_FAILURE(rc))
+        qcowInflateWorker(pReq);
+}
+
+static int qcowInflateReqRead(PQCOWIMAGE pImage, PQCOWINFLATEREQ pReq);
+
+/**
+ * Completion callback for the read of the compressed data of an inflate request.
+ *
+ * @returns VERR_VD_ASYNC_IO_IN_PROGRESS, the I/O context stays halted until the
+ *          data was inflated.
+ * @param   pBackendData        The opaque backend data.
+ * @param   pIoCtx              The halted I/O context.
+ * @param   pvUser              The inflate request.
+ * @param   rcReq               Status code of the read.
+ */
+static DECLCALLBACK(int) qcowInflateReqReadComplete(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PQCOWIMAGE      pImage = (PQCOWIMAGE)pBackendData;
+    PQCOWINFLATEREQ pReq   = (PQCOWINFLATEREQ)pvUser;
+    int             rc     = rcReq;
+
+    Assert(pReq->pIoCtx == pIoCtx);
+    RTListNodeRemove(&pReq->NodeRead);
+
+    if (RT_SUCCESS(rc))
+    {
+        /* The transfer is kept around until all waiters are processed, fetch the data now. */
+        PVDMETAXFER pMetaXfer = NULL;
+        rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pImage->pStorage, pReq->offFile,
+                                   pReq->pvCompCluster, pReq->cbCompressedCluster, pIoCtx,
+                                   &pMetaXfer, NULL, NULL);
+        AssertRC(rc);
+        if (RT_SUCCESS(rc))
+            vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
+    }
+
+    /* Issue the reads which overlapped with this one. */
+    RTLISTANCHOR ListWaiting;
+    RTListMove(&ListWaiting, &pReq->ListWaiting);
+    while (!RTListIsEmpty(&ListWaiting))
+    {
+        PQCOWINFLATEREQ pReqWaiting = RTListGetFirst(&ListWaiting, QCOWINFLATEREQ, NodeRead);
+        RTListNodeRemove(&pReqWaiting->NodeRead);
+
+        int rc2 = qcowInflateReqRead(pImage, pReqWaiting);
+        if (RT_FAILURE(rc2))
+            qcowInflateReqComplete(pImage, pReqWaiting, rc2);
+    }
+
+    if (RT_SUCCESS(rc))
+        qcowInflateReqQueue(pImage, pReq);
+    else
+        qcowInflateReqComplete(pImage, pReq, rc);
+
+    return VERR_VD_ASYNC_IO_IN_PROGRESS;
+}
+
+/**
+ * Reads the compressed data of an inflate request through the metadata
+ * transfer path of the I/O context, handing it to the worker pool when the
+ * data is available.
+ *
+ * Compressed clusters can share sectors with their neighbours but metadata
+ * transfers must not overlap. A request overlapping with a read in flight
+ * waits until that one completed.
+ *
+ * @returns VBox status code.
+ * @param   pImage              The image instance data.
+ * @param   pReq                The inflate request.
+ */
+static int qcowInflateReqRead(PQCOWIMAGE pImage, PQCOWINFLATEREQ pReq)
+{
+    PQCOWINFLATEREQ pIt;
+    RTListForEach(&pImage->ListInflateReads, pIt, QCOWINFLATEREQ, NodeRead)
+    {
+        if (   pReq->offFile < pIt->offFile + pIt->cbCompressedCluster
+            && pIt->offFile < pReq->offFile + pReq->cbCompressedCluster)
+        {
+            RTListAppend(&pIt->ListWaiting, &pReq->NodeRead);
+            return VINF_SUCCESS;
+        }
+    }
+
+    PVDMETAXFER pMetaXfer = NULL;
+    int rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pImage->pStorage, pReq->offFile,
+                                   pReq->pvCompCluster, pReq->cbCompressedCluster, pReq->pIoCtx,
+                                   &pMetaXfer, qcowInflateReqReadComplete, pReq);
+    if (RT_SUCCESS(rc))
+    {
+        vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
+        qcowInflateReqQueue(pImage, pReq);
+    }
+    else if (rc == VERR_VD_NOT_ENOUGH_METADATA)
+    {
+        RTListAppend(&pImage->ListInflateReads, &pReq->NodeRead);
+        rc = VINF_SUCCESS;
+    }
+
+    return rc;
+}
+
+/**
+ * Reads a compressed cluster asynchronously and inflates it on the worker pool,
+ * halting the given I/O context until the data is available.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_IOCTX_HALT if the request was queued.
+ * @retval  VERR_NO_MEMORY or VERR_NOT_SUPPORTED if the caller should inflate
+ *          the cluster synchronously instead.
+ * @param   pImage              The image instance data.
+ * @param   pIoCtx              The I/O context.
+ * @param   offCluster          Where to start reading in the uncompressed cluster.
+ * @param   cbToRead            How much to read in the uncompressed cluster.
+ * @param   offFile             Offset where the compressed cluster is stored in the image.
+ * @param   cbCompressedCluster Size of the compressed cluster in bytes.
+ */
+static int qcowReadCompressedClusterAsync(PQCOWIMAGE pImage, PVDIOCTX pIoCtx,
+                                          uint32_t offCluster, size_t cbToRead,
+                                          uint64_t offFile, size_t cbCompressedCluster)
+{
+    int rc = VINF_SUCCESS;
+
+    if (pImage->hReqPoolInflate == NIL_RTREQPOOL)
+    {
+        char szName[32];
+        RTStrPrintf(szName, sizeof(szName), "QCowInfl-%RX32", (uint32_t)(uintptr_t)pImage);
+        rc = RTReqPoolCreate(pImage->cInflateThreadsMax, RT_MS_30SEC, UINT32_MAX, 1, szName,
+                             &pImage->hReqPoolInflate);
+        if (RT_FAILURE(rc))
+        {
+            /* Don't fail the guest's read over this, just stick to synchronous inflation. */
+            LogRel(("QCow: Failed to create the inflate worker pool for '%s' (%Rrc), inflating synchronously\n",
+                    pImage->pszFilename, rc));
+            pImage->hReqPoolInflate    = NIL_RTREQPOOL;
+            pImage->cInflateThreadsMax = 0;
+            return VERR_NOT_SUPPORTED;
+        }
+    }
+
+    unsigned cSegs = 0;
+    vdIfIoIntIoCtxSegArrayCreate(pImage->pIfIo, pIoCtx, NULL, &cSegs, cbToRead);
+    AssertReturn(cSegs, VERR_INTERNAL_ERROR);
+
+    PQCOWINFLATEREQ pReq = (PQCOWINFLATEREQ)RTMemAllocZ(RT_UOFFSETOF_DYN(QCOWINFLATEREQ, aSegs[cSegs]));
+    if (RT_UNLIKELY(!pReq))
+        return VERR_NO_MEMORY;
+
+    pReq->pvCompCluster = RTMemAlloc(cbCompressedCluster);
+    pReq->pvCluster     = RTMemAlloc(pImage->cbCluster);
+    if (RT_LIKELY(pReq->pvCompCluster && pReq->pvCluster))
+    {
+        RTListInit(&pReq->ListWaiting);
+        pReq->pImage              = pImage;
+        pReq->pIoCtx              = pIoCtx;
+        pReq->offFile             = offFile;
+        pReq->cbCompressedCluster = cbCompressedCluster;
+        pReq->offCluster          = offCluster;
+        pReq->cbToRead            = cbToRead;
+        pReq->cSegs               = cSegs;
+
+        /* This advances the S/G buffer of the I/O context. */
+        size_t cbSegs = vdIfIoIntIoCtxSegArrayCreate(pImage->pIfIo, pIoCtx, &pReq->aSegs[0],
+                                                     &pReq->cSegs, cbToRead);
+        Assert(cbSegs == cbToRead); RT_NOREF(cbSegs);
+
+        ASMAtomicIncU32(&pImage->cInflateReqsPending);
+        rc = qcowInflateReqRead(pImage, pReq);
+        if (RT_FAILURE(rc))
+        {
+            /* The S/G buffer was already advanced, so complete the request here. */
+            qcowInflateReqComplete(pImage, pReq, rc);
+        }
+
+        return VERR_VD_IOCTX_HALT;
+    }
+
+    qcowInflateReqFree(pReq);
+    return VERR_NO_MEMORY;
+}
+
 /**
  * Reads a compressed cluster, inflates it and copies the amount of data requested
  * into the given I/O context.
@@ -1656,7 +2126,23 @@ static int qcowReadCompressedCluster(PQCOWIMAGE pImage, PVDIOCTX pIoCtx,
 {
     int rc = VINF_SUCCESS;
 
-    AssertReturn(!(pImage->uOpenFlags & VD_OPEN_FLAGS_ASYNC_IO), VERR_NOT_SUPPORTED); /* Only synchronous I/O supported so far. */
+    if (qcowClusterCacheRead(pImage, pIoCtx, offFile, offCluster, cbToRead))
+        return VINF_SUCCESS;
+
+    /*
+     * Asynchronous requests read the compressed data without blocking the
+     * caller and inflate it on a worker thread, the I/O context is halted
+     * meanwhile.
+     */
+    if (   pImage->cInflateThreadsMax
+        && !vdIfIoIntIoCtxIsSynchronous(pImage->pIfIo, pIoCtx))
+    {
+        rc = qcowReadCompressedClusterAsync(pImage, pIoCtx, offCluster, cbToRead,
+                                            offFile, cbCompressedCluster);
+        if (   rc != VERR_NO_MEMORY
+            && rc != VERR_NOT_SUPPORTED)
+            return rc;
+    }
 
     if (cbCompressedCluster > pImage->cbCompCluster)
     {
@@ -1670,36 +2156,24 @@ static int qcowReadCompressedCluster(PQCOWIMAGE pImage, PVDIOCTX pIoCtx,
             rc = VERR_NO_MEMORY;
     }
 
+    if (RT_SUCCESS(rc) && !pImage->pvCluster)
+    {
+        pImage->pvCluster = RTMemAllocZ(pImage->cbCluster);
+        if (!pImage->pvCluster)
+            rc = VERR_NO_MEMORY;
+    }
+
     if (RT_SUCCESS(rc))
     {
-        rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pImage->pStorage,
-                                   offFile, pImage->pvCompCluster,
-                                   cbCompressedCluster, NULL,
-                                   NULL, NULL, NULL);
+        rc = qcowInflateCluster(pImage, offFile, cbCompressedCluster,
+                                pImage->pvCompCluster, pImage->pvCluster);
         if (RT_SUCCESS(rc))
         {
-            if (!pImage->pvCluster)
-            {
-                pImage->pvCluster = RTMemAllocZ(pImage->cbCluster);
-                if (!pImage->pvCluster)
-                    rc = VERR_NO_MEMORY;
-            }
-
-            if (RT_SUCCESS(rc))
-            {
-                size_t cbDecomp = 0;
-
-                rc = RTZipBlockDecompress(RTZIPTYPE_ZLIB_NO_HEADER, 0 /*fFlags*/,
-                                          pImage->pvCompCluster, cbCompressedCluster, NULL,
-                                          pImage->pvCluster, pImage->cbCluster, &cbDecomp);
-                if (RT_SUCCESS(rc))
-                {
-                    Assert(cbDecomp == pImage->cbCluster);
-                    vdIfIoIntIoCtxCopyTo(pImage->pIfIo, pIoCtx,
-                                         (uint8_t *)pImage->pvCluster + offCluster,
-                                         cbToRead);
-                }
-            }
+            vdIfIoIntIoCtxCopyTo(pImage->pIfIo, pIoCtx,
+                                 (uint8_t *)pImage->pvCluster + offCluster,
+                                 cbToRead);
+            /* Hand the buffer over to the cache, the evicted one is reused next time. */
+            qcowClusterCacheInsert(pImage, offFile, &pImage->pvCluster);
         }
     }
 
@@ -1942,7 +2416,8 @@ static DECLCALLBACK(int) qcowRead(void *pBackendData, uint64_t uOffset, size_t c
 
     if (   (   RT_SUCCESS(rc)
             || rc == VERR_VD_BLOCK_FREE
-            || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            || rc == VERR_VD_ASYNC_IO_IN_PROGRESS
+            || rc == VERR_VD_IOCTX_HALT)
         && pcbActuallyRead)
         *pcbActuallyRead = cbToRead;
 
@@ -2065,7 +2540,7 @@ static DECLCALLBACK(int) qcowWrite(void *pBackendData, uint64_t uOffset, size_t
                     {
                         LogFlowFunc(("Fetching L2 table at cluster offset %llu\n", pImage->paL1Table[idxL1]));
 
-                        rc = qcowL2TblCacheFetch(pImage, pIoCtx, pImage->paL1Table[idxL1],
+                        rc = qcowL2TblCacheFetch(pImage, pIoCtx, idxL1, pImage->paL1Table[idxL1],
                                                  &pL2Entry);
                         if (RT_SUCCESS(rc))
                         {
@@ -2467,7 +2942,7 @@ const VDIMAGEBACKEND g_QCowBackend =
     /* paFileExtensions */
     s_aQCowFileExtensions,
     /* paConfigInfo */
-    NULL,
+    s_aQCowConfigInfo,
     /* pfnProbe */
     qcowProbe,
     /* pfnOpen */
@@ -33,6 +33,7 @@
 
 #include "VDBackends.h"
 #include "VDBackendsInline.h"
+#include "VDMetaCache.h"
 
 /**
  * The QED backend implements support for the qemu enhanced disk format (short QED)
@@ -131,20 +132,16 @@ typedef QedHeader *PQedHeader;
  */
 typedef struct QEDL2CACHEENTRY
 {
-    /** List node for the search list. */
-    RTLISTNODE              NodeSearch;
-    /** List node for the LRU list. */
-    RTLISTNODE              NodeLru;
-    /** Reference counter. */
-    uint32_t                cRefs;
-    /** The offset of the L2 table, used as search key. */
+    /** The metadata cache entry, keyed by the offset of the L2 table. */
+    VDMETACACHEENTRY        Core;
+    /** The offset of the L2 table. */
     uint64_t                offL2Tbl;
-    /** Pointer to the cached L2 table. */
+    /** Pointer to the cached L2 table (points to the cache entry data). */
     uint64_t               *paL2Tbl;
 } QEDL2CACHEENTRY, *PQEDL2CACHEENTRY;
 
-/** Maximum amount of memory the cache is allowed to use. */
-#define QED_L2_CACHE_MEMORY_MAX (2*_1M)
+/** Default amount of memory the cache is allowed to use, see VD_METACACHE_CFGKEY_SIZE. */
+#define QED_L2_CACHE_MEMORY_DEFAULT (2*_1M)
 
 /**
  * QED image data structure.
@@ -211,12 +208,8 @@ typedef struct QEDIMAGE
      * (can be only one at a time). */
     PQEDL2CACHEENTRY    pL2TblAlloc;
 
-    /** Memory occupied by the L2 table cache. */
-    size_t              cbL2Cache;
-    /** The sorted L2 entry list used for searching. */
-    RTLISTNODE          ListSearch;
-    /** The LRU L2 entry list used for eviction. */
-    RTLISTNODE          ListLru;
+    /** The L2 table cache. */
+    PVDMETACACHE        pL2Cache;
     /** The static region list. */
     VDREGIONLIST        RegionList;
 } QEDIMAGE, *PQEDIMAGE;
@@ -273,6 +266,17 @@ static const VDFILEEXTENSION s_aQedFileExtensions[] =
     {NULL,  VDTYPE_INVALID}
 };
 
+static const char *s_pszQedMetaCacheSizeDefault    = "2097152";
+static const char *s_pszQedMetaCacheSizeMaxDefault = "33554432";
+
+/** Configuration keys for the L2 table cache. */
+static const VDCONFIGINFO s_aQedConfigInfo[] =
+{
+    { VD_METACACHE_CFGKEY_SIZE,       s_pszQedMetaCacheSizeDefault,       VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { VD_METACACHE_CFGKEY_SIZE_MAX,   s_pszQedMetaCacheSizeMaxDefault,    VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { NULL,                           NULL,                               VDCFGVALUETYPE_INTEGER, 0 }
+};
+
 
 /*********************************************************************************************************************************
 *   Internal Functions                                                                                                           *
@@ -376,18 +380,19 @@ static void qedTableConvertFromHostEndianess(uint64_t *paTblImg, uint64_t *paTbl
 #endif
 
 /**
- * Creates the L2 table cache.
+ * Creates the L2 table cache, the table geometry must be known.
  *
  * @returns VBox status code.
  * @param   pImage    The image instance data.
  */
 static int qedL2TblCacheCreate(PQEDIMAGE pImage)
 {
-    pImage->cbL2Cache = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
+    /* There is no point in caching more than all L2 tables of the image. */
+    uint64_t cbL2TblsAll = (uint64_t)pImage->cTableEntries * pImage->cbTable;
 
-    return VINF_SUCCESS;
+    return vdMetaCacheCreate(&pImage->pL2Cache, pImage->pVDIfsImage, sizeof(QEDL2CACHEENTRY),
+                             pImage->cbTable, QED_L2_CACHE_MEMORY_DEFAULT,
+                             (size_t)RT_MIN(cbL2TblsAll, (uint64_t)~(size_t)0));
 }
 
 /**
@@ -398,20 +403,11 @@ static int qedL2TblCacheCreate(PQEDIMAGE pImage)
  */
 static void qedL2TblCacheDestroy(PQEDIMAGE pImage)
 {
-    PQEDL2CACHEENTRY pL2Entry;
-    PQEDL2CACHEENTRY pL2Next;
-    RTListForEachSafe(&pImage->ListSearch, pL2Entry, pL2Next, QEDL2CACHEENTRY, NodeSearch)
+    if (pImage->pL2Cache)
     {
-        Assert(!pL2Entry->cRefs);
-
-        RTListNodeRemove(&pL2Entry->NodeSearch);
-        RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbTable);
-        RTMemFree(pL2Entry);
+        vdMetaCacheDestroy(pImage->pL2Cache);
+        pImage->pL2Cache = NULL;
     }
-
-    pImage->cbL2Cache       = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
 }
 
 /**
@@ -426,27 +422,14 @@ static PQEDL2CACHEENTRY qedL2TblCacheRetain(PQEDIMAGE pImage, uint64_t offL2Tbl)
     if (   pImage->pL2TblAlloc
         && pImage->pL2TblAlloc->offL2Tbl == offL2Tbl)
     {
-        pImage->pL2TblAlloc->cRefs++;
+        pImage->pL2TblAlloc->Core.cRefs++;
         return pImage->pL2TblAlloc;
     }
 
-    PQEDL2CACHEENTRY pL2Entry;
-    RTListForEach(&pImage->ListSearch, pL2Entry, QEDL2CACHEENTRY, NodeSearch)
-    {
-        if (pL2Entry->offL2Tbl == offL2Tbl)
-            break;
-    }
-
-    if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QEDL2CACHEENTRY, NodeSearch))
-    {
-        /* Update LRU list. */
-        RTListNodeRemove(&pL2Entry->NodeLru);
-        RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
-        pL2Entry->cRefs++;
-        return pL2Entry;
-    }
-    else
-        return NULL;
+    PVDMETACACHEENTRY pEntry = vdMetaCacheRetain(pImage->pL2Cache, offL2Tbl);
+    if (pEntry)
+        return RT_FROM_MEMBER(pEntry, QEDL2CACHEENTRY, Core);
+    return NULL;
 }
 
 /**
@@ -457,8 +440,7 @@ static PQEDL2CACHEENTRY qedL2TblCacheRetain(PQEDIMAGE pImage, uint64_t offL2Tbl)
  */
 static void qedL2TblCacheEntryRelease(PQEDL2CACHEENTRY pL2Entry)
 {
-    Assert(pL2Entry->cRefs > 0);
-    pL2Entry->cRefs--;
+    vdMetaCacheEntryRelease(&pL2Entry->Core);
 }
 
 /**
@@ -469,50 +451,16 @@ static void qedL2TblCacheEntryRelease(PQEDL2CACHEENTRY pL2Entry)
  */
 static PQEDL2CACHEENTRY qedL2TblCacheEntryAlloc(PQEDIMAGE pImage)
 {
-    PQEDL2CACHEENTRY pL2Entry = NULL;
-
-    if (pImage->cbL2Cache + pImage->cbTable <= QED_L2_CACHE_MEMORY_MAX)
-    {
-        /* Add a new entry. */
-        pL2Entry = (PQEDL2CACHEENTRY)RTMemAllocZ(sizeof(QEDL2CACHEENTRY));
-        if (pL2Entry)
-        {
-            pL2Entry->paL2Tbl = (uint64_t *)RTMemPageAllocZ(pImage->cbTable);
-            if (RT_UNLIKELY(!pL2Entry->paL2Tbl))
-            {
-                RTMemFree(pL2Entry);
-                pL2Entry = NULL;
-            }
-            else
-            {
-                pL2Entry->cRefs    = 1;
-                pImage->cbL2Cache += pImage->cbTable;
-            }
-        }
-    }
-    else
+    PVDMETACACHEENTRY pEntry = vdMetaCacheEntryAlloc(pImage->pL2Cache);
+    if (pEntry)
     {
-        /* Evict the last not in use entry and use it */
-        Assert(!RTListIsEmpty(&pImage->ListLru));
-
-        RTListForEachReverse(&pImage->ListLru, pL2Entry, QEDL2CACHEENTRY, NodeLru)
-        {
-            if (!pL2Entry->cRefs)
-                break;
-        }
-
-        if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QEDL2CACHEENTRY, NodeSearch))
-        {
-            RTListNodeRemove(&pL2Entry->NodeSearch);
-            RTListNodeRemove(&pL2Entry->NodeLru);
-            pL2Entry->offL2Tbl = 0;
-            pL2Entry->cRefs    = 1;
-        }
-        else
-            pL2Entry = NULL;
+        PQEDL2CACHEENTRY pL2Entry = RT_FROM_MEMBER(pEntry, QEDL2CACHEENTRY, Core);
+        pL2Entry->offL2Tbl = 0;
+        pL2Entry->paL2Tbl  = (uint64_t *)pEntry->pvData;
+        return pL2Entry;
     }
 
-    return pL2Entry;
+    return NULL;
 }
 
 /**
@@ -524,11 +472,7 @@ static PQEDL2CACHEENTRY qedL2TblCacheEntryAlloc(PQEDIMAGE pImage)
  */
 static void qedL2TblCacheEntryFree(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry)
 {
-    Assert(!pL2Entry->cRefs);
-    RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbTable);
-    RTMemFree(pL2Entry);
-
-    pImage->cbL2Cache -= pImage->cbTable;
+    vdMetaCacheEntryFree(pImage->pL2Cache, &pL2Entry->Core);
 }
 
 /**
@@ -537,42 +481,12 @@ static void qedL2TblCacheEntryFree(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry)
  * @returns nothing.
  * @param   pImage    The image instance data.
  * @param   pL2Entry  The L2 cache entry to insert.
+ * @param   idxL1     The L1 table index referencing the L2 table.
  */
-static void qedL2TblCacheEntryInsert(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry)
+static void qedL2TblCacheEntryInsert(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry, uint32_t idxL1)
 {
     Assert(pL2Entry->offL2Tbl > 0);
-
-    /* Insert at the top of the LRU list. */
-    RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
-
-    if (RTListIsEmpty(&pImage->ListSearch))
-    {
-        RTListAppend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-    }
-    else
-    {
-        /* Insert into search list. */
-        PQEDL2CACHEENTRY pIt;
-        pIt = RTListGetFirst(&pImage->ListSearch, QEDL2CACHEENTRY, NodeSearch);
-        if (pIt->offL2Tbl > pL2Entry->offL2Tbl)
-            RTListPrepend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-        else
-        {
-            bool fInserted = false;
-
-            RTListForEach(&pImage->ListSearch, pIt, QEDL2CACHEENTRY, NodeSearch)
-            {
-                Assert(pIt->offL2Tbl != pL2Entry->offL2Tbl);
-                if (pIt->offL2Tbl < pL2Entry->offL2Tbl)
-                {
-                    RTListNodeInsertAfter(&pIt->NodeSearch, &pL2Entry->NodeSearch);
-                    fInserted = true;
-                    break;
-                }
-            }
-            Assert(fInserted);
-        }
-    }
+    vdMetaCacheEntryInsert(pImage->pL2Cache, &pL2Entry->Core, pL2Entry->offL2Tbl, idxL1);
 }
 
 /**
@@ -582,10 +496,11 @@ static void qedL2TblCacheEntryInsert(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry
  * @returns VBox status code.
  * @param   pImage    Image instance data.
  * @param   pIoCtx    The I/O context.
+ * @param   idxL1     The L1 table index referencing the L2 table.
  * @param   offL2Tbl  The offset of the L2 table in the image.
  * @param   ppL2Entry Where to store the L2 table on success.
  */
-static int qedL2TblCacheFetchAsync(PQEDIMAGE pImage, PVDIOCTX pIoCtx,
+static int qedL2TblCacheFetchAsync(PQEDIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxL1,
                                    uint64_t offL2Tbl, PQEDL2CACHEENTRY *ppL2Entry)
 {
     int rc = VINF_SUCCESS;
@@ -612,7 +527,7 @@ static int qedL2TblCacheFetchAsync(PQEDIMAGE pImage, PVDIOCTX pIoCtx,
 #if defined(RT_BIG_ENDIAN)
                 qedTableConvertToHostEndianess(pL2Entry->paL2Tbl, pImage->cTableEntries);
 #endif
-                qedL2TblCacheEntryInsert(pImage, pL2Entry);
+                qedL2TblCacheEntryInsert(pImage, pL2Entry, idxL1);
             }
             else
             {
@@ -760,7 +675,7 @@ static int qedConvertToImageOffset(PQEDIMAGE pImage, PVDIOCTX pIoCtx,
     {
         PQEDL2CACHEENTRY pL2Entry;
 
-        rc = qedL2TblCacheFetchAsync(pImage, pIoCtx, pImage->paL1Table[idxL1],
+        rc = qedL2TblCacheFetchAsync(pImage, pIoCtx, idxL1, pImage->paL1Table[idxL1],
                                      &pL2Entry);
         if (RT_SUCCESS(rc))
         {
@@ -1131,120 +1046,116 @@ static int qedOpenImage(PQEDIMAGE pImage, unsigned uOpenFlags)
     pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
     AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
 
-    /*
-     * Create the L2 cache before opening the image so we can call qedFreeImage()
-     * even if opening the image file fails.
-     */
-    int rc = qedL2TblCacheCreate(pImage);
-    if (RT_SUCCESS(rc))
-    {
-        /* Open the image. */
-        rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename,
+    /* Open the image. */
+    int rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename,
                                VDOpenFlagsToFileOpenFlags(uOpenFlags,
                                                           false /* fCreate */),
                                &pImage->pStorage);
-        if (RT_SUCCESS(rc))
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t cbFile;
+        rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+        if (   RT_SUCCESS(rc)
+            && cbFile > sizeof(QedHeader))
         {
-            uint64_t cbFile;
-            rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+            QedHeader Header;
+
+            rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, 0, &Header, sizeof(Header));
             if (   RT_SUCCESS(rc)
-                && cbFile > sizeof(QedHeader))
+                && qedHdrConvertToHostEndianess(&Header))
             {
-                QedHeader Header;
-
-                rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, 0, &Header, sizeof(Header));
-                if (   RT_SUCCESS(rc)
-                    && qedHdrConvertToHostEndianess(&Header))
+                if (   !(Header.u64FeatureFlags & ~QED_FEATURE_MASK)
+                    && !(Header.u64FeatureFlags & QED_FEATURE_BACKING_FILE_NO_PROBE))
                 {
-                    if (   !(Header.u64FeatureFlags & ~QED_FEATURE_MASK)
-                        && !(Header.u64FeatureFlags & QED_FEATURE_BACKING_FILE_NO_PROBE))
+                    if (Header.u64FeatureFlags & QED_FEATURE_NEED_CHECK)
                     {
-                        if (Header.u64FeatureFlags & QED_FEATURE_NEED_CHECK)
-                        {
-                            /* Image needs checking. */
-                            if (!(uOpenFlags & VD_OPEN_FLAGS_READONLY))
-                                rc = qedCheckImage(pImage, &Header);
-                            else
-                                rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
-                                               N_("Qed: Image '%s' needs checking but is opened readonly"),
-                                               pImage->pszFilename);
-                        }
+                        /* Image needs checking. */
+                        if (!(uOpenFlags & VD_OPEN_FLAGS_READONLY))
+                            rc = qedCheckImage(pImage, &Header);
+                        else
+                            rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                                           N_("Qed: Image '%s' needs checking but is opened readonly"),
+                                           pImage->pszFilename);
+                    }
 
-                        if (   RT_SUCCESS(rc)
-                            && (Header.u64FeatureFlags & QED_FEATURE_BACKING_FILE))
+                    if (   RT_SUCCESS(rc)
+                        && (Header.u64FeatureFlags & QED_FEATURE_BACKING_FILE))
+                    {
+                        /* Load backing filename from image. */
+                        pImage->pszBackingFilename = RTStrAlloc(Header.u32BackingFilenameSize + 1); /* +1 for \0 terminator. */
+                        if (pImage->pszBackingFilename)
                         {
-                            /* Load backing filename from image. */
-                            pImage->pszBackingFilename = RTStrAlloc(Header.u32BackingFilenameSize + 1); /* +1 for \0 terminator. */
-                            if (pImage->pszBackingFilename)
-                            {
-                                RT_BZERO(pImage->pszBackingFilename, Header.u32BackingFilenameSize + 1);
-                                pImage->cbBackingFilename  = Header.u32BackingFilenameSize;
-                                pImage->offBackingFilename = Header.u32OffBackingFilename;
-                                rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage,
-                                                           Header.u32OffBackingFilename, pImage->pszBackingFilename,
-                                                           Header.u32BackingFilenameSize);
-                                if (RT_SUCCESS(rc))
-                                    rc = RTStrValidateEncoding(pImage->pszBackingFilename);
-                            }
-                            else
-                                rc = VERR_NO_STR_MEMORY;
+                            RT_BZERO(pImage->pszBackingFilename, Header.u32BackingFilenameSize + 1);
+                            pImage->cbBackingFilename  = Header.u32BackingFilenameSize;
+                            pImage->offBackingFilename = Header.u32OffBackingFilename;
+                            rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage,
+                                                       Header.u32OffBackingFilename, pImage->pszBackingFilename,
+                                                       Header.u32BackingFilenameSize);
+                            if (RT_SUCCESS(rc))
+                                rc = RTStrValidateEncoding(pImage->pszBackingFilename);
                         }
+                        else
+                            rc = VERR_NO_STR_MEMORY;
+                    }
 
-                        if (RT_SUCCESS(rc))
+                    if (RT_SUCCESS(rc))
+                    {
+                        pImage->cbImage       = cbFile;
+                        pImage->cbCluster     = Header.u32ClusterSize;
+                        pImage->cbTable       = Header.u32TableSize * pImage->cbCluster;
+                        pImage->cTableEntries = pImage->cbTable / sizeof(uint64_t);
+                        pImage->offL1Table    = Header.u64OffL1Table;
+                        pImage->cbSize        = Header.u64Size;
+                        qedTableMasksInit(pImage);
+
+                        /* Allocate L1 table. */
+                        pImage->paL1Table     = (uint64_t *)RTMemAllocZ(pImage->cbTable);
+                        if (pImage->paL1Table)
                         {
-                            pImage->cbImage       = cbFile;
-                            pImage->cbCluster     = Header.u32ClusterSize;
-                            pImage->cbTable       = Header.u32TableSize * pImage->cbCluster;
-                            pImage->cTableEntries = pImage->cbTable / sizeof(uint64_t);
-                            pImage->offL1Table    = Header.u64OffL1Table;
-                            pImage->cbSize        = Header.u64Size;
-                            qedTableMasksInit(pImage);
-
-                            /* Allocate L1 table. */
-                            pImage->paL1Table     = (uint64_t *)RTMemAllocZ(pImage->cbTable);
-                            if (pImage->paL1Table)
+                            /* Read from the image. */
+                            rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage,
+                                                       pImage->offL1Table, pImage->paL1Table,
+                                                       pImage->cbTable);
+                            if (RT_SUCCESS(rc))
                             {
-                                /* Read from the image. */
-                                rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage,
-                                                           pImage->offL1Table, pImage->paL1Table,
-                                                           pImage->cbTable);
-                                if (RT_SUCCESS(rc))
-                                {
-                                    qedTableConvertToHostEndianess(pImage->paL1Table, pImage->cTableEntries);
-
-                                    /* If the consistency check succeeded, clear the flag by flushing the image. */
-                                    if (Header.u64FeatureFlags & QED_FEATURE_NEED_CHECK)
-                                        rc = qedFlushImage(pImage);
-                                }
-                                else
+                                qedTableConvertToHostEndianess(pImage->paL1Table, pImage->cTableEntries);
+
+                                /* The L2 cache is sized based on the table geometry. */
+                                rc = qedL2TblCacheCreate(pImage);
+                                if (RT_FAILURE(rc))
                                     rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
-                                                   N_("Qed: Reading the L1 table for image '%s' failed"),
+                                                   N_("Qed: Creating the L2 table cache for image '%s' failed"),
                                                    pImage->pszFilename);
+
+                                /* If the consistency check succeeded, clear the flag by flushing the image. */
+                                if (   RT_SUCCESS(rc)
+                                    && (Header.u64FeatureFlags & QED_FEATURE_NEED_CHECK))
+                                    rc = qedFlushImage(pImage);
                             }
                             else
-                                rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
-                                               N_("Qed: Out of memory allocating L1 table for image '%s'"),
+                                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                                               N_("Qed: Reading the L1 table for image '%s' failed"),
                                                pImage->pszFilename);
                         }
+                        else
+                            rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
+                                           N_("Qed: Out of memory allocating L1 table for image '%s'"),
+                                           pImage->pszFilename);
                     }
-                    else
-                        rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
-                                       N_("Qed: The image '%s' makes use of unsupported features"),
-                                       pImage->pszFilename);
                 }
-                else if (RT_SUCCESS(rc))
-                    rc = VERR_VD_GEN_INVALID_HEADER;
+                else
+                    rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                                   N_("Qed: The image '%s' makes use of unsupported features"),
+                                   pImage->pszFilename);
             }
             else if (RT_SUCCESS(rc))
                 rc = VERR_VD_GEN_INVALID_HEADER;
         }
-        /* else: Do NOT signal an appropriate error here, as the VD layer has the
-         *       choice of retrying the open if it failed. */
+        else if (RT_SUCCESS(rc))
+            rc = VERR_VD_GEN_INVALID_HEADER;
     }
-    else
-        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
-                       N_("Qed: Creating the L2 table cache for image '%s' failed"),
-                       pImage->pszFilename);
+    /* else: Do NOT signal an appropriate error here, as the VD layer has the
+     *       choice of retrying the open if it failed. */
 
     if (RT_SUCCESS(rc))
     {
@@ -1280,34 +1191,35 @@ static int qedCreateImage(PQEDIMAGE pImage, uint64_t cbSize,
 
     if (!(uImageFlags & VD_IMAGE_FLAGS_FIXED))
     {
-        rc = qedL2TblCacheCreate(pImage);
+        pImage->uOpenFlags   = uOpenFlags & ~VD_OPEN_FLAGS_READONLY;
+        pImage->uImageFlags  = uImageFlags;
+        pImage->PCHSGeometry = *pPCHSGeometry;
+        pImage->LCHSGeometry = *pLCHSGeometry;
+
+        pImage->pIfError = VDIfErrorGet(pImage->pVDIfsDisk);
+        pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
+        AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
+
+        /* Create image file. */
+        uint32_t fOpen = VDOpenFlagsToFileOpenFlags(pImage->uOpenFlags, true /* fCreate */);
+        rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename, fOpen, &pImage->pStorage);
         if (RT_SUCCESS(rc))
         {
-            pImage->uOpenFlags   = uOpenFlags & ~VD_OPEN_FLAGS_READONLY;
-            pImage->uImageFlags  = uImageFlags;
-            pImage->PCHSGeometry = *pPCHSGeometry;
-            pImage->LCHSGeometry = *pLCHSGeometry;
-
-            pImage->pIfError = VDIfErrorGet(pImage->pVDIfsDisk);
-            pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
-            AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
-
-            /* Create image file. */
-            uint32_t fOpen = VDOpenFlagsToFileOpenFlags(pImage->uOpenFlags, true /* fCreate */);
-            rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename, fOpen, &pImage->pStorage);
+            /* Init image state. */
+            pImage->cbSize             = cbSize;
+            pImage->cbCluster          = QED_CLUSTER_SIZE_DEFAULT;
+            pImage->cbTable            = qedCluster2Byte(pImage, QED_TABLE_SIZE_DEFAULT);
+            pImage->cTableEntries      = pImage->cbTable / sizeof(uint64_t);
+            pImage->offL1Table         = qedCluster2Byte(pImage, 1); /* Cluster 0 is the header. */
+            pImage->cbImage            = (1 * pImage->cbCluster) + pImage->cbTable; /* Header + L1 table size. */
+            pImage->cbBackingFilename  = 0;
+            pImage->offBackingFilename = 0;
+            qedTableMasksInit(pImage);
+
+            /* The L2 cache is sized based on the table geometry. */
+            rc = qedL2TblCacheCreate(pImage);
             if (RT_SUCCESS(rc))
             {
-                /* Init image state. */
-                pImage->cbSize             = cbSize;
-                pImage->cbCluster          = QED_CLUSTER_SIZE_DEFAULT;
-                pImage->cbTable            = qedCluster2Byte(pImage, QED_TABLE_SIZE_DEFAULT);
-                pImage->cTableEntries      = pImage->cbTable / sizeof(uint64_t);
-                pImage->offL1Table         = qedCluster2Byte(pImage, 1); /* Cluster 0 is the header. */
-                pImage->cbImage            = (1 * pImage->cbCluster) + pImage->cbTable; /* Header + L1 table size. */
-                pImage->cbBackingFilename  = 0;
-                pImage->offBackingFilename = 0;
-                qedTableMasksInit(pImage);
-
                 /* Init L1 table. */
                 pImage->paL1Table = (uint64_t *)RTMemAllocZ(pImage->cbTable);
                 if (RT_LIKELY(pImage->paL1Table))
@@ -1320,11 +1232,11 @@ static int qedCreateImage(PQEDIMAGE pImage, uint64_t cbSize,
                                    pImage->pszFilename);
             }
             else
-                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Qed: cannot create image '%s'"), pImage->pszFilename);
+                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Qed: Failed to create L2 cache for image '%s'"),
+                               pImage->pszFilename);
         }
         else
-            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Qed: Failed to create L2 cache for image '%s'"),
-                           pImage->pszFilename);
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("Qed: cannot create image '%s'"), pImage->pszFilename);
     }
     else
         rc = vdIfError(pImage->pIfError, VERR_VD_INVALID_TYPE, RT_SRC_POS, N_("Qed: cannot create fixed image '%s'"), pImage->pszFilename);
@@ -1376,7 +1288,7 @@ static int qedAsyncClusterAllocRollback(PQEDIMAGE pImage, PVDIOCTX pIoCtx, PQEDC
             /* Assumption right now is that the L1 table is not modified on storage if the link fails. */
             rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, pClusterAlloc->cbImageOld);
             qedL2TblCacheEntryRelease(pClusterAlloc->pL2Entry); /* Release L2 cache entry. */
-            Assert(!pClusterAlloc->pL2Entry->cRefs);
+            Assert(!pClusterAlloc->pL2Entry->Core.cRefs);
             qedL2TblCacheEntryFree(pImage, pClusterAlloc->pL2Entry); /* Free it, it is not in the cache yet. */
             break;
         }
@@ -1445,7 +1357,7 @@ static DECLCALLBACK(int) qedAsyncClusterAllocUpdate(void *pBackendData, PVDIOCTX
             uint64_t offData = qedClusterAllocate(pImage, 1);
 
             pImage->pL2TblAlloc = NULL;
-            qedL2TblCacheEntryInsert(pImage, pClusterAlloc->pL2Entry);
+            qedL2TblCacheEntryInsert(pImage, pClusterAlloc->pL2Entry, pClusterAlloc->idxL1);
 
             pClusterAlloc->enmAllocState = QEDCLUSTERASYNCALLOCSTATE_USER_ALLOC;
             pClusterAlloc->cbImageOld    = offData;
@@ -1845,7 +1757,7 @@ static DECLCALLBACK(int) qedWrite(void *pBackendData, uint64_t uOffset, size_t c
                     {
                         LogFlowFunc(("Fetching L2 table at cluster offset %llu\n", pImage->paL1Table[idxL1]));
 
-                        rc = qedL2TblCacheFetchAsync(pImage, pIoCtx, pImage->paL1Table[idxL1],
+                        rc = qedL2TblCacheFetchAsync(pImage, pIoCtx, idxL1, pImage->paL1Table[idxL1],
                                                      &pL2Entry);
 
                         if (RT_SUCCESS(rc))
@@ -2294,7 +2206,7 @@ const VDIMAGEBACKEND g_QedBackend =
     /* paFileExtensions */
     s_aQedFileExtensions,
     /* paConfigInfo */
-    NULL,
+    s_aQedConfigInfo,
     /* pfnProbe */
     qedProbe,
     /* pfnOpen */
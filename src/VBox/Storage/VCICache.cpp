@@ -26,6 +26,7 @@
 #include <VBox/log.h>
 #include <iprt/assert.h>
 #include <iprt/alloc.h>
+#include <iprt/avl.h>
 #include <iprt/file.h>
 #include <iprt/asm.h>
 
@@ -67,26 +68,30 @@ typedef struct VciHdr
     uint8_t     fUncleanShutdown;
     /** Cache type. */
     uint32_t    u32CacheType;
-    /** Offset of the B+-Tree root in the image in blocks. */
-    uint64_t    offTreeRoot;
-    /** Offset of the block allocation bitmap in blocks. */
-    uint64_t    offBlkMap;
-    /** Size of the block allocation bitmap in blocks. */
-    uint32_t    cBlkMap;
+    /** Offset of the line directory in blocks. */
+    uint64_t    offLineDir;
+    /** Number of sets in the line directory, each set occupies one block. */
+    uint32_t    cSets;
+    /** Number of blocks in a cache line. */
+    uint32_t    cBlocksPerLine;
+    /** Offset of the first cache line in blocks. */
+    uint64_t    offData;
     /** UUID of the image. */
     RTUUID      uuidImage;
     /** Modification UUID for the cache. */
     RTUUID      uuidModification;
     /** Reserved for future use. */
-    uint8_t     abReserved[951];
+    uint8_t     abReserved[947];
 } VciHdr, *PVciHdr;
 #pragma pack()
 AssertCompileSize(VciHdr, 2 * VCI_BLOCK_SIZE);
 
 /** VCI signature to identify a valid image. */
 #define VCI_HDR_SIGNATURE          UINT32_C(0x00494356) /* \0ICV */
-/** Current version we support. */
-#define VCI_HDR_VERSION            UINT32_C(0x00000001)
+/** Current version we support.
+ * Version 1 used a B+-Tree which was never finished, no cache of that version
+ * ever held data. */
+#define VCI_HDR_VERSION            UINT32_C(0x00000002)
 
 /** Value for an unclean cache shutdown. */
 #define VCI_HDR_UNCLEAN_SHUTDOWN   UINT8_C(0x01)
@@ -98,238 +103,114 @@ AssertCompileSize(VciHdr, 2 * VCI_BLOCK_SIZE);
 /** Cache type: Fixed image, space is preallocated. */
 #define VCI_HDR_CACHE_TYPE_FIXED   UINT32_C(0x00000002)
 
-/**
- * On disk representation of an extent describing a range of cached data.
- *
- * All entries a stored in little endian order.
- */
-#pragma pack(1)
-typedef struct VciCacheExtent
-{
-    /** Block address of the previous extent in the LRU list. */
-    uint64_t    u64ExtentPrev;
-    /** Block address of the next extent in the LRU list. */
-    uint64_t    u64ExtentNext;
-    /** Flags (for compression, encryption etc.) - currently unused and should be always 0. */
-    uint8_t     u8Flags;
-    /** Reserved */
-    uint8_t     u8Reserved;
-    /** First block of cached data the extent represents. */
-    uint64_t    u64BlockOffset;
-    /** Number of blocks the extent represents. */
-    uint32_t    u32Blocks;
-    /** First block in the image where the data is stored. */
-    uint64_t    u64BlockAddr;
-} VciCacheExtent, *PVciCacheExtent;
-#pragma pack()
-AssertCompileSize(VciCacheExtent, 38);
+/** Size of a cache line in bytes. */
+#define VCI_LINE_SIZE              _64K
+/** Number of blocks in a cache line. */
+#define VCI_LINE_BLOCKS            (VCI_LINE_SIZE / VCI_BLOCK_SIZE)
+/** Number of lines in a set (associativity). */
+#define VCI_SET_WAYS               8
+/** Offset of the line directory in bytes. */
+#define VCI_LINE_DIR_OFFSET        _4K
 
 /**
- * On disk representation of an internal node.
+ * On disk representation of a cache line in the line directory.
  *
- * All entries a stored in little endian order.
- */
-#pragma pack(1)
-typedef struct VciTreeNodeInternal
-{
-    /** First block of cached data the internal node represents. */
-    uint64_t    u64BlockOffset;
-    /** Number of blocks the internal node represents. */
-    uint32_t    u32Blocks;
-    /** Block address in the image where the next node in the tree is stored. */
-    uint64_t    u64ChildAddr;
-} VciTreeNodeInternal, *PVciTreeNodeInternal;
-#pragma pack()
-AssertCompileSize(VciTreeNodeInternal, 20);
-
-/**
- * On-disk representation of a node in the B+-Tree.
+ * A virtual disk line can only live in the set given by its line number
+ * modulo the number of sets. The cache only holds data which was not written
+ * to the image chain yet, a sector is valid if and only if it is dirty.
  *
  * All entries a stored in little endian order.
  */
 #pragma pack(1)
-typedef struct VciTreeNode
+typedef struct VciLineEnt
 {
-    /** Type of the node (root, internal, leaf). */
-    uint8_t     u8Type;
-    /** Data in the node. */
-    uint8_t     au8Data[4095];
-} VciTreeNode, *PVciTreeNode;
-#pragma pack()
-AssertCompileSize(VciTreeNode, 8 * VCI_BLOCK_SIZE);
-
-/** Node type: Internal node containing links to other nodes (VciTreeNodeInternal). */
-#define VCI_TREE_NODE_TYPE_INTERNAL UINT8_C(0x01)
-/** Node type: Leaf of the tree (VciCacheExtent). */
-#define VCI_TREE_NODE_TYPE_LEAF     UINT8_C(0x02)
-
-/** Number of cache extents described by one node. */
-#define VCI_TREE_EXTENTS_PER_NODE        ((sizeof(VciTreeNode)-1) / sizeof(VciCacheExtent))
-/** Number of internal nodes managed by one tree node. */
-#define VCI_TREE_INTERNAL_NODES_PER_NODE ((sizeof(VciTreeNode)-1) / sizeof(VciTreeNodeInternal))
-
-/**
- * VCI block bitmap header.
- *
- * All entries a stored in little endian order.
- */
-#pragma pack(1)
-typedef struct VciBlkMap
-{
-    /** Magic of the block bitmap. */
-    uint32_t     u32Magic;
-    /** Version of the block bitmap. */
-    uint32_t     u32Version;
-    /** Number of blocks this block map manages. */
-    uint64_t     cBlocks;
-    /** Number of free blocks. */
-    uint64_t     cBlocksFree;
-    /** Number of blocks allocated for metadata. */
-    uint64_t     cBlocksAllocMeta;
-    /** Number of blocks allocated for actual cached data. */
-    uint64_t     cBlocksAllocData;
+    /** Line number of the virtual disk plus one, 0 if the line is unused. */
+    uint64_t    u64LineTag;
+    /** Sequence number of the last modification. */
+    uint64_t    u64Seq;
+    /** Bitmap of dirty blocks in the line. */
+    uint8_t     abDirty[VCI_LINE_BLOCKS / 8];
     /** Reserved for future use. */
-    uint8_t      au8Reserved[472];
-} VciBlkMap, *PVciBlkMap;
+    uint8_t     abReserved[32];
+} VciLineEnt, *PVciLineEnt;
 #pragma pack()
-AssertCompileSize(VciBlkMap, VCI_BLOCK_SIZE);
+AssertCompileSize(VciLineEnt, 64);
+AssertCompile(VCI_SET_WAYS * sizeof(VciLineEnt) == VCI_BLOCK_SIZE);
 
-/** The magic which identifies a block map. */
-#define VCI_BLKMAP_MAGIC   UINT32_C(0x4b4c4256) /* KLBV */
-/** Current version. */
-#define VCI_BLKMAP_VERSION UINT32_C(0x00000001)
-
-/** Block bitmap entry */
-typedef uint8_t VciBlkMapEnt;
-
-
-/*********************************************************************************************************************************
-*   Constants And Macros, Structures and Typedefs                                                                                *
-*********************************************************************************************************************************/
-
-/**
- * Block range descriptor.
- */
-typedef struct VCIBLKRANGEDESC
-{
-    /** Previous entry in the list. */
-    struct VCIBLKRANGEDESC    *pPrev;
-    /** Next entry in the list. */
-    struct VCIBLKRANGEDESC    *pNext;
-    /** Start address of the range. */
-    uint64_t                   offAddrStart;
-    /** Number of blocks in the range. */
-    uint64_t                   cBlocks;
-    /** Flag whether the range is free or allocated. */
-    bool                       fFree;
-} VCIBLKRANGEDESC, *PVCIBLKRANGEDESC;
-
-/**
- * Block map for the cache image - in memory structure.
- */
-typedef struct VCIBLKMAP
-{
-    /** Number of blocks the map manages. */
-    uint64_t     cBlocks;
-    /** Number of blocks allocated for metadata. */
-    uint64_t     cBlocksAllocMeta;
-    /** Number of blocks allocated for actual cached data. */
-    uint64_t     cBlocksAllocData;
-    /** Number of free blocks. */
-    uint64_t     cBlocksFree;
-
-    /** Pointer to the head of the block range list. */
-    PVCIBLKRANGEDESC pRangesHead;
-    /** Pointer to the tail of the block range list. */
-    PVCIBLKRANGEDESC pRangesTail;
-
-} VCIBLKMAP;
-/** Pointer to a block map. */
-typedef VCIBLKMAP *PVCIBLKMAP;
-
-/**
- * B+-Tree node header.
- */
-typedef struct VCITREENODE
-{
-    /** Type of the node (VCI_TREE_NODE_TYPE_*). */
-    uint8_t             u8Type;
-    /** Block address where the node is stored. */
-    uint64_t            u64BlockAddr;
-    /** Pointer to the parent. */
-    struct VCITREENODE *pParent;
-} VCITREENODE, *PVCITREENODE;
-
-/**
- * B+-Tree node pointer.
- */
-typedef struct VCITREENODEPTR
-{
-    /** Flag whether the node is in memory or still on the disk. */
-    bool         fInMemory;
-    /** Type dependent data. */
-    union
-    {
-        /** Pointer to a in memory node. */
-        PVCITREENODE pNode;
-        /** Start block address of the node. */
-        uint64_t     offAddrBlockNode;
-    } u;
-} VCITREENODEPTR, *PVCITREENODEPTR;
+/*******************************************************************************
+* Constants And Macros, Structures and Typedefs                                *
+*******************************************************************************/
 
 /**
- * Internal node.
+ * A in memory cache line.
  */
-typedef struct VCINODEINTERNAL
+typedef struct VCILINE
 {
-    /** First block of cached data the internal node represents. */
-    uint64_t       u64BlockOffset;
-    /** Number of blocks the internal node represents. */
-    uint32_t       u32Blocks;
-    /** Pointer to the child node. */
-    VCITREENODEPTR PtrChild;
-} VCINODEINTERNAL, *PVCINODEINTERNAL;
+    /** AVL tree node of the dirty line tree, the key is the sequence number of
+     * the last modification. Only linked while the line has dirty blocks. */
+    AVLU64NODECORE    Core;
+    /** Line number of the virtual disk plus one, 0 if the line is unused. */
+    uint64_t          uLineTag;
+    /** Bitmap of dirty blocks. */
+    uint64_t          au64Dirty[VCI_LINE_BLOCKS / 64];
+    /** Flush generation which made the line clean, the line can be reused for
+     * another virtual disk line only after that flush completed. */
+    uint64_t          uFlushGenClean;
+    /** Last access, for picking the least recently used line of a set. */
+    uint64_t          uLastAccess;
+    /** Number of writes to the line in progress. */
+    uint32_t          cWritesActive;
+} VCILINE, *PVCILINE;
 
 /**
- * A in memory internal B+-tree node.
+ * A write to a cache line in progress.
  */
-typedef struct VCITREENODEINT
+typedef struct VCIWRITE
 {
-    /** Node core. */
-    VCITREENODE     Core;
-    /** Number of used nodes. */
-    unsigned        cUsedNodes;
-    /** Array of internal nodes. */
-    VCINODEINTERNAL aIntNodes[VCI_TREE_INTERNAL_NODES_PER_NODE];
-} VCITREENODEINT, *PVCITREENODEINT;
+    /** The line written to. */
+    PVCILINE          pLine;
+    /** First block written. */
+    uint32_t          iBlockFirst;
+    /** Number of blocks written. */
+    uint32_t          cBlocks;
+} VCIWRITE, *PVCIWRITE;
 
 /**
- * A in memory cache extent.
+ * Flush states.
  */
-typedef struct VCICACHEEXTENT
+typedef enum VCIFLUSHSTATE
 {
-    /** First block of cached data the extent represents. */
-    uint64_t    u64BlockOffset;
-    /** Number of blocks the extent represents. */
-    uint32_t    u32Blocks;
-    /** First block in the image where the data is stored. */
-    uint64_t    u64BlockAddr;
-} VCICACHEEXTENT, *PVCICACHEEXTENT;
+    /** Invalid. */
+    VCIFLUSHSTATE_INVALID = 0,
+    /** Flush the data written so far, the directory must not reference data
+     * which isn't on the disk. */
+    VCIFLUSHSTATE_DATA_FLUSH,
+    /** Write the modified sets of the line directory. */
+    VCIFLUSHSTATE_DIR_WRITE,
+    /** Flush the line directory. */
+    VCIFLUSHSTATE_DIR_FLUSH,
+    /** Flush completed. */
+    VCIFLUSHSTATE_COMPLETE
+} VCIFLUSHSTATE;
 
 /**
- * A in memory leaf B+-tree node.
+ * Cache flush state.
  */
-typedef struct VCITREENODELEAF
+typedef struct VCIFLUSH
 {
-    /** Node core. */
-    VCITREENODE             Core;
-    /** Next leaf node in the list. */
-    struct VCITREENODELEAF *pNext;
-    /** Number of used nodes. */
-    unsigned                cUsedNodes;
-    /** The extents in the node. */
-    VCICACHEEXTENT          aExtents[VCI_TREE_EXTENTS_PER_NODE];
-} VCITREENODELEAF, *PVCITREENODELEAF;
+    /** Current state. */
+    VCIFLUSHSTATE     enmState;
+    /** Flush generation. */
+    uint64_t          uFlushGen;
+    /** Number of sets to write. */
+    uint32_t          cSets;
+    /** Index of the next set to write in the arrays below. */
+    uint32_t          idxSetNext;
+    /** Set numbers to write, sorted. */
+    uint32_t         *paidxSets;
+    /** On disk representation of the sets to write. */
+    VciLineEnt       *paEnts;
+} VCIFLUSH, *PVCIFLUSH;
 
 /**
  * VCI image data structure.
@@ -357,24 +238,32 @@ typedef struct VCICACHE
     /** Total size of the image. */
     uint64_t          cbSize;
 
-    /** Offset of the B+-Tree in the image in bytes. */
-    uint64_t          offTreeRoot;
-    /** Pointer to the root node of the B+-Tree. */
-    PVCITREENODE      pRoot;
-    /** Offset to the block allocation bitmap in bytes. */
-    uint64_t          offBlksBitmap;
-    /** Block map. */
-    PVCIBLKMAP        pBlkMap;
+    /** Offset of the line directory in bytes. */
+    uint64_t          offLineDir;
+    /** Offset of the first line in bytes. */
+    uint64_t          offData;
+    /** Number of sets. */
+    uint32_t          cSets;
+    /** The lines, VCI_SET_WAYS consecutive entries form a set. */
+    PVCILINE          paLines;
+    /** Bitmap of sets which need to be written to the directory. */
+    uint32_t         *pbmSetsDirty;
+    /** Number of sets which need to be written to the directory. */
+    uint32_t          cSetsDirty;
+    /** Dirty lines sorted by the sequence number of the last modification. */
+    AVLU64TREE        TreeDirty;
+    /** Next sequence number to assign. */
+    uint64_t          uSeqNext;
+    /** Next access counter value. */
+    uint64_t          uAccessNext;
+    /** Number of dirty blocks. */
+    uint64_t          cBlocksDirty;
+    /** Generation of the next flush. */
+    uint64_t          uFlushGenNext;
+    /** All flushes below this generation completed. */
+    uint64_t          uFlushGenDone;
 } VCICACHE, *PVCICACHE;
 
-/** No block free in bitmap error code. */
-#define VERR_VCI_NO_BLOCKS_FREE (-65536)
-
-/** Flags for the block map allocator. */
-#define VCIBLKMAP_ALLOC_DATA 0
-#define VCIBLKMAP_ALLOC_META RT_BIT(0)
-#define VCIBLKMAP_ALLOC_MASK 0x1
-
 
 /*********************************************************************************************************************************
 *   Static Variables                                                                                                             *
@@ -409,801 +298,340 @@ static int vciFlushImage(PVCICACHE pCache)
 }
 
 /**
- * Internal. Free all allocated space for representing an image except pCache,
- * and optionally delete the image from disk.
+ * Internal. Converts the given set to the on disk representation.
  */
-static int vciFreeImage(PVCICACHE pCache, bool fDelete)
+static void vciSetToDisk(PVCICACHE pCache, uint32_t idxSet, PVciLineEnt paEnts)
 {
-    int rc = VINF_SUCCESS;
+    PVCILINE pLine = &pCache->paLines[(size_t)idxSet * VCI_SET_WAYS];
 
-    /* Freeing a never allocated image (e.g. because the open failed) is
-     * not signalled as an error. After all nothing bad happens. */
-    if (pCache)
+    memset(paEnts, 0, VCI_SET_WAYS * sizeof(VciLineEnt));
+    for (unsigned i = 0; i < VCI_SET_WAYS; i++, pLine++)
     {
-        if (pCache->pStorage)
+        paEnts[i].u64LineTag = RT_H2LE_U64(pLine->uLineTag);
+        paEnts[i].u64Seq     = RT_H2LE_U64(pLine->Core.Key);
+        for (unsigned j = 0; j < RT_ELEMENTS(pLine->au64Dirty); j++)
         {
-            /* No point updating the file that is deleted anyway. */
-            if (!fDelete)
-                vciFlushImage(pCache);
-
-            vdIfIoIntFileClose(pCache->pIfIo, pCache->pStorage);
-            pCache->pStorage = NULL;
+            uint64_t u64Dirty = RT_H2LE_U64(pLine->au64Dirty[j]);
+            memcpy(&paEnts[i].abDirty[j * sizeof(uint64_t)], &u64Dirty, sizeof(uint64_t));
         }
-
-        if (fDelete && pCache->pszFilename)
-            vdIfIoIntFileDelete(pCache->pIfIo, pCache->pszFilename);
     }
-
-    LogFlowFunc(("returns %Rrc\n", rc));
-    return rc;
 }
 
 /**
- * Creates a new block map which can manage the given number of blocks.
- *
- * The size of the bitmap is aligned to the VCI block size.
- *
- * @returns VBox status code.
- * @param   cBlocks      The number of blocks the bitmap can manage.
- * @param   ppBlkMap     Where to store the pointer to the block bitmap.
- * @param   pcBlkMap     Where to store the size of the block bitmap in blocks
- *                       needed on the disk.
+ * Internal. Marks the given set as modified, it is written with the next flush.
  */
-static int vciBlkMapCreate(uint64_t cBlocks, PVCIBLKMAP *ppBlkMap, uint32_t *pcBlkMap)
+static void vciSetMarkDirty(PVCICACHE pCache, uint32_t idxSet)
 {
-    int rc = VINF_SUCCESS;
-    uint32_t cbBlkMap = RT_ALIGN_Z(cBlocks / sizeof(VciBlkMapEnt) / 8, VCI_BLOCK_SIZE);
-    PVCIBLKMAP pBlkMap = (PVCIBLKMAP)RTMemAllocZ(sizeof(VCIBLKMAP));
-    PVCIBLKRANGEDESC pFree   = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
-
-    LogFlowFunc(("cBlocks=%u ppBlkMap=%#p pcBlkMap=%#p\n", cBlocks, ppBlkMap, pcBlkMap));
-
-    if (pBlkMap && pFree)
-    {
-        pBlkMap->cBlocks          = cBlocks;
-        pBlkMap->cBlocksAllocMeta = 0;
-        pBlkMap->cBlocksAllocData = 0;
-        pBlkMap->cBlocksFree      = cBlocks;
-
-        pFree->pPrev = NULL;
-        pFree->pNext = NULL;
-        pFree->offAddrStart = 0;
-        pFree->cBlocks      = cBlocks;
-        pFree->fFree        = true;
-
-        pBlkMap->pRangesHead = pFree;
-        pBlkMap->pRangesTail = pFree;
-
-        Assert(!((cbBlkMap + sizeof(VciBlkMap)) % VCI_BLOCK_SIZE));
-        *ppBlkMap = pBlkMap;
-        *pcBlkMap = VCI_BYTE2BLOCK(cbBlkMap + sizeof(VciBlkMap));
-    }
-    else
-    {
-        if (pBlkMap)
-            RTMemFree(pBlkMap);
-        if (pFree)
-            RTMemFree(pFree);
-
-        rc = VERR_NO_MEMORY;
-    }
-
-    LogFlowFunc(("returns rc=%Rrc cBlkMap=%u\n", rc, *pcBlkMap));
-    return rc;
+    if (!ASMBitTestAndSet(pCache->pbmSetsDirty, idxSet))
+        pCache->cSetsDirty++;
 }
 
-#if 0 /** @todo unsued vciBlkMapDestroy */
 /**
- * Frees a block map.
- *
- * @returns nothing.
- * @param   pBlkMap         The block bitmap to destroy.
+ * Internal. Returns the number of dirty blocks in the given range of a line.
  */
-static void vciBlkMapDestroy(PVCIBLKMAP pBlkMap)
+static uint32_t vciLineDirtyCount(PVCILINE pLine, uint32_t iBlockFirst, uint32_t cBlocks)
 {
-    LogFlowFunc(("pBlkMap=%#p\n", pBlkMap));
-
-    PVCIBLKRANGEDESC pRangeCur = pBlkMap->pRangesHead;
-
-    while (pRangeCur)
-    {
-        PVCIBLKRANGEDESC pTmp = pRangeCur;
-
-        RTMemFree(pTmp);
-
-        pRangeCur = pRangeCur->pNext;
-    }
+    uint32_t cDirty = 0;
 
-    RTMemFree(pBlkMap);
+    for (uint32_t i = iBlockFirst; i < iBlockFirst + cBlocks; i++)
+        if (ASMBitTest(&pLine->au64Dirty[0], i))
+            cDirty++;
 
-    LogFlowFunc(("returns\n"));
+    return cDirty;
 }
-#endif
 
 /**
- * Loads the block map from the specified medium and creates all necessary
- * in memory structures to manage used and free blocks.
+ * Internal. Returns the first dirty run of a line starting at or after the
+ * given block.
  *
- * @returns VBox status code.
- * @param   pStorage        Storage handle to read the block bitmap from.
- * @param   offBlkMap       Start of the block bitmap in blocks.
- * @param   cBlkMap         Size of the block bitmap on the disk in blocks.
- * @param   ppBlkMap        Where to store the block bitmap on success.
+ * @returns true if a dirty run was found, false otherwise.
+ * @param   pLine       The line.
+ * @param   iBlock      The block to start searching at.
+ * @param   piBlockFirst Where to store the first block of the run.
+ * @param   pcBlocks    Where to store the number of blocks in the run.
  */
-static int vciBlkMapLoad(PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMap, PVCIBLKMAP *ppBlkMap)
+static bool vciLineDirtyRunGet(PVCILINE pLine, uint32_t iBlock, uint32_t *piBlockFirst,
+                               uint32_t *pcBlocks)
 {
-    int rc = VINF_SUCCESS;
-    VciBlkMap BlkMap;
-
-    LogFlowFunc(("pStorage=%#p offBlkMap=%llu cBlkMap=%u ppBlkMap=%#p\n",
-                 pStorage, offBlkMap, cBlkMap, ppBlkMap));
-
-    if (cBlkMap >= VCI_BYTE2BLOCK(sizeof(VciBlkMap)))
-    {
-        cBlkMap -= VCI_BYTE2BLOCK(sizeof(VciBlkMap));
-
-        rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage, offBlkMap,
-                                   &BlkMap, VCI_BYTE2BLOCK(sizeof(VciBlkMap)));
-        if (RT_SUCCESS(rc))
-        {
-            offBlkMap += VCI_BYTE2BLOCK(sizeof(VciBlkMap));
-
-            BlkMap.u32Magic         = RT_LE2H_U32(BlkMap.u32Magic);
-            BlkMap.u32Version       = RT_LE2H_U32(BlkMap.u32Version);
-            BlkMap.cBlocks          = RT_LE2H_U32(BlkMap.cBlocks);
-            BlkMap.cBlocksFree      = RT_LE2H_U32(BlkMap.cBlocksFree);
-            BlkMap.cBlocksAllocMeta = RT_LE2H_U32(BlkMap.cBlocksAllocMeta);
-            BlkMap.cBlocksAllocData = RT_LE2H_U32(BlkMap.cBlocksAllocData);
-
-            if (   BlkMap.u32Magic == VCI_BLKMAP_MAGIC
-                && BlkMap.u32Version == VCI_BLKMAP_VERSION
-                && BlkMap.cBlocks == BlkMap.cBlocksFree + BlkMap.cBlocksAllocMeta + BlkMap.cBlocksAllocData
-                && VCI_BYTE2BLOCK(BlkMap.cBlocks / 8) == cBlkMap)
-            {
-                PVCIBLKMAP pBlkMap = (PVCIBLKMAP)RTMemAllocZ(sizeof(VCIBLKMAP));
-                if (pBlkMap)
-                {
-                    pBlkMap->cBlocks          = BlkMap.cBlocks;
-                    pBlkMap->cBlocksFree      = BlkMap.cBlocksFree;
-                    pBlkMap->cBlocksAllocMeta = BlkMap.cBlocksAllocMeta;
-                    pBlkMap->cBlocksAllocData = BlkMap.cBlocksAllocData;
-
-                    /* Load the bitmap and construct the range list. */
-                    PVCIBLKRANGEDESC pRangeCur = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
-
-                    if (pRangeCur)
-                    {
-                        uint8_t abBitmapBuffer[16 * _1K];
-                        uint32_t cBlocksRead = 0;
-                        uint64_t cBlocksLeft = VCI_BYTE2BLOCK(pBlkMap->cBlocks / 8);
-
-                        cBlocksRead = RT_MIN(VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)), cBlocksLeft);
-                        rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage,
-                                                   offBlkMap, abBitmapBuffer,
-                                                   cBlocksRead);
-
-                        if (RT_SUCCESS(rc))
-                        {
-                            pRangeCur->fFree        = !(abBitmapBuffer[0] & 0x01);
-                            pRangeCur->offAddrStart = 0;
-                            pRangeCur->cBlocks      = 0;
-                            pRangeCur->pNext        = NULL;
-                            pRangeCur->pPrev        = NULL;
-                            pBlkMap->pRangesHead = pRangeCur;
-                            pBlkMap->pRangesTail = pRangeCur;
-                        }
-                        else
-                            RTMemFree(pRangeCur);
-
-                        while (   RT_SUCCESS(rc)
-                               && cBlocksLeft)
-                        {
-                            int iBit = 0;
-                            uint32_t cBits = VCI_BLOCK2BYTE(cBlocksRead) * 8;
-                            uint32_t iBitPrev = 0xffffffff;
-
-                            while (cBits)
-                            {
-                                if (pRangeCur->fFree)
-                                {
-                                    /* Check for the first set bit. */
-                                    iBit = ASMBitNextSet(abBitmapBuffer, cBits, iBitPrev);
-                                }
-                                else
-                                {
-                                    /* Check for the first free bit. */
-                                    iBit = ASMBitNextClear(abBitmapBuffer, cBits, iBitPrev);
-                                }
-
-                                if (iBit == -1)
-                                {
-                                    /* No change. */
-                                    pRangeCur->cBlocks += cBits;
-                                    cBits = 0;
-                                }
-                                else
-                                {
-                                    Assert((uint32_t)iBit < cBits);
-                                    pRangeCur->cBlocks += iBit;
-
-                                    /* Create a new range descriptor. */
-                                    PVCIBLKRANGEDESC pRangeNew = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
-                                    if (!pRangeNew)
-                                    {
-                                        rc = VERR_NO_MEMORY;
-                                        break;
-                                    }
-
-                                    pRangeNew->fFree = !pRangeCur->fFree;
-                                    pRangeNew->offAddrStart = pRangeCur->offAddrStart + pRangeCur->cBlocks;
-                                    pRangeNew->cBlocks = 0;
-                                    pRangeNew->pPrev = pRangeCur;
-                                    pRangeCur->pNext = pRangeNew;
-                                    pBlkMap->pRangesTail = pRangeNew;
-                                    pRangeCur = pRangeNew;
-                                    cBits -= iBit;
-                                    iBitPrev = iBit;
-                                }
-                            }
-
-                            cBlocksLeft -= cBlocksRead;
-                            offBlkMap   += cBlocksRead;
-
-                            if (   RT_SUCCESS(rc)
-                                && cBlocksLeft)
-                            {
-                                /* Read next chunk. */
-                                cBlocksRead = RT_MIN(VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)), cBlocksLeft);
-                                rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage,
-                                                           offBlkMap, abBitmapBuffer, cBlocksRead);
-                            }
-                        }
-                    }
-                    else
-                        rc = VERR_NO_MEMORY;
-
-                    if (RT_SUCCESS(rc))
-                    {
-                        *ppBlkMap = pBlkMap;
-                        LogFlowFunc(("return success\n"));
-                        return VINF_SUCCESS;
-                    }
-
-                    RTMemFree(pBlkMap);
-                }
-                else
-                    rc = VERR_NO_MEMORY;
-            }
-            else
-                rc = VERR_VD_GEN_INVALID_HEADER;
-        }
-        else
-            rc = VERR_VD_GEN_INVALID_HEADER;
-    }
-    else
-        rc = VERR_VD_GEN_INVALID_HEADER;
-
-    LogFlowFunc(("returns rc=%Rrc\n", rc));
-    return rc;
+    if (iBlock >= VCI_LINE_BLOCKS)
+        return false;
+
+    int iFirst =   ASMBitTest(&pLine->au64Dirty[0], iBlock)
+                 ? (int)iBlock
+                 : ASMBitNextSet(&pLine->au64Dirty[0], VCI_LINE_BLOCKS, iBlock);
+    if (iFirst < 0)
+        return false;
+
+    int iEnd = ASMBitNextClear(&pLine->au64Dirty[0], VCI_LINE_BLOCKS, iFirst);
+    if (iEnd < 0)
+        iEnd = VCI_LINE_BLOCKS;
+
+    *piBlockFirst = (uint32_t)iFirst;
+    *pcBlocks     = (uint32_t)(iEnd - iFirst);
+    return true;
 }
 
 /**
- * Saves the block map in the cache image. All necessary on disk structures
- * are written.
- *
- * @returns VBox status code.
- * @param   pBlkMap         The block bitmap to save.
- * @param   pStorage        Where the block bitmap should be written to.
- * @param   offBlkMap       Start of the block bitmap in blocks.
- * @param   cBlkMap         Size of the block bitmap on the disk in blocks.
+ * Internal. Returns the image offset of the given line in bytes.
  */
-static int vciBlkMapSave(PVCIBLKMAP pBlkMap, PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMap)
+DECLINLINE(uint64_t) vciLineGetDataOffset(PVCICACHE pCache, PVCILINE pLine)
 {
-    int rc = VINF_SUCCESS;
-    VciBlkMap BlkMap;
-
-    LogFlowFunc(("pBlkMap=%#p pStorage=%#p offBlkMap=%llu cBlkMap=%u\n",
-                 pBlkMap, pStorage, offBlkMap, cBlkMap));
-
-    /* Make sure the number of blocks allocated for us match our expectations. */
-    if (VCI_BYTE2BLOCK(pBlkMap->cBlocks / 8) + VCI_BYTE2BLOCK(sizeof(VciBlkMap)) == cBlkMap)
-    {
-        /* Setup the header */
-        memset(&BlkMap, 0, sizeof(VciBlkMap));
-
-        BlkMap.u32Magic         = RT_H2LE_U32(VCI_BLKMAP_MAGIC);
-        BlkMap.u32Version       = RT_H2LE_U32(VCI_BLKMAP_VERSION);
-        BlkMap.cBlocks          = RT_H2LE_U32(pBlkMap->cBlocks);
-        BlkMap.cBlocksFree      = RT_H2LE_U32(pBlkMap->cBlocksFree);
-        BlkMap.cBlocksAllocMeta = RT_H2LE_U32(pBlkMap->cBlocksAllocMeta);
-        BlkMap.cBlocksAllocData = RT_H2LE_U32(pBlkMap->cBlocksAllocData);
-
-        rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage, offBlkMap,
-                                    &BlkMap, VCI_BYTE2BLOCK(sizeof(VciBlkMap)));
-        if (RT_SUCCESS(rc))
-        {
-            uint8_t abBitmapBuffer[16*_1K];
-            unsigned iBit = 0;
-            PVCIBLKRANGEDESC pCur = pBlkMap->pRangesHead;
-
-            offBlkMap += VCI_BYTE2BLOCK(sizeof(VciBlkMap));
-
-            /* Write the descriptor ranges. */
-            while (pCur)
-            {
-                uint64_t cBlocks = pCur->cBlocks;
-
-                while (cBlocks)
-                {
-                    uint64_t cBlocksMax = RT_MIN(cBlocks, sizeof(abBitmapBuffer) * 8 - iBit);
-
-                    if (pCur->fFree)
-                        ASMBitClearRange(abBitmapBuffer, iBit, iBit + cBlocksMax);
-                    else
-                        ASMBitSetRange(abBitmapBuffer, iBit, iBit + cBlocksMax);
-
-                    iBit    += cBlocksMax;
-                    cBlocks -= cBlocksMax;
-
-                    if (iBit == sizeof(abBitmapBuffer) * 8)
-                    {
-                        /* Buffer is full, write to file and reset. */
-                        rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage,
-                                                    offBlkMap, abBitmapBuffer,
-                                                    VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)));
-                        if (RT_FAILURE(rc))
-                            break;
-
-                        offBlkMap += VCI_BYTE2BLOCK(sizeof(abBitmapBuffer));
-                        iBit = 0;
-                    }
-                }
-
-                pCur = pCur->pNext;
-            }
-
-            Assert(iBit % 8 == 0);
-
-            if (RT_SUCCESS(rc) && iBit)
-                rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage,
-                                            offBlkMap, abBitmapBuffer, VCI_BYTE2BLOCK(iBit / 8));
-        }
-    }
-    else
-        rc = VERR_INTERNAL_ERROR; /** @todo Better error code. */
-
-    LogFlowFunc(("returns rc=%Rrc\n", rc));
-    return rc;
+    return pCache->offData + (uint64_t)(pLine - pCache->paLines) * VCI_LINE_SIZE;
 }
 
-#if 0 /* unused */
 /**
- * Finds the range block describing the given block address.
+ * Internal. Looks up the line caching the given virtual disk line.
  *
- * @returns Pointer to the block range descriptor or NULL if none could be found.
- * @param   pBlkMap         The block bitmap to search on.
- * @param   offBlockAddr    The block address to search for.
+ * @returns Pointer to the line or NULL if the line is not cached.
  */
-static PVCIBLKRANGEDESC vciBlkMapFindByBlock(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr)
+static PVCILINE vciLineLookup(PVCICACHE pCache, uint64_t uLine)
 {
-    PVCIBLKRANGEDESC pBlk = pBlkMap->pRangesHead;
+    PVCILINE pLine = &pCache->paLines[(size_t)(uLine % pCache->cSets) * VCI_SET_WAYS];
 
-    while (   pBlk
-           && pBlk->offAddrStart < offBlockAddr)
-        pBlk = pBlk->pNext;
+    for (unsigned i = 0; i < VCI_SET_WAYS; i++, pLine++)
+        if (pLine->uLineTag == uLine + 1)
+            return pLine;
 
-    return pBlk;
+    return NULL;
 }
-#endif
 
 /**
- * Allocates the given number of blocks in the bitmap and returns the start block address.
+ * Internal. Assigns a line of the set the given virtual disk line belongs to.
  *
- * @returns VBox status code.
- * @param   pBlkMap          The block bitmap to allocate the blocks from.
- * @param   cBlocks          How many blocks to allocate.
- * @param   fFlags           Allocation flags, comgination of VCIBLKMAP_ALLOC_*.
- * @param   poffBlockAddr    Where to store the start address of the allocated region.
+ * Only unused lines or clean lines which are known to be clean on the disk
+ * can be taken, the least recently used one is picked.
+ *
+ * @returns Pointer to the line or NULL if all lines of the set are in use.
  */
-static int vciBlkMapAllocate(PVCIBLKMAP pBlkMap, uint32_t cBlocks, uint32_t fFlags,
-                             uint64_t *poffBlockAddr)
+static PVCILINE vciLineAlloc(PVCICACHE pCache, uint64_t uLine)
 {
-    PVCIBLKRANGEDESC pBestFit = NULL;
-    PVCIBLKRANGEDESC pCur = NULL;
-    int rc = VINF_SUCCESS;
-
-    LogFlowFunc(("pBlkMap=%#p cBlocks=%u poffBlockAddr=%#p\n",
-                 pBlkMap, cBlocks, poffBlockAddr));
+    uint32_t idxSet = (uint32_t)(uLine % pCache->cSets);
+    PVCILINE pLine = &pCache->paLines[(size_t)idxSet * VCI_SET_WAYS];
+    PVCILINE pLineFree = NULL;
 
-    pCur = pBlkMap->pRangesHead;
-
-    while (pCur)
+    for (unsigned i = 0; i < VCI_SET_WAYS; i++, pLine++)
     {
-        if (   pCur->fFree
-            && pCur->cBlocks >= cBlocks)
+        if (!pLine->uLineTag)
         {
-            if (   !pBestFit
-                || pCur->cBlocks < pBestFit->cBlocks)
-            {
-                pBestFit = pCur;
-                /* Stop searching if the size is matching exactly. */
-                if (pBestFit->cBlocks == cBlocks)
-                    break;
-            }
+            pLineFree = pLine;
+            break;
         }
-        pCur = pCur->pNext;
-    }
-
-    Assert(!pBestFit || pBestFit->fFree);
-
-    if (pBestFit)
-    {
-        pBestFit->fFree = false;
-
-        if (pBestFit->cBlocks > cBlocks)
-        {
-            /* Create a new free block. */
-            PVCIBLKRANGEDESC pFree = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
 
-            if (pFree)
-            {
-                pFree->fFree = true;
-                pFree->cBlocks = pBestFit->cBlocks - cBlocks;
-                pBestFit->cBlocks -= pFree->cBlocks;
-                pFree->offAddrStart = pBestFit->offAddrStart + cBlocks;
-
-                /* Link into the list. */
-                pFree->pNext = pBestFit->pNext;
-                pBestFit->pNext = pFree;
-                pFree->pPrev    = pBestFit;
-                if (!pFree->pNext)
-                    pBlkMap->pRangesTail = pFree;
-
-                *poffBlockAddr = pBestFit->offAddrStart;
-            }
-            else
-            {
-                rc = VERR_NO_MEMORY;
-                pBestFit->fFree = true;
-            }
-        }
+        if (   !pLine->Core.Key
+            && !pLine->cWritesActive
+            && pLine->uFlushGenClean < pCache->uFlushGenDone
+            && (   !pLineFree
+                || pLine->uLastAccess < pLineFree->uLastAccess))
+            pLineFree = pLine;
     }
-    else
-        rc = VERR_VCI_NO_BLOCKS_FREE;
 
-    if (RT_SUCCESS(rc))
+    if (pLineFree)
     {
-        if ((fFlags & VCIBLKMAP_ALLOC_MASK) == VCIBLKMAP_ALLOC_DATA)
-            pBlkMap->cBlocksAllocMeta += cBlocks;
-        else
-            pBlkMap->cBlocksAllocData += cBlocks;
-
-        pBlkMap->cBlocksFree -= cBlocks;
+        Assert(!pLineFree->au64Dirty[0] && !pLineFree->au64Dirty[1]);
+        pLineFree->uLineTag = uLine + 1;
+        vciSetMarkDirty(pCache, idxSet);
     }
 
-    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, *poffBlockAddr));
-    return rc;
+    return pLineFree;
 }
 
-#if 0 /* unused */
 /**
- * Try to extend the space of an already allocated block.
- *
- * @returns VBox status code.
- * @param   pBlkMap          The block bitmap to allocate the blocks from.
- * @param   cBlocksNew       How many blocks the extended block should have.
- * @param   offBlockAddrOld  The start address of the block to reallocate.
- * @param   poffBlockAddr    Where to store the start address of the allocated region.
+ * Internal. Writes the whole line directory synchronously.
  */
-static int vciBlkMapRealloc(PVCIBLKMAP pBlkMap, uint32_t cBlocksNew, uint64_t offBlockAddrOld,
-                            uint64_t *poffBlockAddr)
+static int vciLineDirWriteSync(PVCICACHE pCache)
 {
     int rc = VINF_SUCCESS;
+    uint32_t cSetsPerChunk = _64K / VCI_BLOCK_SIZE;
+    PVciLineEnt paEnts = (PVciLineEnt)RTMemAlloc(cSetsPerChunk * VCI_BLOCK_SIZE);
+
+    if (!paEnts)
+        return VERR_NO_MEMORY;
 
-    LogFlowFunc(("pBlkMap=%#p cBlocksNew=%u offBlockAddrOld=%llu poffBlockAddr=%#p\n",
-                 pBlkMap, cBlocksNew, offBlockAddrOld, poffBlockAddr));
+    for (uint32_t idxSet = 0; idxSet < pCache->cSets && RT_SUCCESS(rc); idxSet += cSetsPerChunk)
+    {
+        uint32_t cSets = RT_MIN(cSetsPerChunk, pCache->cSets - idxSet);
+
+        for (uint32_t i = 0; i < cSets; i++)
+            vciSetToDisk(pCache, idxSet + i, &paEnts[i * VCI_SET_WAYS]);
+
+        rc = vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage,
+                                    pCache->offLineDir + VCI_BLOCK2BYTE(idxSet),
+                                    paEnts, cSets * VCI_BLOCK_SIZE);
+    }
 
-    AssertMsgFailed(("Implement\n"));
-    RT_NOREF4(pBlkMap, cBlocksNew, offBlockAddrOld, poffBlockAddr);
+    if (RT_SUCCESS(rc))
+    {
+        ASMBitClearRange(pCache->pbmSetsDirty, 0, RT_ALIGN_32(pCache->cSets, 32));
+        pCache->cSetsDirty = 0;
+    }
 
-    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, *poffBlockAddr));
+    RTMemFree(paEnts);
     return rc;
 }
-#endif /* unused */
 
-#if 0 /* unused */
 /**
- * Frees a range of blocks.
- *
- * @returns nothing.
- * @param   pBlkMap          The block bitmap.
- * @param   offBlockAddr     Address of the first block to free.
- * @param   cBlocks          How many blocks to free.
- * @param   fFlags           Allocation flags, comgination of VCIBLKMAP_ALLOC_*.
+ * Internal. Loads the line directory and builds the dirty line tree.
  */
-static void vciBlkMapFree(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr, uint32_t cBlocks,
-                          uint32_t fFlags)
+static int vciLineDirLoad(PVCICACHE pCache)
 {
-    PVCIBLKRANGEDESC pBlk;
+    int rc = VINF_SUCCESS;
+    uint32_t cSetsPerChunk = _64K / VCI_BLOCK_SIZE;
+    PVciLineEnt paEnts = (PVciLineEnt)RTMemAlloc(cSetsPerChunk * VCI_BLOCK_SIZE);
 
-    LogFlowFunc(("pBlkMap=%#p offBlockAddr=%llu cBlocks=%u\n",
-                 pBlkMap, offBlockAddr, cBlocks));
+    if (!paEnts)
+        return VERR_NO_MEMORY;
 
-    while (cBlocks)
+    for (uint32_t idxSet = 0; idxSet < pCache->cSets && RT_SUCCESS(rc); idxSet += cSetsPerChunk)
     {
-        pBlk = vciBlkMapFindByBlock(pBlkMap, offBlockAddr);
-        AssertPtr(pBlk);
+        uint32_t cSets = RT_MIN(cSetsPerChunk, pCache->cSets - idxSet);
 
-        /* Easy case, the whole block is freed. */
-        if (   pBlk->offAddrStart == offBlockAddr
-            && pBlk->cBlocks <= cBlocks)
-        {
-            pBlk->fFree = true;
-            cBlocks      -= pBlk->cBlocks;
-            offBlockAddr += pBlk->cBlocks;
+        rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
+                                   pCache->offLineDir + VCI_BLOCK2BYTE(idxSet),
+                                   paEnts, cSets * VCI_BLOCK_SIZE);
+        if (RT_FAILURE(rc))
+            break;
 
-            /* Check if it is possible to merge free blocks. */
-            if (   pBlk->pPrev
-                && pBlk->pPrev->fFree)
-            {
-                PVCIBLKRANGEDESC pBlkPrev = pBlk->pPrev;
+        for (uint32_t i = 0; i < cSets * VCI_SET_WAYS; i++)
+        {
+            PVCILINE pLine = &pCache->paLines[(size_t)idxSet * VCI_SET_WAYS + i];
+            uint64_t uLineTag = RT_LE2H_U64(paEnts[i].u64LineTag);
 
-                Assert(pBlkPrev->offAddrStart + pBlkPrev->cBlocks == pBlk->offAddrStart);
-                pBlkPrev->cBlocks += pBlk->cBlocks;
-                pBlkPrev->pNext = pBlk->pNext;
-                if (pBlk->pNext)
-                    pBlk->pNext->pPrev = pBlkPrev;
-                else
-                    pBlkMap->pRangesTail = pBlkPrev;
+            if (!uLineTag)
+                continue;
 
-                RTMemFree(pBlk);
-                pBlk = pBlkPrev;
+            if ((uLineTag - 1) % pCache->cSets != idxSet + i / VCI_SET_WAYS)
+            {
+                rc = VERR_VD_GEN_INVALID_HEADER;
+                break;
             }
 
-            /* Now the one to the right. */
-            if (   pBlk->pNext
-                && pBlk->pNext->fFree)
+            pLine->uLineTag = uLineTag;
+            for (unsigned j = 0; j < RT_ELEMENTS(pLine->au64Dirty); j++)
             {
-                PVCIBLKRANGEDESC pBlkNext = pBlk->pNext;
+                uint64_t u64Dirty;
+                memcpy(&u64Dirty, &paEnts[i].abDirty[j * sizeof(uint64_t)], sizeof(uint64_t));
+                pLine->au64Dirty[j] = RT_LE2H_U64(u64Dirty);
+            }
 
-                Assert(pBlk->offAddrStart + pBlk->cBlocks == pBlkNext->offAddrStart);
-                pBlk->cBlocks += pBlkNext->cBlocks;
-                pBlk->pNext = pBlkNext->pNext;
-                if (pBlkNext->pNext)
-                    pBlkNext->pNext->pPrev = pBlk;
-                else
-                    pBlkMap->pRangesTail = pBlk;
+            uint32_t cDirty = vciLineDirtyCount(pLine, 0, VCI_LINE_BLOCKS);
+            if (cDirty)
+            {
+                pLine->Core.Key = RT_LE2H_U64(paEnts[i].u64Seq);
+                if (   !pLine->Core.Key
+                    || !RTAvlU64Insert(&pCache->TreeDirty, &pLine->Core))
+                {
+                    rc = VERR_VD_GEN_INVALID_HEADER;
+                    break;
+                }
 
-                RTMemFree(pBlkNext);
+                pCache->cBlocksDirty += cDirty;
+                pCache->uSeqNext = RT_MAX(pCache->uSeqNext, pLine->Core.Key + 1);
             }
         }
-        else
-        {
-            /* The block is intersecting. */
-            AssertMsgFailed(("TODO\n"));
-        }
     }
 
-    if ((fFlags & VCIBLKMAP_ALLOC_MASK) == VCIBLKMAP_ALLOC_DATA)
-        pBlkMap->cBlocksAllocMeta -= cBlocks;
-    else
-        pBlkMap->cBlocksAllocData -= cBlocks;
-
-    pBlkMap->cBlocksFree += cBlocks;
-
-    LogFlowFunc(("returns\n"));
+    RTMemFree(paEnts);
+    return rc;
 }
-#endif /* unused */
 
 /**
- * Converts a tree node from the image to the in memory structure.
- *
- * @returns Pointer to the in memory tree node.
- * @param   offBlockAddrNode    Block address of the node.
- * @param   pNodeImage          Pointer to the image representation of the node.
+ * Internal. Writes the header.
  */
-static PVCITREENODE vciTreeNodeImage2Host(uint64_t offBlockAddrNode, PVciTreeNode pNodeImage)
+static int vciHdrWrite(PVCICACHE pCache, bool fClean)
 {
-    PVCITREENODE pNode = NULL;
-
-    if (pNodeImage->u8Type == VCI_TREE_NODE_TYPE_LEAF)
-    {
-        PVCITREENODELEAF pLeaf = (PVCITREENODELEAF)RTMemAllocZ(sizeof(VCITREENODELEAF));
-
-        if (pLeaf)
-        {
-            PVciCacheExtent pExtent = (PVciCacheExtent)&pNodeImage->au8Data[0];
-
-            pLeaf->Core.u8Type = VCI_TREE_NODE_TYPE_LEAF;
-
-            for (unsigned idx = 0; idx < RT_ELEMENTS(pLeaf->aExtents); idx++)
-            {
-                pLeaf->aExtents[idx].u64BlockOffset = RT_LE2H_U64(pExtent->u64BlockOffset);
-                pLeaf->aExtents[idx].u32Blocks      = RT_LE2H_U32(pExtent->u32Blocks);
-                pLeaf->aExtents[idx].u64BlockAddr   = RT_LE2H_U64(pExtent->u64BlockAddr);
-                pExtent++;
-
-                if (   pLeaf->aExtents[idx].u32Blocks
-                    && pLeaf->aExtents[idx].u64BlockAddr)
-                    pLeaf->cUsedNodes++;
-            }
-
-            pNode = &pLeaf->Core;
-        }
-    }
-    else if (pNodeImage->u8Type == VCI_TREE_NODE_TYPE_INTERNAL)
-    {
-        PVCITREENODEINT pInt = (PVCITREENODEINT)RTMemAllocZ(sizeof(VCITREENODEINT));
-
-        if (pInt)
-        {
-            PVciTreeNodeInternal pIntImage = (PVciTreeNodeInternal)&pNodeImage->au8Data[0];
-
-            pInt->Core.u8Type = VCI_TREE_NODE_TYPE_INTERNAL;
-
-            for (unsigned idx = 0; idx < RT_ELEMENTS(pInt->aIntNodes); idx++)
-            {
-                pInt->aIntNodes[idx].u64BlockOffset              = RT_LE2H_U64(pIntImage->u64BlockOffset);
-                pInt->aIntNodes[idx].u32Blocks                   = RT_LE2H_U32(pIntImage->u32Blocks);
-                pInt->aIntNodes[idx].PtrChild.fInMemory          = false;
-                pInt->aIntNodes[idx].PtrChild.u.offAddrBlockNode = RT_LE2H_U64(pIntImage->u64ChildAddr);
-                pIntImage++;
-
-                if (   pInt->aIntNodes[idx].u32Blocks
-                    && pInt->aIntNodes[idx].PtrChild.u.offAddrBlockNode)
-                    pInt->cUsedNodes++;
-            }
-
-            pNode = &pInt->Core;
-        }
-    }
-    else
-        AssertMsgFailed(("Invalid node type %d\n", pNodeImage->u8Type));
+    VciHdr Hdr;
 
-    if (pNode)
-        pNode->u64BlockAddr = offBlockAddrNode;
+    memset(&Hdr, 0, sizeof(VciHdr));
+    Hdr.u32Signature     = RT_H2LE_U32(VCI_HDR_SIGNATURE);
+    Hdr.u32Version       = RT_H2LE_U32(VCI_HDR_VERSION);
+    Hdr.cBlocksCache     = RT_H2LE_U64(VCI_BYTE2BLOCK(pCache->cbSize));
+    Hdr.fUncleanShutdown = fClean ? VCI_HDR_CLEAN_SHUTDOWN : VCI_HDR_UNCLEAN_SHUTDOWN;
+    Hdr.u32CacheType     = pCache->uImageFlags & VD_IMAGE_FLAGS_FIXED
+                           ? RT_H2LE_U32(VCI_HDR_CACHE_TYPE_FIXED)
+                           : RT_H2LE_U32(VCI_HDR_CACHE_TYPE_DYNAMIC);
+    Hdr.offLineDir       = RT_H2LE_U64(VCI_BYTE2BLOCK(pCache->offLineDir));
+    Hdr.cSets            = RT_H2LE_U32(pCache->cSets);
+    Hdr.cBlocksPerLine   = RT_H2LE_U32(VCI_LINE_BLOCKS);
+    Hdr.offData          = RT_H2LE_U64(VCI_BYTE2BLOCK(pCache->offData));
+
+    return vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, 0, &Hdr, sizeof(Hdr));
+}
 
-    return pNode;
+/**
+ * Internal. Allocates the in memory state for the line directory.
+ */
+static int vciLinesAlloc(PVCICACHE pCache)
+{
+    pCache->paLines = (PVCILINE)RTMemAllocZ((size_t)pCache->cSets * VCI_SET_WAYS * sizeof(VCILINE));
+    pCache->pbmSetsDirty = (uint32_t *)RTMemAllocZ(RT_ALIGN_32(pCache->cSets, 32) / 8);
+    if (   !pCache->paLines
+        || !pCache->pbmSetsDirty)
+        return VERR_NO_MEMORY;
+
+    pCache->cSetsDirty    = 0;
+    pCache->TreeDirty     = NULL;
+    pCache->uSeqNext      = 1;
+    pCache->uAccessNext   = 0;
+    pCache->cBlocksDirty  = 0;
+    pCache->uFlushGenNext = 1;
+    pCache->uFlushGenDone = 1;
+    return VINF_SUCCESS;
 }
 
 /**
- * Looks up the cache extent for the given virtual block address.
- *
- * @returns Pointer to the cache extent or NULL if none could be found.
- * @param   pCache         The cache image instance.
- * @param   offBlockOffset The block offset to search for.
- * @param   ppNextBestFit  Where to store the pointer to the next best fit
- *                         cache extent above offBlockOffset if existing. - Optional
- *                         This is always filled if possible even if the function returns NULL.
+ * Internal. Free all allocated space for representing an image except pCache,
+ * and optionally delete the image from disk.
  */
-static PVCICACHEEXTENT vciCacheExtentLookup(PVCICACHE pCache, uint64_t offBlockOffset,
-                                            PVCICACHEEXTENT *ppNextBestFit)
+static int vciFreeImage(PVCICACHE pCache, bool fDelete)
 {
     int rc = VINF_SUCCESS;
-    PVCICACHEEXTENT pExtent = NULL;
-    PVCITREENODE pNodeCur = pCache->pRoot;
 
-    while (   RT_SUCCESS(rc)
-           && pNodeCur
-           && pNodeCur->u8Type != VCI_TREE_NODE_TYPE_LEAF)
+    /* Freeing a never allocated image (e.g. because the open failed) is
+     * not signalled as an error. After all nothing bad happens. */
+    if (pCache)
     {
-        PVCITREENODEINT pNodeInt = (PVCITREENODEINT)pNodeCur;
-
-        Assert(pNodeCur->u8Type == VCI_TREE_NODE_TYPE_INTERNAL);
-
-        /* Search for the correct internal node. */
-        unsigned idxMin = 0;
-        unsigned idxMax = pNodeInt->cUsedNodes;
-        unsigned idxCur = pNodeInt->cUsedNodes / 2;
-
-        while (idxMin < idxMax)
+        if (pCache->pStorage)
         {
-            PVCINODEINTERNAL pInt = &pNodeInt->aIntNodes[idxCur];
-
-            /* Determine the search direction. */
-            if (offBlockOffset < pInt->u64BlockOffset)
-            {
-                /* Search left from the current extent. */
-                idxMax = idxCur;
-            }
-            else if (offBlockOffset >= pInt->u64BlockOffset + pInt->u32Blocks)
-            {
-                /* Search right from the current extent. */
-                idxMin = idxCur;
-            }
-            else
+            /* No point updating the file that is deleted anyway. */
+            if (   !fDelete
+                && !(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+                && pCache->paLines)
             {
-                /* The block lies in the node, stop searching. */
-                if (pInt->PtrChild.fInMemory)
-                    pNodeCur = pInt->PtrChild.u.pNode;
-                else
-                {
-                    PVCITREENODE pNodeNew;
-                    VciTreeNode NodeTree;
-
-                    /* Read from disk and add to the tree. */
-                    rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
-                                               VCI_BLOCK2BYTE(pInt->PtrChild.u.offAddrBlockNode),
-                                               &NodeTree, sizeof(NodeTree));
-                    AssertRC(rc);
-
-                    pNodeNew = vciTreeNodeImage2Host(pInt->PtrChild.u.offAddrBlockNode, &NodeTree);
-                    if (pNodeNew)
-                    {
-                        /* Link to the parent. */
-                        pInt->PtrChild.fInMemory = true;
-                        pInt->PtrChild.u.pNode = pNodeNew;
-                        pNodeNew->pParent = pNodeCur;
-                        pNodeCur = pNodeNew;
-                    }
-                    else
-                        rc = VERR_NO_MEMORY;
-                }
-                break;
+                /* The directory must be on the disk before the header marks the cache as clean. */
+                rc = vciLineDirWriteSync(pCache);
+                if (RT_SUCCESS(rc))
+                    rc = vciFlushImage(pCache);
+                if (RT_SUCCESS(rc))
+                    rc = vciHdrWrite(pCache, true /* fClean */);
             }
 
-            idxCur = idxMin + (idxMax - idxMin) / 2;
-        }
-    }
-
-    if (   RT_SUCCESS(rc)
-        && pNodeCur)
-    {
-        PVCITREENODELEAF pLeaf = (PVCITREENODELEAF)pNodeCur;
-        Assert(pNodeCur->u8Type == VCI_TREE_NODE_TYPE_LEAF);
+            if (!fDelete)
+                vciFlushImage(pCache);
 
-        /* Search the range. */
-        unsigned idxMin = 0;
-        unsigned idxMax = pLeaf->cUsedNodes;
-        unsigned idxCur = pLeaf->cUsedNodes / 2;
+            vdIfIoIntFileClose(pCache->pIfIo, pCache->pStorage);
+            pCache->pStorage = NULL;
+        }
 
-        while (idxMin < idxMax)
+        if (pCache->paLines)
         {
-            PVCICACHEEXTENT pExtentCur = &pLeaf->aExtents[idxCur];
-
-            /* Determine the search direction. */
-            if (offBlockOffset < pExtentCur->u64BlockOffset)
-            {
-                /* Search left from the current extent. */
-                idxMax = idxCur;
-            }
-            else if (offBlockOffset >= pExtentCur->u64BlockOffset + pExtentCur->u32Blocks)
-            {
-                /* Search right from the current extent. */
-                idxMin = idxCur;
-            }
-            else
-            {
-                /* We found the extent, stop searching. */
-                pExtent = pExtentCur;
-                break;
-            }
-
-            idxCur = idxMin + (idxMax - idxMin) / 2;
+            RTMemFree(pCache->paLines);
+            pCache->paLines = NULL;
         }
 
-        /* Get the next best fit extent if it exists. */
-        if (ppNextBestFit)
+        if (pCache->pbmSetsDirty)
         {
-            if (idxCur < pLeaf->cUsedNodes - 1)
-                *ppNextBestFit = &pLeaf->aExtents[idxCur + 1];
-            else
-            {
-                /*
-                 * Go up the tree and find the best extent
-                 * in the leftmost tree of the child subtree to the right.
-                 */
-                PVCITREENODEINT pInt = (PVCITREENODEINT)pLeaf->Core.pParent;
+            RTMemFree(pCache->pbmSetsDirty);
+            pCache->pbmSetsDirty = NULL;
+        }
 
-                while (pInt)
-                {
+        pCache->TreeDirty = NULL;
 
-                }
-            }
-        }
+        if (fDelete && pCache->pszFilename)
+            vdIfIoIntFileDelete(pCache->pIfIo, pCache->pszFilename);
     }
 
-    return pExtent;
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
 }
 
 /**
@@ -1242,48 +670,61 @@ static int vciOpenImage(PVCICACHE pCache, unsigned uOpenFlags)
         goto out;
     }
 
-    rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage, 0, &Hdr,
-                               VCI_BYTE2BLOCK(sizeof(Hdr)));
+    rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage, 0, &Hdr, sizeof(Hdr));
     if (RT_FAILURE(rc))
     {
         rc = VERR_VD_GEN_INVALID_HEADER;
         goto out;
     }
 
-    Hdr.u32Signature = RT_LE2H_U32(Hdr.u32Signature);
-    Hdr.u32Version   = RT_LE2H_U32(Hdr.u32Version);
-    Hdr.cBlocksCache = RT_LE2H_U64(Hdr.cBlocksCache);
-    Hdr.u32CacheType = RT_LE2H_U32(Hdr.u32CacheType);
-    Hdr.offTreeRoot  = RT_LE2H_U64(Hdr.offTreeRoot);
-    Hdr.offBlkMap    = RT_LE2H_U64(Hdr.offBlkMap);
-    Hdr.cBlkMap      = RT_LE2H_U32(Hdr.cBlkMap);
-
-    if (   Hdr.u32Signature == VCI_HDR_SIGNATURE
-        && Hdr.u32Version == VCI_HDR_VERSION)
+    Hdr.u32Signature   = RT_LE2H_U32(Hdr.u32Signature);
+    Hdr.u32Version     = RT_LE2H_U32(Hdr.u32Version);
+    Hdr.cBlocksCache   = RT_LE2H_U64(Hdr.cBlocksCache);
+    Hdr.u32CacheType   = RT_LE2H_U32(Hdr.u32CacheType);
+    Hdr.offLineDir     = RT_LE2H_U64(Hdr.offLineDir);
+    Hdr.cSets          = RT_LE2H_U32(Hdr.cSets);
+    Hdr.cBlocksPerLine = RT_LE2H_U32(Hdr.cBlocksPerLine);
+    Hdr.offData        = RT_LE2H_U64(Hdr.offData);
+
+    if (   Hdr.u32Signature != VCI_HDR_SIGNATURE
+        || Hdr.u32Version != VCI_HDR_VERSION
+        || Hdr.cBlocksPerLine != VCI_LINE_BLOCKS
+        || !Hdr.cSets
+        || Hdr.offLineDir + Hdr.cSets > Hdr.offData
+        || Hdr.offData + (uint64_t)Hdr.cSets * VCI_SET_WAYS * VCI_LINE_BLOCKS > Hdr.cBlocksCache
+        || cbFile < VCI_BLOCK2BYTE(Hdr.offLineDir + Hdr.cSets))
     {
-        pCache->offTreeRoot   = Hdr.offTreeRoot;
-        pCache->offBlksBitmap = Hdr.offBlkMap;
+        rc = VERR_VD_GEN_INVALID_HEADER;
+        goto out;
+    }
 
-        /* Load the block map. */
-        rc = vciBlkMapLoad(pCache, pCache->offBlksBitmap, Hdr.cBlkMap, &pCache->pBlkMap);
-        if (RT_SUCCESS(rc))
-        {
-            /* Load the first tree node. */
-            VciTreeNode RootNode;
+    pCache->cbSize      = VCI_BLOCK2BYTE(Hdr.cBlocksCache);
+    pCache->uImageFlags = Hdr.u32CacheType == VCI_HDR_CACHE_TYPE_FIXED ? VD_IMAGE_FLAGS_FIXED : 0;
+    pCache->offLineDir  = VCI_BLOCK2BYTE(Hdr.offLineDir);
+    pCache->offData     = VCI_BLOCK2BYTE(Hdr.offData);
+    pCache->cSets       = Hdr.cSets;
 
-            rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
-                                       pCache->offTreeRoot, &RootNode,
-                                       VCI_BYTE2BLOCK(sizeof(VciTreeNode)));
-            if (RT_SUCCESS(rc))
-            {
-                pCache->pRoot = vciTreeNodeImage2Host(pCache->offTreeRoot, &RootNode);
-                if (!pCache->pRoot)
-                    rc = VERR_NO_MEMORY;
-            }
-        }
+    rc = vciLinesAlloc(pCache);
+    if (RT_SUCCESS(rc))
+        rc = vciLineDirLoad(pCache);
+    if (RT_FAILURE(rc))
+        goto out;
+
+    /*
+     * Nothing needs to be recovered after an unclean shutdown: the directory is
+     * only written after the data it references was flushed and lines are reused
+     * only after their clean state reached the disk.
+     */
+    if (Hdr.fUncleanShutdown != VCI_HDR_CLEAN_SHUTDOWN)
+        LogRel(("VCI: Cache '%s' was not closed cleanly, %llu bytes of dirty data are kept\n",
+                pCache->pszFilename, VCI_BLOCK2BYTE(pCache->cBlocksDirty)));
+
+    if (!(uOpenFlags & VD_OPEN_FLAGS_READONLY))
+    {
+        rc = vciHdrWrite(pCache, false /* fClean */);
+        if (RT_SUCCESS(rc))
+            rc = vciFlushImage(pCache);
     }
-    else
-        rc = VERR_VD_GEN_INVALID_HEADER;
 
 out:
     if (RT_FAILURE(rc))
@@ -1301,10 +742,7 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
                           unsigned uPercentSpan)
 {
     RT_NOREF1(pszComment);
-    VciHdr Hdr;
-    VciTreeNode NodeRoot;
     int rc;
-    uint64_t cBlocks = cbSize / VCI_BLOCK_SIZE; /* Size of the cache in blocks. */
 
     pCache->uImageFlags = uImageFlags;
     pCache->uOpenFlags = uOpenFlags & ~VD_OPEN_FLAGS_READONLY;
@@ -1319,6 +757,26 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
         return rc;
     }
 
+    /*
+     * Each set takes one block in the directory and VCI_SET_WAYS lines, the
+     * header, the directory start and the alignment of the lines take less
+     * than two lines.
+     */
+    uint64_t cSets = 0;
+    if (cbSize > 2 * VCI_LINE_SIZE)
+        cSets = (cbSize - 2 * VCI_LINE_SIZE) / (VCI_SET_WAYS * VCI_LINE_SIZE + VCI_BLOCK_SIZE);
+    if (!cSets || cSets > UINT32_MAX)
+    {
+        rc = vdIfError(pCache->pIfError, VERR_VD_INVALID_SIZE, RT_SRC_POS, N_("VCI: invalid cache size %llu for '%s'"), cbSize, pCache->pszFilename);
+        return rc;
+    }
+
+    pCache->cbSize     = cbSize;
+    pCache->cSets      = (uint32_t)cSets;
+    pCache->offLineDir = VCI_LINE_DIR_OFFSET;
+    pCache->offData    = RT_ALIGN_64(VCI_LINE_DIR_OFFSET + cSets * VCI_BLOCK_SIZE, VCI_LINE_SIZE);
+    Assert(pCache->offData + cSets * VCI_SET_WAYS * VCI_LINE_SIZE <= cbSize);
+
     do
     {
         /* Create image file. */
@@ -1332,106 +790,35 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
             break;
         }
 
-        /* Allocate block bitmap. */
-        uint32_t cBlkMap = 0;
-        rc = vciBlkMapCreate(cBlocks, &pCache->pBlkMap, &cBlkMap);
-        if (RT_FAILURE(rc))
-        {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot create block bitmap '%s'"), pCache->pszFilename);
-            break;
-        }
-
-        /*
-         * Allocate space for the header in the block bitmap.
-         * Because the block map is empty the header has to start at block 0
-         */
-        uint64_t offHdr = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, VCI_BYTE2BLOCK(sizeof(VciHdr)), VCIBLKMAP_ALLOC_META, &offHdr);
+        rc = vciLinesAlloc(pCache);
         if (RT_FAILURE(rc))
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate space for header in block bitmap '%s'"), pCache->pszFilename);
+            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate line directory '%s'"), pCache->pszFilename);
             break;
         }
 
-        Assert(offHdr == 0);
-
-        /*
-         * Allocate space for the block map itself.
-         */
-        uint64_t offBlkMap = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, cBlkMap, VCIBLKMAP_ALLOC_META, &offBlkMap);
-        if (RT_FAILURE(rc))
-        {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate space for block map in block map '%s'"), pCache->pszFilename);
-            break;
-        }
-
-        /*
-         * Allocate space for the tree root node.
-         */
-        uint64_t offTreeRoot = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, VCI_BYTE2BLOCK(sizeof(VciTreeNode)), VCIBLKMAP_ALLOC_META, &offTreeRoot);
+        if (uImageFlags & VD_IMAGE_FLAGS_FIXED)
+            rc = vdIfIoIntFileSetAllocationSize(pCache->pIfIo, pCache->pStorage, cbSize, 0 /* fFlags */,
+                                                NULL, 0, 0);
+        else
+            rc = vdIfIoIntFileSetSize(pCache->pIfIo, pCache->pStorage, pCache->offData);
         if (RT_FAILURE(rc))
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate space for block map in block map '%s'"), pCache->pszFilename);
+            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: setting image size failed for '%s'"), pCache->pszFilename);
             break;
         }
 
-        /*
-         * Allocate the in memory root node.
-         */
-        pCache->pRoot = (PVCITREENODE)RTMemAllocZ(sizeof(VCITREENODELEAF));
-        if (!pCache->pRoot)
-        {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate B+-Tree root pointer '%s'"), pCache->pszFilename);
-            break;
-        }
-
-        pCache->pRoot->u8Type = VCI_TREE_NODE_TYPE_LEAF;
-        /* Rest remains 0 as the tree is still empty. */
-
-        /*
-         * Now that we are here we have all the basic structures and know where to place them in the image.
-         * It's time to write it now.
-         */
-
-        /* Setup the header. */
-        memset(&Hdr, 0, sizeof(VciHdr));
-        Hdr.u32Signature     = RT_H2LE_U32(VCI_HDR_SIGNATURE);
-        Hdr.u32Version       = RT_H2LE_U32(VCI_HDR_VERSION);
-        Hdr.cBlocksCache     = RT_H2LE_U64(cBlocks);
-        Hdr.fUncleanShutdown = VCI_HDR_UNCLEAN_SHUTDOWN;
-        Hdr.u32CacheType     = uImageFlags & VD_IMAGE_FLAGS_FIXED
-                               ? RT_H2LE_U32(VCI_HDR_CACHE_TYPE_FIXED)
-                               : RT_H2LE_U32(VCI_HDR_CACHE_TYPE_DYNAMIC);
-        Hdr.offTreeRoot      = RT_H2LE_U64(offTreeRoot);
-        Hdr.offBlkMap        = RT_H2LE_U64(offBlkMap);
-        Hdr.cBlkMap          = RT_H2LE_U32(cBlkMap);
-
-        rc = vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, offHdr, &Hdr,
-                                    VCI_BYTE2BLOCK(sizeof(VciHdr)));
+        rc = vciHdrWrite(pCache, false /* fClean */);
         if (RT_FAILURE(rc))
         {
             rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write header '%s'"), pCache->pszFilename);
             break;
         }
 
-        rc = vciBlkMapSave(pCache->pBlkMap, pCache, offBlkMap, cBlkMap);
-        if (RT_FAILURE(rc))
-        {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write block map '%s'"), pCache->pszFilename);
-            break;
-        }
-
-        /* Setup the root tree. */
-        memset(&NodeRoot, 0, sizeof(VciTreeNode));
-        NodeRoot.u8Type = VCI_TREE_NODE_TYPE_LEAF;
-
-        rc = vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, offTreeRoot,
-                                    &NodeRoot, VCI_BYTE2BLOCK(sizeof(VciTreeNode)));
+        rc = vciLineDirWriteSync(pCache);
         if (RT_FAILURE(rc))
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write root node '%s'"), pCache->pszFilename);
+            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write line directory '%s'"), pCache->pszFilename);
             break;
         }
 
@@ -1441,9 +828,6 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
             rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot flush '%s'"), pCache->pszFilename);
             break;
         }
-
-        pCache->cbSize = cbSize;
-
     } while (0);
 
     if (RT_SUCCESS(rc) && pfnProgress)
@@ -1454,6 +838,148 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
     return rc;
 }
 
+/**
+ * Internal. Completion callback for writes to a cache line.
+ */
+static DECLCALLBACK(int) vciWriteComplete(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    RT_NOREF1(pIoCtx);
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    PVCIWRITE pWrite = (PVCIWRITE)pvUser;
+    PVCILINE pLine = pWrite->pLine;
+
+    Assert(pLine->cWritesActive);
+    pLine->cWritesActive--;
+
+    if (RT_SUCCESS(rcReq))
+    {
+        /* The line moves to the end of the destage order. */
+        if (pLine->Core.Key)
+            RTAvlU64Remove(&pCache->TreeDirty, pLine->Core.Key);
+
+        pCache->cBlocksDirty += pWrite->cBlocks - vciLineDirtyCount(pLine, pWrite->iBlockFirst, pWrite->cBlocks);
+        ASMBitSetRange(&pLine->au64Dirty[0], pWrite->iBlockFirst, pWrite->iBlockFirst + pWrite->cBlocks);
+        pLine->Core.Key = pCache->uSeqNext++;
+        RTAvlU64Insert(&pCache->TreeDirty, &pLine->Core);
+
+        vciSetMarkDirty(pCache, (uint32_t)((pLine - pCache->paLines) / VCI_SET_WAYS));
+    }
+
+    RTMemFree(pWrite);
+    return rcReq;
+}
+
+static DECLCALLBACK(int) vciFlushUpdate(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq);
+
+/**
+ * Internal. Frees the flush state, marking the sets as modified again if the
+ * flush failed.
+ */
+static void vciFlushDestroy(PVCICACHE pCache, PVCIFLUSH pFlush, bool fFailed)
+{
+    if (fFailed)
+    {
+        for (uint32_t i = 0; i < pFlush->cSets; i++)
+            vciSetMarkDirty(pCache, pFlush->paidxSets[i]);
+    }
+
+    RTMemFree(pFlush->paidxSets);
+    RTMemFree(pFlush->paEnts);
+    RTMemFree(pFlush);
+}
+
+/**
+ * Advances the flush state machine as far as possible.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_ASYNC_IO_IN_PROGRESS if a step is still in progress, the
+ *          state machine continues in the completion callback.
+ * @param   pCache        Cache instance data.
+ * @param   pIoCtx        The I/O context.
+ * @param   pFlush        The flush state.
+ */
+static int vciFlushProcess(PVCICACHE pCache, PVDIOCTX pIoCtx, PVCIFLUSH pFlush)
+{
+    int rc = VINF_SUCCESS;
+
+    while (   RT_SUCCESS(rc)
+           && pFlush->enmState != VCIFLUSHSTATE_COMPLETE)
+    {
+        switch (pFlush->enmState)
+        {
+            case VCIFLUSHSTATE_DATA_FLUSH:
+            {
+                pFlush->enmState = VCIFLUSHSTATE_DIR_WRITE;
+                rc = vdIfIoIntFileFlush(pCache->pIfIo, pCache->pStorage, pIoCtx,
+                                        vciFlushUpdate, pFlush);
+                break;
+            }
+            case VCIFLUSHSTATE_DIR_WRITE:
+            {
+                /* Write one run of consecutive sets at a time. */
+                uint32_t idxFirst = pFlush->idxSetNext;
+                uint32_t cSets = 1;
+
+                while (   idxFirst + cSets < pFlush->cSets
+                       && cSets < _64K / VCI_BLOCK_SIZE
+                       && pFlush->paidxSets[idxFirst + cSets] == pFlush->paidxSets[idxFirst] + cSets)
+                    cSets++;
+
+                pFlush->idxSetNext += cSets;
+                if (pFlush->idxSetNext == pFlush->cSets)
+                    pFlush->enmState = VCIFLUSHSTATE_DIR_FLUSH;
+
+                rc = vdIfIoIntFileWriteMeta(pCache->pIfIo, pCache->pStorage,
+                                            pCache->offLineDir + VCI_BLOCK2BYTE(pFlush->paidxSets[idxFirst]),
+                                            &pFlush->paEnts[(size_t)idxFirst * VCI_SET_WAYS],
+                                            cSets * VCI_BLOCK_SIZE, pIoCtx,
+                                            vciFlushUpdate, pFlush);
+                break;
+            }
+            case VCIFLUSHSTATE_DIR_FLUSH:
+            {
+                pFlush->enmState = VCIFLUSHSTATE_COMPLETE;
+                rc = vdIfIoIntFileFlush(pCache->pIfIo, pCache->pStorage, pIoCtx,
+                                        vciFlushUpdate, pFlush);
+                break;
+            }
+            default:
+                AssertMsgFailed(("Invalid flush state %d\n", pFlush->enmState));
+                rc = VERR_INTERNAL_ERROR;
+        }
+    }
+
+    if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+        return rc;
+
+    if (RT_SUCCESS(rc))
+    {
+        /* The VD layer serializes flushes by locking the disk, they complete in order. */
+        Assert(pFlush->uFlushGen >= pCache->uFlushGenDone - 1);
+        pCache->uFlushGenDone = pFlush->uFlushGen + 1;
+    }
+
+    vciFlushDestroy(pCache, pFlush, RT_FAILURE(rc));
+    return rc;
+}
+
+/**
+ * Completion callback for the individual steps of a flush.
+ */
+static DECLCALLBACK(int) vciFlushUpdate(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    PVCIFLUSH pFlush = (PVCIFLUSH)pvUser;
+
+    if (RT_FAILURE(rcReq))
+    {
+        vciFlushDestroy(pCache, pFlush, true /* fFailed */);
+        return VINF_SUCCESS;
+    }
+
+    return vciFlushProcess(pCache, pIoCtx, pFlush);
+}
+
 /** @copydoc VDCACHEBACKEND::pfnProbe */
 static DECLCALLBACK(int) vciProbe(const char *pszFilename, PVDINTERFACE pVDIfsDisk,
                                   PVDINTERFACE pVDIfsImage)
@@ -1492,11 +1018,6 @@ static DECLCALLBACK(int) vciProbe(const char *pszFilename, PVDINTERFACE pVDIfsDi
 
     Hdr.u32Signature = RT_LE2H_U32(Hdr.u32Signature);
     Hdr.u32Version   = RT_LE2H_U32(Hdr.u32Version);
-    Hdr.cBlocksCache = RT_LE2H_U64(Hdr.cBlocksCache);
-    Hdr.u32CacheType = RT_LE2H_U32(Hdr.u32CacheType);
-    Hdr.offTreeRoot  = RT_LE2H_U64(Hdr.offTreeRoot);
-    Hdr.offBlkMap    = RT_LE2H_U64(Hdr.offBlkMap);
-    Hdr.cBlkMap      = RT_LE2H_U32(Hdr.cBlkMap);
 
     if (   Hdr.u32Signature == VCI_HDR_SIGNATURE
         && Hdr.u32Version == VCI_HDR_VERSION)
@@ -1656,30 +1177,43 @@ static DECLCALLBACK(int) vciRead(void *pBackendData, uint64_t uOffset, size_t cb
                  pBackendData, uOffset, cbToRead, pIoCtx, pcbActuallyRead));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc = VINF_SUCCESS;
-    PVCICACHEEXTENT pExtent;
-    uint64_t cBlocksToRead = VCI_BYTE2BLOCK(cbToRead);
-    uint64_t offBlockAddr  = VCI_BYTE2BLOCK(uOffset);
+    uint32_t iBlock = (uint32_t)VCI_BYTE2BLOCK(uOffset % VCI_LINE_SIZE);
+    uint32_t cBlocksToRead = (uint32_t)RT_MIN(VCI_BYTE2BLOCK(cbToRead), VCI_LINE_BLOCKS - iBlock);
+    PVCILINE pLine;
 
     AssertPtr(pCache);
     Assert(uOffset % 512 == 0);
     Assert(cbToRead % 512 == 0);
 
-    pExtent = vciCacheExtentLookup(pCache, offBlockAddr, NULL);
-    if (pExtent)
+    pLine = vciLineLookup(pCache, uOffset / VCI_LINE_SIZE);
+    if (pLine)
     {
-        uint64_t offRead = offBlockAddr - pExtent->u64BlockOffset;
-        cBlocksToRead = RT_MIN(cBlocksToRead, pExtent->u32Blocks - offRead);
+        uint32_t iBlockFirst = 0;
+        uint32_t cBlocks = 0;
 
-        rc = vdIfIoIntFileReadUser(pCache->pIfIo, pCache->pStorage,
-                                   pExtent->u64BlockAddr + offRead,
-                                   pIoCtx, cBlocksToRead);
+        if (   vciLineDirtyRunGet(pLine, iBlock, &iBlockFirst, &cBlocks)
+            && iBlockFirst < iBlock + cBlocksToRead)
+        {
+            if (iBlockFirst == iBlock)
+            {
+                cBlocksToRead = RT_MIN(cBlocksToRead, cBlocks);
+                pLine->uLastAccess = pCache->uAccessNext++;
+                rc = vdIfIoIntFileReadUser(pCache->pIfIo, pCache->pStorage,
+                                           vciLineGetDataOffset(pCache, pLine) + VCI_BLOCK2BYTE(iBlock),
+                                           pIoCtx, VCI_BLOCK2BYTE(cBlocksToRead));
+            }
+            else
+            {
+                /* Everything up to the next dirty block must come from the image. */
+                cBlocksToRead = iBlockFirst - iBlock;
+                rc = VERR_VD_BLOCK_FREE;
+            }
+        }
+        else
+            rc = VERR_VD_BLOCK_FREE;
     }
     else
-    {
-        /** @todo Best fit to check whether we have cached data later and set
-         * pcbActuallyRead accordingly. */
         rc = VERR_VD_BLOCK_FREE;
-    }
 
     if (pcbActuallyRead)
         *pcbActuallyRead = VCI_BLOCK2BYTE(cBlocksToRead);
@@ -1690,25 +1224,64 @@ static DECLCALLBACK(int) vciRead(void *pBackendData, uint64_t uOffset, size_t cb
 
 /** @copydoc VDCACHEBACKEND::pfnWrite */
 static DECLCALLBACK(int) vciWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
-                                  PVDIOCTX pIoCtx, size_t *pcbWriteProcess)
+                                  PVDIOCTX pIoCtx, size_t *pcbWriteProcess, uint32_t fWrite)
 {
-    RT_NOREF5(pBackendData, uOffset, cbToWrite, pIoCtx, pcbWriteProcess);
-    LogFlowFunc(("pBackendData=%#p uOffset=%llu cbToWrite=%zu pIoCtx=%#p pcbWriteProcess=%#p\n",
-                 pBackendData, uOffset, cbToWrite, pIoCtx, pcbWriteProcess));
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu cbToWrite=%zu pIoCtx=%#p pcbWriteProcess=%#p fWrite=%#x\n",
+                 pBackendData, uOffset, cbToWrite, pIoCtx, pcbWriteProcess, fWrite));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc = VINF_SUCCESS;
-    uint64_t cBlocksToWrite = VCI_BYTE2BLOCK(cbToWrite);
-    //uint64_t offBlockAddr  = VCI_BYTE2BLOCK(uOffset);
+    uint32_t iBlock = (uint32_t)VCI_BYTE2BLOCK(uOffset % VCI_LINE_SIZE);
+    uint32_t cBlocksToWrite = (uint32_t)RT_MIN(VCI_BYTE2BLOCK(cbToWrite), VCI_LINE_BLOCKS - iBlock);
 
-    AssertPtr(pCache); NOREF(pCache);
+    AssertPtr(pCache);
     Assert(uOffset % 512 == 0);
     Assert(cbToWrite % 512 == 0);
-    while (cBlocksToWrite)
+
+    /*
+     * The cache only holds data written in write-back mode, copies of data read
+     * from the image chain are not kept as they would take away room from
+     * dirty data which can't go anywhere else.
+     */
+    if (fWrite & VD_CACHE_WRITE_F_DIRTY)
     {
+        if (!(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+        {
+            uint64_t uLine = uOffset / VCI_LINE_SIZE;
+            PVCILINE pLine = vciLineLookup(pCache, uLine);
 
+            if (!pLine)
+                pLine = vciLineAlloc(pCache, uLine);
+
+            if (pLine)
+            {
+                PVCIWRITE pWrite = (PVCIWRITE)RTMemAlloc(sizeof(VCIWRITE));
+                if (pWrite)
+                {
+                    pWrite->pLine       = pLine;
+                    pWrite->iBlockFirst = iBlock;
+                    pWrite->cBlocks     = cBlocksToWrite;
+
+                    /* The dirty bits are set when the data is on the disk, nobody may read it before. */
+                    pLine->cWritesActive++;
+                    pLine->uLastAccess = pCache->uAccessNext++;
+                    rc = vdIfIoIntFileWriteUser(pCache->pIfIo, pCache->pStorage,
+                                                vciLineGetDataOffset(pCache, pLine) + VCI_BLOCK2BYTE(iBlock),
+                                                pIoCtx, VCI_BLOCK2BYTE(cBlocksToWrite),
+                                                vciWriteComplete, pWrite);
+                    if (rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+                        rc = vciWriteComplete(pCache, pIoCtx, pWrite, rc);
+                }
+                else
+                    rc = VERR_NO_MEMORY;
+            }
+            else
+                rc = VERR_DISK_FULL; /* All lines of the set hold dirty data. */
+        }
+        else
+            rc = VERR_VD_IMAGE_READ_ONLY;
     }
 
-    *pcbWriteProcess = cbToWrite; /** @todo Implement. */
+    *pcbWriteProcess = VCI_BLOCK2BYTE(cBlocksToWrite);
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -1717,15 +1290,149 @@ static DECLCALLBACK(int) vciWrite(void *pBackendData, uint64_t uOffset, size_t c
 /** @copydoc VDCACHEBACKEND::pfnFlush */
 static DECLCALLBACK(int) vciFlush(void *pBackendData, PVDIOCTX pIoCtx)
 {
-    RT_NOREF1(pIoCtx);
     LogFlowFunc(("pBackendData=%#p\n", pBackendData));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    if (pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        return VINF_SUCCESS;
+
+    if (!pCache->cSetsDirty)
+        rc = vdIfIoIntFileFlush(pCache->pIfIo, pCache->pStorage, pIoCtx, NULL, NULL);
+    else
+    {
+        /* Take a snapshot of the modified sets, writes completing from now on go into the next flush. */
+        PVCIFLUSH pFlush = (PVCIFLUSH)RTMemAllocZ(sizeof(VCIFLUSH));
+        if (pFlush)
+        {
+            pFlush->paidxSets = (uint32_t *)RTMemAlloc(pCache->cSetsDirty * sizeof(uint32_t));
+            pFlush->paEnts    = (PVciLineEnt)RTMemAlloc((size_t)pCache->cSetsDirty * VCI_BLOCK_SIZE);
+            if (   pFlush->paidxSets
+                && pFlush->paEnts)
+            {
+                int idxSet = ASMBitFirstSet(pCache->pbmSetsDirty, RT_ALIGN_32(pCache->cSets, 32));
+                while (idxSet >= 0)
+                {
+                    Assert(pFlush->cSets < pCache->cSetsDirty);
+                    pFlush->paidxSets[pFlush->cSets] = (uint32_t)idxSet;
+                    vciSetToDisk(pCache, (uint32_t)idxSet, &pFlush->paEnts[(size_t)pFlush->cSets * VCI_SET_WAYS]);
+                    pFlush->cSets++;
+                    ASMBitClear(pCache->pbmSetsDirty, idxSet);
+                    idxSet = ASMBitNextSet(pCache->pbmSetsDirty, RT_ALIGN_32(pCache->cSets, 32), idxSet);
+                }
+                Assert(pFlush->cSets == pCache->cSetsDirty);
+                pCache->cSetsDirty = 0;
+
+                pFlush->enmState  = VCIFLUSHSTATE_DATA_FLUSH;
+                pFlush->uFlushGen = pCache->uFlushGenNext++;
+                rc = vciFlushProcess(pCache, pIoCtx, pFlush);
+            }
+            else
+            {
+                RTMemFree(pFlush->paidxSets);
+                RTMemFree(pFlush->paEnts);
+                RTMemFree(pFlush);
+                rc = VERR_NO_MEMORY;
+            }
+        }
+        else
+            rc = VERR_NO_MEMORY;
+    }
 
-    int rc = vciFlushImage(pCache);
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
 }
 
+/** @copydoc VDCACHEBACKEND::pfnDirtyQueryNext */
+static DECLCALLBACK(int) vciDirtyQueryNext(void *pBackendData, uint64_t *puSeq,
+                                           uint64_t *puOffset, size_t *pcbDirty)
+{
+    LogFlowFunc(("pBackendData=%#p puSeq=%#p puOffset=%#p pcbDirty=%#p\n",
+                 pBackendData, puSeq, puOffset, pcbDirty));
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    uint32_t iBlockFirst = 0;
+    uint32_t cBlocks = 0;
+    PVCILINE pLine = NULL;
+
+    AssertPtr(pCache);
+
+    /* Continue in the line the caller stopped at. */
+    if (*puSeq)
+    {
+        pLine = (PVCILINE)RTAvlU64Get(&pCache->TreeDirty, *puSeq);
+        if (   pLine
+            && (   *puOffset / VCI_LINE_SIZE != pLine->uLineTag - 1
+                || !vciLineDirtyRunGet(pLine, (uint32_t)VCI_BYTE2BLOCK(*puOffset % VCI_LINE_SIZE),
+                                       &iBlockFirst, &cBlocks)))
+            pLine = NULL;
+    }
+
+    /* Take the next line in destage order otherwise. */
+    if (!pLine)
+    {
+        pLine = (PVCILINE)RTAvlU64GetBestFit(&pCache->TreeDirty, *puSeq + 1, true /* fAbove */);
+        if (!pLine)
+            return VERR_NOT_FOUND;
+
+        bool fFound = vciLineDirtyRunGet(pLine, 0, &iBlockFirst, &cBlocks);
+        AssertReturn(fFound, VERR_INTERNAL_ERROR); RT_NOREF(fFound);
+    }
+
+    *puSeq    = pLine->Core.Key;
+    *puOffset = (pLine->uLineTag - 1) * VCI_LINE_SIZE + VCI_BLOCK2BYTE(iBlockFirst);
+    *pcbDirty = VCI_BLOCK2BYTE(cBlocks);
+
+    LogFlowFunc(("returns VINF_SUCCESS uSeq=%llu uOffset=%llu cbDirty=%zu\n", *puSeq, *puOffset, *pcbDirty));
+    return VINF_SUCCESS;
+}
+
+/** @copydoc VDCACHEBACKEND::pfnDirtyClear */
+static DECLCALLBACK(int) vciDirtyClear(void *pBackendData, uint64_t uSeq,
+                                       uint64_t uOffset, size_t cbRange)
+{
+    LogFlowFunc(("pBackendData=%#p uSeq=%llu uOffset=%llu cbRange=%zu\n",
+                 pBackendData, uSeq, uOffset, cbRange));
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+
+    AssertPtr(pCache);
+    Assert(uOffset % 512 == 0);
+    Assert(cbRange % 512 == 0);
+
+    /* A line modified since it was queried has a new sequence number and stays dirty. */
+    PVCILINE pLine = (PVCILINE)RTAvlU64Get(&pCache->TreeDirty, uSeq);
+    if (   pLine
+        && uOffset / VCI_LINE_SIZE == pLine->uLineTag - 1)
+    {
+        uint32_t iBlock = (uint32_t)VCI_BYTE2BLOCK(uOffset % VCI_LINE_SIZE);
+        uint32_t cBlocks = (uint32_t)RT_MIN(VCI_BYTE2BLOCK(cbRange), VCI_LINE_BLOCKS - iBlock);
+
+        pCache->cBlocksDirty -= vciLineDirtyCount(pLine, iBlock, cBlocks);
+        ASMBitClearRange(&pLine->au64Dirty[0], iBlock, iBlock + cBlocks);
+
+        if (!vciLineDirtyCount(pLine, 0, VCI_LINE_BLOCKS))
+        {
+            RTAvlU64Remove(&pCache->TreeDirty, pLine->Core.Key);
+            pLine->Core.Key = 0;
+            pLine->uFlushGenClean = pCache->uFlushGenNext;
+        }
+
+        vciSetMarkDirty(pCache, (uint32_t)((pLine - pCache->paLines) / VCI_SET_WAYS));
+    }
+
+    return VINF_SUCCESS;
+}
+
+/** @copydoc VDCACHEBACKEND::pfnGetDirtySize */
+static DECLCALLBACK(uint64_t) vciGetDirtySize(void *pBackendData)
+{
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+
+    AssertPtr(pCache);
+
+    return VCI_BLOCK2BYTE(pCache->cBlocksDirty);
+}
+
 /** @copydoc VDCACHEBACKEND::pfnGetVersion */
 static DECLCALLBACK(unsigned) vciGetVersion(void *pBackendData)
 {
@@ -2008,6 +1715,12 @@ const VDCACHEBACKEND g_VciCacheBackend =
     vciFlush,
     /* pfnDiscard */
     NULL,
+    /* pfnDirtyQueryNext */
+    vciDirtyQueryNext,
+    /* pfnDirtyClear */
+    vciDirtyClear,
+    /* pfnGetDirtySize */
+    vciGetDirtySize,
     /* pfnGetVersion */
     vciGetVersion,
     /* pfnGetSize */
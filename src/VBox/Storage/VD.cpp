@@ -35,6 +35,7 @@
 #include <iprt/path.h>
 #include <iprt/sg.h>
 #include <iprt/semaphore.h>
+#include <iprt/thread.h>
 #include <iprt/vector.h>
 
 #include "VDInternal.h"
@@ -42,6 +43,12 @@
 /** Buffer size used for merging images. */
 #define VD_MERGE_BUFFER_SIZE    (16 * _1M)
 
+/** Number of buffers in flight when copying or merging images. */
+#define VD_COPY_PIPE_BUFFERS        4
+/** Size of a single copy pipeline buffer, all buffers together use the same
+ * amount of memory as the merge buffer. */
+#define VD_COPY_PIPE_BUFFER_SIZE    (VD_MERGE_BUFFER_SIZE / VD_COPY_PIPE_BUFFERS)
+
 /** Maximum number of segments in one I/O task. */
 #define VD_IO_TASK_SEGMENTS_MAX 64
 
@@ -138,6 +145,20 @@ typedef struct VDIOCTX
     PFNVDIOCTXTRANSFER           pfnIoCtxTransferNext;
     /** Transfer direction */
     VDIOCTXTXDIR                 enmTxDir;
+    /** Stage timestamps, only maintained for root contexts if tracing is enabled. */
+    struct
+    {
+        /** When the context was queued. */
+        uint64_t                 tsQueued;
+        /** When the context acquired the disk lock the first time. */
+        uint64_t                 tsLocked;
+        /** When the first transfer was submitted to the I/O interface. */
+        uint64_t                 tsSubmitted;
+        /** Number of metadata transfers submitted. */
+        volatile uint32_t        cMetaXfers;
+        /** Number of data transfers submitted. */
+        volatile uint32_t        cDataXfers;
+    } Trace;
     /** Request type dependent data. */
     union
     {
@@ -261,6 +282,8 @@ typedef struct VDIOCTX
  * multiple times.
  */
 #define VDIOCTX_FLAGS_WRITE_FILTER_APPLIED   RT_BIT_32(6)
+/** Write to the image chain even if the cache is in write-back mode. */
+#define VDIOCTX_FLAGS_CACHE_BYPASS           RT_BIT_32(7)
 
 /** NIL I/O context pointer value. */
 #define NIL_VDIOCTX ((PVDIOCTX)0)
@@ -690,6 +713,83 @@ static int vdFilterChainApplyRead(PVDISK pDisk, uint64_t uOffset, size_t cbRead,
     return rc;
 }
 
+/**
+ * Internal: Resets the trace data of the given I/O context and marks it as queued.
+ */
+DECLINLINE(void) vdIoCtxTraceInit(PVDISK pDisk, PVDIOCTX pIoCtx)
+{
+    pIoCtx->Trace.tsQueued    = RT_UNLIKELY(pDisk->pInterfaceIoTrace) ? RTTimeNanoTS() : 0;
+    pIoCtx->Trace.tsLocked    = 0;
+    pIoCtx->Trace.tsSubmitted = 0;
+    pIoCtx->Trace.cMetaXfers  = 0;
+    pIoCtx->Trace.cDataXfers  = 0;
+}
+
+/**
+ * Internal: Records the submission of a transfer to the I/O interface for the given I/O context.
+ */
+DECLINLINE(void) vdIoCtxTraceSubmit(PVDIOCTX pIoCtx, bool fMeta)
+{
+    if (RT_LIKELY(!pIoCtx || !pIoCtx->Trace.tsQueued))
+        return;
+
+    PVDIOCTX pIoCtxRoot = pIoCtx->pIoCtxParent ? pIoCtx->pIoCtxParent : pIoCtx;
+    if (!pIoCtxRoot->Trace.tsSubmitted)
+        pIoCtxRoot->Trace.tsSubmitted = RTTimeNanoTS();
+    if (fMeta)
+        ASMAtomicIncU32(&pIoCtxRoot->Trace.cMetaXfers);
+    else
+        ASMAtomicIncU32(&pIoCtxRoot->Trace.cDataXfers);
+}
+
+/**
+ * Internal: Hands the timing record of the completed root I/O context to the tracing interface.
+ */
+static void vdIoCtxTraceComplete(PVDISK pDisk, PVDIOCTX pIoCtx)
+{
+    VDIOTRACEREC Rec;
+
+    switch (pIoCtx->enmTxDir)
+    {
+        case VDIOCTXTXDIR_READ:
+            Rec.enmType = VDIOTRACEREQTYPE_READ;
+            break;
+        case VDIOCTXTXDIR_WRITE:
+            Rec.enmType = VDIOTRACEREQTYPE_WRITE;
+            break;
+        case VDIOCTXTXDIR_FLUSH:
+            Rec.enmType = VDIOTRACEREQTYPE_FLUSH;
+            break;
+        case VDIOCTXTXDIR_DISCARD:
+            Rec.enmType = VDIOTRACEREQTYPE_DISCARD;
+            break;
+        default:
+            Rec.enmType = VDIOTRACEREQTYPE_INVALID;
+    }
+
+    if (   pIoCtx->enmTxDir == VDIOCTXTXDIR_READ
+        || pIoCtx->enmTxDir == VDIOCTXTXDIR_WRITE)
+    {
+        Rec.off        = pIoCtx->Req.Io.uOffsetXferOrig;
+        Rec.cbTransfer = pIoCtx->Req.Io.cbXferOrig;
+    }
+    else
+    {
+        Rec.off        = 0;
+        Rec.cbTransfer = 0;
+    }
+
+    Rec.rcReq       = pIoCtx->rcReq;
+    Rec.cMetaXfers  = pIoCtx->Trace.cMetaXfers;
+    Rec.cDataXfers  = pIoCtx->Trace.cDataXfers;
+    Rec.tsQueued    = pIoCtx->Trace.tsQueued;
+    Rec.tsLocked    = pIoCtx->Trace.tsLocked;
+    Rec.tsSubmitted = pIoCtx->Trace.tsSubmitted;
+    Rec.tsCompleted = RTTimeNanoTS();
+
+    pDisk->pInterfaceIoTrace->pfnIoReqCompleted(pDisk->pInterfaceIoTrace->Core.pvUser, &Rec);
+}
+
 DECLINLINE(void) vdIoCtxRootComplete(PVDISK pDisk, PVDIOCTX pIoCtx)
 {
     if (   RT_SUCCESS(pIoCtx->rcReq)
@@ -697,6 +797,9 @@ DECLINLINE(void) vdIoCtxRootComplete(PVDISK pDisk, PVDIOCTX pIoCtx)
         pIoCtx->rcReq = vdFilterChainApplyRead(pDisk, pIoCtx->Req.Io.uOffsetXferOrig,
                                                pIoCtx->Req.Io.cbXferOrig, pIoCtx);
 
+    if (RT_UNLIKELY(pIoCtx->Trace.tsQueued))
+        vdIoCtxTraceComplete(pDisk, pIoCtx);
+
     pIoCtx->Type.Root.pfnComplete(pIoCtx->Type.Root.pvUser1,
                                   pIoCtx->Type.Root.pvUser2,
                                   pIoCtx->rcReq);
@@ -730,6 +833,7 @@ DECLINLINE(void) vdIoCtxInit(PVDIOCTX pIoCtx, PVDISK pDisk, VDIOCTXTXDIR enmTxDi
     pIoCtx->pfnIoCtxTransferNext  = NULL;
     pIoCtx->rcReq                 = VINF_SUCCESS;
     pIoCtx->pIoCtxParent          = NULL;
+    vdIoCtxTraceInit(pDisk, pIoCtx);
 
     /* There is no S/G list for a flush request. */
     if (   enmTxDir != VDIOCTXTXDIR_FLUSH
@@ -784,9 +888,10 @@ static int vdCacheReadHelper(PVDCACHE pCache, uint64_t uOffset,
  * @param   cbWrite    How much to write.
  * @param   pIoCtx     The I/O context to write from.
  * @param   pcbWritten How much data could be written, optional.
+ * @param   fWrite     Write flags, combination of VD_CACHE_WRITE_F_*.
  */
 static int vdCacheWriteHelper(PVDCACHE pCache, uint64_t uOffset, size_t cbWrite,
-                              PVDIOCTX pIoCtx, size_t *pcbWritten)
+                              PVDIOCTX pIoCtx, size_t *pcbWritten, uint32_t fWrite)
 {
     int rc = VINF_SUCCESS;
 
@@ -799,7 +904,7 @@ static int vdCacheWriteHelper(PVDCACHE pCache, uint64_t uOffset, size_t cbWrite,
 
     if (pcbWritten)
         rc = pCache->Backend->pfnWrite(pCache->pBackendData, uOffset, cbWrite,
-                                       pIoCtx, pcbWritten);
+                                       pIoCtx, pcbWritten, fWrite);
     else
     {
         size_t cbWritten = 0;
@@ -807,7 +912,7 @@ static int vdCacheWriteHelper(PVDCACHE pCache, uint64_t uOffset, size_t cbWrite,
         do
         {
             rc = pCache->Backend->pfnWrite(pCache->pBackendData, uOffset, cbWrite,
-                                           pIoCtx, &cbWritten);
+                                           pIoCtx, &cbWritten, fWrite);
             uOffset += cbWritten;
             cbWrite -= cbWritten;
         } while (   cbWrite
@@ -1070,6 +1175,7 @@ DECLINLINE(void) vdIoCtxDiscardInit(PVDIOCTX pIoCtx, PVDISK pDisk, PCRTRANGE paR
     pIoCtx->Req.Discard.cbDiscardLeft = 0;
     pIoCtx->Req.Discard.offCur        = 0;
     pIoCtx->Req.Discard.cbThisDiscard = 0;
+    vdIoCtxTraceInit(pDisk, pIoCtx);
 
     pIoCtx->pIoCtxParent          = NULL;
     pIoCtx->Type.Root.pfnComplete = pfnComplete;
@@ -1615,6 +1721,8 @@ static int vdIoCtxLockDisk(PVDISK pDisk, PVDIOCTX pIoCtx)
         vdIoCtxDefer(pDisk, pIoCtx);
         rc = VERR_VD_ASYNC_IO_IN_PROGRESS;
     }
+    else if (RT_UNLIKELY(pIoCtx->Trace.tsQueued) && !pIoCtx->Trace.tsLocked)
+        pIoCtx->Trace.tsLocked = RTTimeNanoTS();
 
     LogFlowFunc(("returns -> %Rrc\n", rc));
     return rc;
@@ -1735,7 +1843,7 @@ static DECLCALLBACK(int) vdReadHelperAsync(PVDIOCTX pIoCtx)
                     && pIoCtx->fFlags & VDIOCTX_FLAGS_READ_UPDATE_CACHE)
                 {
                     rc = vdCacheWriteHelper(pDisk->pCache, uOffset, cbThisRead,
-                                            pIoCtx, NULL);
+                                            pIoCtx, NULL, 0 /* fWrite */);
                 }
             }
         }
@@ -2040,156 +2148,518 @@ static int vdWriteHelper(PVDISK pDisk, PVDIMAGE pImage, uint64_t uOffset,
 }
 
 /**
- * Internal: Copies the content of one disk to another one applying optimizations
- * to speed up the copy process if possible.
+ * Reads the next chunk of data for the copy pipeline.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_BLOCK_FREE if the range is unallocated and doesn't need to be written.
+ * @param   pvUser          Opaque user data passed to vdCopyPipeRun().
+ * @param   uOffset         Offset of the chunk to read.
+ * @param   pvBuf           Where to store the data.
+ * @param   pcbRead         On input the maximum number of bytes to read, on output
+ *                          the number of bytes the returned status applies to.
+ * @param   puWriteGen      Where to store the write generation of the source
+ *                          the data was read with.
+ */
+typedef DECLCALLBACK(int) FNVDCOPYPIPEREAD(void *pvUser, uint64_t uOffset, void *pvBuf,
+                                           size_t *pcbRead, uint64_t *puWriteGen);
+/** Pointer to a copy pipeline read callback. */
+typedef FNVDCOPYPIPEREAD *PFNVDCOPYPIPEREAD;
+
+/**
+ * Writes a chunk of data read by the copy pipeline.
+ *
+ * @returns VBox status code.
+ * @param   pvUser          Opaque user data passed to vdCopyPipeRun().
+ * @param   uOffset         Offset of the chunk.
+ * @param   pvBuf           The data read, can be used as scratch buffer.
+ * @param   cbWrite         Size of the chunk.
+ * @param   fFree           Flag whether the read callback found the range unallocated.
+ * @param   uWriteGen       The write generation returned by the read callback.
+ */
+typedef DECLCALLBACK(int) FNVDCOPYPIPEWRITE(void *pvUser, uint64_t uOffset, void *pvBuf,
+                                            size_t cbWrite, bool fFree, uint64_t uWriteGen);
+/** Pointer to a copy pipeline write callback. */
+typedef FNVDCOPYPIPEWRITE *PFNVDCOPYPIPEWRITE;
+
+/**
+ * Copy pipeline buffer.
+ */
+typedef struct VDCOPYPIPEBUF
+{
+    /** Pointer to the data. */
+    void                   *pvBuf;
+    /** Offset the data was read from. */
+    uint64_t                uOffset;
+    /** Number of bytes valid. */
+    size_t                  cbData;
+    /** Status of the read. */
+    int                     rcRead;
+    /** Flag whether the range is unallocated in the source. */
+    bool                    fFree;
+    /** Write generation of the source when the data was read. */
+    uint64_t                uWriteGen;
+} VDCOPYPIPEBUF;
+/** Pointer to a copy pipeline buffer. */
+typedef VDCOPYPIPEBUF *PVDCOPYPIPEBUF;
+
+/**
+ * Copy pipeline state shared between the reader thread and the writer.
+ *
+ * The buffers form a ring which is filled by the reader thread and drained
+ * in the same order by the writer, so reading the source overlaps with
+ * writing the destination.
+ */
+typedef struct VDCOPYPIPE
+{
+    /** The read callback. */
+    PFNVDCOPYPIPEREAD       pfnRead;
+    /** Opaque user data for the callbacks. */
+    void                   *pvUser;
+    /** Number of bytes to copy. */
+    uint64_t                cbSize;
+    /** Event signalled by the reader when a buffer was filled. */
+    RTSEMEVENT              hEvtFilled;
+    /** Event signalled by the writer when a buffer was drained. */
+    RTSEMEVENT              hEvtDrained;
+    /** Number of filled buffers waiting to be written. */
+    volatile uint32_t       cBufsFilled;
+    /** Flag whether the reader should stop. */
+    volatile bool           fCancelled;
+    /** The pipeline buffers. */
+    VDCOPYPIPEBUF           aBufs[VD_COPY_PIPE_BUFFERS];
+} VDCOPYPIPE;
+/** Pointer to the copy pipeline state. */
+typedef VDCOPYPIPE *PVDCOPYPIPE;
+
+/**
+ * Internal: Copy pipeline reader thread.
+ */
+static DECLCALLBACK(int) vdCopyPipeReadWorker(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PVDCOPYPIPE pPipe = (PVDCOPYPIPE)pvUser;
+    uint64_t uOffset = 0;
+    unsigned idxBuf = 0;
+
+    RT_NOREF(hThreadSelf);
+
+    while (   uOffset < pPipe->cbSize
+           && !ASMAtomicReadBool(&pPipe->fCancelled))
+    {
+        if (ASMAtomicReadU32(&pPipe->cBufsFilled) == RT_ELEMENTS(pPipe->aBufs))
+        {
+            /* All buffers are in use, wait for the writer to catch up. */
+            RTSemEventWait(pPipe->hEvtDrained, RT_INDEFINITE_WAIT);
+            continue;
+        }
+
+        PVDCOPYPIPEBUF pBuf = &pPipe->aBufs[idxBuf];
+        size_t cbRead = (size_t)RT_MIN(VD_COPY_PIPE_BUFFER_SIZE, pPipe->cbSize - uOffset);
+
+        pBuf->uWriteGen = 0;
+        int rc = pPipe->pfnRead(pPipe->pvUser, uOffset, pBuf->pvBuf, &cbRead, &pBuf->uWriteGen);
+        AssertMsgStmt(RT_FAILURE(rc) || cbRead, ("Read callback made no progress\n"), rc = VERR_INTERNAL_ERROR);
+        pBuf->uOffset = uOffset;
+        pBuf->cbData  = cbRead;
+        pBuf->fFree   = rc == VERR_VD_BLOCK_FREE;
+        pBuf->rcRead  = pBuf->fFree ? VINF_SUCCESS : rc;
+
+        ASMAtomicIncU32(&pPipe->cBufsFilled);
+        RTSemEventSignal(pPipe->hEvtFilled);
+
+        if (RT_FAILURE(pBuf->rcRead))
+            break;
+
+        uOffset += cbRead;
+        idxBuf = (idxBuf + 1) % RT_ELEMENTS(pPipe->aBufs);
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: Copies data using a pipeline of buffers, reading from the source
+ * on a separate thread while the calling thread writes to the destination.
+ *
+ * @returns VBox status code.
+ * @param   pfnRead         The read callback, called on the reader thread.
+ * @param   pfnWrite        The write callback, called on the calling thread.
+ * @param   pvUser          Opaque user data for the callbacks.
+ * @param   cbSize          Number of bytes to copy.
+ * @param   pIfProgress     Progress interface, optional.
+ * @param   pDstIfProgress  Progress interface for the destination, optional.
  */
-static int vdCopyHelper(PVDISK pDiskFrom, PVDIMAGE pImageFrom, PVDISK pDiskTo,
-                        uint64_t cbSize, unsigned cImagesFromRead, unsigned cImagesToRead,
-                        bool fSuppressRedundantIo, PVDINTERFACEPROGRESS pIfProgress,
-                        PVDINTERFACEPROGRESS pDstIfProgress)
+static int vdCopyPipeRun(PFNVDCOPYPIPEREAD pfnRead, PFNVDCOPYPIPEWRITE pfnWrite, void *pvUser,
+                         uint64_t cbSize, PVDINTERFACEPROGRESS pIfProgress,
+                         PVDINTERFACEPROGRESS pDstIfProgress)
 {
     int rc = VINF_SUCCESS;
-    int rc2;
-    uint64_t uOffset = 0;
-    uint64_t cbRemaining = cbSize;
-    void *pvBuf = NULL;
-    bool fLockReadFrom = false;
-    bool fLockWriteTo = false;
-    bool fBlockwiseCopy = false;
     unsigned uProgressOld = 0;
 
-    LogFlowFunc(("pDiskFrom=%#p pImageFrom=%#p pDiskTo=%#p cbSize=%llu cImagesFromRead=%u cImagesToRead=%u fSuppressRedundantIo=%RTbool pIfProgress=%#p pDstIfProgress=%#p\n",
-                 pDiskFrom, pImageFrom, pDiskTo, cbSize, cImagesFromRead, cImagesToRead, fSuppressRedundantIo, pDstIfProgress, pDstIfProgress));
-
-    if (   (fSuppressRedundantIo || (cImagesFromRead > 0))
-        && RTListIsEmpty(&pDiskFrom->ListFilterChainRead))
-        fBlockwiseCopy = true;
-
-    /* Allocate tmp buffer. */
-    pvBuf = RTMemTmpAlloc(VD_MERGE_BUFFER_SIZE);
-    if (!pvBuf)
-        return rc;
+    PVDCOPYPIPE pPipe = (PVDCOPYPIPE)RTMemAllocZ(sizeof(VDCOPYPIPE));
+    if (!pPipe)
+        return VERR_NO_MEMORY;
 
-    do
+    uint8_t *pbBufs = (uint8_t *)RTMemTmpAlloc(VD_COPY_PIPE_BUFFERS * VD_COPY_PIPE_BUFFER_SIZE);
+    if (!pbBufs)
     {
-        size_t cbThisRead = RT_MIN(VD_MERGE_BUFFER_SIZE, cbRemaining);
+        RTMemFree(pPipe);
+        return VERR_NO_MEMORY;
+    }
 
-        /* Note that we don't attempt to synchronize cross-disk accesses.
-         * It wouldn't be very difficult to do, just the lock order would
-         * need to be defined somehow to prevent deadlocks. Postpone such
-         * magic as there is no use case for this. */
+    pPipe->pfnRead     = pfnRead;
+    pPipe->pvUser      = pvUser;
+    pPipe->cbSize      = cbSize;
+    pPipe->hEvtFilled  = NIL_RTSEMEVENT;
+    pPipe->hEvtDrained = NIL_RTSEMEVENT;
+    for (unsigned i = 0; i < RT_ELEMENTS(pPipe->aBufs); i++)
+        pPipe->aBufs[i].pvBuf = pbBufs + i * VD_COPY_PIPE_BUFFER_SIZE;
 
-        rc2 = vdThreadStartRead(pDiskFrom);
-        AssertRC(rc2);
-        fLockReadFrom = true;
+    RTTHREAD hThreadRead = NIL_RTTHREAD;
+    rc = RTSemEventCreate(&pPipe->hEvtFilled);
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pPipe->hEvtDrained);
+    if (RT_SUCCESS(rc))
+        rc = RTThreadCreate(&hThreadRead, vdCopyPipeReadWorker, pPipe, 0, RTTHREADTYPE_IO,
+                            RTTHREADFLAGS_WAITABLE, "VDCopyRd");
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t uOffset = 0;
+        unsigned idxBuf = 0;
 
-        if (fBlockwiseCopy)
+        while (uOffset < cbSize)
         {
-            RTSGSEG SegmentBuf;
-            RTSGBUF SgBuf;
-            VDIOCTX IoCtx;
+            if (!ASMAtomicReadU32(&pPipe->cBufsFilled))
+            {
+                RTSemEventWait(pPipe->hEvtFilled, RT_INDEFINITE_WAIT);
+                continue;
+            }
 
-            SegmentBuf.pvSeg = pvBuf;
-            SegmentBuf.cbSeg = VD_MERGE_BUFFER_SIZE;
-            RTSgBufInit(&SgBuf, &SegmentBuf, 1);
-            vdIoCtxInit(&IoCtx, pDiskFrom, VDIOCTXTXDIR_READ, 0, 0, NULL,
-                        &SgBuf, NULL, NULL, VDIOCTX_FLAGS_SYNC);
+            PVDCOPYPIPEBUF pBuf = &pPipe->aBufs[idxBuf];
+            rc = pBuf->rcRead;
+            if (RT_SUCCESS(rc))
+                rc = pfnWrite(pvUser, pBuf->uOffset, pBuf->pvBuf, pBuf->cbData,
+                              pBuf->fFree, pBuf->uWriteGen);
+            if (RT_FAILURE(rc))
+                break;
 
-            /* Read the source data. */
-            rc = pImageFrom->Backend->pfnRead(pImageFrom->pBackendData,
-                                              uOffset, cbThisRead, &IoCtx,
-                                              &cbThisRead);
+            uOffset = pBuf->uOffset + pBuf->cbData;
+            idxBuf = (idxBuf + 1) % RT_ELEMENTS(pPipe->aBufs);
+            ASMAtomicDecU32(&pPipe->cBufsFilled);
+            RTSemEventSignal(pPipe->hEvtDrained);
 
-            if (   rc == VERR_VD_BLOCK_FREE
-                && cImagesFromRead != 1)
+            unsigned uProgressNew = uOffset * 99 / cbSize;
+            if (uProgressNew != uProgressOld)
             {
-                unsigned cImagesToProcess = cImagesFromRead;
+                uProgressOld = uProgressNew;
 
-                for (PVDIMAGE pCurrImage = pImageFrom->pPrev;
-                     pCurrImage != NULL && rc == VERR_VD_BLOCK_FREE;
-                     pCurrImage = pCurrImage->pPrev)
+                if (pIfProgress && pIfProgress->pfnProgress)
                 {
-                    rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
-                                                           uOffset, cbThisRead,
-                                                           &IoCtx, &cbThisRead);
-                    if (cImagesToProcess == 1)
+                    rc = pIfProgress->pfnProgress(pIfProgress->Core.pvUser,
+                                                  uProgressOld);
+                    if (RT_FAILURE(rc))
+                        break;
+                }
+                if (pDstIfProgress && pDstIfProgress->pfnProgress)
+                {
+                    rc = pDstIfProgress->pfnProgress(pDstIfProgress->Core.pvUser,
+                                                     uProgressOld);
+                    if (RT_FAILURE(rc))
                         break;
-                    else if (cImagesToProcess > 0)
-                        cImagesToProcess--;
                 }
             }
         }
-        else
-            rc = vdReadHelper(pDiskFrom, pImageFrom, uOffset, pvBuf, cbThisRead,
-                              false /* fUpdateCache */);
 
-        if (RT_FAILURE(rc) && rc != VERR_VD_BLOCK_FREE)
-            break;
-
-        rc2 = vdThreadFinishRead(pDiskFrom);
+        /* Stop the reader, it might still be waiting for a free buffer. */
+        ASMAtomicWriteBool(&pPipe->fCancelled, true);
+        RTSemEventSignal(pPipe->hEvtDrained);
+        int rc2 = RTThreadWait(hThreadRead, RT_INDEFINITE_WAIT, NULL);
         AssertRC(rc2);
-        fLockReadFrom = false;
+    }
 
-        if (rc != VERR_VD_BLOCK_FREE)
-        {
-            rc2 = vdThreadStartWrite(pDiskTo);
-            AssertRC(rc2);
-            fLockWriteTo = true;
+    if (pPipe->hEvtDrained != NIL_RTSEMEVENT)
+        RTSemEventDestroy(pPipe->hEvtDrained);
+    if (pPipe->hEvtFilled != NIL_RTSEMEVENT)
+        RTSemEventDestroy(pPipe->hEvtFilled);
+    RTMemTmpFree(pbBufs);
+    RTMemFree(pPipe);
 
-            /* Only do collapsed I/O if we are copying the data blockwise. */
-            rc = vdWriteHelperEx(pDiskTo, pDiskTo->pLast, NULL, uOffset, pvBuf,
-                                 cbThisRead, VDIOCTX_FLAGS_DONT_SET_MODIFIED_FLAG /* fFlags */,
-                                 fBlockwiseCopy ? cImagesToRead : 0);
-            if (RT_FAILURE(rc))
-                break;
+    return rc;
+}
 
-            rc2 = vdThreadFinishWrite(pDiskTo);
-            AssertRC(rc2);
-            fLockWriteTo = false;
-        }
-        else /* Don't propagate the error to the outside */
-            rc = VINF_SUCCESS;
+/**
+ * State for copying a disk with the copy pipeline.
+ */
+typedef struct VDCOPYSTATE
+{
+    /** The source disk. */
+    PVDISK                  pDiskFrom;
+    /** The image to copy. */
+    PVDIMAGE                pImageFrom;
+    /** The destination disk. */
+    PVDISK                  pDiskTo;
+    /** Number of images to read from in the source when copying blockwise. */
+    unsigned                cImagesFromRead;
+    /** Number of images to read from in the destination when copying blockwise. */
+    unsigned                cImagesToRead;
+    /** Flag whether the data is copied blockwise skipping unallocated blocks. */
+    bool                    fBlockwiseCopy;
+} VDCOPYSTATE;
+/** Pointer to the disk copy state. */
+typedef VDCOPYSTATE *PVDCOPYSTATE;
 
-        uOffset += cbThisRead;
-        cbRemaining -= cbThisRead;
+/**
+ * @callback_method_impl{FNVDCOPYPIPEREAD, Reads from the source disk of a copy.}
+ */
+static DECLCALLBACK(int) vdCopyPipeRead(void *pvUser, uint64_t uOffset, void *pvBuf,
+                                        size_t *pcbRead, uint64_t *puWriteGen)
+{
+    PVDCOPYSTATE pState = (PVDCOPYSTATE)pvUser;
+    PVDIMAGE pImageFrom = pState->pImageFrom;
+    size_t cbThisRead = *pcbRead;
+    int rc;
+
+    RT_NOREF(puWriteGen);
+
+    /* Note that we don't attempt to synchronize cross-disk accesses.
+     * It wouldn't be very difficult to do, just the lock order would
+     * need to be defined somehow to prevent deadlocks. Postpone such
+     * magic as there is no use case for this. */
+
+    int rc2 = vdThreadStartRead(pState->pDiskFrom);
+    AssertRC(rc2);
 
-        unsigned uProgressNew = uOffset * 99 / cbSize;
-        if (uProgressNew != uProgressOld)
+    if (pState->fBlockwiseCopy)
+    {
+        RTSGSEG SegmentBuf;
+        RTSGBUF SgBuf;
+        VDIOCTX IoCtx;
+
+        SegmentBuf.pvSeg = pvBuf;
+        SegmentBuf.cbSeg = VD_COPY_PIPE_BUFFER_SIZE;
+        RTSgBufInit(&SgBuf, &SegmentBuf, 1);
+        vdIoCtxInit(&IoCtx, pState->pDiskFrom, VDIOCTXTXDIR_READ, 0, 0, NULL,
+                    &SgBuf, NULL, NULL, VDIOCTX_FLAGS_SYNC);
+
+        /* Read the source data. */
+        rc = pImageFrom->Backend->pfnRead(pImageFrom->pBackendData,
+                                          uOffset, cbThisRead, &IoCtx,
+                                          &cbThisRead);
+
+        if (   rc == VERR_VD_BLOCK_FREE
+            && pState->cImagesFromRead != 1)
         {
-            uProgressOld = uProgressNew;
+            unsigned cImagesToProcess = pState->cImagesFromRead;
 
-            if (pIfProgress && pIfProgress->pfnProgress)
+            for (PVDIMAGE pCurrImage = pImageFrom->pPrev;
+                 pCurrImage != NULL && rc == VERR_VD_BLOCK_FREE;
+                 pCurrImage = pCurrImage->pPrev)
             {
-                rc = pIfProgress->pfnProgress(pIfProgress->Core.pvUser,
-                                              uProgressOld);
-                if (RT_FAILURE(rc))
-                    break;
-            }
-            if (pDstIfProgress && pDstIfProgress->pfnProgress)
-            {
-                rc = pDstIfProgress->pfnProgress(pDstIfProgress->Core.pvUser,
-                                                 uProgressOld);
-                if (RT_FAILURE(rc))
+                rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
+                                                  uOffset, cbThisRead,
+                                                  &IoCtx, &cbThisRead);
+                if (cImagesToProcess == 1)
                     break;
+                else if (cImagesToProcess > 0)
+                    cImagesToProcess--;
             }
         }
-    } while (uOffset < cbSize);
+    }
+    else
+        rc = vdReadHelper(pState->pDiskFrom, pImageFrom, uOffset, pvBuf, cbThisRead,
+                          false /* fUpdateCache */);
+
+    rc2 = vdThreadFinishRead(pState->pDiskFrom);
+    AssertRC(rc2);
+
+    *pcbRead = cbThisRead;
+    return rc;
+}
+
+/**
+ * @callback_method_impl{FNVDCOPYPIPEWRITE, Writes to the destination disk of a copy.}
+ */
+static DECLCALLBACK(int) vdCopyPipeWrite(void *pvUser, uint64_t uOffset, void *pvBuf,
+                                         size_t cbWrite, bool fFree, uint64_t uWriteGen)
+{
+    PVDCOPYSTATE pState = (PVDCOPYSTATE)pvUser;
+
+    RT_NOREF(uWriteGen);
+    if (fFree)
+        return VINF_SUCCESS;
+
+    int rc2 = vdThreadStartWrite(pState->pDiskTo);
+    AssertRC(rc2);
+
+    /* Only do collapsed I/O if we are copying the data blockwise. */
+    int rc = vdWriteHelperEx(pState->pDiskTo, pState->pDiskTo->pLast, NULL, uOffset, pvBuf,
+                             cbWrite, VDIOCTX_FLAGS_DONT_SET_MODIFIED_FLAG /* fFlags */,
+                             pState->fBlockwiseCopy ? pState->cImagesToRead : 0);
+
+    rc2 = vdThreadFinishWrite(pState->pDiskTo);
+    AssertRC(rc2);
+
+    return rc;
+}
+
+/**
+ * Internal: Copies the content of one disk to another one applying optimizations
+ * to speed up the copy process if possible.
+ */
+static int vdCopyHelper(PVDISK pDiskFrom, PVDIMAGE pImageFrom, PVDISK pDiskTo,
+                        uint64_t cbSize, unsigned cImagesFromRead, unsigned cImagesToRead,
+                        bool fSuppressRedundantIo, PVDINTERFACEPROGRESS pIfProgress,
+                        PVDINTERFACEPROGRESS pDstIfProgress)
+{
+    VDCOPYSTATE State;
+
+    LogFlowFunc(("pDiskFrom=%#p pImageFrom=%#p pDiskTo=%#p cbSize=%llu cImagesFromRead=%u cImagesToRead=%u fSuppressRedundantIo=%RTbool pIfProgress=%#p pDstIfProgress=%#p\n",
+                 pDiskFrom, pImageFrom, pDiskTo, cbSize, cImagesFromRead, cImagesToRead, fSuppressRedundantIo, pDstIfProgress, pDstIfProgress));
+
+    State.pDiskFrom       = pDiskFrom;
+    State.pImageFrom      = pImageFrom;
+    State.pDiskTo         = pDiskTo;
+    State.cImagesFromRead = cImagesFromRead;
+    State.cImagesToRead   = cImagesToRead;
+    State.fBlockwiseCopy  =    (fSuppressRedundantIo || (cImagesFromRead > 0))
+                            && RTListIsEmpty(&pDiskFrom->ListFilterChainRead);
+
+    int rc = vdCopyPipeRun(vdCopyPipeRead, vdCopyPipeWrite, &State, cbSize,
+                           pIfProgress, pDstIfProgress);
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * State for merging the content of child images into a parent with the
+ * copy pipeline.
+ */
+typedef struct VDMERGESTATE
+{
+    /** The disk. */
+    PVDISK                  pDisk;
+    /** The image to merge from, the last one read. */
+    PVDIMAGE                pImageFrom;
+    /** The image to merge into. */
+    PVDIMAGE                pImageTo;
+} VDMERGESTATE;
+/** Pointer to the merge state. */
+typedef VDMERGESTATE *PVDMERGESTATE;
+
+/**
+ * Internal: Reads the merged content of the images between the source and the
+ * destination of a merge into a parent. The caller must hold the write lock.
+ */
+static int vdMergeParentReadLocked(PVDMERGESTATE pState, uint64_t uOffset, void *pvBuf,
+                                   size_t *pcbRead)
+{
+    size_t cbThisRead = *pcbRead;
+    RTSGSEG SegmentBuf;
+    RTSGBUF SgBuf;
+    VDIOCTX IoCtx;
+    int rc = VERR_VD_BLOCK_FREE;
 
-    RTMemFree(pvBuf);
+    SegmentBuf.pvSeg = pvBuf;
+    SegmentBuf.cbSeg = VD_COPY_PIPE_BUFFER_SIZE;
+    RTSgBufInit(&SgBuf, &SegmentBuf, 1);
+    vdIoCtxInit(&IoCtx, pState->pDisk, VDIOCTXTXDIR_READ, 0, 0, NULL,
+                &SgBuf, NULL, NULL, VDIOCTX_FLAGS_SYNC);
 
-    if (fLockReadFrom)
+    /* Search for image with allocated block. Do not attempt to
+     * read more than the previous reads marked as valid. Otherwise
+     * this would return stale data when different block sizes are
+     * used for the images. */
+    for (PVDIMAGE pCurrImage = pState->pImageFrom;
+         pCurrImage != NULL && pCurrImage != pState->pImageTo && rc == VERR_VD_BLOCK_FREE;
+         pCurrImage = pCurrImage->pPrev)
     {
-        rc2 = vdThreadFinishRead(pDiskFrom);
-        AssertRC(rc2);
+        /*
+         * Skip reading when offset exceeds image size which can happen when the target is
+         * bigger than the source.
+         */
+        uint64_t cbImage = vdImageGetSize(pCurrImage);
+        if (uOffset < cbImage)
+        {
+            cbThisRead = RT_MIN(cbThisRead, cbImage - uOffset);
+            rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
+                                              uOffset, cbThisRead,
+                                              &IoCtx, &cbThisRead);
+        }
+        else
+            rc = VERR_VD_BLOCK_FREE;
     }
 
-    if (fLockWriteTo)
+    *pcbRead = cbThisRead;
+    return rc;
+}
+
+/**
+ * @callback_method_impl{FNVDCOPYPIPEREAD, Reads the child images of a merge into a parent.}
+ */
+static DECLCALLBACK(int) vdMergeParentPipeRead(void *pvUser, uint64_t uOffset, void *pvBuf,
+                                               size_t *pcbRead, uint64_t *puWriteGen)
+{
+    PVDMERGESTATE pState = (PVDMERGESTATE)pvUser;
+
+    /* Need to hold the write lock to get a consistent view in case of a live merge. */
+    int rc2 = vdThreadStartWrite(pState->pDisk);
+    AssertRC(rc2);
+
+    int rc = vdMergeParentReadLocked(pState, uOffset, pvBuf, pcbRead);
+    *puWriteGen = ASMAtomicReadU64(&pState->pDisk->uWriteGen);
+
+    rc2 = vdThreadFinishWrite(pState->pDisk);
+    AssertRC(rc2);
+
+    return rc;
+}
+
+/**
+ * @callback_method_impl{FNVDCOPYPIPEWRITE, Writes to the parent image of a merge.}
+ */
+static DECLCALLBACK(int) vdMergeParentPipeWrite(void *pvUser, uint64_t uOffset, void *pvBuf,
+                                                size_t cbWrite, bool fFree, uint64_t uWriteGen)
+{
+    PVDMERGESTATE pState = (PVDMERGESTATE)pvUser;
+    PVDISK pDisk = pState->pDisk;
+    int rc = VINF_SUCCESS;
+
+    int rc2 = vdThreadStartWrite(pDisk);
+    AssertRC(rc2);
+
+    if (ASMAtomicReadU64(&pDisk->uWriteGen) == uWriteGen)
     {
-        rc2 = vdThreadFinishWrite(pDiskTo);
-        AssertRC(rc2);
+        if (!fFree)
+            rc = vdWriteHelper(pDisk, pState->pImageTo, uOffset, pvBuf,
+                               cbWrite, VDIOCTX_FLAGS_READ_UPDATE_CACHE);
     }
+    else
+    {
+        /*
+         * The disk was written to since the data was read (live merge),
+         * the data might be stale. Read it again while holding the lock.
+         */
+        while (cbWrite)
+        {
+            size_t cbThisRead = cbWrite;
+
+            rc = vdMergeParentReadLocked(pState, uOffset, pvBuf, &cbThisRead);
+            if (rc == VERR_VD_BLOCK_FREE)
+                rc = VINF_SUCCESS;
+            else if (RT_SUCCESS(rc))
+                rc = vdWriteHelper(pDisk, pState->pImageTo, uOffset, pvBuf,
+                                   cbThisRead, VDIOCTX_FLAGS_READ_UPDATE_CACHE);
+            if (RT_FAILURE(rc))
+                break;
+
+            uOffset += cbThisRead;
+            cbWrite -= cbThisRead;
+        }
+    }
+
+    rc2 = vdThreadFinishWrite(pDisk);
+    AssertRC(rc2);
 
-    LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
 }
 
@@ -2635,6 +3105,12 @@ static DECLCALLBACK(int) vdWriteHelperAsync(PVDIOCTX pIoCtx)
     unsigned fWrite;
     size_t cbThisWrite;
     size_t cbPreRead, cbPostRead;
+    PVDCACHE pCache = pDisk->pCache;
+    bool fWriteBack =    pCache
+                      && (pCache->uOpenFlags & VD_OPEN_FLAGS_CACHE_WRITE_BACK)
+                      && pImage == pDisk->pLast
+                      && !pIoCtx->Req.Io.pImageParentOverride
+                      && !(pIoCtx->fFlags & VDIOCTX_FLAGS_CACHE_BYPASS);
 
     /* Apply write filter chain here if it was not done already. */
     if (!(pIoCtx->fFlags & VDIOCTX_FLAGS_WRITE_FILTER_APPLIED))
@@ -2681,6 +3157,25 @@ static DECLCALLBACK(int) vdWriteHelperAsync(PVDIOCTX pIoCtx)
             break;
         }
 
+        if (fWriteBack)
+        {
+            /* The write completes once the data is in the cache, it is written back later. */
+            rc = vdCacheWriteHelper(pCache, uOffset, cbThisWrite, pIoCtx,
+                                    &cbThisWrite, VD_CACHE_WRITE_F_DIRTY);
+            if (rc != VERR_DISK_FULL)
+            {
+                cbWrite -= cbThisWrite;
+                uOffset += cbThisWrite;
+                continue;
+            }
+
+            /* No room in the cache for this part, write it through to the image. */
+            rc = VINF_SUCCESS;
+        }
+
+        if (pCache)
+            ASMAtomicWriteBool(&pCache->fImageFlushNeeded, true);
+
         fWrite =   (pImage->uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME)
                  ? 0 : VD_WRITE_NO_ALLOC;
         rc = pImage->Backend->pfnWrite(pImage->pBackendData, uOffset, cbThisWrite,
@@ -2779,67 +3274,395 @@ static DECLCALLBACK(int) vdWriteHelperAsync(PVDIOCTX pIoCtx)
         else if (rc == VERR_VD_NOT_ENOUGH_METADATA)
             break;
 
-        cbWrite -= cbThisWrite;
-        uOffset += cbThisWrite;
-    } while (cbWrite != 0 && (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS));
+        cbWrite -= cbThisWrite;
+        uOffset += cbThisWrite;
+    } while (cbWrite != 0 && (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS));
+
+    if (   rc == VERR_VD_ASYNC_IO_IN_PROGRESS
+        || rc == VERR_VD_NOT_ENOUGH_METADATA
+        || rc == VERR_VD_IOCTX_HALT)
+    {
+        /*
+         * Tell the caller that we don't need to go back here because all
+         * writes are initiated. This applies to a halted context as well,
+         * the backend accounted for the halted part already and continuing
+         * the context must not call the backend with nothing left to write.
+         */
+        if (!cbWrite)
+            rc = VINF_SUCCESS;
+
+        pIoCtx->Req.Io.uOffset    = uOffset;
+        pIoCtx->Req.Io.cbTransfer = cbWrite;
+    }
+
+    return rc;
+}
+
+/**
+ * Flush helper async version.
+ */
+static DECLCALLBACK(int) vdFlushHelperAsync(PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+    PVDISK pDisk = pIoCtx->pDisk;
+    PVDIMAGE pImage = pIoCtx->Req.Io.pImageCur;
+
+    rc = vdIoCtxLockDisk(pDisk, pIoCtx);
+    if (RT_SUCCESS(rc))
+    {
+        /* Mark the whole disk as locked. */
+        pDisk->uOffsetStartLocked = 0;
+        pDisk->uOffsetEndLocked = UINT64_C(0xffffffffffffffff);
+
+        vdResetModifiedFlag(pDisk);
+
+        /* A write-back cache holds everything written since the last flush unless
+         * something was written past it, the image doesn't need a flush then. */
+        if (   !pDisk->pCache
+            || !(pDisk->pCache->uOpenFlags & VD_OPEN_FLAGS_CACHE_WRITE_BACK)
+            || ASMAtomicXchgBool(&pDisk->pCache->fImageFlushNeeded, false))
+        {
+            rc = pImage->Backend->pfnFlush(pImage->pBackendData, pIoCtx);
+            if (   RT_FAILURE(rc)
+                && rc != VERR_VD_ASYNC_IO_IN_PROGRESS
+                && rc != VERR_VD_IOCTX_HALT
+                && pDisk->pCache)
+                ASMAtomicWriteBool(&pDisk->pCache->fImageFlushNeeded, true);
+        }
+
+        if (   (   RT_SUCCESS(rc)
+                || rc == VERR_VD_ASYNC_IO_IN_PROGRESS
+                || rc == VERR_VD_IOCTX_HALT)
+            && pDisk->pCache)
+        {
+            rc = pDisk->pCache->Backend->pfnFlush(pDisk->pCache->pBackendData, pIoCtx);
+            if (   RT_SUCCESS(rc)
+                || (   rc != VERR_VD_ASYNC_IO_IN_PROGRESS
+                    && rc != VERR_VD_IOCTX_HALT))
+                vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessBlockedReqs */);
+            else if (rc != VERR_VD_IOCTX_HALT)
+                rc = VINF_SUCCESS;
+        }
+        else if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            rc = VINF_SUCCESS;
+        else if (rc != VERR_VD_IOCTX_HALT)/* Some other error. */
+            vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessBlockedReqs */);
+    }
+
+    return rc;
+}
+
+/**
+ * Internal: Flushes the image chain and the cache synchronously.
+ *
+ * @returns VBox status code.
+ * @param   pDisk     The disk to flush.
+ * @param   pImage    The image to flush.
+ */
+static int vdFlushSync(PVDISK pDisk, PVDIMAGE pImage)
+{
+    VDIOCTX IoCtx;
+    RTSEMEVENT hEventComplete = NIL_RTSEMEVENT;
+
+    int rc = RTSemEventCreate(&hEventComplete);
+    if (RT_SUCCESS(rc))
+    {
+        vdIoCtxInit(&IoCtx, pDisk, VDIOCTXTXDIR_FLUSH, 0, 0, pImage, NULL,
+                    NULL, vdFlushHelperAsync, VDIOCTX_FLAGS_SYNC | VDIOCTX_FLAGS_DONT_FREE);
+
+        IoCtx.Type.Root.pfnComplete = vdIoCtxSyncComplete;
+        IoCtx.Type.Root.pvUser1     = pDisk;
+        IoCtx.Type.Root.pvUser2     = hEventComplete;
+        rc = vdIoCtxProcessSync(&IoCtx, hEventComplete);
+
+        RTSemEventDestroy(hEventComplete);
+    }
+
+    return rc;
+}
+
+/**
+ * Internal: Runs the given transfer function synchronously with the disk
+ * locked against concurrent I/O processing. The transfer function must not
+ * start any asynchronous I/O.
+ *
+ * @returns VBox status code.
+ * @param   pDisk             The disk.
+ * @param   pfnIoCtxTransfer  The transfer function to run.
+ */
+static int vdIoCtxRunSync(PVDISK pDisk, PFNVDIOCTXTRANSFER pfnIoCtxTransfer)
+{
+    VDIOCTX IoCtx;
+    RTSEMEVENT hEventComplete = NIL_RTSEMEVENT;
+
+    int rc = RTSemEventCreate(&hEventComplete);
+    if (RT_SUCCESS(rc))
+    {
+        vdIoCtxInit(&IoCtx, pDisk, VDIOCTXTXDIR_FLUSH, 0, 0, NULL, NULL,
+                    NULL, pfnIoCtxTransfer, VDIOCTX_FLAGS_SYNC | VDIOCTX_FLAGS_DONT_FREE);
+
+        IoCtx.Type.Root.pfnComplete = vdIoCtxSyncComplete;
+        IoCtx.Type.Root.pvUser1     = pDisk;
+        IoCtx.Type.Root.pvUser2     = hEventComplete;
+        rc = vdIoCtxProcessSync(&IoCtx, hEventComplete);
+
+        RTSemEventDestroy(hEventComplete);
+    }
+
+    return rc;
+}
+
+/** Maximum number of dirty cache ranges written back in one batch. */
+#define VD_CACHE_DESTAGE_RANGES_MAX     64
+/** Size of the buffer holding the data of one batch. */
+#define VD_CACHE_DESTAGE_BUFFER_SIZE    _4M
+
+/**
+ * A dirty range of the cache which is written back to the image chain.
+ */
+typedef struct VDCACHEDESTAGERANGE
+{
+    /** Sequence number of the range as returned by the cache. */
+    uint64_t            uSeq;
+    /** Start offset of the range. */
+    uint64_t            uOffset;
+    /** Size of the range in bytes. */
+    size_t              cbRange;
+    /** Offset of the data in the batch buffer. */
+    size_t              offBuf;
+} VDCACHEDESTAGERANGE;
+/** Pointer to a dirty range. */
+typedef VDCACHEDESTAGERANGE *PVDCACHEDESTAGERANGE;
+
+/**
+ * State of a cache write back.
+ */
+typedef struct VDCACHEDESTAGE
+{
+    /** Sequence number to continue the search for dirty ranges at. */
+    uint64_t            uSeqNext;
+    /** Offset to continue the search for dirty ranges at. */
+    uint64_t            uOffsetNext;
+    /** Buffer holding the data of the current batch. */
+    uint8_t             *pbBuf;
+    /** Number of ranges in the current batch. */
+    unsigned            cRanges;
+    /** The ranges of the current batch. */
+    VDCACHEDESTAGERANGE aRanges[VD_CACHE_DESTAGE_RANGES_MAX];
+} VDCACHEDESTAGE;
+/** Pointer to a cache write back state. */
+typedef VDCACHEDESTAGE *PVDCACHEDESTAGE;
+
+/**
+ * Internal: Reads data from the cache synchronously.
+ *
+ * @returns VBox status code.
+ * @param   pDisk     The disk the cache belongs to.
+ * @param   pCache    The cache to read from.
+ * @param   uOffset   Offset of the virtual disk to read.
+ * @param   pvBuf     Where to store the data.
+ * @param   cbRead    How much to read, must be completely in the cache.
+ */
+static int vdCacheReadSync(PVDISK pDisk, PVDCACHE pCache, uint64_t uOffset,
+                           void *pvBuf, size_t cbRead)
+{
+    int rc = VINF_SUCCESS;
+    RTSGSEG Segment;
+    RTSGBUF SgBuf;
+    VDIOCTX IoCtx;
+
+    Segment.pvSeg = pvBuf;
+    Segment.cbSeg = cbRead;
+    RTSgBufInit(&SgBuf, &Segment, 1);
+    vdIoCtxInit(&IoCtx, pDisk, VDIOCTXTXDIR_READ, uOffset, cbRead, NULL,
+                &SgBuf, NULL, NULL, VDIOCTX_FLAGS_SYNC);
+
+    while (   cbRead
+           && RT_SUCCESS(rc))
+    {
+        size_t cbThisRead = cbRead;
+
+        rc = vdCacheReadHelper(pCache, uOffset, cbThisRead, &IoCtx, &cbThisRead);
+        AssertMsgBreakStmt(rc != VERR_VD_BLOCK_FREE,
+                           ("Dirty data at %llu is not in the cache\n", uOffset),
+                           rc = VERR_INTERNAL_ERROR);
+
+        uOffset += cbThisRead;
+        cbRead  -= cbThisRead;
+    }
+
+    return rc;
+}
+
+/**
+ * Collects the next batch of dirty ranges from the cache and reads their data.
+ */
+static DECLCALLBACK(int) vdCacheDestageReadHelperAsync(PVDIOCTX pIoCtx)
+{
+    PVDISK pDisk = pIoCtx->pDisk;
+    PVDCACHE pCache = pDisk->pCache;
+    PVDCACHEDESTAGE pDestage = pCache->pDestage;
+    size_t offBuf = 0;
+    int rc = VINF_SUCCESS;
+
+    pDestage->cRanges = 0;
+    while (   pDestage->cRanges < RT_ELEMENTS(pDestage->aRanges)
+           && offBuf < VD_CACHE_DESTAGE_BUFFER_SIZE)
+    {
+        PVDCACHEDESTAGERANGE pRange = &pDestage->aRanges[pDestage->cRanges];
+
+        pRange->uSeq    = pDestage->uSeqNext;
+        pRange->uOffset = pDestage->uOffsetNext;
+        rc = pCache->Backend->pfnDirtyQueryNext(pCache->pBackendData, &pRange->uSeq,
+                                                &pRange->uOffset, &pRange->cbRange);
+        if (RT_FAILURE(rc))
+        {
+            if (rc == VERR_NOT_FOUND)
+                rc = VINF_SUCCESS;
+            break;
+        }
+
+        pRange->cbRange = RT_MIN(pRange->cbRange, VD_CACHE_DESTAGE_BUFFER_SIZE - offBuf);
+        pRange->offBuf  = offBuf;
+        rc = vdCacheReadSync(pDisk, pCache, pRange->uOffset, pDestage->pbBuf + offBuf,
+                             pRange->cbRange);
+        if (RT_FAILURE(rc))
+            break;
+
+        pDestage->uSeqNext    = pRange->uSeq;
+        pDestage->uOffsetNext = pRange->uOffset + pRange->cbRange;
+        offBuf += pRange->cbRange;
+        pDestage->cRanges++;
+    }
+
+    return rc;
+}
+
+/**
+ * Marks the ranges of the current batch as written back.
+ */
+static DECLCALLBACK(int) vdCacheDestageClearHelperAsync(PVDIOCTX pIoCtx)
+{
+    PVDCACHE pCache = pIoCtx->pDisk->pCache;
+    PVDCACHEDESTAGE pDestage = pCache->pDestage;
+    int rc = VINF_SUCCESS;
+
+    for (unsigned i = 0; i < pDestage->cRanges && RT_SUCCESS(rc); i++)
+        rc = pCache->Backend->pfnDirtyClear(pCache->pBackendData, pDestage->aRanges[i].uSeq,
+                                            pDestage->aRanges[i].uOffset,
+                                            pDestage->aRanges[i].cbRange);
+
+    return rc;
+}
+
+/**
+ * Internal: Writes dirty data of the cache back to the image chain, oldest
+ * modifications first. The caller must hold the write lock.
+ *
+ * Each batch is written to the image and flushed before the cache is told to
+ * forget about it, so a crash at any point leaves the data either in the cache
+ * or on the image.
+ *
+ * @returns VBox status code.
+ * @param   pDisk       The disk.
+ * @param   cbDestage   Amount of dirty data to write back at most.
+ */
+static int vdCacheDestage(PVDISK pDisk, uint64_t cbDestage)
+{
+    PVDCACHE pCache = pDisk->pCache;
+    uint64_t cbDestaged = 0;
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pDisk=%#p cbDestage=%llu\n", pDisk, cbDestage));
+
+    AssertPtrReturn(pCache, VERR_VD_CACHE_NOT_FOUND);
+    AssertPtrReturn(pDisk->pLast, VERR_VD_NOT_OPENED);
+
+    if (!pCache->Backend->pfnGetDirtySize(pCache->pBackendData))
+        return VINF_SUCCESS;
+
+    if (pCache->Backend->pfnGetOpenFlags(pCache->pBackendData) & VD_OPEN_FLAGS_READONLY)
+        return vdError(pDisk, VERR_VD_IMAGE_READ_ONLY, RT_SRC_POS,
+                       N_("VD: cache '%s' holds data which was not written back yet but is opened read-only"),
+                       pCache->pszFilename);
+
+    PVDCACHEDESTAGE pDestage = (PVDCACHEDESTAGE)RTMemAllocZ(sizeof(VDCACHEDESTAGE));
+    if (!pDestage)
+        return VERR_NO_MEMORY;
+
+    pDestage->pbBuf = (uint8_t *)RTMemAlloc(VD_CACHE_DESTAGE_BUFFER_SIZE);
+    if (!pDestage->pbBuf)
+    {
+        RTMemFree(pDestage);
+        return VERR_NO_MEMORY;
+    }
+
+    pCache->pDestage = pDestage;
+
+    while (cbDestaged < cbDestage)
+    {
+        rc = vdIoCtxRunSync(pDisk, vdCacheDestageReadHelperAsync);
+        if (   RT_FAILURE(rc)
+            || !pDestage->cRanges)
+            break;
+
+        /* The data went through the write filters already when it was written to the cache. */
+        for (unsigned i = 0; i < pDestage->cRanges && RT_SUCCESS(rc); i++)
+            rc = vdWriteHelper(pDisk, pDisk->pLast, pDestage->aRanges[i].uOffset,
+                               pDestage->pbBuf + pDestage->aRanges[i].offBuf,
+                               pDestage->aRanges[i].cbRange,
+                               VDIOCTX_FLAGS_CACHE_BYPASS | VDIOCTX_FLAGS_WRITE_FILTER_APPLIED);
+        if (RT_FAILURE(rc))
+            break;
+
+        rc = vdFlushSync(pDisk, pDisk->pLast);
+        if (RT_FAILURE(rc))
+            break;
 
-    if (   rc == VERR_VD_ASYNC_IO_IN_PROGRESS
-        || rc == VERR_VD_NOT_ENOUGH_METADATA
-        || rc == VERR_VD_IOCTX_HALT)
-    {
-        /*
-         * Tell the caller that we don't need to go back here because all
-         * writes are initiated.
-         */
-        if (   !cbWrite
-            && rc != VERR_VD_IOCTX_HALT)
-            rc = VINF_SUCCESS;
+        rc = vdIoCtxRunSync(pDisk, vdCacheDestageClearHelperAsync);
+        if (RT_FAILURE(rc))
+            break;
 
-        pIoCtx->Req.Io.uOffset    = uOffset;
-        pIoCtx->Req.Io.cbTransfer = cbWrite;
+        for (unsigned i = 0; i < pDestage->cRanges; i++)
+            cbDestaged += pDestage->aRanges[i].cbRange;
     }
 
+    /* Make the clean state persistent, the cache can reuse the space afterwards. */
+    if (   RT_SUCCESS(rc)
+        && cbDestaged)
+        rc = vdFlushSync(pDisk, pDisk->pLast);
+
+    pCache->pDestage = NULL;
+    RTMemFree(pDestage->pbBuf);
+    RTMemFree(pDestage);
+
+    LogFlowFunc(("returns %Rrc cbDestaged=%llu\n", rc, cbDestaged));
     return rc;
 }
 
 /**
- * Flush helper async version.
+ * Internal: Writes the oldest dirty data of a write-back cache back to the
+ * image chain if the cache holds more than the configured limit. The caller
+ * must hold the write lock.
+ *
+ * @returns VBox status code.
+ * @param   pDisk       The disk.
  */
-static DECLCALLBACK(int) vdFlushHelperAsync(PVDIOCTX pIoCtx)
+static int vdCacheDestageOverLimit(PVDISK pDisk)
 {
-    int rc = VINF_SUCCESS;
-    PVDISK pDisk = pIoCtx->pDisk;
-    PVDIMAGE pImage = pIoCtx->Req.Io.pImageCur;
+    PVDCACHE pCache = pDisk->pCache;
 
-    rc = vdIoCtxLockDisk(pDisk, pIoCtx);
-    if (RT_SUCCESS(rc))
-    {
-        /* Mark the whole disk as locked. */
-        pDisk->uOffsetStartLocked = 0;
-        pDisk->uOffsetEndLocked = UINT64_C(0xffffffffffffffff);
+    if (   !pCache
+        || !(pCache->uOpenFlags & VD_OPEN_FLAGS_CACHE_WRITE_BACK)
+        || !pCache->cbDirtyMax)
+        return VINF_SUCCESS;
 
-        vdResetModifiedFlag(pDisk);
-        rc = pImage->Backend->pfnFlush(pImage->pBackendData, pIoCtx);
-        if (   (   RT_SUCCESS(rc)
-                || rc == VERR_VD_ASYNC_IO_IN_PROGRESS
-                || rc == VERR_VD_IOCTX_HALT)
-            && pDisk->pCache)
-        {
-            rc = pDisk->pCache->Backend->pfnFlush(pDisk->pCache->pBackendData, pIoCtx);
-            if (   RT_SUCCESS(rc)
-                || (   rc != VERR_VD_ASYNC_IO_IN_PROGRESS
-                    && rc != VERR_VD_IOCTX_HALT))
-                vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessBlockedReqs */);
-            else if (rc != VERR_VD_IOCTX_HALT)
-                rc = VINF_SUCCESS;
-        }
-        else if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
-            rc = VINF_SUCCESS;
-        else if (rc != VERR_VD_IOCTX_HALT)/* Some other error. */
-            vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessBlockedReqs */);
-    }
+    uint64_t cbDirty = pCache->Backend->pfnGetDirtySize(pCache->pBackendData);
+    if (cbDirty <= pCache->cbDirtyMax)
+        return VINF_SUCCESS;
 
-    return rc;
+    /* Go down to half the limit so not every following write has to wait for a write back. */
+    return vdCacheDestage(pDisk, cbDirty - pCache->cbDirtyMax / 2);
 }
 
 /**
@@ -3999,6 +4822,7 @@ static DECLCALLBACK(int) vdIOIntReadUser(void *pvUser, PVDIOSTORAGE pIoStorage,
         cbTaskRead = RTSgBufSegArrayCreate(&pIoCtx->Req.Io.SgBuf, &Seg, &cSegments, cbRead);
         Assert(cbRead == cbTaskRead);
         Assert(cSegments == 1);
+        vdIoCtxTraceSubmit(pIoCtx, false /* fMeta */);
         rc = pVDIo->pInterfaceIo->pfnReadSync(pVDIo->pInterfaceIo->Core.pvUser,
                                               pIoStorage->pStorage, uOffset,
                                               Seg.pvSeg, cbRead, NULL);
@@ -4039,6 +4863,7 @@ static DECLCALLBACK(int) vdIOIntReadUser(void *pvUser, PVDIOSTORAGE pIoStorage,
 
             void *pvTask;
             Log(("Spawning pIoTask=%p pIoCtx=%p\n", pIoTask, pIoCtx));
+            vdIoCtxTraceSubmit(pIoCtx, false /* fMeta */);
             rc = pVDIo->pInterfaceIo->pfnReadAsync(pVDIo->pInterfaceIo->Core.pvUser,
                                                    pIoStorage->pStorage, uOffset,
                                                    aSeg, cSegments, cbTaskRead, pIoTask,
@@ -4097,6 +4922,7 @@ static DECLCALLBACK(int) vdIOIntWriteUser(void *pvUser, PVDIOSTORAGE pIoStorage,
         cbTaskWrite = RTSgBufSegArrayCreate(&pIoCtx->Req.Io.SgBuf, &Seg, &cSegments, cbWrite);
         Assert(cbWrite == cbTaskWrite);
         Assert(cSegments == 1);
+        vdIoCtxTraceSubmit(pIoCtx, false /* fMeta */);
         rc = pVDIo->pInterfaceIo->pfnWriteSync(pVDIo->pInterfaceIo->Core.pvUser,
                                               pIoStorage->pStorage, uOffset,
                                               Seg.pvSeg, cbWrite, NULL);
@@ -4139,6 +4965,7 @@ static DECLCALLBACK(int) vdIOIntWriteUser(void *pvUser, PVDIOSTORAGE pIoStorage,
 
             void *pvTask;
             Log(("Spawning pIoTask=%p pIoCtx=%p\n", pIoTask, pIoCtx));
+            vdIoCtxTraceSubmit(pIoCtx, false /* fMeta */);
             rc = pVDIo->pInterfaceIo->pfnWriteAsync(pVDIo->pInterfaceIo->Core.pvUser,
                                                     pIoStorage->pStorage,
                                                     uOffset, aSeg, cSegments,
@@ -4197,6 +5024,7 @@ static DECLCALLBACK(int) vdIOIntReadMeta(void *pvUser, PVDIOSTORAGE pIoStorage,
     {
         /* Handle synchronous metadata I/O. */
         /** @todo Integrate with metadata transfers below. */
+        vdIoCtxTraceSubmit(pIoCtx, true /* fMeta */);
         rc = pVDIo->pInterfaceIo->pfnReadSync(pVDIo->pInterfaceIo->Core.pvUser,
                                                pIoStorage->pStorage, uOffset,
                                                pvBuf, cbRead, NULL);
@@ -4230,6 +5058,7 @@ static DECLCALLBACK(int) vdIOIntReadMeta(void *pvUser, PVDIOSTORAGE pIoStorage,
             Seg.pvSeg = pMetaXfer->abData;
 
             VDMETAXFER_TXDIR_SET(pMetaXfer->fFlags, VDMETAXFER_TXDIR_READ);
+            vdIoCtxTraceSubmit(pIoCtx, true /* fMeta */);
             rc = pVDIo->pInterfaceIo->pfnReadAsync(pVDIo->pInterfaceIo->Core.pvUser,
                                                    pIoStorage->pStorage,
                                                    uOffset, &Seg, 1,
@@ -4319,6 +5148,7 @@ static DECLCALLBACK(int) vdIOIntWriteMeta(void *pvUser, PVDIOSTORAGE pIoStorage,
     {
         /* Handle synchronous metadata I/O. */
         /** @todo Integrate with metadata transfers below. */
+        vdIoCtxTraceSubmit(pIoCtx, true /* fMeta */);
         rc = pVDIo->pInterfaceIo->pfnWriteSync(pVDIo->pInterfaceIo->Core.pvUser,
                                                pIoStorage->pStorage, uOffset,
                                                pvBuf, cbWrite, NULL);
@@ -4356,6 +5186,7 @@ static DECLCALLBACK(int) vdIOIntWriteMeta(void *pvUser, PVDIOSTORAGE pIoStorage,
             ASMAtomicIncU32(&pIoCtx->cMetaTransfersPending);
 
             VDMETAXFER_TXDIR_SET(pMetaXfer->fFlags, VDMETAXFER_TXDIR_WRITE);
+            vdIoCtxTraceSubmit(pIoCtx, true /* fMeta */);
             rc = pVDIo->pInterfaceIo->pfnWriteAsync(pVDIo->pInterfaceIo->Core.pvUser,
                                                     pIoStorage->pStorage,
                                                     uOffset, &Seg, 1, cbWrite, pIoTask,
@@ -4512,6 +5343,7 @@ static DECLCALLBACK(int) vdIOIntFlush(void *pvUser, PVDIOSTORAGE pIoStorage, PVD
     {
         /* Handle synchronous flushes. */
         /** @todo Integrate with metadata transfers below. */
+        vdIoCtxTraceSubmit(pIoCtx, true /* fMeta */);
         rc = pVDIo->pInterfaceIo->pfnFlushSync(pVDIo->pInterfaceIo->Core.pvUser,
                                                pIoStorage->pStorage);
     }
@@ -4522,7 +5354,7 @@ static DECLCALLBACK(int) vdIOIntFlush(void *pvUser, PVDIOSTORAGE pIoStorage, PVD
         if (!pMetaXfer)
             return VERR_NO_MEMORY;
 
-        pIoTask = vdIoTaskMetaAlloc(pIoStorage, pfnComplete, pvUser, pMetaXfer);
+        pIoTask = vdIoTaskMetaAlloc(pIoStorage, pfnComplete, pvCompleteUser, pMetaXfer);
         if (!pIoTask)
         {
             RTMemFree(pMetaXfer);
@@ -4539,6 +5371,7 @@ static DECLCALLBACK(int) vdIOIntFlush(void *pvUser, PVDIOSTORAGE pIoStorage, PVD
 
         RTListAppend(&pMetaXfer->ListIoCtxWaiting, &pDeferred->NodeDeferred);
         VDMETAXFER_TXDIR_SET(pMetaXfer->fFlags, VDMETAXFER_TXDIR_FLUSH);
+        vdIoCtxTraceSubmit(pIoCtx, true /* fMeta */);
         rc = pVDIo->pInterfaceIo->pfnFlushAsync(pVDIo->pInterfaceIo->Core.pvUser,
                                                 pIoStorage->pStorage,
                                                 pIoTask, &pvTask);
@@ -5321,9 +6154,11 @@ VBOXDDU_DECL(int) VDCreate(PVDINTERFACE pVDIfsDisk, VDTYPE enmType, PVDISK *ppDi
             pDisk->pVDIfsDisk              = pVDIfsDisk;
             pDisk->pInterfaceError         = NULL;
             pDisk->pInterfaceThreadSync    = NULL;
+            pDisk->pInterfaceIoTrace       = NULL;
             pDisk->pIoCtxLockOwner         = NULL;
             pDisk->pIoCtxHead              = NULL;
             pDisk->fLocked                 = false;
+            pDisk->uWriteGen               = 0;
             pDisk->hMemCacheIoCtx          = NIL_RTMEMCACHE;
             pDisk->hMemCacheIoTask         = NIL_RTMEMCACHE;
             RTListInit(&pDisk->ListFilterChainWrite);
@@ -5343,6 +6178,7 @@ VBOXDDU_DECL(int) VDCreate(PVDINTERFACE pVDIfsDisk, VDTYPE enmType, PVDISK *ppDi
 
             pDisk->pInterfaceError      = VDIfErrorGet(pVDIfsDisk);
             pDisk->pInterfaceThreadSync = VDIfThreadSyncGet(pVDIfsDisk);
+            pDisk->pInterfaceIoTrace    = VDIfIoTraceGet(pVDIfsDisk);
 
             *ppDisk = pDisk;
         }
@@ -5987,9 +6823,10 @@ VBOXDDU_DECL(int) VDCacheOpen(PVDISK pDisk, const char *pszBackend,
                             &pCache->VDIo, sizeof(VDINTERFACEIOINT), &pCache->pVDIfsCache);
         AssertRC(rc);
 
-        pCache->uOpenFlags = uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME;
+        pCache->uOpenFlags = uOpenFlags & (VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_CACHE_WRITE_BACK);
+        uOpenFlags &= ~(VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_CACHE_WRITE_BACK);
         rc = pCache->Backend->pfnOpen(pCache->pszFilename,
-                                      uOpenFlags & ~VD_OPEN_FLAGS_HONOR_SAME,
+                                      uOpenFlags,
                                       pDisk->pVDIfsDisk,
                                       pCache->pVDIfsCache,
                                       &pCache->pBackendData);
@@ -6002,12 +6839,15 @@ VBOXDDU_DECL(int) VDCacheOpen(PVDISK pDisk, const char *pszBackend,
                      || rc == VERR_WRITE_PROTECT
                      || rc == VERR_SHARING_VIOLATION
                      || rc == VERR_FILE_LOCK_FAILED))
+            {
                 rc = pCache->Backend->pfnOpen(pCache->pszFilename,
-                                                (uOpenFlags & ~VD_OPEN_FLAGS_HONOR_SAME)
-                                               | VD_OPEN_FLAGS_READONLY,
-                                               pDisk->pVDIfsDisk,
-                                               pCache->pVDIfsCache,
-                                               &pCache->pBackendData);
+                                              uOpenFlags | VD_OPEN_FLAGS_READONLY,
+                                              pDisk->pVDIfsDisk,
+                                              pCache->pVDIfsCache,
+                                              &pCache->pBackendData);
+                /* Nothing can be written to a read-only cache. */
+                pCache->uOpenFlags &= ~VD_OPEN_FLAGS_CACHE_WRITE_BACK;
+            }
             if (RT_FAILURE(rc))
             {
                 rc = vdError(pDisk, rc, RT_SRC_POS,
@@ -6057,6 +6897,19 @@ VBOXDDU_DECL(int) VDCacheOpen(PVDISK pDisk, const char *pszBackend,
                 rc = VERR_VD_CACHE_ALREADY_EXISTS;
         }
 
+        /*
+         * Dirty data left behind by a write-back session must be written back
+         * now if the cache isn't used in write-back mode anymore, writes would
+         * bypass it otherwise.
+         */
+        if (   RT_SUCCESS(rc)
+            && !(pCache->uOpenFlags & VD_OPEN_FLAGS_CACHE_WRITE_BACK))
+        {
+            rc = vdCacheDestage(pDisk, UINT64_MAX);
+            if (RT_FAILURE(rc))
+                pDisk->pCache = NULL;
+        }
+
         if (RT_FAILURE(rc))
         {
             /* Error detected, but image opened. Close image. */
@@ -6885,12 +7738,13 @@ VBOXDDU_DECL(int) VDCreateCache(PVDISK pDisk, const char *pszBackend,
             pUuid = &uuid;
         }
 
-        pCache->uOpenFlags = uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME;
+        pCache->uOpenFlags = uOpenFlags & (VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_CACHE_WRITE_BACK);
         pCache->VDIo.fIgnoreFlush = (uOpenFlags & VD_OPEN_FLAGS_IGNORE_FLUSH) != 0;
         rc = pCache->Backend->pfnCreate(pCache->pszFilename, cbSize,
                                         uImageFlags,
                                         pszComment, pUuid,
-                                        uOpenFlags & ~VD_OPEN_FLAGS_HONOR_SAME,
+                                          uOpenFlags
+                                        & ~(VD_OPEN_FLAGS_HONOR_SAME | VD_OPEN_FLAGS_CACHE_WRITE_BACK),
                                         0, 99,
                                         pDisk->pVDIfsDisk,
                                         pCache->pVDIfsCache,
@@ -7195,88 +8049,14 @@ VBOXDDU_DECL(int) VDMerge(PVDISK pDisk, unsigned nImageFrom,
 
             /* Merge child state into parent. This means writing all blocks
              * which are allocated in the image up to the source image to the
-             * destination image. */
-            unsigned uProgressOld = 0;
-            uint64_t uOffset = 0;
-            uint64_t cbRemaining = cbSize;
-            do
-            {
-                size_t cbThisRead = RT_MIN(VD_MERGE_BUFFER_SIZE, cbRemaining);
-                RTSGSEG SegmentBuf;
-                RTSGBUF SgBuf;
-                VDIOCTX IoCtx;
-
-                rc = VERR_VD_BLOCK_FREE;
-
-                SegmentBuf.pvSeg = pvBuf;
-                SegmentBuf.cbSeg = VD_MERGE_BUFFER_SIZE;
-                RTSgBufInit(&SgBuf, &SegmentBuf, 1);
-                vdIoCtxInit(&IoCtx, pDisk, VDIOCTXTXDIR_READ, 0, 0, NULL,
-                            &SgBuf, NULL, NULL, VDIOCTX_FLAGS_SYNC);
-
-                /* Need to hold the write lock during a read-write operation. */
-                rc2 = vdThreadStartWrite(pDisk);
-                AssertRC(rc2);
-                fLockWrite = true;
-
-                /* Search for image with allocated block. Do not attempt to
-                 * read more than the previous reads marked as valid. Otherwise
-                 * this would return stale data when different block sizes are
-                 * used for the images. */
-                for (PVDIMAGE pCurrImage = pImageFrom;
-                     pCurrImage != NULL && pCurrImage != pImageTo && rc == VERR_VD_BLOCK_FREE;
-                     pCurrImage = pCurrImage->pPrev)
-                {
-                    /*
-                     * Skip reading when offset exceeds image size which can happen when the target is
-                     * bigger than the source.
-                     */
-                    uint64_t cbImage = vdImageGetSize(pCurrImage);
-                    if (uOffset < cbImage)
-                    {
-                        cbThisRead = RT_MIN(cbThisRead, cbImage - uOffset);
-                        rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
-                                                          uOffset, cbThisRead,
-                                                          &IoCtx, &cbThisRead);
-                    }
-                    else
-                        rc = VERR_VD_BLOCK_FREE;
-                }
-
-                if (rc != VERR_VD_BLOCK_FREE)
-                {
-                    if (RT_FAILURE(rc))
-                        break;
-                    rc = vdWriteHelper(pDisk, pImageTo, uOffset, pvBuf,
-                                       cbThisRead, VDIOCTX_FLAGS_READ_UPDATE_CACHE);
-                    if (RT_FAILURE(rc))
-                        break;
-                }
-                else
-                    rc = VINF_SUCCESS;
-
-                rc2 = vdThreadFinishWrite(pDisk);
-                AssertRC(rc2);
-                fLockWrite = false;
-
-                uOffset += cbThisRead;
-                cbRemaining -= cbThisRead;
-
-                unsigned uProgressNew = uOffset * 99 / cbSize;
-                if (uProgressNew != uProgressOld)
-                {
-                    uProgressOld = uProgressNew;
-
-                    if (pIfProgress && pIfProgress->pfnProgress)
-                    {
-                        rc = pIfProgress->pfnProgress(pIfProgress->Core.pvUser,
-                                                      uProgressOld);
-                        if (RT_FAILURE(rc))
-                            break;
-                    }
-                }
-
-            } while (uOffset < cbSize);
+             * destination image. Reading the children and writing the parent
+             * touches distinct images, so it can be pipelined. */
+            VDMERGESTATE State;
+            State.pDisk      = pDisk;
+            State.pImageFrom = pImageFrom;
+            State.pImageTo   = pImageTo;
+            rc = vdCopyPipeRun(vdMergeParentPipeRead, vdMergeParentPipeWrite, &State,
+                               cbSize, pIfProgress, NULL /* pDstIfProgress */);
 
             /* In case we set up a "write proxy" image above we must clear
              * this again now to prevent stray writes. Failure or not. */
@@ -8289,6 +9069,14 @@ VBOXDDU_DECL(int) VDClose(PVDISK pDisk, bool fDelete)
         if (RT_FAILURE(rc))
             break;
 
+        /* Dirty data in the cache belongs to the image being closed. */
+        if (pDisk->pCache)
+        {
+            rc = vdCacheDestage(pDisk, UINT64_MAX);
+            if (RT_FAILURE(rc))
+                break;
+        }
+
         unsigned uOpenFlags = pImage->Backend->pfnGetOpenFlags(pImage->pBackendData);
         /* Remove image from list of opened images. */
         vdRemoveImageFromList(pDisk, pImage);
@@ -8388,6 +9176,14 @@ VBOXDDU_DECL(int) VDCacheClose(PVDISK pDisk, bool fDelete)
 
         AssertPtrBreakStmt(pDisk->pCache, rc = VERR_VD_CACHE_NOT_FOUND);
 
+        /* Keep the cache if the dirty data can't be written back, nothing is lost then. */
+        if (pDisk->pLast)
+        {
+            rc = vdCacheDestage(pDisk, UINT64_MAX);
+            if (RT_FAILURE(rc))
+                break;
+        }
+
         pCache = pDisk->pCache;
         pDisk->pCache = NULL;
 
@@ -8407,6 +9203,131 @@ VBOXDDU_DECL(int) VDCacheClose(PVDISK pDisk, bool fDelete)
     return rc;
 }
 
+/**
+ * Writes dirty data of a cache opened in write-back mode back to the image
+ * chain, oldest modifications first.
+ *
+ * @return  VBox status code.
+ * @return  VERR_VD_NOT_OPENED if no cache is opened in HDD container.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   cbDestage       Amount of dirty data to write back at most,
+ *                          UINT64_MAX to write back everything.
+ */
+VBOXDDU_DECL(int) VDCacheDestage(PVDISK pDisk, uint64_t cbDestage)
+{
+    int rc = VINF_SUCCESS;
+    int rc2;
+    bool fLockWrite = false;
+
+    LogFlowFunc(("pDisk=%#p cbDestage=%llu\n", pDisk, cbDestage));
+
+    do
+    {
+        /* sanity check */
+        AssertPtrBreakStmt(pDisk, rc = VERR_INVALID_PARAMETER);
+        AssertMsg(pDisk->u32Signature == VDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
+
+        rc2 = vdThreadStartWrite(pDisk);
+        AssertRC(rc2);
+        fLockWrite = true;
+
+        AssertPtrBreakStmt(pDisk->pCache, rc = VERR_VD_NOT_OPENED);
+        AssertPtrBreakStmt(pDisk->pLast, rc = VERR_VD_NOT_OPENED);
+
+        rc = vdCacheDestage(pDisk, cbDestage);
+    } while (0);
+
+    if (RT_LIKELY(fLockWrite))
+    {
+        rc2 = vdThreadFinishWrite(pDisk);
+        AssertRC(rc2);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Returns the amount of dirty data in the cache which was not written back
+ * to the image chain yet.
+ *
+ * @return  Amount of dirty data in bytes, 0 if no cache is opened.
+ * @param   pDisk           Pointer to HDD container.
+ */
+VBOXDDU_DECL(uint64_t) VDCacheGetDirtySize(PVDISK pDisk)
+{
+    uint64_t cbDirty = 0;
+    int rc2;
+    bool fLockRead = false;
+
+    LogFlowFunc(("pDisk=%#p\n", pDisk));
+    do
+    {
+        /* sanity check */
+        AssertPtrBreak(pDisk);
+        AssertMsg(pDisk->u32Signature == VDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
+
+        rc2 = vdThreadStartRead(pDisk);
+        AssertRC(rc2);
+        fLockRead = true;
+
+        PVDCACHE pCache = pDisk->pCache;
+        if (pCache)
+            cbDirty = pCache->Backend->pfnGetDirtySize(pCache->pBackendData);
+    } while (0);
+
+    if (RT_UNLIKELY(fLockRead))
+    {
+        rc2 = vdThreadFinishRead(pDisk);
+        AssertRC(rc2);
+    }
+
+    LogFlowFunc(("returns %llu\n", cbDirty));
+    return cbDirty;
+}
+
+/**
+ * Sets the amount of dirty data a cache opened in write-back mode may hold.
+ * VDWrite() writes the oldest data back once the limit is exceeded, users of
+ * the asynchronous interface have to call VDCacheDestage() themselves.
+ *
+ * @return  VBox status code.
+ * @return  VERR_VD_NOT_OPENED if no cache is opened in HDD container.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   cbDirtyMax      Amount of dirty data in bytes, 0 for no limit.
+ */
+VBOXDDU_DECL(int) VDCacheSetDirtyLimit(PVDISK pDisk, uint64_t cbDirtyMax)
+{
+    int rc = VINF_SUCCESS;
+    int rc2;
+    bool fLockWrite = false;
+
+    LogFlowFunc(("pDisk=%#p cbDirtyMax=%llu\n", pDisk, cbDirtyMax));
+
+    do
+    {
+        /* sanity check */
+        AssertPtrBreakStmt(pDisk, rc = VERR_INVALID_PARAMETER);
+        AssertMsg(pDisk->u32Signature == VDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
+
+        rc2 = vdThreadStartWrite(pDisk);
+        AssertRC(rc2);
+        fLockWrite = true;
+
+        AssertPtrBreakStmt(pDisk->pCache, rc = VERR_VD_NOT_OPENED);
+        pDisk->pCache->cbDirtyMax = cbDirtyMax;
+    } while (0);
+
+    if (RT_LIKELY(fLockWrite))
+    {
+        rc2 = vdThreadFinishWrite(pDisk);
+        AssertRC(rc2);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
 VBOXDDU_DECL(int) VDFilterRemove(PVDISK pDisk, uint32_t fFlags)
 {
     int rc = VINF_SUCCESS;
@@ -8486,6 +9407,11 @@ VBOXDDU_DECL(int) VDCloseAll(PVDISK pDisk)
         PVDCACHE pCache = pDisk->pCache;
         if (pCache)
         {
+            /* Dirty data which can't be written back stays in the cache for the next open. */
+            if (pDisk->pLast)
+                rc = vdCacheDestage(pDisk, UINT64_MAX);
+
+            pDisk->pCache = NULL;
             rc2 = pCache->Backend->pfnClose(pCache->pBackendData, false);
             if (RT_FAILURE(rc2) && RT_SUCCESS(rc))
                 rc = rc2;
@@ -8694,6 +9620,7 @@ VBOXDDU_DECL(int) VDWrite(PVDISK pDisk, uint64_t uOffset, const void *pvBuf,
         PVDIMAGE pImage = pDisk->pLast;
         AssertPtrBreakStmt(pImage, rc = VERR_VD_NOT_OPENED);
 
+        ASMAtomicIncU64(&pDisk->uWriteGen);
         vdSetModifiedFlag(pDisk);
         rc = vdWriteHelper(pDisk, pImage, uOffset, pvBuf, cbWrite,
                            VDIOCTX_FLAGS_READ_UPDATE_CACHE);
@@ -8711,6 +9638,10 @@ VBOXDDU_DECL(int) VDWrite(PVDISK pDisk, uint64_t uOffset, const void *pvBuf,
         if (RT_UNLIKELY(pDisk->pImageRelay))
             rc = vdWriteHelper(pDisk, pDisk->pImageRelay, uOffset,
                                pvBuf, cbWrite, VDIOCTX_FLAGS_DEFAULT);
+        if (RT_FAILURE(rc))
+            break;
+
+        rc = vdCacheDestageOverLimit(pDisk);
     } while (0);
 
     if (RT_UNLIKELY(fLockWrite))
@@ -8750,22 +9681,7 @@ VBOXDDU_DECL(int) VDFlush(PVDISK pDisk)
         PVDIMAGE pImage = pDisk->pLast;
         AssertPtrBreakStmt(pImage, rc = VERR_VD_NOT_OPENED);
 
-        VDIOCTX IoCtx;
-        RTSEMEVENT hEventComplete = NIL_RTSEMEVENT;
-
-        rc = RTSemEventCreate(&hEventComplete);
-        if (RT_FAILURE(rc))
-            break;
-
-        vdIoCtxInit(&IoCtx, pDisk, VDIOCTXTXDIR_FLUSH, 0, 0, pImage, NULL,
-                    NULL, vdFlushHelperAsync, VDIOCTX_FLAGS_SYNC | VDIOCTX_FLAGS_DONT_FREE);
-
-        IoCtx.Type.Root.pfnComplete = vdIoCtxSyncComplete;
-        IoCtx.Type.Root.pvUser1     = pDisk;
-        IoCtx.Type.Root.pvUser2     = hEventComplete;
-        rc = vdIoCtxProcessSync(&IoCtx, hEventComplete);
-
-        RTSemEventDestroy(hEventComplete);
+        rc = vdFlushSync(pDisk, pImage);
     } while (0);
 
     if (RT_UNLIKELY(fLockWrite))
@@ -10210,6 +11126,7 @@ VBOXDDU_DECL(int) VDDiscardRanges(PVDISK pDisk, PCRTRANGE paRanges, unsigned cRa
         if (RT_FAILURE(rc))
             break;
 
+        ASMAtomicIncU64(&pDisk->uWriteGen);
         vdIoCtxDiscardInit(&IoCtx, pDisk, paRanges, cRanges,
                            vdIoCtxSyncComplete, pDisk, hEventComplete, NULL,
                            vdDiscardHelperAsync, VDIOCTX_FLAGS_SYNC | VDIOCTX_FLAGS_DONT_FREE);
@@ -10339,6 +11256,7 @@ VBOXDDU_DECL(int) VDAsyncWrite(PVDISK pDisk, uint64_t uOffset, size_t cbWrite,
                            rc = VERR_INVALID_PARAMETER);
         AssertPtrBreakStmt(pDisk->pLast, rc = VERR_VD_NOT_OPENED);
 
+        ASMAtomicIncU64(&pDisk->uWriteGen);
         pIoCtx = vdIoCtxRootAlloc(pDisk, VDIOCTXTXDIR_WRITE, uOffset,
                                   cbWrite, pDisk->pLast, pcSgBuf,
                                   pfnComplete, pvUser1, pvUser2,
@@ -10451,6 +11369,7 @@ VBOXDDU_DECL(int) VDAsyncDiscardRanges(PVDISK pDisk, PCRTRANGE paRanges, unsigne
 
         AssertPtrBreakStmt(pDisk->pLast, rc = VERR_VD_NOT_OPENED);
 
+        ASMAtomicIncU64(&pDisk->uWriteGen);
         pIoCtx = vdIoCtxDiscardAlloc(pDisk, paRanges, cRanges,
                                      pfnComplete, pvUser1, pvUser2, NULL,
                                      vdDiscardHelperAsync,
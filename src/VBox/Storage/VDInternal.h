@@ -122,6 +122,15 @@ typedef struct VDCACHE
     PVDINTERFACE        pVDIfsCache;
     /** I/O related things. */
     VDIO                VDIo;
+
+    /** Flag whether data was written to the image chain past a write-back cache
+     * since the last flush, so the next flush has to include the image. */
+    volatile bool       fImageFlushNeeded;
+    /** Amount of dirty data a write-back cache may hold before synchronous writes
+     * write the oldest data back, 0 if there is no limit. */
+    uint64_t            cbDirtyMax;
+    /** State of the write back of dirty data in progress, NULL if none. */
+    struct VDCACHEDESTAGE *pDestage;
 } VDCACHE, *PVDCACHE;
 
 /**
@@ -203,6 +212,9 @@ struct VDISK
     /** If a merge to one of the parents is running this may be non-NULL
      * to indicate to what image the writes should be additionally relayed. */
     PVDIMAGE               pImageRelay;
+    /** Write generation, incremented for every write or discard request so
+     * a pipelined merge can detect data which changed after it was read. */
+    volatile uint64_t      uWriteGen;
 
     /** Flags representing the modification state. */
     unsigned               uModified;
@@ -220,6 +232,8 @@ struct VDISK
     PVDINTERFACEERROR      pInterfaceError;
     /** Pointer to the optional thread synchronization callbacks. */
     PVDINTERFACETHREADSYNC pInterfaceThreadSync;
+    /** Pointer to the optional I/O tracing callbacks. */
+    PVDINTERFACEIOTRACE    pInterfaceIoTrace;
 
     /** Memory cache for I/O contexts */
     RTMEMCACHE             hMemCacheIoCtx;
@@ -0,0 +1,533 @@
+/* $Id: VDMetaCache.cpp $ */
+/** @file
+ * VD - Metadata table cache shared by the sparse image backends.
+ *
+ * The cache holds fixed size metadata tables (L2 tables for QCOW and QED,
+ * grain table blocks for VMDK) keyed by their offset in the image. Lookups go
+ * through an AVL tree, eviction uses a segmented LRU: newly read tables start
+ * in the probationary segment and are only moved to the protected segment when
+ * they are accessed again after another table was accessed in between.
+ * A sequential scan over the disk touches every table many times in a row but
+ * never comes back, so it only cycles through the probationary segment and
+ * doesn't throw out the working set of a random access workload.
+ *
+ * The memory budget starts at the configured size and is doubled up to a limit
+ * when capacity misses make up a large part of the lookups.
+ */
+
+/*
+ * Copyright (C) 2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define LOG_GROUP LOG_GROUP_VD
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <VBox/vd-ifs.h>
+
+#include <iprt/assert.h>
+#include <iprt/mem.h>
+#include <iprt/param.h>
+
+#include "VDMetaCache.h"
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+
+/** Number of lookups after which the hit rate is evaluated for growing the cache. */
+#define VD_METACACHE_GROW_INTERVAL      1024
+/** Shift for the fraction of capacity misses in an interval to grow the cache (1/8). */
+#define VD_METACACHE_GROW_MISS_SHIFT    3
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+
+/**
+ * Metadata cache instance.
+ */
+typedef struct VDMETACACHE
+{
+    /** Size of an entry structure including the backend specific part. */
+    size_t                  cbEntry;
+    /** Size of the table data of one entry. */
+    size_t                  cbData;
+    /** Flag whether the table data is allocated from the page heap. */
+    bool                    fPageAlloc;
+    /** Memory occupied by the cached tables. */
+    size_t                  cbUsed;
+    /** Memory occupied by tables in the protected segment. */
+    size_t                  cbProtected;
+    /** The current memory budget. */
+    size_t                  cbMax;
+    /** The limit the memory budget can grow to. */
+    size_t                  cbLimit;
+    /** AVL tree of all cached entries. */
+    AVLU64TREE              TreeEntries;
+    /** LRU list of the probationary segment, most recently used first. */
+    RTLISTANCHOR            ListProbation;
+    /** LRU list of the protected segment, most recently used first. */
+    RTLISTANCHOR            ListProtected;
+    /** The entry accessed last, hits on it don't count as reuse. */
+    PVDMETACACHEENTRY       pEntryLast;
+    /** Index of the table inserted last for detecting sequential access. */
+    uint64_t                idxTblLast;
+    /** Number of lookups in the current growth interval. */
+    uint32_t                cLookupsInterval;
+    /** Number of capacity misses in the current growth interval. */
+    uint32_t                cMissesInterval;
+    /** The statistics. */
+    VDMETACACHESTATS        Stats;
+} VDMETACACHE;
+
+
+/*********************************************************************************************************************************
+*   Internal Functions                                                                                                           *
+*********************************************************************************************************************************/
+
+/**
+ * Frees the given entry and its table data.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ * @param   pEntry    The entry to free, must be unlinked from the cache.
+ */
+static void vdMetaCacheEntryDestroy(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry)
+{
+    Assert(!pEntry->fCached);
+
+    if (pCache->fPageAlloc)
+        RTMemPageFree(pEntry->pvData, pCache->cbData);
+    else
+        RTMemFree(pEntry->pvData);
+    RTMemFree(pEntry);
+
+    pCache->cbUsed -= pCache->cbData;
+}
+
+/**
+ * Unlinks the given entry from the tree and the LRU lists.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ * @param   pEntry    The entry to unlink.
+ */
+static void vdMetaCacheEntryUnlink(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry)
+{
+    Assert(pEntry->fCached);
+
+    PAVLU64NODECORE pCore = RTAvlU64Remove(&pCache->TreeEntries, pEntry->Core.Key);
+    Assert(pCore == &pEntry->Core); RT_NOREF(pCore);
+    RTListNodeRemove(&pEntry->NodeLru);
+    if (pEntry->fProtected)
+        pCache->cbProtected -= pCache->cbData;
+
+    pEntry->fCached    = false;
+    pEntry->fProtected = false;
+    if (pCache->pEntryLast == pEntry)
+        pCache->pEntryLast = NULL;
+}
+
+/**
+ * Returns the least recently used entry which is not referenced, preferring
+ * the probationary segment.
+ *
+ * @returns Pointer to the entry or NULL if all entries are in use.
+ * @param   pCache    The cache instance.
+ */
+static PVDMETACACHEENTRY vdMetaCacheEvictCandidateGet(PVDMETACACHE pCache)
+{
+    PVDMETACACHEENTRY pEntry;
+    RTListForEachReverse(&pCache->ListProbation, pEntry, VDMETACACHEENTRY, NodeLru)
+    {
+        if (!pEntry->cRefs)
+            return pEntry;
+    }
+
+    RTListForEachReverse(&pCache->ListProtected, pEntry, VDMETACACHEENTRY, NodeLru)
+    {
+        if (!pEntry->cRefs)
+            return pEntry;
+    }
+
+    return NULL;
+}
+
+/**
+ * Moves the least recently used entries of the protected segment to the
+ * probationary segment until it fits into its share of the budget again.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ */
+static void vdMetaCacheProtectedTrim(PVDMETACACHE pCache)
+{
+    /* The protected segment gets 3/4 of the budget. */
+    size_t cbProtectedMax = pCache->cbMax - pCache->cbMax / 4;
+
+    while (   pCache->cbProtected > cbProtectedMax
+           && !RTListIsEmpty(&pCache->ListProtected))
+    {
+        PVDMETACACHEENTRY pEntry = RTListGetLast(&pCache->ListProtected, VDMETACACHEENTRY, NodeLru);
+        RTListNodeRemove(&pEntry->NodeLru);
+        RTListPrepend(&pCache->ListProbation, &pEntry->NodeLru);
+        pEntry->fProtected = false;
+        pCache->cbProtected -= pCache->cbData;
+    }
+}
+
+/**
+ * Evicts unreferenced entries until the cache fits into its budget.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ */
+static void vdMetaCacheShrink(PVDMETACACHE pCache)
+{
+    while (pCache->cbUsed > pCache->cbMax)
+    {
+        PVDMETACACHEENTRY pEntry = vdMetaCacheEvictCandidateGet(pCache);
+        if (!pEntry)
+            break;
+
+        vdMetaCacheEntryUnlink(pCache, pEntry);
+        vdMetaCacheEntryDestroy(pCache, pEntry);
+        pCache->Stats.cEvictions++;
+    }
+
+    vdMetaCacheProtectedTrim(pCache);
+}
+
+/**
+ * Accounts a lookup and grows the memory budget if too many lookups miss
+ * because the cache is too small.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ * @param   fCapacityMiss Flag whether the lookup missed a table which would
+ *                      have been cached with a bigger budget.
+ */
+static void vdMetaCacheLookupAccount(PVDMETACACHE pCache, bool fCapacityMiss)
+{
+    pCache->cLookupsInterval++;
+    if (fCapacityMiss)
+        pCache->cMissesInterval++;
+
+    if (pCache->cLookupsInterval >= VD_METACACHE_GROW_INTERVAL)
+    {
+        if (   pCache->cMissesInterval > (pCache->cLookupsInterval >> VD_METACACHE_GROW_MISS_SHIFT)
+            && pCache->cbMax < pCache->cbLimit)
+        {
+            pCache->cbMax = RT_MIN(pCache->cbMax * 2, pCache->cbLimit);
+            pCache->Stats.cGrows++;
+            Log(("vdMetaCache: Growing cache %#p to %zu bytes (%u of %u lookups missed)\n",
+                 pCache, pCache->cbMax, pCache->cMissesInterval, pCache->cLookupsInterval));
+        }
+
+        pCache->cLookupsInterval = 0;
+        pCache->cMissesInterval  = 0;
+    }
+}
+
+
+/**
+ * Creates a new metadata cache.
+ *
+ * The memory budget is read from the image config interface.
+ *
+ * @returns VBox status code.
+ * @param   ppCache     Where to store the cache instance on success.
+ * @param   pVDIfsImage The image interface list to query the configuration from, optional.
+ * @param   cbEntry     Size of an entry structure, at least sizeof(VDMETACACHEENTRY).
+ * @param   cbData      Size of the table data of one entry.
+ * @param   cbDefault   Default memory budget if nothing is configured.
+ * @param   cbLimit     Upper limit for the memory budget, usually the size of all
+ *                      tables of the image. The configured values are clipped to this.
+ */
+DECLHIDDEN(int) vdMetaCacheCreate(PVDMETACACHE *ppCache, PVDINTERFACE pVDIfsImage, size_t cbEntry,
+                                  size_t cbData, size_t cbDefault, size_t cbLimit)
+{
+    AssertPtrReturn(ppCache, VERR_INVALID_POINTER);
+    AssertReturn(cbEntry >= sizeof(VDMETACACHEENTRY), VERR_INVALID_PARAMETER);
+    AssertReturn(cbData, VERR_INVALID_PARAMETER);
+
+    uint64_t cbMax    = cbDefault;
+    uint64_t cbMaxCfg = RT_MAX(cbDefault, VD_METACACHE_SIZE_MAX_DEFAULT);
+    PVDINTERFACECONFIG pImgCfg = VDIfConfigGet(pVDIfsImage);
+    if (pImgCfg)
+    {
+        int rc = VDCFGQueryU64Def(pImgCfg, VD_METACACHE_CFGKEY_SIZE, &cbMax, cbDefault);
+        if (RT_SUCCESS(rc))
+            rc = VDCFGQueryU64Def(pImgCfg, VD_METACACHE_CFGKEY_SIZE_MAX, &cbMaxCfg, RT_MAX(cbMax, cbMaxCfg));
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    PVDMETACACHE pCache = (PVDMETACACHE)RTMemAllocZ(sizeof(VDMETACACHE));
+    if (RT_UNLIKELY(!pCache))
+        return VERR_NO_MEMORY;
+
+    /* Always allow at least a few tables so allocations in flight don't starve lookups. */
+    size_t cbMin = 4 * cbData;
+
+    cbLimit = (size_t)RT_MIN(cbMaxCfg, (uint64_t)cbLimit);
+    cbLimit = RT_MAX(cbLimit, cbMin);
+
+    pCache->cbEntry     = cbEntry;
+    pCache->cbData      = cbData;
+    pCache->fPageAlloc  = cbData >= PAGE_SIZE;
+    pCache->cbLimit     = cbLimit;
+    pCache->cbMax       = RT_MAX((size_t)RT_MIN(cbMax, (uint64_t)cbLimit), cbMin);
+    pCache->TreeEntries = NULL;
+    pCache->idxTblLast  = UINT64_MAX - 1;
+    RTListInit(&pCache->ListProbation);
+    RTListInit(&pCache->ListProtected);
+
+    *ppCache = pCache;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Destroys a metadata cache, all entries must be released.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance to destroy.
+ */
+DECLHIDDEN(void) vdMetaCacheDestroy(PVDMETACACHE pCache)
+{
+    if (!pCache)
+        return;
+
+    Log(("vdMetaCache: Destroying cache %#p: %llu hits, %llu misses (%llu sequential), %llu evictions, grown %u times to %zu bytes\n",
+         pCache, pCache->Stats.cHits, pCache->Stats.cMisses, pCache->Stats.cMissesSeq,
+         pCache->Stats.cEvictions, pCache->Stats.cGrows, pCache->cbMax));
+
+    vdMetaCacheInvalidate(pCache);
+    Assert(!pCache->cbUsed);
+    RTMemFree(pCache);
+}
+
+/**
+ * Changes the memory budget of the cache, evicting entries if required.
+ *
+ * @returns VBox status code.
+ * @param   pCache    The cache instance.
+ * @param   cbMax     The new memory budget, clipped to the limit given during creation.
+ */
+DECLHIDDEN(int) vdMetaCacheResize(PVDMETACACHE pCache, size_t cbMax)
+{
+    AssertPtrReturn(pCache, VERR_INVALID_POINTER);
+
+    pCache->cbMax = RT_MIN(RT_MAX(cbMax, 4 * pCache->cbData), pCache->cbLimit);
+    vdMetaCacheShrink(pCache);
+    return VINF_SUCCESS;
+}
+
+/**
+ * Returns the statistics of the cache.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ * @param   pStats    Where to store the statistics.
+ */
+DECLHIDDEN(void) vdMetaCacheQueryStats(PVDMETACACHE pCache, PVDMETACACHESTATS pStats)
+{
+    *pStats        = pCache->Stats;
+    pStats->cbUsed = pCache->cbUsed;
+    pStats->cbMax  = pCache->cbMax;
+}
+
+/**
+ * Returns the table at the given offset and retains a reference or NULL if it
+ * is not cached.
+ *
+ * @returns Pointer to the cache entry or NULL.
+ * @param   pCache    The cache instance.
+ * @param   offTbl    Key of the table, usually its offset in the image.
+ */
+DECLHIDDEN(PVDMETACACHEENTRY) vdMetaCacheRetain(PVDMETACACHE pCache, uint64_t offTbl)
+{
+    PVDMETACACHEENTRY pEntry = (PVDMETACACHEENTRY)RTAvlU64Get(&pCache->TreeEntries, offTbl);
+    if (pEntry)
+    {
+        if (pEntry->fProtected)
+        {
+            RTListNodeRemove(&pEntry->NodeLru);
+            RTListPrepend(&pCache->ListProtected, &pEntry->NodeLru);
+        }
+        else if (pEntry != pCache->pEntryLast)
+        {
+            /* Reused after something else was accessed, promote to the protected segment. */
+            RTListNodeRemove(&pEntry->NodeLru);
+            RTListPrepend(&pCache->ListProtected, &pEntry->NodeLru);
+            pEntry->fProtected = true;
+            pCache->cbProtected += pCache->cbData;
+            vdMetaCacheProtectedTrim(pCache);
+        }
+
+        pEntry->cRefs++;
+        pCache->pEntryLast = pEntry;
+        pCache->Stats.cHits++;
+        vdMetaCacheLookupAccount(pCache, false /*fCapacityMiss*/);
+    }
+    else
+    {
+        pCache->Stats.cMisses++;
+        /* Only misses which require an eviction to load the table could be avoided by a bigger budget. */
+        vdMetaCacheLookupAccount(pCache, pCache->cbUsed + pCache->cbData > pCache->cbMax);
+    }
+
+    return pEntry;
+}
+
+/**
+ * Releases a reference of the given cache entry.
+ *
+ * @returns nothing.
+ * @param   pEntry    The cache entry.
+ */
+DECLHIDDEN(void) vdMetaCacheEntryRelease(PVDMETACACHEENTRY pEntry)
+{
+    Assert(pEntry->cRefs > 0);
+    pEntry->cRefs--;
+}
+
+/**
+ * Allocates a new entry, evicting the least recently used unreferenced entry
+ * if the budget is exhausted.
+ *
+ * @returns Pointer to the entry with one reference or NULL if out of memory.
+ * @param   pCache    The cache instance.
+ */
+DECLHIDDEN(PVDMETACACHEENTRY) vdMetaCacheEntryAlloc(PVDMETACACHE pCache)
+{
+    PVDMETACACHEENTRY pEntry = NULL;
+
+    if (pCache->cbUsed + pCache->cbData > pCache->cbMax)
+    {
+        pEntry = vdMetaCacheEvictCandidateGet(pCache);
+        if (pEntry)
+        {
+            vdMetaCacheEntryUnlink(pCache, pEntry);
+            pEntry->Core.Key = 0;
+            pEntry->cRefs    = 1;
+            pCache->Stats.cEvictions++;
+            return pEntry;
+        }
+        /* Everything is in use, exceed the budget for now, it is trimmed when entries get released. */
+    }
+
+    pEntry = (PVDMETACACHEENTRY)RTMemAllocZ(pCache->cbEntry);
+    if (RT_LIKELY(pEntry))
+    {
+        if (pCache->fPageAlloc)
+            pEntry->pvData = RTMemPageAllocZ(pCache->cbData);
+        else
+            pEntry->pvData = RTMemAllocZ(pCache->cbData);
+        if (RT_LIKELY(pEntry->pvData))
+        {
+            pEntry->cRefs   = 1;
+            pCache->cbUsed += pCache->cbData;
+        }
+        else
+        {
+            RTMemFree(pEntry);
+            pEntry = NULL;
+        }
+    }
+
+    return pEntry;
+}
+
+/**
+ * Frees an entry which was never inserted into the cache.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ * @param   pEntry    The entry to free.
+ */
+DECLHIDDEN(void) vdMetaCacheEntryFree(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry)
+{
+    Assert(!pEntry->cRefs);
+    vdMetaCacheEntryDestroy(pCache, pEntry);
+}
+
+/**
+ * Inserts an entry holding a freshly read table into the cache.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ * @param   pEntry    The entry to insert.
+ * @param   offTbl    Key of the table, usually its offset in the image.
+ * @param   idxTbl    Logical index of the table (L1 or grain directory index),
+ *                    used to detect sequential scans.
+ */
+DECLHIDDEN(void) vdMetaCacheEntryInsert(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry,
+                                        uint64_t offTbl, uint64_t idxTbl)
+{
+    Assert(!pEntry->fCached);
+
+    pEntry->Core.Key   = offTbl;
+    pEntry->fCached    = true;
+    pEntry->fProtected = false;
+    bool fInserted = RTAvlU64Insert(&pCache->TreeEntries, &pEntry->Core);
+    Assert(fInserted); RT_NOREF(fInserted);
+
+    if (idxTbl == pCache->idxTblLast + 1)
+    {
+        /* Part of a sequential scan, make it the first to go. */
+        RTListAppend(&pCache->ListProbation, &pEntry->NodeLru);
+        pCache->Stats.cMissesSeq++;
+    }
+    else
+        RTListPrepend(&pCache->ListProbation, &pEntry->NodeLru);
+
+    pCache->idxTblLast = idxTbl;
+    pCache->pEntryLast = pEntry;
+
+    /* Give back memory from allocations which exceeded the budget. */
+    if (pCache->cbUsed > pCache->cbMax)
+        vdMetaCacheShrink(pCache);
+}
+
+/**
+ * Drops all unreferenced entries from the cache.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache instance.
+ */
+DECLHIDDEN(void) vdMetaCacheInvalidate(PVDMETACACHE pCache)
+{
+    PVDMETACACHEENTRY pEntry, pEntryNext;
+    RTListForEachSafe(&pCache->ListProbation, pEntry, pEntryNext, VDMETACACHEENTRY, NodeLru)
+    {
+        if (!pEntry->cRefs)
+        {
+            vdMetaCacheEntryUnlink(pCache, pEntry);
+            vdMetaCacheEntryDestroy(pCache, pEntry);
+        }
+    }
+
+    RTListForEachSafe(&pCache->ListProtected, pEntry, pEntryNext, VDMETACACHEENTRY, NodeLru)
+    {
+        if (!pEntry->cRefs)
+        {
+            vdMetaCacheEntryUnlink(pCache, pEntry);
+            vdMetaCacheEntryDestroy(pCache, pEntry);
+        }
+    }
+}
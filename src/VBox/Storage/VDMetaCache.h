@@ -0,0 +1,117 @@
+/* $Id: VDMetaCache.h $ */
+/** @file
+ * VD - Metadata table cache shared by the sparse image backends (internal).
+ */
+
+/*
+ * Copyright (C) 2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef VBOX_INCLUDED_SRC_Storage_VDMetaCache_h
+#define VBOX_INCLUDED_SRC_Storage_VDMetaCache_h
+#ifndef RT_WITHOUT_PRAGMA_ONCE
+# pragma once
+#endif
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/vd.h>
+#include <iprt/avl.h>
+#include <iprt/list.h>
+
+RT_C_DECLS_BEGIN
+
+
+/*******************************************************************************
+*   Constants And Macros, Structures and Typedefs                              *
+*******************************************************************************/
+
+/** Name of the config key for the initial memory budget of the cache in bytes. */
+#define VD_METACACHE_CFGKEY_SIZE        "MetaCacheSize"
+/** Name of the config key for the memory limit the cache is allowed to grow to in bytes. */
+#define VD_METACACHE_CFGKEY_SIZE_MAX    "MetaCacheSizeMax"
+
+/** Default limit the cache can grow to if the hit rate is bad. */
+#define VD_METACACHE_SIZE_MAX_DEFAULT   (32 * _1M)
+
+/**
+ * Metadata cache entry.
+ *
+ * Backends can embed this as the first member of their own entry structure,
+ * the size of the complete structure is given when creating the cache.
+ */
+typedef struct VDMETACACHEENTRY
+{
+    /** AVL tree node, the key identifies the cached table (usually its offset in the image). */
+    AVLU64NODECORE          Core;
+    /** List node for the LRU lists. */
+    RTLISTNODE              NodeLru;
+    /** Reference counter. */
+    uint32_t                cRefs;
+    /** Flag whether the entry is linked into the cache. */
+    bool                    fCached;
+    /** Flag whether the entry is in the protected LRU segment. */
+    bool                    fProtected;
+    /** Pointer to the cached table data. */
+    void                   *pvData;
+} VDMETACACHEENTRY;
+/** Pointer to a metadata cache entry. */
+typedef VDMETACACHEENTRY *PVDMETACACHEENTRY;
+
+/**
+ * Metadata cache statistics.
+ */
+typedef struct VDMETACACHESTATS
+{
+    /** Number of lookups finding the table in the cache. */
+    uint64_t                cHits;
+    /** Number of lookups requiring a read from the image. */
+    uint64_t                cMisses;
+    /** Number of misses caused by sequential table accesses. */
+    uint64_t                cMissesSeq;
+    /** Number of entries evicted to make room for new tables. */
+    uint64_t                cEvictions;
+    /** Number of times the memory budget was increased. */
+    uint32_t                cGrows;
+    /** Memory currently occupied by the cached tables. */
+    size_t                  cbUsed;
+    /** The current memory budget. */
+    size_t                  cbMax;
+} VDMETACACHESTATS;
+/** Pointer to metadata cache statistics. */
+typedef VDMETACACHESTATS *PVDMETACACHESTATS;
+
+/** Opaque metadata cache instance. */
+typedef struct VDMETACACHE *PVDMETACACHE;
+
+
+/*******************************************************************************
+*   Functions                                                                  *
+*******************************************************************************/
+
+DECLHIDDEN(int)  vdMetaCacheCreate(PVDMETACACHE *ppCache, PVDINTERFACE pVDIfsImage, size_t cbEntry,
+                                   size_t cbData, size_t cbDefault, size_t cbLimit);
+DECLHIDDEN(void) vdMetaCacheDestroy(PVDMETACACHE pCache);
+DECLHIDDEN(int)  vdMetaCacheResize(PVDMETACACHE pCache, size_t cbMax);
+DECLHIDDEN(void) vdMetaCacheQueryStats(PVDMETACACHE pCache, PVDMETACACHESTATS pStats);
+DECLHIDDEN(PVDMETACACHEENTRY) vdMetaCacheRetain(PVDMETACACHE pCache, uint64_t offTbl);
+DECLHIDDEN(void) vdMetaCacheEntryRelease(PVDMETACACHEENTRY pEntry);
+DECLHIDDEN(PVDMETACACHEENTRY) vdMetaCacheEntryAlloc(PVDMETACACHE pCache);
+DECLHIDDEN(void) vdMetaCacheEntryFree(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry);
+DECLHIDDEN(void) vdMetaCacheEntryInsert(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry,
+                                        uint64_t offTbl, uint64_t idxTbl);
+DECLHIDDEN(void) vdMetaCacheInvalidate(PVDMETACACHE pCache);
+
+RT_C_DECLS_END
+
+#endif /* !VBOX_INCLUDED_SRC_Storage_VDMetaCache_h */
@@ -94,6 +94,7 @@ static PCVDIMAGEBACKEND aStaticBackends[] =
     &g_QCowBackend,
     &g_VhdxBackend,
     &g_CueBackend,
+    &g_DdiBackend,
     &g_VBoxIsoMakerBackend,
     &g_RawBackend,
     &g_ISCSIBackend
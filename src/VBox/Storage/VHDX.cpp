@@ -27,9 +27,11 @@
 #include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/alloc.h>
+#include <iprt/list.h>
 #include <iprt/path.h>
 #include <iprt/uuid.h>
 #include <iprt/crc.h>
+#include <iprt/sort.h>
 
 #include "VDBackends.h"
 #include "VDBackendsInline.h"
@@ -128,6 +130,8 @@ typedef VhdxRegionTblHdr *PVhdxRegionTblHdr;
 #define VHDX_REGION_TBL_HDR_ENTRY_COUNT_MAX UINT32_C(2047)
 /** Offset where the region table is stored (192 KB). */
 #define VHDX_REGION_TBL_HDR_OFFSET          UINT64_C(196608)
+/** Offset where the copy of the region table is stored (256 KB). */
+#define VHDX_REGION_TBL2_HDR_OFFSET         UINT64_C(262144)
 /** Maximum size of the region table. */
 #define VHDX_REGION_TBL_SIZE_MAX            _64K
 
@@ -261,6 +265,8 @@ typedef VhdxLogDataSector *PVhdxLogDataSector;
 
 /** Signature of a VHDX log data sector ("data"). */
 #define VHDX_LOG_DATA_SECTOR_SIGNATURE UINT32_C(0x61746164)
+/** Size of a log sector, all log entries and updates are made in units of this size. */
+#define VHDX_LOG_SECTOR_SIZE           _4K
 
 /**
  * VHDX BAT entry.
@@ -280,6 +286,10 @@ typedef VhdxBatEntry *PVhdxBatEntry;
 #define VHDX_BAT_ENTRY_GET_FILE_OFFSET_MB(bat) (((bat) & UINT64_C(0xfffffffffff00000)) >> 20)
 /** Get a byte offset from the BAT entry. */
 #define VHDX_BAT_ENTRY_GET_FILE_OFFSET(bat) (VHDX_BAT_ENTRY_GET_FILE_OFFSET_MB(bat) * (uint64_t)_1M)
+/** Create a BAT entry from the given byte offset (must be 1MB aligned) and state. */
+#define VHDX_BAT_ENTRY_CREATE(off, state) ((((uint64_t)(off) / _1M) << 20) | (state))
+/** Number of BAT entries in one log sector. */
+#define VHDX_BAT_ENTRIES_PER_SECTOR ((uint32_t)(VHDX_LOG_SECTOR_SIZE / sizeof(VhdxBatEntry)))
 
 /** Block not present and the data is undefined. */
 #define VHDX_BAT_ENTRY_PAYLOAD_BLOCK_NOT_PRESENT       (0)
@@ -481,6 +491,27 @@ typedef struct VhdxParentLocatorEntry *PVhdxParentLocatorEntry;
 *   Constants And Macros, Structures and Typedefs                                                                                *
 *********************************************************************************************************************************/
 
+/** Block size of newly created images. */
+#define VHDX_CREATE_BLOCK_SIZE          _1M
+/** Logical sector size of newly created images. */
+#define VHDX_CREATE_LOGICAL_SECTOR_SIZE 512
+/** Physical sector size of newly created images. */
+#define VHDX_CREATE_PHYS_SECTOR_SIZE    512
+/** Offset of the log in newly created images. */
+#define VHDX_CREATE_LOG_OFFSET          _1M
+/** Size of the log in newly created images. */
+#define VHDX_CREATE_LOG_SIZE            _1M
+/** Offset of the metadata region in newly created images. */
+#define VHDX_CREATE_METADATA_OFFSET     (2 * _1M)
+/** Size of the metadata region in newly created images. */
+#define VHDX_CREATE_METADATA_SIZE       _1M
+/** Offset of the metadata items relative to the metadata region in newly created images. */
+#define VHDX_CREATE_METADATA_ITEMS_OFF  _64K
+/** Offset of the BAT region in newly created images. */
+#define VHDX_CREATE_BAT_OFFSET          (3 * _1M)
+/** Maximum virtual disk size supported by the format (64TB). */
+#define VHDX_VDISK_SIZE_MAX             (_1T * 64)
+
 typedef enum VHDXMETADATAITEM
 {
     VHDXMETADATAITEM_UNKNOWN = 0,
@@ -550,10 +581,138 @@ typedef struct VHDXIMAGE
     PVhdxBatEntry       paBat;
     /** Chunk ratio. */
     uint32_t            uChunkRatio;
+    /** Number of entries in the BAT (payload and sector bitmap entries). */
+    uint32_t            cBatEntries;
+    /** Start offset of the BAT region. */
+    uint64_t            offBat;
+    /** Size of the BAT region. */
+    uint32_t            cbBatRegion;
+    /** Start offset of the metadata region. */
+    uint64_t            offMetadata;
+    /** Size of the metadata region. */
+    uint32_t            cbMetadataRegion;
+    /** File offset of the virtual disk size metadata item. */
+    uint64_t            offVDiskSize;
+    /** Flag whether all payload blocks must stay allocated (fixed image). */
+    bool                fLeaveBlocksAllocated;
+
+    /** The current header in host endianess. */
+    VhdxHeader          Hdr;
+    /** File offset of the current header. */
+    uint64_t            offHdrCur;
+    /** Flag whether the log is in use, i.e. the log UUID in the header is set. */
+    bool                fLogActive;
+    /** Sequence number of the next log entry. */
+    uint64_t            u64LogSeqNext;
+    /** File offset where the next payload block gets allocated. */
+    uint64_t            offBlockNext;
+    /** File size known to be stable on the underlying medium. */
+    uint64_t            cbFileFlushed;
+    /** Offset of the next log entry relative to the start of the log. */
+    uint32_t            offLogHead;
+    /** The block allocation currently owning the log and the BAT, NULL if none. */
+    struct VHDXBLOCKALLOC *pBlockAllocActive;
+    /** Block allocations waiting for the log in the order they arrived. */
+    RTLISTANCHOR        ListBlockAllocWaiting;
+    /** Flag whether waiting block allocations are resumed already. */
+    bool                fBlockAllocResuming;
+
     /** The static region list. */
     VDREGIONLIST        RegionList;
 } VHDXIMAGE, *PVHDXIMAGE;
 
+/**
+ * State of the async block allocation.
+ */
+typedef enum VHDXBLOCKALLOCSTATE
+{
+    /** Invalid. */
+    VHDXBLOCKALLOCSTATE_INVALID = 0,
+    /** Write the user data into the new block. */
+    VHDXBLOCKALLOCSTATE_USER_WRITE,
+    /** Wait until no other block allocation uses the log. */
+    VHDXBLOCKALLOCSTATE_LOG_LOCK,
+    /** Activate the log by writing the log UUID to the header. */
+    VHDXBLOCKALLOCSTATE_HDR_WRITE,
+    /** Flush the header update. */
+    VHDXBLOCKALLOCSTATE_HDR_FLUSH,
+    /** Write the log entry for the BAT update. */
+    VHDXBLOCKALLOCSTATE_LOG_WRITE,
+    /** Flush the log entry. */
+    VHDXBLOCKALLOCSTATE_LOG_FLUSH,
+    /** Write the updated BAT sector in place. */
+    VHDXBLOCKALLOCSTATE_BAT_WRITE,
+    /** Flush the BAT update before the log is reused. */
+    VHDXBLOCKALLOCSTATE_BAT_FLUSH,
+    /** Allocation completed. */
+    VHDXBLOCKALLOCSTATE_COMPLETE,
+    /** 32bit blowup. */
+    VHDXBLOCKALLOCSTATE_32BIT_HACK = 0x7fffffff
+} VHDXBLOCKALLOCSTATE;
+
+/**
+ * Data needed to track async block allocation.
+ */
+typedef struct VHDXBLOCKALLOC
+{
+    /** Node for the list of allocations waiting for the log. */
+    RTLISTNODE          NodeWaiting;
+    /** The I/O context which is halted until the allocation completes. */
+    PVDIOCTX            pIoCtx;
+    /** The next step of the block allocation. */
+    VHDXBLOCKALLOCSTATE enmAllocState;
+    /** BAT index of the block. */
+    uint32_t            idxBat;
+    /** Flag whether the in memory BAT was updated already. */
+    bool                fBatUpdated;
+    /** The BAT entry before the allocation, for rollback. */
+    uint64_t            u64BatEntryOld;
+    /** The new BAT entry. */
+    uint64_t            u64BatEntryNew;
+    /** Start offset of the new block. */
+    uint64_t            offBlockNew;
+    /** Number of bytes to write. */
+    size_t              cbToWrite;
+    /** File size covered by the flush of the log entry. */
+    uint64_t            cbFileFlushing;
+    /** File offset of the BAT sector updated by this allocation. */
+    uint64_t            offBatSector;
+    /** The BAT sector as written to the log and in place, in file endianess. */
+    VhdxBatEntry        aBatSector[VHDX_BAT_ENTRIES_PER_SECTOR];
+} VHDXBLOCKALLOC, *PVHDXBLOCKALLOC;
+
+/**
+ * Information about a log entry collected during log replay.
+ */
+typedef struct VHDXLOGENTRYINFO
+{
+    /** Flag whether a valid entry starts at this log sector. */
+    bool                fValid;
+    /** Sequence number of the entry. */
+    uint64_t            u64SequenceNumber;
+    /** Length of the entry in bytes. */
+    uint32_t            cbEntry;
+    /** Offset of the tail of the sequence relative to the log start. */
+    uint32_t            offTail;
+    /** File size which was stable when the entry was written. */
+    uint64_t            u64FlushedFileOffset;
+    /** File size required by the structures after the entry was written. */
+    uint64_t            u64LastFileOffset;
+} VHDXLOGENTRYINFO, *PVHDXLOGENTRYINFO;
+
+/**
+ * Region of the image file occupied by a structure, used for compaction.
+ */
+typedef struct VHDXFILEEXTENT
+{
+    /** Start offset in the file. */
+    uint64_t            offStart;
+    /** Size of the extent. */
+    uint64_t            cbExtent;
+    /** BAT index of the payload block, UINT32_MAX for structures which can't be moved. */
+    uint32_t            idxBat;
+} VHDXFILEEXTENT, *PVHDXFILEEXTENT;
+
 /**
  * Endianess conversion direction.
  */
@@ -666,9 +825,9 @@ DECLINLINE(void) vhdxConvHeaderEndianess(VHDXECONV enmConv, PVhdxHeader pHdrConv
     pHdrConv->u32Signature      = SET_ENDIAN_U32(pHdr->u32Signature);
     pHdrConv->u32Checksum       = SET_ENDIAN_U32(pHdr->u32Checksum);
     pHdrConv->u64SequenceNumber = SET_ENDIAN_U64(pHdr->u64SequenceNumber);
-    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidFileWrite, &pHdrConv->UuidFileWrite);
-    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidDataWrite, &pHdrConv->UuidDataWrite);
-    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidLog, &pHdrConv->UuidLog);
+    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidFileWrite, &pHdr->UuidFileWrite);
+    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidDataWrite, &pHdr->UuidDataWrite);
+    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidLog, &pHdr->UuidLog);
     pHdrConv->u16LogVersion     = SET_ENDIAN_U16(pHdr->u16LogVersion);
     pHdrConv->u16Version        = SET_ENDIAN_U16(pHdr->u16Version);
     pHdrConv->u32LogLength      = SET_ENDIAN_U32(pHdr->u32LogLength);
@@ -713,8 +872,6 @@ DECLINLINE(void) vhdxConvRegionTblEntryEndianess(VHDXECONV enmConv, PVhdxRegionT
     pRegTblEntConv->u32Flags      = SET_ENDIAN_U32(pRegTblEnt->u32Flags);
 }
 
-#if 0 /* unused */
-
 /**
  * Converts a VHDX log entry header between file and host endianness.
  *
@@ -737,6 +894,7 @@ DECLINLINE(void) vhdxConvLogEntryHdrEndianess(VHDXECONV enmConv, PVhdxLogEntryHd
     pLogEntryHdrConv->u32Reserved          = SET_ENDIAN_U32(pLogEntryHdr->u32Reserved);
     vhdxConvUuidEndianess(enmConv, &pLogEntryHdrConv->UuidLog, &pLogEntryHdr->UuidLog);
     pLogEntryHdrConv->u64FlushedFileOffset = SET_ENDIAN_U64(pLogEntryHdr->u64FlushedFileOffset);
+    pLogEntryHdrConv->u64LastFileOffset    = SET_ENDIAN_U64(pLogEntryHdr->u64LastFileOffset);
 }
 
 /**
@@ -799,8 +957,6 @@ DECLINLINE(void) vhdxConvLogDataSectorEndianess(VHDXECONV enmConv, PVhdxLogDataS
     pLogDataSectorConv->u32SequenceLow   = SET_ENDIAN_U32(pLogDataSector->u32SequenceLow);
 }
 
-#endif /* unused */
-
 /**
  * Converts a BAT between file and host endianess.
  *
@@ -892,8 +1048,6 @@ DECLINLINE(void) vhdxConvVDiskSizeEndianess(VHDXECONV enmConv, PVhdxVDiskSize pV
     pVDiskSizeConv->u64VDiskSize  = SET_ENDIAN_U64(pVDiskSize->u64VDiskSize);
 }
 
-#if 0 /* unused */
-
 /**
  * Converts a VHDX page 83 data item between file and host endianness.
  *
@@ -909,7 +1063,6 @@ DECLINLINE(void) vhdxConvPage83DataEndianess(VHDXECONV enmConv, PVhdxPage83Data
 {
     vhdxConvUuidEndianess(enmConv, &pPage83DataConv->UuidPage83Data, &pPage83Data->UuidPage83Data);
 }
-#endif /* unused */
 
 /**
  * Converts a VHDX logical sector size item between file and host endianness.
@@ -927,8 +1080,6 @@ DECLINLINE(void) vhdxConvVDiskLogSectSizeEndianess(VHDXECONV enmConv, PVhdxVDisk
     pVDiskLogSectSizeConv->u32LogicalSectorSize = SET_ENDIAN_U32(pVDiskLogSectSize->u32LogicalSectorSize);
 }
 
-#if 0 /* unused */
-
 /**
  * Converts a VHDX physical sector size item between file and host endianness.
  *
@@ -945,6 +1096,7 @@ DECLINLINE(void) vhdxConvVDiskPhysSectSizeEndianess(VHDXECONV enmConv, PVhdxVDis
     pVDiskPhysSectSizeConv->u64PhysicalSectorSize = SET_ENDIAN_U64(pVDiskPhysSectSize->u64PhysicalSectorSize);
 }
 
+#if 0 /* unused */
 
 /**
  * Converts a VHDX parent locator header item between file and host endianness.
@@ -986,6 +1138,529 @@ DECLINLINE(void) vhdxConvParentLocatorEntryEndianess(VHDXECONV enmConv, PVhdxPar
 
 #endif /* unused */
 
+/**
+ * Writes the in memory header with an incremented sequence number to the
+ * non current header location, making it the current header.
+ *
+ * @returns VBox status code.
+ * @param   pImage        Image instance data.
+ * @param   pIoCtx        The I/O context, NULL for synchronous I/O.
+ * @param   pfnComplete   Callback called when the write completes.
+ * @param   pvUser        Opaque user data to pass in the completion callback.
+ */
+static int vhdxHdrWrite(PVHDXIMAGE pImage, PVDIOCTX pIoCtx,
+                        PFNVDXFERCOMPLETED pfnComplete, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVhdxHeader pHdr = (PVhdxHeader)RTMemTmpAllocZ(sizeof(VhdxHeader));
+
+    if (pHdr)
+    {
+        pImage->Hdr.u64SequenceNumber++;
+        pImage->offHdrCur =   pImage->offHdrCur == VHDX_HEADER1_OFFSET
+                            ? VHDX_HEADER2_OFFSET
+                            : VHDX_HEADER1_OFFSET;
+
+        memcpy(pHdr, &pImage->Hdr, sizeof(VhdxHeader));
+        pHdr->u32Checksum = 0;
+        vhdxConvHeaderEndianess(VHDXECONV_H2F, pHdr, pHdr);
+        pHdr->u32Checksum = RT_H2LE_U32(RTCrc32C(pHdr, sizeof(VhdxHeader)));
+
+        rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage, pImage->offHdrCur,
+                                    pHdr, sizeof(VhdxHeader), pIoCtx, pfnComplete, pvUser);
+        RTMemTmpFree(pHdr);
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    return rc;
+}
+
+/**
+ * Checks whether a valid log entry starts at the given position and returns
+ * information about it.
+ *
+ * @returns true if the entry is valid, false otherwise.
+ * @param   pImage    Image instance data.
+ * @param   pbEntry   Start of the entry, must be followed by the rest of the
+ *                    log (wrapped around).
+ * @param   cbLog     Size of the log.
+ * @param   pInfo     Where to store the information about the entry.
+ */
+static bool vhdxLogEntryCheck(PVHDXIMAGE pImage, uint8_t *pbEntry, uint32_t cbLog,
+                              PVHDXLOGENTRYINFO pInfo)
+{
+    PVhdxLogEntryHdr pEntryHdr = (PVhdxLogEntryHdr)pbEntry;
+    VhdxLogEntryHdr EntryHdr;
+
+    memcpy(&EntryHdr, pbEntry, sizeof(EntryHdr));
+    vhdxConvLogEntryHdrEndianess(VHDXECONV_F2H, &EntryHdr, &EntryHdr);
+
+    if (   EntryHdr.u32Signature != VHDX_LOG_ENTRY_HEADER_SIGNATURE
+        || RTUuidCompare(&EntryHdr.UuidLog, &pImage->Hdr.UuidLog)
+        || !EntryHdr.u64SequenceNumber
+        || EntryHdr.u32EntryLength < VHDX_LOG_SECTOR_SIZE
+        || EntryHdr.u32EntryLength % VHDX_LOG_SECTOR_SIZE
+        || EntryHdr.u32EntryLength > cbLog
+        || EntryHdr.u32Tail % VHDX_LOG_SECTOR_SIZE
+        || EntryHdr.u32Tail >= cbLog
+        || EntryHdr.u32DescriptorCount > EntryHdr.u32EntryLength / sizeof(VhdxLogDataDesc))
+        return false;
+
+    /* The descriptors are padded to a full sector, the data sectors follow. */
+    uint32_t cbDescriptors = RT_ALIGN_32(sizeof(VhdxLogEntryHdr) + EntryHdr.u32DescriptorCount * sizeof(VhdxLogDataDesc),
+                                         VHDX_LOG_SECTOR_SIZE);
+    if (cbDescriptors > EntryHdr.u32EntryLength)
+        return false;
+
+    /* The checksum covers the complete entry with the checksum field set to zero. */
+    pEntryHdr->u32Checksum = 0;
+    uint32_t u32ChkSum = RTCrc32C(pbEntry, EntryHdr.u32EntryLength);
+    pEntryHdr->u32Checksum = RT_H2LE_U32(EntryHdr.u32Checksum);
+    if (u32ChkSum != EntryHdr.u32Checksum)
+        return false;
+
+    uint32_t cDataSectors = 0;
+    for (uint32_t i = 0; i < EntryHdr.u32DescriptorCount; i++)
+    {
+        uint8_t *pbDesc = pbEntry + sizeof(VhdxLogEntryHdr) + i * sizeof(VhdxLogDataDesc);
+
+        if (RT_LE2H_U32(*(uint32_t *)pbDesc) == VHDX_LOG_ZERO_DESC_SIGNATURE)
+        {
+            VhdxLogZeroDesc ZeroDesc;
+
+            memcpy(&ZeroDesc, pbDesc, sizeof(ZeroDesc));
+            vhdxConvLogZeroDescEndianess(VHDXECONV_F2H, &ZeroDesc, &ZeroDesc);
+            if (   ZeroDesc.u64SequenceNumber != EntryHdr.u64SequenceNumber
+                || ZeroDesc.u64ZeroLength % VHDX_LOG_SECTOR_SIZE
+                || ZeroDesc.u64FileOffset % VHDX_LOG_SECTOR_SIZE)
+                return false;
+        }
+        else if (RT_LE2H_U32(*(uint32_t *)pbDesc) == VHDX_LOG_DATA_DESC_SIGNATURE)
+        {
+            VhdxLogDataDesc DataDesc;
+            VhdxLogDataSector DataSector;
+
+            memcpy(&DataDesc, pbDesc, sizeof(DataDesc));
+            vhdxConvLogDataDescEndianess(VHDXECONV_F2H, &DataDesc, &DataDesc);
+            if (   DataDesc.u64SequenceNumber != EntryHdr.u64SequenceNumber
+                || DataDesc.u64FileOffset % VHDX_LOG_SECTOR_SIZE
+                || cbDescriptors + (cDataSectors + 1) * VHDX_LOG_SECTOR_SIZE > EntryHdr.u32EntryLength)
+                return false;
+
+            memcpy(&DataSector, pbEntry + cbDescriptors + cDataSectors * VHDX_LOG_SECTOR_SIZE, sizeof(DataSector));
+            vhdxConvLogDataSectorEndianess(VHDXECONV_F2H, &DataSector, &DataSector);
+            if (   DataSector.u32DataSignature != VHDX_LOG_DATA_SECTOR_SIGNATURE
+                || DataSector.u32SequenceHigh != (uint32_t)(EntryHdr.u64SequenceNumber >> 32)
+                || DataSector.u32SequenceLow != (uint32_t)EntryHdr.u64SequenceNumber)
+                return false;
+
+            cDataSectors++;
+        }
+        else
+            return false;
+    }
+
+    if (cbDescriptors + cDataSectors * VHDX_LOG_SECTOR_SIZE != EntryHdr.u32EntryLength)
+        return false;
+
+    pInfo->u64SequenceNumber    = EntryHdr.u64SequenceNumber;
+    pInfo->cbEntry              = EntryHdr.u32EntryLength;
+    pInfo->offTail              = EntryHdr.u32Tail;
+    pInfo->u64FlushedFileOffset = EntryHdr.u64FlushedFileOffset;
+    pInfo->u64LastFileOffset    = EntryHdr.u64LastFileOffset;
+    return true;
+}
+
+/**
+ * Checks whether the entries from the tail of the given head entry form a
+ * complete sequence up to the head.
+ *
+ * @returns true if the sequence is complete, false otherwise.
+ * @param   paEntries   Entry information for every log sector.
+ * @param   cSectors    Number of log sectors.
+ * @param   idxHead     Log sector of the head entry.
+ */
+static bool vhdxLogSequenceIsValid(PVHDXLOGENTRYINFO paEntries, uint32_t cSectors, uint32_t idxHead)
+{
+    uint32_t idxEntry = paEntries[idxHead].offTail / VHDX_LOG_SECTOR_SIZE;
+    uint64_t u64SeqExpected = paEntries[idxEntry].u64SequenceNumber;
+
+    for (uint32_t cEntries = 0; cEntries < cSectors; cEntries++)
+    {
+        if (   !paEntries[idxEntry].fValid
+            || paEntries[idxEntry].u64SequenceNumber != u64SeqExpected)
+            return false;
+        if (idxEntry == idxHead)
+            return true;
+
+        idxEntry = (idxEntry + paEntries[idxEntry].cbEntry / VHDX_LOG_SECTOR_SIZE) % cSectors;
+        u64SeqExpected++;
+    }
+
+    return false;
+}
+
+/**
+ * Applies the descriptors of a validated log entry to the file.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ * @param   pbEntry   Start of the entry.
+ */
+static int vhdxLogEntryApply(PVHDXIMAGE pImage, const uint8_t *pbEntry)
+{
+    VhdxLogEntryHdr EntryHdr;
+    int rc = VINF_SUCCESS;
+
+    memcpy(&EntryHdr, pbEntry, sizeof(EntryHdr));
+    vhdxConvLogEntryHdrEndianess(VHDXECONV_F2H, &EntryHdr, &EntryHdr);
+
+    uint32_t cbDescriptors = RT_ALIGN_32(sizeof(VhdxLogEntryHdr) + EntryHdr.u32DescriptorCount * sizeof(VhdxLogDataDesc),
+                                         VHDX_LOG_SECTOR_SIZE);
+    uint32_t cDataSectors = 0;
+    uint8_t *pbBuf = (uint8_t *)RTMemTmpAllocZ(_64K);
+    if (!pbBuf)
+        return VERR_NO_MEMORY;
+
+    for (uint32_t i = 0; i < EntryHdr.u32DescriptorCount && RT_SUCCESS(rc); i++)
+    {
+        const uint8_t *pbDesc = pbEntry + sizeof(VhdxLogEntryHdr) + i * sizeof(VhdxLogDataDesc);
+
+        if (RT_LE2H_U32(*(const uint32_t *)pbDesc) == VHDX_LOG_ZERO_DESC_SIGNATURE)
+        {
+            VhdxLogZeroDesc ZeroDesc;
+
+            memcpy(&ZeroDesc, pbDesc, sizeof(ZeroDesc));
+            vhdxConvLogZeroDescEndianess(VHDXECONV_F2H, &ZeroDesc, &ZeroDesc);
+
+            memset(pbBuf, 0, _64K);
+
+            uint64_t offFile = ZeroDesc.u64FileOffset;
+            uint64_t cbLeft  = ZeroDesc.u64ZeroLength;
+            while (cbLeft && RT_SUCCESS(rc))
+            {
+                size_t cbThisWrite = (size_t)RT_MIN(cbLeft, _64K);
+
+                rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, offFile,
+                                            pbBuf, cbThisWrite);
+                offFile += cbThisWrite;
+                cbLeft  -= cbThisWrite;
+            }
+        }
+        else
+        {
+            const uint8_t *pbDataSector = pbEntry + cbDescriptors + cDataSectors * VHDX_LOG_SECTOR_SIZE;
+            VhdxLogDataDesc DataDesc;
+
+            memcpy(&DataDesc, pbDesc, sizeof(DataDesc));
+            vhdxConvLogDataDescEndianess(VHDXECONV_F2H, &DataDesc, &DataDesc);
+
+            /* Reassemble the sector, the first and last bytes are stored in the descriptor. */
+            uint64_t u64LeadingBytes  = RT_H2LE_U64(DataDesc.u64LeadingBytes);
+            uint32_t u32TrailingBytes = RT_H2LE_U32(DataDesc.u32TrailingBytes);
+            memcpy(pbBuf, &u64LeadingBytes, sizeof(u64LeadingBytes));
+            memcpy(pbBuf + sizeof(u64LeadingBytes), pbDataSector + RT_UOFFSETOF(VhdxLogDataSector, u8Data),
+                   RT_SIZEOFMEMB(VhdxLogDataSector, u8Data));
+            memcpy(pbBuf + VHDX_LOG_SECTOR_SIZE - sizeof(u32TrailingBytes), &u32TrailingBytes, sizeof(u32TrailingBytes));
+
+            rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, DataDesc.u64FileOffset,
+                                        pbBuf, VHDX_LOG_SECTOR_SIZE);
+            cDataSectors++;
+        }
+    }
+
+    RTMemTmpFree(pbBuf);
+    return rc;
+}
+
+/**
+ * Replays a non empty log and marks it as empty afterwards.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ */
+static int vhdxLogReplay(PVHDXIMAGE pImage)
+{
+    uint32_t cbLog = pImage->Hdr.u32LogLength;
+    uint32_t cSectors = cbLog / VHDX_LOG_SECTOR_SIZE;
+    uint8_t *pbLog = NULL;
+    PVHDXLOGENTRYINFO paEntries = NULL;
+    uint64_t cbFile = 0;
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pImage=%#p\n", pImage));
+
+    rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+    if (   RT_SUCCESS(rc)
+        && pImage->Hdr.u64LogOffset + cbLog > cbFile)
+        rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                       "VHDX: Log region of image \'%s\' exceeds the file",
+                       pImage->pszFilename);
+
+    if (RT_SUCCESS(rc))
+    {
+        /*
+         * The log is a ring buffer, keep a copy of it right behind the log so entries
+         * wrapping around the end can be accessed linearly.
+         */
+        pbLog = (uint8_t *)RTMemAlloc(2 * (size_t)cbLog);
+        paEntries = (PVHDXLOGENTRYINFO)RTMemAllocZ(cSectors * sizeof(VHDXLOGENTRYINFO));
+        if (pbLog && paEntries)
+        {
+            rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, pImage->Hdr.u64LogOffset,
+                                       pbLog, cbLog);
+            if (RT_FAILURE(rc))
+                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                               "VHDX: Reading the log of image \'%s\' failed",
+                               pImage->pszFilename);
+        }
+        else
+            rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
+                           "VHDX: Out of memory allocating memory for the log of image \'%s\'",
+                           pImage->pszFilename);
+    }
+
+    if (RT_SUCCESS(rc))
+    {
+        uint32_t idxHead = UINT32_MAX;
+
+        memcpy(pbLog + cbLog, pbLog, cbLog);
+        for (uint32_t i = 0; i < cSectors; i++)
+            paEntries[i].fValid = vhdxLogEntryCheck(pImage, pbLog + i * VHDX_LOG_SECTOR_SIZE, cbLog, &paEntries[i]);
+
+        /*
+         * The head is the entry with the highest sequence number which is preceded by a
+         * complete sequence of entries starting at its tail.
+         */
+        for (uint32_t i = 0; i < cSectors; i++)
+        {
+            if (   paEntries[i].fValid
+                && (   idxHead == UINT32_MAX
+                    || paEntries[i].u64SequenceNumber > paEntries[idxHead].u64SequenceNumber)
+                && vhdxLogSequenceIsValid(paEntries, cSectors, i))
+                idxHead = i;
+        }
+
+        if (idxHead != UINT32_MAX)
+        {
+            PVHDXLOGENTRYINFO pHead = &paEntries[idxHead];
+
+            LogFlowFunc(("Replaying log from sector %u up to sector %u\n",
+                         pHead->offTail / VHDX_LOG_SECTOR_SIZE, idxHead));
+
+            if (cbFile < pHead->u64FlushedFileOffset)
+                rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                               "VHDX: Image \'%s\' is smaller than recorded in the log, the image is corrupt",
+                               pImage->pszFilename);
+            else
+            {
+                uint32_t idxEntry = pHead->offTail / VHDX_LOG_SECTOR_SIZE;
+
+                for (;;)
+                {
+                    rc = vhdxLogEntryApply(pImage, pbLog + idxEntry * VHDX_LOG_SECTOR_SIZE);
+                    if (   RT_FAILURE(rc)
+                        || idxEntry == idxHead)
+                        break;
+                    idxEntry = (idxEntry + paEntries[idxEntry].cbEntry / VHDX_LOG_SECTOR_SIZE) % cSectors;
+                }
+
+                if (   RT_SUCCESS(rc)
+                    && cbFile < pHead->u64LastFileOffset)
+                    rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, pHead->u64LastFileOffset);
+                if (RT_SUCCESS(rc))
+                    rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+                if (RT_FAILURE(rc))
+                    rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                                   "VHDX: Replaying the log of image \'%s\' failed",
+                                   pImage->pszFilename);
+            }
+        }
+
+        if (RT_SUCCESS(rc))
+        {
+            /* Everything from the log is in place now, mark it as empty. */
+            RTUuidClear(&pImage->Hdr.UuidLog);
+            rc = vhdxHdrWrite(pImage, NULL, NULL, NULL);
+            if (RT_SUCCESS(rc))
+                rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+            if (RT_FAILURE(rc))
+                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                               "VHDX: Clearing the log of image \'%s\' failed",
+                               pImage->pszFilename);
+        }
+    }
+
+    if (pbLog)
+        RTMemFree(pbLog);
+    if (paEntries)
+        RTMemFree(paEntries);
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Writes a log entry updating a single sector of the file at the head of the
+ * log and advances the head.
+ *
+ * There is at most one update in flight (see VHDXBLOCKALLOCSTATE_LOG_LOCK) and
+ * the caller has to make sure the previous update reached its final location on
+ * the disk before, so every entry is the tail of its own sequence. Writing the
+ * entries round robin keeps the previous entry intact if writing the new one is
+ * torn.
+ *
+ * @returns VBox status code.
+ * @param   pImage        Image instance data.
+ * @param   pIoCtx        The I/O context, NULL for synchronous I/O.
+ * @param   offSector     File offset of the sector to update.
+ * @param   pvSector      The new sector content in file endianess.
+ * @param   pfnComplete   Callback called when the write completes.
+ * @param   pvUser        Opaque user data to pass in the completion callback.
+ */
+static int vhdxLogEntryWrite(PVHDXIMAGE pImage, PVDIOCTX pIoCtx, uint64_t offSector, const void *pvSector,
+                             PFNVDXFERCOMPLETED pfnComplete, void *pvUser)
+{
+    const uint8_t *pbSector = (const uint8_t *)pvSector;
+    uint8_t *pbEntry = (uint8_t *)RTMemTmpAllocZ(2 * VHDX_LOG_SECTOR_SIZE);
+    int rc = VINF_SUCCESS;
+
+    if (pbEntry)
+    {
+        PVhdxLogEntryHdr pEntryHdr = (PVhdxLogEntryHdr)pbEntry;
+        PVhdxLogDataDesc pDataDesc = (PVhdxLogDataDesc)(pEntryHdr + 1);
+        PVhdxLogDataSector pDataSector = (PVhdxLogDataSector)(pbEntry + VHDX_LOG_SECTOR_SIZE);
+        uint64_t u64SequenceNumber = pImage->u64LogSeqNext++;
+        uint32_t offEntry = pImage->offLogHead;
+        uint64_t u64LeadingBytes;
+        uint32_t u32TrailingBytes;
+
+        memcpy(&u64LeadingBytes, pbSector, sizeof(u64LeadingBytes));
+        memcpy(&u32TrailingBytes, pbSector + VHDX_LOG_SECTOR_SIZE - sizeof(u32TrailingBytes), sizeof(u32TrailingBytes));
+
+        pEntryHdr->u32Signature         = VHDX_LOG_ENTRY_HEADER_SIGNATURE;
+        pEntryHdr->u32EntryLength       = 2 * VHDX_LOG_SECTOR_SIZE;
+        pEntryHdr->u32Tail              = offEntry;
+        pEntryHdr->u64SequenceNumber    = u64SequenceNumber;
+        pEntryHdr->u32DescriptorCount   = 1;
+        pEntryHdr->UuidLog              = pImage->Hdr.UuidLog;
+        pEntryHdr->u64FlushedFileOffset = pImage->cbFileFlushed;
+        pEntryHdr->u64LastFileOffset    = pImage->offBlockNext;
+        vhdxConvLogEntryHdrEndianess(VHDXECONV_H2F, pEntryHdr, pEntryHdr);
+
+        pDataDesc->u32DataSignature  = VHDX_LOG_DATA_DESC_SIGNATURE;
+        pDataDesc->u32TrailingBytes  = RT_LE2H_U32(u32TrailingBytes);
+        pDataDesc->u64LeadingBytes   = RT_LE2H_U64(u64LeadingBytes);
+        pDataDesc->u64FileOffset     = offSector;
+        pDataDesc->u64SequenceNumber = u64SequenceNumber;
+        vhdxConvLogDataDescEndianess(VHDXECONV_H2F, pDataDesc, pDataDesc);
+
+        pDataSector->u32DataSignature = VHDX_LOG_DATA_SECTOR_SIGNATURE;
+        pDataSector->u32SequenceHigh  = (uint32_t)(u64SequenceNumber >> 32);
+        memcpy(&pDataSector->u8Data[0], pbSector + sizeof(u64LeadingBytes), sizeof(pDataSector->u8Data));
+        pDataSector->u32SequenceLow   = (uint32_t)u64SequenceNumber;
+        vhdxConvLogDataSectorEndianess(VHDXECONV_H2F, pDataSector, pDataSector);
+
+        pEntryHdr->u32Checksum = RT_H2LE_U32(RTCrc32C(pbEntry, 2 * VHDX_LOG_SECTOR_SIZE));
+
+        /* The log size is a multiple of 1MB, so an entry never wraps around the end. */
+        Assert(offEntry + 2 * VHDX_LOG_SECTOR_SIZE <= pImage->Hdr.u32LogLength);
+        pImage->offLogHead = (offEntry + 2 * VHDX_LOG_SECTOR_SIZE) % pImage->Hdr.u32LogLength;
+
+        rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage, pImage->Hdr.u64LogOffset + offEntry,
+                                    pbEntry, 2 * VHDX_LOG_SECTOR_SIZE, pIoCtx, pfnComplete, pvUser);
+        RTMemTmpFree(pbEntry);
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    return rc;
+}
+
+/**
+ * Returns the BAT sector containing the given entry in file endianess.
+ *
+ * @returns File offset of the BAT sector.
+ * @param   pImage        Image instance data.
+ * @param   idxBat        The BAT entry index.
+ * @param   u64BatEntry   The value to use for the entry at idxBat.
+ * @param   paBatSector   Where to store the BAT sector.
+ */
+static uint64_t vhdxBatSectorGet(PVHDXIMAGE pImage, uint32_t idxBat, uint64_t u64BatEntry,
+                                 PVhdxBatEntry paBatSector)
+{
+    uint32_t idxFirst = idxBat - idxBat % VHDX_BAT_ENTRIES_PER_SECTOR;
+    uint32_t cEntries = RT_MIN(VHDX_BAT_ENTRIES_PER_SECTOR, pImage->cBatEntries - idxFirst);
+
+    memset(paBatSector, 0, VHDX_LOG_SECTOR_SIZE);
+    vhdxConvBatTableEndianess(VHDXECONV_H2F, paBatSector, &pImage->paBat[idxFirst], cEntries);
+    paBatSector[idxBat - idxFirst].u64BatEntry = RT_H2LE_U64(u64BatEntry);
+
+    return pImage->offBat + (uint64_t)idxFirst * sizeof(VhdxBatEntry);
+}
+
+/**
+ * Updates a metadata sector synchronously, going through the log.
+ *
+ * @returns VBox status code.
+ * @param   pImage        Image instance data.
+ * @param   offSector     File offset of the sector to update.
+ * @param   pvSector      The new sector content in file endianess.
+ */
+static int vhdxMetaSectorUpdateSync(PVHDXIMAGE pImage, uint64_t offSector, const void *pvSector)
+{
+    int rc = VINF_SUCCESS;
+
+    AssertReturn(!pImage->pBlockAllocActive, VERR_INTERNAL_ERROR_3);
+
+    if (!pImage->fLogActive)
+    {
+        rc = RTUuidCreate(&pImage->Hdr.UuidLog);
+        if (RT_SUCCESS(rc))
+            rc = vhdxHdrWrite(pImage, NULL, NULL, NULL);
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+        if (RT_SUCCESS(rc))
+        {
+            pImage->fLogActive    = true;
+            pImage->u64LogSeqNext = 1;
+            pImage->offLogHead    = 0;
+        }
+        else
+            RTUuidClear(&pImage->Hdr.UuidLog);
+    }
+
+    if (RT_SUCCESS(rc))
+        rc = vhdxLogEntryWrite(pImage, NULL, offSector, pvSector, NULL, NULL);
+    if (RT_SUCCESS(rc))
+        rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+    if (RT_SUCCESS(rc))
+        rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, offSector,
+                                    pvSector, VHDX_LOG_SECTOR_SIZE);
+    if (RT_SUCCESS(rc))
+        rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+
+    return rc;
+}
+
+/**
+ * Writes the BAT sector containing the given entry from the in memory BAT
+ * synchronously, going through the log.
+ *
+ * @returns VBox status code.
+ * @param   pImage        Image instance data.
+ * @param   idxBat        The BAT entry index.
+ */
+static int vhdxBatSectorUpdateSync(PVHDXIMAGE pImage, uint32_t idxBat)
+{
+    VhdxBatEntry aBatSector[VHDX_BAT_ENTRIES_PER_SECTOR];
+    uint64_t offSector = vhdxBatSectorGet(pImage, idxBat, pImage->paBat[idxBat].u64BatEntry,
+                                          &aBatSector[0]);
+
+    return vhdxMetaSectorUpdateSync(pImage, offSector, &aBatSector[0]);
+}
+
 /**
  * Internal. Free all allocated space for representing an image except pImage,
  * and optionally delete the image from disk.
@@ -1000,7 +1675,23 @@ static int vhdxFreeImage(PVHDXIMAGE pImage, bool fDelete)
     {
         if (pImage->pStorage)
         {
-            rc = vdIfIoIntFileClose(pImage->pIfIo, pImage->pStorage);
+            /* Mark the log as empty, all updates reached the disk after the flush. */
+            if (pImage->fLogActive)
+            {
+                rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+                if (RT_SUCCESS(rc))
+                {
+                    RTUuidClear(&pImage->Hdr.UuidLog);
+                    rc = vhdxHdrWrite(pImage, NULL, NULL, NULL);
+                    if (RT_SUCCESS(rc))
+                        rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+                }
+                pImage->fLogActive = false;
+            }
+
+            int rc2 = vdIfIoIntFileClose(pImage->pIfIo, pImage->pStorage);
+            if (RT_SUCCESS(rc))
+                rc = rc2;
             pImage->pStorage = NULL;
         }
 
@@ -1025,27 +1716,48 @@ static int vhdxFreeImage(PVHDXIMAGE pImage, bool fDelete)
  * @returns VBox status code.
  * @param   pImage    Image instance data.
  * @param   pHdr      The header to load.
+ * @param   offHdr    File offset the header was loaded from.
  */
-static int vhdxLoadHeader(PVHDXIMAGE pImage, PVhdxHeader pHdr)
+static int vhdxLoadHeader(PVHDXIMAGE pImage, PVhdxHeader pHdr, uint64_t offHdr)
 {
     int rc = VINF_SUCCESS;
 
-    LogFlowFunc(("pImage=%#p pHdr=%#p\n", pImage, pHdr));
+    LogFlowFunc(("pImage=%#p pHdr=%#p offHdr=%llu\n", pImage, pHdr, offHdr));
 
     /*
-     * Most fields in the header are not required because the backend implements
-     * readonly access only so far.
-     * We just have to check that the log is empty, we have to refuse to load the
-     * image otherwsie because replaying the log is not implemented.
+     * The header is kept in memory because it has to be rewritten with new GUIDs
+     * and a new sequence number whenever the image is opened for writing or the
+     * log becomes active.
+     * A non empty log can only be replayed if the image is writable, refuse to
+     * load the image otherwise.
      */
     if (pHdr->u16Version == VHDX_HEADER_VHDX_VERSION)
     {
-        /* Check that the log UUID is zero. */
         pImage->uVersion = pHdr->u16Version;
         if (!RTUuidIsNull(&pHdr->UuidLog))
-            rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
-                           "VHDX: Image \'%s\' has a non empty log which is not supported",
+        {
+            if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+                rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                               "VHDX: Image \'%s\' has a non empty log which can only be replayed if the image is opened for writing",
+                               pImage->pszFilename);
+        }
+
+        if (   RT_SUCCESS(rc)
+            && !(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+            && (   pHdr->u16LogVersion != VHDX_HEADER_LOG_VERSION
+                || !pHdr->u32LogLength
+                || pHdr->u32LogLength % _1M
+                || pHdr->u64LogOffset % _1M
+                || pHdr->u64LogOffset < _1M))
+            rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                           "VHDX: Image \'%s\' has an invalid log location or version",
                            pImage->pszFilename);
+
+        if (RT_SUCCESS(rc))
+        {
+            memcpy(&pImage->Hdr, pHdr, sizeof(VhdxHeader));
+            pImage->offHdrCur = offHdr;
+        }
     }
     else
         rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
@@ -1121,7 +1833,10 @@ static int vhdxFindAndLoadCurrentHeader(PVHDXIMAGE pImage)
         if (fHdr1Valid != fHdr2Valid)
         {
             /* Only one header is valid - use it. */
-            rc = vhdxLoadHeader(pImage, fHdr1Valid ? pHdr1 : pHdr2);
+            if (fHdr1Valid)
+                rc = vhdxLoadHeader(pImage, pHdr1, VHDX_HEADER1_OFFSET);
+            else
+                rc = vhdxLoadHeader(pImage, pHdr2, VHDX_HEADER2_OFFSET);
         }
         else if (!fHdr1Valid && !fHdr2Valid)
         {
@@ -1133,9 +1848,9 @@ static int vhdxFindAndLoadCurrentHeader(PVHDXIMAGE pImage)
         {
             /* Both headers are valid. Use the sequence number to find the current one. */
             if (pHdr1->u64SequenceNumber > pHdr2->u64SequenceNumber)
-                rc = vhdxLoadHeader(pImage, pHdr1);
+                rc = vhdxLoadHeader(pImage, pHdr1, VHDX_HEADER1_OFFSET);
             else
-                rc = vhdxLoadHeader(pImage, pHdr2);
+                rc = vhdxLoadHeader(pImage, pHdr2, VHDX_HEADER2_OFFSET);
         }
     }
     else
@@ -1212,8 +1927,8 @@ static int vhdxLoadBatRegion(PVHDXIMAGE pImage, uint64_t offRegion,
                     {
 /**
  * Disabled the verification because there are images out there with the sector bitmap
- * marked as present. The entry is never accessed and the image is readonly anyway,
- * so no harm done.
+ * marked as present. The entry is never accessed because differencing images are not
+ * supported, so no harm done.
  */
 #if 0
                         /* Sector bitmap block. */
@@ -1245,6 +1960,9 @@ static int vhdxLoadBatRegion(PVHDXIMAGE pImage, uint64_t offRegion,
                 {
                     pImage->paBat       = paBatEntries;
                     pImage->uChunkRatio = uChunkRatio;
+                    pImage->cBatEntries = cBatEntries;
+                    pImage->offBat      = offRegion;
+                    pImage->cbBatRegion = cbRegion;
                 }
             }
             else
@@ -1299,6 +2017,13 @@ static int vhdxLoadFileParametersMetadata(PVHDXIMAGE pImage, uint64_t offItem, s
             vhdxConvFileParamsEndianess(VHDXECONV_F2H, &FileParameters, &FileParameters);
             pImage->cbBlock = FileParameters.u32BlockSize;
 
+            /* All blocks are allocated and must stay so, treat the image like a fixed one. */
+            if (FileParameters.u32Flags & VHDX_FILE_PARAMETERS_FLAGS_LEAVE_BLOCKS_ALLOCATED)
+            {
+                pImage->fLeaveBlocksAllocated = true;
+                pImage->uImageFlags |= VD_IMAGE_FLAGS_FIXED;
+            }
+
             /** @todo No support for differencing images yet. */
             if (FileParameters.u32Flags & VHDX_FILE_PARAMETERS_FLAGS_HAS_PARENT)
                 rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
@@ -1342,7 +2067,8 @@ static int vhdxLoadVDiskSizeMetadata(PVHDXIMAGE pImage, uint64_t offItem, size_t
         if (RT_SUCCESS(rc))
         {
             vhdxConvVDiskSizeEndianess(VHDXECONV_F2H, &VDiskSize, &VDiskSize);
-            pImage->cbSize = VDiskSize.u64VDiskSize;
+            pImage->cbSize       = VDiskSize.u64VDiskSize;
+            pImage->offVDiskSize = offItem;
         }
         else
             rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
@@ -1647,7 +2373,11 @@ static int vhdxLoadRegionTable(PVHDXIMAGE pImage)
                     else if (!RTUuidCompareStr(&pRegTblEntry->UuidObject, VHDX_REGION_TBL_ENTRY_UUID_METADATA))
                     {
                         if (pRegTblEntry->u32Flags & VHDX_REGION_TBL_ENTRY_FLAGS_IS_REQUIRED)
+                        {
+                            pImage->offMetadata      = pRegTblEntry->u64FileOffset;
+                            pImage->cbMetadataRegion = pRegTblEntry->u32Length;
                             rc = vhdxLoadMetadataRegion(pImage, pRegTblEntry->u64FileOffset, pRegTblEntry->u32Length);
+                        }
                         else
                             rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
                                            "VHDX: Metadata region not marked as required in image \'%s\'",
@@ -1703,15 +2433,13 @@ static int vhdxOpenImage(PVHDXIMAGE pImage, unsigned uOpenFlags)
 
     LogFlowFunc(("pImage=%#p uOpenFlags=%#x\n", pImage, uOpenFlags));
     pImage->uOpenFlags = uOpenFlags;
+    pImage->pBlockAllocActive = NULL;
+    RTListInit(&pImage->ListBlockAllocWaiting);
 
     pImage->pIfError = VDIfErrorGet(pImage->pVDIfsDisk);
     pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
     AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
 
-    /* Refuse write access, it is not implemented so far. */
-    if (!(uOpenFlags & VD_OPEN_FLAGS_READONLY))
-        return VERR_NOT_SUPPORTED;
-
     /*
      * Open the image.
      */
@@ -1740,6 +2468,11 @@ static int vhdxOpenImage(PVHDXIMAGE pImage, unsigned uOpenFlags)
                 else
                     rc = vhdxFindAndLoadCurrentHeader(pImage);
 
+                /* Bring the metadata into a consistent state before loading anything else. */
+                if (   RT_SUCCESS(rc)
+                    && !RTUuidIsNull(&pImage->Hdr.UuidLog))
+                    rc = vhdxLogReplay(pImage);
+
                 /* Load the region table. */
                 if (RT_SUCCESS(rc))
                     rc = vhdxLoadRegionTable(pImage);
@@ -1749,13 +2482,40 @@ static int vhdxOpenImage(PVHDXIMAGE pImage, unsigned uOpenFlags)
             rc = VERR_VD_GEN_INVALID_HEADER;
     }
 
-    if (RT_SUCCESS(rc))
+    if (   RT_SUCCESS(rc)
+        && !(uOpenFlags & VD_OPEN_FLAGS_READONLY))
     {
-        PVDREGIONDESC pRegion = &pImage->RegionList.aRegions[0];
-        pImage->RegionList.fFlags   = 0;
-        pImage->RegionList.cRegions = 1;
-
-        pRegion->offRegion            = 0; /* Disk start. */
+        /*
+         * The specification requires new file and data write GUIDs before the first
+         * modification. Do it right here so the write path doesn't need to care.
+         */
+        rc = RTUuidCreate(&pImage->Hdr.UuidFileWrite);
+        if (RT_SUCCESS(rc))
+            rc = RTUuidCreate(&pImage->Hdr.UuidDataWrite);
+        if (RT_SUCCESS(rc))
+            rc = vhdxHdrWrite(pImage, NULL, NULL, NULL);
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+        if (RT_SUCCESS(rc))
+        {
+            pImage->offBlockNext  = RT_ALIGN_64(cbFile, _1M);
+            pImage->cbFileFlushed = cbFile;
+        }
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           "VHDX: Updating the header of image \'%s\' failed",
+                           pImage->pszFilename);
+    }
+
+    if (RT_SUCCESS(rc))
+    {
+        PVDREGIONDESC pRegion = &pImage->RegionList.aRegions[0];
+        pImage->RegionList.fFlags   = 0;
+        pImage->RegionList.cRegions = 1;
+
+        pRegion->offRegion            = 0; /* Disk start. */
         pRegion->cbBlock              = pImage->cbLogicalSector;
         pRegion->enmDataForm          = VDREGIONDATAFORM_RAW;
         pRegion->enmMetadataForm      = VDREGIONMETADATAFORM_NONE;
@@ -1770,6 +2530,487 @@ static int vhdxOpenImage(PVHDXIMAGE pImage, unsigned uOpenFlags)
     return rc;
 }
 
+/**
+ * Internal: Create a dynamic image and open it.
+ */
+static int vhdxCreateImage(PVHDXIMAGE pImage, uint64_t cbSize, unsigned uImageFlags,
+                           PCRTUUID pUuid, PCVDGEOMETRY pPCHSGeometry, PCVDGEOMETRY pLCHSGeometry,
+                           unsigned uOpenFlags, PVDINTERFACEPROGRESS pIfProgress,
+                           unsigned uPercentStart, unsigned uPercentSpan)
+{
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pImage=%#p cbSize=%llu uImageFlags=%#x uOpenFlags=%#x\n", pImage, cbSize, uImageFlags, uOpenFlags));
+
+    pImage->uImageFlags = uImageFlags;
+    pImage->pIfError = VDIfErrorGet(pImage->pVDIfsDisk);
+    pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
+    AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
+
+    /*
+     * Layout of the file: File identifier, headers and region tables in the first MB,
+     * followed by the log, the metadata region and the BAT region. The payload blocks
+     * are allocated behind the BAT.
+     */
+    uint64_t cDataBlocks = (cbSize + VHDX_CREATE_BLOCK_SIZE - 1) / VHDX_CREATE_BLOCK_SIZE;
+    uint64_t uChunkRatio = RT_BIT_64(23) * VHDX_CREATE_LOGICAL_SECTOR_SIZE / VHDX_CREATE_BLOCK_SIZE;
+    uint64_t cBatEntries = cDataBlocks + (cDataBlocks - 1) / uChunkRatio;
+    uint32_t cbBatRegion = (uint32_t)RT_ALIGN_64(cBatEntries * sizeof(VhdxBatEntry), _1M);
+    size_t   cbBuf       = RT_MAX(VHDX_REGION_TBL_SIZE_MAX, VHDX_CREATE_METADATA_ITEMS_OFF + VHDX_LOG_SECTOR_SIZE);
+    uint8_t *pbBuf       = (uint8_t *)RTMemTmpAllocZ(cbBuf);
+
+    if (!pbBuf)
+        return VERR_NO_MEMORY;
+
+    rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename,
+                           VDOpenFlagsToFileOpenFlags(uOpenFlags & ~VD_OPEN_FLAGS_READONLY, true /* fCreate */),
+                           &pImage->pStorage);
+    if (RT_FAILURE(rc))
+    {
+        RTMemTmpFree(pbBuf);
+        return vdIfError(pImage->pIfError, rc, RT_SRC_POS, "VHDX: cannot create image \'%s\'",
+                         pImage->pszFilename);
+    }
+
+    /* File identifier. */
+    VhdxFileIdentifier FileIdentifier;
+    static const char s_szCreator[] = "VirtualBox";
+
+    RT_ZERO(FileIdentifier);
+    FileIdentifier.u64Signature = VHDX_FILE_IDENTIFIER_SIGNATURE;
+    for (unsigned i = 0; i < sizeof(s_szCreator) - 1; i++)
+        FileIdentifier.awszCreator[i] = s_szCreator[i];
+    vhdxConvFileIdentifierEndianess(VHDXECONV_H2F, &FileIdentifier, &FileIdentifier);
+    rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, VHDX_FILE_IDENTIFIER_OFFSET,
+                                &FileIdentifier, sizeof(FileIdentifier));
+
+    /* Both headers, the second write makes the header at the second location the current one. */
+    if (RT_SUCCESS(rc))
+    {
+        RT_ZERO(pImage->Hdr);
+        pImage->Hdr.u32Signature  = VHDX_HEADER_SIGNATURE;
+        pImage->Hdr.u16LogVersion = VHDX_HEADER_LOG_VERSION;
+        pImage->Hdr.u16Version    = VHDX_HEADER_VHDX_VERSION;
+        pImage->Hdr.u32LogLength  = VHDX_CREATE_LOG_SIZE;
+        pImage->Hdr.u64LogOffset  = VHDX_CREATE_LOG_OFFSET;
+        pImage->offHdrCur         = VHDX_HEADER2_OFFSET;
+
+        rc = RTUuidCreate(&pImage->Hdr.UuidFileWrite);
+        if (RT_SUCCESS(rc))
+            rc = RTUuidCreate(&pImage->Hdr.UuidDataWrite);
+        if (RT_SUCCESS(rc))
+            rc = vhdxHdrWrite(pImage, NULL, NULL, NULL);
+        if (RT_SUCCESS(rc))
+            rc = vhdxHdrWrite(pImage, NULL, NULL, NULL);
+    }
+
+    /* Region table and its copy. */
+    if (RT_SUCCESS(rc))
+    {
+        PVhdxRegionTblHdr pRegionTblHdr = (PVhdxRegionTblHdr)pbBuf;
+        PVhdxRegionTblEntry paRegTblEntries = (PVhdxRegionTblEntry)(pRegionTblHdr + 1);
+
+        memset(pbBuf, 0, cbBuf);
+        pRegionTblHdr->u32Signature  = VHDX_REGION_TBL_HDR_SIGNATURE;
+        pRegionTblHdr->u32EntryCount = 2;
+        vhdxConvRegionTblHdrEndianess(VHDXECONV_H2F, pRegionTblHdr, pRegionTblHdr);
+
+        RTUuidFromStr(&paRegTblEntries[0].UuidObject, VHDX_REGION_TBL_ENTRY_UUID_METADATA);
+        paRegTblEntries[0].u64FileOffset = VHDX_CREATE_METADATA_OFFSET;
+        paRegTblEntries[0].u32Length     = VHDX_CREATE_METADATA_SIZE;
+        paRegTblEntries[0].u32Flags      = VHDX_REGION_TBL_ENTRY_FLAGS_IS_REQUIRED;
+        vhdxConvRegionTblEntryEndianess(VHDXECONV_H2F, &paRegTblEntries[0], &paRegTblEntries[0]);
+
+        RTUuidFromStr(&paRegTblEntries[1].UuidObject, VHDX_REGION_TBL_ENTRY_UUID_BAT);
+        paRegTblEntries[1].u64FileOffset = VHDX_CREATE_BAT_OFFSET;
+        paRegTblEntries[1].u32Length     = cbBatRegion;
+        paRegTblEntries[1].u32Flags      = VHDX_REGION_TBL_ENTRY_FLAGS_IS_REQUIRED;
+        vhdxConvRegionTblEntryEndianess(VHDXECONV_H2F, &paRegTblEntries[1], &paRegTblEntries[1]);
+
+        /* The checksum covers the complete table with the checksum field set to zero. */
+        pRegionTblHdr->u32Checksum = RT_H2LE_U32(RTCrc32C(pbBuf, VHDX_REGION_TBL_SIZE_MAX));
+
+        rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, VHDX_REGION_TBL_HDR_OFFSET,
+                                    pbBuf, VHDX_REGION_TBL_SIZE_MAX);
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, VHDX_REGION_TBL2_HDR_OFFSET,
+                                        pbBuf, VHDX_REGION_TBL_SIZE_MAX);
+    }
+
+    /* Metadata table with the items following in the same region. */
+    if (RT_SUCCESS(rc))
+    {
+        memset(pbBuf, 0, cbBuf);
+
+        PVhdxMetadataTblHdr pMetadataTblHdr = (PVhdxMetadataTblHdr)pbBuf;
+        PVhdxMetadataTblEntry paMetadataTblEntries = (PVhdxMetadataTblEntry)(pMetadataTblHdr + 1);
+        PVhdxFileParameters pFileParams = (PVhdxFileParameters)(pbBuf + VHDX_CREATE_METADATA_ITEMS_OFF);
+        PVhdxVDiskSize pVDiskSize = (PVhdxVDiskSize)(pFileParams + 1);
+        PVhdxPage83Data pPage83Data = (PVhdxPage83Data)(pVDiskSize + 1);
+        PVhdxVDiskLogicalSectorSize pVDiskLogSectSize = (PVhdxVDiskLogicalSectorSize)(pPage83Data + 1);
+        PVhdxVDiskPhysicalSectorSize pVDiskPhysSectSize = (PVhdxVDiskPhysicalSectorSize)(pVDiskLogSectSize + 1);
+
+        pFileParams->u32BlockSize = VHDX_CREATE_BLOCK_SIZE;
+        pFileParams->u32Flags     = 0;
+        vhdxConvFileParamsEndianess(VHDXECONV_H2F, pFileParams, pFileParams);
+        pVDiskSize->u64VDiskSize = cbSize;
+        vhdxConvVDiskSizeEndianess(VHDXECONV_H2F, pVDiskSize, pVDiskSize);
+        pPage83Data->UuidPage83Data = *pUuid;
+        vhdxConvPage83DataEndianess(VHDXECONV_H2F, pPage83Data, pPage83Data);
+        pVDiskLogSectSize->u32LogicalSectorSize = VHDX_CREATE_LOGICAL_SECTOR_SIZE;
+        vhdxConvVDiskLogSectSizeEndianess(VHDXECONV_H2F, pVDiskLogSectSize, pVDiskLogSectSize);
+        pVDiskPhysSectSize->u64PhysicalSectorSize = VHDX_CREATE_PHYS_SECTOR_SIZE;
+        vhdxConvVDiskPhysSectSizeEndianess(VHDXECONV_H2F, pVDiskPhysSectSize, pVDiskPhysSectSize);
+
+        const struct
+        {
+            const char *pszItemUuid;
+            void       *pvItem;
+            uint32_t    cbItem;
+            uint32_t    fFlags;
+        } aItems[] =
+        {
+            { VHDX_METADATA_TBL_ENTRY_ITEM_FILE_PARAMS,    pFileParams,        sizeof(*pFileParams),
+              VHDX_METADATA_TBL_ENTRY_FLAGS_IS_REQUIRED },
+            { VHDX_METADATA_TBL_ENTRY_ITEM_VDISK_SIZE,     pVDiskSize,         sizeof(*pVDiskSize),
+              VHDX_METADATA_TBL_ENTRY_FLAGS_IS_VDISK | VHDX_METADATA_TBL_ENTRY_FLAGS_IS_REQUIRED },
+            { VHDX_METADATA_TBL_ENTRY_ITEM_PAGE83_DATA,    pPage83Data,        sizeof(*pPage83Data),
+              VHDX_METADATA_TBL_ENTRY_FLAGS_IS_VDISK | VHDX_METADATA_TBL_ENTRY_FLAGS_IS_REQUIRED },
+            { VHDX_METADATA_TBL_ENTRY_ITEM_LOG_SECT_SIZE,  pVDiskLogSectSize,  sizeof(*pVDiskLogSectSize),
+              VHDX_METADATA_TBL_ENTRY_FLAGS_IS_VDISK | VHDX_METADATA_TBL_ENTRY_FLAGS_IS_REQUIRED },
+            { VHDX_METADATA_TBL_ENTRY_ITEM_PHYS_SECT_SIZE, pVDiskPhysSectSize, sizeof(*pVDiskPhysSectSize),
+              VHDX_METADATA_TBL_ENTRY_FLAGS_IS_VDISK | VHDX_METADATA_TBL_ENTRY_FLAGS_IS_REQUIRED }
+        };
+
+        for (unsigned i = 0; i < RT_ELEMENTS(aItems); i++)
+        {
+            RTUuidFromStr(&paMetadataTblEntries[i].UuidItem, aItems[i].pszItemUuid);
+            paMetadataTblEntries[i].u32Offset = (uint32_t)((uint8_t *)aItems[i].pvItem - pbBuf);
+            paMetadataTblEntries[i].u32Length = aItems[i].cbItem;
+            paMetadataTblEntries[i].u32Flags  = aItems[i].fFlags;
+            vhdxConvMetadataTblEntryEndianess(VHDXECONV_H2F, &paMetadataTblEntries[i], &paMetadataTblEntries[i]);
+        }
+
+        pMetadataTblHdr->u64Signature  = VHDX_METADATA_TBL_HDR_SIGNATURE;
+        pMetadataTblHdr->u16EntryCount = RT_ELEMENTS(aItems);
+        vhdxConvMetadataTblHdrEndianess(VHDXECONV_H2F, pMetadataTblHdr, pMetadataTblHdr);
+
+        rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, VHDX_CREATE_METADATA_OFFSET,
+                                    pbBuf, VHDX_CREATE_METADATA_ITEMS_OFF + VHDX_LOG_SECTOR_SIZE);
+    }
+
+    /* All blocks are not present initially, the BAT reads as zeros after extending the file. */
+    if (RT_SUCCESS(rc))
+        rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, VHDX_CREATE_BAT_OFFSET + cbBatRegion);
+    if (RT_SUCCESS(rc))
+        rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+
+    RTMemTmpFree(pbBuf);
+
+    if (RT_SUCCESS(rc))
+    {
+        vdIfProgress(pIfProgress, uPercentStart + uPercentSpan * 98 / 100);
+
+        /* Load the image through the regular path to get the in memory state set up. */
+        vdIfIoIntFileClose(pImage->pIfIo, pImage->pStorage);
+        pImage->pStorage = NULL;
+        rc = vhdxOpenImage(pImage, uOpenFlags);
+    }
+    else
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, "VHDX: Writing the structures of image \'%s\' failed",
+                       pImage->pszFilename);
+
+    if (RT_SUCCESS(rc))
+    {
+        pImage->PCHSGeometry = *pPCHSGeometry;
+        pImage->LCHSGeometry = *pLCHSGeometry;
+        vdIfProgress(pIfProgress, uPercentStart + uPercentSpan);
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Rolls back a failed block allocation.
+ *
+ * @returns nothing.
+ * @param   pImage        Image instance data.
+ * @param   pBlockAlloc   The block allocation state to roll back.
+ */
+static void vhdxBlockAllocRollback(PVHDXIMAGE pImage, PVHDXBLOCKALLOC pBlockAlloc)
+{
+    if (pBlockAlloc->fBatUpdated)
+    {
+        /*
+         * The on disk BAT entry is in an unknown state, the log takes care of it if
+         * the update made it to the log. Leak the block in that case, it is reclaimed
+         * by compacting the image.
+         */
+        pImage->paBat[pBlockAlloc->idxBat].u64BatEntry = pBlockAlloc->u64BatEntryOld;
+    }
+    else if (pImage->offBlockNext == pBlockAlloc->offBlockNew + RT_ALIGN_64(pImage->cbBlock, _1M))
+    {
+        /* Nothing references the block and no other block was allocated after it, give the space back. */
+        pImage->offBlockNext  = pBlockAlloc->offBlockNew;
+        pImage->cbFileFlushed = RT_MIN(pImage->cbFileFlushed, pBlockAlloc->offBlockNew);
+        vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, pBlockAlloc->offBlockNew);
+    }
+    /* else: Blocks following this one are in use, leak it until the image is compacted. */
+
+    /* Clear the log GUID again if activating the log failed. */
+    if (   pImage->pBlockAllocActive == pBlockAlloc
+        && !pImage->fLogActive)
+        RTUuidClear(&pImage->Hdr.UuidLog);
+}
+
+static int vhdxBlockAllocProcess(PVHDXIMAGE pImage, PVDIOCTX pIoCtx, PVHDXBLOCKALLOC pBlockAlloc);
+
+/**
+ * Completes a block allocation, continues the halted I/O context and hands the
+ * log over to the next waiting allocation.
+ *
+ * @returns nothing.
+ * @param   pImage        Image instance data.
+ * @param   pBlockAlloc   The block allocation state, freed on return.
+ * @param   rc            Status code of the allocation.
+ */
+static void vhdxBlockAllocComplete(PVHDXIMAGE pImage, PVHDXBLOCKALLOC pBlockAlloc, int rc)
+{
+    PVDIOCTX pIoCtx = pBlockAlloc->pIoCtx;
+
+    if (RT_FAILURE(rc))
+        vhdxBlockAllocRollback(pImage, pBlockAlloc);
+    if (pImage->pBlockAllocActive == pBlockAlloc)
+        pImage->pBlockAllocActive = NULL;
+    RTMemFree(pBlockAlloc);
+
+    /* The user data transfer accounts for the bytes already. */
+    pImage->pIfIo->pfnIoCtxCompleted(pImage->pIfIo->Core.pvUser, pIoCtx, rc, 0);
+
+    /*
+     * Resume the waiting allocations one after another. An allocation completing
+     * synchronously ends up here again, the flag prevents recursing.
+     */
+    if (!pImage->fBlockAllocResuming)
+    {
+        pImage->fBlockAllocResuming = true;
+        while (   !pImage->pBlockAllocActive
+               && !RTListIsEmpty(&pImage->ListBlockAllocWaiting))
+        {
+            PVHDXBLOCKALLOC pBlockAllocNext = RTListGetFirst(&pImage->ListBlockAllocWaiting, VHDXBLOCKALLOC, NodeWaiting);
+            RTListNodeRemove(&pBlockAllocNext->NodeWaiting);
+            vhdxBlockAllocProcess(pImage, pBlockAllocNext->pIoCtx, pBlockAllocNext);
+        }
+        pImage->fBlockAllocResuming = false;
+    }
+}
+
+static DECLCALLBACK(int) vhdxBlockAllocUpdate(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq);
+
+/**
+ * Advances the block allocation state machine as far as possible.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_ASYNC_IO_IN_PROGRESS if a step is still in progress or the
+ *          allocation waits for the log, the state machine continues in the
+ *          completion callback or when the log is free again.
+ * @retval  Anything else if the allocation completed, pBlockAlloc is freed.
+ * @param   pImage        Image instance data.
+ * @param   pIoCtx        The I/O context.
+ * @param   pBlockAlloc   The block allocation state.
+ */
+static int vhdxBlockAllocProcess(PVHDXIMAGE pImage, PVDIOCTX pIoCtx, PVHDXBLOCKALLOC pBlockAlloc)
+{
+    int rc = VINF_SUCCESS;
+
+    while (   RT_SUCCESS(rc)
+           && pBlockAlloc->enmAllocState != VHDXBLOCKALLOCSTATE_COMPLETE)
+    {
+        switch (pBlockAlloc->enmAllocState)
+        {
+            case VHDXBLOCKALLOCSTATE_USER_WRITE:
+            {
+                pBlockAlloc->enmAllocState = VHDXBLOCKALLOCSTATE_LOG_LOCK;
+
+                /*
+                 * The data is written to fresh space beyond the flushed end of the file
+                 * which reads as zeros until the BAT links it, so it doesn't need to be
+                 * ordered against the metadata updates following. A later flush orders it.
+                 */
+                rc = vdIfIoIntFileWriteUser(pImage->pIfIo, pImage->pStorage, pBlockAlloc->offBlockNew,
+                                            pIoCtx, pBlockAlloc->cbToWrite, NULL, NULL);
+                if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+                    rc = VINF_SUCCESS;
+                break;
+            }
+            case VHDXBLOCKALLOCSTATE_LOG_LOCK:
+            {
+                /*
+                 * Allocations of different blocks run concurrently if the disk was opened
+                 * with VD_OPEN_FLAGS_HONOR_SAME. The log holds one update at a time and the
+                 * BAT sector written must contain the entries of all earlier allocations,
+                 * so queue up behind the allocation currently owning the log.
+                 */
+                if (pImage->pBlockAllocActive)
+                {
+                    RTListAppend(&pImage->ListBlockAllocWaiting, &pBlockAlloc->NodeWaiting);
+                    rc = VERR_VD_ASYNC_IO_IN_PROGRESS;
+                    break;
+                }
+
+                pImage->pBlockAllocActive = pBlockAlloc;
+                pBlockAlloc->enmAllocState =   pImage->fLogActive
+                                             ? VHDXBLOCKALLOCSTATE_LOG_WRITE
+                                             : VHDXBLOCKALLOCSTATE_HDR_WRITE;
+                break;
+            }
+            case VHDXBLOCKALLOCSTATE_HDR_WRITE:
+            {
+                /* Activate the log, the new log GUID must be on disk before the first entry. */
+                pBlockAlloc->enmAllocState = VHDXBLOCKALLOCSTATE_HDR_FLUSH;
+                rc = RTUuidCreate(&pImage->Hdr.UuidLog);
+                if (RT_SUCCESS(rc))
+                {
+                    pImage->u64LogSeqNext = 1;
+                    pImage->offLogHead    = 0;
+                    rc = vhdxHdrWrite(pImage, pIoCtx, vhdxBlockAllocUpdate, pBlockAlloc);
+                }
+                break;
+            }
+            case VHDXBLOCKALLOCSTATE_HDR_FLUSH:
+            {
+                pBlockAlloc->enmAllocState = VHDXBLOCKALLOCSTATE_LOG_WRITE;
+                pImage->fLogActive = true;
+                rc = vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage, pIoCtx,
+                                        vhdxBlockAllocUpdate, pBlockAlloc);
+                break;
+            }
+            case VHDXBLOCKALLOCSTATE_LOG_WRITE:
+            {
+                /* Build the sector once, the log and the in place update must match. */
+                pBlockAlloc->offBatSector = vhdxBatSectorGet(pImage, pBlockAlloc->idxBat,
+                                                             pBlockAlloc->u64BatEntryNew,
+                                                             &pBlockAlloc->aBatSector[0]);
+
+                pBlockAlloc->enmAllocState = VHDXBLOCKALLOCSTATE_LOG_FLUSH;
+                rc = vhdxLogEntryWrite(pImage, pIoCtx, pBlockAlloc->offBatSector, &pBlockAlloc->aBatSector[0],
+                                       vhdxBlockAllocUpdate, pBlockAlloc);
+                break;
+            }
+            case VHDXBLOCKALLOCSTATE_LOG_FLUSH:
+            {
+                pBlockAlloc->enmAllocState  = VHDXBLOCKALLOCSTATE_BAT_WRITE;
+                pBlockAlloc->cbFileFlushing = pImage->offBlockNext;
+                rc = vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage, pIoCtx,
+                                        vhdxBlockAllocUpdate, pBlockAlloc);
+                break;
+            }
+            case VHDXBLOCKALLOCSTATE_BAT_WRITE:
+            {
+                /* The log entry is on the disk, the file can't shrink below the flushed size anymore. */
+                pImage->cbFileFlushed = RT_MAX(pImage->cbFileFlushed, pBlockAlloc->cbFileFlushing);
+                pImage->paBat[pBlockAlloc->idxBat].u64BatEntry = pBlockAlloc->u64BatEntryNew;
+                pBlockAlloc->fBatUpdated = true;
+
+                pBlockAlloc->enmAllocState = VHDXBLOCKALLOCSTATE_BAT_FLUSH;
+                rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage, pBlockAlloc->offBatSector,
+                                            &pBlockAlloc->aBatSector[0], VHDX_LOG_SECTOR_SIZE, pIoCtx,
+                                            vhdxBlockAllocUpdate, pBlockAlloc);
+                break;
+            }
+            case VHDXBLOCKALLOCSTATE_BAT_FLUSH:
+            {
+                /* The BAT update must be on the disk before the next log entry is written. */
+                pBlockAlloc->enmAllocState = VHDXBLOCKALLOCSTATE_COMPLETE;
+                rc = vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage, pIoCtx,
+                                        vhdxBlockAllocUpdate, pBlockAlloc);
+                break;
+            }
+            default:
+                AssertMsgFailed(("Invalid block allocation state %d\n", pBlockAlloc->enmAllocState));
+                rc = VERR_INTERNAL_ERROR;
+        }
+    }
+
+    if (rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+        vhdxBlockAllocComplete(pImage, pBlockAlloc, rc);
+
+    return rc;
+}
+
+/**
+ * Completion callback for the individual steps of a block allocation.
+ */
+static DECLCALLBACK(int) vhdxBlockAllocUpdate(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+    PVHDXBLOCKALLOC pBlockAlloc = (PVHDXBLOCKALLOC)pvUser;
+
+    if (RT_SUCCESS(rcReq))
+        vhdxBlockAllocProcess(pImage, pIoCtx, pBlockAlloc);
+    else
+        vhdxBlockAllocComplete(pImage, pBlockAlloc, rcReq);
+
+    /* The I/O context stays halted until vhdxBlockAllocComplete() continues it. */
+    return VINF_SUCCESS;
+}
+
+/**
+ * Allocates a new block at the end of the image, writes the user data to it
+ * and links it into the BAT.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_IOCTX_HALT if the allocation was started, the I/O context is
+ *          continued when it completes.
+ * @param   pImage        Image instance data.
+ * @param   pIoCtx        The I/O context holding the data for the complete block.
+ * @param   idxBat        The BAT entry index of the block.
+ * @param   cbToWrite     Amount of data to write.
+ */
+static int vhdxBlockAlloc(PVHDXIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxBat, size_t cbToWrite)
+{
+    int rc = VINF_SUCCESS;
+    PVHDXBLOCKALLOC pBlockAlloc = (PVHDXBLOCKALLOC)RTMemAllocZ(sizeof(VHDXBLOCKALLOC));
+
+    if (RT_LIKELY(pBlockAlloc))
+    {
+        pBlockAlloc->pIoCtx         = pIoCtx;
+        pBlockAlloc->enmAllocState  = VHDXBLOCKALLOCSTATE_USER_WRITE;
+        pBlockAlloc->idxBat         = idxBat;
+        pBlockAlloc->fBatUpdated    = false;
+        pBlockAlloc->u64BatEntryOld = pImage->paBat[idxBat].u64BatEntry;
+        pBlockAlloc->offBlockNew    = pImage->offBlockNext;
+        pBlockAlloc->u64BatEntryNew = VHDX_BAT_ENTRY_CREATE(pBlockAlloc->offBlockNew,
+                                                            VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT);
+        pBlockAlloc->cbToWrite      = cbToWrite;
+
+        /* Blocks are placed at 1MB boundaries. */
+        pImage->offBlockNext += RT_ALIGN_64(pImage->cbBlock, _1M);
+        rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, pImage->offBlockNext);
+        if (RT_SUCCESS(rc))
+        {
+            /*
+             * The I/O context is halted from here on and every outcome is reported
+             * through vhdxBlockAllocComplete(), even if the allocation completes
+             * right away. This keeps the handling the same for allocations waiting
+             * for the log and the ones which don't.
+             */
+            vhdxBlockAllocProcess(pImage, pIoCtx, pBlockAlloc);
+            rc = VERR_VD_IOCTX_HALT;
+        }
+        else
+        {
+            pImage->offBlockNext = pBlockAlloc->offBlockNew;
+            RTMemFree(pBlockAlloc);
+        }
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    return rc;
+}
+
 
 /** @copydoc VDIMAGEBACKEND::pfnProbe */
 static DECLCALLBACK(int) vhdxProbe(const char *pszFilename, PVDINTERFACE pVDIfsDisk,
@@ -1879,11 +3120,54 @@ static DECLCALLBACK(int) vhdxCreate(const char *pszFilename, uint64_t cbSize,
                                     PVDINTERFACE pVDIfsOperation, VDTYPE enmType,
                                     void **ppBackendData)
 {
-    RT_NOREF8(pszFilename, cbSize, uImageFlags, pszComment, pPCHSGeometry, pLCHSGeometry, pUuid, uOpenFlags);
-    RT_NOREF7(uPercentStart, uPercentSpan, pVDIfsDisk, pVDIfsImage, pVDIfsOperation, enmType, ppBackendData);
+    RT_NOREF1(pszComment);
     LogFlowFunc(("pszFilename=\"%s\" cbSize=%llu uImageFlags=%#x pszComment=\"%s\" pPCHSGeometry=%#p pLCHSGeometry=%#p Uuid=%RTuuid uOpenFlags=%#x uPercentStart=%u uPercentSpan=%u pVDIfsDisk=%#p pVDIfsImage=%#p pVDIfsOperation=%#p enmType=%u ppBackendData=%#p",
                  pszFilename, cbSize, uImageFlags, pszComment, pPCHSGeometry, pLCHSGeometry, pUuid, uOpenFlags, uPercentStart, uPercentSpan, pVDIfsDisk, pVDIfsImage, pVDIfsOperation, enmType, ppBackendData));
-    int rc = VERR_NOT_SUPPORTED;
+    int rc;
+
+    /* Check the VD container type. */
+    if (enmType != VDTYPE_HDD)
+        return VERR_VD_INVALID_TYPE;
+
+    /** @todo Fixed images, they need all blocks allocated and the leave blocks allocated flag set. */
+    if (uImageFlags & VD_IMAGE_FLAGS_FIXED)
+        return VERR_VD_INVALID_TYPE;
+
+    if (   !cbSize
+        || cbSize % VHDX_CREATE_LOGICAL_SECTOR_SIZE
+        || cbSize > VHDX_VDISK_SIZE_MAX)
+        return VERR_VD_INVALID_SIZE;
+
+    /* Check open flags. All valid flags are supported. */
+    AssertReturn(!(uOpenFlags & ~VD_OPEN_FLAGS_MASK), VERR_INVALID_PARAMETER);
+    AssertReturn(   VALID_PTR(pszFilename)
+                 && *pszFilename
+                 && VALID_PTR(pPCHSGeometry)
+                 && VALID_PTR(pLCHSGeometry)
+                 && VALID_PTR(pUuid), VERR_INVALID_PARAMETER);
+
+    PVHDXIMAGE pImage = (PVHDXIMAGE)RTMemAllocZ(RT_UOFFSETOF(VHDXIMAGE, RegionList.aRegions[1]));
+    if (RT_LIKELY(pImage))
+    {
+        PVDINTERFACEPROGRESS pIfProgress = VDIfProgressGet(pVDIfsOperation);
+
+        pImage->pszFilename = pszFilename;
+        pImage->pStorage = NULL;
+        pImage->pVDIfsDisk = pVDIfsDisk;
+        pImage->pVDIfsImage = pVDIfsImage;
+
+        rc = vhdxCreateImage(pImage, cbSize, uImageFlags, pUuid, pPCHSGeometry, pLCHSGeometry,
+                             uOpenFlags, pIfProgress, uPercentStart, uPercentSpan);
+        if (RT_SUCCESS(rc))
+            *ppBackendData = pImage;
+        else
+        {
+            vhdxFreeImage(pImage, rc != VERR_ALREADY_EXISTS);
+            RTMemFree(pImage);
+        }
+    }
+    else
+        rc = VERR_NO_MEMORY;
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -2008,11 +3292,10 @@ static DECLCALLBACK(int) vhdxWrite(void *pBackendData, uint64_t uOffset,  size_t
                                    PVDIOCTX pIoCtx, size_t *pcbWriteProcess, size_t *pcbPreRead,
                                    size_t *pcbPostRead, unsigned fWrite)
 {
-    RT_NOREF5(pIoCtx, pcbWriteProcess, pcbPreRead, pcbPostRead, fWrite);
     LogFlowFunc(("pBackendData=%#p uOffset=%llu pIoCtx=%#p cbToWrite=%zu pcbWriteProcess=%#p pcbPreRead=%#p pcbPostRead=%#p\n",
                  pBackendData, uOffset, pIoCtx, cbToWrite, pcbWriteProcess, pcbPreRead, pcbPostRead));
     PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
-    int rc;
+    int rc = VINF_SUCCESS;
 
     AssertPtr(pImage);
     Assert(uOffset % 512 == 0);
@@ -2024,7 +3307,57 @@ static DECLCALLBACK(int) vhdxWrite(void *pBackendData, uint64_t uOffset,  size_t
              || cbToWrite == 0)
         rc = VERR_INVALID_PARAMETER;
     else
-        rc = VERR_NOT_SUPPORTED;
+    {
+        uint32_t idxBat = (uint32_t)(uOffset / pImage->cbBlock); Assert(idxBat == uOffset / pImage->cbBlock);
+        uint32_t offWrite = uOffset % pImage->cbBlock;
+        /* The last block might be only partially used by the disk. */
+        size_t cbBlock = (size_t)RT_MIN(pImage->cbBlock, pImage->cbSize - (uOffset - offWrite));
+        uint64_t uBatEntry;
+
+        idxBat += idxBat / pImage->uChunkRatio; /* Add interleaving sector bitmap entries. */
+        uBatEntry = pImage->paBat[idxBat].u64BatEntry;
+
+        cbToWrite = RT_MIN(cbToWrite, cbBlock - offWrite);
+
+        switch (VHDX_BAT_ENTRY_GET_STATE(uBatEntry))
+        {
+            case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_NOT_PRESENT:
+            case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_UNDEFINED:
+            case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_ZERO:
+            case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_UNMAPPED:
+            {
+                /* Allocate the block if the whole block is written, let the VD layer fill the rest otherwise. */
+                if (   cbToWrite == cbBlock
+                    && !(fWrite & VD_WRITE_NO_ALLOC))
+                {
+                    rc = vhdxBlockAlloc(pImage, pIoCtx, idxBat, cbToWrite);
+                    *pcbPreRead  = 0;
+                    *pcbPostRead = 0;
+                }
+                else
+                {
+                    *pcbPreRead  = offWrite;
+                    *pcbPostRead = cbBlock - cbToWrite - offWrite;
+                    rc = VERR_VD_BLOCK_FREE;
+                }
+                break;
+            }
+            case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT:
+            {
+                uint64_t offFile = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + offWrite;
+                rc = vdIfIoIntFileWriteUser(pImage->pIfIo, pImage->pStorage, offFile,
+                                            pIoCtx, cbToWrite, NULL, NULL);
+                break;
+            }
+            case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_PARTIALLY_PRESENT:
+            default:
+                rc = VERR_INVALID_PARAMETER;
+                break;
+        }
+
+        if (pcbWriteProcess)
+            *pcbWriteProcess = cbToWrite;
+    }
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -2033,15 +3366,15 @@ static DECLCALLBACK(int) vhdxWrite(void *pBackendData, uint64_t uOffset,  size_t
 /** @copydoc VDIMAGEBACKEND::pfnFlush */
 static DECLCALLBACK(int) vhdxFlush(void *pBackendData, PVDIOCTX pIoCtx)
 {
-    RT_NOREF1(pIoCtx);
     LogFlowFunc(("pBackendData=%#p pIoCtx=%#p\n", pBackendData, pIoCtx));
     PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
     int rc;
 
+    /* Metadata updates are flushed as part of the allocation, only the user data is left. */
     if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
         rc = VERR_VD_IMAGE_READ_ONLY;
     else
-        rc = VERR_NOT_SUPPORTED;
+        rc = vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage, pIoCtx, NULL, NULL);
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -2311,6 +3644,433 @@ static DECLCALLBACK(void) vhdxDump(void *pBackendData)
     }
 }
 
+/**
+ * Compares two file extents by their start offset, used for sorting.
+ */
+static DECLCALLBACK(int) vhdxFileExtentCmp(void const *pvElement1, void const *pvElement2, void *pvUser)
+{
+    PVHDXFILEEXTENT pExtent1 = (PVHDXFILEEXTENT)pvElement1;
+    PVHDXFILEEXTENT pExtent2 = (PVHDXFILEEXTENT)pvElement2;
+    RT_NOREF(pvUser);
+
+    if (pExtent1->offStart < pExtent2->offStart)
+        return -1;
+    if (pExtent1->offStart > pExtent2->offStart)
+        return 1;
+    return 0;
+}
+
+/**
+ * Checks whether the given payload block contains only zeros.
+ *
+ * @returns VBox status code.
+ * @param   pImage        Image instance data.
+ * @param   offFile       File offset of the block.
+ * @param   cbBlock       Number of bytes in use of the block.
+ * @param   pvBuf         Temporary buffer of _1M bytes.
+ * @param   pfZero        Where to store whether the block is all zero.
+ */
+static int vhdxBlockIsZero(PVHDXIMAGE pImage, uint64_t offFile, uint64_t cbBlock, void *pvBuf, bool *pfZero)
+{
+    int rc = VINF_SUCCESS;
+
+    *pfZero = true;
+    while (cbBlock && RT_SUCCESS(rc))
+    {
+        size_t cbThisRead = (size_t)RT_MIN(cbBlock, _1M);
+
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offFile, pvBuf, cbThisRead);
+        if (RT_SUCCESS(rc))
+        {
+            if (!ASMMemIsZero(pvBuf, cbThisRead))
+            {
+                *pfZero = false;
+                break;
+            }
+            offFile += cbThisRead;
+            cbBlock -= cbThisRead;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * Moves a payload block to a new location in the file and updates the BAT.
+ *
+ * @returns VBox status code.
+ * @param   pImage        Image instance data.
+ * @param   pExtent       The extent describing the block.
+ * @param   offNew        The new file offset.
+ * @param   pvBuf         Temporary buffer of _1M bytes.
+ */
+static int vhdxBlockMove(PVHDXIMAGE pImage, PVHDXFILEEXTENT pExtent, uint64_t offNew, void *pvBuf)
+{
+    int rc = VINF_SUCCESS;
+
+    for (uint64_t off = 0; off < pExtent->cbExtent && RT_SUCCESS(rc); off += _1M)
+    {
+        size_t cbThisCopy = (size_t)RT_MIN(pExtent->cbExtent - off, _1M);
+
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, pExtent->offStart + off,
+                                   pvBuf, cbThisCopy);
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, offNew + off,
+                                        pvBuf, cbThisCopy);
+    }
+
+    /* The copy must be on the disk before the BAT points to it, the old location stays valid until then. */
+    if (RT_SUCCESS(rc))
+        rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t u64BatEntryOld = pImage->paBat[pExtent->idxBat].u64BatEntry;
+
+        pImage->paBat[pExtent->idxBat].u64BatEntry = VHDX_BAT_ENTRY_CREATE(offNew, VHDX_BAT_ENTRY_GET_STATE(u64BatEntryOld));
+        rc = vhdxBatSectorUpdateSync(pImage, pExtent->idxBat);
+        if (RT_FAILURE(rc))
+            pImage->paBat[pExtent->idxBat].u64BatEntry = u64BatEntryOld;
+    }
+
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnCompact */
+static DECLCALLBACK(int) vhdxCompact(void *pBackendData, unsigned uPercentStart,
+                                     unsigned uPercentSpan, PVDINTERFACE pVDIfsDisk,
+                                     PVDINTERFACE pVDIfsImage, PVDINTERFACE pVDIfsOperation)
+{
+    RT_NOREF2(pVDIfsDisk, pVDIfsImage);
+    LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+    PVHDXFILEEXTENT paExtents = NULL;
+    void *pvBuf = NULL;
+    int rc = VINF_SUCCESS;
+
+    PVDINTERFACEPROGRESS pIfProgress = VDIfProgressGet(pVDIfsOperation);
+    PVDINTERFACEQUERYRANGEUSE pIfQueryRangeUse = VDIfQueryRangeUseGet(pVDIfsOperation);
+
+    AssertPtrReturn(pImage, VERR_INVALID_PARAMETER);
+
+    if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        return VERR_VD_IMAGE_READ_ONLY;
+
+    /* Blocks of fixed images must stay allocated. */
+    if (pImage->uImageFlags & VD_IMAGE_FLAGS_FIXED)
+        return VINF_SUCCESS;
+
+    pvBuf = RTMemTmpAlloc(_1M);
+    paExtents = (PVHDXFILEEXTENT)RTMemAllocZ((pImage->cBatEntries + 4) * sizeof(VHDXFILEEXTENT));
+    if (!pvBuf || !paExtents)
+        rc = VERR_NO_MEMORY;
+
+    /*
+     * Pass 1: Release all blocks which contain only zeros or are not in use by the
+     * guest and strip stale offsets from entries which are not present.
+     * Dirty BAT sectors are written when the loop leaves them.
+     */
+    if (RT_SUCCESS(rc))
+    {
+        uint32_t idxSectorDirty = UINT32_MAX;
+
+        for (uint32_t i = 0; i < pImage->cBatEntries && RT_SUCCESS(rc); i++)
+        {
+            if (   idxSectorDirty != UINT32_MAX
+                && i / VHDX_BAT_ENTRIES_PER_SECTOR != idxSectorDirty)
+            {
+                rc = vhdxBatSectorUpdateSync(pImage, idxSectorDirty * VHDX_BAT_ENTRIES_PER_SECTOR);
+                idxSectorDirty = UINT32_MAX;
+                if (RT_FAILURE(rc))
+                    break;
+            }
+
+            /* Skip sector bitmap entries. */
+            if ((i + 1) % (pImage->uChunkRatio + 1) == 0)
+                continue;
+
+            uint64_t uBatEntry = pImage->paBat[i].u64BatEntry;
+            if (VHDX_BAT_ENTRY_GET_STATE(uBatEntry) == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT)
+            {
+                uint64_t offBlock = (uint64_t)(i - i / (pImage->uChunkRatio + 1)) * pImage->cbBlock;
+                uint64_t cbBlock  = RT_MIN(pImage->cbBlock, pImage->cbSize - offBlock);
+                bool fFree = false;
+
+                if (pIfQueryRangeUse)
+                {
+                    bool fUsed = true;
+
+                    rc = vdIfQueryRangeUse(pIfQueryRangeUse, offBlock, cbBlock, &fUsed);
+                    fFree = !fUsed;
+                }
+
+                if (   RT_SUCCESS(rc)
+                    && !fFree)
+                    rc = vhdxBlockIsZero(pImage, VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry), cbBlock,
+                                         pvBuf, &fFree);
+
+                if (   RT_SUCCESS(rc)
+                    && fFree)
+                {
+                    pImage->paBat[i].u64BatEntry = VHDX_BAT_ENTRY_CREATE(0, VHDX_BAT_ENTRY_PAYLOAD_BLOCK_ZERO);
+                    idxSectorDirty = i / VHDX_BAT_ENTRIES_PER_SECTOR;
+                }
+            }
+            else if (VHDX_BAT_ENTRY_GET_FILE_OFFSET_MB(uBatEntry) != 0)
+            {
+                pImage->paBat[i].u64BatEntry = VHDX_BAT_ENTRY_CREATE(0, VHDX_BAT_ENTRY_GET_STATE(uBatEntry));
+                idxSectorDirty = i / VHDX_BAT_ENTRIES_PER_SECTOR;
+            }
+
+            vdIfProgress(pIfProgress, uPercentStart + (uint64_t)i * (uPercentSpan / 2) / pImage->cBatEntries);
+        }
+
+        if (   RT_SUCCESS(rc)
+            && idxSectorDirty != UINT32_MAX)
+            rc = vhdxBatSectorUpdateSync(pImage, idxSectorDirty * VHDX_BAT_ENTRIES_PER_SECTOR);
+    }
+
+    /*
+     * Pass 2: Collect everything occupying space in the file and move blocks from
+     * the end of the file into the holes until no block fits anymore.
+     */
+    if (RT_SUCCESS(rc))
+    {
+        uint32_t cExtents = 0;
+
+        /* The header section and the regions can't be moved. */
+        paExtents[cExtents].offStart = 0;
+        paExtents[cExtents].cbExtent = _1M;
+        paExtents[cExtents++].idxBat = UINT32_MAX;
+        paExtents[cExtents].offStart = pImage->Hdr.u64LogOffset;
+        paExtents[cExtents].cbExtent = pImage->Hdr.u32LogLength;
+        paExtents[cExtents++].idxBat = UINT32_MAX;
+        paExtents[cExtents].offStart = pImage->offBat;
+        paExtents[cExtents].cbExtent = pImage->cbBatRegion;
+        paExtents[cExtents++].idxBat = UINT32_MAX;
+        paExtents[cExtents].offStart = pImage->offMetadata;
+        paExtents[cExtents].cbExtent = pImage->cbMetadataRegion;
+        paExtents[cExtents++].idxBat = UINT32_MAX;
+
+        for (uint32_t i = 0; i < pImage->cBatEntries; i++)
+        {
+            uint64_t uBatEntry = pImage->paBat[i].u64BatEntry;
+
+            if ((i + 1) % (pImage->uChunkRatio + 1) == 0)
+            {
+                /* Sector bitmap blocks are left where they are. */
+                if (VHDX_BAT_ENTRY_GET_STATE(uBatEntry) == VHDX_BAT_ENTRY_SB_BLOCK_PRESENT)
+                {
+                    paExtents[cExtents].offStart = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry);
+                    paExtents[cExtents].cbExtent = _1M;
+                    paExtents[cExtents++].idxBat = UINT32_MAX;
+                }
+            }
+            else if (VHDX_BAT_ENTRY_GET_STATE(uBatEntry) == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT)
+            {
+                paExtents[cExtents].offStart = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry);
+                paExtents[cExtents].cbExtent = RT_ALIGN_64(pImage->cbBlock, _1M);
+                paExtents[cExtents++].idxBat = i;
+            }
+        }
+
+        RTSortShell(paExtents, cExtents, sizeof(VHDXFILEEXTENT), vhdxFileExtentCmp, NULL);
+
+        for (uint32_t i = 1; i < cExtents; i++)
+        {
+            if (paExtents[i].offStart < paExtents[i - 1].offStart + paExtents[i - 1].cbExtent)
+            {
+                rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                               "VHDX: Overlapping structures in image \'%s\', refusing to compact",
+                               pImage->pszFilename);
+                break;
+            }
+        }
+
+        uint32_t cBlocksMoved = 0;
+        while (   RT_SUCCESS(rc)
+               && cExtents > 1
+               && paExtents[cExtents - 1].idxBat != UINT32_MAX)
+        {
+            PVHDXFILEEXTENT pLast = &paExtents[cExtents - 1];
+            uint32_t idxHole = UINT32_MAX;
+            uint64_t offHole = 0;
+
+            /* Find the first hole the last block fits into. */
+            for (uint32_t i = 0; i < cExtents - 1; i++)
+            {
+                offHole = RT_ALIGN_64(paExtents[i].offStart + paExtents[i].cbExtent, _1M);
+                if (   offHole < paExtents[i + 1].offStart
+                    && paExtents[i + 1].offStart - offHole >= pLast->cbExtent)
+                {
+                    idxHole = i;
+                    break;
+                }
+            }
+
+            if (idxHole == UINT32_MAX)
+                break;
+
+            rc = vhdxBlockMove(pImage, pLast, offHole, pvBuf);
+            if (RT_SUCCESS(rc))
+            {
+                VHDXFILEEXTENT Extent = *pLast;
+
+                Extent.offStart = offHole;
+                memmove(&paExtents[idxHole + 2], &paExtents[idxHole + 1],
+                        (cExtents - 1 - (idxHole + 1)) * sizeof(VHDXFILEEXTENT));
+                paExtents[idxHole + 1] = Extent;
+                cBlocksMoved++;
+                vdIfProgress(pIfProgress, uPercentStart + uPercentSpan / 2
+                             + (uint64_t)cBlocksMoved * (uPercentSpan / 2) / cExtents);
+            }
+        }
+
+        /* Cut off the unused space at the end of the file. */
+        if (RT_SUCCESS(rc))
+        {
+            uint64_t cbFile = 0;
+            uint64_t cbFileNew = RT_ALIGN_64(paExtents[cExtents - 1].offStart + paExtents[cExtents - 1].cbExtent, _1M);
+
+            rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+            if (   RT_SUCCESS(rc)
+                && cbFileNew < cbFile)
+            {
+                /*
+                 * Record the new size in the log before truncating, replaying an older entry
+                 * would otherwise find the file smaller than recorded.
+                 */
+                pImage->offBlockNext  = cbFileNew;
+                pImage->cbFileFlushed = cbFileNew;
+                if (pImage->fLogActive)
+                    rc = vhdxBatSectorUpdateSync(pImage, 0);
+                if (RT_SUCCESS(rc))
+                    rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, cbFileNew);
+            }
+        }
+    }
+
+    if (RT_SUCCESS(rc))
+        vdIfProgress(pIfProgress, uPercentStart + uPercentSpan);
+
+    if (pvBuf)
+        RTMemTmpFree(pvBuf);
+    if (paExtents)
+        RTMemFree(paExtents);
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VDIMAGEBACKEND::pfnResize */
+static DECLCALLBACK(int) vhdxResize(void *pBackendData, uint64_t cbSize,
+                                    PCVDGEOMETRY pPCHSGeometry, PCVDGEOMETRY pLCHSGeometry,
+                                    unsigned uPercentStart, unsigned uPercentSpan,
+                                    PVDINTERFACE pVDIfsDisk, PVDINTERFACE pVDIfsImage,
+                                    PVDINTERFACE pVDIfsOperation)
+{
+    RT_NOREF7(pPCHSGeometry, pLCHSGeometry, uPercentStart, uPercentSpan, pVDIfsDisk, pVDIfsImage, pVDIfsOperation);
+    LogFlowFunc(("pBackendData=%#p cbSize=%llu\n", pBackendData, cbSize));
+    PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtrReturn(pImage, VERR_INVALID_PARAMETER);
+
+    if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        rc = VERR_VD_IMAGE_READ_ONLY;
+    else if (cbSize % pImage->cbLogicalSector)
+        rc = VERR_VD_INVALID_SIZE;
+    else if (cbSize < pImage->cbSize) /* Making the image smaller is not supported at the moment. */
+        rc = VERR_NOT_SUPPORTED;
+    else if (   cbSize > pImage->cbSize
+             && (pImage->uImageFlags & VD_IMAGE_FLAGS_FIXED))
+        rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                       "VHDX: Resizing the fixed image \'%s\' is not supported",
+                       pImage->pszFilename);
+    else if (cbSize > pImage->cbSize)
+    {
+        uint64_t cDataBlocks64 = cbSize / pImage->cbBlock;
+        if (cbSize % pImage->cbBlock)
+            cDataBlocks64++;
+        uint64_t cBatEntries64 = cDataBlocks64 + (cDataBlocks64 - 1) / pImage->uChunkRatio;
+
+        /*
+         * @todo: Relocating the BAT region if the new BAT doesn't fit into it is not
+         *        implemented, this requires moving the blocks following the BAT.
+         */
+        if (cBatEntries64 * sizeof(VhdxBatEntry) > pImage->cbBatRegion)
+            rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                           "VHDX: Resizing the image \'%s\' requires relocating the BAT which is not supported",
+                           pImage->pszFilename);
+        else
+        {
+            uint32_t cBatEntriesOld = pImage->cBatEntries;
+            uint32_t cBatEntriesNew = (uint32_t)cBatEntries64;
+            PVhdxBatEntry paBatNew = (PVhdxBatEntry)RTMemRealloc(pImage->paBat, cBatEntriesNew * sizeof(VhdxBatEntry));
+
+            if (paBatNew)
+            {
+                memset(&paBatNew[cBatEntriesOld], 0, (cBatEntriesNew - cBatEntriesOld) * sizeof(VhdxBatEntry));
+                pImage->paBat       = paBatNew;
+                pImage->cBatEntries = cBatEntriesNew;
+
+                /* The new entries are not present, write all BAT sectors they occupy. */
+                for (uint32_t idxSector = cBatEntriesOld / VHDX_BAT_ENTRIES_PER_SECTOR;
+                     idxSector <= (cBatEntriesNew - 1) / VHDX_BAT_ENTRIES_PER_SECTOR && RT_SUCCESS(rc);
+                     idxSector++)
+                    rc = vhdxBatSectorUpdateSync(pImage, idxSector * VHDX_BAT_ENTRIES_PER_SECTOR);
+
+                /* Update the virtual disk size metadata item. */
+                if (RT_SUCCESS(rc))
+                {
+                    uint64_t offSector = pImage->offVDiskSize & ~(uint64_t)(VHDX_LOG_SECTOR_SIZE - 1);
+                    uint8_t *pbSector = (uint8_t *)RTMemTmpAlloc(VHDX_LOG_SECTOR_SIZE);
+
+                    if (pImage->offVDiskSize + sizeof(VhdxVDiskSize) > offSector + VHDX_LOG_SECTOR_SIZE)
+                        rc = VERR_NOT_SUPPORTED;
+                    else if (!pbSector)
+                        rc = VERR_NO_MEMORY;
+                    else
+                    {
+                        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offSector,
+                                                   pbSector, VHDX_LOG_SECTOR_SIZE);
+                        if (RT_SUCCESS(rc))
+                        {
+                            VhdxVDiskSize VDiskSize;
+
+                            RT_ZERO(VDiskSize);
+                            VDiskSize.u64VDiskSize = cbSize;
+                            vhdxConvVDiskSizeEndianess(VHDXECONV_H2F, &VDiskSize, &VDiskSize);
+                            memcpy(pbSector + (pImage->offVDiskSize - offSector), &VDiskSize, sizeof(VDiskSize));
+                            rc = vhdxMetaSectorUpdateSync(pImage, offSector, pbSector);
+                        }
+                    }
+
+                    if (pbSector)
+                        RTMemTmpFree(pbSector);
+                }
+
+                if (RT_SUCCESS(rc))
+                {
+                    pImage->cbSize = cbSize;
+                    pImage->RegionList.aRegions[0].cRegionBlocksOrBytes = cbSize;
+                }
+                else
+                {
+                    pImage->cBatEntries = cBatEntriesOld;
+                    rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                                   "VHDX: Resizing the image \'%s\' failed",
+                                   pImage->pszFilename);
+                }
+            }
+            else
+                rc = VERR_NO_MEMORY;
+        }
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
 
 const VDIMAGEBACKEND g_VhdxBackend =
 {
@@ -2319,7 +4079,7 @@ const VDIMAGEBACKEND g_VhdxBackend =
     /* pszBackendName */
     "VHDX",
     /* uBackendCaps */
-    VD_CAP_FILE | VD_CAP_VFS,
+    VD_CAP_CREATE_DYNAMIC | VD_CAP_FILE | VD_CAP_VFS | VD_CAP_ASYNC,
     /* paFileExtensions */
     s_aVhdxFileExtensions,
     /* paConfigInfo */
@@ -2401,9 +4161,9 @@ const VDIMAGEBACKEND g_VhdxBackend =
     /* pfnComposeName */
     genericFileComposeName,
     /* pfnCompact */
-    NULL,
+    vhdxCompact,
     /* pfnResize */
-    NULL,
+    vhdxResize,
     /* pfnRepair */
     NULL,
     /* pfnTraverseMetadata */
@@ -32,8 +32,12 @@
 #include <iprt/rand.h>
 #include <iprt/zip.h>
 #include <iprt/asm.h>
+#include <iprt/mp.h>
+#include <iprt/req.h>
+#include <iprt/semaphore.h>
 
 #include "VDBackends.h"
+#include "VDMetaCache.h"
 
 
 /*********************************************************************************************************************************
@@ -293,6 +297,9 @@ typedef struct VMDKEXTENT
     void        *pvCompGrain;
     /** Decompressed grain buffer for streamOptimized extents. */
     void        *pvGrain;
+    /** Parallel grain compression state for writing streamOptimized extents,
+     * NULL if the grains are compressed in the context of the write. */
+    struct VMDKDEFLATE *pDeflate;
     /** Reference to the image in which this extent is used. Do not use this
      * on a regular basis to avoid passing pImage references to functions
      * explicitly. */
@@ -300,7 +307,9 @@ typedef struct VMDKEXTENT
 } VMDKEXTENT, *PVMDKEXTENT;
 
 /**
- * Grain table cache size. Allocated per image.
+ * Grain table buffer size in cache lines for writing streamOptimized images.
+ * Allocated per image. Also determines the default memory budget of the grain
+ * table cache.
  */
 #define VMDK_GT_CACHE_SIZE 256
 
@@ -311,6 +320,28 @@ typedef struct VMDKEXTENT
  */
 #define VMDK_GT_CACHELINE_SIZE 128
 
+/**
+ * Default amount of memory the grain table cache is allowed to use,
+ * see VD_METACACHE_CFGKEY_SIZE.
+ */
+#define VMDK_GT_CACHE_MEMORY_DEFAULT (VMDK_GT_CACHE_SIZE * VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t))
+
+/**
+ * Key of a grain table block in the grain table cache.
+ */
+#define VMDK_GT_CACHE_KEY(a_uExtent, a_uGTBlock) (((uint64_t)(a_uExtent) << 48) | (a_uGTBlock))
+
+/**
+ * Maximum number of threads compressing grains when writing streamOptimized
+ * images, see the DeflateThreads configuration key.
+ */
+#define VMDK_DEFLATE_THREADS_MAX 16
+
+/**
+ * Number of grains which can be queued for compression per thread.
+ */
+#define VMDK_DEFLATE_GRAINS_PER_THREAD 4
+
 
 /**
  * Maximum number of lines in a descriptor file. Not worth the effort of
@@ -346,8 +377,7 @@ typedef struct VMDKDESCRIPTOR
 
 
 /**
- * Cache entry for translating extent/sector to a sector number in that
- * extent.
+ * Grain table buffer line for writing streamOptimized images.
  */
 typedef struct VMDKGTCACHEENTRY
 {
@@ -360,10 +390,9 @@ typedef struct VMDKGTCACHEENTRY
 } VMDKGTCACHEENTRY, *PVMDKGTCACHEENTRY;
 
 /**
- * Cache data structure for blocks of grain table entries. For now this is a
- * fixed size direct mapping cache, but this should be adapted to the size of
- * the sparse image and maybe converted to a set-associative cache. The
- * implementation below implements a write-through cache with write allocate.
+ * Buffer holding a complete grain table while writing streamOptimized images.
+ * Lookups of grain table entries go through the grain table cache, which is a
+ * write-through cache with write allocate.
  */
 typedef struct VMDKGTCACHE
 {
@@ -432,8 +461,10 @@ typedef struct VMDKIMAGE
     /** Parent image modification UUID. */
     RTUUID          ParentModificationUuid;
 
-    /** Pointer to grain table cache, if this image contains sparse extents. */
+    /** Pointer to the grain table buffer, if this is a streamOptimized image. */
     PVMDKGTCACHE    pGTCache;
+    /** The grain table cache, if this image contains sparse extents. */
+    PVDMETACACHE    pGTBlockCache;
     /** Pointer to the descriptor (NULL if no separate descriptor file). */
     char            *pDescData;
     /** Allocation size of the descriptor file. */
@@ -458,6 +489,61 @@ typedef struct VMDKCOMPRESSIO
     void *pvCompGrain;
 } VMDKCOMPRESSIO;
 
+/**
+ * Grain queued for compression when writing a streamOptimized image.
+ */
+typedef struct VMDKDEFLATEGRAIN
+{
+    /** The compression state this grain belongs to. */
+    struct VMDKDEFLATE *pDeflate;
+    /** Sector of the grain in the extent, stored in the grain marker. */
+    uint64_t    uSector;
+    /** The uncompressed grain data. */
+    void        *pvGrain;
+    /** The compressed grain with the marker. */
+    void        *pvCompGrain;
+    /** Size of the compressed grain including marker and padding. */
+    uint32_t    cbMarkerData;
+    /** Status of the compression. */
+    int         rc;
+    /** Flag whether the compression has finished. */
+    volatile bool fDone;
+} VMDKDEFLATEGRAIN;
+/** Pointer to a grain queued for compression. */
+typedef VMDKDEFLATEGRAIN *PVMDKDEFLATEGRAIN;
+
+/**
+ * Parallel grain compression state for writing streamOptimized extents.
+ *
+ * Grains are copied into a ring of slots and compressed by a request pool.
+ * The compressed grains are written strictly in submission order, which
+ * determines their position in the image, so the result is identical to
+ * compressing them one after another.
+ */
+typedef struct VMDKDEFLATE
+{
+    /** The extent the grains are written to. */
+    PVMDKEXTENT pExtent;
+    /** Request pool compressing the grains. */
+    RTREQPOOL   hReqPool;
+    /** Event signalled whenever a grain was compressed. */
+    RTSEMEVENT  hEvtDone;
+    /** Size of the compressed grain buffers. */
+    size_t      cbCompGrain;
+    /** Sticky status of a failed compression or write. */
+    int         rcSticky;
+    /** Number of grains submitted for compression. */
+    uint32_t    cSubmitted;
+    /** Number of grains written to the image. */
+    uint32_t    cWritten;
+    /** Number of grain slots. */
+    uint32_t    cGrains;
+    /** The grain slots, used as a ring. */
+    VMDKDEFLATEGRAIN aGrains[1];
+} VMDKDEFLATE;
+/** Pointer to the parallel grain compression state. */
+typedef VMDKDEFLATE *PVMDKDEFLATE;
+
 
 /** Tracks async grain allocation. */
 typedef struct VMDKGRAINALLOCASYNC
@@ -531,6 +617,19 @@ static const VDFILEEXTENSION s_aVmdkFileExtensions[] =
     {NULL, VDTYPE_INVALID}
 };
 
+static const char *s_pszVmdkMetaCacheSizeDefault    = "131072";
+static const char *s_pszVmdkMetaCacheSizeMaxDefault = "33554432";
+static const char *s_pszVmdkDeflateThreadsDefault   = "0";
+
+/** Configuration keys for the grain table cache and streamOptimized writing. */
+static const VDCONFIGINFO s_aVmdkConfigInfo[] =
+{
+    { VD_METACACHE_CFGKEY_SIZE,       s_pszVmdkMetaCacheSizeDefault,       VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { VD_METACACHE_CFGKEY_SIZE_MAX,   s_pszVmdkMetaCacheSizeMaxDefault,    VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { "DeflateThreads",               s_pszVmdkDeflateThreadsDefault,      VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { NULL,                           NULL,                                VDCFGVALUETYPE_INTEGER, 0 }
+};
+
 
 /*********************************************************************************************************************************
 *   Internal Functions                                                                                                           *
@@ -830,13 +929,12 @@ static DECLCALLBACK(int) vmdkFileDeflateHelper(void *pvUser, const void *pvBuf,
 }
 
 /**
- * Internal: deflate the uncompressed data and write to a file,
- * distinguishing between async and normal operation
+ * Internal: deflate the uncompressed data into the given buffer, prepending
+ * the compressed grain marker and padding the result to a full sector.
  */
-DECLINLINE(int) vmdkFileDeflateSync(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
-                                    uint64_t uOffset, const void *pvBuf,
-                                    size_t cbToWrite, uint64_t uLBA,
-                                    uint32_t *pcbMarkerData)
+static int vmdkDeflateGrain(PVMDKIMAGE pImage, void *pvCompGrain, size_t cbCompGrain,
+                            const void *pvBuf, size_t cbToWrite, uint64_t uLBA,
+                            uint32_t *pcbMarkerData)
 {
     int rc;
     PRTZIPCOMP pZip = NULL;
@@ -844,8 +942,8 @@ DECLINLINE(int) vmdkFileDeflateSync(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
 
     DeflateState.pImage = pImage;
     DeflateState.iOffset = -1;
-    DeflateState.cbCompGrain = pExtent->cbCompGrain;
-    DeflateState.pvCompGrain = pExtent->pvCompGrain;
+    DeflateState.cbCompGrain = cbCompGrain;
+    DeflateState.pvCompGrain = pvCompGrain;
 
     rc = RTZipCompCreate(&pZip, &DeflateState, vmdkFileDeflateHelper,
                          RTZIPTYPE_ZLIB, RTZIPLEVEL_DEFAULT);
@@ -865,27 +963,261 @@ DECLINLINE(int) vmdkFileDeflateSync(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
         if (uSize % 512)
         {
             uint32_t uSizeAlign = RT_ALIGN(uSize, 512);
-            memset((uint8_t *)pExtent->pvCompGrain + uSize, '\0',
+            memset((uint8_t *)pvCompGrain + uSize, '\0',
                    uSizeAlign - uSize);
             uSize = uSizeAlign;
         }
 
-        if (pcbMarkerData)
-            *pcbMarkerData = uSize;
+        *pcbMarkerData = uSize;
 
         /* Compressed grain marker. Data follows immediately. */
-        VMDKMARKER *pMarker = (VMDKMARKER *)pExtent->pvCompGrain;
+        VMDKMARKER *pMarker = (VMDKMARKER *)pvCompGrain;
         pMarker->uSector = RT_H2LE_U64(uLBA);
         pMarker->cbSize = RT_H2LE_U32(  DeflateState.iOffset
                                       - RT_UOFFSETOF(VMDKMARKER, uType));
+    }
+    return rc;
+}
+
+/**
+ * Internal: deflate the uncompressed data and write to a file,
+ * distinguishing between async and normal operation
+ */
+DECLINLINE(int) vmdkFileDeflateSync(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
+                                    uint64_t uOffset, const void *pvBuf,
+                                    size_t cbToWrite, uint64_t uLBA,
+                                    uint32_t *pcbMarkerData)
+{
+    uint32_t uSize = 0;
+    int rc = vmdkDeflateGrain(pImage, pExtent->pvCompGrain, pExtent->cbCompGrain,
+                              pvBuf, cbToWrite, uLBA, &uSize);
+    if (RT_SUCCESS(rc))
+    {
+        if (pcbMarkerData)
+            *pcbMarkerData = uSize;
+
         rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pExtent->pFile->pStorage,
-                                    uOffset, pMarker, uSize);
+                                    uOffset, pExtent->pvCompGrain, uSize);
+    }
+    return rc;
+}
+
+/**
+ * Internal: request pool worker compressing a grain of a streamOptimized image.
+ */
+static DECLCALLBACK(void) vmdkStreamDeflateWorker(PVMDKDEFLATEGRAIN pGrain)
+{
+    PVMDKDEFLATE pDeflate = pGrain->pDeflate;
+    PVMDKEXTENT pExtent = pDeflate->pExtent;
+
+    pGrain->rc = vmdkDeflateGrain(pExtent->pImage, pGrain->pvCompGrain, pDeflate->cbCompGrain,
+                                  pGrain->pvGrain, VMDK_SECTOR2BYTE(pExtent->cSectorsPerGrain),
+                                  pGrain->uSector, &pGrain->cbMarkerData);
+    ASMAtomicWriteBool(&pGrain->fDone, true);
+    RTSemEventSignal(pDeflate->hEvtDone);
+}
+
+/**
+ * Internal: waits until all grains submitted for compression are processed and
+ * frees the parallel grain compression state of the given extent. Pending
+ * grains are discarded.
+ */
+static void vmdkStreamDeflateDestroy(PVMDKEXTENT pExtent)
+{
+    PVMDKDEFLATE pDeflate = pExtent->pDeflate;
+
+    if (!pDeflate)
+        return;
+
+    for (uint32_t i = pDeflate->cWritten; i != pDeflate->cSubmitted; i++)
+    {
+        PVMDKDEFLATEGRAIN pGrain = &pDeflate->aGrains[i % pDeflate->cGrains];
+        while (!ASMAtomicReadBool(&pGrain->fDone))
+            RTSemEventWait(pDeflate->hEvtDone, RT_INDEFINITE_WAIT);
+    }
+
+    if (pDeflate->hReqPool != NIL_RTREQPOOL)
+        RTReqPoolRelease(pDeflate->hReqPool);
+    if (pDeflate->hEvtDone != NIL_RTSEMEVENT)
+        RTSemEventDestroy(pDeflate->hEvtDone);
+    for (uint32_t i = 0; i < pDeflate->cGrains; i++)
+    {
+        if (pDeflate->aGrains[i].pvGrain)
+            RTMemFree(pDeflate->aGrains[i].pvGrain);
+        if (pDeflate->aGrains[i].pvCompGrain)
+            RTMemFree(pDeflate->aGrains[i].pvCompGrain);
+    }
+    RTMemFree(pDeflate);
+    pExtent->pDeflate = NULL;
+}
+
+/**
+ * Internal: sets up parallel grain compression for writing the given
+ * streamOptimized extent, unless configured to compress in the context
+ * of the write.
+ */
+static int vmdkStreamDeflateCreate(PVMDKIMAGE pImage, PVMDKEXTENT pExtent)
+{
+    PVDINTERFACECONFIG pImgCfg = VDIfConfigGet(pImage->pVDIfsImage);
+    uint32_t cThreads = 0;
+
+    if (pImgCfg)
+    {
+        int rc = VDCFGQueryU32Def(pImgCfg, "DeflateThreads", &cThreads, 0);
         if (RT_FAILURE(rc))
-            return rc;
+            return vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                             N_("VMDK: Querying the number of compression threads for '%s' failed"),
+                             pImage->pszFilename);
     }
+
+    if (!cThreads)
+        cThreads = RTMpGetOnlineCount();
+    cThreads = RT_MIN(cThreads, VMDK_DEFLATE_THREADS_MAX);
+    if (cThreads <= 1)
+        return VINF_SUCCESS;
+
+    uint32_t cGrains = cThreads * VMDK_DEFLATE_GRAINS_PER_THREAD;
+    PVMDKDEFLATE pDeflate = (PVMDKDEFLATE)RTMemAllocZ(RT_UOFFSETOF_DYN(VMDKDEFLATE, aGrains[cGrains]));
+    if (!pDeflate)
+        return VERR_NO_MEMORY;
+
+    pDeflate->pExtent     = pExtent;
+    pDeflate->hReqPool    = NIL_RTREQPOOL;
+    pDeflate->hEvtDone    = NIL_RTSEMEVENT;
+    pDeflate->cbCompGrain = pExtent->cbCompGrain;
+    pDeflate->rcSticky    = VINF_SUCCESS;
+    pDeflate->cGrains     = cGrains;
+    pExtent->pDeflate     = pDeflate;
+
+    int rc = VINF_SUCCESS;
+    for (uint32_t i = 0; i < cGrains && RT_SUCCESS(rc); i++)
+    {
+        PVMDKDEFLATEGRAIN pGrain = &pDeflate->aGrains[i];
+
+        pGrain->pDeflate    = pDeflate;
+        pGrain->fDone       = true;
+        pGrain->pvGrain     = RTMemAlloc(VMDK_SECTOR2BYTE(pExtent->cSectorsPerGrain));
+        pGrain->pvCompGrain = RTMemAlloc(pDeflate->cbCompGrain);
+        if (!pGrain->pvGrain || !pGrain->pvCompGrain)
+            rc = VERR_NO_MEMORY;
+    }
+
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pDeflate->hEvtDone);
+    if (RT_SUCCESS(rc))
+    {
+        char szName[32];
+        RTStrPrintf(szName, sizeof(szName), "VmdkDefl-%RX32", (uint32_t)(uintptr_t)pImage);
+        rc = RTReqPoolCreate(cThreads, RT_MS_30SEC, UINT32_MAX, 1, szName, &pDeflate->hReqPool);
+    }
+
+    if (RT_FAILURE(rc))
+        vmdkStreamDeflateDestroy(pExtent);
+    return rc;
+}
+
+/**
+ * Internal: writes the compressed grains to the image in submission order
+ * and enters them into the grain table buffer.
+ *
+ * @returns VBox status code.
+ * @param   pImage      The VMDK image instance.
+ * @param   pExtent     The streamOptimized extent.
+ * @param   fWait       Flag whether to wait for all submitted grains, otherwise
+ *                      only the grains which are already compressed are written.
+ */
+static int vmdkStreamDeflateFlush(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, bool fWait)
+{
+    PVMDKDEFLATE pDeflate = pExtent->pDeflate;
+    int rc = pDeflate->rcSticky;
+
+    while (   RT_SUCCESS(rc)
+           && pDeflate->cWritten != pDeflate->cSubmitted)
+    {
+        PVMDKDEFLATEGRAIN pGrain = &pDeflate->aGrains[pDeflate->cWritten % pDeflate->cGrains];
+        if (!ASMAtomicReadBool(&pGrain->fDone))
+        {
+            if (!fWait)
+                break;
+            RTSemEventWait(pDeflate->hEvtDone, RT_INDEFINITE_WAIT);
+            continue;
+        }
+
+        rc = pGrain->rc;
+        if (RT_SUCCESS(rc))
+        {
+            uint32_t uGrain = pGrain->uSector / pExtent->cSectorsPerGrain;
+            uint32_t uCacheLine = uGrain % pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE;
+            uint32_t uCacheEntry = uGrain % VMDK_GT_CACHELINE_SIZE;
+            /* Align to sector, as the previous write could have been any size. */
+            uint64_t uFileOffset = RT_ALIGN_64(pExtent->uAppendPosition, 512);
+
+            if (pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry])
+                rc = VERR_INTERNAL_ERROR;
+            else
+            {
+                pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry] = VMDK_BYTE2SECTOR(uFileOffset);
+                rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pExtent->pFile->pStorage,
+                                            uFileOffset, pGrain->pvCompGrain, pGrain->cbMarkerData);
+                if (RT_SUCCESS(rc))
+                    pExtent->uAppendPosition += pGrain->cbMarkerData;
+            }
+        }
+
+        pDeflate->cWritten++;
+        if (RT_FAILURE(rc))
+        {
+            pDeflate->rcSticky = rc;
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("VMDK: cannot write compressed data block in '%s'"), pExtent->pszFullname);
+        }
+    }
+
     return rc;
 }
 
+/**
+ * Internal: queues a grain for compression, writing out the grains which were
+ * compressed in the meantime. The data is copied, so the I/O context can be
+ * completed right away.
+ */
+static int vmdkStreamDeflateSubmit(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, PVDIOCTX pIoCtx,
+                                   uint64_t uSector, size_t cbWrite)
+{
+    PVMDKDEFLATE pDeflate = pExtent->pDeflate;
+    int rc = vmdkStreamDeflateFlush(pImage, pExtent, false /* fWait */);
+
+    /* Wait for the oldest grain if all slots are in use. */
+    while (   RT_SUCCESS(rc)
+           && pDeflate->cSubmitted - pDeflate->cWritten == pDeflate->cGrains)
+    {
+        PVMDKDEFLATEGRAIN pGrain = &pDeflate->aGrains[pDeflate->cWritten % pDeflate->cGrains];
+        while (!ASMAtomicReadBool(&pGrain->fDone))
+            RTSemEventWait(pDeflate->hEvtDone, RT_INDEFINITE_WAIT);
+        rc = vmdkStreamDeflateFlush(pImage, pExtent, false /* fWait */);
+    }
+    if (RT_FAILURE(rc))
+        return rc;
+
+    PVMDKDEFLATEGRAIN pGrain = &pDeflate->aGrains[pDeflate->cSubmitted % pDeflate->cGrains];
+    size_t cbGrain = VMDK_SECTOR2BYTE(pExtent->cSectorsPerGrain);
+
+    vdIfIoIntIoCtxCopyFrom(pImage->pIfIo, pIoCtx, pGrain->pvGrain, cbWrite);
+    if (cbWrite < cbGrain)
+        memset((uint8_t *)pGrain->pvGrain + cbWrite, '\0', cbGrain - cbWrite);
+    pGrain->uSector      = uSector;
+    pGrain->cbMarkerData = 0;
+    pGrain->rc           = VINF_SUCCESS;
+    ASMAtomicWriteBool(&pGrain->fDone, false);
+    pDeflate->cSubmitted++;
+
+    rc = RTReqPoolCallEx(pDeflate->hReqPool, 0 /*cMillies*/, NULL /*phReq*/,
+                         RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
+                         (PFNRT)vmdkStreamDeflateWorker, 1, pGrain);
+    if (RT_FAILURE(rc))
+        vmdkStreamDeflateWorker(pGrain);
+
+    return VINF_SUCCESS;
+}
 
 /**
  * Internal: check if all files are closed, prevent leaking resources.
@@ -2905,6 +3237,7 @@ static int vmdkWriteMetaSparseExtent(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
  */
 static void vmdkFreeStreamBuffers(PVMDKEXTENT pExtent)
 {
+    vmdkStreamDeflateDestroy(pExtent);
     if (pExtent->pvCompGrain)
     {
         RTMemFree(pExtent->pvCompGrain);
@@ -2967,25 +3300,38 @@ static int vmdkFreeExtentData(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
 static int vmdkAllocateGrainTableCache(PVMDKIMAGE pImage)
 {
     PVMDKEXTENT pExtent;
+    uint64_t cbGTsAll = 0;
 
-    /* Allocate grain table cache if any sparse extent is present. */
+    /* Allocate grain table cache if any sparse extent is present, there is
+     * no point in caching more than all grain tables of the image. */
     for (unsigned i = 0; i < pImage->cExtents; i++)
     {
         pExtent = &pImage->pExtents[i];
         if (pExtent->enmType == VMDKETYPE_HOSTED_SPARSE)
+            cbGTsAll += (uint64_t)pExtent->cGDEntries * pExtent->cGTEntries * sizeof(uint32_t);
+    }
+
+    if (!cbGTsAll)
+        return VINF_SUCCESS;
+
+    int rc = vdMetaCacheCreate(&pImage->pGTBlockCache, pImage->pVDIfsImage, sizeof(VDMETACACHEENTRY),
+                               VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t), VMDK_GT_CACHE_MEMORY_DEFAULT,
+                               (size_t)RT_MIN(cbGTsAll, (uint64_t)~(size_t)0));
+    if (RT_FAILURE(rc))
+        return rc;
+
+    if (pImage->uImageFlags & VD_VMDK_IMAGE_FLAGS_STREAM_OPTIMIZED)
+    {
+        /* Allocate grain table buffer for streamOptimized writes. */
+        pImage->pGTCache = (PVMDKGTCACHE)RTMemAllocZ(sizeof(VMDKGTCACHE));
+        if (!pImage->pGTCache)
+            return VERR_NO_MEMORY;
+        for (unsigned j = 0; j < VMDK_GT_CACHE_SIZE; j++)
         {
-            /* Allocate grain table cache. */
-            pImage->pGTCache = (PVMDKGTCACHE)RTMemAllocZ(sizeof(VMDKGTCACHE));
-            if (!pImage->pGTCache)
-                return VERR_NO_MEMORY;
-            for (unsigned j = 0; j < VMDK_GT_CACHE_SIZE; j++)
-            {
-                PVMDKGTCACHEENTRY pGCE = &pImage->pGTCache->aGTCache[j];
-                pGCE->uExtent = UINT32_MAX;
-            }
-            pImage->pGTCache->cEntries = VMDK_GT_CACHE_SIZE;
-            break;
+            PVMDKGTCACHEENTRY pGCE = &pImage->pGTCache->aGTCache[j];
+            pGCE->uExtent = UINT32_MAX;
         }
+        pImage->pGTCache->cEntries = VMDK_GT_CACHE_SIZE;
     }
 
     return VINF_SUCCESS;
@@ -3940,6 +4286,10 @@ static int vmdkCreateStreamImage(PVMDKIMAGE pImage, uint64_t cbSize)
     if (RT_FAILURE(rc))
         return vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("VMDK: could not create new grain directory in '%s'"), pExtent->pszFullname);
 
+    rc = vmdkStreamDeflateCreate(pImage, pExtent);
+    if (RT_FAILURE(rc))
+        return vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("VMDK: could not set up grain compression for '%s'"), pExtent->pszFullname);
+
     rc = vmdkDescBaseSetStr(pImage, &pImage->Descriptor, "createType",
                             "streamOptimized");
     if (RT_FAILURE(rc))
@@ -4294,6 +4644,11 @@ static int vmdkFreeImage(PVMDKIMAGE pImage, bool fDelete, bool fFlush)
             {
                 PVMDKEXTENT pExtent = &pImage->pExtents[0];
                 uint32_t uLastGDEntry = pExtent->uLastGrainAccess / pExtent->cGTEntries;
+                if (pExtent->pDeflate)
+                {
+                    rc = vmdkStreamDeflateFlush(pImage, pExtent, true /* fWait */);
+                    AssertRC(rc);
+                }
                 rc = vmdkStreamFlushGT(pImage, pExtent, uLastGDEntry);
                 AssertRC(rc);
                 vmdkStreamClearGT(pImage, pExtent);
@@ -4388,6 +4743,11 @@ static int vmdkFreeImage(PVMDKIMAGE pImage, bool fDelete, bool fFlush)
             RTMemFree(pImage->pGTCache);
             pImage->pGTCache = NULL;
         }
+        if (pImage->pGTBlockCache)
+        {
+            vdMetaCacheDestroy(pImage->pGTBlockCache);
+            pImage->pGTBlockCache = NULL;
+        }
         if (pImage->pDescData)
         {
             RTMemFree(pImage->pDescData);
@@ -4416,6 +4776,15 @@ static int vmdkFlushImage(PVMDKIMAGE pImage, PVDIOCTX pIoCtx)
         for (unsigned i = 0; i < pImage->cExtents; i++)
         {
             pExtent = &pImage->pExtents[i];
+
+            /* Write out the grains still being compressed for streamOptimized images. */
+            if (pExtent->pDeflate)
+            {
+                rc = vmdkStreamDeflateFlush(pImage, pExtent, true /* fWait */);
+                if (RT_FAILURE(rc))
+                    break;
+            }
+
             if (pExtent->pFile != NULL && pExtent->fMetaDirty)
             {
                 switch (pExtent->enmType)
@@ -4503,17 +4872,6 @@ static int vmdkFindExtent(PVMDKIMAGE pImage, uint64_t offSector,
     return rc;
 }
 
-/**
- * Internal. Hash function for placing the grain table hash entries.
- */
-static uint32_t vmdkGTCacheHash(PVMDKGTCACHE pCache, uint64_t uSector,
-                                unsigned uExtent)
-{
-    /** @todo this hash function is quite simple, maybe use a better one which
-     * scrambles the bits better. */
-    return (uSector + uExtent) % pCache->cEntries;
-}
-
 /**
  * Internal. Get sector number in the extent file from the relative sector
  * number in the extent.
@@ -4522,11 +4880,10 @@ static int vmdkGetSector(PVMDKIMAGE pImage, PVDIOCTX pIoCtx,
                          PVMDKEXTENT pExtent, uint64_t uSector,
                          uint64_t *puExtentSector)
 {
-    PVMDKGTCACHE pCache = pImage->pGTCache;
-    uint64_t uGDIndex, uGTSector, uGTBlock;
-    uint32_t uGTHash, uGTBlockIndex;
-    PVMDKGTCACHEENTRY pGTCacheEntry;
-    uint32_t aGTDataTmp[VMDK_GT_CACHELINE_SIZE];
+    PVDMETACACHE pCache = pImage->pGTBlockCache;
+    uint64_t uGDIndex, uGTSector, uGTBlock, uGTKey;
+    uint32_t uGTBlockIndex;
+    PVDMETACACHEENTRY pGTCacheEntry;
     int rc;
 
     /* For newly created and readonly/sequentially opened streamOptimized
@@ -4554,27 +4911,35 @@ static int vmdkGetSector(PVMDKIMAGE pImage, PVDIOCTX pIoCtx,
     }
 
     uGTBlock = uSector / (pExtent->cSectorsPerGrain * VMDK_GT_CACHELINE_SIZE);
-    uGTHash = vmdkGTCacheHash(pCache, uGTBlock, pExtent->uExtent);
-    pGTCacheEntry = &pCache->aGTCache[uGTHash];
-    if (    pGTCacheEntry->uExtent != pExtent->uExtent
-        ||  pGTCacheEntry->uGTBlock != uGTBlock)
+    uGTKey = VMDK_GT_CACHE_KEY(pExtent->uExtent, uGTBlock);
+    pGTCacheEntry = vdMetaCacheRetain(pCache, uGTKey);
+    if (!pGTCacheEntry)
     {
         /* Cache miss, fetch data from disk. */
+        pGTCacheEntry = vdMetaCacheEntryAlloc(pCache);
+        if (!pGTCacheEntry)
+            return VERR_NO_MEMORY;
+
+        uint32_t *paGTData = (uint32_t *)pGTCacheEntry->pvData;
         PVDMETAXFER pMetaXfer;
         rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pExtent->pFile->pStorage,
-                                   VMDK_SECTOR2BYTE(uGTSector) + (uGTBlock % (pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE)) * sizeof(aGTDataTmp),
-                                   aGTDataTmp, sizeof(aGTDataTmp), pIoCtx, &pMetaXfer, NULL, NULL);
+                                   VMDK_SECTOR2BYTE(uGTSector) + (uGTBlock % (pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE)) * VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t),
+                                   paGTData, VMDK_GT_CACHELINE_SIZE * sizeof(uint32_t), pIoCtx, &pMetaXfer, NULL, NULL);
         if (RT_FAILURE(rc))
+        {
+            vdMetaCacheEntryRelease(pGTCacheEntry);
+            vdMetaCacheEntryFree(pCache, pGTCacheEntry);
             return rc;
+        }
         /* We can release the metadata transfer immediately. */
         vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
-        pGTCacheEntry->uExtent = pExtent->uExtent;
-        pGTCacheEntry->uGTBlock = uGTBlock;
         for (unsigned i = 0; i < VMDK_GT_CACHELINE_SIZE; i++)
-            pGTCacheEntry->aGTData[i] = RT_LE2H_U32(aGTDataTmp[i]);
+            paGTData[i] = RT_LE2H_U32(paGTData[i]);
+        vdMetaCacheEntryInsert(pCache, pGTCacheEntry, uGTKey, uGTBlock);
     }
     uGTBlockIndex = (uSector / pExtent->cSectorsPerGrain) % VMDK_GT_CACHELINE_SIZE;
-    uint32_t uGrainSector = pGTCacheEntry->aGTData[uGTBlockIndex];
+    uint32_t uGrainSector = ((uint32_t *)pGTCacheEntry->pvData)[uGTBlockIndex];
+    vdMetaCacheEntryRelease(pGTCacheEntry);
     if (uGrainSector)
         *puExtentSector = uGrainSector + uSector % pExtent->cSectorsPerGrain;
     else
@@ -4630,6 +4995,13 @@ static int vmdkStreamAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
 
     if (uGDEntry != uLastGDEntry)
     {
+        /* All grains of the previous grain table must be written first. */
+        if (pExtent->pDeflate)
+        {
+            rc = vmdkStreamDeflateFlush(pImage, pExtent, true /* fWait */);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
         rc = vmdkStreamFlushGT(pImage, pExtent, uLastGDEntry);
         if (RT_FAILURE(rc))
             return rc;
@@ -4650,11 +5022,23 @@ static int vmdkStreamAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
     uFileOffset = RT_ALIGN_64(uFileOffset, 512);
 
     /* Paranoia check: extent type, grain table buffer presence and
-     * grain table buffer space. Also grain table entry must be clear. */
+     * grain table buffer space. */
     if (   pExtent->enmType != VMDKETYPE_HOSTED_SPARSE
         || !pImage->pGTCache
-        || pExtent->cGTEntries > VMDK_GT_CACHE_SIZE * VMDK_GT_CACHELINE_SIZE
-        || pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry])
+        || pExtent->cGTEntries > VMDK_GT_CACHE_SIZE * VMDK_GT_CACHELINE_SIZE)
+        return VERR_INTERNAL_ERROR;
+
+    if (pExtent->pDeflate)
+    {
+        /* The grain table entry is updated when the compressed grain is written. */
+        rc = vmdkStreamDeflateSubmit(pImage, pExtent, pIoCtx, uSector, cbWrite);
+        if (RT_SUCCESS(rc))
+            pExtent->uLastGrainAccess = uGrain;
+        return rc;
+    }
+
+    /* Grain table entry must be clear. */
+    if (pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry])
         return VERR_INTERNAL_ERROR;
 
     /* Update grain table entry. */
@@ -4700,12 +5084,12 @@ static int vmdkAllocGrainGTUpdate(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, PVDIOC
                                   PVMDKGRAINALLOCASYNC pGrainAlloc)
 {
     int rc = VINF_SUCCESS;
-    PVMDKGTCACHE pCache = pImage->pGTCache;
+    PVDMETACACHE pCache = pImage->pGTBlockCache;
     uint32_t aGTDataTmp[VMDK_GT_CACHELINE_SIZE];
-    uint32_t uGTHash, uGTBlockIndex;
-    uint64_t uGTSector, uRGTSector, uGTBlock;
+    uint32_t uGTBlockIndex;
+    uint64_t uGTSector, uRGTSector, uGTBlock, uGTKey;
     uint64_t uSector = pGrainAlloc->uSector;
-    PVMDKGTCACHEENTRY pGTCacheEntry;
+    PVDMETACACHEENTRY pGTCacheEntry;
 
     LogFlowFunc(("pImage=%#p pExtent=%#p pCache=%#p pIoCtx=%#p pGrainAlloc=%#p\n",
                  pImage, pExtent, pCache, pIoCtx, pGrainAlloc));
@@ -4716,10 +5100,9 @@ static int vmdkAllocGrainGTUpdate(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, PVDIOC
 
     /* Update the grain table (and the cache). */
     uGTBlock = uSector / (pExtent->cSectorsPerGrain * VMDK_GT_CACHELINE_SIZE);
-    uGTHash = vmdkGTCacheHash(pCache, uGTBlock, pExtent->uExtent);
-    pGTCacheEntry = &pCache->aGTCache[uGTHash];
-    if (    pGTCacheEntry->uExtent != pExtent->uExtent
-        ||  pGTCacheEntry->uGTBlock != uGTBlock)
+    uGTKey = VMDK_GT_CACHE_KEY(pExtent->uExtent, uGTBlock);
+    pGTCacheEntry = vdMetaCacheRetain(pCache, uGTKey);
+    if (!pGTCacheEntry)
     {
         /* Cache miss, fetch data from disk. */
         LogFlow(("Cache miss, fetch data from disk\n"));
@@ -4739,22 +5122,33 @@ static int vmdkAllocGrainGTUpdate(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, PVDIOC
         else if (RT_FAILURE(rc))
             return vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("VMDK: cannot read allocated grain table entry in '%s'"), pExtent->pszFullname);
         vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
-        pGTCacheEntry->uExtent = pExtent->uExtent;
-        pGTCacheEntry->uGTBlock = uGTBlock;
-        for (unsigned i = 0; i < VMDK_GT_CACHELINE_SIZE; i++)
-            pGTCacheEntry->aGTData[i] = RT_LE2H_U32(aGTDataTmp[i]);
+
+        /* Write allocate, the entry is only updated if there is memory for it. */
+        pGTCacheEntry = vdMetaCacheEntryAlloc(pCache);
+        if (pGTCacheEntry)
+        {
+            uint32_t *paGTData = (uint32_t *)pGTCacheEntry->pvData;
+            for (unsigned i = 0; i < VMDK_GT_CACHELINE_SIZE; i++)
+                paGTData[i] = RT_LE2H_U32(aGTDataTmp[i]);
+            vdMetaCacheEntryInsert(pCache, pGTCacheEntry, uGTKey, uGTBlock);
+        }
     }
     else
     {
         /* Cache hit. Convert grain table block back to disk format, otherwise
          * the code below will write garbage for all but the updated entry. */
+        uint32_t *paGTData = (uint32_t *)pGTCacheEntry->pvData;
         for (unsigned i = 0; i < VMDK_GT_CACHELINE_SIZE; i++)
-            aGTDataTmp[i] = RT_H2LE_U32(pGTCacheEntry->aGTData[i]);
+            aGTDataTmp[i] = RT_H2LE_U32(paGTData[i]);
     }
     pGrainAlloc->fGTUpdateNeeded = false;
     uGTBlockIndex = (uSector / pExtent->cSectorsPerGrain) % VMDK_GT_CACHELINE_SIZE;
     aGTDataTmp[uGTBlockIndex] = RT_H2LE_U32(VMDK_BYTE2SECTOR(pGrainAlloc->uGrainOffset));
-    pGTCacheEntry->aGTData[uGTBlockIndex] = VMDK_BYTE2SECTOR(pGrainAlloc->uGrainOffset);
+    if (pGTCacheEntry)
+    {
+        ((uint32_t *)pGTCacheEntry->pvData)[uGTBlockIndex] = VMDK_BYTE2SECTOR(pGrainAlloc->uGrainOffset);
+        vdMetaCacheEntryRelease(pGTCacheEntry);
+    }
     /* Update grain table on disk. */
     rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pExtent->pFile->pStorage,
                                 VMDK_SECTOR2BYTE(uGTSector) + (uGTBlock % (pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE)) * sizeof(aGTDataTmp),
@@ -5282,6 +5676,7 @@ static DECLCALLBACK(int) vmdkProbe(const char *pszFilename, PVDINTERFACE pVDIfsD
         pImage->pExtents = NULL;
         pImage->pFiles = NULL;
         pImage->pGTCache = NULL;
+        pImage->pGTBlockCache = NULL;
         pImage->pDescData = NULL;
         pImage->pVDIfsDisk = pVDIfsDisk;
         pImage->pVDIfsImage = pVDIfsImage;
@@ -5324,6 +5719,7 @@ static DECLCALLBACK(int) vmdkOpen(const char *pszFilename, unsigned uOpenFlags,
         pImage->pExtents = NULL;
         pImage->pFiles = NULL;
         pImage->pGTCache = NULL;
+        pImage->pGTBlockCache = NULL;
         pImage->pDescData = NULL;
         pImage->pVDIfsDisk = pVDIfsDisk;
         pImage->pVDIfsImage = pVDIfsImage;
@@ -5390,6 +5786,7 @@ static DECLCALLBACK(int) vmdkCreate(const char *pszFilename, uint64_t cbSize,
         pImage->pExtents = NULL;
         pImage->pFiles = NULL;
         pImage->pGTCache = NULL;
+        pImage->pGTBlockCache = NULL;
         pImage->pDescData = NULL;
         pImage->pVDIfsDisk = pVDIfsDisk;
         pImage->pVDIfsImage = pVDIfsImage;
@@ -6517,7 +6914,7 @@ const VDIMAGEBACKEND g_VmdkBackend =
     /* paFileExtensions */
     s_aVmdkFileExtensions,
     /* paConfigInfo */
-    NULL,
+    s_aVmdkConfigInfo,
     /* pfnProbe */
     vmdkProbe,
     /* pfnOpen */
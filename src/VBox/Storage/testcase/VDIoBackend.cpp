@@ -127,6 +127,91 @@ int VDIoBackendStorageCreate(PVDIOBACKEND pIoBackend, const char *pszBackend,
     return rc;
 }
 
+int VDIoBackendStorageOpen(PVDIOBACKEND pIoBackend, const char *pszBackend,
+                           const char *pszName, PFNVDIOCOMPLETE pfnComplete,
+                           PPVDIOSTORAGE ppIoStorage)
+{
+    /* Only the file backend can hold data which exists already. */
+    if (strcmp(pszBackend, "file"))
+        return VERR_NOT_SUPPORTED;
+
+    int rc = VINF_SUCCESS;
+    PVDIOSTORAGE pIoStorage = (PVDIOSTORAGE)RTMemAllocZ(sizeof(VDIOSTORAGE));
+
+    if (pIoStorage)
+    {
+        pIoStorage->pIoBackend = pIoBackend;
+        pIoStorage->pfnComplete = pfnComplete;
+
+        rc = RTFileOpen(&pIoStorage->u.hFile, pszName,
+                        RTFILE_O_READWRITE | RTFILE_O_OPEN | RTFILE_O_ASYNC_IO | RTFILE_O_NO_CACHE | RTFILE_O_DENY_NONE);
+        if (RT_SUCCESS(rc))
+        {
+            ASMAtomicIncU32(&pIoBackend->cRefsFile);
+            *ppIoStorage = pIoStorage;
+        }
+        else
+            RTMemFree(pIoStorage);
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    return rc;
+}
+
+int VDIoBackendStorageCopy(PVDIOSTORAGE pIoStorageSrc, const char *pszName,
+                           PPVDIOSTORAGE ppIoStorage)
+{
+    PVDIOSTORAGE pIoStorage = NULL;
+    int rc = VDIoBackendStorageCreate(pIoStorageSrc->pIoBackend,
+                                      pIoStorageSrc->fMemory ? "memory" : "file",
+                                      pszName, pIoStorageSrc->pfnComplete, &pIoStorage);
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t cbSize = 0;
+        rc = VDIoBackendStorageGetSize(pIoStorageSrc, &cbSize);
+        if (RT_SUCCESS(rc))
+            rc = VDIoBackendStorageSetSize(pIoStorage, cbSize);
+        if (RT_SUCCESS(rc))
+        {
+            size_t cbBuf = _1M;
+            void *pvBuf = RTMemAlloc(cbBuf);
+            if (pvBuf)
+            {
+                uint64_t off = 0;
+                while (   off < cbSize
+                       && RT_SUCCESS(rc))
+                {
+                    size_t cbThisCopy = (size_t)RT_MIN(cbBuf, cbSize - off);
+                    RTSGSEG Seg;
+                    RTSGBUF SgBuf;
+
+                    Seg.pvSeg = pvBuf;
+                    Seg.cbSeg = cbThisCopy;
+                    RTSgBufInit(&SgBuf, &Seg, 1);
+                    rc = VDIoBackendTransfer(pIoStorageSrc, VDIOTXDIR_READ, off, cbThisCopy, &SgBuf, NULL, true /* fSync */);
+                    if (RT_SUCCESS(rc))
+                    {
+                        RTSgBufReset(&SgBuf);
+                        rc = VDIoBackendTransfer(pIoStorage, VDIOTXDIR_WRITE, off, cbThisCopy, &SgBuf, NULL, true /* fSync */);
+                    }
+                    off += cbThisCopy;
+                }
+                RTMemFree(pvBuf);
+            }
+            else
+                rc = VERR_NO_MEMORY;
+        }
+
+        if (RT_SUCCESS(rc))
+            *ppIoStorage = pIoStorage;
+        else
+            VDIoBackendStorageDestroy(pIoStorage);
+    }
+
+    return rc;
+}
+
 void VDIoBackendStorageDestroy(PVDIOSTORAGE pIoStorage)
 {
     if (pIoStorage->fMemory)
@@ -69,6 +69,36 @@ int VDIoBackendStorageCreate(PVDIOBACKEND pIoBackend, const char *pszBackend,
                              const char *pszName, PFNVDIOCOMPLETE pfnComplete,
                              PPVDIOSTORAGE ppIoStorage);
 
+/**
+ * Opens an existing storage object of the given backend, only supported
+ * by the file backend.
+ *
+ * @returns IPRT status code.
+ * @retval  VERR_NOT_SUPPORTED if the backend can't hold existing data.
+ *
+ * @param pIoBackend     The I/O backend.
+ * @param pszBackend     Name of the backend, only "file" is supported.
+ * @param pszName        Name of the storage object to open.
+ * @param pfnComplete    Completion callback for asynchronous transfers.
+ * @param ppIoStorage    Where to store the storage handle on success.
+ */
+int VDIoBackendStorageOpen(PVDIOBACKEND pIoBackend, const char *pszBackend,
+                           const char *pszName, PFNVDIOCOMPLETE pfnComplete,
+                           PPVDIOSTORAGE ppIoStorage);
+
+/**
+ * Creates a new storage object holding a copy of the given one,
+ * using the same backend and completion callback.
+ *
+ * @returns IPRT status code.
+ *
+ * @param pIoStorageSrc  The storage object to copy.
+ * @param pszName        Name of the new storage object.
+ * @param ppIoStorage    Where to store the storage handle on success.
+ */
+int VDIoBackendStorageCopy(PVDIOSTORAGE pIoStorageSrc, const char *pszName,
+                           PPVDIOSTORAGE ppIoStorage);
+
 void VDIoBackendStorageDestroy(PVDIOSTORAGE pIoStorage);
 
 int VDIoBackendStorageSetSize(PVDIOSTORAGE pIoStorage, uint64_t cbSize);
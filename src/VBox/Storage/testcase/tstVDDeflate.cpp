@@ -0,0 +1,386 @@
+/** @file
+ *
+ * Benchmark for writing streamOptimized VMDK images with a varying number of
+ * grain compression threads, checking that the output doesn't depend on it.
+ */
+
+/*
+ * Copyright (C) 2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#include <VBox/vd.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/dir.h>
+#include <iprt/string.h>
+#include <iprt/stream.h>
+#include <iprt/file.h>
+#include <iprt/mem.h>
+#include <iprt/initterm.h>
+#include <iprt/getopt.h>
+#include <iprt/path.h>
+#include <iprt/rand.h>
+#include <iprt/time.h>
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The error count. */
+unsigned g_cErrors = 0;
+
+/** Size of the test pattern written repeatedly. */
+#define TSTVDDEFLATE_TEST_PATTERN_SIZE _4M
+/** Size of the buffers for comparing the images. */
+#define TSTVDDEFLATE_COMPARE_BUFFER_SIZE _1M
+
+static DECLCALLBACK(void) tstVDError(void *pvUser, int rc, RT_SRC_POS_DECL, const char *pszFormat, va_list va)
+{
+    RT_NOREF1(pvUser);
+    g_cErrors++;
+    RTPrintf("tstVDDeflate: Error %Rrc at %s:%u (%s): ", rc, RT_SRC_POS_ARGS);
+    RTPrintfV(pszFormat, va);
+    RTPrintf("\n");
+}
+
+static DECLCALLBACK(int) tstVDMessage(void *pvUser, const char *pszFormat, va_list va)
+{
+    RT_NOREF1(pvUser);
+    RTPrintf("tstVDDeflate: ");
+    RTPrintfV(pszFormat, va);
+    return VINF_SUCCESS;
+}
+
+static DECLCALLBACK(bool) tstVDCfgAreKeysValid(void *pvUser, const char *pszzValid)
+{
+    RT_NOREF2(pvUser, pszzValid);
+    return true;
+}
+
+static DECLCALLBACK(int) tstVDCfgQuerySize(void *pvUser, const char *pszName, size_t *pcbValue)
+{
+    if (RTStrCmp(pszName, "DeflateThreads"))
+        return VERR_CFGM_VALUE_NOT_FOUND;
+
+    *pcbValue = strlen((const char *)pvUser) + 1 /* include terminator */;
+    return VINF_SUCCESS;
+}
+
+static DECLCALLBACK(int) tstVDCfgQuery(void *pvUser, const char *pszName, char *pszValue, size_t cchValue)
+{
+    if (RTStrCmp(pszName, "DeflateThreads"))
+        return VERR_CFGM_VALUE_NOT_FOUND;
+
+    return RTStrCopy(pszValue, cchValue, (const char *)pvUser);
+}
+
+/**
+ * Creates a partially compressible test pattern, every 4K block has a random
+ * part followed by a repeating sequence, so compression does real work.
+ */
+static void tstVDDeflatePatternInit(uint8_t *pbPattern, size_t cbPattern)
+{
+    RTRAND hRand;
+    int rc = RTRandAdvCreateParkMiller(&hRand);
+    AssertRC(rc);
+    RTRandAdvSeed(hRand, 0x12345678);
+
+    for (size_t off = 0; off < cbPattern; off += _4K)
+    {
+        size_t cbRandom = RTRandAdvU32Ex(hRand, 0, _4K);
+        RTRandAdvBytes(hRand, pbPattern + off, cbRandom);
+        for (size_t i = cbRandom; i < _4K; i++)
+            pbPattern[off + i] = (uint8_t)(i % 61);
+    }
+
+    RTRandAdvDestroy(hRand);
+}
+
+/**
+ * Writes a streamOptimized image filled with the test pattern.
+ *
+ * @returns VBox status code.
+ * @param   pszFilename     The image to create.
+ * @param   pszThreads      Number of compression threads as a config string.
+ * @param   pbPattern       The test pattern.
+ * @param   cbDisk          Size of the image.
+ * @param   pcNsElapsed     Where to store the time it took.
+ */
+static int tstVDDeflateWrite(const char *pszFilename, const char *pszThreads, const uint8_t *pbPattern,
+                             uint64_t cbDisk, uint64_t *pcNsElapsed)
+{
+    int rc;
+    PVDISK pVD = NULL;
+    VDGEOMETRY        PCHS = { 0, 0, 0 };
+    VDGEOMETRY        LCHS = { 0, 0, 0 };
+    PVDINTERFACE      pVDIfs = NULL;
+    PVDINTERFACE      pVDIfsImage = NULL;
+    VDINTERFACEERROR  VDIfError;
+    VDINTERFACECONFIG VDIfConfig;
+
+    VDIfError.pfnError = tstVDError;
+    VDIfError.pfnMessage = tstVDMessage;
+    rc = VDInterfaceAdd(&VDIfError.Core, "tstVD_Error", VDINTERFACETYPE_ERROR,
+                        NULL, sizeof(VDINTERFACEERROR), &pVDIfs);
+    AssertRC(rc);
+
+    VDIfConfig.pfnAreKeysValid = tstVDCfgAreKeysValid;
+    VDIfConfig.pfnQuerySize    = tstVDCfgQuerySize;
+    VDIfConfig.pfnQuery        = tstVDCfgQuery;
+    VDIfConfig.pfnQueryBytes   = NULL;
+    rc = VDInterfaceAdd(&VDIfConfig.Core, "tstVD_Config", VDINTERFACETYPE_CONFIG,
+                        (void *)pszThreads, sizeof(VDINTERFACECONFIG), &pVDIfsImage);
+    AssertRC(rc);
+
+    RTFileDelete(pszFilename);
+
+    uint64_t tsStart = RTTimeNanoTS();
+
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVD);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    rc = VDCreateBase(pVD, "VMDK", pszFilename, cbDisk, VD_VMDK_IMAGE_FLAGS_STREAM_OPTIMIZED,
+                      "Test image", &PCHS, &LCHS, NULL, VD_OPEN_FLAGS_NORMAL,
+                      pVDIfsImage, NULL);
+    uint64_t uOff = 0;
+    while (   uOff < cbDisk
+           && RT_SUCCESS(rc))
+    {
+        size_t cbThisWrite = (size_t)RT_MIN(TSTVDDEFLATE_TEST_PATTERN_SIZE, cbDisk - uOff);
+        rc = VDWrite(pVD, uOff, pbPattern, cbThisWrite);
+        uOff += cbThisWrite;
+    }
+
+    /* Closing writes the pending grains and the metadata. */
+    if (RT_SUCCESS(rc))
+        rc = VDClose(pVD, false /* fDelete */);
+    VDDestroy(pVD);
+
+    *pcNsElapsed = RTTimeNanoTS() - tsStart;
+    return rc;
+}
+
+/**
+ * Returns the byte range of the embedded descriptor of the given
+ * streamOptimized image, it contains random UUIDs.
+ */
+static int tstVDDeflateQueryDescriptor(RTFILE hFile, uint64_t *poffDesc, uint64_t *pcbDesc)
+{
+    uint8_t abHdr[512];
+    int rc = RTFileReadAt(hFile, 0, abHdr, sizeof(abHdr), NULL);
+    if (RT_SUCCESS(rc))
+    {
+        /* descriptorOffset and descriptorSize of the sparse extent header, in sectors. */
+        *poffDesc = RT_LE2H_U64(*(uint64_t *)&abHdr[28]) * 512;
+        *pcbDesc  = RT_LE2H_U64(*(uint64_t *)&abHdr[36]) * 512;
+    }
+    return rc;
+}
+
+/**
+ * Compares two streamOptimized images, ignoring the embedded descriptors.
+ */
+static int tstVDDeflateCompare(const char *pszFilename1, const char *pszFilename2)
+{
+    RTFILE hFile1 = NIL_RTFILE;
+    RTFILE hFile2 = NIL_RTFILE;
+    uint8_t *pbBuf1 = (uint8_t *)RTMemAlloc(TSTVDDEFLATE_COMPARE_BUFFER_SIZE);
+    uint8_t *pbBuf2 = (uint8_t *)RTMemAlloc(TSTVDDEFLATE_COMPARE_BUFFER_SIZE);
+    if (!pbBuf1 || !pbBuf2)
+    {
+        RTMemFree(pbBuf1);
+        RTMemFree(pbBuf2);
+        return VERR_NO_MEMORY;
+    }
+
+    int rc = RTFileOpen(&hFile1, pszFilename1, RTFILE_O_READ | RTFILE_O_OPEN | RTFILE_O_DENY_NONE);
+    if (RT_SUCCESS(rc))
+        rc = RTFileOpen(&hFile2, pszFilename2, RTFILE_O_READ | RTFILE_O_OPEN | RTFILE_O_DENY_NONE);
+
+    uint64_t cbFile1 = 0, cbFile2 = 0;
+    if (RT_SUCCESS(rc))
+        rc = RTFileQuerySize(hFile1, &cbFile1);
+    if (RT_SUCCESS(rc))
+        rc = RTFileQuerySize(hFile2, &cbFile2);
+    if (RT_SUCCESS(rc) && cbFile1 != cbFile2)
+    {
+        RTPrintf("tstVDDeflate: Image sizes differ: %llu vs. %llu\n", cbFile1, cbFile2);
+        rc = VERR_NOT_EQUAL;
+    }
+
+    uint64_t offDesc = 0, cbDesc = 0;
+    if (RT_SUCCESS(rc))
+        rc = tstVDDeflateQueryDescriptor(hFile1, &offDesc, &cbDesc);
+
+    uint64_t off = 0;
+    while (   RT_SUCCESS(rc)
+           && off < cbFile1)
+    {
+        if (off >= offDesc && off < offDesc + cbDesc)
+        {
+            off = offDesc + cbDesc;
+            continue;
+        }
+
+        size_t cbThisCmp = (size_t)RT_MIN(TSTVDDEFLATE_COMPARE_BUFFER_SIZE, cbFile1 - off);
+        if (off < offDesc)
+            cbThisCmp = (size_t)RT_MIN(cbThisCmp, offDesc - off);
+
+        rc = RTFileReadAt(hFile1, off, pbBuf1, cbThisCmp, NULL);
+        if (RT_SUCCESS(rc))
+            rc = RTFileReadAt(hFile2, off, pbBuf2, cbThisCmp, NULL);
+        if (RT_SUCCESS(rc) && memcmp(pbBuf1, pbBuf2, cbThisCmp))
+        {
+            RTPrintf("tstVDDeflate: Images differ in the range %llu..%llu\n", off, off + cbThisCmp - 1);
+            rc = VERR_NOT_EQUAL;
+        }
+        off += cbThisCmp;
+    }
+
+    if (hFile2 != NIL_RTFILE)
+        RTFileClose(hFile2);
+    if (hFile1 != NIL_RTFILE)
+        RTFileClose(hFile1);
+    RTMemFree(pbBuf2);
+    RTMemFree(pbBuf1);
+    return rc;
+}
+
+/**
+ * Shows help message.
+ */
+static void printUsage(void)
+{
+    RTPrintf("Usage:\n"
+             "--disk-size <size in MB>    Size of the images (default 256)\n"
+             "--dir <directory>           Where to create the images (default current directory)\n"
+             "--threads <count>           Number of compression threads to compare against one,\n"
+             "                            0 for one per CPU (default)\n"
+             "--keep                      Don't delete the images\n"
+             "--help                      Show this text\n");
+}
+
+static const RTGETOPTDEF g_aOptions[] =
+{
+    { "--disk-size",       's', RTGETOPT_REQ_UINT64 },
+    { "--dir",             'd', RTGETOPT_REQ_STRING },
+    { "--threads",         't', RTGETOPT_REQ_UINT32 },
+    { "--keep",            'k', RTGETOPT_REQ_NOTHING },
+    { "--help",            'h', RTGETOPT_REQ_NOTHING }
+};
+
+int main(int argc, char *argv[])
+{
+    RTR3InitExe(argc, &argv, 0);
+    int rc;
+    RTGETOPTUNION ValueUnion;
+    RTGETOPTSTATE GetState;
+    char c;
+    uint64_t cbDisk = 256 * _1M;
+    const char *pszDir = ".";
+    uint32_t cThreads = 0;
+    bool fKeep = false;
+
+    rc = VDInit();
+    if (RT_FAILURE(rc))
+        return RTEXITCODE_FAILURE;
+
+    RTGetOptInit(&GetState, argc, argv, g_aOptions,
+                 RT_ELEMENTS(g_aOptions), 1, RTGETOPTINIT_FLAGS_NO_STD_OPTS);
+
+    while (   RT_SUCCESS(rc)
+           && (c = RTGetOpt(&GetState, &ValueUnion)))
+    {
+        switch (c)
+        {
+            case 's':
+                cbDisk = ValueUnion.u64 * _1M;
+                break;
+            case 'd':
+                pszDir = ValueUnion.psz;
+                break;
+            case 't':
+                cThreads = ValueUnion.u32;
+                break;
+            case 'k':
+                fKeep = true;
+                break;
+            case 'h':
+            default:
+                printUsage();
+                return RTEXITCODE_SUCCESS;
+        }
+    }
+
+    if (!cbDisk)
+    {
+        RTPrintf("tstVDDeflate: Invalid disk size!\n");
+        return RTEXITCODE_FAILURE;
+    }
+
+    uint8_t *pbPattern = (uint8_t *)RTMemAlloc(TSTVDDEFLATE_TEST_PATTERN_SIZE);
+    if (!pbPattern)
+    {
+        RTPrintf("tstVDDeflate: Out of memory!\n");
+        return RTEXITCODE_FAILURE;
+    }
+    tstVDDeflatePatternInit(pbPattern, TSTVDDEFLATE_TEST_PATTERN_SIZE);
+
+    char szFilenameSerial[RTPATH_MAX];
+    char szFilenameParallel[RTPATH_MAX];
+    RTPathJoin(szFilenameSerial, sizeof(szFilenameSerial), pszDir, "tstVDDeflate-serial.vmdk");
+    RTPathJoin(szFilenameParallel, sizeof(szFilenameParallel), pszDir, "tstVDDeflate-parallel.vmdk");
+
+    char szThreads[32];
+    RTStrPrintf(szThreads, sizeof(szThreads), "%u", cThreads);
+
+    uint64_t cNsSerial = 0;
+    uint64_t cNsParallel = 0;
+    rc = tstVDDeflateWrite(szFilenameSerial, "1", pbPattern, cbDisk, &cNsSerial);
+    if (RT_SUCCESS(rc))
+        rc = tstVDDeflateWrite(szFilenameParallel, szThreads, pbPattern, cbDisk, &cNsParallel);
+    if (RT_SUCCESS(rc))
+    {
+        RTPrintf("tstVDDeflate: 1 thread:   %llu MB/s\n",
+                 cbDisk * RT_NS_1SEC / _1M / RT_MAX(cNsSerial, 1));
+        RTPrintf("tstVDDeflate: %s threads: %llu MB/s\n", cThreads ? szThreads : "auto",
+                 cbDisk * RT_NS_1SEC / _1M / RT_MAX(cNsParallel, 1));
+
+        rc = tstVDDeflateCompare(szFilenameSerial, szFilenameParallel);
+        if (RT_FAILURE(rc))
+            RTPrintf("tstVDDeflate: The images are not identical! rc=%Rrc\n", rc);
+    }
+    else
+        RTPrintf("tstVDDeflate: Writing the images failed! rc=%Rrc\n", rc);
+
+    if (!fKeep)
+    {
+        RTFileDelete(szFilenameSerial);
+        RTFileDelete(szFilenameParallel);
+    }
+    RTMemFree(pbPattern);
+
+    int rc2 = VDShutdown();
+    if (RT_FAILURE(rc2))
+        RTPrintf("tstVDDeflate: unloading backends failed! rc=%Rrc\n", rc2);
+
+    if (RT_FAILURE(rc) || g_cErrors)
+    {
+        RTPrintf("tstVDDeflate: FAILED\n");
+        return RTEXITCODE_FAILURE;
+    }
+
+    RTPrintf("tstVDDeflate: SUCCESS\n");
+    return RTEXITCODE_SUCCESS;
+}
+
@@ -0,0 +1,1139 @@
+/** @file
+ *
+ * Testcase for the iSCSI initiator, running it against a minimal in-process
+ * target backed by memory to check multiple outstanding R2Ts per write and
+ * distributing commands over several sessions.
+ */
+
+/*
+ * Copyright (C) 2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#include <VBox/vd.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <VBox/scsi.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/string.h>
+#include <iprt/stream.h>
+#include <iprt/mem.h>
+#include <iprt/initterm.h>
+#include <iprt/getopt.h>
+#include <iprt/list.h>
+#include <iprt/rand.h>
+#include <iprt/semaphore.h>
+#include <iprt/tcp.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The target name the stand-in target reports. */
+#define TSTVDISCSI_TARGET_NAME          "iqn.2020-01.org.virtualbox:tstvdiscsi"
+/** Sector size of the emulated LUN. */
+#define TSTVDISCSI_SECTOR_SIZE          512
+/** Maximum number of connections the target accepts. */
+#define TSTVDISCSI_CONNS_MAX            16
+/** Maximum data segment length the target accepts, small to force R2Ts for big writes. */
+#define TSTVDISCSI_DATA_SEG_MAX         _64K
+/** Maximum burst length the target asks for with a single R2T. */
+#define TSTVDISCSI_BURST_MAX            _256K
+/** Upper limit of outstanding R2Ts per command the target agrees to. */
+#define TSTVDISCSI_OUTSTANDING_R2T_MAX  8
+/** Size of the CmdSN window the target grants. */
+#define TSTVDISCSI_CMDSN_WINDOW         64
+
+/** @name The subset of iSCSI PDU definitions the target needs.
+ * @{ */
+#define TSTVDISCSI_OP_NOP_OUT           0x00000000
+#define TSTVDISCSI_OP_SCSI_CMD          0x01000000
+#define TSTVDISCSI_OP_LOGIN_REQ         0x03000000
+#define TSTVDISCSI_OP_SCSI_DATA_OUT     0x05000000
+#define TSTVDISCSI_OP_LOGOUT_REQ        0x06000000
+#define TSTVDISCSI_OP_NOP_IN            0x20000000
+#define TSTVDISCSI_OP_SCSI_RES          0x21000000
+#define TSTVDISCSI_OP_LOGIN_RES         0x23000000
+#define TSTVDISCSI_OP_SCSI_DATA_IN      0x25000000
+#define TSTVDISCSI_OP_LOGOUT_RES        0x26000000
+#define TSTVDISCSI_OP_R2T               0x31000000
+#define TSTVDISCSI_OP_MASK              0x3f000000
+#define TSTVDISCSI_IMMEDIATE_BIT        0x40000000
+#define TSTVDISCSI_FINAL_BIT            0x00800000
+#define TSTVDISCSI_STATUS_BIT           0x00010000
+#define TSTVDISCSI_CSG_SHIFT            18
+#define TSTVDISCSI_CSG_MASK             0x000c0000
+#define TSTVDISCSI_TASK_TAG_RSVD        0xffffffff
+#define TSTVDISCSI_BHS_SIZE             48
+/** @} */
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+
+/**
+ * A write command waiting for its data on a target connection.
+ */
+typedef struct TSTVDISCSIWRITE
+{
+    /** Node for the list of pending writes. */
+    RTLISTNODE          NodeWrite;
+    /** The initiator task tag, network byte order. */
+    uint32_t            uItt;
+    /** Start offset on the disk. */
+    uint64_t            offDisk;
+    /** Number of bytes to transfer. */
+    uint32_t            cbXfer;
+    /** Number of bytes received so far. */
+    uint32_t            cbRecv;
+    /** Buffer offset the next R2T asks for. */
+    uint32_t            offR2TNext;
+    /** Number of R2Ts sent but not answered completely. */
+    uint32_t            cR2TsActive;
+    /** Next R2TSN. */
+    uint32_t            uR2TSN;
+} TSTVDISCSIWRITE;
+/** Pointer to a pending write. */
+typedef TSTVDISCSIWRITE *PTSTVDISCSIWRITE;
+
+/** Pointer to the target state. */
+typedef struct TSTVDISCSITGT *PTSTVDISCSITGT;
+
+/**
+ * A connection to the target.
+ */
+typedef struct TSTVDISCSICONN
+{
+    /** The target. */
+    PTSTVDISCSITGT      pTgt;
+    /** The socket. */
+    RTSOCKET            hSocket;
+    /** The thread serving the connection. */
+    RTTHREAD            hThread;
+    /** Next StatSN. */
+    uint32_t            uStatSN;
+    /** Expected CmdSN. */
+    uint32_t            uExpCmdSN;
+    /** Negotiated maximum number of outstanding R2Ts per command. */
+    uint32_t            cMaxOutstandingR2T;
+    /** Next target transfer tag. */
+    uint32_t            uTttNext;
+    /** Flag whether a SCSI command was received on this connection. */
+    bool                fIo;
+    /** Flag whether the initiator logged out. */
+    bool                fLoggedOut;
+    /** List of pending writes. */
+    RTLISTANCHOR        LstWrites;
+    /** Buffer for receiving data segments. */
+    uint8_t             abRecv[TSTVDISCSI_DATA_SEG_MAX];
+} TSTVDISCSICONN;
+/** Pointer to a target connection. */
+typedef TSTVDISCSICONN *PTSTVDISCSICONN;
+
+/**
+ * The target state.
+ */
+typedef struct TSTVDISCSITGT
+{
+    /** The TCP server. */
+    PRTTCPSERVER        pServer;
+    /** The thread accepting connections. */
+    RTTHREAD            hThreadListen;
+    /** The disk content. */
+    uint8_t            *pbDisk;
+    /** Size of the disk. */
+    uint64_t            cbDisk;
+    /** Number of connections. */
+    volatile uint32_t   cConns;
+    /** The connections. */
+    PTSTVDISCSICONN     apConns[TSTVDISCSI_CONNS_MAX];
+    /** Number of connections which received SCSI commands, valid after stopping. */
+    uint32_t            cConnsIo;
+    /** Number of completed logins. */
+    volatile uint32_t   cLogins;
+    /** Maximum number of outstanding R2Ts seen for a single command. */
+    volatile uint32_t   cR2TsOutstandingMax;
+    /** Number of protocol errors. */
+    volatile uint32_t   cErrors;
+} TSTVDISCSITGT;
+
+/**
+ * I/O request state of the initiator side.
+ */
+typedef struct TSTVDISCSIREQ
+{
+    /** Flag whether the request is active. */
+    volatile bool       fActive;
+    /** The data segment. */
+    RTSGSEG             Seg;
+    /** The S/G buffer. */
+    RTSGBUF             SgBuf;
+} TSTVDISCSIREQ;
+/** Pointer to an I/O request. */
+typedef TSTVDISCSIREQ *PTSTVDISCSIREQ;
+
+/**
+ * I/O state of the initiator side.
+ */
+typedef struct TSTVDISCSIIO
+{
+    /** Event signalled on request completion. */
+    RTSEMEVENT          hEvtComplete;
+    /** Number of active requests. */
+    volatile uint32_t   cReqsActive;
+    /** Status of the first failed request. */
+    volatile int32_t    rcReq;
+} TSTVDISCSIIO;
+/** Pointer to the I/O state. */
+typedef TSTVDISCSIIO *PTSTVDISCSIIO;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The error count. */
+unsigned g_cErrors = 0;
+
+/** The config values given to the iSCSI backend, zero terminated key/value pairs. */
+static const char *g_apszCfg[12];
+
+
+/*********************************************************************************************************************************
+*   Target                                                                                                                       *
+*********************************************************************************************************************************/
+
+/**
+ * Initializes the common fields of a response BHS.
+ *
+ * @param   pConn       The connection.
+ * @param   paBHS       The BHS to initialize.
+ * @param   u32Word0    The first word (opcode and flags), host byte order.
+ * @param   uItt        The initiator task tag, network byte order.
+ * @param   fStatSN     Flag whether the PDU carries a status and advances StatSN.
+ */
+static void tstVDIScsiTgtBhsInit(PTSTVDISCSICONN pConn, uint32_t *paBHS, uint32_t u32Word0, uint32_t uItt, bool fStatSN)
+{
+    RT_BZERO(paBHS, TSTVDISCSI_BHS_SIZE);
+    paBHS[0] = RT_H2N_U32(u32Word0);
+    paBHS[4] = uItt;
+    paBHS[5] = RT_H2N_U32(TSTVDISCSI_TASK_TAG_RSVD);
+    paBHS[6] = RT_H2N_U32(pConn->uStatSN);
+    paBHS[7] = RT_H2N_U32(pConn->uExpCmdSN);
+    paBHS[8] = RT_H2N_U32(pConn->uExpCmdSN + TSTVDISCSI_CMDSN_WINDOW - 1);
+    if (fStatSN)
+        pConn->uStatSN++;
+}
+
+/**
+ * Sends a PDU to the initiator.
+ *
+ * @returns IPRT status code.
+ * @param   pConn       The connection.
+ * @param   paBHS       The BHS, the data segment length is filled in here.
+ * @param   pvData      The data segment.
+ * @param   cbData      Size of the data segment.
+ */
+static int tstVDIScsiTgtSend(PTSTVDISCSICONN pConn, uint32_t *paBHS, const void *pvData, size_t cbData)
+{
+    static const uint8_t s_abPad[4] = { 0 };
+
+    paBHS[1] = RT_H2N_U32((uint32_t)cbData);
+    if (!cbData)
+        return RTTcpWrite(pConn->hSocket, paBHS, TSTVDISCSI_BHS_SIZE);
+    if (!(cbData & 3))
+        return RTTcpSgWriteL(pConn->hSocket, 2, paBHS, (size_t)TSTVDISCSI_BHS_SIZE, pvData, cbData);
+    return RTTcpSgWriteL(pConn->hSocket, 3, paBHS, (size_t)TSTVDISCSI_BHS_SIZE, pvData, cbData,
+                         s_abPad, 4 - (cbData & 3));
+}
+
+/**
+ * Sends a SCSI response.
+ */
+static int tstVDIScsiTgtSendStatus(PTSTVDISCSICONN pConn, uint32_t uItt, uint8_t bStatus, uint8_t bSenseKey, uint8_t bAsc)
+{
+    uint32_t aBHS[12];
+    uint8_t abSense[2 + 18];
+
+    tstVDIScsiTgtBhsInit(pConn, aBHS, TSTVDISCSI_OP_SCSI_RES | TSTVDISCSI_FINAL_BIT | bStatus, uItt, true /* fStatSN */);
+    aBHS[5] = 0;
+    if (bStatus == SCSI_STATUS_OK)
+        return tstVDIScsiTgtSend(pConn, aBHS, NULL, 0);
+
+    RT_ZERO(abSense);
+    abSense[1]  = 18;
+    abSense[2]  = SCSI_SENSE_RESPONSE_CODE_CURR_FIXED;
+    abSense[4]  = bSenseKey;
+    abSense[9]  = 10;
+    abSense[14] = bAsc;
+    return tstVDIScsiTgtSend(pConn, aBHS, abSense, sizeof(abSense));
+}
+
+/**
+ * Sends the data of a read command in several Data-In PDUs, the last one
+ * carrying the status.
+ */
+static int tstVDIScsiTgtSendDataIn(PTSTVDISCSICONN pConn, uint32_t uItt, const uint8_t *pbData, uint32_t cbData)
+{
+    if (!cbData)
+        return tstVDIScsiTgtSendStatus(pConn, uItt, SCSI_STATUS_OK, 0, 0);
+
+    int rc = VINF_SUCCESS;
+    uint32_t uDataSN = 0;
+    uint32_t off = 0;
+    while (   RT_SUCCESS(rc)
+           && off < cbData)
+    {
+        uint32_t aBHS[12];
+        uint32_t cbThis = RT_MIN(cbData - off, TSTVDISCSI_DATA_SEG_MAX);
+        bool fLast = off + cbThis == cbData;
+
+        tstVDIScsiTgtBhsInit(pConn, aBHS,
+                             TSTVDISCSI_OP_SCSI_DATA_IN | (fLast ? TSTVDISCSI_FINAL_BIT | TSTVDISCSI_STATUS_BIT : 0),
+                             uItt, fLast);
+        if (!fLast)
+            aBHS[6] = 0;
+        aBHS[9]  = RT_H2N_U32(uDataSN);
+        aBHS[10] = RT_H2N_U32(off);
+        rc = tstVDIScsiTgtSend(pConn, aBHS, pbData + off, cbThis);
+        off += cbThis;
+        uDataSN++;
+    }
+
+    return rc;
+}
+
+/**
+ * Completes a write if all data arrived, otherwise asks for more data with as
+ * many R2Ts as allowed.
+ */
+static int tstVDIScsiTgtWriteProgress(PTSTVDISCSICONN pConn, PTSTVDISCSIWRITE pWrite)
+{
+    PTSTVDISCSITGT pTgt = pConn->pTgt;
+    int rc = VINF_SUCCESS;
+
+    if (pWrite->cbRecv == pWrite->cbXfer)
+    {
+        RTListNodeRemove(&pWrite->NodeWrite);
+        rc = tstVDIScsiTgtSendStatus(pConn, pWrite->uItt, SCSI_STATUS_OK, 0, 0);
+        RTMemFree(pWrite);
+        return rc;
+    }
+
+    while (   RT_SUCCESS(rc)
+           && pWrite->cR2TsActive < pConn->cMaxOutstandingR2T
+           && pWrite->offR2TNext < pWrite->cbXfer)
+    {
+        uint32_t aBHS[12];
+        uint32_t cbThis = RT_MIN(pWrite->cbXfer - pWrite->offR2TNext, TSTVDISCSI_BURST_MAX);
+
+        /* R2Ts carry the current StatSN but don't advance it. */
+        tstVDIScsiTgtBhsInit(pConn, aBHS, TSTVDISCSI_OP_R2T | TSTVDISCSI_FINAL_BIT, pWrite->uItt, false /* fStatSN */);
+        aBHS[5]  = RT_H2N_U32(pConn->uTttNext);
+        aBHS[9]  = RT_H2N_U32(pWrite->uR2TSN);
+        aBHS[10] = RT_H2N_U32(pWrite->offR2TNext);
+        aBHS[11] = RT_H2N_U32(cbThis);
+        rc = tstVDIScsiTgtSend(pConn, aBHS, NULL, 0);
+
+        pConn->uTttNext++;
+        pWrite->uR2TSN++;
+        pWrite->offR2TNext += cbThis;
+        pWrite->cR2TsActive++;
+
+        uint32_t cR2TsMax = ASMAtomicReadU32(&pTgt->cR2TsOutstandingMax);
+        while (   pWrite->cR2TsActive > cR2TsMax
+               && !ASMAtomicCmpXchgExU32(&pTgt->cR2TsOutstandingMax, pWrite->cR2TsActive, cR2TsMax, &cR2TsMax))
+        { /* retry */ }
+    }
+
+    return rc;
+}
+
+/**
+ * Processes a SCSI command PDU.
+ */
+static int tstVDIScsiTgtScsiCmd(PTSTVDISCSICONN pConn, const uint32_t *paBHS, const uint8_t *pbData, uint32_t cbData)
+{
+    PTSTVDISCSITGT pTgt = pConn->pTgt;
+    const uint8_t *pbCdb = (const uint8_t *)&paBHS[8];
+    uint32_t uItt = paBHS[4];
+    uint32_t cbXfer = RT_N2H_U32(paBHS[5]);
+    uint64_t uLba = 0;
+    uint32_t cSectors = 0;
+
+    pConn->fIo = true;
+
+    switch (pbCdb[0])
+    {
+        case SCSI_READ_10:
+        case SCSI_WRITE_10:
+            uLba     = RT_BE2H_U32(*(const uint32_t *)&pbCdb[2]);
+            cSectors = RT_BE2H_U16(*(const uint16_t *)&pbCdb[7]);
+            break;
+        case SCSI_READ_16:
+        case SCSI_WRITE_16:
+            uLba     = RT_BE2H_U64(*(const uint64_t *)&pbCdb[2]);
+            cSectors = RT_BE2H_U32(*(const uint32_t *)&pbCdb[10]);
+            break;
+        case SCSI_SYNCHRONIZE_CACHE:
+            return tstVDIScsiTgtSendStatus(pConn, uItt, SCSI_STATUS_OK, 0, 0);
+        case SCSI_REPORT_LUNS:
+        {
+            uint8_t abLuns[16];
+            RT_ZERO(abLuns);
+            abLuns[3] = 8; /* A single LUN 0. */
+            return tstVDIScsiTgtSendDataIn(pConn, uItt, abLuns, RT_MIN(cbXfer, sizeof(abLuns)));
+        }
+        case SCSI_INQUIRY:
+        {
+            uint8_t abInq[36];
+            RT_ZERO(abInq);
+            abInq[0] = SCSI_INQUIRY_DATA_PERIPHERAL_DEVICE_TYPE_DIRECT_ACCESS;
+            abInq[2] = 0x05;
+            abInq[3] = 0x02;
+            abInq[4] = sizeof(abInq) - 5;
+            abInq[7] = 0x02; /* CmdQue */
+            memcpy(&abInq[8], "VBOX    tstVDIScsi      1.0 ", 28);
+            return tstVDIScsiTgtSendDataIn(pConn, uItt, abInq, RT_MIN(cbXfer, sizeof(abInq)));
+        }
+        case SCSI_MODE_SENSE_6:
+        {
+            uint8_t abMode[4 + 20];
+            RT_ZERO(abMode);
+            if ((pbCdb[2] & 0x3f) == 0x08)
+            {
+                /* Caching mode page with the write cache enabled. */
+                abMode[0] = sizeof(abMode) - 1;
+                abMode[4] = 0x08;
+                abMode[5] = 0x12;
+                abMode[6] = 0x04;
+                return tstVDIScsiTgtSendDataIn(pConn, uItt, abMode, RT_MIN(cbXfer, sizeof(abMode)));
+            }
+            /* Just the header without the write protect bit. */
+            abMode[0] = 3;
+            return tstVDIScsiTgtSendDataIn(pConn, uItt, abMode, RT_MIN(cbXfer, 4));
+        }
+        case SCSI_SERVICE_ACTION_IN_16:
+        {
+            if ((pbCdb[1] & 0x1f) != SCSI_SVC_ACTION_IN_READ_CAPACITY_16)
+                return tstVDIScsiTgtSendStatus(pConn, uItt, SCSI_STATUS_CHECK_CONDITION,
+                                               SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_CMD_PACKET);
+            uint8_t abCap[12];
+            *(uint64_t *)&abCap[0] = RT_H2BE_U64(pTgt->cbDisk / TSTVDISCSI_SECTOR_SIZE - 1);
+            *(uint32_t *)&abCap[8] = RT_H2BE_U32(TSTVDISCSI_SECTOR_SIZE);
+            return tstVDIScsiTgtSendDataIn(pConn, uItt, abCap, RT_MIN(cbXfer, sizeof(abCap)));
+        }
+        default:
+            return tstVDIScsiTgtSendStatus(pConn, uItt, SCSI_STATUS_CHECK_CONDITION,
+                                           SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_ILLEGAL_OPCODE);
+    }
+
+    uint64_t offDisk = uLba * TSTVDISCSI_SECTOR_SIZE;
+    uint32_t cbIo = cSectors * TSTVDISCSI_SECTOR_SIZE;
+    if (   offDisk + cbIo > pTgt->cbDisk
+        || cbIo != cbXfer)
+    {
+        ASMAtomicIncU32(&pTgt->cErrors);
+        return tstVDIScsiTgtSendStatus(pConn, uItt, SCSI_STATUS_CHECK_CONDITION,
+                                       SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_CMD_PACKET);
+    }
+
+    if (   pbCdb[0] == SCSI_READ_10
+        || pbCdb[0] == SCSI_READ_16)
+        return tstVDIScsiTgtSendDataIn(pConn, uItt, pTgt->pbDisk + offDisk, cbIo);
+
+    if (cbData > cbIo)
+        return VERR_BUFFER_OVERFLOW;
+
+    PTSTVDISCSIWRITE pWrite = (PTSTVDISCSIWRITE)RTMemAllocZ(sizeof(TSTVDISCSIWRITE));
+    if (!pWrite)
+        return VERR_NO_MEMORY;
+
+    memcpy(pTgt->pbDisk + offDisk, pbData, cbData);
+    pWrite->uItt       = uItt;
+    pWrite->offDisk    = offDisk;
+    pWrite->cbXfer     = cbIo;
+    pWrite->cbRecv     = cbData;
+    pWrite->offR2TNext = cbData;
+    RTListAppend(&pConn->LstWrites, &pWrite->NodeWrite);
+    return tstVDIScsiTgtWriteProgress(pConn, pWrite);
+}
+
+/**
+ * Processes a Data-Out PDU.
+ */
+static int tstVDIScsiTgtDataOut(PTSTVDISCSICONN pConn, const uint32_t *paBHS, const uint8_t *pbData, uint32_t cbData)
+{
+    PTSTVDISCSIWRITE pWrite;
+    RTListForEach(&pConn->LstWrites, pWrite, TSTVDISCSIWRITE, NodeWrite)
+    {
+        if (pWrite->uItt == paBHS[4])
+        {
+            uint32_t offBuf = RT_N2H_U32(paBHS[10]);
+            if (   offBuf + cbData > pWrite->cbXfer
+                || offBuf + cbData > pWrite->offR2TNext)
+                return VERR_OUT_OF_RANGE;
+
+            memcpy(pConn->pTgt->pbDisk + pWrite->offDisk + offBuf, pbData, cbData);
+            pWrite->cbRecv += cbData;
+            if (   (RT_N2H_U32(paBHS[0]) & TSTVDISCSI_FINAL_BIT)
+                && paBHS[5] != RT_H2N_U32(TSTVDISCSI_TASK_TAG_RSVD))
+            {
+                AssertReturn(pWrite->cR2TsActive, VERR_INVALID_STATE);
+                pWrite->cR2TsActive--;
+            }
+            return tstVDIScsiTgtWriteProgress(pConn, pWrite);
+        }
+    }
+
+    return VERR_NOT_FOUND;
+}
+
+/**
+ * Processes a login request PDU.
+ */
+static int tstVDIScsiTgtLogin(PTSTVDISCSICONN pConn, const uint32_t *paBHS, const uint8_t *pbData, uint32_t cbData)
+{
+    uint32_t u32Word0 = RT_N2H_U32(paBHS[0]);
+    uint32_t uCsg = (u32Word0 & TSTVDISCSI_CSG_MASK) >> TSTVDISCSI_CSG_SHIFT;
+    char szReply[512];
+    size_t cchReply = 0;
+
+    if (uCsg == 0)
+    {
+        /* Security negotiation, no authentication. */
+        cchReply = RTStrPrintf(szReply, sizeof(szReply), "AuthMethod=None") + 1;
+        u32Word0 = (1 << 16); /* T=1, CSG=0, NSG=1 */
+    }
+    else if (uCsg == 1)
+    {
+        /* Operational negotiation, agree to the offered MaxOutstandingR2T within limits. */
+        uint32_t cR2TOffered = 1;
+        for (size_t off = 0; off < cbData; off += strlen((const char *)pbData + off) + 1)
+        {
+            if (!strncmp((const char *)pbData + off, "MaxOutstandingR2T=", sizeof("MaxOutstandingR2T=") - 1))
+                RTStrToUInt32Full((const char *)pbData + off + sizeof("MaxOutstandingR2T=") - 1, 10, &cR2TOffered);
+        }
+        pConn->cMaxOutstandingR2T = RT_MAX(RT_MIN(cR2TOffered, TSTVDISCSI_OUTSTANDING_R2T_MAX), 1);
+
+        static const char * const s_apszKeys[] =
+        {
+            "HeaderDigest=None", "DataDigest=None", "MaxConnections=1", "InitialR2T=No", "ImmediateData=Yes",
+            "DefaultTime2Wait=0", "DefaultTime2Retain=60", "DataPDUInOrder=Yes", "DataSequenceInOrder=Yes",
+            "ErrorRecoveryLevel=0"
+        };
+        for (unsigned i = 0; i < RT_ELEMENTS(s_apszKeys); i++)
+            cchReply += RTStrPrintf(&szReply[cchReply], sizeof(szReply) - cchReply, "%s", s_apszKeys[i]) + 1;
+        cchReply += RTStrPrintf(&szReply[cchReply], sizeof(szReply) - cchReply,
+                                "MaxRecvDataSegmentLength=%u", TSTVDISCSI_DATA_SEG_MAX) + 1;
+        cchReply += RTStrPrintf(&szReply[cchReply], sizeof(szReply) - cchReply,
+                                "FirstBurstLength=%u", TSTVDISCSI_DATA_SEG_MAX) + 1;
+        cchReply += RTStrPrintf(&szReply[cchReply], sizeof(szReply) - cchReply,
+                                "MaxBurstLength=%u", TSTVDISCSI_BURST_MAX) + 1;
+        cchReply += RTStrPrintf(&szReply[cchReply], sizeof(szReply) - cchReply,
+                                "MaxOutstandingR2T=%u", pConn->cMaxOutstandingR2T) + 1;
+        u32Word0 = (1 << TSTVDISCSI_CSG_SHIFT) | (3 << 16); /* T=1, CSG=1, NSG=3 */
+        ASMAtomicIncU32(&pConn->pTgt->cLogins);
+    }
+    else
+        return VERR_INVALID_STATE;
+
+    /* The CmdSN of login requests isn't advanced (immediate delivery). */
+    pConn->uExpCmdSN = RT_N2H_U32(paBHS[6]);
+
+    uint32_t aBHS[12];
+    tstVDIScsiTgtBhsInit(pConn, aBHS, TSTVDISCSI_OP_LOGIN_RES | TSTVDISCSI_FINAL_BIT | u32Word0,
+                         paBHS[4], true /* fStatSN */);
+    aBHS[2] = paBHS[2];
+    aBHS[3] = paBHS[3] | (uCsg == 1 ? RT_H2N_U32(1) : 0); /* Assign a TSIH on completion. */
+    aBHS[5] = 0;
+    return tstVDIScsiTgtSend(pConn, aBHS, szReply, cchReply);
+}
+
+/**
+ * Processes a single PDU received from the initiator.
+ */
+static int tstVDIScsiTgtProcess(PTSTVDISCSICONN pConn, const uint32_t *paBHS, const uint8_t *pbData, uint32_t cbData)
+{
+    uint32_t u32Word0 = RT_N2H_U32(paBHS[0]);
+    uint32_t uOp = u32Word0 & TSTVDISCSI_OP_MASK;
+
+    /* Track the command window, Data-Out PDUs carry no CmdSN. */
+    if (   uOp != TSTVDISCSI_OP_SCSI_DATA_OUT
+        && uOp != TSTVDISCSI_OP_LOGIN_REQ
+        && !(u32Word0 & TSTVDISCSI_IMMEDIATE_BIT)
+        && RT_N2H_U32(paBHS[6]) == pConn->uExpCmdSN)
+        pConn->uExpCmdSN++;
+
+    switch (uOp)
+    {
+        case TSTVDISCSI_OP_LOGIN_REQ:
+            return tstVDIScsiTgtLogin(pConn, paBHS, pbData, cbData);
+        case TSTVDISCSI_OP_SCSI_CMD:
+            return tstVDIScsiTgtScsiCmd(pConn, paBHS, pbData, cbData);
+        case TSTVDISCSI_OP_SCSI_DATA_OUT:
+            return tstVDIScsiTgtDataOut(pConn, paBHS, pbData, cbData);
+        case TSTVDISCSI_OP_NOP_OUT:
+        {
+            /* NOP-Outs answering a NOP-In of ours don't get a reply, we never send one though. */
+            if (paBHS[4] == RT_H2N_U32(TSTVDISCSI_TASK_TAG_RSVD))
+                return VINF_SUCCESS;
+            uint32_t aBHS[12];
+            tstVDIScsiTgtBhsInit(pConn, aBHS, TSTVDISCSI_OP_NOP_IN | TSTVDISCSI_FINAL_BIT, paBHS[4], true /* fStatSN */);
+            aBHS[2] = paBHS[2];
+            aBHS[3] = paBHS[3];
+            return tstVDIScsiTgtSend(pConn, aBHS, pbData, cbData);
+        }
+        case TSTVDISCSI_OP_LOGOUT_REQ:
+        {
+            uint32_t aBHS[12];
+            tstVDIScsiTgtBhsInit(pConn, aBHS, TSTVDISCSI_OP_LOGOUT_RES | TSTVDISCSI_FINAL_BIT, paBHS[4], true /* fStatSN */);
+            aBHS[5] = 0;
+            pConn->fLoggedOut = true;
+            return tstVDIScsiTgtSend(pConn, aBHS, NULL, 0);
+        }
+        default:
+            return VERR_NOT_SUPPORTED;
+    }
+}
+
+/**
+ * Connection worker thread.
+ */
+static DECLCALLBACK(int) tstVDIScsiTgtConnWorker(RTTHREAD hThread, void *pvUser)
+{
+    RT_NOREF1(hThread);
+    PTSTVDISCSICONN pConn = (PTSTVDISCSICONN)pvUser;
+    int rc = VINF_SUCCESS;
+
+    while (   RT_SUCCESS(rc)
+           && !pConn->fLoggedOut)
+    {
+        uint32_t aBHS[12];
+        rc = RTTcpRead(pConn->hSocket, aBHS, TSTVDISCSI_BHS_SIZE, NULL);
+        if (RT_FAILURE(rc))
+            break;
+
+        uint32_t cbAhs  = (RT_N2H_U32(aBHS[1]) >> 24) * 4;
+        uint32_t cbData = RT_N2H_U32(aBHS[1]) & 0x00ffffff;
+        if (   cbAhs
+            || cbData > sizeof(pConn->abRecv))
+        {
+            RTPrintf("tstVDIScsi: Target received PDU with AHS length %u and data length %u\n", cbAhs, cbData);
+            rc = VERR_BUFFER_OVERFLOW;
+            break;
+        }
+
+        if (cbData)
+            rc = RTTcpRead(pConn->hSocket, pConn->abRecv, RT_ALIGN_32(cbData, 4), NULL);
+        if (RT_SUCCESS(rc))
+        {
+            rc = tstVDIScsiTgtProcess(pConn, aBHS, pConn->abRecv, cbData);
+            if (RT_FAILURE(rc))
+                RTPrintf("tstVDIScsi: Target failed to process PDU %#x: %Rrc\n", RT_N2H_U32(aBHS[0]), rc);
+        }
+    }
+
+    /* Connections going away without a logout are expected only on errors. */
+    if (!pConn->fLoggedOut)
+        ASMAtomicIncU32(&pConn->pTgt->cErrors);
+
+    PTSTVDISCSIWRITE pIt, pItNext;
+    RTListForEachSafe(&pConn->LstWrites, pIt, pItNext, TSTVDISCSIWRITE, NodeWrite)
+    {
+        RTListNodeRemove(&pIt->NodeWrite);
+        RTMemFree(pIt);
+    }
+
+    RTTcpServerDisconnectClient2(pConn->hSocket);
+    return VINF_SUCCESS;
+}
+
+/**
+ * Thread accepting connections to the target.
+ */
+static DECLCALLBACK(int) tstVDIScsiTgtListenWorker(RTTHREAD hThread, void *pvUser)
+{
+    RT_NOREF1(hThread);
+    PTSTVDISCSITGT pTgt = (PTSTVDISCSITGT)pvUser;
+
+    for (;;)
+    {
+        RTSOCKET hSocket;
+        int rc = RTTcpServerListen2(pTgt->pServer, &hSocket);
+        if (RT_FAILURE(rc))
+            break;
+
+        PTSTVDISCSICONN pConn = NULL;
+        if (pTgt->cConns < RT_ELEMENTS(pTgt->apConns))
+            pConn = (PTSTVDISCSICONN)RTMemAllocZ(sizeof(TSTVDISCSICONN));
+        if (pConn)
+        {
+            pConn->pTgt               = pTgt;
+            pConn->hSocket            = hSocket;
+            pConn->uStatSN            = 0x1000;
+            pConn->uTttNext           = 1;
+            pConn->cMaxOutstandingR2T = 1;
+            RTListInit(&pConn->LstWrites);
+            rc = RTThreadCreate(&pConn->hThread, tstVDIScsiTgtConnWorker, pConn, 0,
+                                RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "tstIScsiConn");
+            if (RT_SUCCESS(rc))
+            {
+                pTgt->apConns[pTgt->cConns] = pConn;
+                ASMAtomicIncU32(&pTgt->cConns);
+                continue;
+            }
+            RTMemFree(pConn);
+        }
+
+        ASMAtomicIncU32(&pTgt->cErrors);
+        RTTcpServerDisconnectClient2(hSocket);
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Starts the target on the loopback interface.
+ */
+static int tstVDIScsiTgtStart(PTSTVDISCSITGT pTgt, uint32_t uPort, uint64_t cbDisk)
+{
+    RT_BZERO(pTgt, sizeof(*pTgt));
+    pTgt->cbDisk = cbDisk;
+    pTgt->pbDisk = (uint8_t *)RTMemAllocZ(cbDisk);
+    if (!pTgt->pbDisk)
+        return VERR_NO_MEMORY;
+
+    int rc = RTTcpServerCreateEx("127.0.0.1", uPort, &pTgt->pServer);
+    if (RT_SUCCESS(rc))
+    {
+        rc = RTThreadCreate(&pTgt->hThreadListen, tstVDIScsiTgtListenWorker, pTgt, 0,
+                            RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "tstIScsiTgt");
+        if (RT_SUCCESS(rc))
+            return VINF_SUCCESS;
+        RTTcpServerDestroy(pTgt->pServer);
+    }
+
+    RTMemFree(pTgt->pbDisk);
+    return rc;
+}
+
+/**
+ * Stops the target, waiting for all connections to go away.
+ */
+static void tstVDIScsiTgtStop(PTSTVDISCSITGT pTgt)
+{
+    RTTcpServerShutdown(pTgt->pServer);
+    RTThreadWait(pTgt->hThreadListen, RT_INDEFINITE_WAIT, NULL);
+
+    for (uint32_t i = 0; i < pTgt->cConns; i++)
+    {
+        RTThreadWait(pTgt->apConns[i]->hThread, RT_INDEFINITE_WAIT, NULL);
+        if (pTgt->apConns[i]->fIo)
+            pTgt->cConnsIo++;
+        RTMemFree(pTgt->apConns[i]);
+    }
+
+    RTMemFree(pTgt->pbDisk);
+}
+
+
+/*********************************************************************************************************************************
+*   Initiator                                                                                                                    *
+*********************************************************************************************************************************/
+
+static DECLCALLBACK(void) tstVDError(void *pvUser, int rc, RT_SRC_POS_DECL, const char *pszFormat, va_list va)
+{
+    RT_NOREF1(pvUser);
+    g_cErrors++;
+    RTPrintf("tstVDIScsi: Error %Rrc at %s:%u (%s): ", rc, RT_SRC_POS_ARGS);
+    RTPrintfV(pszFormat, va);
+    RTPrintf("\n");
+}
+
+static DECLCALLBACK(int) tstVDMessage(void *pvUser, const char *pszFormat, va_list va)
+{
+    RT_NOREF1(pvUser);
+    RTPrintf("tstVDIScsi: ");
+    RTPrintfV(pszFormat, va);
+    return VINF_SUCCESS;
+}
+
+static const char *tstVDCfgLookup(const char *pszName)
+{
+    for (unsigned i = 0; g_apszCfg[i]; i += 2)
+        if (!RTStrCmp(pszName, g_apszCfg[i]))
+            return g_apszCfg[i + 1];
+    return NULL;
+}
+
+static DECLCALLBACK(bool) tstVDCfgAreKeysValid(void *pvUser, const char *pszzValid)
+{
+    RT_NOREF2(pvUser, pszzValid);
+    return true;
+}
+
+static DECLCALLBACK(int) tstVDCfgQuerySize(void *pvUser, const char *pszName, size_t *pcbValue)
+{
+    RT_NOREF1(pvUser);
+    const char *pszValue = tstVDCfgLookup(pszName);
+    if (!pszValue)
+        return VERR_CFGM_VALUE_NOT_FOUND;
+
+    *pcbValue = strlen(pszValue) + 1 /* include terminator */;
+    return VINF_SUCCESS;
+}
+
+static DECLCALLBACK(int) tstVDCfgQuery(void *pvUser, const char *pszName, char *pszValue, size_t cchValue)
+{
+    RT_NOREF1(pvUser);
+    const char *pszCfgValue = tstVDCfgLookup(pszName);
+    if (!pszCfgValue)
+        return VERR_CFGM_VALUE_NOT_FOUND;
+
+    return RTStrCopy(pszValue, cchValue, pszCfgValue);
+}
+
+static DECLCALLBACK(void) tstVDIScsiReqComplete(void *pvUser1, void *pvUser2, int rcReq)
+{
+    PTSTVDISCSIIO pIo = (PTSTVDISCSIIO)pvUser1;
+    PTSTVDISCSIREQ pReq = (PTSTVDISCSIREQ)pvUser2;
+
+    if (RT_FAILURE(rcReq))
+        ASMAtomicCmpXchgS32(&pIo->rcReq, rcReq, VINF_SUCCESS);
+    ASMAtomicWriteBool(&pReq->fActive, false);
+    ASMAtomicDecU32(&pIo->cReqsActive);
+    RTSemEventSignal(pIo->hEvtComplete);
+}
+
+/**
+ * Reads or writes the whole disk with the given number of requests in flight.
+ */
+static int tstVDIScsiIo(PVDISK pDisk, bool fWrite, uint8_t *pbBuf, uint64_t cbDisk, size_t cbReq, uint32_t cQueueDepth)
+{
+    TSTVDISCSIIO Io;
+    Io.cReqsActive = 0;
+    Io.rcReq       = VINF_SUCCESS;
+    int rc = RTSemEventCreate(&Io.hEvtComplete);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    PTSTVDISCSIREQ paReqs = (PTSTVDISCSIREQ)RTMemAllocZ(cQueueDepth * sizeof(TSTVDISCSIREQ));
+    if (!paReqs)
+    {
+        RTSemEventDestroy(Io.hEvtComplete);
+        return VERR_NO_MEMORY;
+    }
+
+    uint64_t off = 0;
+    while (   RT_SUCCESS(rc)
+           && (off < cbDisk || ASMAtomicReadU32(&Io.cReqsActive)))
+    {
+        bool fSubmitted = false;
+        for (uint32_t i = 0; i < cQueueDepth && off < cbDisk && RT_SUCCESS(rc); i++)
+        {
+            PTSTVDISCSIREQ pReq = &paReqs[i];
+            if (ASMAtomicReadBool(&pReq->fActive))
+                continue;
+
+            size_t cbThis = (size_t)RT_MIN(cbReq, cbDisk - off);
+            pReq->Seg.pvSeg = pbBuf + off;
+            pReq->Seg.cbSeg = cbThis;
+            RTSgBufInit(&pReq->SgBuf, &pReq->Seg, 1);
+            ASMAtomicWriteBool(&pReq->fActive, true);
+            ASMAtomicIncU32(&Io.cReqsActive);
+
+            if (fWrite)
+                rc = VDAsyncWrite(pDisk, off, cbThis, &pReq->SgBuf, tstVDIScsiReqComplete, &Io, pReq);
+            else
+                rc = VDAsyncRead(pDisk, off, cbThis, &pReq->SgBuf, tstVDIScsiReqComplete, &Io, pReq);
+            if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+                rc = VINF_SUCCESS;
+            else
+            {
+                /* Completed synchronously or failed, the callback isn't called. */
+                ASMAtomicWriteBool(&pReq->fActive, false);
+                ASMAtomicDecU32(&Io.cReqsActive);
+                if (rc == VINF_VD_ASYNC_IO_FINISHED)
+                    rc = VINF_SUCCESS;
+            }
+
+            off += cbThis;
+            fSubmitted = true;
+        }
+
+        if (   RT_SUCCESS(rc)
+            && !fSubmitted)
+            RTSemEventWait(Io.hEvtComplete, RT_INDEFINITE_WAIT);
+        if (RT_SUCCESS(rc))
+            rc = ASMAtomicReadS32(&Io.rcReq);
+    }
+
+    /* Drain whatever is still in flight after a failure. */
+    while (ASMAtomicReadU32(&Io.cReqsActive))
+        RTSemEventWait(Io.hEvtComplete, 100);
+
+    RTMemFree(paReqs);
+    RTSemEventDestroy(Io.hEvtComplete);
+    return rc;
+}
+
+/**
+ * Opens the target, writes the whole disk and reads it back.
+ */
+static int tstVDIScsiRun(PTSTVDISCSITGT pTgt, const char *pszTargetAddress, uint32_t cSessions, uint32_t cMaxR2T,
+                         size_t cbReq, uint32_t cQueueDepth, const uint8_t *pbPattern)
+{
+    PVDINTERFACE pVDIfsDisk = NULL;
+    PVDINTERFACE pVDIfsImage = NULL;
+    VDINTERFACEERROR VDIfError;
+    VDINTERFACECONFIG VDIfConfig;
+    VDIFINST hTcpNetInst = NULL;
+    PVDISK pDisk = NULL;
+    char szSessions[16];
+    char szMaxR2T[16];
+
+    RTStrPrintf(szSessions, sizeof(szSessions), "%u", cSessions);
+    RTStrPrintf(szMaxR2T, sizeof(szMaxR2T), "%u", cMaxR2T);
+    unsigned i = 0;
+    g_apszCfg[i++] = "TargetName";        g_apszCfg[i++] = TSTVDISCSI_TARGET_NAME;
+    g_apszCfg[i++] = "TargetAddress";     g_apszCfg[i++] = pszTargetAddress;
+    g_apszCfg[i++] = "LUN";               g_apszCfg[i++] = "0";
+    g_apszCfg[i++] = "Sessions";          g_apszCfg[i++] = szSessions;
+    g_apszCfg[i++] = "MaxOutstandingR2T"; g_apszCfg[i++] = szMaxR2T;
+    g_apszCfg[i++] = NULL;                g_apszCfg[i++] = NULL;
+
+    VDIfError.pfnError = tstVDError;
+    VDIfError.pfnMessage = tstVDMessage;
+    int rc = VDInterfaceAdd(&VDIfError.Core, "tstVDIScsi_Error", VDINTERFACETYPE_ERROR,
+                            NULL, sizeof(VDINTERFACEERROR), &pVDIfsDisk);
+    AssertRC(rc);
+
+    VDIfConfig.pfnAreKeysValid = tstVDCfgAreKeysValid;
+    VDIfConfig.pfnQuerySize    = tstVDCfgQuerySize;
+    VDIfConfig.pfnQuery        = tstVDCfgQuery;
+    VDIfConfig.pfnQueryBytes   = NULL;
+    rc = VDInterfaceAdd(&VDIfConfig.Core, "tstVDIScsi_Config", VDINTERFACETYPE_CONFIG,
+                        NULL, sizeof(VDINTERFACECONFIG), &pVDIfsImage);
+    AssertRC(rc);
+
+    rc = VDIfTcpNetInstDefaultCreate(&hTcpNetInst, &pVDIfsImage);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    uint8_t *pbRead = (uint8_t *)RTMemAllocZ(pTgt->cbDisk);
+    if (!pbRead)
+    {
+        VDIfTcpNetInstDefaultDestroy(hTcpNetInst);
+        return VERR_NO_MEMORY;
+    }
+
+    rc = VDCreate(pVDIfsDisk, VDTYPE_HDD, &pDisk);
+    if (RT_SUCCESS(rc))
+    {
+        rc = VDOpen(pDisk, "iSCSI", TSTVDISCSI_TARGET_NAME, VD_OPEN_FLAGS_ASYNC_IO, pVDIfsImage);
+        if (RT_SUCCESS(rc))
+        {
+            uint64_t tsStart = RTTimeNanoTS();
+            rc = tstVDIScsiIo(pDisk, true /* fWrite */, (uint8_t *)pbPattern, pTgt->cbDisk, cbReq, cQueueDepth);
+            uint64_t cNsWrite = RTTimeNanoTS() - tsStart;
+            if (RT_SUCCESS(rc))
+            {
+                tsStart = RTTimeNanoTS();
+                rc = tstVDIScsiIo(pDisk, false /* fWrite */, pbRead, pTgt->cbDisk, cbReq, cQueueDepth);
+                uint64_t cNsRead = RTTimeNanoTS() - tsStart;
+                if (RT_SUCCESS(rc))
+                {
+                    RTPrintf("tstVDIScsi: %u session(s), MaxOutstandingR2T %u: write %llu MB/s, read %llu MB/s\n",
+                             cSessions, cMaxR2T,
+                             pTgt->cbDisk * RT_NS_1SEC / _1M / RT_MAX(cNsWrite, 1),
+                             pTgt->cbDisk * RT_NS_1SEC / _1M / RT_MAX(cNsRead, 1));
+
+                    if (memcmp(pTgt->pbDisk, pbPattern, pTgt->cbDisk))
+                    {
+                        RTPrintf("tstVDIScsi: Data written to the target is corrupted\n");
+                        rc = VERR_NOT_EQUAL;
+                    }
+                    else if (memcmp(pbRead, pbPattern, pTgt->cbDisk))
+                    {
+                        RTPrintf("tstVDIScsi: Data read from the target is corrupted\n");
+                        rc = VERR_NOT_EQUAL;
+                    }
+                }
+                else
+                    RTPrintf("tstVDIScsi: Reading failed! rc=%Rrc\n", rc);
+            }
+            else
+                RTPrintf("tstVDIScsi: Writing failed! rc=%Rrc\n", rc);
+
+            int rc2 = VDClose(pDisk, false /* fDelete */);
+            AssertRC(rc2);
+        }
+        else
+            RTPrintf("tstVDIScsi: Opening the target failed! rc=%Rrc\n", rc);
+
+        VDDestroy(pDisk);
+    }
+
+    RTMemFree(pbRead);
+    VDIfTcpNetInstDefaultDestroy(hTcpNetInst);
+    return rc;
+}
+
+/**
+ * Shows help message.
+ */
+static void printUsage(void)
+{
+    RTPrintf("Usage:\n"
+             "--disk-size <size in MB>    Size of the target LUN (default 64)\n"
+             "--port <port>               TCP port of the target on the loopback interface (default 53260)\n"
+             "--sessions <count>          Number of sessions (default 2)\n"
+             "--max-r2t <count>           MaxOutstandingR2T to offer (default 4)\n"
+             "--request-size <size in KB> Size of a single request (default 1024)\n"
+             "--queue-depth <count>       Number of requests in flight (default 8)\n"
+             "--help                      Show this text\n");
+}
+
+static const RTGETOPTDEF g_aOptions[] =
+{
+    { "--disk-size",       's', RTGETOPT_REQ_UINT64 },
+    { "--port",            'p', RTGETOPT_REQ_UINT32 },
+    { "--sessions",        'n', RTGETOPT_REQ_UINT32 },
+    { "--max-r2t",         'r', RTGETOPT_REQ_UINT32 },
+    { "--request-size",    'b', RTGETOPT_REQ_UINT32 },
+    { "--queue-depth",     'q', RTGETOPT_REQ_UINT32 },
+    { "--help",            'h', RTGETOPT_REQ_NOTHING }
+};
+
+int main(int argc, char *argv[])
+{
+    RTR3InitExe(argc, &argv, 0);
+    int rc;
+    RTGETOPTUNION ValueUnion;
+    RTGETOPTSTATE GetState;
+    char c;
+    uint64_t cbDisk = 64 * _1M;
+    uint32_t uPort = 53260;
+    uint32_t cSessions = 2;
+    uint32_t cMaxR2T = 4;
+    size_t cbReq = _1M;
+    uint32_t cQueueDepth = 8;
+
+    rc = VDInit();
+    if (RT_FAILURE(rc))
+        return RTEXITCODE_FAILURE;
+
+    RTGetOptInit(&GetState, argc, argv, g_aOptions,
+                 RT_ELEMENTS(g_aOptions), 1, RTGETOPTINIT_FLAGS_NO_STD_OPTS);
+
+    while (   RT_SUCCESS(rc)
+           && (c = RTGetOpt(&GetState, &ValueUnion)))
+    {
+        switch (c)
+        {
+            case 's':
+                cbDisk = ValueUnion.u64 * _1M;
+                break;
+            case 'p':
+                uPort = ValueUnion.u32;
+                break;
+            case 'n':
+                cSessions = ValueUnion.u32;
+                break;
+            case 'r':
+                cMaxR2T = ValueUnion.u32;
+                break;
+            case 'b':
+                cbReq = (size_t)ValueUnion.u32 * _1K;
+                break;
+            case 'q':
+                cQueueDepth = ValueUnion.u32;
+                break;
+            case 'h':
+            default:
+                printUsage();
+                return RTEXITCODE_SUCCESS;
+        }
+    }
+
+    if (   !cbDisk
+        || !cSessions
+        || !cMaxR2T
+        || !cQueueDepth
+        || !cbReq
+        || cbReq % TSTVDISCSI_SECTOR_SIZE)
+    {
+        RTPrintf("tstVDIScsi: Invalid parameters!\n");
+        return RTEXITCODE_FAILURE;
+    }
+
+    uint8_t *pbPattern = (uint8_t *)RTMemAlloc(cbDisk);
+    if (!pbPattern)
+    {
+        RTPrintf("tstVDIScsi: Out of memory!\n");
+        return RTEXITCODE_FAILURE;
+    }
+    RTRandBytes(pbPattern, cbDisk);
+
+    TSTVDISCSITGT Tgt;
+    rc = tstVDIScsiTgtStart(&Tgt, uPort, cbDisk);
+    if (RT_SUCCESS(rc))
+    {
+        char szTargetAddress[64];
+        RTStrPrintf(szTargetAddress, sizeof(szTargetAddress), "127.0.0.1:%u", uPort);
+
+        rc = tstVDIScsiRun(&Tgt, szTargetAddress, cSessions, cMaxR2T, cbReq, cQueueDepth, pbPattern);
+        tstVDIScsiTgtStop(&Tgt);
+
+        if (RT_SUCCESS(rc))
+        {
+            RTPrintf("tstVDIScsi: %u login(s), %u connection(s) with I/O, at most %u outstanding R2T(s) per command\n",
+                     Tgt.cLogins, Tgt.cConnsIo, Tgt.cR2TsOutstandingMax);
+            if (Tgt.cErrors)
+            {
+                RTPrintf("tstVDIScsi: The target saw %u protocol error(s)\n", Tgt.cErrors);
+                g_cErrors++;
+            }
+            if (Tgt.cLogins != cSessions)
+            {
+                RTPrintf("tstVDIScsi: Expected %u sessions\n", cSessions);
+                g_cErrors++;
+            }
+            if (   cMaxR2T > 1
+                && cbReq > TSTVDISCSI_DATA_SEG_MAX + TSTVDISCSI_BURST_MAX
+                && Tgt.cR2TsOutstandingMax < 2)
+            {
+                RTPrintf("tstVDIScsi: The initiator never had more than one R2T outstanding\n");
+                g_cErrors++;
+            }
+        }
+    }
+    else
+        RTPrintf("tstVDIScsi: Starting the target on port %u failed! rc=%Rrc\n", uPort, rc);
+
+    RTMemFree(pbPattern);
+
+    int rc2 = VDShutdown();
+    if (RT_FAILURE(rc2))
+        RTPrintf("tstVDIScsi: unloading backends failed! rc=%Rrc\n", rc2);
+
+    if (RT_FAILURE(rc) || g_cErrors)
+    {
+        RTPrintf("tstVDIScsi: FAILED\n");
+        return RTEXITCODE_FAILURE;
+    }
+
+    RTPrintf("tstVDIScsi: SUCCESS\n");
+    return RTEXITCODE_SUCCESS;
+}
@@ -243,6 +243,7 @@ static DECLCALLBACK(int) vdScriptHandlerDiscard(PVDSCRIPTARG paScriptArgs, void
 static DECLCALLBACK(int) vdScriptHandlerCopy(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerClose(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerPrintFileSize(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerCheckFileSize(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerIoRngCreate(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerIoRngDestroy(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerIoPatternCreateFromNumber(PVDSCRIPTARG paScriptArgs, void *pvUser);
@@ -250,6 +251,7 @@ static DECLCALLBACK(int) vdScriptHandlerIoPatternCreateFromFile(PVDSCRIPTARG paS
 static DECLCALLBACK(int) vdScriptHandlerIoPatternDestroy(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerSleep(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerDumpFile(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerCopyFile(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerCreateDisk(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerDestroyDisk(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerCompareDisks(PVDSCRIPTARG paScriptArgs, void *pvUser);
@@ -261,6 +263,11 @@ static DECLCALLBACK(int) vdScriptHandlerResize(PVDSCRIPTARG paScriptArgs, void *
 static DECLCALLBACK(int) vdScriptHandlerSetFileBackend(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerLoadPlugin(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerIoLogReplay(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerCreateCache(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerOpenCache(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerCloseCache(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerSetCacheDirtyLimit(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerCheckCacheDirty(PVDSCRIPTARG paScriptArgs, void *pvUser);
 
 /* create action */
 const VDSCRIPTTYPE g_aArgCreate[] =
@@ -363,6 +370,14 @@ const VDSCRIPTTYPE g_aArgPrintFileSize[] =
     VDSCRIPTTYPE_UINT32 /* image */
 };
 
+/* check file size action */
+const VDSCRIPTTYPE g_aArgCheckFileSize[] =
+{
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_UINT32, /* image */
+    VDSCRIPTTYPE_UINT64  /* max */
+};
+
 /* I/O log replay action */
 const VDSCRIPTTYPE g_aArgIoLogReplay[] =
 {
@@ -412,6 +427,13 @@ const VDSCRIPTTYPE g_aArgDumpFile[] =
     VDSCRIPTTYPE_STRING  /* path */
 };
 
+/* Copy file */
+const VDSCRIPTTYPE g_aArgCopyFile[] =
+{
+    VDSCRIPTTYPE_STRING, /* source */
+    VDSCRIPTTYPE_STRING  /* destination */
+};
+
 /* Create virtual disk handle */
 const VDSCRIPTTYPE g_aArgCreateDisk[] =
 {
@@ -475,6 +497,47 @@ const VDSCRIPTTYPE g_aArgLoadPlugin[] =
     VDSCRIPTTYPE_STRING /* plugin name */
 };
 
+/* create cache action */
+const VDSCRIPTTYPE g_aArgCreateCache[] =
+{
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_STRING, /* name */
+    VDSCRIPTTYPE_STRING, /* backend */
+    VDSCRIPTTYPE_UINT64, /* size */
+    VDSCRIPTTYPE_BOOL    /* writeback */
+};
+
+/* open cache action */
+const VDSCRIPTTYPE g_aArgOpenCache[] =
+{
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_STRING, /* name */
+    VDSCRIPTTYPE_STRING, /* backend */
+    VDSCRIPTTYPE_BOOL    /* writeback */
+};
+
+/* close cache action */
+const VDSCRIPTTYPE g_aArgCloseCache[] =
+{
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_BOOL    /* delete */
+};
+
+/* set cache dirty limit action */
+const VDSCRIPTTYPE g_aArgSetCacheDirtyLimit[] =
+{
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_UINT64  /* max */
+};
+
+/* check cache dirty size action */
+const VDSCRIPTTYPE g_aArgCheckCacheDirty[] =
+{
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_UINT64, /* min */
+    VDSCRIPTTYPE_UINT64  /* max */
+};
+
 const VDSCRIPTCALLBACK g_aScriptActions[] =
 {
     /* pcszFnName                  enmTypeReturn      paArgDesc                          cArgDescs                                      pfnHandler */
@@ -484,6 +547,7 @@ const VDSCRIPTCALLBACK g_aScriptActions[] =
     {"flush",                      VDSCRIPTTYPE_VOID, g_aArgFlush,                       RT_ELEMENTS(g_aArgFlush),                      vdScriptHandlerFlush},
     {"close",                      VDSCRIPTTYPE_VOID, g_aArgClose,                       RT_ELEMENTS(g_aArgClose),                      vdScriptHandlerClose},
     {"printfilesize",              VDSCRIPTTYPE_VOID, g_aArgPrintFileSize,               RT_ELEMENTS(g_aArgPrintFileSize),              vdScriptHandlerPrintFileSize},
+    {"checkfilesize",              VDSCRIPTTYPE_VOID, g_aArgCheckFileSize,               RT_ELEMENTS(g_aArgCheckFileSize),              vdScriptHandlerCheckFileSize},
     {"ioreplay",                   VDSCRIPTTYPE_VOID, g_aArgIoLogReplay,                 RT_ELEMENTS(g_aArgIoLogReplay),                vdScriptHandlerIoLogReplay},
     {"merge",                      VDSCRIPTTYPE_VOID, g_aArgMerge,                       RT_ELEMENTS(g_aArgMerge),                      vdScriptHandlerMerge},
     {"compact",                    VDSCRIPTTYPE_VOID, g_aArgCompact,                     RT_ELEMENTS(g_aArgCompact),                    vdScriptHandlerCompact},
@@ -496,6 +560,7 @@ const VDSCRIPTCALLBACK g_aScriptActions[] =
     {"iopatterndestroy",           VDSCRIPTTYPE_VOID, g_aArgIoPatternDestroy,            RT_ELEMENTS(g_aArgIoPatternDestroy),           vdScriptHandlerIoPatternDestroy},
     {"sleep",                      VDSCRIPTTYPE_VOID, g_aArgSleep,                       RT_ELEMENTS(g_aArgSleep),                      vdScriptHandlerSleep},
     {"dumpfile",                   VDSCRIPTTYPE_VOID, g_aArgDumpFile,                    RT_ELEMENTS(g_aArgDumpFile),                   vdScriptHandlerDumpFile},
+    {"copyfile",                   VDSCRIPTTYPE_VOID, g_aArgCopyFile,                    RT_ELEMENTS(g_aArgCopyFile),                   vdScriptHandlerCopyFile},
     {"createdisk",                 VDSCRIPTTYPE_VOID, g_aArgCreateDisk,                  RT_ELEMENTS(g_aArgCreateDisk),                 vdScriptHandlerCreateDisk},
     {"destroydisk",                VDSCRIPTTYPE_VOID, g_aArgDestroyDisk,                 RT_ELEMENTS(g_aArgDestroyDisk),                vdScriptHandlerDestroyDisk},
     {"comparedisks",               VDSCRIPTTYPE_VOID, g_aArgCompareDisks,                RT_ELEMENTS(g_aArgCompareDisks),               vdScriptHandlerCompareDisks},
@@ -505,7 +570,12 @@ const VDSCRIPTCALLBACK g_aScriptActions[] =
     {"resetstatistics",            VDSCRIPTTYPE_VOID, g_aArgResetStatistics,             RT_ELEMENTS(g_aArgResetStatistics),            vdScriptHandlerResetStatistics},
     {"resize",                     VDSCRIPTTYPE_VOID, g_aArgResize,                      RT_ELEMENTS(g_aArgResize),                     vdScriptHandlerResize},
     {"setfilebackend",             VDSCRIPTTYPE_VOID, g_aArgSetFileBackend,              RT_ELEMENTS(g_aArgSetFileBackend),             vdScriptHandlerSetFileBackend},
-    {"loadplugin",                 VDSCRIPTTYPE_VOID, g_aArgLoadPlugin,                  RT_ELEMENTS(g_aArgLoadPlugin),                 vdScriptHandlerLoadPlugin}
+    {"loadplugin",                 VDSCRIPTTYPE_VOID, g_aArgLoadPlugin,                  RT_ELEMENTS(g_aArgLoadPlugin),                 vdScriptHandlerLoadPlugin},
+    {"createcache",                VDSCRIPTTYPE_VOID, g_aArgCreateCache,                 RT_ELEMENTS(g_aArgCreateCache),                vdScriptHandlerCreateCache},
+    {"opencache",                  VDSCRIPTTYPE_VOID, g_aArgOpenCache,                   RT_ELEMENTS(g_aArgOpenCache),                  vdScriptHandlerOpenCache},
+    {"closecache",                 VDSCRIPTTYPE_VOID, g_aArgCloseCache,                  RT_ELEMENTS(g_aArgCloseCache),                 vdScriptHandlerCloseCache},
+    {"setcachedirtylimit",         VDSCRIPTTYPE_VOID, g_aArgSetCacheDirtyLimit,          RT_ELEMENTS(g_aArgSetCacheDirtyLimit),         vdScriptHandlerSetCacheDirtyLimit},
+    {"checkcachedirty",            VDSCRIPTTYPE_VOID, g_aArgCheckCacheDirty,             RT_ELEMENTS(g_aArgCheckCacheDirty),            vdScriptHandlerCheckCacheDirty}
 };
 
 const unsigned g_cScriptActions = RT_ELEMENTS(g_aScriptActions);
@@ -1397,6 +1467,32 @@ static DECLCALLBACK(int) vdScriptHandlerPrintFileSize(PVDSCRIPTARG paScriptArgs,
 }
 
 
+static DECLCALLBACK(int) vdScriptHandlerCheckFileSize(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    PVDDISK pDisk = NULL;
+    const char *pcszDisk = paScriptArgs[0].psz;
+    uint32_t nImage   = paScriptArgs[1].u32;
+    uint64_t cbMax    = paScriptArgs[2].u64;
+
+    pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+    if (pDisk)
+    {
+        uint64_t cbFile = VDGetFileSize(pDisk->pVD, nImage);
+        if (cbFile > cbMax)
+        {
+            RTPrintf("%s: size of image %u is %llu, expected at most %llu\n", pcszDisk, nImage, cbFile, cbMax);
+            rc = VERR_INVALID_STATE;
+        }
+    }
+    else
+        rc = VERR_NOT_FOUND;
+
+    return rc;
+}
+
+
 static DECLCALLBACK(int) vdScriptHandlerIoLogReplay(PVDSCRIPTARG paScriptArgs, void *pvUser)
 {
     int rc = VINF_SUCCESS;
@@ -1756,6 +1852,57 @@ static DECLCALLBACK(int) vdScriptHandlerDumpFile(PVDSCRIPTARG paScriptArgs, void
     return rc;
 }
 
+static DECLCALLBACK(int) vdScriptHandlerCopyFile(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    const char *pcszSrc = paScriptArgs[0].psz;
+    const char *pcszDst = paScriptArgs[1].psz;
+
+    /*
+     * Copies the current content of a file, even while an image is open.
+     * Used to get the state an image would have after a crash.
+     */
+    PVDFILE pFileSrc = NULL;
+    PVDFILE pIt;
+    RTListForEach(&pGlob->ListFiles, pIt, VDFILE, Node)
+    {
+        if (!RTStrCmp(pIt->pszName, pcszSrc))
+            pFileSrc = pIt;
+        else if (!RTStrCmp(pIt->pszName, pcszDst))
+            rc = VERR_ALREADY_EXISTS;
+    }
+
+    if (!pFileSrc)
+        rc = VERR_FILE_NOT_FOUND;
+
+    if (RT_SUCCESS(rc))
+    {
+        PVDFILE pFileDst = (PVDFILE)RTMemAllocZ(sizeof(VDFILE));
+        if (pFileDst)
+        {
+            pFileDst->pszName = RTStrDup(pcszDst);
+            if (pFileDst->pszName)
+                rc = VDIoBackendStorageCopy(pFileSrc->pIoStorage, pcszDst, &pFileDst->pIoStorage);
+            else
+                rc = VERR_NO_MEMORY;
+
+            if (RT_FAILURE(rc))
+            {
+                if (pFileDst->pszName)
+                    RTStrFree(pFileDst->pszName);
+                RTMemFree(pFileDst);
+            }
+            else
+                RTListAppend(&pGlob->ListFiles, &pFileDst->Node);
+        }
+        else
+            rc = VERR_NO_MEMORY;
+    }
+
+    return rc;
+}
+
 static DECLCALLBACK(int) vdScriptHandlerCreateDisk(PVDSCRIPTARG paScriptArgs, void *pvUser)
 {
     int rc = VINF_SUCCESS;
@@ -2060,6 +2207,119 @@ static DECLCALLBACK(int) vdScriptHandlerLoadPlugin(PVDSCRIPTARG paScriptArgs, vo
     return VDPluginLoadFromFilename(pcszPlugin);
 }
 
+static DECLCALLBACK(int) vdScriptHandlerCreateCache(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    PVDDISK pDisk = NULL;
+
+    const char *pcszDisk = paScriptArgs[0].psz;
+    const char *pcszCache = paScriptArgs[1].psz;
+    const char *pcszBackend = paScriptArgs[2].psz;
+    uint64_t cbSize = paScriptArgs[3].u64;
+    bool fWriteBack = paScriptArgs[4].f;
+
+    pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+    if (pDisk)
+    {
+        unsigned fOpenFlags = VD_OPEN_FLAGS_ASYNC_IO;
+
+        if (fWriteBack)
+            fOpenFlags |= VD_OPEN_FLAGS_CACHE_WRITE_BACK;
+
+        rc = VDCreateCache(pDisk->pVD, pcszBackend, pcszCache, cbSize, VD_IMAGE_FLAGS_NONE, NULL, NULL,
+                           fOpenFlags, pGlob->pInterfacesImages, NULL);
+    }
+    else
+        rc = VERR_NOT_FOUND;
+
+    return rc;
+}
+
+static DECLCALLBACK(int) vdScriptHandlerOpenCache(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    PVDDISK pDisk = NULL;
+
+    const char *pcszDisk = paScriptArgs[0].psz;
+    const char *pcszCache = paScriptArgs[1].psz;
+    const char *pcszBackend = paScriptArgs[2].psz;
+    bool fWriteBack = paScriptArgs[3].f;
+
+    pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+    if (pDisk)
+    {
+        unsigned fOpenFlags = VD_OPEN_FLAGS_ASYNC_IO;
+
+        if (fWriteBack)
+            fOpenFlags |= VD_OPEN_FLAGS_CACHE_WRITE_BACK;
+
+        rc = VDCacheOpen(pDisk->pVD, pcszBackend, pcszCache, fOpenFlags, pGlob->pInterfacesImages);
+    }
+    else
+        rc = VERR_NOT_FOUND;
+
+    return rc;
+}
+
+static DECLCALLBACK(int) vdScriptHandlerCloseCache(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    const char *pcszDisk = paScriptArgs[0].psz;
+    bool fDelete = paScriptArgs[1].f;
+
+    PVDDISK pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+    if (pDisk)
+        rc = VDCacheClose(pDisk->pVD, fDelete);
+    else
+        rc = VERR_NOT_FOUND;
+
+    return rc;
+}
+
+static DECLCALLBACK(int) vdScriptHandlerSetCacheDirtyLimit(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    const char *pcszDisk = paScriptArgs[0].psz;
+    uint64_t cbDirtyMax = paScriptArgs[1].u64;
+
+    PVDDISK pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+    if (pDisk)
+        rc = VDCacheSetDirtyLimit(pDisk->pVD, cbDirtyMax);
+    else
+        rc = VERR_NOT_FOUND;
+
+    return rc;
+}
+
+static DECLCALLBACK(int) vdScriptHandlerCheckCacheDirty(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    const char *pcszDisk = paScriptArgs[0].psz;
+    uint64_t cbMin = paScriptArgs[1].u64;
+    uint64_t cbMax = paScriptArgs[2].u64;
+
+    PVDDISK pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+    if (pDisk)
+    {
+        uint64_t cbDirty = VDCacheGetDirtySize(pDisk->pVD);
+        if (   cbDirty < cbMin
+            || cbDirty > cbMax)
+        {
+            RTPrintf("%s: cache holds %llu bytes of dirty data, expected %llu to %llu\n", pcszDisk, cbDirty, cbMin, cbMax);
+            rc = VERR_INVALID_STATE;
+        }
+    }
+    else
+        rc = VERR_NOT_FOUND;
+
+    return rc;
+}
+
 static DECLCALLBACK(int) tstVDIoFileOpen(void *pvUser, const char *pszLocation,
                                          uint32_t fOpen,
                                          PFNVDCOMPLETED pfnCompleted,
@@ -2127,8 +2387,34 @@ static DECLCALLBACK(int) tstVDIoFileOpen(void *pvUser, const char *pszLocation,
     }
     else if ((fOpen & RTFILE_O_ACTION_MASK) == RTFILE_O_OPEN)
     {
-        if (!fFound)
+        if (!fFound && RTStrCmp(pGlob->pszIoBackend, "file"))
             rc = VERR_FILE_NOT_FOUND;
+        else if (!fFound)
+        {
+            /* Images prepared outside of the testcase can be opened with the file backend. */
+            pIt = (PVDFILE)RTMemAllocZ(sizeof(VDFILE));
+            if (pIt)
+            {
+                pIt->pszName = RTStrDup(pszLocation);
+
+                if (pIt->pszName)
+                    rc = VDIoBackendStorageOpen(pGlob->pIoBackend, pGlob->pszIoBackend,
+                                                pszLocation, pfnCompleted, &pIt->pIoStorage);
+                else
+                    rc = VERR_NO_MEMORY;
+
+                if (RT_FAILURE(rc))
+                {
+                    if (pIt->pszName)
+                        RTStrFree(pIt->pszName);
+                    RTMemFree(pIt);
+                }
+                else
+                    RTListAppend(&pGlob->ListFiles, &pIt->Node);
+            }
+            else
+                rc = VERR_NO_MEMORY;
+        }
     }
     else
         rc = VERR_INVALID_PARAMETER;
@@ -0,0 +1,167 @@
+/* $Id: tstVDMetaCache.cpp $ */
+/** @file
+ * Unit test for the metadata table cache shared by the sparse image backends.
+ */
+
+/*
+ * Copyright (C) 2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/err.h>
+#include <iprt/test.h>
+
+#include "../VDMetaCache.h"
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** Size of a table in the test cache. */
+#define TST_TBL_SIZE    512
+
+
+/**
+ * Looks up a table, loading it into the cache on a miss like the backends do.
+ *
+ * @returns true if the table was cached, false if it had to be loaded.
+ * @param   pCache    The cache instance.
+ * @param   idxTbl    Index of the table to access.
+ */
+static bool tstVDMetaCacheAccess(PVDMETACACHE pCache, uint64_t idxTbl)
+{
+    uint64_t offTbl = (idxTbl + 1) * TST_TBL_SIZE;
+    PVDMETACACHEENTRY pEntry = vdMetaCacheRetain(pCache, offTbl);
+    if (pEntry)
+    {
+        RTTESTI_CHECK(pEntry->Core.Key == offTbl);
+        vdMetaCacheEntryRelease(pEntry);
+        return true;
+    }
+
+    pEntry = vdMetaCacheEntryAlloc(pCache);
+    RTTESTI_CHECK_RET(pEntry != NULL, false);
+    vdMetaCacheEntryInsert(pCache, pEntry, offTbl, idxTbl);
+    vdMetaCacheEntryRelease(pEntry);
+    return false;
+}
+
+
+static void tstVDMetaCacheCounters(void)
+{
+    RTTestISub("Counters");
+
+    PVDMETACACHE pCache = NULL;
+    RTTESTI_CHECK_RC_RETV(vdMetaCacheCreate(&pCache, NULL, sizeof(VDMETACACHEENTRY), TST_TBL_SIZE,
+                                            8 * TST_TBL_SIZE, 8 * TST_TBL_SIZE), VINF_SUCCESS);
+
+    /* Cold misses, the second table is part of a sequential scan. */
+    RTTESTI_CHECK(!tstVDMetaCacheAccess(pCache, 10));
+    RTTESTI_CHECK(!tstVDMetaCacheAccess(pCache, 11));
+    RTTESTI_CHECK(!tstVDMetaCacheAccess(pCache, 20));
+    RTTESTI_CHECK(tstVDMetaCacheAccess(pCache, 10));
+    RTTESTI_CHECK(tstVDMetaCacheAccess(pCache, 20));
+
+    VDMETACACHESTATS Stats;
+    vdMetaCacheQueryStats(pCache, &Stats);
+    RTTESTI_CHECK_MSG(Stats.cHits == 2, ("cHits=%llu\n", Stats.cHits));
+    RTTESTI_CHECK_MSG(Stats.cMisses == 3, ("cMisses=%llu\n", Stats.cMisses));
+    RTTESTI_CHECK_MSG(Stats.cMissesSeq == 1, ("cMissesSeq=%llu\n", Stats.cMissesSeq));
+    RTTESTI_CHECK_MSG(Stats.cEvictions == 0, ("cEvictions=%llu\n", Stats.cEvictions));
+    RTTESTI_CHECK_MSG(Stats.cbUsed == 3 * TST_TBL_SIZE, ("cbUsed=%zu\n", Stats.cbUsed));
+
+    /* Fill the cache, the next new table evicts one. */
+    for (uint64_t i = 0; i < 5; i++)
+        RTTESTI_CHECK(!tstVDMetaCacheAccess(pCache, 100 + 2 * i));
+    vdMetaCacheQueryStats(pCache, &Stats);
+    RTTESTI_CHECK_MSG(Stats.cEvictions == 0, ("cEvictions=%llu\n", Stats.cEvictions));
+    RTTESTI_CHECK(!tstVDMetaCacheAccess(pCache, 200));
+    vdMetaCacheQueryStats(pCache, &Stats);
+    RTTESTI_CHECK_MSG(Stats.cEvictions == 1, ("cEvictions=%llu\n", Stats.cEvictions));
+    RTTESTI_CHECK_MSG(Stats.cbUsed == 8 * TST_TBL_SIZE, ("cbUsed=%zu\n", Stats.cbUsed));
+
+    /* The tables accessed twice are protected and survived. */
+    RTTESTI_CHECK(tstVDMetaCacheAccess(pCache, 10));
+    RTTESTI_CHECK(tstVDMetaCacheAccess(pCache, 20));
+
+    vdMetaCacheDestroy(pCache);
+}
+
+
+static void tstVDMetaCacheGrow(void)
+{
+    RTTestISub("Grow");
+
+    PVDMETACACHE pCache = NULL;
+    RTTESTI_CHECK_RC_RETV(vdMetaCacheCreate(&pCache, NULL, sizeof(VDMETACACHEENTRY), TST_TBL_SIZE,
+                                            4 * TST_TBL_SIZE, 16 * TST_TBL_SIZE), VINF_SUCCESS);
+
+    /* A working set fitting into the budget never makes it grow. */
+    for (unsigned i = 0; i < 4096; i++)
+        tstVDMetaCacheAccess(pCache, 2 * (i % 3));
+
+    VDMETACACHESTATS Stats;
+    vdMetaCacheQueryStats(pCache, &Stats);
+    RTTESTI_CHECK_MSG(Stats.cMisses == 3, ("cMisses=%llu\n", Stats.cMisses));
+    RTTESTI_CHECK_MSG(Stats.cGrows == 0, ("cGrows=%u\n", Stats.cGrows));
+    RTTESTI_CHECK_MSG(Stats.cbMax == 4 * TST_TBL_SIZE, ("cbMax=%zu\n", Stats.cbMax));
+
+    /*
+     * A working set of eight tables thrashes a cache of four, every lookup is
+     * a capacity miss and the budget has to grow until the set fits.
+     */
+    vdMetaCacheInvalidate(pCache);
+    unsigned cHitsLast = 0;
+    for (unsigned i = 0; i < 4096; i++)
+    {
+        bool fHit = tstVDMetaCacheAccess(pCache, 2 * (i % 8));
+        if (i >= 4096 - 8 && fHit)
+            cHitsLast++;
+    }
+
+    vdMetaCacheQueryStats(pCache, &Stats);
+    RTTESTI_CHECK_MSG(Stats.cGrows == 1, ("cGrows=%u\n", Stats.cGrows));
+    RTTESTI_CHECK_MSG(Stats.cbMax == 8 * TST_TBL_SIZE, ("cbMax=%zu\n", Stats.cbMax));
+    RTTESTI_CHECK_MSG(Stats.cbUsed <= Stats.cbMax, ("cbUsed=%zu cbMax=%zu\n", Stats.cbUsed, Stats.cbMax));
+    RTTESTI_CHECK_MSG(cHitsLast == 8, ("cHitsLast=%u\n", cHitsLast));
+
+    /* The budget doesn't grow beyond the limit. */
+    for (unsigned i = 0; i < 8192; i++)
+        tstVDMetaCacheAccess(pCache, 2 * (i % 64));
+    vdMetaCacheQueryStats(pCache, &Stats);
+    RTTESTI_CHECK_MSG(Stats.cbMax == 16 * TST_TBL_SIZE, ("cbMax=%zu\n", Stats.cbMax));
+    RTTESTI_CHECK_MSG(Stats.cbUsed <= Stats.cbMax, ("cbUsed=%zu cbMax=%zu\n", Stats.cbUsed, Stats.cbMax));
+
+    /* Shrinking evicts down to the new budget. */
+    RTTESTI_CHECK_RC(vdMetaCacheResize(pCache, 4 * TST_TBL_SIZE), VINF_SUCCESS);
+    vdMetaCacheQueryStats(pCache, &Stats);
+    RTTESTI_CHECK_MSG(Stats.cbUsed <= 4 * TST_TBL_SIZE, ("cbUsed=%zu\n", Stats.cbUsed));
+
+    vdMetaCacheDestroy(pCache);
+}
+
+
+int main()
+{
+    RTTEST hTest;
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstVDMetaCache", &hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(hTest);
+
+    tstVDMetaCacheCounters();
+    tstVDMetaCacheGrow();
+
+    return RTTestSummaryAndDestroy(hTest);
+}
@@ -1632,6 +1632,21 @@ int pgmPhysPageLoadIntoTlbWithPage(PVMCC pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
     PGM_LOCK_ASSERT_OWNER(pVM);
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,PageMapTlbMisses));
 
+#ifdef IN_RING3
+    /*
+     * Pull in the page content first if a lazy restore hasn't gotten to it yet.
+     * This may leave the lock while reading, so the page state is (re)checked
+     * below.
+     */
+    if (   PGM_PAGE_HAS_ACTIVE_ALL_HANDLERS(pPage)
+        && pVM->pgm.s.pLazyRestoreR3)
+    {
+        int rc = pgmR3LazyRestoreFetchLocked(pVM, pPage, GCPhys);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+#endif
+
     /*
      * Map the page.
      * Make a special case for the zero page as it is kind of special.
@@ -280,13 +280,14 @@ VMM_INT_DECL(void) TMNotifyEndOfHalt(PVMCPUCC pVCpu)
 
 
 /**
- * Raise the timer force action flag and notify the dedicated timer EMT.
+ * Raise the timer force action flag and notify the EMT running the queue.
  *
  * @param   pVM         The cross context VM structure.
+ * @param   enmClock    The clock of the queue needing attention.
  */
-DECLINLINE(void) tmScheduleNotify(PVMCC pVM)
+DECLINLINE(void) tmScheduleNotify(PVMCC pVM, TMCLOCK enmClock)
 {
-    PVMCPUCC pVCpuDst = VMCC_GET_CPU(pVM, pVM->tm.s.idTimerCpu);
+    PVMCPUCC pVCpuDst = TMQUEUE_GET_OWNER_CPU(pVM, enmClock);
     if (!VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER))
     {
         Log5(("TMAll(%u): FF: 0 -> 1\n", __LINE__));
@@ -321,7 +322,7 @@ DECLINLINE(void) tmSchedule(PTMTIMER pTimer)
     {
         TMTIMERSTATE enmState = pTimer->enmState;
         if (TMTIMERSTATE_IS_PENDING_SCHEDULING(enmState))
-            tmScheduleNotify(pVM);
+            tmScheduleNotify(pVM, pTimer->enmClock);
     }
 }
 
@@ -391,61 +392,6 @@ DECLINLINE(bool) tmTimerTryWithLink(PTMTIMER pTimer, TMTIMERSTATE enmStateNew, T
 }
 
 
-/**
- * Links a timer into the active list of a timer queue.
- *
- * @param   pQueue          The queue.
- * @param   pTimer          The timer.
- * @param   u64Expire       The timer expiration time.
- *
- * @remarks Called while owning the relevant queue lock.
- */
-DECL_FORCE_INLINE(void) tmTimerQueueLinkActive(PTMTIMERQUEUE pQueue, PTMTIMER pTimer, uint64_t u64Expire)
-{
-    Assert(!pTimer->offNext);
-    Assert(!pTimer->offPrev);
-    Assert(pTimer->enmState == TMTIMERSTATE_ACTIVE || pTimer->enmClock != TMCLOCK_VIRTUAL_SYNC); /* (active is not a stable state) */
-
-    PTMTIMER pCur = TMTIMER_GET_HEAD(pQueue);
-    if (pCur)
-    {
-        for (;; pCur = TMTIMER_GET_NEXT(pCur))
-        {
-            if (pCur->u64Expire > u64Expire)
-            {
-                const PTMTIMER pPrev = TMTIMER_GET_PREV(pCur);
-                TMTIMER_SET_NEXT(pTimer, pCur);
-                TMTIMER_SET_PREV(pTimer, pPrev);
-                if (pPrev)
-                    TMTIMER_SET_NEXT(pPrev, pTimer);
-                else
-                {
-                    TMTIMER_SET_HEAD(pQueue, pTimer);
-                    ASMAtomicWriteU64(&pQueue->u64Expire, u64Expire);
-                    DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive head", R3STRING(pTimer->pszDesc));
-                }
-                TMTIMER_SET_PREV(pCur, pTimer);
-                return;
-            }
-            if (!pCur->offNext)
-            {
-                TMTIMER_SET_NEXT(pCur, pTimer);
-                TMTIMER_SET_PREV(pTimer, pCur);
-                DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive tail", R3STRING(pTimer->pszDesc));
-                return;
-            }
-        }
-    }
-    else
-    {
-        TMTIMER_SET_HEAD(pQueue, pTimer);
-        ASMAtomicWriteU64(&pQueue->u64Expire, u64Expire);
-        DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive empty", R3STRING(pTimer->pszDesc));
-    }
-}
-
-
-
 /**
  * Schedules the given timer on the given queue.
  *
@@ -606,11 +552,15 @@ void tmTimerQueuesSanityChecks(PVM pVM, const char *pszWhere)
                 continue;
             fHaveVirtualSyncLock = true;
         }
-        PTMTIMER pPrev = NULL;
-        for (PTMTIMER pCur = TMTIMER_GET_HEAD(pQueue); pCur; pPrev = pCur, pCur = TMTIMER_GET_NEXT(pCur))
+        PTMTIMER pHead = TMTIMER_GET_HEAD(pQueue);
+        AssertMsg(!pHead || (!pHead->offPrev && !pHead->offNext), ("%s: %p has siblings\n", pszWhere, pHead));
+        for (PTMTIMER pCur = pHead; pCur; pCur = tmTimerHeapWalkNext(pCur))
         {
             AssertMsg((int)pCur->enmClock == i, ("%s: %d != %d\n", pszWhere, pCur->enmClock, i));
-            AssertMsg(TMTIMER_GET_PREV(pCur) == pPrev, ("%s: %p != %p\n", pszWhere, TMTIMER_GET_PREV(pCur), pPrev));
+            AssertMsg(!pCur->offChild || TMTIMER_GET_PREV(TMTIMER_GET_CHILD(pCur)) == pCur,
+                      ("%s: %p != %p\n", pszWhere, TMTIMER_GET_PREV(TMTIMER_GET_CHILD(pCur)), pCur));
+            AssertMsg(!pCur->offNext || TMTIMER_GET_PREV(TMTIMER_GET_NEXT(pCur)) == pCur,
+                      ("%s: %p != %p\n", pszWhere, TMTIMER_GET_PREV(TMTIMER_GET_NEXT(pCur)), pCur));
             TMTIMERSTATE enmState = pCur->enmState;
             switch (enmState)
             {
@@ -653,7 +603,7 @@ void tmTimerQueuesSanityChecks(PVM pVM, const char *pszWhere)
                     PTMTIMERR3 pCurAct = TMTIMER_GET_HEAD(&pVM->tm.s.CTX_SUFF(paTimerQueues)[pCur->enmClock]);
                     Assert(pCur->offPrev || pCur == pCurAct);
                     while (pCurAct && pCurAct != pCur)
-                        pCurAct = TMTIMER_GET_NEXT(pCurAct);
+                        pCurAct = tmTimerHeapWalkNext(pCurAct);
                     Assert(pCurAct == pCur);
                 }
                 break;
@@ -666,13 +616,15 @@ void tmTimerQueuesSanityChecks(PVM pVM, const char *pszWhere)
                 {
                     Assert(!pCur->offNext);
                     Assert(!pCur->offPrev);
+                    Assert(!pCur->offChild);
                     for (PTMTIMERR3 pCurAct = TMTIMER_GET_HEAD(&pVM->tm.s.CTX_SUFF(paTimerQueues)[pCur->enmClock]);
                           pCurAct;
-                          pCurAct = TMTIMER_GET_NEXT(pCurAct))
+                          pCurAct = tmTimerHeapWalkNext(pCurAct))
                     {
                         Assert(pCurAct != pCur);
                         Assert(TMTIMER_GET_NEXT(pCurAct) != pCur);
                         Assert(TMTIMER_GET_PREV(pCurAct) != pCur);
+                        Assert(TMTIMER_GET_CHILD(pCurAct) != pCur);
                     }
                 }
                 break;
@@ -783,6 +735,35 @@ DECL_FORCE_INLINE(uint64_t) tmTimerPollReturnHit(PVM pVM, PVMCPU pVCpu, PVMCPU p
     return 0;
 }
 
+
+/**
+ * Worker for tmTimerPollInternal handling an EMT which runs the TMCLOCK_VIRTUAL
+ * queue without being the dedicated timer EMT.
+ *
+ * @returns See tmTimerPollInternal.
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure of the calling EMT.
+ * @param   u64Now      Current virtual clock timestamp.
+ * @param   pu64Delta   Where to return the delta.
+ */
+DECL_FORCE_INLINE(uint64_t) tmTimerPollQueueOwner(PVMCC pVM, PVMCPUCC pVCpu, uint64_t u64Now, uint64_t *pu64Delta)
+{
+    if (VMCPU_FF_IS_SET(pVCpu, VMCPU_FF_TIMER))
+        return tmTimerPollReturnHit(pVM, pVCpu, pVCpu, u64Now, pu64Delta, &pVM->tm.s.StatPollAlreadySet);
+
+    const uint64_t  u64Expire = ASMAtomicReadU64(&pVM->tm.s.CTX_SUFF(paTimerQueues)[TMCLOCK_VIRTUAL].u64Expire);
+    const int64_t   i64Delta  = u64Expire - u64Now;
+    if (i64Delta <= 0)
+    {
+        Log5(("TMAll(%u): FF: 0 -> 1\n", __LINE__));
+        VMCPU_FF_SET(pVCpu, VMCPU_FF_TIMER);
+        return tmTimerPollReturnHit(pVM, pVCpu, pVCpu, u64Now, pu64Delta, &pVM->tm.s.StatPollVirtual);
+    }
+
+    STAM_COUNTER_INC(&pVM->tm.s.StatPollMiss);
+    return tmTimerPollReturnMiss(pVM, u64Now, i64Delta, pu64Delta);
+}
+
 /**
  * Common worker for TMTimerPollGIP and TMTimerPoll.
  *
@@ -802,9 +783,16 @@ DECL_FORCE_INLINE(uint64_t) tmTimerPollReturnHit(PVM pVM, PVMCPU pVCpu, PVMCPU p
 DECL_FORCE_INLINE(uint64_t) tmTimerPollInternal(PVMCC pVM, PVMCPUCC pVCpu, uint64_t *pu64Delta)
 {
     PVMCPU                  pVCpuDst      = VMCC_GET_CPU(pVM, pVM->tm.s.idTimerCpu);
+    PVMCPU                  pVCpuVirtual  = TMQUEUE_GET_OWNER_CPU(pVM, TMCLOCK_VIRTUAL);
     const uint64_t          u64Now        = TMVirtualGetNoCheck(pVM);
     STAM_COUNTER_INC(&pVM->tm.s.StatPoll);
 
+    /*
+     * An EMT only running the TMCLOCK_VIRTUAL queue doesn't care about the rest.
+     */
+    if (pVCpuVirtual != pVCpuDst && pVCpu == pVCpuVirtual)
+        return tmTimerPollQueueOwner(pVM, pVCpu, u64Now, pu64Delta);
+
     /*
      * Return straight away if the timer FF is already set ...
      */
@@ -814,7 +802,7 @@ DECL_FORCE_INLINE(uint64_t) tmTimerPollInternal(PVMCC pVM, PVMCPUCC pVCpu, uint6
     /*
      * ... or if timers are being run.
      */
-    if (ASMAtomicReadBool(&pVM->tm.s.fRunningQueues))
+    if (ASMAtomicReadBool(&pVCpuDst->tm.s.fRunningQueues))
     {
         STAM_COUNTER_INC(&pVM->tm.s.StatPollRunning);
         return tmTimerPollReturnOtherCpu(pVM, u64Now, pu64Delta);
@@ -824,17 +812,21 @@ DECL_FORCE_INLINE(uint64_t) tmTimerPollInternal(PVMCC pVM, PVMCPUCC pVCpu, uint6
      * Check for TMCLOCK_VIRTUAL expiration.
      */
     const uint64_t  u64Expire1 = ASMAtomicReadU64(&pVM->tm.s.CTX_SUFF(paTimerQueues)[TMCLOCK_VIRTUAL].u64Expire);
-    const int64_t   i64Delta1  = u64Expire1 - u64Now;
+    int64_t         i64Delta1  = u64Expire1 - u64Now;
     if (i64Delta1 <= 0)
     {
-        if (!VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER))
+        if (!VMCPU_FF_IS_SET(pVCpuVirtual, VMCPU_FF_TIMER))
         {
-            Log5(("TMAll(%u): FF: %d -> 1\n", __LINE__, VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER)));
-            VMCPU_FF_SET(pVCpuDst, VMCPU_FF_TIMER);
+            Log5(("TMAll(%u): FF: %d -> 1\n", __LINE__, VMCPU_FF_IS_SET(pVCpuVirtual, VMCPU_FF_TIMER)));
+            VMCPU_FF_SET(pVCpuVirtual, VMCPU_FF_TIMER);
         }
         LogFlow(("TMTimerPoll: expire1=%'RU64 <= now=%'RU64\n", u64Expire1, u64Now));
-        return tmTimerPollReturnHit(pVM, pVCpu, pVCpuDst, u64Now, pu64Delta, &pVM->tm.s.StatPollVirtual);
+        if (pVCpuVirtual == pVCpuDst)
+            return tmTimerPollReturnHit(pVM, pVCpu, pVCpuDst, u64Now, pu64Delta, &pVM->tm.s.StatPollVirtual);
+        STAM_COUNTER_INC(&pVM->tm.s.StatPollVirtual);
     }
+    if (pVCpuVirtual != pVCpuDst)
+        i64Delta1 = INT64_MAX; /* Another EMT is running the TMCLOCK_VIRTUAL queue. */
 
     /*
      * Check for TMCLOCK_VIRTUAL_SYNC expiration.
@@ -869,7 +861,7 @@ DECL_FORCE_INLINE(uint64_t) tmTimerPollInternal(PVMCC pVM, PVMCPUCC pVCpu, uint6
                     return tmTimerPollReturnOtherCpu(pVM, u64Now, pu64Delta);
                 }
 
-                if (    !pVM->tm.s.fRunningQueues
+                if (    !pVCpuDst->tm.s.fRunningQueues
                     &&  !VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER))
                 {
                     Log5(("TMAll(%u): FF: %d -> 1\n", __LINE__, VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER)));
@@ -944,7 +936,7 @@ DECL_FORCE_INLINE(uint64_t) tmTimerPollInternal(PVMCC pVM, PVMCPUCC pVCpu, uint6
         /* Repeat the initial checks before iterating. */
         if (VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER))
             return tmTimerPollReturnHit(pVM, pVCpu, pVCpuDst, u64Now, pu64Delta, &pVM->tm.s.StatPollAlreadySet);
-        if (ASMAtomicUoReadBool(&pVM->tm.s.fRunningQueues))
+        if (ASMAtomicUoReadBool(&pVCpuDst->tm.s.fRunningQueues))
         {
             STAM_COUNTER_INC(&pVM->tm.s.StatPollRunning);
             return tmTimerPollReturnOtherCpu(pVM, u64Now, pu64Delta);
@@ -965,7 +957,7 @@ DECL_FORCE_INLINE(uint64_t) tmTimerPollInternal(PVMCC pVM, PVMCPUCC pVCpu, uint6
     int64_t i64Delta2 = u64Expire2 - u64VirtualSyncNow;
     if (i64Delta2 <= 0)
     {
-        if (    !pVM->tm.s.fRunningQueues
+        if (    !pVCpuDst->tm.s.fRunningQueues
             &&  !VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER))
         {
             Log5(("TMAll(%u): FF: %d -> 1\n", __LINE__, VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER)));
@@ -2507,7 +2499,7 @@ static uint32_t tmGetFrequencyHint(PVM pVM)
             for (int i = 0; i < TMCLOCK_MAX; i++)
             {
                 PTMTIMERQUEUE pQueue = &pVM->tm.s.CTX_SUFF(paTimerQueues)[i];
-                for (PTMTIMER pCur = TMTIMER_GET_HEAD(pQueue); pCur; pCur = TMTIMER_GET_NEXT(pCur))
+                for (PTMTIMER pCur = TMTIMER_GET_HEAD(pQueue); pCur; pCur = tmTimerHeapWalkNext(pCur))
                 {
                     uint32_t uHzHint = ASMAtomicUoReadU32(&pCur->uHzHint);
                     if (uHzHint > uMaxHzHint)
@@ -235,15 +235,17 @@ DECLINLINE(uint64_t) tmVirtualGet(PVMCC pVM, bool fCheckTimers)
          */
         if (fCheckTimers)
         {
-            PVMCPUCC pVCpuDst = VMCC_GET_CPU(pVM, pVM->tm.s.idTimerCpu);
-            if (    !VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER)
-                &&  !pVM->tm.s.fRunningQueues
-                &&  (   pVM->tm.s.CTX_SUFF(paTimerQueues)[TMCLOCK_VIRTUAL].u64Expire <= u64
-                     || (   pVM->tm.s.fVirtualSyncTicking
-                         && pVM->tm.s.CTX_SUFF(paTimerQueues)[TMCLOCK_VIRTUAL_SYNC].u64Expire <= u64 - pVM->tm.s.offVirtualSync
-                        )
-                    )
-                &&  !pVM->tm.s.fRunningQueues
+            /* The virtual sync queue is always run by the dedicated timer EMT,
+               the virtual one may have been handed to another EMT. */
+            PVMCPUCC pVCpuDst = NULL;
+            if (pVM->tm.s.CTX_SUFF(paTimerQueues)[TMCLOCK_VIRTUAL].u64Expire <= u64)
+                pVCpuDst = TMQUEUE_GET_OWNER_CPU(pVM, TMCLOCK_VIRTUAL);
+            else if (   pVM->tm.s.fVirtualSyncTicking
+                     && pVM->tm.s.CTX_SUFF(paTimerQueues)[TMCLOCK_VIRTUAL_SYNC].u64Expire <= u64 - pVM->tm.s.offVirtualSync)
+                pVCpuDst = VMCC_GET_CPU(pVM, pVM->tm.s.idTimerCpu);
+            if (    pVCpuDst
+                &&  !VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER)
+                &&  !pVCpuDst->tm.s.fRunningQueues
                )
             {
                 STAM_COUNTER_INC(&pVM->tm.s.StatVirtualGetSetFF);
@@ -537,7 +539,7 @@ DECLINLINE(uint64_t) tmVirtualSyncGetEx(PVMCC pVM, bool fCheckTimers, uint64_t *
     u64 = tmVirtualGetRaw(pVM);
     if (fCheckTimers)
     {
-        PVMCPUCC pVCpuDst = VMCC_GET_CPU(pVM, pVM->tm.s.idTimerCpu);
+        PVMCPUCC pVCpuDst = TMQUEUE_GET_OWNER_CPU(pVM, TMCLOCK_VIRTUAL);
         if (    !VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER)
             &&  pVM->tm.s.CTX_SUFF(paTimerQueues)[TMCLOCK_VIRTUAL].u64Expire <= u64)
         {
@@ -35,6 +35,7 @@
 #include <iprt/critsect.h>
 #include <iprt/env.h>
 #include <iprt/file.h>
+#include <iprt/ioqueue.h>
 #include <iprt/mem.h>
 #include <iprt/semaphore.h>
 #include <iprt/string.h>
@@ -201,6 +202,12 @@ static void pdmacFileAioMgrWakeup(PPDMACEPFILEMGR pAioMgr)
             int rc = RTSemEventSignal(pAioMgr->EventSem);
             AssertRC(rc);
         }
+        else if (ASMAtomicReadBool(&pAioMgr->fWaitingIoQueue))
+        {
+            /* The I/O queue manager waits for completions, kick it so it picks up the new requests right away. */
+            int rc = RTIoQueueEvtWaitWakeup(pAioMgr->hIoQueue);
+            AssertRC(rc);
+        }
     }
 }
 
@@ -453,25 +460,32 @@ int pdmacFileAioMgrCreate(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPPDMACEPFILE
                 if (RT_SUCCESS(rc))
                 {
                     /* Init the rest of the manager. */
-                    if (pAioMgrNew->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
+                    PFNRTTHREAD pfnThread = pdmacFileAioMgrFailsafe;
+                    const char *pszSuff   = "F";
+                    if (pAioMgrNew->enmMgrType == PDMACEPFILEMGRTYPE_ASYNC)
+                    {
                         rc = pdmacFileAioMgrNormalInit(pAioMgrNew);
+                        pfnThread = pdmacFileAioMgrNormal;
+                        pszSuff   = "N";
+                    }
+                    else if (pAioMgrNew->enmMgrType == PDMACEPFILEMGRTYPE_IOQUEUE)
+                    {
+                        rc = pdmacFileAioMgrIoQueueInit(pEpClass, pAioMgrNew);
+                        pfnThread = pdmacFileAioMgrIoQueue;
+                        pszSuff   = "Q";
+                    }
 
                     if (RT_SUCCESS(rc))
                     {
                         pAioMgrNew->enmState = PDMACEPFILEMGRSTATE_RUNNING;
 
                         rc = RTThreadCreateF(&pAioMgrNew->Thread,
-                                             pAioMgrNew->enmMgrType == PDMACEPFILEMGRTYPE_SIMPLE
-                                             ? pdmacFileAioMgrFailsafe
-                                             : pdmacFileAioMgrNormal,
+                                             pfnThread,
                                              pAioMgrNew,
                                              0,
                                              RTTHREADTYPE_IO,
                                              0,
-                                             "AioMgr%d-%s", pEpClass->cAioMgrs,
-                                             pAioMgrNew->enmMgrType == PDMACEPFILEMGRTYPE_SIMPLE
-                                             ? "F"
-                                             : "N");
+                                             "AioMgr%d-%s", pEpClass->cAioMgrs, pszSuff);
                         if (RT_SUCCESS(rc))
                         {
                             /* Link it into the list. */
@@ -488,7 +502,11 @@ int pdmacFileAioMgrCreate(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPPDMACEPFILE
                             Log(("PDMAC: Successfully created new file AIO Mgr {%s}\n", RTThreadGetName(pAioMgrNew->Thread)));
                             return VINF_SUCCESS;
                         }
-                        pdmacFileAioMgrNormalDestroy(pAioMgrNew);
+
+                        if (pAioMgrNew->enmMgrType == PDMACEPFILEMGRTYPE_ASYNC)
+                            pdmacFileAioMgrNormalDestroy(pAioMgrNew);
+                        else if (pAioMgrNew->enmMgrType == PDMACEPFILEMGRTYPE_IOQUEUE)
+                            pdmacFileAioMgrIoQueueDestroy(pAioMgrNew);
                     }
                     RTCritSectDelete(&pAioMgrNew->CritSectBlockingEvent);
                 }
@@ -539,8 +557,10 @@ static void pdmacFileAioMgrDestroy(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile,
     RTCritSectDelete(&pAioMgr->CritSectBlockingEvent);
     RTSemEventDestroy(pAioMgr->EventSem);
     RTSemEventDestroy(pAioMgr->EventSemBlock);
-    if (pAioMgr->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
+    if (pAioMgr->enmMgrType == PDMACEPFILEMGRTYPE_ASYNC)
         pdmacFileAioMgrNormalDestroy(pAioMgr);
+    else if (pAioMgr->enmMgrType == PDMACEPFILEMGRTYPE_IOQUEUE)
+        pdmacFileAioMgrIoQueueDestroy(pAioMgr);
 
     MMR3HeapFree(pAioMgr);
 }
@@ -553,6 +573,8 @@ static int pdmacFileMgrTypeFromName(const char *pszVal, PPDMACEPFILEMGRTYPE penm
         *penmMgrType = PDMACEPFILEMGRTYPE_SIMPLE;
     else if (!RTStrCmp(pszVal, "Async"))
         *penmMgrType = PDMACEPFILEMGRTYPE_ASYNC;
+    else if (!RTStrCmp(pszVal, "IoQueue"))
+        *penmMgrType = PDMACEPFILEMGRTYPE_IOQUEUE;
     else
         rc = VERR_CFGM_CONFIG_UNKNOWN_VALUE;
 
@@ -565,10 +587,26 @@ static const char *pdmacFileMgrTypeToName(PDMACEPFILEMGRTYPE enmMgrType)
         return "Simple";
     if (enmMgrType == PDMACEPFILEMGRTYPE_ASYNC)
         return "Async";
+    if (enmMgrType == PDMACEPFILEMGRTYPE_IOQUEUE)
+        return "IoQueue";
 
     return NULL;
 }
 
+/**
+ * Returns whether the given manager type can do async I/O on files
+ * which are accessed through the host cache.
+ *
+ * @returns true if buffered async I/O is possible, false otherwise.
+ * @param   pEpClassFile    Pointer to globals for the file endpoint class.
+ * @param   enmMgrType      The manager type to check.
+ */
+static bool pdmacFileMgrTypeIsBufferedAsync(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile, PDMACEPFILEMGRTYPE enmMgrType)
+{
+    return    enmMgrType == PDMACEPFILEMGRTYPE_IOQUEUE
+           && pEpClassFile->fIoQueueBufferedAsync;
+}
+
 static int pdmacFileBackendTypeFromName(const char *pszVal, PPDMACFILEEPBACKEND penmBackendType)
 {
     int rc = VINF_SUCCESS;
@@ -824,6 +862,35 @@ static DECLCALLBACK(int) pdmacFileInitialize(PPDMASYNCCOMPLETIONEPCLASS pClassGl
             if (RT_FAILURE(rc))
                 return rc;
 
+            if (pEpClassFile->enmMgrTypeOverride == PDMACEPFILEMGRTYPE_IOQUEUE)
+            {
+                pEpClassFile->pIoQueueProv = RTIoQueueProviderGetBestForHndType(RTHANDLETYPE_FILE);
+                if (pEpClassFile->pIoQueueProv)
+                {
+                    /* Only io_uring is able to do async I/O without bypassing the host cache. */
+                    pEpClassFile->fIoQueueBufferedAsync = !RTStrCmp(pEpClassFile->pIoQueueProv->pszId, "LnxIoURingFile");
+
+                    rc = CFGMR3QueryU32Def(pCfgNode, "IoQueueDepth", &pEpClassFile->cIoQueueDepth,
+                                           PDMACEPFILEMGR_IOQUEUE_DEPTH_DEFAULT);
+                    AssertLogRelRCReturn(rc, rc);
+                    AssertLogRelMsgReturn(   pEpClassFile->cIoQueueDepth > 0
+                                          && pEpClassFile->cIoQueueDepth <= PDMACEPFILEMGR_IOQUEUE_DEPTH_MAX,
+                                          ("AIOMgr: IoQueueDepth=%u is out of range\n", pEpClassFile->cIoQueueDepth),
+                                          VERR_OUT_OF_RANGE);
+
+                    rc = CFGMR3QueryBoolDef(pCfgNode, "IoQueuePollSq", &pEpClassFile->fIoQueuePollSq, false);
+                    AssertLogRelRCReturn(rc, rc);
+
+                    LogRel(("AIOMgr: I/O queue provider is '%s' (depth %u, SQ polling %RTbool)\n",
+                            pEpClassFile->pIoQueueProv->pszId, pEpClassFile->cIoQueueDepth, pEpClassFile->fIoQueuePollSq));
+                }
+                else
+                {
+                    LogRel(("AIOMgr: No I/O queue provider available, falling back to the async manager\n"));
+                    pEpClassFile->enmMgrTypeOverride = PDMACEPFILEMGRTYPE_ASYNC;
+                }
+            }
+
             LogRel(("AIOMgr: Default manager type is '%s'\n", pdmacFileMgrTypeToName(pEpClassFile->enmMgrTypeOverride)));
 
             /* Query default backend type */
@@ -838,7 +905,8 @@ static DECLCALLBACK(int) pdmacFileInitialize(PPDMASYNCCOMPLETIONEPCLASS pClassGl
             LogRel(("AIOMgr: Default file backend is '%s'\n", pdmacFileBackendTypeToName(pEpClassFile->enmEpBackendDefault)));
 
 #ifdef RT_OS_LINUX
-            if (   pEpClassFile->enmMgrTypeOverride == PDMACEPFILEMGRTYPE_ASYNC
+            if (   pEpClassFile->enmMgrTypeOverride != PDMACEPFILEMGRTYPE_SIMPLE
+                && !pdmacFileMgrTypeIsBufferedAsync(pEpClassFile, pEpClassFile->enmMgrTypeOverride)
                 && pEpClassFile->enmEpBackendDefault == PDMACFILEEPBACKEND_BUFFERED)
             {
                 LogRel(("AIOMgr: Linux does not support buffered async I/O, changing to non buffered\n"));
@@ -904,11 +972,13 @@ static DECLCALLBACK(int) pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndp
 
     /*
      * Revert to the simple manager and the buffered backend if
-     * the host cache should be enabled.
+     * the host cache should be enabled, unless the manager can do
+     * async I/O through the host cache.
      */
     if (fFlags & PDMACEP_FILE_FLAGS_HOST_CACHE_ENABLED)
     {
-        enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+        if (!pdmacFileMgrTypeIsBufferedAsync(pEpClassFile, enmMgrType))
+            enmMgrType = PDMACEPFILEMGRTYPE_SIMPLE;
         enmEpBackend = PDMACFILEEPBACKEND_BUFFERED;
     }
 
@@ -929,7 +999,9 @@ static DECLCALLBACK(int) pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndp
             fFileFlags |= RTFILE_O_DENY_WRITE;
     }
 
-    if (enmMgrType == PDMACEPFILEMGRTYPE_ASYNC)
+    if (   enmMgrType == PDMACEPFILEMGRTYPE_ASYNC
+        || (   enmMgrType == PDMACEPFILEMGRTYPE_IOQUEUE
+            && !pdmacFileMgrTypeIsBufferedAsync(pEpClassFile, enmMgrType)))
         fFileFlags |= RTFILE_O_ASYNC_IO;
 
     int rc;
@@ -959,8 +1031,11 @@ static DECLCALLBACK(int) pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndp
                 enmEpBackend = PDMACFILEEPBACKEND_BUFFERED;
 
 #ifdef RT_OS_LINUX
-                fFileFlags &= ~RTFILE_O_ASYNC_IO;
-                enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+                if (!pdmacFileMgrTypeIsBufferedAsync(pEpClassFile, enmMgrType))
+                {
+                    fFileFlags &= ~RTFILE_O_ASYNC_IO;
+                    enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+                }
 #endif
             }
             RTFileClose(hFile);
@@ -989,8 +1064,11 @@ static DECLCALLBACK(int) pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndp
         enmEpBackend = PDMACFILEEPBACKEND_BUFFERED;
 
 #ifdef RT_OS_LINUX
-        fFileFlags &= ~RTFILE_O_ASYNC_IO;
-        enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+        if (!pdmacFileMgrTypeIsBufferedAsync(pEpClassFile, enmMgrType))
+        {
+            fFileFlags &= ~RTFILE_O_ASYNC_IO;
+            enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+        }
 #endif
 
         /* Open again. */
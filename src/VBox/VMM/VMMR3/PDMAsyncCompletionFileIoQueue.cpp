@@ -0,0 +1,1505 @@
+/* $Id: PDMAsyncCompletionFileIoQueue.cpp $ */
+/** @file
+ * PDM Async I/O - Async File I/O manager using the RTIoQueue API.
+ */
+
+/*
+ * Copyright (C) 2006-2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define LOG_GROUP LOG_GROUP_PDM_ASYNC_COMPLETION
+#include <iprt/types.h>
+#include <iprt/asm.h>
+#include <iprt/file.h>
+#include <iprt/ioqueue.h>
+#include <iprt/mem.h>
+#include <iprt/string.h>
+#include <iprt/assert.h>
+#include <VBox/log.h>
+
+#include "PDMAsyncCompletionFileInternal.h"
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The update period for the I/O load statistics in ms. */
+#define PDMACEPFILEMGR_LOAD_UPDATE_PERIOD   1000
+/** Number of completion events to reap with one wait call. */
+#define PDMACEPFILEMGR_IOQUEUE_CEVTS        32
+
+
+/*********************************************************************************************************************************
+*   Internal functions                                                                                                           *
+*********************************************************************************************************************************/
+static int pdmacFileAioMgrIoQueueProcessTaskList(PPDMACTASKFILE pTaskHead,
+                                                 PPDMACEPFILEMGR pAioMgr,
+                                                 PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint);
+
+
+/**
+ * Initializes the handle structure used to pass the endpoint file to the I/O queue.
+ */
+DECLINLINE(void) pdmacFileAioMgrIoQueueEpHandle(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, PRTHANDLE pHandle)
+{
+    pHandle->enmType = RTHANDLETYPE_FILE;
+    pHandle->u.hFile = pEndpoint->hFile;
+}
+
+int pdmacFileAioMgrIoQueueInit(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPDMACEPFILEMGR pAioMgr)
+{
+    AssertPtrReturn(pEpClass->pIoQueueProv, VERR_INTERNAL_ERROR_3);
+
+    pAioMgr->cRequestsActiveMax = pEpClass->cIoQueueDepth;
+
+    int rc = RTIoQueueCreate(&pAioMgr->hIoQueue, pEpClass->pIoQueueProv,
+                             pEpClass->fIoQueuePollSq ? RTIOQUEUE_F_POLL_SQ : 0,
+                             pAioMgr->cRequestsActiveMax, pAioMgr->cRequestsActiveMax);
+    if (RT_SUCCESS(rc))
+    {
+        /* Create the range lock memcache. */
+        rc = RTMemCacheCreate(&pAioMgr->hMemCacheRangeLocks, sizeof(PDMACFILERANGELOCK),
+                              0, UINT32_MAX, NULL, NULL, NULL, 0);
+        if (RT_SUCCESS(rc))
+            return VINF_SUCCESS;
+
+        RTIoQueueDestroy(pAioMgr->hIoQueue);
+        pAioMgr->hIoQueue = NIL_RTIOQUEUE;
+    }
+
+    return rc;
+}
+
+void pdmacFileAioMgrIoQueueDestroy(PPDMACEPFILEMGR pAioMgr)
+{
+    int rc = RTIoQueueDestroy(pAioMgr->hIoQueue);
+    AssertRC(rc);
+    pAioMgr->hIoQueue = NIL_RTIOQUEUE;
+
+    RTMemCacheDestroy(pAioMgr->hMemCacheRangeLocks);
+}
+
+/**
+ * Releases the file of an endpoint from the I/O queue once all requests completed.
+ *
+ * @returns nothing.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pEndpoint   The endpoint to release.
+ */
+static void pdmacFileAioMgrIoQueueEpRelease(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint)
+{
+    Assert(!pEndpoint->AioMgr.cRequestsActive);
+    Assert(!pEndpoint->pFlushReq);
+
+    RTHANDLE Hnd;
+    pdmacFileAioMgrIoQueueEpHandle(pEndpoint, &Hnd);
+    int rc = RTIoQueueHandleDeregister(pAioMgr->hIoQueue, &Hnd);
+    AssertRC(rc);
+
+    /* The endpoint moves to a manager which doesn't bypass the host cache, reopen with the new flags. */
+    if (pEndpoint->AioMgr.fMoving)
+    {
+        RTFileClose(pEndpoint->hFile);
+        rc = RTFileOpen(&pEndpoint->hFile, pEndpoint->Core.pszUri, pEndpoint->fFlags);
+        AssertRC(rc);
+    }
+}
+
+/**
+ * Removes an endpoint from the currently assigned manager.
+ *
+ * @returns TRUE if there are still requests pending on the current manager for this endpoint.
+ *          FALSE otherwise.
+ * @param   pEndpointRemove    The endpoint to remove.
+ */
+static bool pdmacFileAioMgrIoQueueRemoveEndpoint(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointRemove)
+{
+    PPDMASYNCCOMPLETIONENDPOINTFILE pPrev   = pEndpointRemove->AioMgr.pEndpointPrev;
+    PPDMASYNCCOMPLETIONENDPOINTFILE pNext   = pEndpointRemove->AioMgr.pEndpointNext;
+    PPDMACEPFILEMGR                 pAioMgr = pEndpointRemove->pAioMgr;
+
+    pAioMgr->cEndpoints--;
+
+    if (pPrev)
+        pPrev->AioMgr.pEndpointNext = pNext;
+    else
+        pAioMgr->pEndpointsHead = pNext;
+
+    if (pNext)
+        pNext->AioMgr.pEndpointPrev = pPrev;
+
+    /* Make sure that there is no request pending on this manager for the endpoint. */
+    if (!pEndpointRemove->AioMgr.cRequestsActive)
+    {
+        pdmacFileAioMgrIoQueueEpRelease(pAioMgr, pEndpointRemove);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Returns whether the given status code is fatal and should be passed up to the
+ * guest instead of retrying the request with the failsafe manager.
+ */
+DECLINLINE(bool) pdmacFileAioMgrIoQueueRcIsFatal(int rcReq)
+{
+    return rcReq == VERR_DEV_IO_ERROR
+        || rcReq == VERR_FILE_IO_ERROR
+        || rcReq == VERR_DISK_IO_ERROR
+        || rcReq == VERR_DISK_FULL
+        || rcReq == VERR_FILE_TOO_BIG;
+}
+
+/**
+ * Put a list of tasks in the pending request list of an endpoint.
+ */
+DECLINLINE(void) pdmacFileAioMgrEpAddTaskList(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, PPDMACTASKFILE pTaskHead)
+{
+    /* Add the rest of the tasks to the pending list */
+    if (!pEndpoint->AioMgr.pReqsPendingHead)
+    {
+        Assert(!pEndpoint->AioMgr.pReqsPendingTail);
+        pEndpoint->AioMgr.pReqsPendingHead = pTaskHead;
+    }
+    else
+    {
+        Assert(pEndpoint->AioMgr.pReqsPendingTail);
+        pEndpoint->AioMgr.pReqsPendingTail->pNext = pTaskHead;
+    }
+
+    /* Update the tail. */
+    while (pTaskHead->pNext)
+        pTaskHead = pTaskHead->pNext;
+
+    pEndpoint->AioMgr.pReqsPendingTail = pTaskHead;
+    pTaskHead->pNext = NULL;
+}
+
+/**
+ * Put one task in the pending request list of an endpoint.
+ */
+DECLINLINE(void) pdmacFileAioMgrEpAddTask(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, PPDMACTASKFILE pTask)
+{
+    /* Add the rest of the tasks to the pending list */
+    if (!pEndpoint->AioMgr.pReqsPendingHead)
+    {
+        Assert(!pEndpoint->AioMgr.pReqsPendingTail);
+        pEndpoint->AioMgr.pReqsPendingHead = pTask;
+    }
+    else
+    {
+        Assert(pEndpoint->AioMgr.pReqsPendingTail);
+        pEndpoint->AioMgr.pReqsPendingTail->pNext = pTask;
+    }
+
+    pEndpoint->AioMgr.pReqsPendingTail = pTask;
+    pTask->pNext = NULL;
+}
+
+/**
+ * Returns whether a started task waits on the pending list to be put into the
+ * I/O queue again.  Such tasks are always at the head of the list.
+ */
+DECLINLINE(bool) pdmacFileAioMgrIoQueueEpHasRestartPending(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint)
+{
+    return pEndpoint->AioMgr.pReqsPendingHead
+        && pEndpoint->AioMgr.pReqsPendingHead->fRestart;
+}
+
+/**
+ * Returns whether there is no request of the endpoint in flight or waiting to
+ * be restarted.
+ */
+DECLINLINE(bool) pdmacFileAioMgrIoQueueEpIsIdle(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint)
+{
+    return !pEndpoint->AioMgr.cRequestsActive
+        && !pdmacFileAioMgrIoQueueEpHasRestartPending(pEndpoint);
+}
+
+static bool pdmacFileAioMgrIoQueueIsRangeLocked(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                                RTFOFF offStart, size_t cbRange,
+                                                PPDMACTASKFILE pTask, bool fAlignedReq)
+{
+    AssertMsg(   pTask->enmTransferType == PDMACTASKFILETRANSFER_WRITE
+              || pTask->enmTransferType == PDMACTASKFILETRANSFER_READ,
+                 ("Invalid task type %d\n", pTask->enmTransferType));
+
+    /*
+     * If there is no unaligned request active and the current one is aligned
+     * just pass it through.
+     */
+    if (!pEndpoint->AioMgr.cLockedReqsActive && fAlignedReq)
+        return false;
+
+    PPDMACFILERANGELOCK pRangeLock;
+    pRangeLock = (PPDMACFILERANGELOCK)RTAvlrFileOffsetRangeGet(pEndpoint->AioMgr.pTreeRangesLocked, offStart);
+    if (!pRangeLock)
+    {
+        pRangeLock = (PPDMACFILERANGELOCK)RTAvlrFileOffsetGetBestFit(pEndpoint->AioMgr.pTreeRangesLocked, offStart, true);
+        /* Check if we intersect with the range. */
+        if (   !pRangeLock
+            || !(   (pRangeLock->Core.Key) <= (offStart + (RTFOFF)cbRange - 1)
+                && (pRangeLock->Core.KeyLast) >= offStart))
+        {
+            pRangeLock = NULL; /* False alarm */
+        }
+    }
+
+    if (pRangeLock)
+    {
+        /* Add to the list of tasks waiting for the range to get unlocked. */
+        pTask->pNext = NULL;
+
+        if (!pRangeLock->pWaitingTasksHead)
+        {
+            Assert(!pRangeLock->pWaitingTasksTail);
+            pRangeLock->pWaitingTasksHead = pTask;
+            pRangeLock->pWaitingTasksTail = pTask;
+        }
+        else
+        {
+            AssertPtr(pRangeLock->pWaitingTasksTail);
+            pRangeLock->pWaitingTasksTail->pNext = pTask;
+            pRangeLock->pWaitingTasksTail = pTask;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+static int pdmacFileAioMgrIoQueueRangeLock(PPDMACEPFILEMGR pAioMgr,
+                                           PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                           RTFOFF offStart, size_t cbRange,
+                                           PPDMACTASKFILE pTask, bool fAlignedReq)
+{
+    LogFlowFunc(("pAioMgr=%#p pEndpoint=%#p offStart=%RTfoff cbRange=%zu pTask=%#p\n",
+                 pAioMgr, pEndpoint, offStart, cbRange, pTask));
+
+    /*
+     * If there is no unaligned request active and the current one is aligned
+     * just don't use the lock.
+     */
+    if (!pEndpoint->AioMgr.cLockedReqsActive && fAlignedReq)
+    {
+        pTask->pRangeLock = NULL;
+        return VINF_SUCCESS;
+    }
+
+    PPDMACFILERANGELOCK pRangeLock = (PPDMACFILERANGELOCK)RTMemCacheAlloc(pAioMgr->hMemCacheRangeLocks);
+    if (!pRangeLock)
+        return VERR_NO_MEMORY;
+
+    /* Init the lock. */
+    pRangeLock->Core.Key          = offStart;
+    pRangeLock->Core.KeyLast      = offStart + cbRange - 1;
+    pRangeLock->cRefs             = 1;
+    pRangeLock->fReadLock         = pTask->enmTransferType == PDMACTASKFILETRANSFER_READ;
+    pRangeLock->pWaitingTasksHead = NULL;
+    pRangeLock->pWaitingTasksTail = NULL;
+
+    bool fInserted = RTAvlrFileOffsetInsert(pEndpoint->AioMgr.pTreeRangesLocked, &pRangeLock->Core);
+    AssertMsg(fInserted, ("Range lock was not inserted!\n")); NOREF(fInserted);
+
+    /* Let the task point to its lock. */
+    pTask->pRangeLock = pRangeLock;
+    pEndpoint->AioMgr.cLockedReqsActive++;
+
+    return VINF_SUCCESS;
+}
+
+static PPDMACTASKFILE pdmacFileAioMgrIoQueueRangeLockFree(PPDMACEPFILEMGR pAioMgr,
+                                                          PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                                          PPDMACFILERANGELOCK pRangeLock)
+{
+    PPDMACTASKFILE pTasksWaitingHead;
+
+    LogFlowFunc(("pAioMgr=%#p pEndpoint=%#p pRangeLock=%#p\n",
+                 pAioMgr, pEndpoint, pRangeLock));
+
+    /* pRangeLock can be NULL if there was no lock assigned with the task. */
+    if (!pRangeLock)
+        return NULL;
+
+    Assert(pRangeLock->cRefs == 1);
+
+    RTAvlrFileOffsetRemove(pEndpoint->AioMgr.pTreeRangesLocked, pRangeLock->Core.Key);
+    pTasksWaitingHead = pRangeLock->pWaitingTasksHead;
+    pRangeLock->pWaitingTasksHead = NULL;
+    pRangeLock->pWaitingTasksTail = NULL;
+    RTMemCacheFree(pAioMgr->hMemCacheRangeLocks, pRangeLock);
+    pEndpoint->AioMgr.cLockedReqsActive--;
+
+    return pTasksWaitingHead;
+}
+
+/**
+ * Puts the given request into the I/O queue.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_IOQUEUE_FULL if the request couldn't be queued, the caller has to retry later.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pEndpoint   The endpoint the request is for.
+ * @param   pTask       The task the request belongs to.
+ * @param   enmOp       The operation to perform.
+ * @param   off         Start offset in the file.
+ * @param   pvBuf       The buffer.
+ * @param   cbBuf       Number of bytes to transfer.
+ */
+static int pdmacFileAioMgrIoQueueReqPrepare(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                            PPDMACTASKFILE pTask, RTIOQUEUEOP enmOp, RTFOFF off,
+                                            void *pvBuf, size_t cbBuf)
+{
+    RTHANDLE Hnd;
+    pdmacFileAioMgrIoQueueEpHandle(pEndpoint, &Hnd);
+
+    int rc = RTIoQueueRequestPrepare(pAioMgr->hIoQueue, &Hnd, enmOp, (uint64_t)off, pvBuf, cbBuf,
+                                     0 /*fReqFlags*/, pTask);
+    if (RT_SUCCESS(rc))
+    {
+        pAioMgr->cRequestsActive++;
+        pEndpoint->AioMgr.cRequestsActive++;
+    }
+
+    return rc;
+}
+
+/**
+ * Puts the next part of a started task into the I/O queue, that is the rest of
+ * an incomplete transfer or the write following the prefetch for an unaligned
+ * write.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_IOQUEUE_FULL if the request couldn't be queued, the caller has to retry later.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pEndpoint   The endpoint the task is for.
+ * @param   pTask       The task to continue.
+ */
+static int pdmacFileAioMgrIoQueueTaskContinue(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                              PPDMACTASKFILE pTask)
+{
+    RTFOFF   offStart;
+    uint8_t *pbBuf;
+    size_t   cbTotal;
+
+    if (pTask->cbBounceBuffer)
+    {
+        offStart = (pTask->Off & ~((RTFOFF)512-1)) + pTask->cbTransfered;
+        pbBuf    = (uint8_t *)pTask->pvBounceBuffer + pTask->cbTransfered;
+        cbTotal  = pTask->cbBounceBuffer;
+    }
+    else
+    {
+        offStart = pTask->Off + pTask->cbTransfered;
+        pbBuf    = (uint8_t *)pTask->DataSeg.pvSeg + pTask->cbTransfered;
+        cbTotal  = pTask->DataSeg.cbSeg;
+    }
+
+    return pdmacFileAioMgrIoQueueReqPrepare(pAioMgr, pEndpoint, pTask,
+                                            pTask->fPrefetch || pTask->enmTransferType == PDMACTASKFILETRANSFER_READ
+                                            ? RTIOQUEUEOP_READ
+                                            : RTIOQUEUEOP_WRITE,
+                                            offStart, pbBuf, cbTotal - pTask->cbTransfered);
+}
+
+/**
+ * Completes a task without going through the I/O queue again, releasing the
+ * range lock and the bounce buffer.
+ *
+ * Tasks waiting for the range lock are put on the pending list.
+ *
+ * @returns nothing.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pEndpoint   The endpoint the task is for.
+ * @param   pTask       The task to complete.
+ * @param   rcReq       The status code to complete the task with.
+ */
+static void pdmacFileAioMgrIoQueueTaskFinish(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                             PPDMACTASKFILE pTask, int rcReq)
+{
+    if (pTask->pRangeLock)
+    {
+        PPDMACTASKFILE pTasksWaiting = pdmacFileAioMgrIoQueueRangeLockFree(pAioMgr, pEndpoint, pTask->pRangeLock);
+        pTask->pRangeLock = NULL;
+        if (pTasksWaiting)
+            pdmacFileAioMgrEpAddTaskList(pEndpoint, pTasksWaiting);
+    }
+
+    if (pTask->cbBounceBuffer)
+    {
+        if (   RT_SUCCESS(rcReq)
+            && pTask->enmTransferType == PDMACTASKFILETRANSFER_READ)
+            memcpy(pTask->DataSeg.pvSeg, (uint8_t *)pTask->pvBounceBuffer + pTask->offBounceBuffer, pTask->DataSeg.cbSeg);
+
+        RTMemPageFree(pTask->pvBounceBuffer, pTask->cbBounceBuffer);
+        pTask->cbBounceBuffer = 0;
+        pTask->pvBounceBuffer = NULL;
+    }
+
+    pTask->fRestart = false;
+    LogFlow(("Task=%#p finished with %Rrc\n", pTask, rcReq));
+    pTask->pfnCompleted(pTask, pTask->pvUser, rcReq);
+    pdmacFileTaskFree(pEndpoint, pTask);
+}
+
+/**
+ * Puts the next part of a started task into the I/O queue after a completion.
+ *
+ * If the queue is full the task goes to the head of the pending list and is
+ * restarted once there is room again, any other error completes the task.
+ *
+ * @returns nothing.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pEndpoint   The endpoint the task is for.
+ * @param   pTask       The task to continue.
+ */
+static void pdmacFileAioMgrIoQueueTaskRestart(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                              PPDMACTASKFILE pTask)
+{
+    int rc = pdmacFileAioMgrIoQueueTaskContinue(pAioMgr, pEndpoint, pTask);
+    if (rc == VERR_IOQUEUE_FULL)
+    {
+        LogFlow(("Queue full, restarting task %#p later\n", pTask));
+        pTask->fRestart = true;
+        pTask->pNext = pEndpoint->AioMgr.pReqsPendingHead;
+        pEndpoint->AioMgr.pReqsPendingHead = pTask;
+        if (!pEndpoint->AioMgr.pReqsPendingTail)
+            pEndpoint->AioMgr.pReqsPendingTail = pTask;
+    }
+    else if (RT_FAILURE(rc))
+        pdmacFileAioMgrIoQueueTaskFinish(pAioMgr, pEndpoint, pTask, rc);
+}
+
+/**
+ * Puts the started tasks waiting at the head of the pending list into the I/O
+ * queue again.
+ *
+ * This is done regardless of a pending flush or endpoint migration as both
+ * wait for these tasks to complete.
+ *
+ * @returns nothing.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pEndpoint   The endpoint.
+ */
+static void pdmacFileAioMgrIoQueueEpRestartPending(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint)
+{
+    while (pdmacFileAioMgrIoQueueEpHasRestartPending(pEndpoint))
+    {
+        PPDMACTASKFILE pTask = pEndpoint->AioMgr.pReqsPendingHead;
+        int rc = pdmacFileAioMgrIoQueueTaskContinue(pAioMgr, pEndpoint, pTask);
+        if (rc == VERR_IOQUEUE_FULL)
+            break;
+
+        pEndpoint->AioMgr.pReqsPendingHead = pTask->pNext;
+        if (!pEndpoint->AioMgr.pReqsPendingHead)
+            pEndpoint->AioMgr.pReqsPendingTail = NULL;
+        pTask->pNext    = NULL;
+        pTask->fRestart = false;
+        if (RT_FAILURE(rc))
+            pdmacFileAioMgrIoQueueTaskFinish(pAioMgr, pEndpoint, pTask, rc);
+    }
+}
+
+/**
+ * Prepares a read or write task, using a bounce buffer if the alignment
+ * restrictions of the host can't be met for a non buffered endpoint.
+ *
+ * @returns VBox status code.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pEndpoint   The endpoint the task is for.
+ * @param   pTask       The task to prepare.
+ * @param   pfDeferred  Where to store whether the task was deferred because the range is locked.
+ */
+static int pdmacFileAioMgrIoQueueTaskPrepare(PPDMACEPFILEMGR pAioMgr,
+                                             PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                             PPDMACTASKFILE pTask, bool *pfDeferred)
+{
+    PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile = (PPDMASYNCCOMPLETIONEPCLASSFILE)pEndpoint->Core.pEpClass;
+    PDMACTASKFILETRANSFER          enmTransferType = pTask->enmTransferType;
+    RTFOFF                         offStart        = pTask->Off;
+    size_t                         cbToTransfer    = pTask->DataSeg.cbSeg;
+    void                          *pvBuf           = pTask->DataSeg.pvSeg;
+    bool                           fAlignedReq     = true;
+
+    pTask->fPrefetch      = false;
+    pTask->cbBounceBuffer = 0;
+    pTask->cbTransfered   = 0;
+    *pfDeferred           = false;
+
+    if (pEndpoint->enmBackendType == PDMACFILEEPBACKEND_NON_BUFFERED)
+    {
+        /*
+         * Offset, transfer size and buffer address need to be on a 512 byte boundary
+         * when the host cache is bypassed.
+         */
+        offStart     = pTask->Off & ~(RTFOFF)(512-1);
+        cbToTransfer = RT_ALIGN_Z(pTask->DataSeg.cbSeg + (pTask->Off - offStart), 512);
+        fAlignedReq  =    cbToTransfer == pTask->DataSeg.cbSeg
+                       && offStart == pTask->Off;
+    }
+
+    /*
+     * Defer the task if an unaligned request is active for an intersecting range,
+     * see pdmacFileAioMgrNormalTaskPrepareNonBuffered() for the details.
+     */
+    if (pdmacFileAioMgrIoQueueIsRangeLocked(pEndpoint, offStart, cbToTransfer, pTask, fAlignedReq))
+    {
+        LogFlow(("Task %#p was deferred because the access range is locked\n", pTask));
+        *pfDeferred = true;
+        return VINF_SUCCESS;
+    }
+
+    if (   pEndpoint->enmBackendType == PDMACFILEEPBACKEND_NON_BUFFERED
+        && (   !fAlignedReq
+            || ((pEpClassFile->uBitmaskAlignment & (RTR3UINTPTR)pvBuf) != (RTR3UINTPTR)pvBuf)))
+    {
+        LogFlow(("Using bounce buffer for task %#p cbToTransfer=%zd cbSeg=%zd offStart=%RTfoff off=%RTfoff\n",
+                 pTask, cbToTransfer, pTask->DataSeg.cbSeg, offStart, pTask->Off));
+
+        pTask->cbBounceBuffer  = cbToTransfer;
+        pTask->offBounceBuffer = (uint32_t)(pTask->Off - offStart);
+        pTask->pvBounceBuffer  = RTMemPageAlloc(cbToTransfer);
+        if (RT_UNLIKELY(!pTask->pvBounceBuffer))
+        {
+            pTask->cbBounceBuffer = 0;
+            return VERR_NO_MEMORY;
+        }
+
+        pvBuf = pTask->pvBounceBuffer;
+        if (enmTransferType == PDMACTASKFILETRANSFER_WRITE)
+        {
+            if (!fAlignedReq)
+            {
+                /* We have to fill the buffer first before we can update the data. */
+                LogFlow(("Prefetching data for task %#p\n", pTask));
+                pTask->fPrefetch = true;
+                enmTransferType = PDMACTASKFILETRANSFER_READ;
+            }
+            else
+                memcpy(pvBuf, pTask->DataSeg.pvSeg, pTask->DataSeg.cbSeg);
+        }
+    }
+
+    if (enmTransferType == PDMACTASKFILETRANSFER_WRITE)
+    {
+        /* Grow the file if needed. */
+        if (RT_UNLIKELY((uint64_t)(pTask->Off + pTask->DataSeg.cbSeg) > pEndpoint->cbFile))
+        {
+            ASMAtomicWriteU64(&pEndpoint->cbFile, pTask->Off + pTask->DataSeg.cbSeg);
+            RTFileSetSize(pEndpoint->hFile, pTask->Off + pTask->DataSeg.cbSeg);
+        }
+    }
+
+    int rc = pdmacFileAioMgrIoQueueRangeLock(pAioMgr, pEndpoint, offStart, cbToTransfer, pTask, fAlignedReq);
+    if (RT_SUCCESS(rc))
+    {
+        rc = pdmacFileAioMgrIoQueueReqPrepare(pAioMgr, pEndpoint, pTask,
+                                              enmTransferType == PDMACTASKFILETRANSFER_WRITE
+                                              ? RTIOQUEUEOP_WRITE
+                                              : RTIOQUEUEOP_READ,
+                                              offStart, pvBuf, cbToTransfer);
+        if (RT_FAILURE(rc))
+        {
+            PPDMACTASKFILE pTasksWaiting = pdmacFileAioMgrIoQueueRangeLockFree(pAioMgr, pEndpoint, pTask->pRangeLock);
+            Assert(!pTasksWaiting); NOREF(pTasksWaiting);
+            pTask->pRangeLock = NULL;
+        }
+    }
+
+    if (   RT_FAILURE(rc)
+        && pTask->cbBounceBuffer)
+    {
+        RTMemPageFree(pTask->pvBounceBuffer, pTask->cbBounceBuffer);
+        pTask->cbBounceBuffer = 0;
+        pTask->pvBounceBuffer = NULL;
+    }
+
+    return rc;
+}
+
+static int pdmacFileAioMgrIoQueueProcessTaskList(PPDMACTASKFILE pTaskHead,
+                                                 PPDMACEPFILEMGR pAioMgr,
+                                                 PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint)
+{
+    int rc = VINF_SUCCESS;
+
+    AssertMsg(pEndpoint->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE,
+              ("Trying to process request lists of a non active endpoint!\n"));
+
+    /* Go through the list and queue the requests until we get a flush request */
+    while (   pTaskHead
+           && !pEndpoint->pFlushReq
+           && pAioMgr->cRequestsActive < pAioMgr->cRequestsActiveMax
+           && RT_SUCCESS(rc))
+    {
+        RTMSINTERVAL msWhenNext;
+        PPDMACTASKFILE pCurr = pTaskHead;
+
+        if (!pdmacEpIsTransferAllowed(&pEndpoint->Core, (uint32_t)pCurr->DataSeg.cbSeg, &msWhenNext))
+        {
+            pAioMgr->msBwLimitExpired = RT_MIN(pAioMgr->msBwLimitExpired, msWhenNext);
+            break;
+        }
+
+        pTaskHead = pTaskHead->pNext;
+        pCurr->pNext = NULL;
+
+        AssertMsg(VALID_PTR(pCurr->pEndpoint) && (pCurr->pEndpoint == pEndpoint),
+                  ("Endpoints do not match\n"));
+
+        if (pCurr->fRestart)
+        {
+            /* A started task interrupted by a full queue, just put the next part into the queue. */
+            rc = pdmacFileAioMgrIoQueueTaskContinue(pAioMgr, pEndpoint, pCurr);
+            if (rc == VERR_IOQUEUE_FULL)
+            {
+                pCurr->pNext = pTaskHead;
+                pTaskHead = pCurr;
+                rc = VINF_SUCCESS;
+                break;
+            }
+            pCurr->fRestart = false;
+            if (RT_FAILURE(rc))
+            {
+                pdmacFileAioMgrIoQueueTaskFinish(pAioMgr, pEndpoint, pCurr, rc);
+                rc = VINF_SUCCESS;
+            }
+            continue;
+        }
+
+        switch (pCurr->enmTransferType)
+        {
+            case PDMACTASKFILETRANSFER_FLUSH:
+            {
+                if (pEndpoint->fAsyncFlushSupported)
+                {
+                    rc = pdmacFileAioMgrIoQueueReqPrepare(pAioMgr, pEndpoint, pCurr, RTIOQUEUEOP_SYNC,
+                                                          0 /*off*/, NULL /*pvBuf*/, 0 /*cbBuf*/);
+                    if (rc == VERR_IOQUEUE_FULL)
+                    {
+                        /* Retry when there is room again. */
+                        pCurr->pNext = pTaskHead;
+                        pTaskHead = pCurr;
+                        rc = VINF_SUCCESS;
+                        break;
+                    }
+                    else if (RT_FAILURE(rc))
+                    {
+                        LogRel(("AIOMgr: Preparing flush failed with %Rrc, disabling async flushes\n", rc));
+                        pEndpoint->fAsyncFlushSupported = false;
+                        rc = VINF_SUCCESS; /* Fake success */
+                    }
+                    else
+                        pEndpoint->AioMgr.cReqsProcessed++;
+                }
+
+                /* If there is no data transfer request this flush request finished immediately. */
+                if (   !pEndpoint->AioMgr.cRequestsActive
+                    && !pEndpoint->fAsyncFlushSupported)
+                {
+                    pCurr->pfnCompleted(pCurr, pCurr->pvUser, VINF_SUCCESS);
+                    pdmacFileTaskFree(pEndpoint, pCurr);
+                }
+                else
+                {
+                    Assert(!pEndpoint->pFlushReq);
+                    pEndpoint->pFlushReq = pCurr;
+                }
+                break;
+            }
+            case PDMACTASKFILETRANSFER_READ:
+            case PDMACTASKFILETRANSFER_WRITE:
+            {
+                bool fDeferred = false;
+                rc = pdmacFileAioMgrIoQueueTaskPrepare(pAioMgr, pEndpoint, pCurr, &fDeferred);
+                if (rc == VERR_IOQUEUE_FULL)
+                {
+                    pCurr->pNext = pTaskHead;
+                    pTaskHead = pCurr;
+                    rc = VINF_SUCCESS;
+                }
+                else if (RT_FAILURE(rc))
+                {
+                    pCurr->pfnCompleted(pCurr, pCurr->pvUser, rc);
+                    pdmacFileTaskFree(pEndpoint, pCurr);
+                    rc = VINF_SUCCESS;
+                }
+                break;
+            }
+            default:
+                AssertMsgFailed(("Invalid transfer type %d\n", pCurr->enmTransferType));
+        } /* switch transfer type */
+
+        /* Stop here if the queue is full and try again once requests completed. */
+        if (pTaskHead == pCurr)
+            break;
+    }
+
+    if (pTaskHead)
+    {
+        /* Add the rest of the tasks to the pending list */
+        pdmacFileAioMgrEpAddTaskList(pEndpoint, pTaskHead);
+    }
+
+    return rc;
+}
+
+/**
+ * Adds all pending requests for the given endpoint
+ * until a flush request is encountered or there is no
+ * request anymore.
+ *
+ * @returns VBox status code.
+ * @param   pAioMgr    The async I/O manager for the endpoint
+ * @param   pEndpoint  The endpoint to get the requests from.
+ */
+static int pdmacFileAioMgrIoQueueQueueReqs(PPDMACEPFILEMGR pAioMgr,
+                                           PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint)
+{
+    int rc = VINF_SUCCESS;
+    PPDMACTASKFILE pTasksHead = NULL;
+
+    AssertMsg(pEndpoint->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE,
+              ("Trying to process request lists of a non active endpoint!\n"));
+
+    Assert(!pEndpoint->pFlushReq);
+
+    /* Check the pending list first */
+    if (pEndpoint->AioMgr.pReqsPendingHead)
+    {
+        LogFlow(("Queuing pending requests first\n"));
+
+        pTasksHead = pEndpoint->AioMgr.pReqsPendingHead;
+        /*
+         * Clear the list as the processing routine will insert them into the list
+         * again if it gets a flush request.
+         */
+        pEndpoint->AioMgr.pReqsPendingHead = NULL;
+        pEndpoint->AioMgr.pReqsPendingTail = NULL;
+        rc = pdmacFileAioMgrIoQueueProcessTaskList(pTasksHead, pAioMgr, pEndpoint);
+        AssertRC(rc);
+    }
+
+    if (   RT_SUCCESS(rc)
+        && !pEndpoint->pFlushReq
+        && !pEndpoint->AioMgr.pReqsPendingHead)
+    {
+        /* Now the request queue. */
+        pTasksHead = pdmacFileEpGetNewTasks(pEndpoint);
+        if (pTasksHead)
+        {
+            rc = pdmacFileAioMgrIoQueueProcessTaskList(pTasksHead, pAioMgr, pEndpoint);
+            AssertRC(rc);
+        }
+    }
+
+    return rc;
+}
+
+static int pdmacFileAioMgrIoQueueProcessBlockingEvent(PPDMACEPFILEMGR pAioMgr)
+{
+    int rc = VINF_SUCCESS;
+    bool fNotifyWaiter = false;
+
+    LogFlowFunc((": Enter\n"));
+
+    Assert(pAioMgr->fBlockingEventPending);
+
+    switch (pAioMgr->enmBlockingEvent)
+    {
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_ADD_ENDPOINT:
+        {
+            PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointNew = ASMAtomicReadPtrT(&pAioMgr->BlockingEventData.AddEndpoint.pEndpoint, PPDMASYNCCOMPLETIONENDPOINTFILE);
+            AssertMsg(VALID_PTR(pEndpointNew), ("Adding endpoint event without a endpoint to add\n"));
+
+            pEndpointNew->enmState = PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE;
+
+            pEndpointNew->AioMgr.pEndpointNext = pAioMgr->pEndpointsHead;
+            pEndpointNew->AioMgr.pEndpointPrev = NULL;
+            if (pAioMgr->pEndpointsHead)
+                pAioMgr->pEndpointsHead->AioMgr.pEndpointPrev = pEndpointNew;
+            pAioMgr->pEndpointsHead = pEndpointNew;
+
+            /* Register the file with the I/O queue. */
+            RTHANDLE Hnd;
+            pdmacFileAioMgrIoQueueEpHandle(pEndpointNew, &Hnd);
+            rc = RTIoQueueHandleRegister(pAioMgr->hIoQueue, &Hnd);
+            fNotifyWaiter = true;
+            pAioMgr->cEndpoints++;
+            break;
+        }
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_REMOVE_ENDPOINT:
+        {
+            PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointRemove = ASMAtomicReadPtrT(&pAioMgr->BlockingEventData.RemoveEndpoint.pEndpoint, PPDMASYNCCOMPLETIONENDPOINTFILE);
+            AssertMsg(VALID_PTR(pEndpointRemove), ("Removing endpoint event without a endpoint to remove\n"));
+
+            /*
+             * The event stays pending until all requests of the endpoint completed,
+             * only release the file when we get here again.
+             */
+            if (pEndpointRemove->enmState != PDMASYNCCOMPLETIONENDPOINTFILESTATE_REMOVING)
+            {
+                pEndpointRemove->enmState = PDMASYNCCOMPLETIONENDPOINTFILESTATE_REMOVING;
+                fNotifyWaiter = !pdmacFileAioMgrIoQueueRemoveEndpoint(pEndpointRemove);
+            }
+            else if (!pEndpointRemove->AioMgr.cRequestsActive)
+            {
+                pdmacFileAioMgrIoQueueEpRelease(pAioMgr, pEndpointRemove);
+                fNotifyWaiter = true;
+            }
+            break;
+        }
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_CLOSE_ENDPOINT:
+        {
+            PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointClose = ASMAtomicReadPtrT(&pAioMgr->BlockingEventData.CloseEndpoint.pEndpoint, PPDMASYNCCOMPLETIONENDPOINTFILE);
+            AssertMsg(VALID_PTR(pEndpointClose), ("Close endpoint event without a endpoint to close\n"));
+
+            if (pEndpointClose->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE)
+            {
+                LogFlowFunc((": Closing endpoint %#p{%s}\n", pEndpointClose, pEndpointClose->Core.pszUri));
+
+                /* Make sure all tasks finished. Process the queues a last time first. */
+                rc = pdmacFileAioMgrIoQueueQueueReqs(pAioMgr, pEndpointClose);
+                AssertRC(rc);
+
+                pEndpointClose->enmState = PDMASYNCCOMPLETIONENDPOINTFILESTATE_CLOSING;
+                fNotifyWaiter = !pdmacFileAioMgrIoQueueRemoveEndpoint(pEndpointClose);
+            }
+            else if (   (pEndpointClose->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_CLOSING)
+                     && (!pEndpointClose->AioMgr.cRequestsActive))
+            {
+                pdmacFileAioMgrIoQueueEpRelease(pAioMgr, pEndpointClose);
+                fNotifyWaiter = true;
+            }
+            break;
+        }
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_SHUTDOWN:
+        {
+            pAioMgr->enmState = PDMACEPFILEMGRSTATE_SHUTDOWN;
+            if (!pAioMgr->cRequestsActive)
+                fNotifyWaiter = true;
+            break;
+        }
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_SUSPEND:
+        {
+            pAioMgr->enmState = PDMACEPFILEMGRSTATE_SUSPENDING;
+            break;
+        }
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_RESUME:
+        {
+            pAioMgr->enmState = PDMACEPFILEMGRSTATE_RUNNING;
+            fNotifyWaiter = true;
+            break;
+        }
+        default:
+            AssertReleaseMsgFailed(("Invalid event type %d\n", pAioMgr->enmBlockingEvent));
+    }
+
+    if (fNotifyWaiter)
+    {
+        ASMAtomicWriteBool(&pAioMgr->fBlockingEventPending, false);
+        pAioMgr->enmBlockingEvent = PDMACEPFILEAIOMGRBLOCKINGEVENT_INVALID;
+
+        /* Release the waiting thread. */
+        LogFlow(("Signalling waiter\n"));
+        rc = RTSemEventSignal(pAioMgr->EventSemBlock);
+        AssertRC(rc);
+    }
+
+    LogFlowFunc((": Leave\n"));
+    return rc;
+}
+
+/**
+ * Checks all endpoints for pending events or new requests and
+ * commits everything queued to the I/O queue.
+ *
+ * @returns VBox status code.
+ * @param   pAioMgr    The I/O manager handle.
+ */
+static int pdmacFileAioMgrIoQueueCheckEndpoints(PPDMACEPFILEMGR pAioMgr)
+{
+    int rc = VINF_SUCCESS;
+    PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint = pAioMgr->pEndpointsHead;
+
+    pAioMgr->msBwLimitExpired = RT_INDEFINITE_WAIT;
+
+    while (pEndpoint)
+    {
+        if (pEndpoint->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE)
+            pdmacFileAioMgrIoQueueEpRestartPending(pAioMgr, pEndpoint);
+
+        if (   !pEndpoint->pFlushReq
+            && pEndpoint->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE
+            && !pEndpoint->AioMgr.fMoving)
+        {
+            rc = pdmacFileAioMgrIoQueueQueueReqs(pAioMgr, pEndpoint);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+
+        pEndpoint = pEndpoint->AioMgr.pEndpointNext;
+    }
+
+    /* Submit everything prepared in one go. */
+    rc = RTIoQueueCommit(pAioMgr->hIoQueue);
+    if (rc == VERR_IOQUEUE_EMPTY)
+        rc = VINF_SUCCESS;
+
+    return rc;
+}
+
+/**
+ * Moves the endpoint over to the destination manager once all requests are done.
+ *
+ * @returns nothing.
+ * @param   pEndpoint   The endpoint to migrate.
+ */
+static void pdmacFileAioMgrIoQueueEpMigrate(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint)
+{
+    bool fReqsPending = pdmacFileAioMgrIoQueueRemoveEndpoint(pEndpoint);
+    Assert(!fReqsPending); NOREF(fReqsPending);
+
+    pEndpoint->AioMgr.fMoving = false;
+    int rc = pdmacFileAioMgrAddEndpoint(pEndpoint->AioMgr.pAioMgrDst, pEndpoint);
+    AssertRC(rc);
+}
+
+/**
+ * Processes a completion event of the I/O queue.
+ *
+ * @returns nothing.
+ * @param   pAioMgr         The I/O manager.
+ * @param   pTask           The task the completed request belongs to.
+ * @param   rcReq           Status code of the completed request.
+ * @param   cbTransfered    Number of bytes transferred.
+ */
+static void pdmacFileAioMgrIoQueueReqComplete(PPDMACEPFILEMGR pAioMgr, PPDMACTASKFILE pTask,
+                                              int rcReq, size_t cbTransfered)
+{
+    int rc = VINF_SUCCESS;
+    PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint = pTask->pEndpoint;
+    PPDMACTASKFILE pTasksWaiting;
+
+    LogFlowFunc(("pAioMgr=%#p pTask=%#p rcReq=%Rrc cbTransfered=%zu\n", pAioMgr, pTask, rcReq, cbTransfered));
+
+    pAioMgr->cRequestsActive--;
+    pEndpoint->AioMgr.cRequestsActive--;
+    pEndpoint->AioMgr.cReqsProcessed++;
+
+    if (pTask->enmTransferType == PDMACTASKFILETRANSFER_FLUSH)
+    {
+        AssertMsg(pEndpoint->pFlushReq == pTask, ("Completed flush request doesn't match active one\n"));
+        pEndpoint->pFlushReq = NULL;
+
+        if (RT_FAILURE(rcReq))
+        {
+            /* The other method will take over now. */
+            LogRel(("AIOMgr: Flush failed with %Rrc, disabling async flushes\n", rcReq));
+            pEndpoint->fAsyncFlushSupported = false;
+            rcReq = VINF_SUCCESS;
+        }
+
+        LogFlow(("Flush task=%#p completed with %Rrc\n", pTask, rcReq));
+        pTask->pfnCompleted(pTask, pTask->pvUser, rcReq);
+        pdmacFileTaskFree(pEndpoint, pTask);
+        return;
+    }
+
+    if (RT_FAILURE(rcReq))
+    {
+        /* Free the lock and process pending tasks if necessary */
+        pTasksWaiting = pdmacFileAioMgrIoQueueRangeLockFree(pAioMgr, pEndpoint, pTask->pRangeLock);
+        pTask->pRangeLock = NULL;
+        if (pTasksWaiting)
+        {
+            rc = pdmacFileAioMgrIoQueueProcessTaskList(pTasksWaiting, pAioMgr, pEndpoint);
+            AssertRC(rc);
+        }
+
+        if (pTask->cbBounceBuffer)
+        {
+            RTMemPageFree(pTask->pvBounceBuffer, pTask->cbBounceBuffer);
+            pTask->cbBounceBuffer = 0;
+            pTask->pvBounceBuffer = NULL;
+        }
+
+        /*
+         * Fatal errors are reported to the guest and non-fatal errors
+         * will cause a migration to the failsafe manager in the hope
+         * that the error disappears.
+         */
+        if (!pdmacFileAioMgrIoQueueRcIsFatal(rcReq))
+        {
+            /* Queue the request on the pending list. */
+            pTask->pNext = pEndpoint->AioMgr.pReqsPendingHead;
+            pEndpoint->AioMgr.pReqsPendingHead = pTask;
+            if (!pEndpoint->AioMgr.pReqsPendingTail)
+                pEndpoint->AioMgr.pReqsPendingTail = pTask;
+
+            if (!pEndpoint->AioMgr.fMoving)
+            {
+                PPDMACEPFILEMGR pAioMgrFailsafe;
+
+                LogRel(("%s: Request %#p failed with rc=%Rrc, migrating endpoint %s to failsafe manager.\n",
+                        RTThreadGetName(pAioMgr->Thread), pTask, rcReq, pEndpoint->Core.pszUri));
+
+                pEndpoint->AioMgr.fMoving = true;
+
+                rc = pdmacFileAioMgrCreate((PPDMASYNCCOMPLETIONEPCLASSFILE)pEndpoint->Core.pEpClass,
+                                           &pAioMgrFailsafe, PDMACEPFILEMGRTYPE_SIMPLE);
+                AssertRC(rc);
+
+                pEndpoint->AioMgr.pAioMgrDst = pAioMgrFailsafe;
+
+                /* Update the flags to open the file with. Disable async I/O and enable the host cache. */
+                pEndpoint->fFlags &= ~(RTFILE_O_ASYNC_IO | RTFILE_O_NO_CACHE);
+            }
+
+            /* If this was the last request for the endpoint migrate it to the new manager. */
+            if (pdmacFileAioMgrIoQueueEpIsIdle(pEndpoint))
+                pdmacFileAioMgrIoQueueEpMigrate(pEndpoint);
+        }
+        else
+        {
+            pTask->pfnCompleted(pTask, pTask->pvUser, rcReq);
+            pdmacFileTaskFree(pEndpoint, pTask);
+        }
+        return;
+    }
+
+    /*
+     * Restart an incomplete transfer.
+     * This usually means that the request will return an error now
+     * but to get the cause of the error (disk full, file too big, I/O error, ...)
+     * the transfer needs to be continued.
+     */
+    pTask->cbTransfered += cbTransfered;
+
+    size_t cbTotal = pTask->cbBounceBuffer ? pTask->cbBounceBuffer : pTask->DataSeg.cbSeg;
+    if (RT_UNLIKELY(pTask->cbTransfered < cbTotal))
+    {
+        LogFlow(("Restarting incomplete transfer %#p (%zu bytes transferred)\n",
+                 pTask, cbTransfered));
+        pdmacFileAioMgrIoQueueTaskRestart(pAioMgr, pEndpoint, pTask);
+        return;
+    }
+
+    if (pTask->fPrefetch)
+    {
+        Assert(pTask->enmTransferType == PDMACTASKFILETRANSFER_WRITE);
+        Assert(pTask->cbBounceBuffer);
+
+        memcpy((uint8_t *)pTask->pvBounceBuffer + pTask->offBounceBuffer,
+               pTask->DataSeg.pvSeg,
+               pTask->DataSeg.cbSeg);
+
+        /* Write it now. */
+        pTask->fPrefetch    = false;
+        pTask->cbTransfered = 0;
+
+        /* Grow the file if needed. */
+        if (RT_UNLIKELY((uint64_t)(pTask->Off + pTask->DataSeg.cbSeg) > pEndpoint->cbFile))
+        {
+            ASMAtomicWriteU64(&pEndpoint->cbFile, pTask->Off + pTask->DataSeg.cbSeg);
+            RTFileSetSize(pEndpoint->hFile, pTask->Off + pTask->DataSeg.cbSeg);
+        }
+
+        pdmacFileAioMgrIoQueueTaskRestart(pAioMgr, pEndpoint, pTask);
+        return;
+    }
+
+    if (pTask->cbBounceBuffer)
+    {
+        if (pTask->enmTransferType == PDMACTASKFILETRANSFER_READ)
+            memcpy(pTask->DataSeg.pvSeg,
+                   (uint8_t *)pTask->pvBounceBuffer + pTask->offBounceBuffer,
+                   pTask->DataSeg.cbSeg);
+
+        RTMemPageFree(pTask->pvBounceBuffer, pTask->cbBounceBuffer);
+        pTask->cbBounceBuffer = 0;
+        pTask->pvBounceBuffer = NULL;
+    }
+
+    /* Free the lock and process pending tasks if necessary */
+    pTasksWaiting = pdmacFileAioMgrIoQueueRangeLockFree(pAioMgr, pEndpoint, pTask->pRangeLock);
+    pTask->pRangeLock = NULL;
+    if (pTasksWaiting)
+    {
+        rc = pdmacFileAioMgrIoQueueProcessTaskList(pTasksWaiting, pAioMgr, pEndpoint);
+        AssertRC(rc);
+    }
+
+    /* Call completion callback */
+    LogFlow(("Task=%#p completed with %Rrc\n", pTask, rcReq));
+    pTask->pfnCompleted(pTask, pTask->pvUser, rcReq);
+    pdmacFileTaskFree(pEndpoint, pTask);
+
+    /*
+     * If there is no request left on the endpoint but a flush request is set
+     * it completed now and we notify the owner.
+     */
+    if (pdmacFileAioMgrIoQueueEpIsIdle(pEndpoint) && pEndpoint->pFlushReq)
+    {
+        pTask = pEndpoint->pFlushReq;
+        pEndpoint->pFlushReq = NULL;
+
+        AssertMsg(pTask->pEndpoint == pEndpoint, ("Endpoint of the flush request does not match assigned one\n"));
+
+        pTask->pfnCompleted(pTask, pTask->pvUser, VINF_SUCCESS);
+        pdmacFileTaskFree(pEndpoint, pTask);
+    }
+    else if (RT_UNLIKELY(pdmacFileAioMgrIoQueueEpIsIdle(pEndpoint) && pEndpoint->AioMgr.fMoving))
+        pdmacFileAioMgrIoQueueEpMigrate(pEndpoint);
+}
+
+/**
+ * Completes all requests of an endpoint which are not in flight with the given
+ * status code, including the ones submitted to the endpoint meanwhile.
+ *
+ * @returns nothing.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pEndpoint   The endpoint.
+ * @param   rcReq       The status code to complete the requests with.
+ */
+static void pdmacFileAioMgrIoQueueEpFailAll(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, int rcReq)
+{
+    if (   pEndpoint->pFlushReq
+        && !pEndpoint->AioMgr.cRequestsActive)
+    {
+        PPDMACTASKFILE pTask = pEndpoint->pFlushReq;
+        pEndpoint->pFlushReq = NULL;
+        pTask->pfnCompleted(pTask, pTask->pvUser, rcReq);
+        pdmacFileTaskFree(pEndpoint, pTask);
+    }
+
+    /* Failing a task can put tasks waiting for its range lock on the pending list. */
+    PPDMACTASKFILE pTasks = pEndpoint->AioMgr.pReqsPendingHead;
+    while (pTasks)
+    {
+        pEndpoint->AioMgr.pReqsPendingHead = NULL;
+        pEndpoint->AioMgr.pReqsPendingTail = NULL;
+        while (pTasks)
+        {
+            PPDMACTASKFILE pTask = pTasks;
+            pTasks = pTasks->pNext;
+            pTask->pNext = NULL;
+            pdmacFileAioMgrIoQueueTaskFinish(pAioMgr, pEndpoint, pTask, rcReq);
+        }
+        pTasks = pEndpoint->AioMgr.pReqsPendingHead;
+    }
+
+    pTasks = pdmacFileEpGetNewTasks(pEndpoint);
+    while (pTasks)
+    {
+        PPDMACTASKFILE pTask = pTasks;
+        pTasks = pTasks->pNext;
+        pTask->pNext = NULL;
+        pdmacFileAioMgrIoQueueTaskFinish(pAioMgr, pEndpoint, pTask, rcReq);
+    }
+}
+
+/**
+ * Error handler for errors the I/O manager can't recover from.
+ *
+ * The requests in flight are reaped and completed, the endpoints are moved
+ * over to a failsafe manager which carries on with the pending requests.
+ * Whatever can't be moved is completed with the error.  The manager then
+ * only services blocking events until it is shut down.
+ *
+ * @returns VBox status code
+ * @param   pAioMgr     The I/O manager the error occurred on.
+ * @param   rc          The error code.
+ * @param   SRC_POS     The source location of the error (use RT_SRC_POS).
+ */
+static int pdmacFileAioMgrIoQueueErrorHandler(PPDMACEPFILEMGR pAioMgr, int rc, RT_SRC_POS_DECL)
+{
+    LogRel(("AIOMgr: I/O queue manager %#p encountered a critical error (rc=%Rrc) during operation. Falling back to failsafe mode. Expect reduced performance\n",
+            pAioMgr, rc));
+    LogRel(("AIOMgr: Error happened in %s:(%u){%s}\n", RT_SRC_POS_ARGS));
+    LogRel(("AIOMgr: Please contact the product vendor\n"));
+
+    PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile = NULL;
+    if (pAioMgr->pEndpointsHead)
+    {
+        pEpClassFile = (PPDMASYNCCOMPLETIONEPCLASSFILE)pAioMgr->pEndpointsHead->Core.pEpClass;
+        ASMAtomicWriteU32((volatile uint32_t *)&pEpClassFile->enmMgrTypeOverride, PDMACEPFILEMGRTYPE_SIMPLE);
+    }
+    pAioMgr->enmState = PDMACEPFILEMGRSTATE_FAULT;
+
+    /*
+     * Reap the requests in flight.  Completed transfers are passed on as they
+     * are, anything which would need another trip through the queue is failed.
+     */
+    while (pAioMgr->cRequestsActive)
+    {
+        RTIOQUEUECEVT aCEvts[PDMACEPFILEMGR_IOQUEUE_CEVTS];
+        uint32_t      cCEvts = 0;
+        int rc2 = RTIoQueueEvtWait(pAioMgr->hIoQueue, &aCEvts[0], RT_ELEMENTS(aCEvts), 1 /*cMinWait*/,
+                                   &cCEvts, 0 /*fFlags*/);
+        if (RT_FAILURE(rc2) && rc2 != VERR_INTERRUPTED)
+        {
+            LogRel(("AIOMgr: Failed to reap %u outstanding requests (rc=%Rrc), they are lost\n",
+                    pAioMgr->cRequestsActive, rc2));
+
+            /* Nothing will complete them, so don't let closing the endpoints wait for them. */
+            for (PPDMASYNCCOMPLETIONENDPOINTFILE pEpLost = pAioMgr->pEndpointsHead; pEpLost; pEpLost = pEpLost->AioMgr.pEndpointNext)
+                pEpLost->AioMgr.cRequestsActive = 0;
+            pAioMgr->cRequestsActive = 0;
+            break;
+        }
+
+        for (uint32_t i = 0; i < cCEvts; i++)
+        {
+            PPDMACTASKFILE                  pTask     = (PPDMACTASKFILE)aCEvts[i].pvUser;
+            PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint = pTask->pEndpoint;
+            int                             rcReq     = aCEvts[i].rcReq;
+
+            pAioMgr->cRequestsActive--;
+            pEndpoint->AioMgr.cRequestsActive--;
+
+            if (pTask->enmTransferType == PDMACTASKFILETRANSFER_FLUSH)
+            {
+                pEndpoint->pFlushReq = NULL;
+                pTask->pfnCompleted(pTask, pTask->pvUser, rcReq);
+                pdmacFileTaskFree(pEndpoint, pTask);
+                continue;
+            }
+
+            size_t cbTotal = pTask->cbBounceBuffer ? pTask->cbBounceBuffer : pTask->DataSeg.cbSeg;
+            if (   RT_SUCCESS(rcReq)
+                && (   pTask->fPrefetch
+                    || pTask->cbTransfered + aCEvts[i].cbXfered < cbTotal))
+                rcReq = rc;
+            pdmacFileAioMgrIoQueueTaskFinish(pAioMgr, pEndpoint, pTask, rcReq);
+        }
+    }
+
+    /*
+     * Move the idle endpoints over to a failsafe manager, failing everything
+     * which can't be moved.
+     */
+    PPDMACEPFILEMGR pAioMgrFailsafe = NULL;
+    PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint = pAioMgr->pEndpointsHead;
+    while (pEndpoint)
+    {
+        PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointNext = pEndpoint->AioMgr.pEndpointNext;
+
+        /* Started tasks can't be carried over, their state belongs to this manager. */
+        while (pdmacFileAioMgrIoQueueEpHasRestartPending(pEndpoint))
+        {
+            PPDMACTASKFILE pTask = pEndpoint->AioMgr.pReqsPendingHead;
+            pEndpoint->AioMgr.pReqsPendingHead = pTask->pNext;
+            if (!pEndpoint->AioMgr.pReqsPendingHead)
+                pEndpoint->AioMgr.pReqsPendingTail = NULL;
+            pTask->pNext = NULL;
+            pdmacFileAioMgrIoQueueTaskFinish(pAioMgr, pEndpoint, pTask, rc);
+        }
+
+        if (   !pEndpoint->AioMgr.cRequestsActive
+            && pEndpoint->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE)
+        {
+            if (!pEndpoint->AioMgr.fMoving && !pAioMgrFailsafe)
+            {
+                int rc2 = pdmacFileAioMgrCreate(pEpClassFile, &pAioMgrFailsafe, PDMACEPFILEMGRTYPE_SIMPLE);
+                if (RT_FAILURE(rc2))
+                {
+                    LogRel(("AIOMgr: Creating the failsafe manager failed with %Rrc\n", rc2));
+                    pAioMgrFailsafe = NULL;
+                }
+            }
+
+            if (pEndpoint->AioMgr.fMoving || pAioMgrFailsafe)
+            {
+                /* A pending flush goes first as it was issued before the other pending requests. */
+                if (pEndpoint->pFlushReq)
+                {
+                    pEndpoint->pFlushReq->pNext = pEndpoint->AioMgr.pReqsPendingHead;
+                    pEndpoint->AioMgr.pReqsPendingHead = pEndpoint->pFlushReq;
+                    if (!pEndpoint->AioMgr.pReqsPendingTail)
+                        pEndpoint->AioMgr.pReqsPendingTail = pEndpoint->pFlushReq;
+                    pEndpoint->pFlushReq = NULL;
+                }
+
+                if (!pEndpoint->AioMgr.fMoving)
+                {
+                    pEndpoint->AioMgr.fMoving    = true;
+                    pEndpoint->AioMgr.pAioMgrDst = pAioMgrFailsafe;
+                    pEndpoint->fFlags &= ~(RTFILE_O_ASYNC_IO | RTFILE_O_NO_CACHE);
+                }
+                LogRel(("AIOMgr: Migrating endpoint %s to failsafe manager\n", pEndpoint->Core.pszUri));
+                pdmacFileAioMgrIoQueueEpMigrate(pEndpoint);
+                pEndpoint = pEndpointNext;
+                continue;
+            }
+        }
+
+        pdmacFileAioMgrIoQueueEpFailAll(pAioMgr, pEndpoint, rc);
+        pEndpoint = pEndpointNext;
+    }
+
+    /*
+     * Service blocking events and fail whatever gets submitted to the endpoints
+     * left on this manager until it is shut down.
+     */
+    while (pAioMgr->enmState != PDMACEPFILEMGRSTATE_SHUTDOWN)
+    {
+        ASMAtomicWriteBool(&pAioMgr->fWaitingEventSem, true);
+        if (!ASMAtomicReadBool(&pAioMgr->fWokenUp))
+            RTSemEventWait(pAioMgr->EventSem, RT_INDEFINITE_WAIT);
+        ASMAtomicWriteBool(&pAioMgr->fWaitingEventSem, false);
+        ASMAtomicWriteBool(&pAioMgr->fWokenUp, false);
+
+        for (pEndpoint = pAioMgr->pEndpointsHead; pEndpoint; pEndpoint = pEndpoint->AioMgr.pEndpointNext)
+            pdmacFileAioMgrIoQueueEpFailAll(pAioMgr, pEndpoint, rc);
+
+        if (pAioMgr->fBlockingEventPending)
+        {
+            pdmacFileAioMgrIoQueueProcessBlockingEvent(pAioMgr);
+
+            /*
+             * Closing and removing an endpoint stays pending until its requests
+             * complete. There is nothing in flight anymore, so finish it right away.
+             */
+            if (pAioMgr->fBlockingEventPending)
+                pdmacFileAioMgrIoQueueProcessBlockingEvent(pAioMgr);
+
+            if (pAioMgr->enmState != PDMACEPFILEMGRSTATE_SHUTDOWN)
+                pAioMgr->enmState = PDMACEPFILEMGRSTATE_FAULT; /* Suspend/resume doesn't change a thing. */
+        }
+    }
+
+    return VINF_SUCCESS;
+}
+
+/** Helper macro for checking for error codes. */
+#define CHECK_RC(pAioMgr, rc) \
+    if (RT_FAILURE(rc)) \
+    {\
+        int rc2 = pdmacFileAioMgrIoQueueErrorHandler(pAioMgr, rc, RT_SRC_POS);\
+        return rc2;\
+    }
+
+/**
+ * The I/O manager using the RTIoQueue API.
+ *
+ * Compared to the normal manager requests of all endpoints are collected and
+ * submitted with a single commit, completions are reaped in batches and new
+ * requests kick the thread out of the completion wait right away.
+ *
+ * @returns VBox status code.
+ * @param   hThreadSelf Handle of the thread.
+ * @param   pvUser      Opaque user data.
+ */
+DECLCALLBACK(int) pdmacFileAioMgrIoQueue(RTTHREAD hThreadSelf, void *pvUser)
+{
+    int             rc          = VINF_SUCCESS;
+    PPDMACEPFILEMGR pAioMgr     = (PPDMACEPFILEMGR)pvUser;
+    uint64_t        uMillisEnd  = RTTimeMilliTS() + PDMACEPFILEMGR_LOAD_UPDATE_PERIOD;
+    NOREF(hThreadSelf);
+
+    while (   pAioMgr->enmState == PDMACEPFILEMGRSTATE_RUNNING
+           || pAioMgr->enmState == PDMACEPFILEMGRSTATE_SUSPENDING)
+    {
+        if (!pAioMgr->cRequestsActive)
+        {
+            ASMAtomicWriteBool(&pAioMgr->fWaitingEventSem, true);
+            if (!ASMAtomicReadBool(&pAioMgr->fWokenUp))
+                rc = RTSemEventWait(pAioMgr->EventSem, pAioMgr->msBwLimitExpired);
+            ASMAtomicWriteBool(&pAioMgr->fWaitingEventSem, false);
+            Assert(RT_SUCCESS(rc) || rc == VERR_TIMEOUT);
+
+            LogFlow(("Got woken up\n"));
+            ASMAtomicWriteBool(&pAioMgr->fWokenUp, false);
+        }
+
+        /* Check for an external blocking event first. */
+        if (pAioMgr->fBlockingEventPending)
+        {
+            rc = pdmacFileAioMgrIoQueueProcessBlockingEvent(pAioMgr);
+            CHECK_RC(pAioMgr, rc);
+        }
+
+        if (RT_LIKELY(pAioMgr->enmState == PDMACEPFILEMGRSTATE_RUNNING))
+        {
+            /* We got woken up because an endpoint issued new requests. Queue them. */
+            rc = pdmacFileAioMgrIoQueueCheckEndpoints(pAioMgr);
+            CHECK_RC(pAioMgr, rc);
+
+            while (pAioMgr->cRequestsActive)
+            {
+                RTIOQUEUECEVT aCEvts[PDMACEPFILEMGR_IOQUEUE_CEVTS];
+                uint32_t      cCEvts = 0;
+
+                ASMAtomicWriteBool(&pAioMgr->fWaitingIoQueue, true);
+                if (!ASMAtomicReadBool(&pAioMgr->fWokenUp))
+                    rc = RTIoQueueEvtWait(pAioMgr->hIoQueue, &aCEvts[0], RT_ELEMENTS(aCEvts), 1 /*cMinWait*/,
+                                          &cCEvts, 0 /*fFlags*/);
+                else
+                    rc = VERR_INTERRUPTED;
+                ASMAtomicWriteBool(&pAioMgr->fWaitingIoQueue, false);
+                ASMAtomicWriteBool(&pAioMgr->fWokenUp, false);
+                if (RT_FAILURE(rc) && rc != VERR_INTERRUPTED)
+                    CHECK_RC(pAioMgr, rc);
+
+                LogFlow(("%u tasks completed\n", cCEvts));
+
+                for (uint32_t i = 0; i < cCEvts; i++)
+                    pdmacFileAioMgrIoQueueReqComplete(pAioMgr, (PPDMACTASKFILE)aCEvts[i].pvUser,
+                                                      aCEvts[i].rcReq, aCEvts[i].cbXfered);
+
+                /* Check for an external blocking event before we go to sleep again. */
+                if (pAioMgr->fBlockingEventPending)
+                {
+                    rc = pdmacFileAioMgrIoQueueProcessBlockingEvent(pAioMgr);
+                    CHECK_RC(pAioMgr, rc);
+                }
+
+                /* Update load statistics. */
+                uint64_t uMillisCurr = RTTimeMilliTS();
+                if (uMillisCurr > uMillisEnd)
+                {
+                    PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointCurr = pAioMgr->pEndpointsHead;
+
+                    /* Calculate timespan. */
+                    uMillisCurr -= uMillisEnd;
+
+                    while (pEndpointCurr)
+                    {
+                        pEndpointCurr->AioMgr.cReqsPerSec    = pEndpointCurr->AioMgr.cReqsProcessed / (uMillisCurr + PDMACEPFILEMGR_LOAD_UPDATE_PERIOD);
+                        pEndpointCurr->AioMgr.cReqsProcessed = 0;
+                        pEndpointCurr = pEndpointCurr->AioMgr.pEndpointNext;
+                    }
+
+                    /* Set new update interval */
+                    uMillisEnd = RTTimeMilliTS() + PDMACEPFILEMGR_LOAD_UPDATE_PERIOD;
+                }
+
+                /*
+                 * Check endpoints for new requests, this also commits any request
+                 * restarted or unblocked by the completions above.
+                 */
+                rc = pdmacFileAioMgrIoQueueCheckEndpoints(pAioMgr);
+                CHECK_RC(pAioMgr, rc);
+            } /* while requests are active. */
+        } /* if still running */
+    } /* while running */
+
+    LogFlowFunc(("rc=%Rrc\n", rc));
+    return rc;
+}
+
+#undef CHECK_RC
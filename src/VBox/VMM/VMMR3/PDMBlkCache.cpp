@@ -16,7 +16,16 @@
  */
 
 /** @page pg_pdm_block_cache     PDM Block Cache - The I/O cache
- * This component implements an I/O cache based on the 2Q cache algorithm.
+ * This component implements an I/O cache based on the 2Q cache algorithm,
+ * optionally replaced by ARC (PDM/BlkCache/CachePolicy).
+ *
+ * The cache is split into shards (PDM/BlkCache/CacheShards) each having its
+ * own lock, LRU lists and a fixed part of the cache size. Entries are assigned
+ * to a shard based on the endpoint and the offset so that I/O from different
+ * storage controllers doesn't serialize on a single lock. Cache hits don't take
+ * the shard lock at all but only mark the entry as referenced, reordering the
+ * lists is deferred to the eviction code which gives referenced entries a
+ * second chance.
  */
 
 
@@ -27,6 +36,7 @@
 #include "PDMInternal.h"
 #include <iprt/asm.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
 #include <iprt/path.h>
 #include <iprt/string.h>
 #include <iprt/trace.h>
@@ -71,6 +81,22 @@
 
 #define PDM_BLK_CACHE_SAVED_STATE_VERSION 1
 
+/** Log2 of the size of the region of an endpoint mapped to the same shard. */
+#define PDM_BLK_CACHE_SHARD_REGION_SHIFT  20
+/** Maximum number of shards. */
+#define PDM_BLK_CACHE_SHARDS_MAX          64
+/** Minimum size of a single shard when the number of shards is not configured.
+ * A request bigger than a shard can't be cached, so this must stay well above
+ * the largest transfer size a device issues.  With the default cache size of
+ * 5MB there is only a single shard. */
+#define PDM_BLK_CACHE_SHARD_SIZE_MIN      _16M
+/** Number of consecutive sequential reads before read ahead kicks in. */
+#define PDM_BLK_CACHE_READ_AHEAD_TRIGGER  2
+/** Initial size of the read ahead window. */
+#define PDM_BLK_CACHE_READ_AHEAD_WINDOW_MIN _64K
+/** Maximum size of a single entry created by read ahead. */
+#define PDM_BLK_CACHE_READ_AHEAD_ENTRY_MAX  _256K
+
 /* Enable to enable some tracing in the block cache code for investigating issues. */
 /*#define VBOX_BLKCACHE_TRACING 1*/
 
@@ -128,17 +154,18 @@ DECLINLINE(void) pdmBlkCacheEntryRef(PPDMBLKCACHEENTRY pEntry)
 }
 
 #ifdef VBOX_STRICT
-static void pdmBlkCacheValidate(PPDMBLKCACHEGLOBAL pCache)
+static void pdmBlkCacheShardValidate(PPDMBLKCACHESHARD pShard)
 {
     /* Amount of cached data should never exceed the maximum amount. */
-    AssertMsg(pCache->cbCached <= pCache->cbMax,
+    AssertMsg(pShard->cbCached <= pShard->cbMax,
               ("Current amount of cached data exceeds maximum\n"));
 
     /* The amount of cached data in the LRU and FRU list should match cbCached */
-    AssertMsg(pCache->LruRecentlyUsedIn.cbCached + pCache->LruFrequentlyUsed.cbCached == pCache->cbCached,
+    AssertMsg(pShard->LruRecentlyUsedIn.cbCached + pShard->LruFrequentlyUsed.cbCached == pShard->cbCached,
               ("Amount of cached data doesn't match\n"));
 
-    AssertMsg(pCache->LruRecentlyUsedOut.cbCached <= pCache->cbRecentlyUsedOutMax,
+    AssertMsg(   pShard->pCache->enmPolicy != PDMBLKCACHEPOLICY_2Q
+              || pShard->LruRecentlyUsedOut.cbCached <= pShard->cbRecentlyUsedOutMax,
               ("Paged out list exceeds maximum\n"));
 }
 #endif
@@ -146,29 +173,103 @@ static void pdmBlkCacheValidate(PPDMBLKCACHEGLOBAL pCache)
 DECLINLINE(void) pdmBlkCacheLockEnter(PPDMBLKCACHEGLOBAL pCache)
 {
     RTCritSectEnter(&pCache->CritSect);
+}
+
+DECLINLINE(void) pdmBlkCacheLockLeave(PPDMBLKCACHEGLOBAL pCache)
+{
+    RTCritSectLeave(&pCache->CritSect);
+}
+
+DECLINLINE(void) pdmBlkCacheShardLockEnter(PPDMBLKCACHESHARD pShard)
+{
+    if (RT_FAILURE(RTCritSectTryEnter(&pShard->CritSect)))
+    {
+        STAM_REL_COUNTER_INC(&pShard->StatLockContention);
+        RTCritSectEnter(&pShard->CritSect);
+    }
 #ifdef VBOX_STRICT
-    pdmBlkCacheValidate(pCache);
+    pdmBlkCacheShardValidate(pShard);
 #endif
 }
 
-DECLINLINE(void) pdmBlkCacheLockLeave(PPDMBLKCACHEGLOBAL pCache)
+DECLINLINE(void) pdmBlkCacheShardLockLeave(PPDMBLKCACHESHARD pShard)
 {
 #ifdef VBOX_STRICT
-    pdmBlkCacheValidate(pCache);
+    pdmBlkCacheShardValidate(pShard);
 #endif
-    RTCritSectLeave(&pCache->CritSect);
+    RTCritSectLeave(&pShard->CritSect);
+}
+
+/**
+ * Enters the locks of all shards, used when the whole cache of an endpoint
+ * is destroyed.
+ *
+ * @returns nothing.
+ * @param   pCache    The global cache instance.
+ */
+static void pdmBlkCacheShardsLockEnterAll(PPDMBLKCACHEGLOBAL pCache)
+{
+    /* Always in ascending order to not deadlock with another thread doing the same. */
+    for (uint32_t i = 0; i < pCache->cShards; i++)
+        pdmBlkCacheShardLockEnter(&pCache->aShards[i]);
+}
+
+/**
+ * Leaves the locks of all shards.
+ *
+ * @returns nothing.
+ * @param   pCache    The global cache instance.
+ */
+static void pdmBlkCacheShardsLockLeaveAll(PPDMBLKCACHEGLOBAL pCache)
+{
+    for (uint32_t i = pCache->cShards; i > 0; i--)
+        pdmBlkCacheShardLockLeave(&pCache->aShards[i - 1]);
+}
+
+/**
+ * Returns the shard an entry of the given endpoint starting at the given
+ * offset is assigned to.
+ *
+ * Each endpoint starts at a different shard and consecutive regions of an
+ * endpoint are spread over the following shards so that neither concurrent
+ * I/O to different disks nor to different regions of a single disk contends
+ * on the same lock.
+ *
+ * @returns Pointer to the shard.
+ * @param   pBlkCache    The endpoint cache.
+ * @param   off          Start offset of the entry.
+ */
+DECLINLINE(PPDMBLKCACHESHARD) pdmBlkCacheShardGet(PPDMBLKCACHE pBlkCache, uint64_t off)
+{
+    PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
+    uint32_t idxShard = (uint32_t)((pBlkCache->idxShardBase + (off >> PDM_BLK_CACHE_SHARD_REGION_SHIFT)) % pCache->cShards);
+    return &pCache->aShards[idxShard];
+}
+
+DECLINLINE(void) pdmBlkCacheSub(PPDMBLKCACHESHARD pShard, uint32_t cbAmount)
+{
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+    pShard->cbCached -= cbAmount;
 }
 
-DECLINLINE(void) pdmBlkCacheSub(PPDMBLKCACHEGLOBAL pCache, uint32_t cbAmount)
+DECLINLINE(void) pdmBlkCacheAdd(PPDMBLKCACHESHARD pShard, uint32_t cbAmount)
 {
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
-    pCache->cbCached -= cbAmount;
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+    pShard->cbCached += cbAmount;
 }
 
-DECLINLINE(void) pdmBlkCacheAdd(PPDMBLKCACHEGLOBAL pCache, uint32_t cbAmount)
+/**
+ * Returns whether the given entry is in one of the lists containing data
+ * (i.e. not on a ghost list).
+ *
+ * @returns true if the entry contains data, false if it is a ghost entry.
+ * @param   pEntry    The entry to check.
+ */
+DECLINLINE(bool) pdmBlkCacheEntryIsCached(PPDMBLKCACHEENTRY pEntry)
 {
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
-    pCache->cbCached += cbAmount;
+    PPDMBLKCACHESHARD pShard = pEntry->pShard;
+    return    pEntry->pList == &pShard->LruRecentlyUsedIn
+           || pEntry->pList == &pShard->LruFrequentlyUsed;
 }
 
 DECLINLINE(void) pdmBlkCacheListAdd(PPDMBLKLRULIST pList, uint32_t cbAmount)
@@ -331,12 +432,35 @@ static void pdmBlkCacheDestroyList(PPDMBLKLRULIST pList)
     }
 }
 
+/**
+ * Returns the maximum number of bytes the given ghost list may hold.
+ *
+ * @returns Maximum size of the ghost list in bytes.
+ * @param   pShard        The shard the list belongs to.
+ * @param   pGhostList    The ghost list.
+ */
+static uint64_t pdmBlkCacheGhostListMax(PPDMBLKCACHESHARD pShard, PPDMBLKLRULIST pGhostList)
+{
+    if (pShard->pCache->enmPolicy == PDMBLKCACHEPOLICY_2Q)
+        return pShard->cbRecentlyUsedOutMax;
+
+    /* ARC: T1 + B1 <= c and T1 + T2 + B1 + B2 <= 2c. */
+    uint64_t cbMax = pShard->cbMax;
+    uint64_t cbUsed = pShard->LruRecentlyUsedIn.cbCached;
+    if (pGhostList == &pShard->LruRecentlyUsedOut)
+        return cbUsed < cbMax ? cbMax - cbUsed : 0;
+
+    cbMax *= 2;
+    cbUsed += (uint64_t)pShard->LruFrequentlyUsed.cbCached + pShard->LruRecentlyUsedOut.cbCached;
+    return cbUsed < cbMax ? cbMax - cbUsed : 0;
+}
+
 /**
  * Tries to remove the given amount of bytes from a given list in the cache
  * moving the entries to one of the given ghosts lists
  *
  * @returns Amount of data which could be freed.
- * @param    pCache           Pointer to the global cache data.
+ * @param    pShard           The shard to evict from, the caller owns the lock.
  * @param    cbData           The amount of the data to free.
  * @param    pListSrc         The source list to evict data from.
  * @param    pGhostListDst    Where the ghost list removed entries should be
@@ -351,18 +475,20 @@ static void pdmBlkCacheDestroyList(PPDMBLKLRULIST pList)
  *          may be marked as non evictable if they are used for I/O at the
  *          moment.
  */
-static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData,
+static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHESHARD pShard, size_t cbData,
                                         PPDMBLKLRULIST pListSrc, PPDMBLKLRULIST pGhostListDst,
                                         bool fReuseBuffer, uint8_t **ppbBuffer)
 {
+    PPDMBLKCACHEGLOBAL pCache = pShard->pCache;
     size_t cbEvicted = 0;
 
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
 
     AssertMsg(cbData > 0, ("Evicting 0 bytes not possible\n"));
     AssertMsg(   !pGhostListDst
-              || (pGhostListDst == &pCache->LruRecentlyUsedOut),
-              ("Destination list must be NULL or the recently used but paged out list\n"));
+              || (pGhostListDst == &pShard->LruRecentlyUsedOut)
+              || (pGhostListDst == &pShard->LruFrequentlyUsedOut),
+              ("Destination list must be NULL or one of the paged out lists\n"));
 
     if (fReuseBuffer)
     {
@@ -379,6 +505,28 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
 
         pEntry = pEntry->pPrev;
 
+        /*
+         * Entries which were accessed since they were queued get a second chance.
+         * Frequently used entries go back to the head of their list, recently used
+         * ones get promoted to the frequently used list with ARC while 2Q keeps
+         * the recently used list strictly FIFO.
+         */
+        if (ASMAtomicXchgBool(&pCurr->fReferenced, false))
+        {
+            if (pListSrc == &pShard->LruFrequentlyUsed)
+            {
+                STAM_REL_COUNTER_INC(&pShard->StatSecondChance);
+                pdmBlkCacheEntryAddToList(pListSrc, pCurr);
+                continue;
+            }
+            else if (pCache->enmPolicy == PDMBLKCACHEPOLICY_ARC)
+            {
+                STAM_REL_COUNTER_INC(&pShard->StatSecondChance);
+                pdmBlkCacheEntryAddToList(&pShard->LruFrequentlyUsed, pCurr);
+                continue;
+            }
+        }
+
         /* We can't evict pages which are currently in progress or dirty but not in progress */
         if (   !(pCurr->fFlags & PDMBLKCACHE_NOT_EVICTABLE)
             && (ASMAtomicReadU32(&pCurr->cRefs) == 0))
@@ -393,6 +541,9 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
             {
                 LogFlow(("Evicting entry %#p (%u bytes)\n", pCurr, pCurr->cbData));
 
+                if (ASMAtomicXchgBool(&pCurr->fReadAhead, false))
+                    STAM_REL_COUNTER_INC(&pBlkCache->StatReadAheadWasted);
+
                 if (fReuseBuffer && pCurr->cbData == cbData)
                 {
                     STAM_COUNTER_INC(&pCache->StatBuffersReused);
@@ -405,16 +556,17 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                 cbEvicted += pCurr->cbData;
 
                 pdmBlkCacheEntryRemoveFromList(pCurr);
-                pdmBlkCacheSub(pCache, pCurr->cbData);
+                pdmBlkCacheSub(pShard, pCurr->cbData);
 
                 if (pGhostListDst)
                 {
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
                     PPDMBLKCACHEENTRY pGhostEntFree = pGhostListDst->pTail;
+                    uint64_t cbGhostMax = pdmBlkCacheGhostListMax(pShard, pGhostListDst);
 
                     /* We have to remove the last entries from the paged out list. */
-                    while (   pGhostListDst->cbCached + pCurr->cbData > pCache->cbRecentlyUsedOutMax
+                    while (   (uint64_t)pGhostListDst->cbCached + pCurr->cbData > cbGhostMax
                            && pGhostEntFree)
                     {
                         PPDMBLKCACHEENTRY pFree = pGhostEntFree;
@@ -438,7 +590,7 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                         RTSemRWReleaseWrite(pBlkCacheFree->SemRWEntries);
                     }
 
-                    if (pGhostListDst->cbCached + pCurr->cbData > pCache->cbRecentlyUsedOutMax)
+                    if ((uint64_t)pGhostListDst->cbCached + pCurr->cbData > cbGhostMax)
                     {
                         /* Couldn't remove enough entries. Delete */
                         STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
@@ -476,49 +628,148 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
     return cbEvicted;
 }
 
-static bool pdmBlkCacheReclaim(PPDMBLKCACHEGLOBAL pCache, size_t cbData, bool fReuseBuffer, uint8_t **ppbBuffer)
+/**
+ * Makes room for the given amount of data in the shard evicting entries
+ * according to the configured replacement policy.
+ *
+ * @returns Flag whether enough data could be evicted.
+ * @param   pShard              The shard to reclaim space in, the caller owns the lock.
+ * @param   cbData              Number of bytes required.
+ * @param   fGhostHitFrequent   Flag whether the space is required for an entry which
+ *                              was found on the frequently used ghost list (ARC only).
+ * @param   fReuseBuffer        Flag whether a buffer should be reused if it has
+ *                              the same size.
+ * @param   ppbBuffer           Where to store the address of the buffer if an
+ *                              entry with the same size was found and
+ *                              fReuseBuffer is true.
+ */
+static bool pdmBlkCacheReclaim(PPDMBLKCACHESHARD pShard, size_t cbData, bool fGhostHitFrequent,
+                               bool fReuseBuffer, uint8_t **ppbBuffer)
 {
     size_t cbRemoved = 0;
 
-    if ((pCache->cbCached + cbData) < pCache->cbMax)
+    if ((pShard->cbCached + cbData) < pShard->cbMax)
         return true;
-    else if ((pCache->LruRecentlyUsedIn.cbCached + cbData) > pCache->cbRecentlyUsedInMax)
-    {
-        /* Try to evict as many bytes as possible from A1in */
-        cbRemoved = pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruRecentlyUsedIn,
-                                                 &pCache->LruRecentlyUsedOut, fReuseBuffer, ppbBuffer);
 
+    PPDMBLKLRULIST pListFirst;
+    PPDMBLKLRULIST pGhostFirst;
+    PPDMBLKLRULIST pListSecond;
+    PPDMBLKLRULIST pGhostSecond;
+    if (pShard->pCache->enmPolicy == PDMBLKCACHEPOLICY_ARC)
+    {
         /*
-         * If it was not possible to remove enough entries
-         * try the frequently accessed cache.
+         * Evict from the recently used list if it exceeds the adaptive target (or reached it
+         * and the new entry comes from the frequently used ghost list), from the frequently
+         * used list otherwise. Evicted entries are remembered in the respective ghost list.
          */
-        if (cbRemoved < cbData)
+        uint32_t cbRecent = pShard->LruRecentlyUsedIn.cbCached;
+        bool fFromRecent =    cbRecent
+                           && (   cbRecent > pShard->cbRecentlyUsedInTarget
+                               || (fGhostHitFrequent && cbRecent >= pShard->cbRecentlyUsedInTarget));
+        if (fFromRecent)
         {
-            Assert(!fReuseBuffer || !*ppbBuffer); /* It is not possible that we got a buffer with the correct size but we didn't freed enough data. */
-
-            /*
-             * If we removed something we can't pass the reuse buffer flag anymore because
-             * we don't need to evict that much data
-             */
-            if (!cbRemoved)
-                cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruFrequentlyUsed,
-                                                          NULL, fReuseBuffer, ppbBuffer);
-            else
-                cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData - cbRemoved, &pCache->LruFrequentlyUsed,
-                                                          NULL, false, NULL);
+            pListFirst   = &pShard->LruRecentlyUsedIn;
+            pGhostFirst  = &pShard->LruRecentlyUsedOut;
+            pListSecond  = &pShard->LruFrequentlyUsed;
+            pGhostSecond = &pShard->LruFrequentlyUsedOut;
         }
+        else
+        {
+            pListFirst   = &pShard->LruFrequentlyUsed;
+            pGhostFirst  = &pShard->LruFrequentlyUsedOut;
+            pListSecond  = &pShard->LruRecentlyUsedIn;
+            pGhostSecond = &pShard->LruRecentlyUsedOut;
+        }
+    }
+    else if ((pShard->LruRecentlyUsedIn.cbCached + cbData) > pShard->cbRecentlyUsedInMax)
+    {
+        /* Try to evict as many bytes as possible from A1in and fall back to Am. */
+        pListFirst   = &pShard->LruRecentlyUsedIn;
+        pGhostFirst  = &pShard->LruRecentlyUsedOut;
+        pListSecond  = &pShard->LruFrequentlyUsed;
+        pGhostSecond = NULL;
     }
     else
     {
         /* We have to remove entries from frequently access list. */
-        cbRemoved = pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruFrequentlyUsed,
-                                                 NULL, fReuseBuffer, ppbBuffer);
+        pListFirst   = &pShard->LruFrequentlyUsed;
+        pGhostFirst  = NULL;
+        pListSecond  = NULL;
+        pGhostSecond = NULL;
+    }
+
+    cbRemoved = pdmBlkCacheEvictPagesFrom(pShard, cbData, pListFirst, pGhostFirst, fReuseBuffer, ppbBuffer);
+
+    /*
+     * If it was not possible to remove enough entries
+     * try the other list.
+     */
+    if (   cbRemoved < cbData
+        && pListSecond)
+    {
+        Assert(!fReuseBuffer || !*ppbBuffer); /* It is not possible that we got a buffer with the correct size but we didn't freed enough data. */
+
+        /*
+         * If we removed something we can't pass the reuse buffer flag anymore because
+         * we don't need to evict that much data
+         */
+        if (!cbRemoved)
+            cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData, pListSecond,
+                                                   pGhostSecond, fReuseBuffer, ppbBuffer);
+        else
+            cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData - cbRemoved, pListSecond,
+                                                   pGhostSecond, false, NULL);
     }
 
     LogFlowFunc((": removed %u bytes, requested %u\n", cbRemoved, cbData));
     return (cbRemoved >= cbData);
 }
 
+/**
+ * Handles a hit on a ghost entry, adapting the target size of the recently
+ * used list for the ARC policy and unlinking the entry from the ghost list.
+ *
+ * @returns Flag whether the entry was found on the frequently used ghost list.
+ * @param   pShard    The shard the entry belongs to, the caller owns the lock.
+ * @param   pEntry    The ghost entry.
+ */
+static bool pdmBlkCacheGhostHit(PPDMBLKCACHESHARD pShard, PPDMBLKCACHEENTRY pEntry)
+{
+    PPDMBLKLRULIST pListHit = pEntry->pList;
+    bool fFrequent = pListHit == &pShard->LruFrequentlyUsedOut;
+
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+    AssertPtr(pListHit);
+
+    STAM_REL_COUNTER_INC(&pShard->StatMisses);
+    if (fFrequent)
+        STAM_REL_COUNTER_INC(&pShard->StatGhostHitsFrequent);
+    else
+        STAM_REL_COUNTER_INC(&pShard->StatGhostHitsRecent);
+
+    if (   pShard->pCache->enmPolicy == PDMBLKCACHEPOLICY_ARC
+        && pListHit->cbCached)
+    {
+        /*
+         * A hit in B1 means the recently used list was too small, a hit in B2 that the
+         * frequently used one was. Move the target by the size of the entry scaled by
+         * the ratio of the ghost list sizes.
+         */
+        PPDMBLKLRULIST pListOther = fFrequent ? &pShard->LruRecentlyUsedOut : &pShard->LruFrequentlyUsedOut;
+        uint64_t cbDelta = (uint64_t)RT_MAX(pListOther->cbCached / pListHit->cbCached, 1) * pEntry->cbData;
+        uint32_t cbTarget = pShard->cbRecentlyUsedInTarget;
+
+        if (!fFrequent)
+            cbTarget = (uint32_t)RT_MIN(cbTarget + cbDelta, pShard->cbMax);
+        else
+            cbTarget = cbDelta < cbTarget ? cbTarget - (uint32_t)cbDelta : 0;
+        pShard->cbRecentlyUsedInTarget = cbTarget;
+    }
+
+    pdmBlkCacheEntryRemoveFromList(pEntry); /* Remove it before we remove data, otherwise it may get freed when evicting data. */
+    return fFrequent;
+}
+
 DECLINLINE(int) pdmBlkCacheEnqueue(PPDMBLKCACHE pBlkCache, uint64_t off, size_t cbXfer, PPDMBLKCACHEIOXFER pIoXfer)
 {
     int rc = VINF_SUCCESS;
@@ -891,9 +1142,7 @@ static DECLCALLBACK(int) pdmR3BlkCacheSaveExec(PVM pVM, PSSMHANDLE pSSM)
             AssertMsg(pEntry->fFlags & PDMBLKCACHE_ENTRY_IS_DIRTY, ("Entry is not dirty\n"));
             AssertMsg(!(pEntry->fFlags & ~PDMBLKCACHE_ENTRY_IS_DIRTY), ("Invalid flags set\n"));
             AssertMsg(!pEntry->pWaitingHead && !pEntry->pWaitingTail, ("There are waiting requests\n"));
-            AssertMsg(   pEntry->pList == &pBlkCacheGlobal->LruRecentlyUsedIn
-                      || pEntry->pList == &pBlkCacheGlobal->LruFrequentlyUsed,
-                      ("Invalid list\n"));
+            AssertMsg(pdmBlkCacheEntryIsCached(pEntry), ("Invalid list\n"));
             AssertMsg(pEntry->cbData == pEntry->Core.KeyLast - pEntry->Core.Key + 1,
                       ("Size and range do not match\n"));
 
@@ -1002,10 +1251,20 @@ static DECLCALLBACK(int) pdmR3BlkCacheLoadExec(PVM pVM, PSSMHANDLE pSSM, uint32_
             bool fInserted = RTAvlrU64Insert(pBlkCache->pTree, &pEntry->Core);
             Assert(fInserted); NOREF(fInserted);
 
+            /* Dirty entries can't be evicted, move the entry to the next shard having enough room if required. */
+            PPDMBLKCACHESHARD pShard = pEntry->pShard;
+            for (uint32_t i = 1;
+                 i < pBlkCacheGlobal->cShards && pShard->cbCached + cbEntry > pShard->cbMax;
+                 i++)
+                pShard = &pBlkCacheGlobal->aShards[(pEntry->pShard - &pBlkCacheGlobal->aShards[0] + i) % pBlkCacheGlobal->cShards];
+            pEntry->pShard = pShard;
+
             /* Add to the dirty list. */
             pdmBlkCacheAddDirtyEntry(pBlkCache, pEntry);
-            pdmBlkCacheEntryAddToList(&pBlkCacheGlobal->LruRecentlyUsedIn, pEntry);
-            pdmBlkCacheAdd(pBlkCacheGlobal, cbEntry);
+            pdmBlkCacheShardLockEnter(pShard);
+            pdmBlkCacheEntryAddToList(&pShard->LruRecentlyUsedIn, pEntry);
+            pdmBlkCacheAdd(pShard, cbEntry);
+            pdmBlkCacheShardLockLeave(pShard);
             pdmBlkCacheEntryRelease(pEntry);
             cEntries--;
         }
@@ -1046,45 +1305,96 @@ int pdmR3BlkCacheInit(PVM pVM)
     PCFGMNODE pCfgRoot     = CFGMR3GetRoot(pVM);
     PCFGMNODE pCfgBlkCache = CFGMR3GetChild(CFGMR3GetChild(pCfgRoot, "PDM"), "BlkCache");
 
-    pBlkCacheGlobal = (PPDMBLKCACHEGLOBAL)RTMemAllocZ(sizeof(PDMBLKCACHEGLOBAL));
+    uint32_t cbMax = 0;
+    rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheSize", &cbMax, 5 * _1M);
+    AssertLogRelRCReturn(rc, rc);
+    LogFlowFunc(("Maximum number of bytes cached %u\n", cbMax));
+
+    /*
+     * The cache is split into shards with their own lock and LRU lists.
+     * By default there is one shard per online CPU, limited so that a shard
+     * doesn't get too small to hold a reasonable working set and the biggest
+     * requests.
+     */
+    uint32_t cShardsDef = RT_MIN(RTMpGetOnlineCount(), RT_MAX(cbMax / PDM_BLK_CACHE_SHARD_SIZE_MIN, 1));
+    uint32_t cShards = 0;
+    rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheShards", &cShards, RT_MIN(RT_MAX(cShardsDef, 1), 8));
+    AssertLogRelRCReturn(rc, rc);
+    if (!cShards || cShards > PDM_BLK_CACHE_SHARDS_MAX)
+    {
+        LogRel(("BlkCache: Invalid number of shards %u (must be between 1 and %u)\n", cShards, PDM_BLK_CACHE_SHARDS_MAX));
+        return VERR_OUT_OF_RANGE;
+    }
+
+    PDMBLKCACHEPOLICY enmPolicy = PDMBLKCACHEPOLICY_INVALID;
+    char szPolicy[16];
+    rc = CFGMR3QueryStringDef(pCfgBlkCache, "CachePolicy", szPolicy, sizeof(szPolicy), "2Q");
+    AssertLogRelRCReturn(rc, rc);
+    if (!RTStrICmp(szPolicy, "2Q"))
+        enmPolicy = PDMBLKCACHEPOLICY_2Q;
+    else if (!RTStrICmp(szPolicy, "ARC"))
+        enmPolicy = PDMBLKCACHEPOLICY_ARC;
+    else
+    {
+        LogRel(("BlkCache: Unknown cache policy '%s'\n", szPolicy));
+        return VERR_INVALID_PARAMETER;
+    }
+
+    pBlkCacheGlobal = (PPDMBLKCACHEGLOBAL)RTMemAllocZ(RT_UOFFSETOF_DYN(PDMBLKCACHEGLOBAL, aShards[cShards]));
     if (!pBlkCacheGlobal)
         return VERR_NO_MEMORY;
 
     RTListInit(&pBlkCacheGlobal->ListUsers);
     pBlkCacheGlobal->pVM = pVM;
     pBlkCacheGlobal->cRefs = 0;
-    pBlkCacheGlobal->cbCached  = 0;
+    pBlkCacheGlobal->cbMax = cbMax;
+    pBlkCacheGlobal->enmPolicy = enmPolicy;
+    pBlkCacheGlobal->cShards = cShards;
+    pBlkCacheGlobal->idxShardNext = 0;
     pBlkCacheGlobal->fCommitInProgress = false;
 
     /* Initialize members */
-    pBlkCacheGlobal->LruRecentlyUsedIn.pHead    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedIn.pTail    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedIn.cbCached = 0;
-
-    pBlkCacheGlobal->LruRecentlyUsedOut.pHead    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedOut.pTail    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedOut.cbCached = 0;
-
-    pBlkCacheGlobal->LruFrequentlyUsed.pHead    = NULL;
-    pBlkCacheGlobal->LruFrequentlyUsed.pTail    = NULL;
-    pBlkCacheGlobal->LruFrequentlyUsed.cbCached = 0;
+    for (uint32_t i = 0; i < cShards; i++)
+    {
+        PPDMBLKCACHESHARD pShard = &pBlkCacheGlobal->aShards[i];
+
+        pShard->pCache   = pBlkCacheGlobal;
+        pShard->cbMax    = cbMax / cShards;
+        pShard->cbCached = 0;
+        pShard->cbRecentlyUsedInMax    = (pShard->cbMax / 100) * 25; /* 25% of the buffer size */
+        pShard->cbRecentlyUsedOutMax   = (pShard->cbMax / 100) * 50; /* 50% of the buffer size */
+        pShard->cbRecentlyUsedInTarget = 0;
+
+        pShard->LruRecentlyUsedIn.pHead    = NULL;
+        pShard->LruRecentlyUsedIn.pTail    = NULL;
+        pShard->LruRecentlyUsedIn.cbCached = 0;
+
+        pShard->LruRecentlyUsedOut.pHead    = NULL;
+        pShard->LruRecentlyUsedOut.pTail    = NULL;
+        pShard->LruRecentlyUsedOut.cbCached = 0;
+
+        pShard->LruFrequentlyUsed.pHead    = NULL;
+        pShard->LruFrequentlyUsed.pTail    = NULL;
+        pShard->LruFrequentlyUsed.cbCached = 0;
+
+        pShard->LruFrequentlyUsedOut.pHead    = NULL;
+        pShard->LruFrequentlyUsedOut.pTail    = NULL;
+        pShard->LruFrequentlyUsedOut.cbCached = 0;
+    }
+    LogFlowFunc(("cShards=%u cbRecentlyUsedInMax=%u cbRecentlyUsedOutMax=%u\n", cShards,
+                 pBlkCacheGlobal->aShards[0].cbRecentlyUsedInMax, pBlkCacheGlobal->aShards[0].cbRecentlyUsedOutMax));
 
     do
     {
-        rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheSize", &pBlkCacheGlobal->cbMax, 5 * _1M);
-        AssertLogRelRCBreak(rc);
-        LogFlowFunc(("Maximum number of bytes cached %u\n", pBlkCacheGlobal->cbMax));
-
-        pBlkCacheGlobal->cbRecentlyUsedInMax  = (pBlkCacheGlobal->cbMax / 100) * 25; /* 25% of the buffer size */
-        pBlkCacheGlobal->cbRecentlyUsedOutMax = (pBlkCacheGlobal->cbMax / 100) * 50; /* 50% of the buffer size */
-        LogFlowFunc(("cbRecentlyUsedInMax=%u cbRecentlyUsedOutMax=%u\n",
-                     pBlkCacheGlobal->cbRecentlyUsedInMax, pBlkCacheGlobal->cbRecentlyUsedOutMax));
-
         /** @todo r=aeichner: Experiment to find optimal default values */
         rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheCommitIntervalMs", &pBlkCacheGlobal->u32CommitTimeoutMs, 10000 /* 10sec */);
         AssertLogRelRCBreak(rc);
         rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheCommitThreshold", &pBlkCacheGlobal->cbCommitDirtyThreshold, pBlkCacheGlobal->cbMax / 2);
         AssertLogRelRCBreak(rc);
+        /* The read ahead window defaults to a quarter of a shard so a stream can't flush the whole cache. */
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "ReadAheadMax", &pBlkCacheGlobal->cbReadAheadMaxDef,
+                               RT_MIN(pBlkCacheGlobal->aShards[0].cbMax / 4, _1M));
+        AssertLogRelRCBreak(rc);
     } while (0);
 
     if (RT_SUCCESS(rc))
@@ -1094,26 +1404,35 @@ int pdmR3BlkCacheInit(PVM pVM)
                        "/PDM/BlkCache/cbMax",
                        STAMUNIT_BYTES,
                        "Maximum cache size");
-        STAMR3Register(pVM, &pBlkCacheGlobal->cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCached",
-                       STAMUNIT_BYTES,
-                       "Currently used cache");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruRecentlyUsedIn.cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedMruIn",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in MRU list");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruRecentlyUsedOut.cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedMruOut",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in FRU list");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruFrequentlyUsed.cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedFru",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in FRU ghost list");
+        for (uint32_t i = 0; i < cShards; i++)
+        {
+            PPDMBLKCACHESHARD pShard = &pBlkCacheGlobal->aShards[i];
+
+            STAMR3RegisterF(pVM, &pShard->cbCached, STAMTYPE_U32, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
+                            "Currently used cache", "/PDM/BlkCache/Shard%u/cbCached", i);
+            STAMR3RegisterF(pVM, &pShard->LruRecentlyUsedIn.cbCached, STAMTYPE_U32, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
+                            "Number of bytes cached in MRU list", "/PDM/BlkCache/Shard%u/cbCachedMruIn", i);
+            STAMR3RegisterF(pVM, &pShard->LruRecentlyUsedOut.cbCached, STAMTYPE_U32, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
+                            "Number of bytes cached in MRU ghost list", "/PDM/BlkCache/Shard%u/cbCachedMruOut", i);
+            STAMR3RegisterF(pVM, &pShard->LruFrequentlyUsed.cbCached, STAMTYPE_U32, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
+                            "Number of bytes cached in FRU list", "/PDM/BlkCache/Shard%u/cbCachedFru", i);
+            STAMR3RegisterF(pVM, &pShard->LruFrequentlyUsedOut.cbCached, STAMTYPE_U32, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
+                            "Number of bytes cached in FRU ghost list", "/PDM/BlkCache/Shard%u/cbCachedFruOut", i);
+            STAMR3RegisterF(pVM, &pShard->cbRecentlyUsedInTarget, STAMTYPE_U32, STAMVISIBILITY_USED, STAMUNIT_BYTES,
+                            "Adaptive target size of the MRU list (ARC)", "/PDM/BlkCache/Shard%u/cbMruInTarget", i);
+            STAMR3RegisterF(pVM, &pShard->StatHits, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                            "Number of accesses served from the cache", "/PDM/BlkCache/Shard%u/Hits", i);
+            STAMR3RegisterF(pVM, &pShard->StatMisses, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                            "Number of accesses which had to fetch data from the medium", "/PDM/BlkCache/Shard%u/Misses", i);
+            STAMR3RegisterF(pVM, &pShard->StatGhostHitsRecent, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                            "Number of hits in the MRU ghost list", "/PDM/BlkCache/Shard%u/GhostHitsMru", i);
+            STAMR3RegisterF(pVM, &pShard->StatGhostHitsFrequent, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                            "Number of hits in the FRU ghost list", "/PDM/BlkCache/Shard%u/GhostHitsFru", i);
+            STAMR3RegisterF(pVM, &pShard->StatSecondChance, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                            "Number of referenced entries kept when up for eviction", "/PDM/BlkCache/Shard%u/SecondChance", i);
+            STAMR3RegisterF(pVM, &pShard->StatLockContention, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                            "Number of times the shard lock was contended", "/PDM/BlkCache/Shard%u/LockContention", i);
+        }
 
 #ifdef VBOX_WITH_STATISTICS
         STAMR3Register(pVM, &pBlkCacheGlobal->cHits,
@@ -1154,8 +1473,18 @@ int pdmR3BlkCacheInit(PVM pVM)
                        STAMUNIT_COUNT, "Number of times a buffer could be reused");
 #endif
 
-        /* Initialize the critical section */
+        /* Initialize the critical sections */
         rc = RTCritSectInit(&pBlkCacheGlobal->CritSect);
+        for (uint32_t i = 0; i < cShards && RT_SUCCESS(rc); i++)
+        {
+            rc = RTCritSectInit(&pBlkCacheGlobal->aShards[i].CritSect);
+            if (RT_FAILURE(rc))
+            {
+                while (i-- > 0)
+                    RTCritSectDelete(&pBlkCacheGlobal->aShards[i].CritSect);
+                RTCritSectDelete(&pBlkCacheGlobal->CritSect);
+            }
+        }
     }
 
     if (RT_SUCCESS(rc))
@@ -1178,13 +1507,18 @@ int pdmR3BlkCacheInit(PVM pVM)
             if (RT_SUCCESS(rc))
             {
                 LogRel(("BlkCache: Cache successfully initialized. Cache size is %u bytes\n", pBlkCacheGlobal->cbMax));
+                LogRel(("BlkCache: Cache is split into %u shard(s) using the %s replacement policy\n",
+                        pBlkCacheGlobal->cShards, pBlkCacheGlobal->enmPolicy == PDMBLKCACHEPOLICY_ARC ? "ARC" : "2Q"));
                 LogRel(("BlkCache: Cache commit interval is %u ms\n", pBlkCacheGlobal->u32CommitTimeoutMs));
                 LogRel(("BlkCache: Cache commit threshold is %u bytes\n", pBlkCacheGlobal->cbCommitDirtyThreshold));
+                LogRel(("BlkCache: Default read ahead window is %u bytes\n", pBlkCacheGlobal->cbReadAheadMaxDef));
                 pUVM->pdm.s.pBlkCacheGlobal = pBlkCacheGlobal;
                 return VINF_SUCCESS;
             }
         }
 
+        for (uint32_t i = 0; i < pBlkCacheGlobal->cShards; i++)
+            RTCritSectDelete(&pBlkCacheGlobal->aShards[i].CritSect);
         RTCritSectDelete(&pBlkCacheGlobal->CritSect);
     }
 
@@ -1203,14 +1537,24 @@ void pdmR3BlkCacheTerm(PVM pVM)
     {
         /* Make sure no one else uses the cache now */
         pdmBlkCacheLockEnter(pBlkCacheGlobal);
+        pdmBlkCacheShardsLockEnterAll(pBlkCacheGlobal);
 
         /* Cleanup deleting all cache entries waiting for in progress entries to finish. */
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruRecentlyUsedIn);
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruRecentlyUsedOut);
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruFrequentlyUsed);
+        for (uint32_t i = 0; i < pBlkCacheGlobal->cShards; i++)
+        {
+            PPDMBLKCACHESHARD pShard = &pBlkCacheGlobal->aShards[i];
 
+            pdmBlkCacheDestroyList(&pShard->LruRecentlyUsedIn);
+            pdmBlkCacheDestroyList(&pShard->LruRecentlyUsedOut);
+            pdmBlkCacheDestroyList(&pShard->LruFrequentlyUsed);
+            pdmBlkCacheDestroyList(&pShard->LruFrequentlyUsedOut);
+        }
+
+        pdmBlkCacheShardsLockLeaveAll(pBlkCacheGlobal);
         pdmBlkCacheLockLeave(pBlkCacheGlobal);
 
+        for (uint32_t i = 0; i < pBlkCacheGlobal->cShards; i++)
+            RTCritSectDelete(&pBlkCacheGlobal->aShards[i].CritSect);
         RTCritSectDelete(&pBlkCacheGlobal->CritSect);
         RTMemFree(pBlkCacheGlobal);
         pVM->pUVM->pdm.s.pBlkCacheGlobal = NULL;
@@ -1263,6 +1607,10 @@ static int pdmR3BlkCacheRetain(PVM pVM, PPPDMBLKCACHE ppBlkCache, const char *pc
             pBlkCache->fSuspended = false;
             pBlkCache->cIoXfersActive = 0;
             pBlkCache->pCache = pBlkCacheGlobal;
+            pBlkCache->idxShardBase = pBlkCacheGlobal->idxShardNext++ % pBlkCacheGlobal->cShards;
+            pBlkCache->cbReadAheadMax = pBlkCacheGlobal->cbReadAheadMaxDef;
+            pBlkCache->cbMedium = UINT64_MAX;
+            pBlkCache->offReadNext = UINT64_MAX;
             RTListInit(&pBlkCache->ListDirtyNotCommitted);
 
             rc = RTSpinlockCreate(&pBlkCache->LockList, RTSPINLOCK_FLAGS_INTERRUPT_UNSAFE, "pdmR3BlkCacheRetain");
@@ -1280,6 +1628,22 @@ static int pdmR3BlkCacheRetain(PVM pVM, PPPDMBLKCACHE ppBlkCache, const char *pc
                                         STAMUNIT_COUNT, "Number of deferred writes",
                                         "/PDM/BlkCache/%s/Cache/DeferredWrites", pBlkCache->pszId);
 #endif
+                        STAMR3RegisterF(pBlkCacheGlobal->pVM, &pBlkCache->StatReadAheadBytes,
+                                        STAMTYPE_COUNTER, STAMVISIBILITY_USED,
+                                        STAMUNIT_BYTES, "Number of bytes read ahead",
+                                        "/PDM/BlkCache/%s/ReadAhead/Bytes", pBlkCache->pszId);
+                        STAMR3RegisterF(pBlkCacheGlobal->pVM, &pBlkCache->StatReadAheadEntries,
+                                        STAMTYPE_COUNTER, STAMVISIBILITY_USED,
+                                        STAMUNIT_COUNT, "Number of entries created by read ahead",
+                                        "/PDM/BlkCache/%s/ReadAhead/Entries", pBlkCache->pszId);
+                        STAMR3RegisterF(pBlkCacheGlobal->pVM, &pBlkCache->StatReadAheadUsed,
+                                        STAMTYPE_COUNTER, STAMVISIBILITY_USED,
+                                        STAMUNIT_COUNT, "Number of read ahead entries accessed afterwards",
+                                        "/PDM/BlkCache/%s/ReadAhead/Used", pBlkCache->pszId);
+                        STAMR3RegisterF(pBlkCacheGlobal->pVM, &pBlkCache->StatReadAheadWasted,
+                                        STAMTYPE_COUNTER, STAMVISIBILITY_USED,
+                                        STAMUNIT_COUNT, "Number of read ahead entries evicted without being accessed",
+                                        "/PDM/BlkCache/%s/ReadAhead/Wasted", pBlkCache->pszId);
 
                         /* Add to the list of users. */
                         pBlkCacheGlobal->cRefs++;
@@ -1432,12 +1796,14 @@ static DECLCALLBACK(int) pdmBlkCacheEntryDestroy(PAVLRU64NODECORE pNode, void *p
         /* Leave the locks to let the I/O thread make progress but reference the entry to prevent eviction. */
         pdmBlkCacheEntryRef(pEntry);
         RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+        pdmBlkCacheShardsLockLeaveAll(pCache);
         pdmBlkCacheLockLeave(pCache);
 
         RTThreadSleep(250);
 
         /* Re-enter all locks */
         pdmBlkCacheLockEnter(pCache);
+        pdmBlkCacheShardsLockEnterAll(pCache);
         RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
         pdmBlkCacheEntryRelease(pEntry);
     }
@@ -1445,13 +1811,12 @@ static DECLCALLBACK(int) pdmBlkCacheEntryDestroy(PAVLRU64NODECORE pNode, void *p
     AssertMsg(!(pEntry->fFlags & PDMBLKCACHE_ENTRY_IO_IN_PROGRESS),
                 ("Entry is dirty and/or still in progress fFlags=%#x\n", pEntry->fFlags));
 
-    bool fUpdateCache =    pEntry->pList == &pCache->LruFrequentlyUsed
-                        || pEntry->pList == &pCache->LruRecentlyUsedIn;
+    bool fUpdateCache = pdmBlkCacheEntryIsCached(pEntry);
 
     pdmBlkCacheEntryRemoveFromList(pEntry);
 
     if (fUpdateCache)
-        pdmBlkCacheSub(pCache, pEntry->cbData);
+        pdmBlkCacheSub(pEntry->pShard, pEntry->cbData);
 
     RTMemPageFree(pEntry->pbData, pEntry->cbData);
     RTMemFree(pEntry);
@@ -1479,9 +1844,11 @@ VMMR3DECL(void) PDMR3BlkCacheRelease(PPDMBLKCACHE pBlkCache)
 
     /* Make sure nobody is accessing the cache while we delete the tree. */
     pdmBlkCacheLockEnter(pCache);
+    pdmBlkCacheShardsLockEnterAll(pCache);
     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
     RTAvlrU64Destroy(pBlkCache->pTree, pdmBlkCacheEntryDestroy, pCache);
     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+    pdmBlkCacheShardsLockLeaveAll(pCache);
 
     RTSpinlockDestroy(pBlkCache->LockList);
 
@@ -1497,6 +1864,7 @@ VMMR3DECL(void) PDMR3BlkCacheRelease(PPDMBLKCACHE pBlkCache)
 #ifdef VBOX_WITH_STATISTICS
     STAMR3DeregisterF(pCache->pVM->pUVM, "/PDM/BlkCache/%s/Cache/DeferredWrites", pBlkCache->pszId);
 #endif
+    STAMR3DeregisterF(pCache->pVM->pUVM, "/PDM/BlkCache/%s/ReadAhead/*", pBlkCache->pszId);
 
     RTStrFree(pBlkCache->pszId);
     RTMemFree(pBlkCache);
@@ -1666,10 +2034,12 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryAlloc(PPDMBLKCACHE pBlkCache, uint64_t
     pEntryNew->Core.Key      = off;
     pEntryNew->Core.KeyLast  = off + cbData - 1;
     pEntryNew->pBlkCache     = pBlkCache;
+    pEntryNew->pShard        = pdmBlkCacheShardGet(pBlkCache, off);
     pEntryNew->fFlags        = 0;
     pEntryNew->cRefs         = 1; /* We are using it now. */
     pEntryNew->pList         = NULL;
     pEntryNew->cbData        = (uint32_t)cbData;
+    pEntryNew->fReferenced   = false;
     pEntryNew->pWaitingHead  = NULL;
     pEntryNew->pWaitingTail  = NULL;
     if (pbBuffer)
@@ -1862,12 +2232,13 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache, uint64_t
     *pcbData = pdmBlkCacheEntryBoundariesCalc(pBlkCache, off, (uint32_t)cb, &cbEntry);
     AssertReturn(cb <= UINT32_MAX, NULL);
 
-    PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
-    pdmBlkCacheLockEnter(pCache);
+    PPDMBLKCACHESHARD pShard = pdmBlkCacheShardGet(pBlkCache, off);
+    STAM_REL_COUNTER_INC(&pShard->StatMisses);
+    pdmBlkCacheShardLockEnter(pShard);
 
     PPDMBLKCACHEENTRY pEntryNew = NULL;
     uint8_t          *pbBuffer  = NULL;
-    bool fEnough = pdmBlkCacheReclaim(pCache, cbEntry, true, &pbBuffer);
+    bool fEnough = pdmBlkCacheReclaim(pShard, cbEntry, false /*fGhostHitFrequent*/, true, &pbBuffer);
     if (fEnough)
     {
         LogFlow(("Evicted enough bytes (%u requested). Creating new cache entry\n", cbEntry));
@@ -1875,9 +2246,10 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache, uint64_t
         pEntryNew = pdmBlkCacheEntryAlloc(pBlkCache, off, cbEntry, pbBuffer);
         if (RT_LIKELY(pEntryNew))
         {
-            pdmBlkCacheEntryAddToList(&pCache->LruRecentlyUsedIn, pEntryNew);
-            pdmBlkCacheAdd(pCache, cbEntry);
-            pdmBlkCacheLockLeave(pCache);
+            Assert(pEntryNew->pShard == pShard);
+            pdmBlkCacheEntryAddToList(&pShard->LruRecentlyUsedIn, pEntryNew);
+            pdmBlkCacheAdd(pShard, cbEntry);
+            pdmBlkCacheShardLockLeave(pShard);
 
             pdmBlkCacheInsertEntry(pBlkCache, pEntryNew);
 
@@ -1886,10 +2258,10 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache, uint64_t
                       ("Overflow in calculation off=%llu\n", off));
         }
         else
-            pdmBlkCacheLockLeave(pCache);
+            pdmBlkCacheShardLockLeave(pShard);
     }
     else
-        pdmBlkCacheLockLeave(pCache);
+        pdmBlkCacheShardLockLeave(pShard);
 
     return pEntryNew;
 }
@@ -1963,6 +2335,124 @@ static bool pdmBlkCacheReqUpdate(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEREQ pReq,
     return false;
 }
 
+/**
+ * Updates the sequential stream detection of the given endpoint with a new read
+ * and returns the range to read ahead if any.
+ *
+ * @returns Number of bytes to read ahead, 0 if nothing should be read ahead.
+ * @param   pBlkCache       The endpoint cache.
+ * @param   off             Start offset of the read.
+ * @param   cbRead          Number of bytes read.
+ * @param   poffReadAhead   Where to store the start offset of the read ahead.
+ */
+static size_t pdmBlkCacheReadAheadCheck(PPDMBLKCACHE pBlkCache, uint64_t off, size_t cbRead, uint64_t *poffReadAhead)
+{
+    uint32_t cbReadAheadMax = ASMAtomicReadU32(&pBlkCache->cbReadAheadMax);
+    if (!cbReadAheadMax)
+        return 0;
+
+    size_t   cbReadAhead = 0;
+    uint64_t offEnd = off + cbRead;
+    uint64_t cbMedium = ASMAtomicReadU64(&pBlkCache->cbMedium);
+
+    RTSpinlockAcquire(pBlkCache->LockList);
+    if (off == pBlkCache->offReadNext)
+    {
+        if (++pBlkCache->cReadsSequential >= PDM_BLK_CACHE_READ_AHEAD_TRIGGER)
+        {
+            if (!pBlkCache->cbReadAheadWindow)
+                pBlkCache->cbReadAheadWindow = RT_MIN(RT_MAX((uint32_t)RT_MIN(cbRead * 2, _1G),
+                                                             PDM_BLK_CACHE_READ_AHEAD_WINDOW_MIN),
+                                                      cbReadAheadMax);
+
+            /*
+             * Only issue read ahead after at least half of the window was consumed
+             * to get reasonably sized transfers.
+             */
+            uint64_t offStart = RT_MAX(offEnd, pBlkCache->offReadAheadEnd);
+            uint64_t offStop  = RT_MIN(offEnd + pBlkCache->cbReadAheadWindow, cbMedium);
+            if (   offStop > offStart
+                && offStop - offStart >= pBlkCache->cbReadAheadWindow / 2)
+            {
+                *poffReadAhead = offStart;
+                cbReadAhead    = (size_t)(offStop - offStart);
+                pBlkCache->offReadAheadEnd = offStop;
+
+                /* Grow the window for the next round as the stream continues. */
+                pBlkCache->cbReadAheadWindow = RT_MIN(pBlkCache->cbReadAheadWindow * 2, cbReadAheadMax);
+            }
+        }
+    }
+    else
+    {
+        /* Not sequential, start over. */
+        pBlkCache->cReadsSequential  = 0;
+        pBlkCache->cbReadAheadWindow = 0;
+        pBlkCache->offReadAheadEnd   = 0;
+    }
+    pBlkCache->offReadNext = offEnd;
+    RTSpinlockRelease(pBlkCache->LockList);
+
+    return cbReadAhead;
+}
+
+/**
+ * Fetches the given range into the cache asynchronously, skipping everything
+ * which is already cached.
+ *
+ * @returns nothing.
+ * @param   pBlkCache       The endpoint cache.
+ * @param   off             Start offset of the range.
+ * @param   cb              Size of the range in bytes.
+ * @param   cbEntryMax      Maximum size of a single cache entry.
+ */
+static void pdmBlkCacheReadAhead(PPDMBLKCACHE pBlkCache, uint64_t off, size_t cb, size_t cbEntryMax)
+{
+    LogFlowFunc(("pBlkCache=%#p{%s} off=%llu cb=%zu\n", pBlkCache, pBlkCache->pszId, off, cb));
+
+    while (cb)
+    {
+        size_t cbThis = 0;
+        PPDMBLKCACHEENTRY pEntry = pdmBlkCacheGetCacheEntryByOffset(pBlkCache, off);
+        if (pEntry)
+        {
+            /* Already cached or a ghost entry, leave it alone. */
+            cbThis = (size_t)RT_MIN(pEntry->Core.KeyLast + 1 - off, cb);
+            pdmBlkCacheEntryRelease(pEntry);
+        }
+        else
+        {
+            PPDMBLKCACHEENTRY pEntryNew = pdmBlkCacheEntryCreate(pBlkCache, off, RT_MIN(cb, cbEntryMax), &cbThis);
+            if (!pEntryNew)
+                break; /* Everything else is in use, don't bother. */
+
+            ASMAtomicWriteBool(&pEntryNew->fReadAhead, true);
+            STAM_REL_COUNTER_INC(&pBlkCache->StatReadAheadEntries);
+            STAM_REL_COUNTER_ADD(&pBlkCache->StatReadAheadBytes, pEntryNew->cbData);
+            pdmBlkCacheEntryReadFromMedium(pEntryNew);
+            pdmBlkCacheEntryRelease(pEntryNew); /* it is protected by the I/O in progress flag now. */
+        }
+
+        Assert(cbThis > 0);
+        off += cbThis;
+        cb  -= cbThis;
+    }
+}
+
+/**
+ * Accounts an access to the given entry for the read ahead statistics.
+ *
+ * @returns nothing.
+ * @param   pBlkCache       The endpoint cache.
+ * @param   pEntry          The accessed entry.
+ */
+DECLINLINE(void) pdmBlkCacheReadAheadEntryAccessed(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEENTRY pEntry)
+{
+    if (   pEntry->fReadAhead
+        && ASMAtomicXchgBool(&pEntry->fReadAhead, false))
+        STAM_REL_COUNTER_INC(&pBlkCache->StatReadAheadUsed);
+}
+
 VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                                  PCRTSGBUF pSgBuf, size_t cbRead, void *pvUser)
 {
@@ -1988,6 +2478,10 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
     /* Increment data transfer counter to keep the request valid while we access it. */
     ASMAtomicIncU32(&pReq->cXfersPending);
 
+    uint64_t offReadAhead = 0;
+    size_t   cbReadAhead  = pdmBlkCacheReadAheadCheck(pBlkCache, off, cbRead, &offReadAhead);
+    size_t   cbReadAheadEntryMax = RT_MIN(RT_MAX(cbRead, _4K), PDM_BLK_CACHE_READ_AHEAD_ENTRY_MAX);
+
     while (cbRead)
     {
         size_t cbToRead;
@@ -2030,10 +2524,14 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
 
             STAM_COUNTER_ADD(&pCache->StatRead, cbToRead);
 
+            PPDMBLKCACHESHARD pShard = pEntry->pShard;
+
             /* Ghost lists contain no data. */
-            if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                || (pEntry->pList == &pCache->LruFrequentlyUsed))
+            if (pdmBlkCacheEntryIsCached(pEntry))
             {
+                STAM_REL_COUNTER_INC(&pShard->StatHits);
+                pdmBlkCacheReadAheadEntryAccessed(pBlkCache, pEntry);
+
                 if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
                                                               PDMBLKCACHE_ENTRY_IO_IN_PROGRESS,
                                                               PDMBLKCACHE_ENTRY_IS_DIRTY))
@@ -2050,13 +2548,11 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                     RTSgBufCopyFromBuf(&SgBuf, pEntry->pbData + offDiff, cbToRead);
                 }
 
-                /* Move this entry to the top position */
-                if (pEntry->pList == &pCache->LruFrequentlyUsed)
-                {
-                    pdmBlkCacheLockEnter(pCache);
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheLockLeave(pCache);
-                }
+                /*
+                 * Mark the entry as referenced instead of moving it to the top position,
+                 * the eviction code takes care of that so hits don't need the shard lock.
+                 */
+                ASMAtomicWriteBool(&pEntry->fReferenced, true);
                 /* Release the entry */
                 pdmBlkCacheEntryRelease(pEntry);
             }
@@ -2066,16 +2562,16 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
 
                 LogFlow(("Fetching data for ghost entry %#p from file\n", pEntry));
 
-                pdmBlkCacheLockEnter(pCache);
-                pdmBlkCacheEntryRemoveFromList(pEntry); /* Remove it before we remove data, otherwise it may get freed when evicting data. */
-                bool fEnough = pdmBlkCacheReclaim(pCache, pEntry->cbData, true, &pbBuffer);
+                pdmBlkCacheShardLockEnter(pShard);
+                bool fGhostHitFrequent = pdmBlkCacheGhostHit(pShard, pEntry);
+                bool fEnough = pdmBlkCacheReclaim(pShard, pEntry->cbData, fGhostHitFrequent, true, &pbBuffer);
 
                 /* Move the entry to Am and fetch it to the cache. */
                 if (fEnough)
                 {
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheAdd(pCache, pEntry->cbData);
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheEntryAddToList(&pShard->LruFrequentlyUsed, pEntry);
+                    pdmBlkCacheAdd(pShard, pEntry->cbData);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     if (pbBuffer)
                         pEntry->pbData = pbBuffer;
@@ -2098,7 +2594,7 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     RTMemFree(pEntry);
 
@@ -2171,6 +2667,10 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
         off += cbToRead;
     }
 
+    /* Issue the read ahead after the request itself so it doesn't delay it. */
+    if (cbReadAhead)
+        pdmBlkCacheReadAhead(pBlkCache, offReadAhead, cbReadAhead, cbReadAheadEntryMax);
+
     if (!pdmBlkCacheReqUpdate(pBlkCache, pReq, rc, false))
         rc = VINF_AIO_TASK_PENDING;
     else
@@ -2231,10 +2731,14 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off, PCRTSGBU
 
             STAM_COUNTER_ADD(&pCache->StatWritten, cbToWrite);
 
+            PPDMBLKCACHESHARD pShard = pEntry->pShard;
+
             /* Ghost lists contain no data. */
-            if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                || (pEntry->pList == &pCache->LruFrequentlyUsed))
+            if (pdmBlkCacheEntryIsCached(pEntry))
             {
+                STAM_REL_COUNTER_INC(&pShard->StatHits);
+                pdmBlkCacheReadAheadEntryAccessed(pBlkCache, pEntry);
+
                 /* Check if the entry is dirty. */
                 if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
                                                               PDMBLKCACHE_ENTRY_IS_DIRTY,
@@ -2281,13 +2785,8 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off, PCRTSGBU
                     }
                 } /* Dirty bit not set */
 
-                /* Move this entry to the top position */
-                if (pEntry->pList == &pCache->LruFrequentlyUsed)
-                {
-                    pdmBlkCacheLockEnter(pCache);
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheLockLeave(pCache);
-                }
+                /* Mark the entry as referenced, see PDMR3BlkCacheRead(). */
+                ASMAtomicWriteBool(&pEntry->fReferenced, true);
 
                 pdmBlkCacheEntryRelease(pEntry);
             }
@@ -2295,16 +2794,16 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off, PCRTSGBU
             {
                 uint8_t *pbBuffer = NULL;
 
-                pdmBlkCacheLockEnter(pCache);
-                pdmBlkCacheEntryRemoveFromList(pEntry); /* Remove it before we remove data, otherwise it may get freed when evicting data. */
-                bool fEnough = pdmBlkCacheReclaim(pCache, pEntry->cbData, true, &pbBuffer);
+                pdmBlkCacheShardLockEnter(pShard);
+                bool fGhostHitFrequent = pdmBlkCacheGhostHit(pShard, pEntry);
+                bool fEnough = pdmBlkCacheReclaim(pShard, pEntry->cbData, fGhostHitFrequent, true, &pbBuffer);
 
                 if (fEnough)
                 {
                     /* Move the entry to Am and fetch it to the cache. */
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheAdd(pCache, pEntry->cbData);
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheEntryAddToList(&pShard->LruFrequentlyUsed, pEntry);
+                    pdmBlkCacheAdd(pShard, pEntry->cbData);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     if (pbBuffer)
                         pEntry->pbData = pbBuffer;
@@ -2329,7 +2828,7 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off, PCRTSGBU
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     RTMemFree(pEntry);
                     pdmBlkCacheRequestPassthrough(pBlkCache, pReq,
@@ -2485,9 +2984,10 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
 
                 cbThisDiscard = RT_MIN(pEntry->cbData - offDiff, cbLeft);
 
+                PPDMBLKCACHESHARD pShard = pEntry->pShard;
+
                 /* Ghost lists contain no data. */
-                if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                    || (pEntry->pList == &pCache->LruFrequentlyUsed))
+                if (pdmBlkCacheEntryIsCached(pEntry))
                 {
                     /* Check if the entry is dirty. */
                     if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
@@ -2497,14 +2997,15 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                         /* If it is dirty but not yet in progress remove it. */
                         if (!(pEntry->fFlags & PDMBLKCACHE_ENTRY_IO_IN_PROGRESS))
                         {
-                            pdmBlkCacheLockEnter(pCache);
+                            pdmBlkCacheShardLockEnter(pShard);
                             pdmBlkCacheEntryRemoveFromList(pEntry);
+                            pdmBlkCacheSub(pShard, pEntry->cbData);
 
                             STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
                             RTAvlrU64Remove(pBlkCache->pTree, pEntry->Core.Key);
                             STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
 
-                            pdmBlkCacheLockLeave(pCache);
+                            pdmBlkCacheShardLockLeave(pShard);
 
                             RTMemFree(pEntry);
                         }
@@ -2543,8 +3044,9 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                         }
                         else /* I/O in progress flag not set */
                         {
-                            pdmBlkCacheLockEnter(pCache);
+                            pdmBlkCacheShardLockEnter(pShard);
                             pdmBlkCacheEntryRemoveFromList(pEntry);
+                            pdmBlkCacheSub(pShard, pEntry->cbData);
 
                             RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
                             STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
@@ -2552,7 +3054,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                             STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                             RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                            pdmBlkCacheLockLeave(pCache);
+                            pdmBlkCacheShardLockLeave(pShard);
 
                             RTMemFree(pEntry);
                         }
@@ -2560,7 +3062,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                 }
                 else /* Entry is on the ghost list just remove cache entry. */
                 {
-                    pdmBlkCacheLockEnter(pCache);
+                    pdmBlkCacheShardLockEnter(pShard);
                     pdmBlkCacheEntryRemoveFromList(pEntry);
 
                     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
@@ -2569,7 +3071,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     RTMemFree(pEntry);
                 }
@@ -2615,6 +3117,57 @@ static PPDMBLKCACHEWAITER pdmBlkCacheWaiterComplete(PPDMBLKCACHE pBlkCache, PPDM
     return pNext;
 }
 
+/**
+ * Drops an entry whose data couldn't be read from the medium.
+ *
+ * @returns nothing.
+ * @param   pBlkCache       The endpoint cache.
+ * @param   pEntry          The entry to drop, referenced by the caller and
+ *                          with the I/O in progress flag set.
+ */
+static void pdmBlkCacheEntryDropInvalid(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEENTRY pEntry)
+{
+    PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
+    PPDMBLKCACHESHARD  pShard = pEntry->pShard;
+
+    LogFlowFunc(("Dropping entry %#p (off=%llu cb=%u) after a failed read\n", pEntry, pEntry->Core.Key, pEntry->cbData));
+
+    pdmBlkCacheShardLockEnter(pShard);
+    RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
+
+    if (   !pEntry->pWaitingHead
+        && ASMAtomicReadU32(&pEntry->cRefs) == 1)
+    {
+        if (ASMAtomicXchgBool(&pEntry->fReadAhead, false))
+            STAM_REL_COUNTER_INC(&pBlkCache->StatReadAheadWasted);
+
+        pdmBlkCacheEntryRemoveFromList(pEntry);
+        pdmBlkCacheSub(pShard, pEntry->cbData);
+
+        STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
+        RTAvlrU64Remove(pBlkCache->pTree, pEntry->Core.Key);
+        STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
+
+        RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+        pdmBlkCacheShardLockLeave(pShard);
+
+        RTMemPageFree(pEntry->pbData, pEntry->cbData);
+        RTMemFree(pEntry);
+    }
+    else
+    {
+        /*
+         * Somebody started using the entry in the meantime, fetch the data again
+         * so the waiters get either the data or the error.
+         */
+        RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+        pdmBlkCacheShardLockLeave(pShard);
+
+        pdmBlkCacheEntryReadFromMedium(pEntry);
+        pdmBlkCacheEntryRelease(pEntry);
+    }
+}
+
 static void pdmBlkCacheIoXferCompleteEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEIOXFER hIoXfer, int rcIoXfer)
 {
     PPDMBLKCACHEENTRY  pEntry    = hIoXfer->pEntry;
@@ -2681,6 +3234,18 @@ static void pdmBlkCacheIoXferCompleteEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEI
         AssertMsg(!(pEntry->fFlags & PDMBLKCACHE_ENTRY_IS_DIRTY),
                   ("Invalid flags set\n"));
 
+        /*
+         * A failed read nobody is waiting for (read ahead) leaves invalid data in the entry.
+         * Keep it marked as in progress so nobody uses the data until it is dropped below.
+         */
+        if (RT_FAILURE(rcIoXfer) && !pCurr)
+        {
+            pEntry->fFlags |= PDMBLKCACHE_ENTRY_IO_IN_PROGRESS;
+            RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+            pdmBlkCacheEntryDropInvalid(pBlkCache, pEntry);
+            return;
+        }
+
         while (pCurr)
         {
             if (pCurr->fWrite)
@@ -2790,6 +3355,21 @@ VMMR3DECL(int) PDMR3BlkCacheResume(PPDMBLKCACHE pBlkCache)
     return VINF_SUCCESS;
 }
 
+VMMR3DECL(int) PDMR3BlkCacheSetReadAhead(PPDMBLKCACHE pBlkCache, uint32_t cbReadAheadMax, uint64_t cbMedium)
+{
+    LogFlowFunc(("pBlkCache=%#p cbReadAheadMax=%u cbMedium=%llu\n", pBlkCache, cbReadAheadMax, cbMedium));
+
+    AssertPtrReturn(pBlkCache, VERR_INVALID_POINTER);
+
+    if (cbReadAheadMax == UINT32_MAX)
+        cbReadAheadMax = pBlkCache->pCache->cbReadAheadMaxDef;
+
+    ASMAtomicWriteU64(&pBlkCache->cbMedium, cbMedium);
+    ASMAtomicWriteU32(&pBlkCache->cbReadAheadMax, cbReadAheadMax);
+    LogRel(("BlkCache: Read ahead window for \"%s\" is %u bytes\n", pBlkCache->pszId, cbReadAheadMax));
+    return VINF_SUCCESS;
+}
+
 VMMR3DECL(int) PDMR3BlkCacheClear(PPDMBLKCACHE pBlkCache)
 {
     int rc = VINF_SUCCESS;
@@ -2805,10 +3385,12 @@ VMMR3DECL(int) PDMR3BlkCacheClear(PPDMBLKCACHE pBlkCache)
 
     /* Make sure nobody is accessing the cache while we delete the tree. */
     pdmBlkCacheLockEnter(pCache);
+    pdmBlkCacheShardsLockEnterAll(pCache);
     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
     RTAvlrU64Destroy(pBlkCache->pTree, pdmBlkCacheEntryDestroy, pCache);
     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
+    pdmBlkCacheShardsLockLeaveAll(pCache);
     pdmBlkCacheLockLeave(pCache);
     return rc;
 }
@@ -640,6 +640,7 @@
 #include <iprt/assert.h>
 #include <iprt/env.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
 #include <iprt/file.h>
 #include <iprt/string.h>
 #include <iprt/thread.h>
@@ -905,6 +906,33 @@ VMMR3DECL(int) PGMR3Init(PVM pVM)
     rc = CFGMR3QueryBoolDef(pCfgPGM, "ZeroRamPagesOnReset", &pVM->pgm.s.fZeroRamPagesOnReset, true);
     AssertLogRelRCReturn(rc, rc);
 
+    /** @cfgm{/PGM/SaveDedup, boolean, true}
+     * Whether to send RAM pages whose content has already been sent in the
+     * same saved state stream as references to the earlier page. */
+    rc = CFGMR3QueryBoolDef(pCfgPGM, "SaveDedup", &pVM->pgm.s.LiveSave.fDedup, true);
+    AssertLogRelRCReturn(rc, rc);
+
+    /** @cfgm{/PGM/LiveSaveScanThreads, uint32_t, min(host CPUs / 2, 8)}
+     * The number of threads to scan RAM for dirty pages with during live save.
+     * Zero or one makes the saving thread do it all by itself. */
+    rc = CFGMR3QueryU32Def(pCfgPGM, "LiveSaveScanThreads", &pVM->pgm.s.LiveSave.cScanThreads,
+                           RT_MIN(RTMpGetOnlineCount() / 2, 8));
+    AssertLogRelRCReturn(rc, rc);
+    pVM->pgm.s.LiveSave.cScanThreads = RT_MIN(pVM->pgm.s.LiveSave.cScanThreads, PGM_LIVE_SAVE_MAX_SCAN_THREADS);
+
+    /** @cfgm{/PGM/SaveForLazyRestore, boolean, false}
+     * Whether to write RAM so that the saved state can be restored lazily, i.e.
+     * in a separate unit during the final pass followed by a page index. */
+    rc = CFGMR3QueryBoolDef(pCfgPGM, "SaveForLazyRestore", &pVM->pgm.s.LiveSave.fRamIndex, false);
+    AssertLogRelRCReturn(rc, rc);
+
+    /** @cfgm{/PGM/LazyRestore, boolean, false}
+     * Whether to resume the VM before all RAM has been read from a saved state
+     * with a page index, fetching the remaining pages on first access and in
+     * the background. */
+    rc = CFGMR3QueryBoolDef(pCfgPGM, "LazyRestore", &pVM->pgm.s.fLazyRestore, false);
+    AssertLogRelRCReturn(rc, rc);
+
 #ifdef VBOX_WITH_STATISTICS
     /*
      * Allocate memory for the statistics before someone tries to use them.
@@ -1017,6 +1045,18 @@ VMMR3DECL(int) PGMR3Init(PVM pVM)
                                               "MMIO2 dirty page tracing",
                                               &pVM->pgm.s.hMmio2DirtyPhysHandlerType);
 
+    /*
+     * Register the physical access handler guarding RAM pages that a lazy
+     * restore has yet to read from the saved state.
+     */
+    if (RT_SUCCESS(rc))
+        rc = PGMR3HandlerPhysicalTypeRegister(pVM, PGMPHYSHANDLERKIND_ALL, false /*fKeepPgmLock*/,
+                                              pgmR3LazyRestoreHandler,
+                                              NULL, NULL, NULL,
+                                              NULL, NULL, NULL,
+                                              "Lazy restore",
+                                              &pVM->pgm.s.hLazyRestorePhysHandlerType);
+
     /*
      * Init the paging.
      */
@@ -1324,6 +1364,10 @@ static int pgmR3InitStats(PVM pVM)
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cDirtyPagesShort,     STAMTYPE_U32,     "/PGM/LiveSave/cDirtyPagesShort",     STAMUNIT_COUNT,     "Short term dirty page average.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cPagesPerSecond,      STAMTYPE_U32,     "/PGM/LiveSave/cPagesPerSecond",      STAMUNIT_COUNT,     "Pages per second.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cSavedPages,          STAMTYPE_U64,     "/PGM/LiveSave/cSavedPages",          STAMUNIT_COUNT,     "The total number of saved pages.");
+    STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cDedupRawPages,       STAMTYPE_U64,     "/PGM/LiveSave/Dedup/cRawPages",      STAMUNIT_COUNT,     "RAM pages sent as raw data.");
+    STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cDedupZeroPages,      STAMTYPE_U64,     "/PGM/LiveSave/Dedup/cZeroPages",     STAMUNIT_COUNT,     "RAM pages elided because they were all zeros.");
+    STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cDedupDupPages,       STAMTYPE_U64,     "/PGM/LiveSave/Dedup/cDupPages",      STAMUNIT_COUNT,     "RAM pages sent as references to an identical page.");
+    STAM_REL_REG_USED(pVM, &pPGM->LiveSave.uDedupPct,            STAMTYPE_U32,     "/PGM/LiveSave/Dedup/Ratio",          STAMUNIT_PCT,       "Percentage of the sent RAM pages that were elided.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cReadyPages,      STAMTYPE_U32,     "/PGM/LiveSave/Ram/cReadPages",       STAMUNIT_COUNT,     "RAM: Ready pages.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cDirtyPages,      STAMTYPE_U32,     "/PGM/LiveSave/Ram/cDirtyPages",      STAMUNIT_COUNT,     "RAM: Dirty pages.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cZeroPages,       STAMTYPE_U32,     "/PGM/LiveSave/Ram/cZeroPages",       STAMUNIT_COUNT,     "RAM: Ready zero pages.");
@@ -2036,6 +2080,9 @@ VMMR3_INT_DECL(void) PGMR3Reset(PVM pVM)
     LogFlow(("PGMR3Reset:\n"));
     VM_ASSERT_EMT(pVM);
 
+    /* Stop any lazy restore first, its prefetcher needs the lock. */
+    pgmR3LazyRestoreReset(pVM);
+
     pgmLock(pVM);
 
     /*
@@ -2171,6 +2218,8 @@ VMMR3_INT_DECL(void) PGMR3ResetNoMorePhysWritesFlag(PVM pVM)
  */
 VMMR3DECL(int) PGMR3Term(PVM pVM)
 {
+    pgmR3LazyRestoreTerm(pVM);
+
     /* Must free shared pages here. */
     pgmLock(pVM);
     pgmR3PhysRamTerm(pVM);
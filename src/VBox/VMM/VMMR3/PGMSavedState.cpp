@@ -34,8 +34,11 @@
 
 #include <iprt/asm.h>
 #include <iprt/assert.h>
+#include <iprt/critsect.h>
 #include <iprt/crc.h>
 #include <iprt/mem.h>
+#include <iprt/req.h>
+#include <iprt/semaphore.h>
 #include <iprt/sha.h>
 #include <iprt/string.h>
 #include <iprt/thread.h>
@@ -45,7 +48,9 @@
 *   Defined Constants And Macros                                                                                                 *
 *********************************************************************************************************************************/
 /** Saved state data unit version.  */
-#define PGM_SAVED_STATE_VERSION                 14
+#define PGM_SAVED_STATE_VERSION                 15
+/** Saved state data unit version before PGM_STATE_REC_RAM_DUP. */
+#define PGM_SAVED_STATE_VERSION_PRE_DEDUP       14
 /** Saved state data unit version before the PAE PDPE registers. */
 #define PGM_SAVED_STATE_VERSION_PRE_PAE         13
 /** Saved state data unit version after this includes ballooned page flags in
@@ -86,8 +91,11 @@
 #define PGM_STATE_REC_ROM_PROT          UINT8_C(0x07)
 /** Ballooned page. No data. */
 #define PGM_STATE_REC_RAM_BALLOONED     UINT8_C(0x08)
+/** RAM page identical to the content last sent for another RAM page in the
+ * same stream.  The address (RTGCPHYS) of that page is the payload. */
+#define PGM_STATE_REC_RAM_DUP           UINT8_C(0x09)
 /** The last record type. */
-#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_BALLOONED
+#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_DUP
 /** End marker. */
 #define PGM_STATE_REC_END               UINT8_C(0xff)
 /** Flag indicating that the data is preceded by the page address.
@@ -102,6 +110,44 @@
 /** The CRC-32 for a zero half page. */
 #define PGM_STATE_CRC32_ZERO_HALF_PAGE  UINT32_C(0xf1e8ba9e)
 
+/** @name Content hash dictionary for eliding duplicate RAM pages.
+ * @{  */
+/** The number of hash buckets for each of the two lookups (power of two). */
+#define PGM_DEDUP_BUCKETS               _64K
+/** The max number of pages tracked by the dictionary (1 GB worth). */
+#define PGM_DEDUP_MAX_ENTRIES           _256K
+/** Nil entry index. */
+#define PGM_DEDUP_NIL                   UINT32_MAX
+/** @} */
+
+/** The number of RAM pages in a parallel scan chunk (8 MB).  This matches the
+ * yield interval of the serial scan, so a round of one chunk per worker holds
+ * the PGM lock about as long as the serial scan does between yields. */
+#define PGM_LS_SCAN_CHUNK_PAGES         _2K
+/** The minimum number of RAM pages for scanning in parallel (256 MB). */
+#define PGM_LS_SCAN_MIN_PAGES           _64K
+
+/** @name Lazy restore.
+ * @{  */
+/** Saved state version of the "pgmram" unit holding the RAM pages when
+ * PGM::LiveSave::fRamIndex is set. */
+#define PGM_RAM_SAVED_STATE_VERSION     1
+/** Saved state version of the "pgmidx" unit holding the RAM page index. */
+#define PGM_IDX_SAVED_STATE_VERSION     1
+/** RAM page index entry: Not in the saved state / already restored. */
+#define PGM_RAM_IDX_NONE                UINT64_C(0)
+/** RAM page index entry: Zero page. */
+#define PGM_RAM_IDX_ZERO                UINT64_C(1)
+/** RAM page index entry: Ballooned page.
+ * Any value above this is the stream offset of the page data record. */
+#define PGM_RAM_IDX_BALLOONED           UINT64_C(2)
+/** The number of pages the lazy restore prefetcher reads before handing
+ * them to an EMT for installing. */
+#define PGM_LAZY_RESTORE_BATCH_PAGES    64
+/** The number of batches the lazy restore prefetcher can have in flight. */
+#define PGM_LAZY_RESTORE_BATCHES        2
+/** @} */
+
 
 
 /** @name Old Page types used in older saved states.
@@ -127,6 +173,227 @@
 /*********************************************************************************************************************************
 *   Structures and Typedefs                                                                                                      *
 *********************************************************************************************************************************/
+/**
+ * Content hash dictionary entry.
+ *
+ * There is one for each RAM page whose last record in the stream carried the
+ * raw page content.
+ */
+typedef struct PGMLSDEDUPENTRY
+{
+    /** The SHA-256 of the page content as it was sent.  A match is trusted
+     * without comparing the content, so this must be collision resistant. */
+    uint8_t                         abHash[RTSHA256_HASH_SIZE];
+    /** The next entry in the content hash chain. */
+    uint32_t                        iNextHash;
+    /** The next entry in the address chain, or the next free entry. */
+    uint32_t                        iNextAddr;
+    /** The guest physical address of the page. */
+    RTGCPHYS                        GCPhys;
+} PGMLSDEDUPENTRY;
+/** Pointer to a content hash dictionary entry. */
+typedef PGMLSDEDUPENTRY *PPGMLSDEDUPENTRY;
+
+/**
+ * Content hash dictionary used by pgmR3SaveRamPages to find pages whose
+ * content was already sent in the current stream.
+ *
+ * Entries are chained both by content hash and by address, the latter so
+ * that an entry can be dropped as soon as its page is sent again with
+ * different content.
+ */
+typedef struct PGMLSDEDUP
+{
+    /** The RAM range generation the entries are valid for. */
+    uint32_t                        idRamRangesGen;
+    /** The number of entries handed out (high water mark). */
+    uint32_t                        cUsed;
+    /** The head of the free entry list. */
+    uint32_t                        iFree;
+    /** The content hash chain heads. */
+    uint32_t                        aiHashHeads[PGM_DEDUP_BUCKETS];
+    /** The address chain heads. */
+    uint32_t                        aiAddrHeads[PGM_DEDUP_BUCKETS];
+    /** The entries. */
+    PGMLSDEDUPENTRY                 aEntries[PGM_DEDUP_MAX_ENTRIES];
+} PGMLSDEDUP;
+/** Pointer to a content hash dictionary. */
+typedef PGMLSDEDUP *PPGMLSDEDUP;
+
+/**
+ * Counter changes accumulated while scanning RAM.
+ *
+ * Kept apart from PGM so the parallel scan workers don't have to share the
+ * counters, see pgmR3ScanRamMergeStats.
+ */
+typedef struct PGMLSRAMSCANSTATS
+{
+    /** @name PGM::LiveSave::Ram changes.
+     * @{ */
+    int32_t                         cReadyPages;
+    int32_t                         cDirtyPages;
+    int32_t                         cZeroPages;
+    int32_t                         cMonitoredPages;
+    /** @} */
+    /** PGM::LiveSave::cIgnoredPages change. */
+    int32_t                         cIgnoredPages;
+    /** PGM::cWrittenToPages change. */
+    int32_t                         cWrittenToPages;
+    /** PGM::cMonitoredPages change. */
+    int32_t                         cPgmMonitoredPages;
+    /** Padding to a cache line. */
+    int32_t                         ai32Padding[9];
+} PGMLSRAMSCANSTATS;
+AssertCompileSize(PGMLSRAMSCANSTATS, 64);
+/** Pointer to RAM scan counter changes. */
+typedef PGMLSRAMSCANSTATS *PPGMLSRAMSCANSTATS;
+
+/**
+ * A chunk of a RAM range for the parallel scan.
+ */
+typedef struct PGMLSRAMSCANCHUNK
+{
+    /** The RAM range. */
+    PPGMRAMRANGE                    pRam;
+    /** The first page. */
+    uint32_t                        iFirstPage;
+    /** The number of pages. */
+    uint32_t                        cPages;
+    /** The pages to write monitor when the round is done. */
+    uint64_t                       *pbmDeferred;
+} PGMLSRAMSCANCHUNK;
+/** Pointer to a parallel scan chunk. */
+typedef PGMLSRAMSCANCHUNK *PPGMLSRAMSCANCHUNK;
+
+/**
+ * Parallel RAM scan state, see pgmR3ScanRamPagesParallel.
+ */
+typedef struct PGMLSRAMSCAN
+{
+    /** The cross context VM structure. */
+    PVM                             pVM;
+    /** The chunks. */
+    PPGMLSRAMSCANCHUNK              paChunks;
+    /** The next chunk to scan. */
+    uint32_t volatile               iNextChunk;
+    /** The end of the current round. */
+    uint32_t                        iEndChunk;
+    /** Per worker counter changes. */
+    PGMLSRAMSCANSTATS               aStats[PGM_LIVE_SAVE_MAX_SCAN_THREADS];
+} PGMLSRAMSCAN;
+/** Pointer to the parallel RAM scan state. */
+typedef PGMLSRAMSCAN *PPGMLSRAMSCAN;
+
+/**
+ * RAM range in a RAM page index.
+ */
+typedef struct PGMRAMIDXRANGE
+{
+    /** The guest physical address of the range. */
+    RTGCPHYS                        GCPhys;
+    /** The number of pages in the range. */
+    uint32_t                        cPages;
+    /** The index of the first page entry (PGMRAMIDX::pau64Entries). */
+    uint32_t                        iFirstEntry;
+} PGMRAMIDXRANGE;
+/** Pointer to a RAM range in a RAM page index. */
+typedef PGMRAMIDXRANGE *PPGMRAMIDXRANGE;
+
+/**
+ * RAM page index telling where each RAM page is in the "pgmram" unit.
+ *
+ * Built while saving with PGM::LiveSave::fRamIndex set and written as the
+ * "pgmidx" unit, read back again for the lazy restore.
+ */
+typedef struct PGMRAMIDX
+{
+    /** The number of ranges. */
+    uint32_t                        cRanges;
+    /** The number of page entries. */
+    uint32_t                        cEntries;
+    /** The ranges, sorted by address. */
+    PPGMRAMIDXRANGE                 paRanges;
+    /** The page entries (PGM_RAM_IDX_XXX or a record offset). */
+    uint64_t                       *pau64Entries;
+} PGMRAMIDX;
+/** Pointer to a RAM page index. */
+typedef PGMRAMIDX *PPGMRAMIDX;
+
+/**
+ * A batch of pages read by the lazy restore prefetcher, see
+ * pgmR3LazyRestoreInstallWorker.
+ */
+typedef struct PGMLAZYRESTOREBATCH
+{
+    /** Set while the batch is queued for or being installed by an EMT. */
+    bool volatile                   fBusy;
+    /** The number of pages in the batch. */
+    uint32_t                        cPages;
+    /** The page addresses. */
+    RTGCPHYS                        aGCPhys[PGM_LAZY_RESTORE_BATCH_PAGES];
+    /** The index entries the pages were read for. */
+    uint64_t                        au64Entries[PGM_LAZY_RESTORE_BATCH_PAGES];
+    /** The page content. */
+    uint8_t                         abPages[PGM_LAZY_RESTORE_BATCH_PAGES][PAGE_SIZE];
+} PGMLAZYRESTOREBATCH;
+/** Pointer to a lazy restore prefetch batch. */
+typedef PGMLAZYRESTOREBATCH *PPGMLAZYRESTOREBATCH;
+
+/**
+ * Lazy (post-copy) restore state.
+ *
+ * The RAM pages which are still in the saved state are covered by
+ * physical access handlers of type PGM::hLazyRestorePhysHandlerType.  A page
+ * is read from the saved state when ring-3 maps it
+ * (pgmR3LazyRestoreFetchLocked), when an access is forwarded to the handler,
+ * or when the prefetch thread gets to it, whichever comes first.
+ *
+ * Installing a page may allocate it, which only an EMT can do.  So the
+ * prefetch thread only reads the pages and has an EMT install them a batch
+ * at a time.
+ *
+ * Locking: The index entries, cPending and the batches are protected by the
+ * PGM lock, the saved state handle by CritSect.  The PGM lock is always taken
+ * first.
+ */
+typedef struct PGMLAZYRESTORE
+{
+    /** The cross context VM structure. */
+    PVM                             pVM;
+    /** The saved state opened for random access page reads, NULL when done. */
+    PSSMHANDLE                      pSSM;
+    /** Serializes pSSM access. */
+    RTCRITSECT                      CritSect;
+    /** The page index; the entries are set to PGM_RAM_IDX_NONE as the pages
+     * are restored. */
+    PGMRAMIDX                       Idx;
+    /** The number of pages still in the saved state. */
+    uint32_t                        cPending;
+    /** The number of handlers in paGCPhysHandlers. */
+    uint32_t                        cHandlers;
+    /** The start addresses of the registered handlers. */
+    RTGCPHYS                       *paGCPhysHandlers;
+    /** The prefetch thread. */
+    RTTHREAD                        hThread;
+    /** Tells the prefetch thread to quit. */
+    bool volatile                   fTerminate;
+    /** Signalled when a batch has been installed or fTerminate is set. */
+    RTSEMEVENT                      hEvtBatchDone;
+    /** Set by the first pgmR3LazyRestoreEnd call, as the end worker and a
+     * state save completing the restore may race one another. */
+    bool volatile                   fEnding;
+    /** The number of pages fetched on demand (statistics). */
+    uint32_t volatile               cFaultedPages;
+    /** The number of pages fetched by the prefetch thread (statistics). */
+    uint32_t volatile               cPrefetchedPages;
+    /** The RTTimeNanoTS of when the VM was made runnable (statistics). */
+    uint64_t                        nsStart;
+    /** The prefetch batches. */
+    PGMLAZYRESTOREBATCH             aBatches[PGM_LAZY_RESTORE_BATCHES];
+} PGMLAZYRESTORE;
+/** Pointer to the lazy restore state. */
+typedef PGMLAZYRESTORE *PPGMLAZYRESTORE;
+
 /** For loading old saved states. (pre-smp) */
 typedef struct
 {
@@ -202,6 +469,12 @@ static const SSMFIELD s_aPGMFields_Old[] =
 };
 
 
+/*********************************************************************************************************************************
+*   Internal Functions                                                                                                           *
+*********************************************************************************************************************************/
+static int pgmR3LazyRestoreComplete(PVM pVM);
+
+
 /**
  * Find the ROM tracking structure for the given page.
  *
@@ -1077,6 +1350,23 @@ static void pgmR3DoneMmio2Pages(PVM pVM)
  */
 static int pgmR3PrepRamPages(PVM pVM)
 {
+#ifndef PGMLIVESAVERAMPAGE_WITH_CRC32
+    /*
+     * Create the worker pool for scanning large amounts of RAM in parallel.
+     */
+    if (   pVM->pgm.s.LiveSave.cScanThreads > 1
+        && pVM->pgm.s.cAllPages >= PGM_LS_SCAN_MIN_PAGES
+        && !pVM->pgm.s.LiveSave.hScanPoolR3)
+    {
+        RTREQPOOL hPool;
+        int rc = RTReqPoolCreate(pVM->pgm.s.LiveSave.cScanThreads - 1, RT_MS_1MIN /*cMsMinIdle*/,
+                                 UINT32_MAX /*cThreadsPushBackThreshold*/, 1 /*cMsMaxPushBack*/, "PGMScan", &hPool);
+        if (RT_SUCCESS(rc))
+            pVM->pgm.s.LiveSave.hScanPoolR3 = hPool;
+        else
+            LogRel(("PGM: Failed to create the RAM scan worker pool: %Rrc\n", rc));
+    }
+#endif
 
     /*
      * Try allocating tracking structures for the ram ranges.
@@ -1341,6 +1631,393 @@ static void pgmR3StateVerifyCrc32ForRamPage(PVM pVM, PPGMRAMRANGE pCur, PPGMLIVE
 
 #endif /* PGMLIVESAVERAMPAGE_WITH_CRC32 */
 
+/**
+ * Scans one RAM page for modifications and reprotects it.
+ *
+ * This only touches the page, its tracking entry and @a pStats, so different
+ * pages can be scanned concurrently as long as the caller owns the PGM lock.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   pCur                The RAM range.
+ * @param   iPage               The page index into the range.
+ * @param   pStats              Where to account counter changes.
+ * @param   pbmDeferred         Bitmap for recording pages that should be write
+ *                              monitored by the caller.  NULL if this should be
+ *                              done right away.
+ * @param   iBit                The bit in @a pbmDeferred for this page.
+ */
+static void pgmR3ScanRamPage(PVM pVM, PPGMRAMRANGE pCur, uint32_t iPage, PPGMLSRAMSCANSTATS pStats,
+                             uint64_t *pbmDeferred, int32_t iBit)
+{
+    PPGMLIVESAVERAMPAGE paLSPages = pCur->paLSPages;
+
+    /* Skip already ignored pages. */
+    if (paLSPages[iPage].fIgnore)
+        return;
+
+    if (RT_LIKELY(PGM_PAGE_GET_TYPE(&pCur->aPages[iPage]) == PGMPAGETYPE_RAM))
+    {
+        /*
+         * A RAM page.
+         */
+        switch (PGM_PAGE_GET_STATE(&pCur->aPages[iPage]))
+        {
+            case PGM_PAGE_STATE_ALLOCATED:
+                /** @todo Optimize this: Don't always re-enable write
+                 * monitoring if the page is known to be very busy. */
+                if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
+                {
+                    AssertMsg(paLSPages[iPage].fWriteMonitored,
+                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
+                    PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
+                    pStats->cWrittenToPages--;
+                }
+                else
+                {
+                    AssertMsg(!paLSPages[iPage].fWriteMonitored,
+                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
+                    pStats->cMonitoredPages++;
+                }
+
+                if (!paLSPages[iPage].fDirty)
+                {
+                    pStats->cReadyPages--;
+                    if (paLSPages[iPage].fZero)
+                        pStats->cZeroPages--;
+                    pStats->cDirtyPages++;
+                    if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
+                        paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
+                }
+
+                if (pbmDeferred)
+                    ASMBitSet(pbmDeferred, iBit); /* Done by the caller, see pgmR3ScanRamPagesParallel. */
+                else
+                    pgmPhysPageWriteMonitor(pVM, &pCur->aPages[iPage],
+                                            pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT));
+                paLSPages[iPage].fWriteMonitored        = 1;
+                paLSPages[iPage].fWriteMonitoredJustNow = 1;
+                paLSPages[iPage].fDirty                 = 1;
+                paLSPages[iPage].fZero                  = 0;
+                paLSPages[iPage].fShared                = 0;
+#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
+                paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
+#endif
+                break;
+
+            case PGM_PAGE_STATE_WRITE_MONITORED:
+                Assert(paLSPages[iPage].fWriteMonitored);
+                if (PGM_PAGE_GET_WRITE_LOCKS(&pCur->aPages[iPage]) == 0)
+                {
+#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
+                    if (paLSPages[iPage].fWriteMonitoredJustNow)
+                        pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
+                    else
+                        pgmR3StateVerifyCrc32ForRamPage(pVM, pCur, paLSPages, iPage, "scan");
+#endif
+                    paLSPages[iPage].fWriteMonitoredJustNow = 0;
+                }
+                else
+                {
+                    paLSPages[iPage].fWriteMonitoredJustNow = 1;
+#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
+                    paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
+#endif
+                    if (!paLSPages[iPage].fDirty)
+                    {
+                        pStats->cReadyPages--;
+                        pStats->cDirtyPages++;
+                        if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
+                            paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
+                    }
+                }
+                break;
+
+            case PGM_PAGE_STATE_ZERO:
+            case PGM_PAGE_STATE_BALLOONED:
+                if (!paLSPages[iPage].fZero)
+                {
+                    if (!paLSPages[iPage].fDirty)
+                    {
+                        paLSPages[iPage].fDirty = 1;
+                        pStats->cReadyPages--;
+                        pStats->cDirtyPages++;
+                    }
+                    paLSPages[iPage].fZero = 1;
+                    paLSPages[iPage].fShared = 0;
+#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
+                    paLSPages[iPage].u32Crc = PGM_STATE_CRC32_ZERO_PAGE;
+#endif
+                }
+                break;
+
+            case PGM_PAGE_STATE_SHARED:
+                if (!paLSPages[iPage].fShared)
+                {
+                    if (!paLSPages[iPage].fDirty)
+                    {
+                        paLSPages[iPage].fDirty = 1;
+                        pStats->cReadyPages--;
+                        if (paLSPages[iPage].fZero)
+                            pStats->cZeroPages--;
+                        pStats->cDirtyPages++;
+                    }
+                    paLSPages[iPage].fZero = 0;
+                    paLSPages[iPage].fShared = 1;
+#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
+                    pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
+#endif
+                }
+                break;
+        }
+    }
+    else
+    {
+        /*
+         * All other types => Ignore the page.
+         */
+        Assert(!paLSPages[iPage].fIgnore); /* skipped before switch */
+        paLSPages[iPage].fIgnore = 1;
+        if (paLSPages[iPage].fWriteMonitored)
+        {
+            /** @todo this doesn't hold water when we start monitoring MMIO2 and ROM shadow
+             *        pages! */
+            if (RT_UNLIKELY(PGM_PAGE_GET_STATE(&pCur->aPages[iPage]) == PGM_PAGE_STATE_WRITE_MONITORED))
+            {
+                AssertMsgFailed(("%R[pgmpage]", &pCur->aPages[iPage])); /* shouldn't happen. */
+                PGM_PAGE_SET_STATE(pVM, &pCur->aPages[iPage], PGM_PAGE_STATE_ALLOCATED);
+                pStats->cPgmMonitoredPages--;
+            }
+            if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
+            {
+                PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
+                pStats->cWrittenToPages--;
+            }
+            pStats->cMonitoredPages--;
+        }
+
+        /** @todo the counting doesn't quite work out here. fix later? */
+        if (paLSPages[iPage].fDirty)
+            pStats->cDirtyPages--;
+        else
+        {
+            pStats->cReadyPages--;
+            if (paLSPages[iPage].fZero)
+                pStats->cZeroPages--;
+        }
+        pStats->cIgnoredPages++;
+    }
+}
+
+
+/**
+ * Merges the counter changes accumulated by pgmR3ScanRamPage into PGM.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   pStats              The counter changes.  Reset on return.
+ */
+static void pgmR3ScanRamMergeStats(PVM pVM, PPGMLSRAMSCANSTATS pStats)
+{
+    pVM->pgm.s.LiveSave.Ram.cReadyPages     += pStats->cReadyPages;
+    pVM->pgm.s.LiveSave.Ram.cDirtyPages     += pStats->cDirtyPages;
+    pVM->pgm.s.LiveSave.Ram.cZeroPages      += pStats->cZeroPages;
+    pVM->pgm.s.LiveSave.Ram.cMonitoredPages += pStats->cMonitoredPages;
+    pVM->pgm.s.LiveSave.cIgnoredPages       += pStats->cIgnoredPages;
+    Assert((int32_t)pVM->pgm.s.cWrittenToPages + pStats->cWrittenToPages >= 0);
+    pVM->pgm.s.cWrittenToPages              += pStats->cWrittenToPages;
+    Assert((int32_t)pVM->pgm.s.cMonitoredPages + pStats->cPgmMonitoredPages >= 0);
+    pVM->pgm.s.cMonitoredPages              += pStats->cPgmMonitoredPages;
+    RT_ZERO(*pStats);
+}
+
+
+/**
+ * Worker for pgmR3ScanRamPagesParallel that scans chunks until there are no
+ * more left in the current round.
+ *
+ * @param   pScan               The scan state.
+ * @param   iWorker             The worker index (0 is the saving thread).
+ */
+static DECLCALLBACK(void) pgmR3ScanRamWorker(PPGMLSRAMSCAN pScan, uintptr_t iWorker)
+{
+    PVM                 pVM    = pScan->pVM;
+    PPGMLSRAMSCANSTATS  pStats = &pScan->aStats[iWorker];
+    for (;;)
+    {
+        uint32_t const iChunk = ASMAtomicIncU32(&pScan->iNextChunk) - 1;
+        if (iChunk >= pScan->iEndChunk)
+            break;
+        PPGMLSRAMSCANCHUNK pChunk = &pScan->paChunks[iChunk];
+        for (uint32_t i = 0; i < pChunk->cPages; i++)
+            pgmR3ScanRamPage(pVM, pChunk->pRam, pChunk->iFirstPage + i, pStats, pChunk->pbmDeferred, (int32_t)i);
+    }
+}
+
+
+/**
+ * Splits the RAM ranges into scan chunks.
+ *
+ * @returns Number of chunks.
+ * @param   pVM                 The cross context VM structure.
+ * @param   GCPhysFirst         Where to start.
+ * @param   paChunks            Where to return the chunks.  NULL for counting.
+ * @param   pbmDeferred         The deferred write monitoring bitmap to divide
+ *                              up between the chunks.  NULL for counting.
+ * @param   pcbBitmap           Where to return the required bitmap size.
+ */
+static uint32_t pgmR3ScanRamBuildChunks(PVM pVM, RTGCPHYS GCPhysFirst, PPGMLSRAMSCANCHUNK paChunks,
+                                        uint64_t *pbmDeferred, size_t *pcbBitmap)
+{
+    uint32_t cChunks  = 0;
+    size_t   cbBitmap = 0;
+    for (PPGMRAMRANGE pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+        if (   pCur->GCPhysLast > GCPhysFirst
+            && !PGM_RAM_RANGE_IS_AD_HOC(pCur))
+        {
+            uint32_t const  cPages = pCur->cb >> PAGE_SHIFT;
+            uint32_t        iPage  = GCPhysFirst <= pCur->GCPhys ? 0 : (GCPhysFirst - pCur->GCPhys) >> PAGE_SHIFT;
+            while (iPage < cPages)
+            {
+                uint32_t const cChunkPages = RT_MIN(cPages - iPage, PGM_LS_SCAN_CHUNK_PAGES);
+                if (paChunks)
+                {
+                    paChunks[cChunks].pRam        = pCur;
+                    paChunks[cChunks].iFirstPage  = iPage;
+                    paChunks[cChunks].cPages      = cChunkPages;
+                    paChunks[cChunks].pbmDeferred = (uint64_t *)((uint8_t *)pbmDeferred + cbBitmap);
+                }
+                cChunks++;
+                cbBitmap += RT_ALIGN_32(cChunkPages, 64) / 8; /* keeps the chunks from sharing bitmap words */
+                iPage    += cChunkPages;
+            }
+        }
+    *pcbBitmap = cbBitmap;
+    return cChunks;
+}
+
+
+/**
+ * Scans RAM for modifications using the worker pool.
+ *
+ * The RAM is split into chunks that are handed out to the workers in rounds,
+ * with the saving thread taking part.  The PGM lock is held during a round,
+ * so the page states are stable, and the workers only touch the pages they
+ * are scanning.  Enabling write monitoring may involve disabling large pages
+ * and notifying NEM, so it's done by the saving thread between rounds, along
+ * with merging the counters and yielding the lock.  A round is one chunk per
+ * worker, keeping the time EMTs may have to wait for the lock in line with
+ * the serial scan.
+ *
+ * @returns true if the scan was done, false if the caller should do it.
+ * @param   pVM                 The cross context VM structure.
+ * @param   fFinalPass          Whether this is the final pass or not.
+ */
+static bool pgmR3ScanRamPagesParallel(PVM pVM, bool fFinalPass)
+{
+    RTREQPOOL const hPool    = pVM->pgm.s.LiveSave.hScanPoolR3;
+    uint32_t const  cWorkers = RT_MIN(pVM->pgm.s.LiveSave.cScanThreads, PGM_LIVE_SAVE_MAX_SCAN_THREADS);
+    RTGCPHYS        GCPhysCur = 0;
+
+    pgmLock(pVM);
+    for (;;)
+    {
+        /*
+         * Allocate and set up the chunks, dropping the lock while allocating.
+         */
+        uint32_t const  idRamRangesGen = pVM->pgm.s.idRamRangesGen;
+        size_t          cbBitmap;
+        uint32_t const  cChunks = pgmR3ScanRamBuildChunks(pVM, GCPhysCur, NULL, NULL, &cbBitmap);
+        if (!cChunks)
+            break;
+        size_t const    offChunks = RT_ALIGN_Z(sizeof(PGMLSRAMSCAN), 64);
+        size_t const    offBitmap = RT_ALIGN_Z(offChunks + cChunks * sizeof(PGMLSRAMSCANCHUNK), 64);
+        pgmUnlock(pVM);
+        PPGMLSRAMSCAN   pScan = (PPGMLSRAMSCAN)RTMemAllocZ(offBitmap + cbBitmap);
+        if (!pScan)
+            return false; /* Let the caller do it the slow way. */
+        pgmLock(pVM);
+        if (idRamRangesGen != pVM->pgm.s.idRamRangesGen)
+        {
+            pgmUnlock(pVM);
+            RTMemFree(pScan);
+            pgmLock(pVM);
+            continue;
+        }
+        pScan->pVM      = pVM;
+        pScan->paChunks = (PPGMLSRAMSCANCHUNK)((uint8_t *)pScan + offChunks);
+        pgmR3ScanRamBuildChunks(pVM, GCPhysCur, pScan->paChunks, (uint64_t *)((uint8_t *)pScan + offBitmap), &cbBitmap);
+
+        /*
+         * Do the rounds.
+         */
+        uint32_t iChunk = 0;
+        while (iChunk < cChunks)
+        {
+            uint32_t const cRound = RT_MIN(cChunks - iChunk, cWorkers);
+            pScan->iNextChunk = iChunk;
+            pScan->iEndChunk  = iChunk + cRound;
+
+            PRTREQ   ahReqs[PGM_LIVE_SAVE_MAX_SCAN_THREADS];
+            uint32_t cReqs = 0;
+            for (uint32_t iWorker = 1; iWorker < cWorkers && iWorker < cRound; iWorker++)
+            {
+                int rc = RTReqPoolCallEx(hPool, 0 /*cMillies*/, &ahReqs[cReqs], RTREQFLAGS_VOID,
+                                         (PFNRT)pgmR3ScanRamWorker, 2, pScan, (uintptr_t)iWorker);
+                if (ahReqs[cReqs] != NIL_RTREQ)
+                    cReqs++;
+                else
+                    LogRel(("pgmR3ScanRamPagesParallel: RTReqPoolCallEx failed: %Rrc\n", rc));
+            }
+            pgmR3ScanRamWorker(pScan, 0);
+            for (uint32_t iReq = 0; iReq < cReqs; iReq++)
+            {
+                int rc = RTReqWait(ahReqs[iReq], RT_INDEFINITE_WAIT);
+                AssertRC(rc);
+                RTReqRelease(ahReqs[iReq]);
+            }
+
+            for (uint32_t iWorker = 0; iWorker < cWorkers; iWorker++)
+                pgmR3ScanRamMergeStats(pVM, &pScan->aStats[iWorker]);
+
+            for (uint32_t i = iChunk; i < iChunk + cRound; i++)
+            {
+                PPGMLSRAMSCANCHUNK pChunk = &pScan->paChunks[i];
+                uint32_t const     cBits  = RT_ALIGN_32(pChunk->cPages, 64);
+                for (int32_t iBit = ASMBitFirstSet(pChunk->pbmDeferred, cBits);
+                     iBit >= 0;
+                     iBit = ASMBitNextSet(pChunk->pbmDeferred, cBits, iBit))
+                {
+                    uint32_t const iPage = pChunk->iFirstPage + (uint32_t)iBit;
+                    pgmPhysPageWriteMonitor(pVM, &pChunk->pRam->aPages[iPage],
+                                            pChunk->pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT));
+                }
+            }
+
+            /* Yield and restart if the RAM ranges were changed meanwhile. */
+            iChunk += cRound;
+            if (iChunk < cChunks && !fFinalPass)
+            {
+                RTGCPHYS const GCPhysNext = pScan->paChunks[iChunk].pRam->GCPhys
+                                          + ((RTGCPHYS)pScan->paChunks[iChunk].iFirstPage << PAGE_SHIFT);
+                if (   PDMR3CritSectYield(pVM, &pVM->pgm.s.CritSectX)
+                    && pVM->pgm.s.idRamRangesGen != idRamRangesGen)
+                {
+                    GCPhysCur = GCPhysNext;
+                    break;
+                }
+            }
+        }
+
+        pgmUnlock(pVM);
+        RTMemFree(pScan);
+        pgmLock(pVM);
+        if (iChunk >= cChunks)
+            break;
+    }
+    pgmUnlock(pVM);
+    return true;
+}
+
+
 /**
  * Scan for RAM page modifications and reprotect them.
  *
@@ -1349,9 +2026,15 @@ static void pgmR3StateVerifyCrc32ForRamPage(PVM pVM, PPGMRAMRANGE pCur, PPGMLIVE
  */
 static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
 {
+    if (   pVM->pgm.s.LiveSave.hScanPoolR3
+        && pgmR3ScanRamPagesParallel(pVM, fFinalPass))
+        return;
+
     /*
      * The RAM.
      */
+    PGMLSRAMSCANSTATS Stats;
+    RT_ZERO(Stats);
     RTGCPHYS GCPhysCur = 0;
     PPGMRAMRANGE pCur;
     pgmLock(pVM);
@@ -1363,7 +2046,6 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
             if (    pCur->GCPhysLast > GCPhysCur
                 && !PGM_RAM_RANGE_IS_AD_HOC(pCur))
             {
-                PPGMLIVESAVERAMPAGE paLSPages = pCur->paLSPages;
                 uint32_t         cPages    = pCur->cb >> PAGE_SHIFT;
                 uint32_t         iPage     = GCPhysCur <= pCur->GCPhys ? 0 : (GCPhysCur - pCur->GCPhys) >> PAGE_SHIFT;
                 GCPhysCur = 0;
@@ -1381,170 +2063,269 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
                         break; /* restart */
                     }
 
-                    /* Skip already ignored pages. */
-                    if (paLSPages[iPage].fIgnore)
-                        continue;
-
-                    if (RT_LIKELY(PGM_PAGE_GET_TYPE(&pCur->aPages[iPage]) == PGMPAGETYPE_RAM))
-                    {
-                        /*
-                         * A RAM page.
-                         */
-                        switch (PGM_PAGE_GET_STATE(&pCur->aPages[iPage]))
-                        {
-                            case PGM_PAGE_STATE_ALLOCATED:
-                                /** @todo Optimize this: Don't always re-enable write
-                                 * monitoring if the page is known to be very busy. */
-                                if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
-                                {
-                                    AssertMsg(paLSPages[iPage].fWriteMonitored,
-                                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
-                                    PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
-                                    Assert(pVM->pgm.s.cWrittenToPages > 0);
-                                    pVM->pgm.s.cWrittenToPages--;
-                                }
-                                else
-                                {
-                                    AssertMsg(!paLSPages[iPage].fWriteMonitored,
-                                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
-                                    pVM->pgm.s.LiveSave.Ram.cMonitoredPages++;
-                                }
+                    pgmR3ScanRamPage(pVM, pCur, iPage, &Stats, NULL, 0);
+                } /* for each page in range */
 
-                                if (!paLSPages[iPage].fDirty)
-                                {
-                                    pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                    if (paLSPages[iPage].fZero)
-                                        pVM->pgm.s.LiveSave.Ram.cZeroPages--;
-                                    pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                    if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
-                                        paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
-                                }
+                if (GCPhysCur != 0)
+                    break; /* Yield + ramrange change */
+                GCPhysCur = pCur->GCPhysLast;
+            }
+        } /* for each range */
+    } while (pCur);
+    pgmR3ScanRamMergeStats(pVM, &Stats);
+    pgmUnlock(pVM);
+}
 
-                                pgmPhysPageWriteMonitor(pVM, &pCur->aPages[iPage],
-                                                        pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT));
-                                paLSPages[iPage].fWriteMonitored        = 1;
-                                paLSPages[iPage].fWriteMonitoredJustNow = 1;
-                                paLSPages[iPage].fDirty                 = 1;
-                                paLSPages[iPage].fZero                  = 0;
-                                paLSPages[iPage].fShared                = 0;
-#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
-#endif
-                                break;
 
-                            case PGM_PAGE_STATE_WRITE_MONITORED:
-                                Assert(paLSPages[iPage].fWriteMonitored);
-                                if (PGM_PAGE_GET_WRITE_LOCKS(&pCur->aPages[iPage]) == 0)
-                                {
-#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    if (paLSPages[iPage].fWriteMonitoredJustNow)
-                                        pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
-                                    else
-                                        pgmR3StateVerifyCrc32ForRamPage(pVM, pCur, paLSPages, iPage, "scan");
-#endif
-                                    paLSPages[iPage].fWriteMonitoredJustNow = 0;
-                                }
-                                else
-                                {
-                                    paLSPages[iPage].fWriteMonitoredJustNow = 1;
-#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
-#endif
-                                    if (!paLSPages[iPage].fDirty)
-                                    {
-                                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                        if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
-                                            paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
-                                    }
-                                }
-                                break;
+/**
+ * Resets the RAM page elision statistics at the start of a save.
+ *
+ * @param   pVM                 The cross context VM structure.
+ */
+static void pgmR3SaveDedupResetStats(PVM pVM)
+{
+    pVM->pgm.s.LiveSave.cDedupRawPages  = 0;
+    pVM->pgm.s.LiveSave.cDedupZeroPages = 0;
+    pVM->pgm.s.LiveSave.cDedupDupPages  = 0;
+    pVM->pgm.s.LiveSave.uDedupPct       = 0;
+}
 
-                            case PGM_PAGE_STATE_ZERO:
-                            case PGM_PAGE_STATE_BALLOONED:
-                                if (!paLSPages[iPage].fZero)
-                                {
-                                    if (!paLSPages[iPage].fDirty)
-                                    {
-                                        paLSPages[iPage].fDirty = 1;
-                                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                    }
-                                    paLSPages[iPage].fZero = 1;
-                                    paLSPages[iPage].fShared = 0;
-#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    paLSPages[iPage].u32Crc = PGM_STATE_CRC32_ZERO_PAGE;
-#endif
-                                }
-                                break;
 
-                            case PGM_PAGE_STATE_SHARED:
-                                if (!paLSPages[iPage].fShared)
-                                {
-                                    if (!paLSPages[iPage].fDirty)
-                                    {
-                                        paLSPages[iPage].fDirty = 1;
-                                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                        if (paLSPages[iPage].fZero)
-                                            pVM->pgm.s.LiveSave.Ram.cZeroPages--;
-                                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                    }
-                                    paLSPages[iPage].fZero = 0;
-                                    paLSPages[iPage].fShared = 1;
-#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
-#endif
-                                }
-                                break;
-                        }
-                    }
-                    else
-                    {
-                        /*
-                         * All other types => Ignore the page.
-                         */
-                        Assert(!paLSPages[iPage].fIgnore); /* skipped before switch */
-                        paLSPages[iPage].fIgnore = 1;
-                        if (paLSPages[iPage].fWriteMonitored)
-                        {
-                            /** @todo this doesn't hold water when we start monitoring MMIO2 and ROM shadow
-                             *        pages! */
-                            if (RT_UNLIKELY(PGM_PAGE_GET_STATE(&pCur->aPages[iPage]) == PGM_PAGE_STATE_WRITE_MONITORED))
-                            {
-                                AssertMsgFailed(("%R[pgmpage]", &pCur->aPages[iPage])); /* shouldn't happen. */
-                                PGM_PAGE_SET_STATE(pVM, &pCur->aPages[iPage], PGM_PAGE_STATE_ALLOCATED);
-                                Assert(pVM->pgm.s.cMonitoredPages > 0);
-                                pVM->pgm.s.cMonitoredPages--;
-                            }
-                            if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
-                            {
-                                PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
-                                Assert(pVM->pgm.s.cWrittenToPages > 0);
-                                pVM->pgm.s.cWrittenToPages--;
-                            }
-                            pVM->pgm.s.LiveSave.Ram.cMonitoredPages--;
-                        }
+/**
+ * Empties the content hash dictionary.
+ *
+ * @param   pDedup              The content hash dictionary.
+ * @param   idRamRangesGen      The RAM range generation the new entries will
+ *                              be valid for.
+ */
+static void pgmR3SaveDedupReset(PPGMLSDEDUP pDedup, uint32_t idRamRangesGen)
+{
+    pDedup->idRamRangesGen = idRamRangesGen;
+    pDedup->cUsed          = 0;
+    pDedup->iFree          = PGM_DEDUP_NIL;
+    memset(pDedup->aiHashHeads, 0xff, sizeof(pDedup->aiHashHeads));
+    memset(pDedup->aiAddrHeads, 0xff, sizeof(pDedup->aiAddrHeads));
+}
 
-                        /** @todo the counting doesn't quite work out here. fix later? */
-                        if (paLSPages[iPage].fDirty)
-                            pVM->pgm.s.LiveSave.Ram.cDirtyPages--;
-                        else
-                        {
-                            pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                            if (paLSPages[iPage].fZero)
-                                pVM->pgm.s.LiveSave.Ram.cZeroPages--;
-                        }
-                        pVM->pgm.s.LiveSave.cIgnoredPages++;
-                    }
-                } /* for each page in range */
 
-                if (GCPhysCur != 0)
-                    break; /* Yield + ramrange change */
-                GCPhysCur = pCur->GCPhysLast;
+/** Calculates the content hash bucket index. */
+DECLINLINE(uint32_t) pgmR3SaveDedupHashBucket(uint8_t const *pabHash)
+{
+    uint32_t u32;
+    memcpy(&u32, pabHash, sizeof(u32));
+    return u32 & (PGM_DEDUP_BUCKETS - 1);
+}
+
+
+/** Calculates the address bucket index. */
+DECLINLINE(uint32_t) pgmR3SaveDedupAddrBucket(RTGCPHYS GCPhys)
+{
+    return (uint32_t)(GCPhys >> PAGE_SHIFT) & (PGM_DEDUP_BUCKETS - 1);
+}
+
+
+/**
+ * Looks up a page with the given content hash.
+ *
+ * @returns The address of the page last sent with this content, NIL_RTGCPHYS
+ *          if not found.
+ * @param   pDedup              The content hash dictionary.
+ * @param   pabHash             The SHA-256 of the page content.
+ */
+static RTGCPHYS pgmR3SaveDedupLookup(PPGMLSDEDUP pDedup, uint8_t const *pabHash)
+{
+    uint32_t i = pDedup->aiHashHeads[pgmR3SaveDedupHashBucket(pabHash)];
+    while (i != PGM_DEDUP_NIL)
+    {
+        PPGMLSDEDUPENTRY pEntry = &pDedup->aEntries[i];
+        if (!memcmp(pEntry->abHash, pabHash, RTSHA256_HASH_SIZE))
+            return pEntry->GCPhys;
+        i = pEntry->iNextHash;
+    }
+    return NIL_RTGCPHYS;
+}
+
+
+/**
+ * Drops the entry for a page that is being sent again.
+ *
+ * @param   pDedup              The content hash dictionary.
+ * @param   GCPhys              The page address.
+ */
+static void pgmR3SaveDedupRemove(PPGMLSDEDUP pDedup, RTGCPHYS GCPhys)
+{
+    /* Unlink it from the address chain. */
+    uint32_t *pi = &pDedup->aiAddrHeads[pgmR3SaveDedupAddrBucket(GCPhys)];
+    while (*pi != PGM_DEDUP_NIL && pDedup->aEntries[*pi].GCPhys != GCPhys)
+        pi = &pDedup->aEntries[*pi].iNextAddr;
+    uint32_t const   iEntry = *pi;
+    if (iEntry == PGM_DEDUP_NIL)
+        return;
+    PPGMLSDEDUPENTRY pEntry = &pDedup->aEntries[iEntry];
+    *pi = pEntry->iNextAddr;
+
+    /* Unlink it from the content hash chain. */
+    pi = &pDedup->aiHashHeads[pgmR3SaveDedupHashBucket(pEntry->abHash)];
+    while (*pi != iEntry)
+    {
+        Assert(*pi != PGM_DEDUP_NIL);
+        pi = &pDedup->aEntries[*pi].iNextHash;
+    }
+    *pi = pEntry->iNextHash;
+
+    /* Free it. */
+    pEntry->GCPhys    = NIL_RTGCPHYS;
+    pEntry->iNextAddr = pDedup->iFree;
+    pDedup->iFree     = iEntry;
+}
+
+
+/**
+ * Records the content of a page that was just sent raw.
+ *
+ * The caller must have removed any previous entry for the page.  Nothing is
+ * recorded when the dictionary is full.
+ *
+ * @param   pDedup              The content hash dictionary.
+ * @param   GCPhys              The page address.
+ * @param   pabHash             The SHA-256 of the page content.
+ */
+static void pgmR3SaveDedupInsert(PPGMLSDEDUP pDedup, RTGCPHYS GCPhys, uint8_t const *pabHash)
+{
+    uint32_t iEntry = pDedup->iFree;
+    if (iEntry != PGM_DEDUP_NIL)
+        pDedup->iFree = pDedup->aEntries[iEntry].iNextAddr;
+    else if (pDedup->cUsed < RT_ELEMENTS(pDedup->aEntries))
+        iEntry = pDedup->cUsed++;
+    else
+        return;
+
+    PPGMLSDEDUPENTRY pEntry = &pDedup->aEntries[iEntry];
+    memcpy(pEntry->abHash, pabHash, RTSHA256_HASH_SIZE);
+    pEntry->GCPhys = GCPhys;
+
+    uint32_t *pi = &pDedup->aiHashHeads[pgmR3SaveDedupHashBucket(pabHash)];
+    pEntry->iNextHash = *pi;
+    *pi = iEntry;
+
+    pi = &pDedup->aiAddrHeads[pgmR3SaveDedupAddrBucket(GCPhys)];
+    pEntry->iNextAddr = *pi;
+    *pi = iEntry;
+}
+
+
+/**
+ * Frees the arrays of a RAM page index.
+ *
+ * @param   pIdx                The RAM page index.
+ */
+static void pgmR3RamIdxDelete(PPGMRAMIDX pIdx)
+{
+    RTMemFree(pIdx->paRanges);
+    RTMemFree(pIdx->pau64Entries);
+    pIdx->paRanges     = NULL;
+    pIdx->pau64Entries = NULL;
+    pIdx->cRanges      = 0;
+    pIdx->cEntries     = 0;
+}
+
+
+/**
+ * Initializes a RAM page index covering the current RAM ranges, with all
+ * entries set to PGM_RAM_IDX_NONE.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pIdx                The RAM page index, zero initialized.
+ */
+static int pgmR3RamIdxInit(PVM pVM, PPGMRAMIDX pIdx)
+{
+    pgmLock(pVM);
+    for (;;)
+    {
+        uint32_t const idRamRangesGen = pVM->pgm.s.idRamRangesGen;
+        uint32_t       cRanges        = 0;
+        uint64_t       cEntries       = 0;
+        for (PPGMRAMRANGE pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+            if (!PGM_RAM_RANGE_IS_AD_HOC(pCur))
+            {
+                cRanges++;
+                cEntries += pCur->cb >> PAGE_SHIFT;
             }
-        } /* for each range */
-    } while (pCur);
+        AssertLogRelMsgReturnStmt(cEntries < UINT32_MAX, ("%#RX64\n", cEntries), pgmUnlock(pVM), VERR_OUT_OF_RANGE);
+
+        /* (Re)allocate the arrays outside the lock and check the ranges again. */
+        if (   cRanges  != pIdx->cRanges
+            || cEntries != pIdx->cEntries)
+        {
+            pgmUnlock(pVM);
+            pgmR3RamIdxDelete(pIdx);
+            pIdx->paRanges     = (PPGMRAMIDXRANGE)RTMemAllocZ(sizeof(pIdx->paRanges[0]) * RT_MAX(cRanges, 1));
+            pIdx->pau64Entries = (uint64_t *)RTMemAllocZ(sizeof(pIdx->pau64Entries[0]) * RT_MAX(cEntries, 1));
+            if (!pIdx->paRanges || !pIdx->pau64Entries)
+            {
+                pgmR3RamIdxDelete(pIdx);
+                return VERR_NO_MEMORY;
+            }
+            pIdx->cRanges  = cRanges;
+            pIdx->cEntries = (uint32_t)cEntries;
+            pgmLock(pVM);
+            continue;
+        }
+        Assert(idRamRangesGen == pVM->pgm.s.idRamRangesGen); NOREF(idRamRangesGen);
+
+        uint32_t iRange = 0;
+        uint32_t iEntry = 0;
+        for (PPGMRAMRANGE pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+            if (!PGM_RAM_RANGE_IS_AD_HOC(pCur))
+            {
+                pIdx->paRanges[iRange].GCPhys      = pCur->GCPhys;
+                pIdx->paRanges[iRange].cPages      = (uint32_t)(pCur->cb >> PAGE_SHIFT);
+                pIdx->paRanges[iRange].iFirstEntry = iEntry;
+                iEntry += pIdx->paRanges[iRange].cPages;
+                iRange++;
+            }
+        break;
+    }
     pgmUnlock(pVM);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Looks up the entries of a RAM range in a RAM page index.
+ *
+ * @returns Pointer to the first page entry of the range, NULL if not found.
+ * @param   pIdx                The RAM page index.
+ * @param   GCPhys              The start of the RAM range.
+ * @param   cPages              The number of pages in the RAM range.
+ */
+static uint64_t *pgmR3RamIdxLookup(PPGMRAMIDX pIdx, RTGCPHYS GCPhys, uint32_t cPages)
+{
+    for (uint32_t iRange = 0; iRange < pIdx->cRanges; iRange++)
+        if (   pIdx->paRanges[iRange].GCPhys == GCPhys
+            && pIdx->paRanges[iRange].cPages == cPages)
+            return &pIdx->pau64Entries[pIdx->paRanges[iRange].iFirstEntry];
+    return NULL;
+}
+
+
+/**
+ * Looks up the entry of a page in a RAM page index.
+ *
+ * @returns Pointer to the page entry, NULL if not found.
+ * @param   pIdx                The RAM page index.
+ * @param   GCPhys              The page address.
+ */
+static uint64_t *pgmR3RamIdxLookupPage(PPGMRAMIDX pIdx, RTGCPHYS GCPhys)
+{
+    for (uint32_t iRange = 0; iRange < pIdx->cRanges; iRange++)
+    {
+        RTGCPHYS const off = GCPhys - pIdx->paRanges[iRange].GCPhys;
+        if (off < ((RTGCPHYS)pIdx->paRanges[iRange].cPages << PAGE_SHIFT))
+            return &pIdx->pau64Entries[pIdx->paRanges[iRange].iFirstEntry + (uint32_t)(off >> PAGE_SHIFT)];
+    }
+    return NULL;
 }
 
 
@@ -1556,11 +2337,30 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
  * @param   pSSM                The SSM handle.
  * @param   fLiveSave           Whether it's a live save or not.
  * @param   uPass               The pass number.
+ * @param   pIdx                The RAM page index to record where the pages
+ *                              end up in, NULL if not wanted.  This disables
+ *                              the deduplication as every raw page needs a
+ *                              record of its own.
  */
-static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t uPass)
+static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t uPass, PPGMRAMIDX pIdx)
 {
     NOREF(fLiveSave);
 
+    /*
+     * The content hash dictionary lives until pgmR3SaveDone so that pages
+     * sent in earlier passes can be referenced as well.
+     */
+    PPGMLSDEDUP pDedup = !pIdx ? pVM->pgm.s.LiveSave.pDedupR3 : NULL;
+    if (!pDedup && !pIdx && pVM->pgm.s.LiveSave.fDedup)
+    {
+        pDedup = (PPGMLSDEDUP)RTMemAlloc(sizeof(*pDedup));
+        if (pDedup)
+            pgmR3SaveDedupReset(pDedup, pVM->pgm.s.idRamRangesGen);
+        else
+            LogRel(("PGM: Failed to allocate the %zu byte content hash dictionary, not eliding duplicate pages\n", sizeof(*pDedup)));
+        pVM->pgm.s.LiveSave.pDedupR3 = pDedup;
+    }
+
     /*
      * The RAM.
      */
@@ -1572,6 +2372,12 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
     do
     {
         uint32_t const  idRamRangesGen = pVM->pgm.s.idRamRangesGen;
+
+        /* The loader resolves references using the final RAM layout, so
+           forget everything if the ranges have been changed. */
+        if (pDedup && pDedup->idRamRangesGen != idRamRangesGen)
+            pgmR3SaveDedupReset(pDedup, idRamRangesGen);
+
         for (pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
         {
             if (   pCur->GCPhysLast > GCPhysCur
@@ -1580,6 +2386,13 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                 PPGMLIVESAVERAMPAGE paLSPages = pCur->paLSPages;
                 uint32_t         cPages    = pCur->cb >> PAGE_SHIFT;
                 uint32_t         iPage     = GCPhysCur <= pCur->GCPhys ? 0 : (GCPhysCur - pCur->GCPhys) >> PAGE_SHIFT;
+                uint64_t        *pau64Idx  = NULL;
+                if (pIdx)
+                {
+                    pau64Idx = pgmR3RamIdxLookup(pIdx, pCur->GCPhys, cPages);
+                    AssertLogRelMsgReturnStmt(pau64Idx, ("%RGp LB %RGp\n", pCur->GCPhys, pCur->cb),
+                                              pgmUnlock(pVM), VERR_INTERNAL_ERROR_3);
+                }
                 GCPhysCur = 0;
                 for (; iPage < cPages; iPage++)
                 {
@@ -1667,16 +2480,47 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                         AssertLogRelMsgRCReturn(rc, ("rc=%Rrc GCPhys=%RGp\n", rc, GCPhys), rc);
 
                         /* Try save some memory when restoring. */
-                        if (!ASMMemIsZeroPage(pvPage))
+                        if (!ASMMemIsZeroPage(abPage))
                         {
-                            if (GCPhys == GCPhysLast + PAGE_SIZE)
-                                SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_RAW);
+                            /* Send pages we've already sent the content of as a reference. */
+                            RTGCPHYS GCPhysDup = NIL_RTGCPHYS;
+                            uint8_t  abHash[RTSHA256_HASH_SIZE];
+                            if (pDedup)
+                            {
+                                RTSha256(abPage, PAGE_SIZE, abHash);
+                                GCPhysDup = pgmR3SaveDedupLookup(pDedup, abHash);
+                                if (GCPhysDup != GCPhys)
+                                    pgmR3SaveDedupRemove(pDedup, GCPhys);
+                            }
+                            if (GCPhysDup != NIL_RTGCPHYS)
+                            {
+                                if (GCPhys == GCPhysLast + PAGE_SIZE)
+                                    SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_DUP);
+                                else
+                                {
+                                    SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_DUP | PGM_STATE_REC_FLAG_ADDR);
+                                    SSMR3PutGCPhys(pSSM, GCPhys);
+                                }
+                                rc = SSMR3PutGCPhys(pSSM, GCPhysDup);
+                                pVM->pgm.s.LiveSave.cDedupDupPages++;
+                            }
                             else
                             {
-                                SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_RAW | PGM_STATE_REC_FLAG_ADDR);
-                                SSMR3PutGCPhys(pSSM, GCPhys);
+                                if (GCPhys == GCPhysLast + PAGE_SIZE)
+                                    SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_RAW);
+                                else
+                                {
+                                    SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_RAW | PGM_STATE_REC_FLAG_ADDR);
+                                    SSMR3PutGCPhys(pSSM, GCPhys);
+                                }
+                                if (pau64Idx)
+                                    rc = SSMR3PutPageIndexed(pSSM, abPage, &pau64Idx[iPage]);
+                                else
+                                    rc = SSMR3PutMem(pSSM, abPage, PAGE_SIZE);
+                                if (pDedup)
+                                    pgmR3SaveDedupInsert(pDedup, GCPhys, abHash);
+                                pVM->pgm.s.LiveSave.cDedupRawPages++;
                             }
-                            rc = SSMR3PutMem(pSSM, abPage, PAGE_SIZE);
                         }
                         else
                         {
@@ -1687,6 +2531,11 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                                 SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_ZERO | PGM_STATE_REC_FLAG_ADDR);
                                 rc = SSMR3PutGCPhys(pSSM, GCPhys);
                             }
+                            if (pDedup)
+                                pgmR3SaveDedupRemove(pDedup, GCPhys);
+                            if (pau64Idx)
+                                pau64Idx[iPage] = PGM_RAM_IDX_ZERO;
+                            pVM->pgm.s.LiveSave.cDedupZeroPages++;
                         }
                     }
                     else
@@ -1708,6 +2557,12 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                             SSMR3PutU8(pSSM, u8RecType | PGM_STATE_REC_FLAG_ADDR);
                             rc = SSMR3PutGCPhys(pSSM, GCPhys);
                         }
+                        if (pDedup)
+                            pgmR3SaveDedupRemove(pDedup, GCPhys);
+                        if (pau64Idx)
+                            pau64Idx[iPage] = fBallooned ? PGM_RAM_IDX_BALLOONED : PGM_RAM_IDX_ZERO;
+                        if (fZero)
+                            pVM->pgm.s.LiveSave.cDedupZeroPages++;
                     }
                     if (RT_FAILURE(rc))
                         return rc;
@@ -1739,6 +2594,10 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
         } /* for each range */
     } while (pCur);
 
+    uint64_t const cElided = pVM->pgm.s.LiveSave.cDedupZeroPages + pVM->pgm.s.LiveSave.cDedupDupPages;
+    uint64_t const cTotal  = cElided + pVM->pgm.s.LiveSave.cDedupRawPages;
+    pVM->pgm.s.LiveSave.uDedupPct = cTotal ? (uint32_t)(cElided * 100 / cTotal) : 0;
+
     pgmUnlock(pVM);
 
     return VINF_SUCCESS;
@@ -1809,6 +2668,12 @@ static void pgmR3DoneRamPages(PVM pVM)
 
     MMR3HeapFree(pvToFree);
     pvToFree = NULL;
+
+    if (pVM->pgm.s.LiveSave.hScanPoolR3)
+    {
+        RTReqPoolRelease(pVM->pgm.s.LiveSave.hScanPoolR3);
+        pVM->pgm.s.LiveSave.hScanPoolR3 = NULL;
+    }
 }
 
 
@@ -1849,7 +2714,8 @@ static DECLCALLBACK(int) pgmR3LiveExec(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass)
      */
     pgmR3ScanRomPages(pVM);
     pgmR3ScanMmio2Pages(pVM, uPass);
-    pgmR3ScanRamPages(pVM, false /*fFinalPass*/);
+    if (!pVM->pgm.s.LiveSave.fRamIndex)
+        pgmR3ScanRamPages(pVM, false /*fFinalPass*/);
     pgmR3PoolClearAll(pVM, true /*fFlushRemTlb*/); /** @todo this could perhaps be optimized a bit. */
 
     /*
@@ -1863,8 +2729,8 @@ static DECLCALLBACK(int) pgmR3LiveExec(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass)
         rc = pgmR3SaveShadowedRomPages(pVM, pSSM, true /*fLiveSave*/, false /*fFinalPass*/);
     if (RT_SUCCESS(rc))
         rc = pgmR3SaveMmio2Pages(      pVM, pSSM, true /*fLiveSave*/, uPass);
-    if (RT_SUCCESS(rc))
-        rc = pgmR3SaveRamPages(        pVM, pSSM, true /*fLiveSave*/, uPass);
+    if (RT_SUCCESS(rc) && !pVM->pgm.s.LiveSave.fRamIndex)
+        rc = pgmR3SaveRamPages(        pVM, pSSM, true /*fLiveSave*/, uPass, NULL /*pIdx*/);
     SSMR3PutU8(pSSM, PGM_STATE_REC_END);    /* (Ignore the rc, SSM takes care of it.) */
 
     return rc;
@@ -1983,6 +2849,13 @@ static DECLCALLBACK(int)  pgmR3LiveVote(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass
  */
 static DECLCALLBACK(int) pgmR3LivePrep(PVM pVM, PSSMHANDLE pSSM)
 {
+    /*
+     * Pages a lazy restore hasn't gotten to yet must be in place first.
+     */
+    int rc = pgmR3LazyRestoreComplete(pVM);
+    if (RT_FAILURE(rc))
+        return rc;
+
     /*
      * Indicate that we will be using the write monitoring.
      */
@@ -2013,14 +2886,15 @@ static DECLCALLBACK(int) pgmR3LivePrep(PVM pVM, PSSMHANDLE pSSM)
     pVM->pgm.s.LiveSave.cSavedPages       = 0;
     pVM->pgm.s.LiveSave.uSaveStartNS      = RTTimeNanoTS();
     pVM->pgm.s.LiveSave.cPagesPerSecond   = 8192;
+    pgmR3SaveDedupResetStats(pVM);
 
     /*
      * Per page type.
      */
-    int rc = pgmR3PrepRomPages(pVM);
+    rc = pgmR3PrepRomPages(pVM);
     if (RT_SUCCESS(rc))
         rc = pgmR3PrepMmio2Pages(pVM);
-    if (RT_SUCCESS(rc))
+    if (RT_SUCCESS(rc) && !pVM->pgm.s.LiveSave.fRamIndex) /* RAM goes into "pgmram" in the final pass. */
         rc = pgmR3PrepRamPages(pVM);
 
     NOREF(pSSM);
@@ -2062,16 +2936,18 @@ static DECLCALLBACK(int) pgmR3SaveExec(PVM pVM, PSSMHANDLE pSSM)
         {
             pgmR3ScanRomPages(pVM);
             pgmR3ScanMmio2Pages(pVM, SSM_PASS_FINAL);
-            pgmR3ScanRamPages(pVM, true /*fFinalPass*/);
+            if (!pVM->pgm.s.LiveSave.fRamIndex)
+                pgmR3ScanRamPages(pVM, true /*fFinalPass*/);
 
             rc = pgmR3SaveShadowedRomPages(    pVM, pSSM, true /*fLiveSave*/, true /*fFinalPass*/);
             if (RT_SUCCESS(rc))
                 rc = pgmR3SaveMmio2Pages(      pVM, pSSM, true /*fLiveSave*/, SSM_PASS_FINAL);
-            if (RT_SUCCESS(rc))
-                rc = pgmR3SaveRamPages(        pVM, pSSM, true /*fLiveSave*/, SSM_PASS_FINAL);
+            if (RT_SUCCESS(rc) && !pVM->pgm.s.LiveSave.fRamIndex)
+                rc = pgmR3SaveRamPages(        pVM, pSSM, true /*fLiveSave*/, SSM_PASS_FINAL, NULL /*pIdx*/);
         }
         else
         {
+            pgmR3SaveDedupResetStats(pVM);
             rc = pgmR3SaveRamConfig(pVM, pSSM);
             if (RT_SUCCESS(rc))
                 rc = pgmR3SaveRomRanges(pVM, pSSM);
@@ -2083,8 +2959,8 @@ static DECLCALLBACK(int) pgmR3SaveExec(PVM pVM, PSSMHANDLE pSSM)
                 rc = pgmR3SaveShadowedRomPages(pVM, pSSM, false /*fLiveSave*/, true /*fFinalPass*/);
             if (RT_SUCCESS(rc))
                 rc = pgmR3SaveMmio2Pages(      pVM, pSSM, false /*fLiveSave*/, SSM_PASS_FINAL);
-            if (RT_SUCCESS(rc))
-                rc = pgmR3SaveRamPages(        pVM, pSSM, false /*fLiveSave*/, SSM_PASS_FINAL);
+            if (RT_SUCCESS(rc) && !pVM->pgm.s.LiveSave.fRamIndex) /* RAM goes into "pgmram", see pgmR3SaveRam. */
+                rc = pgmR3SaveRamPages(        pVM, pSSM, false /*fLiveSave*/, SSM_PASS_FINAL, NULL /*pIdx*/);
         }
         SSMR3PutU8(pSSM, PGM_STATE_REC_END);    /* (Ignore the rc, SSM takes of it.) */
     }
@@ -2109,6 +2985,17 @@ static DECLCALLBACK(int) pgmR3SaveDone(PVM pVM, PSSMHANDLE pSSM)
         pgmR3DoneRamPages(pVM);
     }
 
+    /*
+     * Report how many RAM pages we managed to elide and free the dictionary.
+     */
+    uint64_t const cElided = pVM->pgm.s.LiveSave.cDedupZeroPages + pVM->pgm.s.LiveSave.cDedupDupPages;
+    if (cElided + pVM->pgm.s.LiveSave.cDedupRawPages)
+        LogRel(("PGM: Saved %RU64 RAM pages raw, elided %RU64 zero and %RU64 duplicate pages (%u%%)\n",
+                pVM->pgm.s.LiveSave.cDedupRawPages, pVM->pgm.s.LiveSave.cDedupZeroPages,
+                pVM->pgm.s.LiveSave.cDedupDupPages, pVM->pgm.s.LiveSave.uDedupPct));
+    RTMemFree(pVM->pgm.s.LiveSave.pDedupR3);
+    pVM->pgm.s.LiveSave.pDedupR3 = NULL;
+
     /*
      * Clear the live save indicator and disengage write monitoring.
      */
@@ -2124,6 +3011,70 @@ static DECLCALLBACK(int) pgmR3SaveDone(PVM pVM, PSSMHANDLE pSSM)
 }
 
 
+/**
+ * @callback_method_impl{FNSSMINTSAVEEXEC, "pgmram"}
+ *
+ * Only registered with PGM::LiveSave::fRamIndex set, the "pgm" unit leaves out
+ * RAM in that case.  All of it is saved here in the final pass with each raw
+ * page in a record of its own, noting the record offsets in the index.
+ */
+static DECLCALLBACK(int) pgmR3SaveRam(PVM pVM, PSSMHANDLE pSSM)
+{
+    PPGMRAMIDX pIdx = (PPGMRAMIDX)RTMemAllocZ(sizeof(*pIdx));
+    AssertReturn(pIdx, VERR_NO_MEMORY);
+    pVM->pgm.s.LiveSave.pRamIdxR3 = pIdx;
+
+    int rc = pgmR3RamIdxInit(pVM, pIdx);
+    if (RT_SUCCESS(rc))
+        rc = pgmR3SaveRamPages(pVM, pSSM, false /*fLiveSave*/, SSM_PASS_FINAL, pIdx);
+    SSMR3PutU8(pSSM, PGM_STATE_REC_END);    /* (Ignore the rc, SSM takes care of it.) */
+    return rc;
+}
+
+
+/**
+ * @callback_method_impl{FNSSMINTSAVEDONE, "pgmram"}
+ */
+static DECLCALLBACK(int) pgmR3SaveRamDone(PVM pVM, PSSMHANDLE pSSM)
+{
+    PPGMRAMIDX pIdx = pVM->pgm.s.LiveSave.pRamIdxR3;
+    if (pIdx)
+    {
+        pVM->pgm.s.LiveSave.pRamIdxR3 = NULL;
+        pgmR3RamIdxDelete(pIdx);
+        RTMemFree(pIdx);
+    }
+    NOREF(pSSM);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNSSMINTSAVEEXEC, "pgmidx"}
+ *
+ * Saves the index built by pgmR3SaveRam.  SSM has flushed the "pgmram" unit
+ * to the stream at this point, so all the record offsets are known.
+ */
+static DECLCALLBACK(int) pgmR3SaveRamIdx(PVM pVM, PSSMHANDLE pSSM)
+{
+    PPGMRAMIDX pIdx = pVM->pgm.s.LiveSave.pRamIdxR3;
+    AssertReturn(pIdx, VERR_INTERNAL_ERROR_3);
+
+    SSMR3PutU32(pSSM, pIdx->cRanges);
+    int rc = SSMR3PutU32(pSSM, pIdx->cEntries);
+    for (uint32_t iRange = 0; iRange < pIdx->cRanges && RT_SUCCESS(rc); iRange++)
+    {
+        PPGMRAMIDXRANGE pRange = &pIdx->paRanges[iRange];
+        SSMR3PutGCPhys(pSSM, pRange->GCPhys);
+        SSMR3PutU32(pSSM, pRange->cPages);
+        rc = SSMR3PutMem(pSSM, &pIdx->pau64Entries[pRange->iFirstEntry], sizeof(uint64_t) * pRange->cPages);
+    }
+    if (RT_SUCCESS(rc))
+        rc = SSMR3PutU32(pSSM, UINT32_MAX); /* terminator */
+    return rc;
+}
+
+
 /**
  * @callback_method_impl{FNSSMINTLOADPREP}
  */
@@ -2649,6 +3600,7 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
             case PGM_STATE_REC_RAM_ZERO:
             case PGM_STATE_REC_RAM_RAW:
             case PGM_STATE_REC_RAM_BALLOONED:
+            case PGM_STATE_REC_RAM_DUP:
             {
                 /*
                  * Get the address and resolve it into a page descriptor.
@@ -2757,6 +3709,34 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
                         break;
                     }
 
+                    case PGM_STATE_REC_RAM_DUP:
+                    {
+                        /* Copy what we've already loaded for the source page (it may be the page itself). */
+                        RTGCPHYS GCPhysSrc;
+                        rc = SSMR3GetGCPhys(pSSM, &GCPhysSrc);
+                        if (RT_FAILURE(rc))
+                            return rc;
+                        AssertLogRelMsgReturn(!(GCPhysSrc & PAGE_OFFSET_MASK), ("%RGp\n", GCPhysSrc), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+                        PPGMPAGE pSrcPage = pgmPhysGetPage(pVM, GCPhysSrc);
+                        AssertLogRelMsgReturn(pSrcPage && PGM_PAGE_GET_TYPE(pSrcPage) == PGMPAGETYPE_RAM,
+                                              ("GCPhysSrc=%RGp\n", GCPhysSrc), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+
+                        uint8_t         abPage[PAGE_SIZE];
+                        PGMPAGEMAPLOCK  PgMpLck;
+                        void const     *pvSrcPage;
+                        rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pSrcPage, GCPhysSrc, &pvSrcPage, &PgMpLck);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhysSrc=%RGp %R[pgmpage] rc=%Rrc\n", GCPhysSrc, pSrcPage, rc), rc);
+                        memcpy(abPage, pvSrcPage, PAGE_SIZE);
+                        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+
+                        void           *pvDstPage;
+                        rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+                        memcpy(pvDstPage, abPage, PAGE_SIZE);
+                        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                        break;
+                    }
+
                     default:
                         AssertMsgFailedReturn(("%#x\n", u8), VERR_PGM_SAVED_REC_TYPE);
                 }
@@ -3294,17 +4274,935 @@ static DECLCALLBACK(int) pgmR3LoadDone(PVM pVM, PSSMHANDLE pSSM)
 
 
 /**
- * Registers the saved state callbacks with SSM.
+ * Reads a page from the saved state of a lazy restore.
  *
  * @returns VBox status code.
- * @param   pVM     The cross context VM structure.
- * @param   cbRam   The RAM size.
+ * @retval  VERR_NOT_AVAILABLE if the saved state has been closed.
+ * @param   pLazy               The lazy restore state.
+ * @param   offRec              The record offset from the index.
+ * @param   pvPage              Where to return the page content.
  */
-int pgmR3InitSavedState(PVM pVM, uint64_t cbRam)
+static int pgmR3LazyRestoreReadPage(PPGMLAZYRESTORE pLazy, uint64_t offRec, void *pvPage)
+{
+    RTCritSectEnter(&pLazy->CritSect);
+    int rc = pLazy->pSSM ? SSMR3ReadPageAt(pLazy->pSSM, offRec, pvPage) : VERR_NOT_AVAILABLE;
+    RTCritSectLeave(&pLazy->CritSect);
+    AssertLogRelMsg(RT_SUCCESS(rc) || rc == VERR_NOT_AVAILABLE, ("offRec=%#RX64 rc=%Rrc\n", offRec, rc));
+    return rc;
+}
+
+
+/**
+ * Restores a RAM page right away, without going via the access handler.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pLazy               The lazy restore state.
+ * @param   pPage               The page.
+ * @param   GCPhys              The page address.
+ * @param   pu64Entry           The index entry, set to PGM_RAM_IDX_NONE.
+ * @param   pvSrc               The page content if already read, NULL if
+ *                              it has to be read.
+ *
+ * @remarks Caller owns the PGM lock.
+ */
+static int pgmR3LazyRestorePageNow(PVM pVM, PPGMLAZYRESTORE pLazy, PPGMPAGE pPage, RTGCPHYS GCPhys,
+                                   uint64_t *pu64Entry, void const *pvSrc)
 {
-    return SSMR3RegisterInternal(pVM, "pgm", 1, PGM_SAVED_STATE_VERSION, (size_t)cbRam + sizeof(PGM),
-                                 pgmR3LivePrep, pgmR3LiveExec, pgmR3LiveVote,
-                                 NULL,          pgmR3SaveExec, pgmR3SaveDone,
-                                 pgmR3LoadPrep, pgmR3Load,     pgmR3LoadDone);
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    uint64_t const u64Entry = *pu64Entry;
+    *pu64Entry = PGM_RAM_IDX_NONE; /* Must be done before mapping the page, see pgmR3LazyRestoreFetchLocked. */
+    if (u64Entry == PGM_RAM_IDX_NONE)
+        return VINF_SUCCESS;
+
+    /* Zero and ballooned pages. The latter are restored as zero pages and
+       only given back when the guest inflates its balloon again. */
+    uint8_t abPage[PAGE_SIZE];
+    if (u64Entry <= PGM_RAM_IDX_BALLOONED)
+    {
+        if (PGM_PAGE_IS_ZERO(pPage) || PGM_PAGE_IS_BALLOONED(pPage))
+            return VINF_SUCCESS;
+        RT_ZERO(abPage);
+        pvSrc = abPage;
+    }
+    else if (!pvSrc)
+    {
+        int rc = pgmR3LazyRestoreReadPage(pLazy, u64Entry, abPage);
+        if (RT_FAILURE(rc))
+            return rc;
+        pvSrc = abPage;
+    }
+
+    PGMPAGEMAPLOCK PgMpLck;
+    void          *pvDstPage;
+    int rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+    AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+    memcpy(pvDstPage, pvSrc, PAGE_SIZE);
+    pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Finds the start address of the handler covering a page.
+ *
+ * @returns The handler start address, NIL_RTGCPHYS if not found.
+ * @param   pLazy               The lazy restore state.
+ * @param   GCPhys              The page address.
+ */
+static RTGCPHYS pgmR3LazyRestoreFindHandler(PPGMLAZYRESTORE pLazy, RTGCPHYS GCPhys)
+{
+    /* Binary search for the last handler starting at or below GCPhys. */
+    uint32_t iStart = 0;
+    uint32_t iEnd   = pLazy->cHandlers;
+    while (iStart < iEnd)
+    {
+        uint32_t const i = iStart + (iEnd - iStart) / 2;
+        if (pLazy->paGCPhysHandlers[i] <= GCPhys)
+            iStart = i + 1;
+        else
+            iEnd = i;
+    }
+    return iStart > 0 ? pLazy->paGCPhysHandlers[iStart - 1] : NIL_RTGCPHYS;
+}
+
+
+/**
+ * Installs a pending page and turns off the access handler for it.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pLazy               The lazy restore state.
+ * @param   pPage               The page.
+ * @param   GCPhys              The page address.
+ * @param   pu64Entry           The index entry.
+ * @param   pvSrc               The page content, NULL to read it.
+ *
+ * @remarks Caller owns the PGM lock.
+ */
+static int pgmR3LazyRestoreInstall(PVM pVM, PPGMLAZYRESTORE pLazy, PPGMPAGE pPage, RTGCPHYS GCPhys,
+                                   uint64_t *pu64Entry, void const *pvSrc)
+{
+    Assert(pLazy->cPending > 0);
+    int rc = pgmR3LazyRestorePageNow(pVM, pLazy, pPage, GCPhys, pu64Entry, pvSrc);
+    if (RT_SUCCESS(rc))
+    {
+        pLazy->cPending--;
+        rc = PGMHandlerPhysicalPageTempOff(pVM, pgmR3LazyRestoreFindHandler(pLazy, GCPhys), GCPhys);
+        AssertLogRelMsgRC(rc, ("GCPhys=%RGp rc=%Rrc\n", GCPhys, rc));
+    }
+    return rc;
+}
+
+
+/**
+ * Restores a pending page before ring-3 maps it.
+ *
+ * Called by pgmPhysPageLoadIntoTlbWithPage for pages with active access
+ * handlers of all kinds while a lazy restore is in progress, so the page
+ * content is in place before anyone gets a pointer to it.
+ *
+ * The PGM lock is left while reading the page from the saved state, unless
+ * the caller has entered it recursively, so the other EMTs don't stall on the
+ * disk.  The RAM ranges covered by the index stay put while the restore is in
+ * progress, so @a pPage remains valid, but its state may have changed when
+ * this function returns.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pPage               The page.
+ * @param   GCPhys              The page address.
+ *
+ * @remarks Caller owns the PGM lock.  pgmR3LazyRestorePageNow clears the
+ *          index entry before mapping the page, which stops the recursion.
+ */
+int pgmR3LazyRestoreFetchLocked(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    GCPhys &= ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    uint64_t *pu64Entry = pgmR3RamIdxLookupPage(&pLazy->Idx, GCPhys);
+    if (!pu64Entry || *pu64Entry <= PGM_RAM_IDX_BALLOONED)
+        return VINF_SUCCESS;
+
+    int rc;
+    if (PDMCritSectGetRecursion(&pVM->pgm.s.CritSectX) == 1)
+    {
+        uint64_t const offRec = *pu64Entry;
+        uint8_t        abPage[PAGE_SIZE];
+        pgmUnlock(pVM);
+        rc = pgmR3LazyRestoreReadPage(pLazy, offRec, abPage);
+        pgmLock(pVM);
+        if (RT_FAILURE(rc))
+            return rc == VERR_NOT_AVAILABLE ? VINF_SUCCESS : rc;
+
+        /* Install it unless someone beat us to it or the restore ended. */
+        pu64Entry = pgmR3RamIdxLookupPage(&pLazy->Idx, GCPhys);
+        if (!pu64Entry || *pu64Entry != offRec)
+            return VINF_SUCCESS;
+        rc = pgmR3LazyRestoreInstall(pVM, pLazy, pPage, GCPhys, pu64Entry, abPage);
+    }
+    else
+        rc = pgmR3LazyRestoreInstall(pVM, pLazy, pPage, GCPhys, pu64Entry, NULL /*pvSrc*/);
+    if (RT_SUCCESS(rc))
+        ASMAtomicIncU32(&pLazy->cFaultedPages);
+    return rc;
+}
+
+
+/**
+ * Restores a pending page without owning the PGM lock.
+ *
+ * The page is read from the saved state without holding the PGM lock, so the
+ * other EMTs don't have to wait for the disk.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pLazy               The lazy restore state.
+ * @param   GCPhys              The page address.
+ * @param   pcFetched           The statistics counter to increment if the page
+ *                              was restored by this call.
+ */
+static int pgmR3LazyRestoreFetch(PVM pVM, PPGMLAZYRESTORE pLazy, RTGCPHYS GCPhys, uint32_t volatile *pcFetched)
+{
+    pgmLock(pVM);
+    uint64_t *pu64Entry = pgmR3RamIdxLookupPage(&pLazy->Idx, GCPhys);
+    uint64_t const offRec = pu64Entry ? *pu64Entry : PGM_RAM_IDX_NONE;
+    pgmUnlock(pVM);
+    if (offRec <= PGM_RAM_IDX_BALLOONED)
+        return VINF_SUCCESS;
+
+    uint8_t abPage[PAGE_SIZE];
+    int rc = pgmR3LazyRestoreReadPage(pLazy, offRec, abPage);
+    if (RT_FAILURE(rc))
+        return rc == VERR_NOT_AVAILABLE ? VINF_SUCCESS : rc;
+
+    /* Install it unless someone beat us to it. */
+    pgmLock(pVM);
+    pu64Entry = pgmR3RamIdxLookupPage(&pLazy->Idx, GCPhys);
+    if (pu64Entry && *pu64Entry == offRec)
+    {
+        PPGMPAGE pPage = pgmPhysGetPage(pVM, GCPhys);
+        AssertLogRelMsgStmt(pPage, ("%RGp\n", GCPhys), rc = VERR_PGM_PHYS_PAGE_GET_IPE);
+        if (pPage)
+            rc = pgmR3LazyRestoreInstall(pVM, pLazy, pPage, GCPhys, pu64Entry, abPage);
+        if (RT_SUCCESS(rc))
+            ASMAtomicIncU32(pcFetched);
+    }
+    pgmUnlock(pVM);
+    return rc;
+}
+
+
+/**
+ * @callback_method_impl{FNPGMPHYSHANDLER, Pages still in the saved state.}
+ *
+ * Restores the page and does the access itself, as the mapping passed in may
+ * have been made before the page was restored.
+ */
+DECLCALLBACK(VBOXSTRICTRC) pgmR3LazyRestoreHandler(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, void *pvPhys, void *pvBuf,
+                                                   size_t cbBuf, PGMACCESSTYPE enmAccessType, PGMACCESSORIGIN enmOrigin,
+                                                   void *pvUser)
+{
+    RT_NOREF3(pVCpu, pvPhys, enmOrigin);
+    PPGMLAZYRESTORE pLazy = (PPGMLAZYRESTORE)pvUser;
+
+    int rc = pgmR3LazyRestoreFetch(pVM, pLazy, GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK, &pLazy->cFaultedPages);
+    if (RT_SUCCESS(rc))
+    {
+        if (enmAccessType == PGMACCESSTYPE_READ)
+            rc = PGMPhysSimpleReadGCPhys(pVM, pvBuf, GCPhys, cbBuf);
+        else
+            rc = PGMPhysSimpleWriteGCPhys(pVM, GCPhys, pvBuf, cbBuf);
+    }
+    return rc;
+}
+
+
+/**
+ * Ends a lazy restore, deregistering the access handlers and closing the
+ * saved state.
+ *
+ * Any pages still pending are lost, so this is only used when all pages have
+ * been restored, on reset and on termination.  The state structure itself is
+ * kept until pgmR3LazyRestoreTerm since other threads may still reference it.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   pLazy               The lazy restore state.
+ *
+ * @thread  EMT
+ */
+static void pgmR3LazyRestoreEnd(PVM pVM, PPGMLAZYRESTORE pLazy)
+{
+    if (ASMAtomicXchgBool(&pLazy->fEnding, true))
+        return;
+
+    /*
+     * Stop the prefetcher (it may be the one asking us to do this).
+     */
+    if (pLazy->hThread != NIL_RTTHREAD)
+    {
+        ASMAtomicWriteBool(&pLazy->fTerminate, true);
+        RTSemEventSignal(pLazy->hEvtBatchDone);
+        int rc = RTThreadWait(pLazy->hThread, RT_INDEFINITE_WAIT, NULL);
+        AssertLogRelRC(rc);
+        pLazy->hThread = NIL_RTTHREAD;
+    }
+
+    /*
+     * Drop the handlers and the index.
+     */
+    for (uint32_t i = 0; i < pLazy->cHandlers; i++)
+    {
+        int rc = PGMHandlerPhysicalDeregister(pVM, pLazy->paGCPhysHandlers[i]);
+        AssertLogRelMsgRC(rc, ("GCPhys=%RGp rc=%Rrc\n", pLazy->paGCPhysHandlers[i], rc));
+    }
+
+    pgmLock(pVM);
+    uint32_t const cPending = pLazy->cPending;
+    PGMRAMIDX      Idx      = pLazy->Idx;
+    RTGCPHYS      *paGCPhys = pLazy->paGCPhysHandlers;
+    RT_ZERO(pLazy->Idx);
+    pLazy->paGCPhysHandlers = NULL;
+    pLazy->cHandlers        = 0;
+    pLazy->cPending         = 0;
+    pgmUnlock(pVM);
+    pgmR3RamIdxDelete(&Idx);
+    RTMemFree(paGCPhys);
+
+    /*
+     * Close the saved state.
+     */
+    RTCritSectEnter(&pLazy->CritSect);
+    PSSMHANDLE pSSM = pLazy->pSSM;
+    pLazy->pSSM = NULL;
+    RTCritSectLeave(&pLazy->CritSect);
+    if (pSSM)
+    {
+        SSMR3Close(pSSM);
+        LogRel(("PGM: Lazy restore %s after %'RU64 ms: %u pages on demand, %u prefetched%s\n",
+                cPending ? "aborted" : "completed", (RTTimeNanoTS() - pLazy->nsStart) / RT_NS_1MS,
+                pLazy->cFaultedPages, pLazy->cPrefetchedPages, cPending ? ", pending pages lost" : ""));
+    }
+}
+
+
+/**
+ * EMT worker for pgmR3LazyRestorePrefetchThread installing a batch of pages.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   iBatch              The batch index (PGMLAZYRESTORE::aBatches).
+ */
+static DECLCALLBACK(void) pgmR3LazyRestoreInstallWorker(PVM pVM, uint32_t iBatch)
+{
+    pgmLock(pVM);
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (pLazy)
+    {
+        PPGMLAZYRESTOREBATCH pBatch = &pLazy->aBatches[iBatch];
+        for (uint32_t i = 0; i < pBatch->cPages; i++)
+        {
+            /* Skip pages restored by someone else since they were read, or
+               the whole lot if the restore has ended in the meantime. */
+            RTGCPHYS const GCPhys    = pBatch->aGCPhys[i];
+            uint64_t      *pu64Entry = pgmR3RamIdxLookupPage(&pLazy->Idx, GCPhys);
+            if (!pu64Entry || *pu64Entry != pBatch->au64Entries[i])
+                continue;
+
+            PPGMPAGE pPage = pgmPhysGetPage(pVM, GCPhys);
+            AssertLogRelMsgStmt(pPage, ("%RGp\n", GCPhys), continue);
+            int rc = pgmR3LazyRestoreInstall(pVM, pLazy, pPage, GCPhys, pu64Entry, &pBatch->abPages[i][0]);
+            if (RT_SUCCESS(rc))
+                ASMAtomicIncU32(&pLazy->cPrefetchedPages);
+            else
+                LogRel(("PGM: Lazy restore failed to install %RGp: %Rrc\n", GCPhys, rc));
+        }
+        pBatch->cPages = 0;
+        ASMAtomicWriteBool(&pBatch->fBusy, false);
+        RTSemEventSignal(pLazy->hEvtBatchDone);
+    }
+    pgmUnlock(pVM);
+}
+
+
+/**
+ * EMT worker for pgmR3LazyRestorePrefetchThread ending the restore.
+ *
+ * @param   pVM                 The cross context VM structure.
+ */
+static DECLCALLBACK(void) pgmR3LazyRestoreEndWorker(PVM pVM)
+{
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (pLazy && pLazy->pSSM)
+    {
+        /* Pages the prefetcher failed on stay under their handlers and are
+           retried on access, the rest is dropped on reset or termination. */
+        if (!pLazy->cPending)
+            pgmR3LazyRestoreEnd(pVM, pLazy);
+        else
+            LogRel(("PGM: Lazy restore prefetching done with %u pages still pending\n", pLazy->cPending));
+    }
+}
+
+
+/**
+ * Waits for a prefetch batch to be installed.
+ *
+ * @returns true if the batch is free, false if the thread should quit.
+ * @param   pLazy               The lazy restore state.
+ * @param   pBatch              The batch.
+ */
+static bool pgmR3LazyRestoreWaitBatch(PPGMLAZYRESTORE pLazy, PPGMLAZYRESTOREBATCH pBatch)
+{
+    while (ASMAtomicReadBool(&pBatch->fBusy))
+    {
+        if (ASMAtomicReadBool(&pLazy->fTerminate))
+            return false;
+        RTSemEventWait(pLazy->hEvtBatchDone, RT_INDEFINITE_WAIT);
+    }
+    return !ASMAtomicReadBool(&pLazy->fTerminate);
+}
+
+
+/**
+ * Hands a prefetch batch to an EMT for installing.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pLazy               The lazy restore state.
+ * @param   iBatch              The batch index.
+ */
+static int pgmR3LazyRestoreQueueBatch(PVM pVM, PPGMLAZYRESTORE pLazy, uint32_t iBatch)
+{
+    PPGMLAZYRESTOREBATCH pBatch = &pLazy->aBatches[iBatch];
+    ASMAtomicWriteBool(&pBatch->fBusy, true);
+    int rc = VMR3ReqCallNoWait(pVM, VMCPUID_ANY, (PFNRT)pgmR3LazyRestoreInstallWorker, 2, pVM, iBatch);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("PGM: Lazy restore failed to queue a prefetch batch: %Rrc\n", rc));
+        pBatch->cPages = 0;
+        ASMAtomicWriteBool(&pBatch->fBusy, false);
+    }
+    return rc;
+}
+
+
+/**
+ * @callback_method_impl{FNRTTHREAD,
+ *      Restores the pages not touched yet in address order.}
+ */
+static DECLCALLBACK(int) pgmR3LazyRestorePrefetchThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PPGMLAZYRESTORE pLazy = (PPGMLAZYRESTORE)pvUser;
+    PVM             pVM   = pLazy->pVM;
+    RT_NOREF(hThreadSelf);
+
+    /*
+     * Read the pages into batches, handing each full one to an EMT.
+     * The ranges stay put until pgmR3LazyRestoreEnd has waited for us.
+     */
+    int                  rc     = VINF_SUCCESS;
+    uint32_t             iBatch = 0;
+    PPGMLAZYRESTOREBATCH pBatch = NULL;
+    for (uint32_t iRange = 0; iRange < pLazy->Idx.cRanges && RT_SUCCESS(rc); iRange++)
+    {
+        PPGMRAMIDXRANGE pRange = &pLazy->Idx.paRanges[iRange];
+        for (uint32_t iPage = 0; iPage < pRange->cPages; iPage++)
+        {
+            RTGCPHYS const GCPhys = pRange->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+            if (ASMAtomicReadBool(&pLazy->fTerminate))
+                return VINF_SUCCESS;
+
+            pgmLock(pVM);
+            uint64_t *pu64Entry = pgmR3RamIdxLookupPage(&pLazy->Idx, GCPhys);
+            uint64_t const offRec = pu64Entry ? *pu64Entry : PGM_RAM_IDX_NONE;
+            pgmUnlock(pVM);
+            if (offRec <= PGM_RAM_IDX_BALLOONED)
+                continue;
+
+            if (!pBatch)
+            {
+                pBatch = &pLazy->aBatches[iBatch];
+                if (!pgmR3LazyRestoreWaitBatch(pLazy, pBatch))
+                    return VINF_SUCCESS;
+            }
+
+            rc = pgmR3LazyRestoreReadPage(pLazy, offRec, &pBatch->abPages[pBatch->cPages][0]);
+            if (RT_FAILURE(rc))
+            {
+                if (rc == VERR_NOT_AVAILABLE) /* Closed, the restore has ended. */
+                    return VINF_SUCCESS;
+                LogRel(("PGM: Lazy restore prefetching failed at %RGp: %Rrc\n", GCPhys, rc));
+                break;
+            }
+            pBatch->aGCPhys[pBatch->cPages]     = GCPhys;
+            pBatch->au64Entries[pBatch->cPages] = offRec;
+            if (++pBatch->cPages == PGM_LAZY_RESTORE_BATCH_PAGES)
+            {
+                rc = pgmR3LazyRestoreQueueBatch(pVM, pLazy, iBatch);
+                pBatch = NULL;
+                iBatch = (iBatch + 1) % PGM_LAZY_RESTORE_BATCHES;
+                if (RT_FAILURE(rc))
+                    break;
+            }
+        }
+    }
+    if (pBatch && pBatch->cPages)
+        pgmR3LazyRestoreQueueBatch(pVM, pLazy, iBatch);
+
+    /*
+     * Once all batches are in, have an EMT drop the handlers and close the
+     * file.  The end worker copes with pages left pending by a failure.
+     */
+    for (uint32_t i = 0; i < PGM_LAZY_RESTORE_BATCHES; i++)
+        if (!pgmR3LazyRestoreWaitBatch(pLazy, &pLazy->aBatches[i]))
+            return VINF_SUCCESS;
+    rc = VMR3ReqCallNoWait(pVM, VMCPUID_ANY, (PFNRT)pgmR3LazyRestoreEndWorker, 1, pVM);
+    AssertLogRelRC(rc);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Puts a run of pages under a lazy restore access handler.
+ *
+ * Pages in the run that aren't pending are restored right away and have the
+ * handler turned off.  If the handler can't be registered, the whole run is
+ * restored right away.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pLazy               The lazy restore state.
+ * @param   pRam                The RAM range.
+ * @param   pau64Entries        The index entries of the RAM range.
+ * @param   iFirst              The first page of the run.
+ * @param   cPages              The number of pages in the run.
+ *
+ * @remarks Caller owns the PGM lock.
+ */
+static int pgmR3LazyRestoreArmRun(PVM pVM, PPGMLAZYRESTORE pLazy, PPGMRAMRANGE pRam, uint64_t *pau64Entries,
+                                  uint32_t iFirst, uint32_t cPages)
+{
+    RTGCPHYS const GCPhysFirst = pRam->GCPhys + ((RTGCPHYS)iFirst << PAGE_SHIFT);
+    int rc = VINF_SUCCESS;
+    if (!(pLazy->cHandlers % 64))
+    {
+        void *pvNew = RTMemRealloc(pLazy->paGCPhysHandlers, (pLazy->cHandlers + 64) * sizeof(pLazy->paGCPhysHandlers[0]));
+        if (pvNew)
+            pLazy->paGCPhysHandlers = (RTGCPHYS *)pvNew;
+        else
+            rc = VERR_NO_MEMORY;
+    }
+    if (RT_SUCCESS(rc))
+        rc = PGMHandlerPhysicalRegister(pVM, GCPhysFirst, GCPhysFirst + ((RTGCPHYS)cPages << PAGE_SHIFT) - 1,
+                                        pVM->pgm.s.hLazyRestorePhysHandlerType, pLazy, NIL_RTR0PTR, NIL_RTRCPTR,
+                                        "Lazy restore");
+    bool const fHandler = RT_SUCCESS(rc);
+    if (fHandler)
+        pLazy->paGCPhysHandlers[pLazy->cHandlers++] = GCPhysFirst;
+    else
+        LogRel(("PGM: Failed to register lazy restore handler for %RGp LB %#x pages (%Rrc), restoring them now\n",
+                GCPhysFirst, cPages, rc));
+
+    for (uint32_t iPage = iFirst; iPage < iFirst + cPages; iPage++)
+    {
+        RTGCPHYS const GCPhys = pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+        if (fHandler && pau64Entries[iPage] > PGM_RAM_IDX_BALLOONED)
+            pLazy->cPending++;
+        else
+        {
+            rc = pgmR3LazyRestorePageNow(pVM, pLazy, &pRam->aPages[iPage], GCPhys, &pau64Entries[iPage], NULL /*pvSrc*/);
+            if (RT_SUCCESS(rc) && fHandler)
+                rc = PGMHandlerPhysicalPageTempOff(pVM, GCPhysFirst, GCPhys);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Starts the lazy restore once the index has been loaded.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pLazy               The lazy restore state with the index.
+ */
+static int pgmR3LazyRestoreArm(PVM pVM, PPGMLAZYRESTORE pLazy)
+{
+    /*
+     * Cover all the pending RAM pages with access handlers, skipping pages
+     * which already have one.  Those we restore right away.
+     */
+    int rc = VINF_SUCCESS;
+    pgmLock(pVM);
+    for (uint32_t iRange = 0; iRange < pLazy->Idx.cRanges && RT_SUCCESS(rc); iRange++)
+    {
+        PPGMRAMIDXRANGE pRange = &pLazy->Idx.paRanges[iRange];
+        PPGMRAMRANGE    pRam   = pgmPhysGetRange(pVM, pRange->GCPhys);
+        AssertLogRelMsgBreakStmt(   pRam
+                                 && pRam->GCPhys == pRange->GCPhys
+                                 && (pRam->cb >> PAGE_SHIFT) == pRange->cPages,
+                                 ("%RGp LB %#x pages\n", pRange->GCPhys, pRange->cPages),
+                                 rc = VERR_SSM_LOAD_CONFIG_MISMATCH);
+
+        uint64_t *pau64Entries = &pLazy->Idx.pau64Entries[pRange->iFirstEntry];
+        uint32_t  iPage        = 0;
+        while (iPage < pRange->cPages && RT_SUCCESS(rc))
+        {
+            uint32_t const iFirst = iPage;
+            while (   iPage < pRange->cPages
+                   && pau64Entries[iPage] != PGM_RAM_IDX_NONE
+                   && PGM_PAGE_GET_TYPE(&pRam->aPages[iPage]) == PGMPAGETYPE_RAM
+                   && !PGM_PAGE_HAS_ANY_PHYSICAL_HANDLERS(&pRam->aPages[iPage]))
+                iPage++;
+            if (iPage > iFirst)
+                rc = pgmR3LazyRestoreArmRun(pVM, pLazy, pRam, pau64Entries, iFirst, iPage - iFirst);
+            else
+            {
+                rc = pgmR3LazyRestorePageNow(pVM, pLazy, &pRam->aPages[iPage], pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT),
+                                             &pau64Entries[iPage], NULL /*pvSrc*/);
+                iPage++;
+            }
+        }
+    }
+    pgmUnlock(pVM);
+
+    /* Make sure nothing is mapped from before the handlers were registered. */
+    pgmPhysInvalidatePageMapTLB(pVM);
+
+    /*
+     * Kick off the prefetcher, or end it right here if there is nothing left.
+     */
+    pLazy->nsStart = RTTimeNanoTS();
+    if (RT_SUCCESS(rc) && pLazy->cPending)
+    {
+        LogRel(("PGM: Lazy restore of %u RAM pages using %u handlers\n", pLazy->cPending, pLazy->cHandlers));
+        ASMAtomicWriteBool(&pLazy->fTerminate, false);
+        rc = RTThreadCreate(&pLazy->hThread, pgmR3LazyRestorePrefetchThread, pLazy, 0 /*cbStack*/,
+                            RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "PgmLazyRst");
+        if (RT_FAILURE(rc))
+            pLazy->hThread = NIL_RTTHREAD;
+    }
+    if (RT_FAILURE(rc) || !pLazy->cPending)
+        pgmR3LazyRestoreEnd(pVM, pLazy);
+    return rc;
+}
+
+
+/**
+ * Checks whether the RAM of a saved state being loaded can be restored
+ * lazily, and if so, opens a second handle to it for reading the pages.
+ *
+ * @returns true if lazy restore is going ahead, false if not.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSSM                The saved state handle being loaded.
+ */
+static bool pgmR3LazyRestoreBegin(PVM pVM, PSSMHANDLE pSSM)
+{
+    /* Only when loading a file for resuming, and only with nested paging as
+       the shadow page pool puts access handlers on guest page tables. */
+    const char *pszFilename = SSMR3HandleFilename(pSSM);
+    if (   !pVM->pgm.s.fLazyRestore
+        || !pszFilename
+        || SSMR3HandleGetAfter(pSSM) != SSMAFTER_RESUME)
+        return false;
+    if (!pVM->pgm.s.fNestedPaging || pVM->pgm.s.fPciPassthrough)
+    {
+        LogRel(("PGM: Lazy restore requires nested paging and no PCI passthrough, loading all of RAM now\n"));
+        return false;
+    }
+
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (!pLazy)
+    {
+        pLazy = (PPGMLAZYRESTORE)RTMemAllocZ(sizeof(*pLazy));
+        if (!pLazy)
+            return false;
+        int rc = RTCritSectInit(&pLazy->CritSect);
+        if (RT_SUCCESS(rc))
+        {
+            rc = RTSemEventCreate(&pLazy->hEvtBatchDone);
+            if (RT_FAILURE(rc))
+                RTCritSectDelete(&pLazy->CritSect);
+        }
+        if (RT_FAILURE(rc))
+        {
+            RTMemFree(pLazy);
+            return false;
+        }
+        pLazy->pVM     = pVM;
+        pLazy->hThread = NIL_RTTHREAD;
+        pVM->pgm.s.pLazyRestoreR3 = pLazy;
+    }
+    Assert(!pLazy->pSSM && !pLazy->Idx.pau64Entries && !pLazy->cHandlers);
+    pLazy->fEnding          = false;
+    pLazy->cFaultedPages    = 0;
+    pLazy->cPrefetchedPages = 0;
+    pLazy->nsStart          = RTTimeNanoTS();
+
+    int rc = SSMR3Open(pszFilename, 0 /*fFlags*/, &pLazy->pSSM);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("PGM: Lazy restore failed to open '%s': %Rrc, loading all of RAM now\n", pszFilename, rc));
+        pLazy->pSSM = NULL;
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * @callback_method_impl{FNSSMINTLOADEXEC, "pgmram"}
+ */
+static DECLCALLBACK(int) pgmR3LoadRam(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+{
+    AssertLogRelMsgReturn(uVersion == PGM_RAM_SAVED_STATE_VERSION, ("%u\n", uVersion), VERR_SSM_UNSUPPORTED_DATA_UNIT_VERSION);
+    AssertLogRelMsgReturn(uPass == SSM_PASS_FINAL, ("%#x\n", uPass), VERR_SSM_UNEXPECTED_PASS);
+
+    /*
+     * Leave the pages in the file if we can restore them lazily, the
+     * "pgmidx" unit which follows tells us where they are.
+     */
+    if (pgmR3LazyRestoreBegin(pVM, pSSM))
+        return SSMR3SeekToEndOfUnit(pSSM);
+
+    pgmLock(pVM);
+    int rc = pgmR3LoadMemory(pVM, pSSM, PGM_SAVED_STATE_VERSION, uPass);
+    pgmUnlock(pVM);
+    return rc;
+}
+
+
+/**
+ * @callback_method_impl{FNSSMINTLOADDONE, "pgmram"}
+ */
+static DECLCALLBACK(int) pgmR3LoadRamDone(PVM pVM, PSSMHANDLE pSSM)
+{
+    /* The "pgmidx" unit is required when pgmR3LoadRam skipped the pages. */
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (   pLazy
+        && pLazy->pSSM
+        && !pLazy->Idx.pau64Entries)
+    {
+        pgmR3LazyRestoreEnd(pVM, pLazy);
+        AssertLogRelMsgFailedReturn(("PGM: The saved state has no RAM page index\n"), VERR_SSM_INTEGRITY_UNIT_NOT_FOUND);
+    }
+    NOREF(pSSM);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNSSMINTLOADEXEC, "pgmidx"}
+ */
+static DECLCALLBACK(int) pgmR3LoadRamIdx(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+{
+    AssertLogRelMsgReturn(uVersion == PGM_IDX_SAVED_STATE_VERSION, ("%u\n", uVersion), VERR_SSM_UNSUPPORTED_DATA_UNIT_VERSION);
+    AssertLogRelMsgReturn(uPass == SSM_PASS_FINAL, ("%#x\n", uPass), VERR_SSM_UNEXPECTED_PASS);
+
+    /*
+     * Only needed if pgmR3LoadRam left the pages in the file.
+     */
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (   !pLazy
+        || !pLazy->pSSM
+        || pLazy->Idx.pau64Entries)
+        return SSMR3SkipToEndOfUnit(pSSM);
+
+    /*
+     * Load the index.
+     */
+    PGMRAMIDX Idx;
+    RT_ZERO(Idx);
+    uint32_t  cRanges;
+    uint32_t  cEntries;
+    SSMR3GetU32(pSSM, &cRanges);
+    int rc = SSMR3GetU32(pSSM, &cEntries);
+    if (RT_FAILURE(rc))
+        return rc;
+    AssertLogRelMsgReturn(cRanges > 0 && cRanges <= _64K && cEntries > 0 && cEntries < UINT32_MAX / 2,
+                          ("cRanges=%#x cEntries=%#x\n", cRanges, cEntries), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+    Idx.paRanges     = (PPGMRAMIDXRANGE)RTMemAllocZ(sizeof(Idx.paRanges[0]) * cRanges);
+    Idx.pau64Entries = (uint64_t *)RTMemAlloc(sizeof(Idx.pau64Entries[0]) * cEntries);
+    Idx.cRanges      = cRanges;
+    Idx.cEntries     = cEntries;
+    if (!Idx.paRanges || !Idx.pau64Entries)
+    {
+        pgmR3RamIdxDelete(&Idx);
+        return VERR_NO_MEMORY;
+    }
+
+    uint32_t iEntry = 0;
+    for (uint32_t iRange = 0; iRange < cRanges && RT_SUCCESS(rc); iRange++)
+    {
+        RTGCPHYS GCPhys;
+        uint32_t cPages;
+        SSMR3GetGCPhys(pSSM, &GCPhys);
+        rc = SSMR3GetU32(pSSM, &cPages);
+        if (RT_FAILURE(rc))
+            break;
+        AssertLogRelMsgBreakStmt(!(GCPhys & PAGE_OFFSET_MASK) && cPages <= cEntries - iEntry,
+                                 ("GCPhys=%RGp cPages=%#x iEntry=%#x\n", GCPhys, cPages, iEntry),
+                                 rc = VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+        Idx.paRanges[iRange].GCPhys      = GCPhys;
+        Idx.paRanges[iRange].cPages      = cPages;
+        Idx.paRanges[iRange].iFirstEntry = iEntry;
+        rc = SSMR3GetMem(pSSM, &Idx.pau64Entries[iEntry], sizeof(uint64_t) * cPages);
+        iEntry += cPages;
+    }
+    if (RT_SUCCESS(rc))
+    {
+        uint32_t u32Terminator;
+        rc = SSMR3GetU32(pSSM, &u32Terminator);
+        if (RT_SUCCESS(rc) && (u32Terminator != UINT32_MAX || iEntry != cEntries))
+            AssertLogRelMsgFailedStmt(("u32Terminator=%#x iEntry=%#x cEntries=%#x\n", u32Terminator, iEntry, cEntries),
+                                      rc = VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+    }
+    if (RT_FAILURE(rc))
+    {
+        pgmR3RamIdxDelete(&Idx);
+        return rc;
+    }
+
+    /*
+     * Hand it to the lazy restore state and get going.
+     */
+    pgmLock(pVM);
+    pLazy->Idx = Idx;
+    pgmUnlock(pVM);
+    return pgmR3LazyRestoreArm(pVM, pLazy);
+}
+
+
+/**
+ * Ends any lazy restore in progress, called on VM reset.
+ *
+ * Pages not yet restored are lost, but so is the rest of RAM.
+ *
+ * @param   pVM                 The cross context VM structure.
+ */
+void pgmR3LazyRestoreReset(PVM pVM)
+{
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (pLazy)
+        pgmR3LazyRestoreEnd(pVM, pLazy);
+}
+
+
+/**
+ * Ends any lazy restore in progress and frees the state, called on VM
+ * termination.
+ *
+ * @param   pVM                 The cross context VM structure.
+ */
+void pgmR3LazyRestoreTerm(PVM pVM)
+{
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (pLazy)
+    {
+        pgmR3LazyRestoreEnd(pVM, pLazy);
+        pgmLock(pVM);
+        pVM->pgm.s.pLazyRestoreR3 = NULL;
+        pgmUnlock(pVM);
+        RTSemEventDestroy(pLazy->hEvtBatchDone);
+        RTCritSectDelete(&pLazy->CritSect);
+        RTMemFree(pLazy);
+    }
+}
+
+
+/**
+ * Restores all pages still pending in a lazy restore.
+ *
+ * Pages not restored yet are zero pages under an access handler, so saving
+ * them as they are would lose their content.  This fetches them from the
+ * old saved state and ends the lazy restore before the RAM is looked at.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ *
+ * @thread  EMT
+ */
+static int pgmR3LazyRestoreComplete(PVM pVM)
+{
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (!pLazy || !pLazy->pSSM)
+        return VINF_SUCCESS;
+
+    LogRel(("PGM: Completing lazy restore (%u pages pending) before saving state\n", pLazy->cPending));
+    for (uint32_t iRange = 0; ; iRange++)
+    {
+        /* The end worker may drop the index on another EMT while we're at it. */
+        pgmLock(pVM);
+        if (iRange >= pLazy->Idx.cRanges)
+        {
+            pgmUnlock(pVM);
+            break;
+        }
+        RTGCPHYS const GCPhysRange = pLazy->Idx.paRanges[iRange].GCPhys;
+        uint32_t const cPages      = pLazy->Idx.paRanges[iRange].cPages;
+        pgmUnlock(pVM);
+
+        for (uint32_t iPage = 0; iPage < cPages; iPage++)
+        {
+            RTGCPHYS const GCPhys = GCPhysRange + ((RTGCPHYS)iPage << PAGE_SHIFT);
+            int rc = pgmR3LazyRestoreFetch(pVM, pLazy, GCPhys, &pLazy->cPrefetchedPages);
+            if (RT_FAILURE(rc))
+            {
+                LogRel(("PGM: Cannot save state during lazy restore, fetching %RGp failed: %Rrc\n", GCPhys, rc));
+                return rc;
+            }
+        }
+    }
+
+    AssertLogRelMsgReturn(!pLazy->cPending, ("cPending=%u\n", pLazy->cPending), VERR_INTERNAL_ERROR_4);
+    pgmR3LazyRestoreEnd(pVM, pLazy);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNSSMINTSAVEPREP}
+ */
+static DECLCALLBACK(int) pgmR3SavePrep(PVM pVM, PSSMHANDLE pSSM)
+{
+    RT_NOREF(pSSM);
+    return pgmR3LazyRestoreComplete(pVM);
+}
+
+
+/**
+ * Registers the saved state callbacks with SSM.
+ *
+ * @returns VBox status code.
+ * @param   pVM     The cross context VM structure.
+ * @param   cbRam   The RAM size.
+ */
+int pgmR3InitSavedState(PVM pVM, uint64_t cbRam)
+{
+    /*
+     * The RAM and index units for lazy restore come first so that RAM has
+     * been loaded (or armed for lazy restore) when the "pgm" unit changes
+     * the paging mode in the final pass.  They only save anything with
+     * PGM::LiveSave::fRamIndex set, but must always be able to load.
+     */
+    bool const fRamIndex = pVM->pgm.s.LiveSave.fRamIndex;
+    int rc = SSMR3RegisterInternal(pVM, "pgmram", 1, PGM_RAM_SAVED_STATE_VERSION, (size_t)cbRam,
+                                   NULL, NULL, NULL,
+                                   NULL, fRamIndex ? pgmR3SaveRam : NULL, fRamIndex ? pgmR3SaveRamDone : NULL,
+                                   NULL, pgmR3LoadRam, pgmR3LoadRamDone);
+    if (RT_SUCCESS(rc))
+        rc = SSMR3RegisterInternal(pVM, "pgmidx", 1, PGM_IDX_SAVED_STATE_VERSION, (size_t)(cbRam >> PAGE_SHIFT) * sizeof(uint64_t),
+                                   NULL, NULL, NULL,
+                                   NULL, fRamIndex ? pgmR3SaveRamIdx : NULL, NULL,
+                                   NULL, pgmR3LoadRamIdx, NULL);
+    if (RT_SUCCESS(rc))
+        rc = SSMR3RegisterInternal(pVM, "pgm", 1, PGM_SAVED_STATE_VERSION, (size_t)cbRam + sizeof(PGM),
+                                   pgmR3LivePrep, pgmR3LiveExec, pgmR3LiveVote,
+                                   pgmR3SavePrep, pgmR3SaveExec, pgmR3SaveDone,
+                                   pgmR3LoadPrep, pgmR3Load,     pgmR3LoadDone);
+    return rc;
 }
 
@@ -112,7 +112,9 @@
  *       - type 5: Named data - length prefixed name followed by the data. This
  *                 type is not implemented yet as we're missing the API part, so
  *                 the type assignment is tentative.
- *       - types 6 thru 15 are current undefined.
+ *       - type 6: Raw data compressed by the codec given in the file header
+ *                 (SSMFILEHDR::u8Codec).  Same layout as type 3.
+ *       - types 7 thru 15 are current undefined.
  *   - bit 4: Important (set), can be skipped (clear).
  *   - bit 5: Undefined flag, must be zero.
  *   - bit 6: Undefined flag, must be zero.
@@ -145,6 +147,7 @@
 *********************************************************************************************************************************/
 #define LOG_GROUP LOG_GROUP_SSM
 #include <VBox/vmm/ssm.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/dbgf.h>
 #include <VBox/vmm/pdmapi.h>
 #include <VBox/vmm/pdmcritsect.h>
@@ -161,6 +164,7 @@
 #include <iprt/crc.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
 #include <iprt/param.h>
 #include <iprt/thread.h>
 #include <iprt/semaphore.h>
@@ -194,6 +198,16 @@
 #define SSMFILEHDR_FLAGS_STREAM_LIVE_SAVE       RT_BIT_32(1)
 /** @} */
 
+/** @name SSMFILEHDR::u8Codec values.
+ * @{ */
+/** LZF, using SSM_REC_TYPE_RAW_LZF records only. */
+#define SSMFILEHDR_CODEC_LZF                    UINT8_C(0)
+/** LZ4 block format for SSM_REC_TYPE_RAW_CODEC records. */
+#define SSMFILEHDR_CODEC_LZ4                    UINT8_C(1)
+/** Zstandard for SSM_REC_TYPE_RAW_CODEC records. */
+#define SSMFILEHDR_CODEC_ZSTD                   UINT8_C(2)
+/** @} */
+
 /** The directory magic. */
 #define SSMFILEDIR_MAGIC                        "\nDir\n\0\0"
 
@@ -227,10 +241,13 @@
 /** Named data items.
  * A length prefix zero terminated string (i.e. max 255) followed by the data.  */
 #define SSM_REC_TYPE_NAMED                      5
+/** Raw data compressed by the codec specified in the file header.
+ * Same layout as SSM_REC_TYPE_RAW_LZF. */
+#define SSM_REC_TYPE_RAW_CODEC                  6
 /** Macro for validating the record type.
  * This can be used with the flags+type byte, no need to mask out the type first. */
 #define SSM_REC_TYPE_IS_VALID(u8Type)           (   ((u8Type) & SSM_REC_TYPE_MASK) >  SSM_REC_TYPE_INVALID \
-                                                 && ((u8Type) & SSM_REC_TYPE_MASK) <= SSM_REC_TYPE_NAMED )
+                                                 && ((u8Type) & SSM_REC_TYPE_MASK) <= SSM_REC_TYPE_RAW_CODEC )
 /** @} */
 
 /** The flag mask. */
@@ -285,6 +302,25 @@
 #define SSM_ZIP_BLOCK_SIZE                      _4K
 AssertCompile(SSM_ZIP_BLOCK_SIZE / _1K * _1K == SSM_ZIP_BLOCK_SIZE);
 
+/** The max size of a compressed block record (header + size prefix + data). */
+#define SSM_ZIP_BLOCK_REC_MAX                   (1 + 3 + 1 + SSM_ZIP_BLOCK_SIZE)
+/** The max number of compression worker threads. */
+#define SSM_ZIP_MAX_THREADS                     16
+/** The number of compression blocks in the pipeline per worker thread. */
+#define SSM_ZIP_BLOCKS_PER_THREAD               16
+
+/** @name Compression pipeline block states (SSMZIPBLOCK::u32State).
+ * @{ */
+/** The block is free. */
+#define SSMZIPBLOCK_STATE_FREE                  UINT32_C(0)
+/** The block contains source data waiting for a worker. */
+#define SSMZIPBLOCK_STATE_PENDING               UINT32_C(1)
+/** A worker is compressing the block. */
+#define SSMZIPBLOCK_STATE_BUSY                  UINT32_C(2)
+/** The block record is ready for writing to the stream. */
+#define SSMZIPBLOCK_STATE_DONE                  UINT32_C(3)
+/** @} */
+
 
 /**
  * Asserts that the handle is writable and returns with VERR_SSM_INVALID_STATE
@@ -447,6 +483,80 @@ typedef struct SSMSTRM
 typedef SSMSTRM *PSSMSTRM;
 
 
+/**
+ * A block in the save compression pipeline.
+ */
+typedef struct SSMZIPBLOCK
+{
+    /** The block state, SSMZIPBLOCK_STATE_XXX. */
+    uint32_t volatile       u32State;
+    /** The size of the finished record in abRec. */
+    uint32_t                cbRec;
+    /** Where to store the stream offset of the record when it is written,
+     * NULL if not wanted (SSMR3PutPageIndexed). */
+    uint64_t               *poffRec;
+    /** The uncompressed data. */
+    uint8_t                 abSrc[SSM_ZIP_BLOCK_SIZE];
+    /** The finished record (header included). */
+    uint8_t                 abRec[SSM_ZIP_BLOCK_REC_MAX];
+} SSMZIPBLOCK;
+/** Pointer to a compression pipeline block. */
+typedef SSMZIPBLOCK *PSSMZIPBLOCK;
+
+/**
+ * A save compression pipeline worker thread.
+ */
+typedef struct SSMZIPWORKER
+{
+    /** Pointer back to the pipeline. */
+    struct SSMZIPPIPE      *pPipe;
+    /** The thread handle. */
+    RTTHREAD                hThread;
+    /** Event for waking up the thread. */
+    RTSEMEVENT              hEvtWork;
+} SSMZIPWORKER;
+/** Pointer to a compression pipeline worker thread. */
+typedef SSMZIPWORKER *PSSMZIPWORKER;
+
+/**
+ * The save compression pipeline.
+ *
+ * The thread doing the saving (the producer) copies the data blocks into a
+ * ring of SSMZIPBLOCK entries, the worker threads compress them in parallel
+ * and the producer writes the finished records to the stream in submission
+ * order.  This keeps the stream format identical to the inline compression.
+ */
+typedef struct SSMZIPPIPE
+{
+    /** The cross context VM structure (statistics). */
+    PVM                     pVM;
+    /** The block codec. */
+    RTZIPTYPE               enmZipType;
+    /** The number of blocks in the ring. */
+    uint32_t                cBlocks;
+    /** The next block to submit (producer). */
+    uint32_t volatile       iSubmit;
+    /** The next block to claim (workers). */
+    uint32_t volatile       iClaim;
+    /** The next block to write to the stream (producer). */
+    uint32_t                iWrite;
+    /** Set when the producer waits for hEvtDone. */
+    bool volatile           fProducerWaiting;
+    /** Tells the worker threads to terminate. */
+    bool volatile           fTerminate;
+    /** Event the producer waits on for completed blocks. */
+    RTSEMEVENT              hEvtDone;
+    /** The number of worker threads. */
+    uint32_t                cWorkers;
+    /** The worker threads. */
+    SSMZIPWORKER            aWorkers[SSM_ZIP_MAX_THREADS];
+    /** The block ring. */
+    PSSMZIPBLOCK            paBlocks;
+} SSMZIPPIPE;
+/** Pointer to the save compression pipeline. */
+typedef SSMZIPPIPE *PSSMZIPPIPE;
+
+
 /**
  * Handle structure.
  */
@@ -473,6 +583,10 @@ typedef struct SSMHANDLE
     uint64_t                offUnitUser;
     /** Indicates that this is a live save or restore operation. */
     bool                    fLiveSave;
+    /** The block compression codec used for SSM_REC_TYPE_RAW_CODEC records.
+     * RTZIPTYPE_LZF when saving the classic way, RTZIPTYPE_INVALID when
+     * reading a stream without a codec. */
+    RTZIPTYPE               enmZipType;
 
     /** Pointer to the progress callback function. */
     PFNVMPROGRESS           pfnProgress;
@@ -514,6 +628,8 @@ typedef struct SSMHANDLE
             uint8_t         abDataBuffer[4096];
             /** The maximum downtime given as milliseconds. */
             uint32_t        cMsMaxDowntime;
+            /** The compression pipeline, NULL if compressing inline. */
+            PSSMZIPPIPE     pZipPipe;
         } Write;
 
         /** Read data. */
@@ -619,8 +735,10 @@ typedef struct SSMFILEHDR
     uint8_t         cbGCPhys;
     /** The size of RTGCPTR. */
     uint8_t         cbGCPtr;
-    /** Reserved header space - must be zero. */
-    uint8_t         u8Reserved;
+    /** The block compression codec, SSMFILEHDR_CODEC_XXX.
+     * This used to be a reserved must-be-zero field, so older readers will
+     * refuse streams using anything but LZF. */
+    uint8_t         u8Codec;
     /** The number of units that (may) have stored data in the file. */
     uint32_t        cUnits;
     /** Flags, see SSMFILEHDR_FLAGS_XXX.  */
@@ -945,6 +1063,18 @@ static int ssmR3LazyInit(PVM pVM)
     if (RT_SUCCESS(rc))
     {
         STAM_REL_REG_USED(pVM, &pVM->ssm.s.uPass, STAMTYPE_U32, "/SSM/uPass", STAMUNIT_COUNT, "Current pass");
+        STAM_REL_REG_USED(pVM, (void *)&pVM->ssm.s.cZipQueueDepth, STAMTYPE_U32, "/SSM/Zip/QueueDepth", STAMUNIT_COUNT,
+                          "Blocks queued in the compression pipeline");
+        STAM_REL_REG(pVM, &pVM->ssm.s.StatZipCompress,  STAMTYPE_PROFILE, "/SSM/Zip/Compress",  STAMUNIT_TICKS_PER_CALL,
+                     "Compressing a block on a worker thread");
+        STAM_REL_REG(pVM, &pVM->ssm.s.StatZipWrite,     STAMTYPE_PROFILE, "/SSM/Zip/Write",     STAMUNIT_TICKS_PER_CALL,
+                     "Writing a finished block record to the stream (in order)");
+        STAM_REL_REG(pVM, &pVM->ssm.s.StatZipBytesIn,   STAMTYPE_COUNTER, "/SSM/Zip/BytesIn",   STAMUNIT_BYTES,
+                     "Uncompressed bytes submitted to the compression pipeline");
+        STAM_REL_REG(pVM, &pVM->ssm.s.StatZipBytesOut,  STAMTYPE_COUNTER, "/SSM/Zip/BytesOut",  STAMUNIT_BYTES,
+                     "Record bytes written by the compression pipeline");
+        STAM_REL_REG(pVM, &pVM->ssm.s.StatZipStalls,    STAMTYPE_COUNTER, "/SSM/Zip/Stalls",    STAMUNIT_OCCURENCES,
+                     "Times the saving thread had to wait for a compression worker");
     }
 
     pVM->ssm.s.fInitialized = RT_SUCCESS(rc);
@@ -3272,6 +3402,300 @@ DECLINLINE(bool) ssmR3IsHostMsc32(PSSMHANDLE pSSM)
 
 #ifndef SSM_STANDALONE
 
+/**
+ * Compresses one SSM_ZIP_BLOCK_SIZE block into a complete data record.
+ *
+ * Falls back on a raw data record if the block doesn't compress.
+ *
+ * @returns The size of the record (header included).
+ * @param   enmZipType      The block codec.
+ * @param   pvSrc           The block to compress.
+ * @param   pb              The record buffer, SSM_ZIP_BLOCK_REC_MAX bytes.
+ */
+static size_t ssmR3DataCompressBlock(RTZIPTYPE enmZipType, const void *pvSrc, uint8_t *pb)
+{
+    AssertCompile(SSM_ZIP_BLOCK_REC_MAX < 0x00010000);
+    size_t cbRec = SSM_ZIP_BLOCK_SIZE - (SSM_ZIP_BLOCK_SIZE / 16);
+    int rc = RTZipBlockCompress(enmZipType, RTZIPLEVEL_FAST, 0 /*fFlags*/,
+                                pvSrc, SSM_ZIP_BLOCK_SIZE,
+                                pb + 1 + 3 + 1, cbRec, &cbRec);
+    if (RT_SUCCESS(rc))
+    {
+        pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT
+              | (enmZipType == RTZIPTYPE_LZF ? SSM_REC_TYPE_RAW_LZF : SSM_REC_TYPE_RAW_CODEC);
+        pb[4] = SSM_ZIP_BLOCK_SIZE / _1K;
+        cbRec += 1;
+    }
+    else
+    {
+        pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW;
+        memcpy(&pb[4], pvSrc, SSM_ZIP_BLOCK_SIZE);
+        cbRec = SSM_ZIP_BLOCK_SIZE;
+    }
+    pb[1] = (uint8_t)(0xe0 | ( cbRec >> 12));
+    pb[2] = (uint8_t)(0x80 | ((cbRec >>  6) & 0x3f));
+    pb[3] = (uint8_t)(0x80 | ( cbRec        & 0x3f));
+    return cbRec + 1 + 3;
+}
+
+
+/**
+ * Compression pipeline worker thread.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   hSelf           The thread handle.
+ * @param   pvUser          The worker (SSMZIPPIPE::aWorkers entry).
+ */
+static DECLCALLBACK(int) ssmR3ZipPipeWorker(RTTHREAD hSelf, void *pvUser)
+{
+    PSSMZIPWORKER   pWorker = (PSSMZIPWORKER)pvUser;
+    PSSMZIPPIPE     pPipe   = pWorker->pPipe;
+    PVM             pVM     = pPipe->pVM;
+    RT_NOREF(hSelf);
+
+    for (;;)
+    {
+        uint32_t iBlock = ASMAtomicReadU32(&pPipe->iClaim);
+        if (iBlock != ASMAtomicReadU32(&pPipe->iSubmit))
+        {
+            if (!ASMAtomicCmpXchgU32(&pPipe->iClaim, iBlock + 1, iBlock))
+                continue;
+
+            /* Zero blocks are done already.  The state change also guards
+               against a slow worker racing the block being reused. */
+            PSSMZIPBLOCK pBlock = &pPipe->paBlocks[iBlock % pPipe->cBlocks];
+            if (ASMAtomicCmpXchgU32(&pBlock->u32State, SSMZIPBLOCK_STATE_BUSY, SSMZIPBLOCK_STATE_PENDING))
+            {
+                STAM_REL_PROFILE_START(&pVM->ssm.s.StatZipCompress, a);
+                pBlock->cbRec = (uint32_t)ssmR3DataCompressBlock(pPipe->enmZipType, pBlock->abSrc, pBlock->abRec);
+                STAM_REL_PROFILE_STOP(&pVM->ssm.s.StatZipCompress, a);
+                ASMAtomicWriteU32(&pBlock->u32State, SSMZIPBLOCK_STATE_DONE);
+                if (ASMAtomicReadBool(&pPipe->fProducerWaiting))
+                    RTSemEventSignal(pPipe->hEvtDone);
+            }
+        }
+        else
+        {
+            if (ASMAtomicReadBool(&pPipe->fTerminate))
+                break;
+            RTSemEventWait(pWorker->hEvtWork, RT_INDEFINITE_WAIT);
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Destroys the compression pipeline of a save handle, if any.
+ *
+ * Blocks which haven't been written to the stream yet are discarded, so call
+ * ssmR3ZipPipeWrite with cMaxPending=0 first unless bailing out.
+ *
+ * @param   pSSM            The saved state handle.
+ */
+static void ssmR3ZipPipeDestroy(PSSMHANDLE pSSM)
+{
+    PSSMZIPPIPE pPipe = pSSM->u.Write.pZipPipe;
+    if (!pPipe)
+        return;
+    pSSM->u.Write.pZipPipe = NULL;
+
+    ASMAtomicWriteBool(&pPipe->fTerminate, true);
+    for (uint32_t i = 0; i < pPipe->cWorkers; i++)
+        RTSemEventSignal(pPipe->aWorkers[i].hEvtWork);
+    for (uint32_t i = 0; i < pPipe->cWorkers; i++)
+    {
+        int rc = RTThreadWait(pPipe->aWorkers[i].hThread, RT_MS_30SEC, NULL);
+        AssertLogRelRC(rc);
+        RTSemEventDestroy(pPipe->aWorkers[i].hEvtWork);
+    }
+    RTSemEventDestroy(pPipe->hEvtDone);
+    ASMAtomicWriteU32(&pPipe->pVM->ssm.s.cZipQueueDepth, 0);
+
+    RTMemFree(pPipe->paBlocks);
+    RTMemFree(pPipe);
+}
+
+
+/**
+ * Creates the compression pipeline for a save handle.
+ *
+ * The number of worker threads is taken from the "SSM/CompressionThreads"
+ * CFGM value, defaulting to half the online CPUs (max 4).  Zero means the
+ * blocks are compressed inline by the saving thread.  Failures are not fatal,
+ * the save just continues with inline compression.
+ *
+ * @param   pVM             The cross context VM structure.
+ * @param   pSSM            The saved state handle.
+ */
+static void ssmR3ZipPipeCreate(PVM pVM, PSSMHANDLE pSSM)
+{
+    uint32_t cWorkers = RT_MIN(RTMpGetOnlineCount() / 2, 4);
+    int rc = CFGMR3QueryU32Def(CFGMR3GetChild(CFGMR3GetRoot(pVM), "SSM"), "CompressionThreads", &cWorkers, cWorkers);
+    AssertLogRelRCReturnVoid(rc);
+    if (!cWorkers)
+        return;
+    cWorkers = RT_MIN(cWorkers, SSM_ZIP_MAX_THREADS);
+
+    PSSMZIPPIPE pPipe = (PSSMZIPPIPE)RTMemAllocZ(sizeof(*pPipe));
+    if (!pPipe)
+        return;
+    pPipe->pVM        = pVM;
+    pPipe->enmZipType = pSSM->enmZipType;
+    pPipe->cBlocks    = cWorkers * SSM_ZIP_BLOCKS_PER_THREAD;
+    pPipe->hEvtDone   = NIL_RTSEMEVENT;
+    pPipe->paBlocks   = (PSSMZIPBLOCK)RTMemAllocZ(sizeof(pPipe->paBlocks[0]) * pPipe->cBlocks);
+    if (pPipe->paBlocks)
+        rc = RTSemEventCreate(&pPipe->hEvtDone);
+    else
+        rc = VERR_NO_MEMORY;
+    pSSM->u.Write.pZipPipe = pPipe;
+    for (uint32_t i = 0; i < cWorkers && RT_SUCCESS(rc); i++)
+    {
+        pPipe->aWorkers[i].pPipe = pPipe;
+        rc = RTSemEventCreate(&pPipe->aWorkers[i].hEvtWork);
+        if (RT_SUCCESS(rc))
+        {
+            rc = RTThreadCreateF(&pPipe->aWorkers[i].hThread, ssmR3ZipPipeWorker, &pPipe->aWorkers[i], 0,
+                                 RTTHREADTYPE_DEFAULT, RTTHREADFLAGS_WAITABLE, "SSMZip%u", i);
+            if (RT_SUCCESS(rc))
+                pPipe->cWorkers++;
+            else
+                RTSemEventDestroy(pPipe->aWorkers[i].hEvtWork);
+        }
+    }
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("SSM: Failed to create the compression pipeline: %Rrc\n", rc));
+        ssmR3ZipPipeDestroy(pSSM);
+        return;
+    }
+    LogRel(("SSM: Compressing with %u worker threads\n", cWorkers));
+}
+
+
+/**
+ * Writes finished blocks from the compression pipeline to the stream, in
+ * submission order.
+ *
+ * @returns VBox status code.
+ * @param   pSSM            The saved state handle.
+ * @param   cMaxPending     The max number of unwritten blocks to leave in the
+ *                          pipeline.  The call will block until the pipeline
+ *                          is down to this number.  Pass UINT32_MAX to write
+ *                          whatever is ready without blocking, and 0 to drain
+ *                          the pipeline.
+ */
+static int ssmR3ZipPipeWrite(PSSMHANDLE pSSM, uint32_t cMaxPending)
+{
+    PSSMZIPPIPE pPipe = pSSM->u.Write.pZipPipe;
+    PVM         pVM   = pPipe->pVM;
+    int         rc    = VINF_SUCCESS;
+    while (pPipe->iWrite != pPipe->iSubmit)
+    {
+        PSSMZIPBLOCK pBlock = &pPipe->paBlocks[pPipe->iWrite % pPipe->cBlocks];
+        if (ASMAtomicReadU32(&pBlock->u32State) != SSMZIPBLOCK_STATE_DONE)
+        {
+            if (pPipe->iSubmit - pPipe->iWrite <= cMaxPending)
+                break;
+
+            /* Wait for the worker to finish it. */
+            STAM_REL_COUNTER_INC(&pVM->ssm.s.StatZipStalls);
+            ASMAtomicWriteBool(&pPipe->fProducerWaiting, true);
+            if (ASMAtomicReadU32(&pBlock->u32State) != SSMZIPBLOCK_STATE_DONE)
+                RTSemEventWait(pPipe->hEvtDone, RT_INDEFINITE_WAIT);
+            ASMAtomicWriteBool(&pPipe->fProducerWaiting, false);
+            continue;
+        }
+
+        if (pBlock->poffRec)
+            *pBlock->poffRec = ssmR3StrmTell(&pSSM->Strm);
+        STAM_REL_PROFILE_START(&pVM->ssm.s.StatZipWrite, a);
+        rc = ssmR3StrmWrite(&pSSM->Strm, pBlock->abRec, pBlock->cbRec);
+        STAM_REL_PROFILE_STOP(&pVM->ssm.s.StatZipWrite, a);
+        if (RT_FAILURE(rc))
+            break;
+        pSSM->offUnit += pBlock->cbRec;
+        STAM_REL_COUNTER_ADD(&pVM->ssm.s.StatZipBytesOut, pBlock->cbRec);
+
+        ASMAtomicWriteU32(&pBlock->u32State, SSMZIPBLOCK_STATE_FREE);
+        pPipe->iWrite++;
+    }
+    ASMAtomicWriteU32(&pVM->ssm.s.cZipQueueDepth, pPipe->iSubmit - pPipe->iWrite);
+    return rc;
+}
+
+
+/**
+ * Drains the compression pipeline, if active.
+ *
+ * This must be done before anything else is written to the stream.
+ *
+ * @returns VBox status code. Sets pSSM->rc on failure.
+ * @param   pSSM            The saved state handle.
+ */
+DECLINLINE(int) ssmR3ZipPipeDrain(PSSMHANDLE pSSM)
+{
+    if (!pSSM->u.Write.pZipPipe)
+        return VINF_SUCCESS;
+    int rc = ssmR3ZipPipeWrite(pSSM, 0 /*cMaxPending*/);
+    if (RT_FAILURE(rc) && RT_SUCCESS(pSSM->rc))
+        pSSM->rc = rc;
+    return rc;
+}
+
+
+/**
+ * Submits a SSM_ZIP_BLOCK_SIZE block to the compression pipeline.
+ *
+ * @returns VBox status code.
+ * @param   pSSM            The saved state handle.
+ * @param   pvBlock         The block.  Copied, so the caller can reuse it.
+ * @param   fZero           Set if this is an all zero block.  It will then be
+ *                          written as a zero record without going via the
+ *                          workers.
+ * @param   poffRec         Where to store the stream offset of the record once
+ *                          it has been written.  Optional.
+ */
+static int ssmR3ZipPipeSubmit(PSSMHANDLE pSSM, const void *pvBlock, bool fZero, uint64_t *poffRec)
+{
+    PSSMZIPPIPE pPipe = pSSM->u.Write.pZipPipe;
+
+    /* Make room. */
+    if (pPipe->iSubmit - pPipe->iWrite >= pPipe->cBlocks)
+    {
+        int rc = ssmR3ZipPipeWrite(pSSM, pPipe->cBlocks - 1);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    uint32_t const  iBlock = pPipe->iSubmit;
+    PSSMZIPBLOCK    pBlock = &pPipe->paBlocks[iBlock % pPipe->cBlocks];
+    Assert(pBlock->u32State == SSMZIPBLOCK_STATE_FREE);
+    pBlock->poffRec = poffRec;
+    if (fZero)
+    {
+        pBlock->abRec[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_ZERO;
+        pBlock->abRec[1] = 1;
+        pBlock->abRec[2] = SSM_ZIP_BLOCK_SIZE / _1K;
+        pBlock->cbRec    = 3;
+        ASMAtomicWriteU32(&pBlock->u32State, SSMZIPBLOCK_STATE_DONE);
+        ASMAtomicWriteU32(&pPipe->iSubmit, iBlock + 1);
+    }
+    else
+    {
+        memcpy(pBlock->abSrc, pvBlock, SSM_ZIP_BLOCK_SIZE);
+        ASMAtomicWriteU32(&pBlock->u32State, SSMZIPBLOCK_STATE_PENDING);
+        ASMAtomicWriteU32(&pPipe->iSubmit, iBlock + 1);
+        RTSemEventSignal(pPipe->aWorkers[iBlock % pPipe->cWorkers].hEvtWork);
+    }
+    STAM_REL_COUNTER_ADD(&pPipe->pVM->ssm.s.StatZipBytesIn, SSM_ZIP_BLOCK_SIZE);
+
+    /* Opportunistically write whatever is ready. */
+    return ssmR3ZipPipeWrite(pSSM, UINT32_MAX);
+}
+
+
 /**
  * Finishes a data unit.
  * All buffers and compressor instances are flushed and destroyed.
@@ -3424,6 +3848,13 @@ static int ssmR3DataWriteRecHdr(PSSMHANDLE pSSM, size_t cb, uint8_t u8TypeAndFla
  */
 static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
 {
+    /*
+     * Everything in the compression pipeline goes first.
+     */
+    int rc = ssmR3ZipPipeDrain(pSSM);
+    if (RT_FAILURE(rc))
+        return rc;
+
     /*
      * Check how much there current is in the buffer.
      */
@@ -3437,7 +3868,7 @@ static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
      * (No need for fancy optimizations here any longer since the stream is
      * fully buffered.)
      */
-    int rc = ssmR3DataWriteRecHdr(pSSM, cb, SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW);
+    rc = ssmR3DataWriteRecHdr(pSSM, cb, SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW);
     if (RT_SUCCESS(rc))
         rc = ssmR3DataWriteRaw(pSSM, pSSM->u.Write.abDataBuffer, cb);
     ssmR3ProgressByByte(pSSM, cb);
@@ -3455,7 +3886,8 @@ static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
  */
 static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
 {
-    int rc = ssmR3DataFlushBuffer(pSSM);
+    /* Don't drain the compression pipeline unless there is buffered data to flush. */
+    int rc = pSSM->u.Write.offDataBuffer ? ssmR3DataFlushBuffer(pSSM) : pSSM->rc;
     if (RT_SUCCESS(rc))
     {
         pSSM->offUnitUser += cbBuf;
@@ -3467,38 +3899,35 @@ static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
         {
             AssertCompile(SSM_ZIP_BLOCK_SIZE == PAGE_SIZE);
             if (    cbBuf >= SSM_ZIP_BLOCK_SIZE
-                && (    ((uintptr_t)pvBuf & 0xf)
-                    ||  !ASMMemIsZeroPage(pvBuf))
-               )
+                &&  pSSM->u.Write.pZipPipe)
+            {
+                /*
+                 * Hand it to the compression pipeline.
+                 */
+                rc = ssmR3ZipPipeSubmit(pSSM, pvBuf, !((uintptr_t)pvBuf & 0xf) && ASMMemIsZeroPage(pvBuf), NULL /*poffRec*/);
+                if (RT_FAILURE(rc))
+                    break;
+                ssmR3ProgressByByte(pSSM, SSM_ZIP_BLOCK_SIZE);
+
+                /* advance */
+                if (cbBuf == SSM_ZIP_BLOCK_SIZE)
+                    return VINF_SUCCESS;
+                cbBuf -= SSM_ZIP_BLOCK_SIZE;
+                pvBuf = (uint8_t const*)pvBuf + SSM_ZIP_BLOCK_SIZE;
+            }
+            else if (    cbBuf >= SSM_ZIP_BLOCK_SIZE
+                     && (    ((uintptr_t)pvBuf & 0xf)
+                         ||  !ASMMemIsZeroPage(pvBuf))
+                    )
             {
                 /*
                  * Compress it.
                  */
-                AssertCompile(1 + 3 + 1 + SSM_ZIP_BLOCK_SIZE < 0x00010000);
                 uint8_t *pb;
-                rc = ssmR3StrmReserveWriteBufferSpace(&pSSM->Strm, 1 + 3 + 1 + SSM_ZIP_BLOCK_SIZE, &pb);
+                rc = ssmR3StrmReserveWriteBufferSpace(&pSSM->Strm, SSM_ZIP_BLOCK_REC_MAX, &pb);
                 if (RT_FAILURE(rc))
                     break;
-                size_t cbRec = SSM_ZIP_BLOCK_SIZE - (SSM_ZIP_BLOCK_SIZE / 16);
-                rc = RTZipBlockCompress(RTZIPTYPE_LZF, RTZIPLEVEL_FAST, 0 /*fFlags*/,
-                                        pvBuf, SSM_ZIP_BLOCK_SIZE,
-                                        pb + 1 + 3 + 1, cbRec, &cbRec);
-                if (RT_SUCCESS(rc))
-                {
-                    pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_LZF;
-                    pb[4] = SSM_ZIP_BLOCK_SIZE / _1K;
-                    cbRec += 1;
-                }
-                else
-                {
-                    pb[0] = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW;
-                    memcpy(&pb[4], pvBuf, SSM_ZIP_BLOCK_SIZE);
-                    cbRec = SSM_ZIP_BLOCK_SIZE;
-                }
-                pb[1] = (uint8_t)(0xe0 | ( cbRec >> 12));
-                pb[2] = (uint8_t)(0x80 | ((cbRec >>  6) & 0x3f));
-                pb[3] = (uint8_t)(0x80 | ( cbRec        & 0x3f));
-                cbRec += 1 + 3;
+                size_t cbRec = ssmR3DataCompressBlock(pSSM->enmZipType, pvBuf, pb);
                 rc = ssmR3StrmCommitWriteBufferSpace(&pSSM->Strm, cbRec);
                 if (RT_FAILURE(rc))
                     break;
@@ -3538,6 +3967,9 @@ static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
                 /*
                  * Less than one block left, store it the simple way.
                  */
+                rc = ssmR3ZipPipeDrain(pSSM);
+                if (RT_FAILURE(rc))
+                    break;
                 rc = ssmR3DataWriteRecHdr(pSSM, cbBuf, SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW);
                 if (RT_SUCCESS(rc))
                     rc = ssmR3DataWriteRaw(pSSM, pvBuf, cbBuf);
@@ -4358,6 +4790,51 @@ VMMR3DECL(int) SSMR3PutMem(PSSMHANDLE pSSM, const void *pv, size_t cb)
 }
 
 
+/**
+ * Saves a page to the current data unit as a record of its own and reports
+ * where in the stream that record ends up.
+ *
+ * The offset can later be handed to SSMR3ReadPageAt to fetch the page without
+ * reading the stream sequentially.  When the compression pipeline is active,
+ * the offset is not known till the record has been written, which is at the
+ * latest when the data unit is completed.  So, the caller must keep the
+ * variable @a poffRec points to around till then.
+ *
+ * @returns VBox status code.
+ * @param   pSSM            The saved state handle.
+ * @param   pvPage          The page to save (PAGE_SIZE bytes).
+ * @param   poffRec         Where to store the stream offset of the record.
+ */
+VMMR3DECL(int) SSMR3PutPageIndexed(PSSMHANDLE pSSM, const void *pvPage, uint64_t *poffRec)
+{
+    SSM_ASSERT_WRITEABLE_RET(pSSM);
+    SSM_CHECK_CANCELLED_RET(pSSM);
+    AssertPtrReturn(poffRec, VERR_INVALID_POINTER);
+    AssertCompile(SSM_ZIP_BLOCK_SIZE == PAGE_SIZE);
+    *poffRec = UINT64_MAX;
+
+    /*
+     * Anything buffered must go first so the page gets a record of its own.
+     */
+    int rc = pSSM->u.Write.offDataBuffer ? ssmR3DataFlushBuffer(pSSM) : pSSM->rc;
+    if (RT_FAILURE(rc))
+        return rc;
+
+    if (pSSM->u.Write.pZipPipe)
+    {
+        pSSM->offUnitUser += PAGE_SIZE;
+        rc = ssmR3ZipPipeSubmit(pSSM, pvPage, !((uintptr_t)pvPage & 0xf) && ASMMemIsZeroPage(pvPage), poffRec);
+        if (RT_FAILURE(rc) && RT_SUCCESS(pSSM->rc))
+            pSSM->rc = rc;
+        ssmR3ProgressByByte(pSSM, PAGE_SIZE);
+        return rc;
+    }
+
+    *poffRec = ssmR3StrmTell(&pSSM->Strm);
+    return ssmR3DataWriteBig(pSSM, pvPage, PAGE_SIZE);
+}
+
+
 /**
  * Saves a zero terminated string item to the current data unit.
  *
@@ -4583,6 +5060,7 @@ static int ssmR3SaveDoClose(PVM pVM, PSSMHANDLE pSSM)
      * Make it non-cancellable, close the stream and delete the file on failure.
      */
     ssmR3SetCancellable(pVM, pSSM, false);
+    ssmR3ZipPipeDestroy(pSSM);
     int rc = ssmR3StrmClose(&pSSM->Strm, pSSM->rc == VERR_SSM_CANCELLED);
     if (RT_SUCCESS(rc))
         rc = pSSM->rc;
@@ -5111,7 +5589,9 @@ static int ssmR3WriteHeaderAndClearPerUnitData(PVM pVM, PSSMHANDLE pSSM)
     FileHdr.cHostBits    = HC_ARCH_BITS;
     FileHdr.cbGCPhys     = sizeof(RTGCPHYS);
     FileHdr.cbGCPtr      = sizeof(RTGCPTR);
-    FileHdr.u8Reserved   = 0;
+    FileHdr.u8Codec      = pSSM->enmZipType == RTZIPTYPE_LZ4  ? SSMFILEHDR_CODEC_LZ4
+                         : pSSM->enmZipType == RTZIPTYPE_ZSTD ? SSMFILEHDR_CODEC_ZSTD
+                         :                                      SSMFILEHDR_CODEC_LZF;
     FileHdr.cUnits       = pVM->ssm.s.cUnits;
     FileHdr.fFlags       = SSMFILEHDR_FLAGS_STREAM_CRC32;
     if (pSSM->fLiveSave)
@@ -5136,6 +5616,62 @@ static int ssmR3WriteHeaderAndClearPerUnitData(PVM pVM, PSSMHANDLE pSSM)
 }
 
 
+/**
+ * Works out the block compression codec to use for a new saved state.
+ *
+ * The codec is selected by the "SSM/Codec" CFGM value, which can be "LZF"
+ * (default), "LZ4" or "Zstd".  Codecs not supported by the runtime fall back
+ * on LZF.
+ *
+ * Teleportation always uses LZF, as the target may be an older version or
+ * built without the configured codec and would only find out when loading.
+ *
+ * @returns The RTZIPTYPE to use.
+ * @param   pVM                 The cross context VM structure.
+ * @param   enmAfter            What is done after saving.
+ */
+static RTZIPTYPE ssmR3SaveQueryCodec(PVM pVM, SSMAFTER enmAfter)
+{
+    if (enmAfter == SSMAFTER_TELEPORT)
+        return RTZIPTYPE_LZF;
+
+    char szCodec[16];
+    int rc = CFGMR3QueryStringDef(CFGMR3GetChild(CFGMR3GetRoot(pVM), "SSM"), "Codec", szCodec, sizeof(szCodec), "LZF");
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("SSM: Failed to query SSM/Codec: %Rrc, using LZF\n", rc));
+        return RTZIPTYPE_LZF;
+    }
+
+    RTZIPTYPE enmZipType;
+    if (!RTStrICmp(szCodec, "LZF"))
+        return RTZIPTYPE_LZF;
+    if (!RTStrICmp(szCodec, "LZ4"))
+        enmZipType = RTZIPTYPE_LZ4;
+    else if (!RTStrICmp(szCodec, "Zstd"))
+        enmZipType = RTZIPTYPE_ZSTD;
+    else
+    {
+        LogRel(("SSM: Unknown codec '%s', using LZF\n", szCodec));
+        return RTZIPTYPE_LZF;
+    }
+
+    /* Check that the runtime was built with it. */
+    uint8_t abSrc[64];
+    uint8_t abDst[128];
+    size_t  cbDst;
+    RT_ZERO(abSrc);
+    rc = RTZipBlockCompress(enmZipType, RTZIPLEVEL_FAST, 0 /*fFlags*/, abSrc, sizeof(abSrc), abDst, sizeof(abDst), &cbDst);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("SSM: Codec '%s' is not available (%Rrc), using LZF\n", szCodec, rc));
+        return RTZIPTYPE_LZF;
+    }
+    LogRel(("SSM: Using codec '%s'\n", szCodec));
+    return enmZipType;
+}
+
+
 /**
  * Creates a new saved state file.
  *
@@ -5169,6 +5705,7 @@ static int ssmR3SaveDoCreateFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS
     pSSM->offUnit                   = UINT64_MAX;
     pSSM->offUnitUser               = UINT64_MAX;
     pSSM->fLiveSave                 = false;
+    pSSM->enmZipType                = ssmR3SaveQueryCodec(pVM, enmAfter);
     pSSM->pfnProgress               = pfnProgress;
     pSSM->pvUser                    = pvProgressUser;
     pSSM->uPercent                  = 0;
@@ -5183,6 +5720,7 @@ static int ssmR3SaveDoCreateFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS
     pSSM->pszFilename               = pszFilename;
     pSSM->u.Write.offDataBuffer     = 0;
     pSSM->u.Write.cMsMaxDowntime    = UINT32_MAX;
+    pSSM->u.Write.pZipPipe          = NULL;
 
     int rc;
     if (pStreamOps)
@@ -5196,6 +5734,8 @@ static int ssmR3SaveDoCreateFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS
         return rc;
     }
 
+    ssmR3ZipPipeCreate(pVM, pSSM);
+
     *ppSSM = pSSM;
     return VINF_SUCCESS;
 }
@@ -5801,6 +6341,7 @@ VMMR3_INT_DECL(int) SSMR3LiveSave(PVM pVM, uint32_t cMsMaxDowntime,
         return VINF_SUCCESS;
     }
     /* bail out. */
+    ssmR3ZipPipeDestroy(pSSM);
     int rc2 = ssmR3StrmClose(&pSSM->Strm, pSSM->rc == VERR_SSM_CANCELLED);
     RTMemFree(pSSM);
     rc2 = RTFileDelete(pszFilename);
@@ -6016,15 +6557,19 @@ DECLINLINE(int) ssmR3DataReadV2Raw(PSSMHANDLE pSSM, void *pvBuf, size_t cbToRead
 
 
 /**
- * Reads and checks the LZF "header".
+ * Reads and checks the LZF / codec "header".
  *
  * @returns VBox status code. Sets pSSM->rc on error.
  * @param   pSSM            The saved state handle..
  * @param   pcbDecompr      Where to store the size of the decompressed data.
  */
-DECLINLINE(int) ssmR3DataReadV2RawLzfHdr(PSSMHANDLE pSSM, uint32_t *pcbDecompr)
+DECLINLINE(int) ssmR3DataReadV2RawZipHdr(PSSMHANDLE pSSM, uint32_t *pcbDecompr)
 {
     *pcbDecompr = 0; /* shuts up gcc. */
+    AssertLogRelMsgReturn(   (pSSM->u.Read.u8TypeAndFlags & SSM_REC_TYPE_MASK) != SSM_REC_TYPE_RAW_CODEC
+                          || pSSM->enmZipType != RTZIPTYPE_INVALID,
+                          ("Codec record in a stream without a codec\n"),
+                          pSSM->rc = VERR_SSM_INTEGRITY_DECOMPRESSION);
     AssertLogRelMsgReturn(   pSSM->u.Read.cbRecLeft > 1
                           && pSSM->u.Read.cbRecLeft <= RT_SIZEOFMEMB(SSMHANDLE, u.Read.abComprBuffer) + 2,
                           ("%#x\n", pSSM->u.Read.cbRecLeft),
@@ -6048,15 +6593,15 @@ DECLINLINE(int) ssmR3DataReadV2RawLzfHdr(PSSMHANDLE pSSM, uint32_t *pcbDecompr)
 
 
 /**
- * Reads an LZF block from the stream and decompresses into the specified
- * buffer.
+ * Reads an LZF or codec compressed block from the stream and decompresses into
+ * the specified buffer.
  *
  * @returns VBox status code. Sets pSSM->rc on error.
  * @param   pSSM            The saved state handle.
  * @param   pvDst           Pointer to the output buffer.
  * @param   cbDecompr       The size of the decompressed data.
  */
-static int ssmR3DataReadV2RawLzf(PSSMHANDLE pSSM, void *pvDst, size_t cbDecompr)
+static int ssmR3DataReadV2RawZip(PSSMHANDLE pSSM, void *pvDst, size_t cbDecompr)
 {
     int         rc;
     uint32_t    cbCompr    = pSSM->u.Read.cbRecLeft;
@@ -6083,7 +6628,9 @@ static int ssmR3DataReadV2RawLzf(PSSMHANDLE pSSM, void *pvDst, size_t cbDecompr)
      * Decompress it.
      */
     size_t cbDstActual;
-    rc = RTZipBlockDecompress(RTZIPTYPE_LZF, 0 /*fFlags*/,
+    RTZIPTYPE const enmZipType = (pSSM->u.Read.u8TypeAndFlags & SSM_REC_TYPE_MASK) == SSM_REC_TYPE_RAW_LZF
+                               ? RTZIPTYPE_LZF : pSSM->enmZipType;
+    rc = RTZipBlockDecompress(enmZipType, 0 /*fFlags*/,
                               pb, cbCompr, NULL /*pcbSrcActual*/,
                               pvDst, cbDecompr, &cbDstActual);
     if (RT_SUCCESS(rc))
@@ -6360,20 +6907,21 @@ static int ssmR3DataReadUnbufferedV2(PSSMHANDLE pSSM, void *pvBuf, size_t cbBuf)
             }
 
             case SSM_REC_TYPE_RAW_LZF:
+            case SSM_REC_TYPE_RAW_CODEC:
             {
-                int rc = ssmR3DataReadV2RawLzfHdr(pSSM, &cbToRead);
+                int rc = ssmR3DataReadV2RawZipHdr(pSSM, &cbToRead);
                 if (RT_FAILURE(rc))
                     return rc;
                 if (cbToRead <= cbBuf)
                 {
-                    rc = ssmR3DataReadV2RawLzf(pSSM, pvBuf, cbToRead);
+                    rc = ssmR3DataReadV2RawZip(pSSM, pvBuf, cbToRead);
                     if (RT_FAILURE(rc))
                         return rc;
                 }
                 else
                 {
                     /* The output buffer is too small, use the data buffer. */
-                    rc = ssmR3DataReadV2RawLzf(pSSM, &pSSM->u.Read.abDataBuffer[0], cbToRead);
+                    rc = ssmR3DataReadV2RawZip(pSSM, &pSSM->u.Read.abDataBuffer[0], cbToRead);
                     if (RT_FAILURE(rc))
                         return rc;
                     pSSM->u.Read.cbDataBuffer  = cbToRead;
@@ -6483,11 +7031,12 @@ static int ssmR3DataReadBufferedV2(PSSMHANDLE pSSM, void *pvBuf, size_t cbBuf)
             }
 
             case SSM_REC_TYPE_RAW_LZF:
+            case SSM_REC_TYPE_RAW_CODEC:
             {
-                int rc = ssmR3DataReadV2RawLzfHdr(pSSM, &cbToRead);
+                int rc = ssmR3DataReadV2RawZipHdr(pSSM, &cbToRead);
                 if (RT_FAILURE(rc))
                     return rc;
-                rc = ssmR3DataReadV2RawLzf(pSSM, &pSSM->u.Read.abDataBuffer[0], cbToRead);
+                rc = ssmR3DataReadV2RawZip(pSSM, &pSSM->u.Read.abDataBuffer[0], cbToRead);
                 if (RT_FAILURE(rc))
                     return rc;
                 pSSM->u.Read.cbDataBuffer = cbToRead;
@@ -7769,6 +8318,125 @@ VMMR3DECL(int) SSMR3SkipToEndOfUnit(PSSMHANDLE pSSM)
 }
 
 
+#ifndef SSM_STANDALONE
+/**
+ * Skips to the end of the current data unit by repositioning the stream.
+ *
+ * This is SSMR3SkipToEndOfUnit for units with lots of data that the caller
+ * intends to read later via SSMR3ReadPageAt.  For file streams, the directory
+ * is used to locate the termination record of the unit and the stream is
+ * moved there without reading anything in-between.  Since the skipped bytes
+ * are never seen, stream checksumming is disabled for the rest of the load.
+ * Other streams fall back on SSMR3SkipToEndOfUnit.
+ *
+ * @returns VBox status code.
+ * @param   pSSM                The saved state handle.
+ */
+VMMR3DECL(int) SSMR3SeekToEndOfUnit(PSSMHANDLE pSSM)
+{
+    SSM_ASSERT_READABLE_RET(pSSM);
+    SSM_CHECK_CANCELLED_RET(pSSM);
+    PSSMSTRM pStrm = &pSSM->Strm;
+    if (   pSSM->u.Read.uFmtVerMajor < 2
+        || pSSM->u.Read.fEndOfData
+        || pSSM->u.Read.cbRecLeft
+        || pSSM->u.Read.offDataBuffer != pSSM->u.Read.cbDataBuffer
+        || !ssmR3StrmIsFile(pStrm))
+        return SSMR3SkipToEndOfUnit(pSSM);
+
+    /*
+     * Stop the I/O thread so we can peek at the directory and footer.
+     */
+    bool const fIoThread = pStrm->hIoThread != NIL_RTTHREAD;
+    ssmR3StrmStopIoThread(pStrm);
+
+    uint64_t const  offCur = ssmR3StrmTell(pStrm);
+    uint64_t        offFooter;
+    SSMFILEFTR      Footer;
+    int rc = ssmR3StrmPeekAt(pStrm, -(RTFOFF)sizeof(Footer), &Footer, sizeof(Footer), &offFooter);
+    if (   RT_SUCCESS(rc)
+        && (   memcmp(Footer.szMagic, SSMFILEFTR_MAGIC, sizeof(Footer.szMagic))
+            || Footer.cDirEntries >= _64K))
+        rc = VERR_SSM_INTEGRITY_FOOTER;
+    PSSMFILEDIR pDir  = NULL;
+    size_t      cbDir = 0;
+    if (RT_SUCCESS(rc))
+    {
+        cbDir = RT_UOFFSETOF_DYN(SSMFILEDIR, aEntries[Footer.cDirEntries]);
+        pDir  = (PSSMFILEDIR)RTMemTmpAlloc(cbDir);
+        if (pDir)
+            rc = ssmR3StrmPeekAt(pStrm, offFooter - cbDir, pDir, cbDir, NULL);
+        else
+            rc = VERR_NO_TMP_MEMORY;
+    }
+
+    /*
+     * The termination record sits right before the header of the next unit,
+     * or before the end unit header when there are no more units.
+     */
+    uint64_t offTerm = UINT64_MAX;
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t offNext = offFooter - cbDir - RT_UOFFSETOF(SSMFILEUNITHDRV2, szName);
+        for (uint32_t i = 0; i < Footer.cDirEntries; i++)
+            if (   pDir->aEntries[i].off > offCur
+                && pDir->aEntries[i].off < offNext)
+                offNext = pDir->aEntries[i].off;
+        if (offNext >= offCur + sizeof(SSMRECTERM))
+            offTerm = offNext - sizeof(SSMRECTERM);
+        else
+            rc = VERR_SSM_INTEGRITY_DIR;
+    }
+    RTMemTmpFree(pDir);
+
+    if (RT_SUCCESS(rc))
+    {
+        /* Recycle the read-ahead buffers, ssmR3StrmSeek would free them. */
+        PSSMSTRMBUF pBuf = pStrm->pPending;
+        pStrm->pPending = NULL;
+        while (pBuf)
+        {
+            PSSMSTRMBUF pNext = pBuf->pNext;
+            ssmR3StrmPutFreeBuf(pStrm, pBuf);
+            pBuf = pNext;
+        }
+        pBuf = ASMAtomicXchgPtrT(&pStrm->pHead, NULL, PSSMSTRMBUF);
+        while (pBuf)
+        {
+            PSSMSTRMBUF pNext = pBuf->pNext;
+            ssmR3StrmPutFreeBuf(pStrm, pBuf);
+            pBuf = pNext;
+        }
+
+        ssmR3StrmDisableChecksumming(pStrm);
+        rc = ssmR3StrmSeek(pStrm, offTerm, RTFILE_SEEK_BEGIN, 0 /*u32CurCRC*/);
+        if (RT_SUCCESS(rc))
+        {
+            Log(("SSMR3SeekToEndOfUnit: %#llx -> %#llx\n", offCur, offTerm));
+            pSSM->offUnit += offTerm - offCur;
+            ssmR3ProgressByByte(pSSM, offTerm - offCur);
+            pSSM->u.Read.cbDataBuffer  = 0;
+            pSSM->u.Read.offDataBuffer = 0;
+        }
+    }
+    if (fIoThread)
+        ssmR3StrmStartIoThread(pStrm);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("SSM: Failed to seek to the end of the unit at %#llx: %Rrc\n", offCur, rc));
+        return pSSM->rc = rc;
+    }
+
+    /* Read the termination record. */
+    rc = ssmR3DataReadRecHdrV2(pSSM);
+    if (RT_FAILURE(rc))
+        return pSSM->rc = rc;
+    AssertLogRelReturn(pSSM->u.Read.fEndOfData, pSSM->rc = VERR_SSM_INTEGRITY_REC_TERM);
+    return VINF_SUCCESS;
+}
+#endif /* !SSM_STANDALONE */
+
+
 /**
  * Calculate the checksum of a file portion.
  *
@@ -8028,10 +8696,14 @@ static int ssmR3HeaderAndValidate(PSSMHANDLE pSSM, bool fChecksumIt, bool fCheck
         {
             /* validate the header. */
             SSM_CHECK_CRC32_RET(&uHdr.v2_0, sizeof(uHdr.v2_0), ("Header CRC mismatch: %08x, correct is %08x\n", u32CRC, u32ActualCRC));
-            if (uHdr.v2_0.u8Reserved)
+            switch (uHdr.v2_0.u8Codec)
             {
-                LogRel(("SSM: Reserved header field isn't zero: %02x\n", uHdr.v2_0.u8Reserved));
-                return VERR_SSM_INTEGRITY;
+                case SSMFILEHDR_CODEC_LZF:  pSSM->enmZipType = RTZIPTYPE_INVALID; break;
+                case SSMFILEHDR_CODEC_LZ4:  pSSM->enmZipType = RTZIPTYPE_LZ4; break;
+                case SSMFILEHDR_CODEC_ZSTD: pSSM->enmZipType = RTZIPTYPE_ZSTD; break;
+                default:
+                    LogRel(("SSM: Unknown codec in header: %02x\n", uHdr.v2_0.u8Codec));
+                    return VERR_SSM_INTEGRITY;
             }
             if (uHdr.v2_0.fFlags & ~(SSMFILEHDR_FLAGS_STREAM_CRC32 | SSMFILEHDR_FLAGS_STREAM_LIVE_SAVE))
             {
@@ -8249,6 +8921,7 @@ static int ssmR3OpenFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS pStreamO
     pSSM->offUnit               = UINT64_MAX;
     pSSM->offUnitUser           = UINT64_MAX;
     pSSM->fLiveSave             = false;
+    pSSM->enmZipType            = RTZIPTYPE_INVALID;
     pSSM->pfnProgress           = NULL;
     pSSM->pvUser                = NULL;
     pSSM->uPercent              = 0;
@@ -8777,6 +9450,9 @@ static int ssmR3LoadDirectoryAndFooter(PSSMHANDLE pSSM)
     rc = ssmR3StrmRead(&pSSM->Strm, &Footer, sizeof(Footer));
     if (RT_FAILURE(rc))
         return rc;
+    /* Can't verify the stream CRC if SSMR3SeekToEndOfUnit skipped parts of it. */
+    if (pSSM->u.Read.fStreamCrc32 && !pSSM->Strm.fChecksummed)
+        u32StreamCRC = Footer.u32StreamCRC;
     return ssmR3ValidateFooter(&Footer, off, DirHdr.cEntries, pSSM->u.Read.fStreamCrc32, u32StreamCRC);
 }
 
@@ -9670,6 +10346,105 @@ VMMR3DECL(int) SSMR3Seek(PSSMHANDLE pSSM, const char *pszUnit, uint32_t iInstanc
 }
 
 
+/**
+ * Reads a page saved by SSMR3PutPageIndexed.
+ *
+ * This does not disturb the current position of the handle and works directly
+ * on the file, so the data is not covered by any stream checksum.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_SSM_INTEGRITY_REC_HDR if @a offRec doesn't point to a page
+ *          record.
+ *
+ * @param   pSSM            The SSM handle returned by SSMR3Open().
+ * @param   offRec          The record offset returned by SSMR3PutPageIndexed.
+ * @param   pvPage          Where to return the page (PAGE_SIZE bytes).
+ *
+ * @thread  Any, but the caller is responsible for serializing calls per handle.
+ */
+VMMR3DECL(int) SSMR3ReadPageAt(PSSMHANDLE pSSM, uint64_t offRec, void *pvPage)
+{
+    AssertPtrReturn(pSSM, VERR_INVALID_PARAMETER);
+    AssertMsgReturn(pSSM->enmAfter == SSMAFTER_OPENED, ("%d\n", pSSM->enmAfter),VERR_INVALID_PARAMETER);
+    AssertMsgReturn(pSSM->enmOp == SSMSTATE_OPEN_READ, ("%d\n", pSSM->enmOp), VERR_INVALID_PARAMETER);
+    AssertPtrReturn(pvPage, VERR_INVALID_POINTER);
+    AssertReturn(pSSM->u.Read.uFmtVerMajor >= 2, VERR_NOT_SUPPORTED);
+    AssertCompile(SSM_ZIP_BLOCK_SIZE == PAGE_SIZE);
+
+    /*
+     * Read and decode the record header.  Page records never need more than
+     * four header bytes, and the fifth is the size byte of the zero and
+     * compressed records.
+     */
+    uint8_t abHdr[5];
+    int rc = ssmR3StrmPeekAt(&pSSM->Strm, (RTFOFF)offRec, abHdr, sizeof(abHdr), NULL);
+    if (RT_FAILURE(rc))
+        return rc;
+    AssertLogRelMsgReturn(SSM_REC_ARE_TYPE_AND_FLAGS_VALID(abHdr[0]), ("%#llx: %.*Rhxs\n", offRec, sizeof(abHdr), abHdr),
+                          VERR_SSM_INTEGRITY_REC_HDR);
+    uint32_t cbHdr;
+    uint32_t cbRec;
+    if (!(abHdr[1] & 0x80))
+    {
+        cbHdr = 2;
+        cbRec = abHdr[1];
+    }
+    else if ((abHdr[1] & 0xe0) == 0xc0)
+    {
+        cbHdr = 3;
+        cbRec = ((uint32_t)(abHdr[1] & 0x1f) << 6) | (abHdr[2] & 0x3f);
+    }
+    else if ((abHdr[1] & 0xf0) == 0xe0)
+    {
+        cbHdr = 4;
+        cbRec = ((uint32_t)(abHdr[1] & 0x0f) << 12) | ((uint32_t)(abHdr[2] & 0x3f) << 6) | (abHdr[3] & 0x3f);
+    }
+    else
+        AssertLogRelMsgFailedReturn(("%#llx: %.*Rhxs\n", offRec, sizeof(abHdr), abHdr), VERR_SSM_INTEGRITY_REC_HDR);
+
+    switch (abHdr[0] & SSM_REC_TYPE_MASK)
+    {
+        case SSM_REC_TYPE_RAW:
+            AssertLogRelMsgReturn(cbRec == PAGE_SIZE, ("%#llx: cbRec=%#x\n", offRec, cbRec), VERR_SSM_INTEGRITY_REC_HDR);
+            return ssmR3StrmPeekAt(&pSSM->Strm, (RTFOFF)(offRec + cbHdr), pvPage, PAGE_SIZE, NULL);
+
+        case SSM_REC_TYPE_RAW_ZERO:
+            AssertLogRelMsgReturn(cbRec == 1 && abHdr[cbHdr] == PAGE_SIZE / _1K,
+                                  ("%#llx: %.*Rhxs\n", offRec, sizeof(abHdr), abHdr), VERR_SSM_INTEGRITY_REC_HDR);
+            ASMMemZeroPage(pvPage);
+            return VINF_SUCCESS;
+
+        case SSM_REC_TYPE_RAW_LZF:
+        case SSM_REC_TYPE_RAW_CODEC:
+        {
+            AssertLogRelMsgReturn(   cbRec > 1
+                                  && cbRec - 1 < PAGE_SIZE
+                                  && abHdr[cbHdr] == PAGE_SIZE / _1K,
+                                  ("%#llx: %.*Rhxs\n", offRec, sizeof(abHdr), abHdr), VERR_SSM_INTEGRITY_REC_HDR);
+            RTZIPTYPE const enmZipType = (abHdr[0] & SSM_REC_TYPE_MASK) == SSM_REC_TYPE_RAW_LZF
+                                       ? RTZIPTYPE_LZF : pSSM->enmZipType;
+            AssertLogRelReturn(enmZipType != RTZIPTYPE_INVALID, VERR_SSM_INTEGRITY_DECOMPRESSION);
+
+            uint8_t  abCompr[PAGE_SIZE];
+            uint32_t cbCompr = cbRec - 1;
+            rc = ssmR3StrmPeekAt(&pSSM->Strm, (RTFOFF)(offRec + cbHdr + 1), abCompr, cbCompr, NULL);
+            if (RT_FAILURE(rc))
+                return rc;
+
+            size_t cbDstActual = 0;
+            rc = RTZipBlockDecompress(enmZipType, 0 /*fFlags*/, abCompr, cbCompr, NULL /*pcbSrcActual*/,
+                                      pvPage, PAGE_SIZE, &cbDstActual);
+            AssertLogRelMsgReturn(RT_SUCCESS(rc) && cbDstActual == PAGE_SIZE,
+                                  ("%#llx: rc=%Rrc cbDstActual=%#zx\n", offRec, rc, cbDstActual), VERR_SSM_INTEGRITY_DECOMPRESSION);
+            return VINF_SUCCESS;
+        }
+
+        default:
+            AssertLogRelMsgFailedReturn(("%#llx: %.*Rhxs\n", offRec, sizeof(abHdr), abHdr), VERR_SSM_INTEGRITY_REC_HDR);
+    }
+}
+
+
 
 /* ... Misc APIs ... */
 /* ... Misc APIs ... */
@@ -9842,6 +10617,21 @@ VMMR3DECL(uint32_t)     SSMR3HandleVersion(PSSMHANDLE pSSM)
 }
 
 
+/**
+ * Gets the name of the file the saved state is being loaded from or saved to.
+ *
+ * @returns Pointer to a read only string, NULL if not a file stream (remote
+ *          machine or custom stream methods).  Only valid for the duration
+ *          of the save or load operation.
+ * @param   pSSM            The saved state handle.
+ */
+VMMR3DECL(const char *) SSMR3HandleFilename(PSSMHANDLE pSSM)
+{
+    SSM_ASSERT_VALID_HANDLE(pSSM);
+    return pSSM->pszFilename;
+}
+
+
 /**
  * Get the host OS and architecture where the saved state was created.
  *
@@ -21,7 +21,10 @@
  * with a somewhat uniform way of accessing VMM statistics.  STAM sports a
  * couple of different APIs for accessing them: STAMR3EnumU, STAMR3SnapshotU,
  * STAMR3DumpU, STAMR3DumpToReleaseLogU and the debugger.  Main is exposing the
- * XML based one, STAMR3SnapshotU.
+ * XML based one, STAMR3SnapshotU.  For monitoring many VMs there is also a
+ * binary export in shared memory that is updated by a background thread and
+ * can be scraped without calling into the VM process, see grp_stam_export and
+ * the VBoxStamReader tool.
  *
  * The rest of the VMM together with the devices and drivers registers their
  * statistics with STAM giving them a name.  The name is hierarchical, the
@@ -51,6 +54,7 @@
 #define LOG_GROUP LOG_GROUP_STAM
 #include <VBox/vmm/stam.h>
 #include "STAMInternal.h"
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/vmcc.h>
 
 #include <VBox/err.h>
@@ -62,6 +66,7 @@
 #include <iprt/mem.h>
 #include <iprt/stream.h>
 #include <iprt/string.h>
+#include <iprt/time.h>
 
 
 /*********************************************************************************************************************************
@@ -156,6 +161,7 @@ static bool                 stamR3MultiMatch(const char * const *papszExpression
 static char **              stamR3SplitPattern(const char *pszPat, unsigned *pcExpressions, char **ppszCopy);
 static int                  stamR3EnumU(PUVM pUVM, const char *pszPat, bool fUpdateRing0, int (pfnCallback)(PSTAMDESC pDesc, void *pvArg), void *pvArg);
 static void                 stamR3Ring0StatsRegisterU(PUVM pUVM);
+static void                 stamR3ExportStop(PUVM pUVM);
 
 #ifdef VBOX_WITH_DEBUGGER
 static FNDBGCCMD            stamR3CmdStats;
@@ -338,6 +344,11 @@ VMMR3DECL(int) STAMR3InitUVM(PUVM pUVM)
  */
 VMMR3DECL(void) STAMR3TermUVM(PUVM pUVM)
 {
+    /*
+     * Make sure the export is stopped (STAMR3Term normally did this).
+     */
+    stamR3ExportStop(pUVM);
+
     /*
      * Free used memory and the RWLock.
      */
@@ -1545,6 +1556,7 @@ static int stamR3RegisterU(PUVM pUVM, void *pvSample, PFNSTAMR3CALLBACKRESET pfn
         case STAMTYPE_COUNTER:
         case STAMTYPE_PROFILE:
         case STAMTYPE_PROFILE_ADV:
+        case STAMTYPE_HISTOGRAM:
             AssertMsg(!((uintptr_t)pvSample & 7), ("%p - %s\n", pvSample, pszName));
             break;
 
@@ -1617,6 +1629,7 @@ static int stamR3RegisterU(PUVM pUVM, void *pvSample, PFNSTAMR3CALLBACKRESET pfn
         stamR3LookupIncUsage(pLookup);
 
         stamR3ResetOne(pNew, pUVM->pVM);
+        pUVM->stam.s.uGeneration++;
         rc = VINF_SUCCESS;
     }
     else
@@ -1631,10 +1644,12 @@ static int stamR3RegisterU(PUVM pUVM, void *pvSample, PFNSTAMR3CALLBACKRESET pfn
  * Destroys the statistics descriptor, unlinking it and freeing all resources.
  *
  * @returns VINF_SUCCESS
+ * @param   pUVM        Pointer to the user mode VM structure.
  * @param   pCur        The descriptor to destroy.
  */
-static int stamR3DestroyDesc(PSTAMDESC pCur)
+static int stamR3DestroyDesc(PUVM pUVM, PSTAMDESC pCur)
 {
+    pUVM->stam.s.uGeneration++;
     RTListNodeRemove(&pCur->ListEntry);
     pCur->pLookup->pDesc = NULL; /** @todo free lookup nodes once it's working. */
     stamR3LookupDecUsage(pCur->pLookup);
@@ -1675,7 +1690,7 @@ VMMR3DECL(int)  STAMR3DeregisterByAddr(PUVM pUVM, void *pvSample)
     RTListForEachSafe(&pUVM->stam.s.List, pCur, pNext, STAMDESC, ListEntry)
     {
         if (pCur->u.pv == pvSample)
-            rc = stamR3DestroyDesc(pCur);
+            rc = stamR3DestroyDesc(pUVM, pCur);
     }
 
     STAM_UNLOCK_WR(pUVM);
@@ -1708,7 +1723,7 @@ static int stamR3DeregisterByPattern(PUVM pUVM, const char *pszPat)
             PSTAMDESC pNext = RTListNodeGetNext(&pCur->ListEntry, STAMDESC, ListEntry);
 
             if (RTStrSimplePatternMatch(pszPat, pCur->pszName))
-                rc = stamR3DestroyDesc(pCur);
+                rc = stamR3DestroyDesc(pUVM, pCur);
 
             /* advance. */
             if (pCur == pLast)
@@ -1823,7 +1838,7 @@ VMMR3DECL(int)  STAMR3DeregisterByPrefix(PUVM pUVM, const char *pszPrefix)
             PSTAMDESC const pNext = RTListNodeGetNext(&pCur->ListEntry, STAMDESC, ListEntry);
             Assert(strncmp(pCur->pszName, pszPrefix, cchPrefix) == 0);
 
-            rc = stamR3DestroyDesc(pCur);
+            rc = stamR3DestroyDesc(pUVM, pCur);
 
             /* advance. */
             if (pCur == pLast)
@@ -1949,6 +1964,14 @@ static int stamR3ResetOne(PSTAMDESC pDesc, void *pvArg)
             ASMAtomicXchgU64(&pDesc->u.pProfile->cTicksMin, UINT64_MAX);
             break;
 
+        case STAMTYPE_HISTOGRAM:
+            ASMAtomicXchgU64(&pDesc->u.pHistogram->cSamples, 0);
+            ASMAtomicXchgU64(&pDesc->u.pHistogram->cTotal, 0);
+            ASMAtomicXchgU64(&pDesc->u.pHistogram->cMax, 0);
+            for (unsigned i = 0; i < RT_ELEMENTS(pDesc->u.pHistogram->acBuckets); i++)
+                ASMAtomicXchgU64(&pDesc->u.pHistogram->acBuckets[i], 0);
+            break;
+
         case STAMTYPE_RATIO_U32_RESET:
             ASMAtomicXchgU32(&pDesc->u.pRatioU32->u32A, 0);
             ASMAtomicXchgU32(&pDesc->u.pRatioU32->u32B, 0);
@@ -2087,6 +2110,27 @@ static int stamR3SnapshotOne(PSTAMDESC pDesc, void *pvArg)
                                  pDesc->u.pProfile->cTicksMax);
             break;
 
+        case STAMTYPE_HISTOGRAM:
+        {
+            PCSTAMHISTOGRAM pHistogram = pDesc->u.pHistogram;
+            if (pDesc->enmVisibility == STAMVISIBILITY_USED && pHistogram->cSamples == 0)
+                return VINF_SUCCESS;
+            stamR3SnapshotPrintf(pThis, "<Histogram cSamples=\"%lld\" cTotal=\"%lld\" cMax=\"%lld\" p50=\"%lld\" p99=\"%lld\" p999=\"%lld\"",
+                                 pHistogram->cSamples, pHistogram->cTotal, pHistogram->cMax,
+                                 STAMHistogramPercentile(pHistogram, 500), STAMHistogramPercentile(pHistogram, 990),
+                                 STAMHistogramPercentile(pHistogram, 999));
+
+            /* The buckets as a comma separated list, leaving out the trailing empty ones. */
+            unsigned cBuckets = RT_ELEMENTS(pHistogram->acBuckets);
+            while (cBuckets > 1 && !pHistogram->acBuckets[cBuckets - 1])
+                cBuckets--;
+            stamR3SnapshotPrintf(pThis, " buckets=\"");
+            for (unsigned i = 0; i < cBuckets; i++)
+                stamR3SnapshotPrintf(pThis, i ? ",%llu" : "%llu", pHistogram->acBuckets[i]);
+            stamR3SnapshotPrintf(pThis, "\"");
+            break;
+        }
+
         case STAMTYPE_RATIO_U32:
         case STAMTYPE_RATIO_U32_RESET:
             if (pDesc->enmVisibility == STAMVISIBILITY_USED && !pDesc->u.pRatioU32->u32A && !pDesc->u.pRatioU32->u32B)
@@ -2467,6 +2511,20 @@ static int stamR3PrintOne(PSTAMDESC pDesc, void *pvArg)
             break;
         }
 
+        case STAMTYPE_HISTOGRAM:
+        {
+            PCSTAMHISTOGRAM pHistogram = pDesc->u.pHistogram;
+            if (pDesc->enmVisibility == STAMVISIBILITY_USED && pHistogram->cSamples == 0)
+                return VINF_SUCCESS;
+
+            uint64_t u64 = pHistogram->cSamples ? pHistogram->cSamples : 1;
+            pArgs->pfnPrintf(pArgs, "%-32s %8llu %s (%7llu times, p50 %7llu, p99 %9llu, p999 %9llu, max %9llu)\n", pDesc->pszName,
+                             pHistogram->cTotal / u64, STAMR3GetUnit(pDesc->enmUnit), pHistogram->cSamples,
+                             STAMHistogramPercentile(pHistogram, 500), STAMHistogramPercentile(pHistogram, 990),
+                             STAMHistogramPercentile(pHistogram, 999), pHistogram->cMax);
+            break;
+        }
+
         case STAMTYPE_RATIO_U32:
         case STAMTYPE_RATIO_U32_RESET:
             if (pDesc->enmVisibility == STAMVISIBILITY_USED && !pDesc->u.pRatioU32->u32A && !pDesc->u.pRatioU32->u32B)
@@ -3020,6 +3078,437 @@ VMMR3DECL(const char *) STAMR3GetUnit(STAMUNIT enmUnit)
     }
 }
 
+
+/**
+ * Gets the number of values a sample occupies in the export value array.
+ *
+ * @returns Value count, 0 if the sample isn't exported.
+ * @param   pDesc       The sample.
+ */
+static uint32_t stamR3ExportValueCount(PSTAMDESC pDesc)
+{
+    switch (pDesc->enmType)
+    {
+        case STAMTYPE_CALLBACK:
+            return 0;
+        case STAMTYPE_PROFILE:
+        case STAMTYPE_PROFILE_ADV:
+            return 4;
+        case STAMTYPE_RATIO_U32:
+        case STAMTYPE_RATIO_U32_RESET:
+            return 2;
+        case STAMTYPE_HISTOGRAM:
+            return 3 + STAM_HISTOGRAM_BUCKETS;
+        default:
+            return 1;
+    }
+}
+
+
+/**
+ * Rewrites the sample table and the string table of the export.
+ *
+ * Called with the STAM lock held for reading and the sequence number odd.
+ *
+ * @param   pUVM        Pointer to the user mode VM structure.
+ * @param   pExport     The export state.
+ */
+static void stamR3ExportWriteLayout(PUVM pUVM, PSTAMEXPORT pExport)
+{
+    PSTAMEXPORTHDR  pHdr    = pExport->pHdr;
+    uint8_t        *pbShMem = (uint8_t *)pHdr;
+    size_t const    cbShMem = pExport->cbShMem;
+
+    /*
+     * Size it up first, dropping the tail if it doesn't fit.  The unit
+     * strings go first in the string table.
+     */
+    size_t cbUnits = 0;
+    for (unsigned iUnit = STAMUNIT_INVALID + 1; iUnit < STAMUNIT_END; iUnit++)
+        cbUnits += strlen(STAMR3GetUnit((STAMUNIT)iUnit)) + 1;
+
+    uint32_t  fFlags    = 0;
+    uint32_t  cSamples  = 0;
+    uint32_t  cValues   = 0;
+    size_t    cbStrings = cbUnits;
+    PSTAMDESC pCur;
+    RTListForEach(&pUVM->stam.s.List, pCur, STAMDESC, ListEntry)
+    {
+        uint32_t const cSampleValues = stamR3ExportValueCount(pCur);
+        if (!cSampleValues)
+            continue;
+        size_t const cbSampleStrings = strlen(pCur->pszName) + 1 + (pCur->pszDesc ? strlen(pCur->pszDesc) + 1 : 0);
+        size_t const cbNeeded = RT_ALIGN_Z(sizeof(*pHdr), 64)
+                              + RT_ALIGN_Z((cSamples + 1) * sizeof(STAMEXPORTSAMPLE), 64)
+                              + (cValues + cSampleValues) * sizeof(uint64_t)
+                              + cbStrings + cbSampleStrings;
+        if (cbNeeded > cbShMem)
+        {
+            fFlags |= STAMEXPORTHDR_F_TRUNCATED;
+            break;
+        }
+        cSamples++;
+        cValues   += cSampleValues;
+        cbStrings += cbSampleStrings;
+    }
+
+    uint32_t const offSamples = RT_ALIGN_32(sizeof(*pHdr), 64);
+    uint32_t const offValues  = RT_ALIGN_32(offSamples + cSamples * sizeof(STAMEXPORTSAMPLE), 64);
+    uint32_t const offStrings = offValues + cValues * sizeof(uint64_t);
+
+    /*
+     * Write the tables.
+     */
+    char    *pszStrings = (char *)&pbShMem[offStrings];
+    uint32_t offString  = 0;
+    uint32_t aoffUnits[STAMUNIT_END];
+    aoffUnits[STAMUNIT_INVALID] = 0;
+    for (unsigned iUnit = STAMUNIT_INVALID + 1; iUnit < STAMUNIT_END; iUnit++)
+    {
+        const char  *pszUnit = STAMR3GetUnit((STAMUNIT)iUnit);
+        size_t const cbUnit  = strlen(pszUnit) + 1;
+        memcpy(&pszStrings[offString], pszUnit, cbUnit);
+        aoffUnits[iUnit] = offString;
+        offString += (uint32_t)cbUnit;
+    }
+
+    PSTAMEXPORTSAMPLE paSamples = (PSTAMEXPORTSAMPLE)&pbShMem[offSamples];
+    uint32_t          iSample   = 0;
+    uint32_t          iValue    = 0;
+    RTListForEach(&pUVM->stam.s.List, pCur, STAMDESC, ListEntry)
+    {
+        if (iSample >= cSamples)
+            break;
+        uint32_t const cSampleValues = stamR3ExportValueCount(pCur);
+        if (!cSampleValues)
+            continue;
+
+        PSTAMEXPORTSAMPLE pSample = &paSamples[iSample++];
+        pSample->offName     = offString;
+        size_t cb = strlen(pCur->pszName) + 1;
+        memcpy(&pszStrings[offString], pCur->pszName, cb);
+        offString += (uint32_t)cb;
+        if (pCur->pszDesc)
+        {
+            pSample->offDesc = offString;
+            cb = strlen(pCur->pszDesc) + 1;
+            memcpy(&pszStrings[offString], pCur->pszDesc, cb);
+            offString += (uint32_t)cb;
+        }
+        else
+            pSample->offDesc = UINT32_MAX;
+        pSample->offUnit     = (unsigned)pCur->enmUnit < STAMUNIT_END ? aoffUnits[pCur->enmUnit] : 0;
+        pSample->iValue      = iValue;
+        pSample->enmType     = (uint8_t)pCur->enmType;
+        pSample->cValues     = (uint8_t)cSampleValues;
+        pSample->enmUnit     = (uint16_t)pCur->enmUnit;
+        pSample->u32Reserved = 0;
+        iValue += cSampleValues;
+    }
+    Assert(iSample == cSamples); Assert(iValue == cValues); Assert(offString == cbStrings);
+
+    pHdr->fFlags      = fFlags;
+    pHdr->cSamples    = cSamples;
+    pHdr->offSamples  = offSamples;
+    pHdr->cValues     = cValues;
+    pHdr->offValues   = offValues;
+    pHdr->cbStrings   = (uint32_t)cbStrings;
+    pHdr->offStrings  = offStrings;
+    pHdr->uGeneration++;
+    if (fFlags & STAMEXPORTHDR_F_TRUNCATED)
+        LogRelMax(8, ("STAM: The export '%s' is too small, only %u samples fit\n", pExport->szName, cSamples));
+}
+
+
+/**
+ * Updates the export, rewriting the sample table if samples were registered
+ * or deregistered since the last time.
+ *
+ * @param   pUVM        Pointer to the user mode VM structure.
+ * @param   pExport     The export state.
+ */
+static void stamR3ExportUpdate(PUVM pUVM, PSTAMEXPORT pExport)
+{
+    PSTAMEXPORTHDR pHdr = pExport->pHdr;
+
+    STAM_LOCK_RD(pUVM);
+
+    /* Refresh the ring-0 statistics first, as that may register new samples. */
+    uint64_t  bmRefreshedGroups = 0;
+    PSTAMDESC pCur;
+    RTListForEach(&pUVM->stam.s.List, pCur, STAMDESC, ListEntry)
+        stamR3Refresh(pUVM, pCur, &bmRefreshedGroups);
+
+    ASMAtomicIncU64(&pHdr->uSeqNo);
+
+    if (   pExport->fLayoutDirty
+        || pExport->uGeneration != pUVM->stam.s.uGeneration)
+    {
+        stamR3ExportWriteLayout(pUVM, pExport);
+        pExport->uGeneration  = pUVM->stam.s.uGeneration;
+        pExport->fLayoutDirty = false;
+    }
+
+    /*
+     * Copy the values in the same order the layout was written.
+     */
+    uint64_t      *pau64   = (uint64_t *)((uint8_t *)pHdr + pHdr->offValues);
+    uint32_t const cValues = pHdr->cValues;
+    uint32_t       iValue  = 0;
+    RTListForEach(&pUVM->stam.s.List, pCur, STAMDESC, ListEntry)
+    {
+        if (iValue >= cValues)
+            break;
+        switch (pCur->enmType)
+        {
+            case STAMTYPE_CALLBACK:
+                break;
+
+            case STAMTYPE_COUNTER:
+                pau64[iValue++] = pCur->u.pCounter->c;
+                break;
+
+            case STAMTYPE_PROFILE:
+            case STAMTYPE_PROFILE_ADV:
+                pau64[iValue++] = pCur->u.pProfile->cPeriods;
+                pau64[iValue++] = pCur->u.pProfile->cTicks;
+                pau64[iValue++] = pCur->u.pProfile->cTicksMin;
+                pau64[iValue++] = pCur->u.pProfile->cTicksMax;
+                break;
+
+            case STAMTYPE_RATIO_U32:
+            case STAMTYPE_RATIO_U32_RESET:
+                pau64[iValue++] = pCur->u.pRatioU32->u32A;
+                pau64[iValue++] = pCur->u.pRatioU32->u32B;
+                break;
+
+            case STAMTYPE_HISTOGRAM:
+                pau64[iValue++] = pCur->u.pHistogram->cSamples;
+                pau64[iValue++] = pCur->u.pHistogram->cTotal;
+                pau64[iValue++] = pCur->u.pHistogram->cMax;
+                for (unsigned i = 0; i < STAM_HISTOGRAM_BUCKETS; i++)
+                    pau64[iValue++] = pCur->u.pHistogram->acBuckets[i];
+                break;
+
+            case STAMTYPE_U8:
+            case STAMTYPE_U8_RESET:
+            case STAMTYPE_X8:
+            case STAMTYPE_X8_RESET:
+                pau64[iValue++] = *pCur->u.pu8;
+                break;
+
+            case STAMTYPE_U16:
+            case STAMTYPE_U16_RESET:
+            case STAMTYPE_X16:
+            case STAMTYPE_X16_RESET:
+                pau64[iValue++] = *pCur->u.pu16;
+                break;
+
+            case STAMTYPE_U32:
+            case STAMTYPE_U32_RESET:
+            case STAMTYPE_X32:
+            case STAMTYPE_X32_RESET:
+                pau64[iValue++] = *pCur->u.pu32;
+                break;
+
+            case STAMTYPE_U64:
+            case STAMTYPE_U64_RESET:
+            case STAMTYPE_X64:
+            case STAMTYPE_X64_RESET:
+                pau64[iValue++] = *pCur->u.pu64;
+                break;
+
+            case STAMTYPE_BOOL:
+            case STAMTYPE_BOOL_RESET:
+                pau64[iValue++] = *pCur->u.pf;
+                break;
+
+            default:
+                AssertMsgFailed(("enmType=%d\n", pCur->enmType));
+                pau64[iValue++] = 0;
+                break;
+        }
+    }
+    Assert(iValue == cValues);
+
+    RTTIMESPEC Now;
+    pHdr->nsTimestamp = RTTimeSpecGetNano(RTTimeNow(&Now));
+
+    ASMAtomicIncU64(&pHdr->uSeqNo);
+
+    STAM_UNLOCK_RD(pUVM);
+}
+
+
+/**
+ * @callback_method_impl{FNRTTHREAD, The export update thread.}
+ */
+static DECLCALLBACK(int) stamR3ExportThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PUVM        pUVM    = (PUVM)pvUser;
+    PSTAMEXPORT pExport = pUVM->stam.s.pExport;
+    RT_NOREF(hThreadSelf);
+
+    while (!ASMAtomicReadBool(&pExport->fShutdown))
+    {
+        stamR3ExportUpdate(pUVM, pExport);
+        RTSemEventWait(pExport->hEvtWait, pExport->cMsInterval);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Creates the shared memory object and starts the export thread.
+ *
+ * @returns VBox status code.
+ * @param   pUVM        Pointer to the user mode VM structure.
+ * @param   pszName     The name of the shared memory object.
+ * @param   cbShMem     The size of the shared memory object.
+ * @param   cMsInterval The update interval.
+ */
+static int stamR3ExportStart(PUVM pUVM, const char *pszName, size_t cbShMem, uint32_t cMsInterval)
+{
+    AssertCompileSize(STAMEXPORTHDR, 72);
+    AssertCompileSize(STAMEXPORTSAMPLE, 24);
+    AssertReturn(!pUVM->stam.s.pExport, VERR_WRONG_ORDER);
+
+    PSTAMEXPORT pExport = (PSTAMEXPORT)RTMemAllocZ(sizeof(*pExport));
+    AssertReturn(pExport, VERR_NO_MEMORY);
+    pExport->hShMem       = NIL_RTSHMEM;
+    pExport->hThread      = NIL_RTTHREAD;
+    pExport->hEvtWait     = NIL_RTSEMEVENT;
+    pExport->cbShMem      = cbShMem;
+    pExport->cMsInterval  = cMsInterval;
+    pExport->fLayoutDirty = true;
+    int rc = RTStrCopy(pExport->szName, sizeof(pExport->szName), pszName);
+    if (RT_SUCCESS(rc))
+        rc = RTShMemOpen(&pExport->hShMem, pszName, RTSHMEM_O_F_CREATE | RTSHMEM_O_F_READWRITE | RTSHMEM_O_F_TRUNCATE,
+                         cbShMem, 1 /*cMappingsHint*/);
+    if (RT_SUCCESS(rc))
+    {
+        rc = RTShMemMapRegion(pExport->hShMem, 0, cbShMem, RTSHMEM_MAP_F_READ | RTSHMEM_MAP_F_WRITE, (void **)&pExport->pHdr);
+        if (RT_SUCCESS(rc))
+        {
+            PSTAMEXPORTHDR pHdr = pExport->pHdr;
+            pHdr->uSeqNo      = 1;  /* Odd until the first update is complete. */
+            pHdr->u32Version  = STAMEXPORTHDR_VERSION;
+            pHdr->cbShMem     = cbShMem;
+            pHdr->cMsInterval = cMsInterval;
+            ASMAtomicWriteU32(&pHdr->u32Magic, STAMEXPORTHDR_MAGIC);
+            ASMAtomicWriteU64(&pHdr->uSeqNo, 2);
+
+            rc = RTSemEventCreate(&pExport->hEvtWait);
+            if (RT_SUCCESS(rc))
+            {
+                pUVM->stam.s.pExport = pExport;
+                rc = RTThreadCreate(&pExport->hThread, stamR3ExportThread, pUVM, 0, RTTHREADTYPE_INFREQUENT_POLLER,
+                                    RTTHREADFLAGS_WAITABLE, "StamExport");
+                if (RT_SUCCESS(rc))
+                    return VINF_SUCCESS;
+                pUVM->stam.s.pExport = NULL;
+                RTSemEventDestroy(pExport->hEvtWait);
+            }
+            RTShMemUnmapRegion(pExport->hShMem, pExport->pHdr);
+        }
+        RTShMemClose(pExport->hShMem);
+    }
+    RTMemFree(pExport);
+    return rc;
+}
+
+
+/**
+ * Stops the export thread and removes the shared memory object.
+ *
+ * @param   pUVM        Pointer to the user mode VM structure.
+ */
+static void stamR3ExportStop(PUVM pUVM)
+{
+    PSTAMEXPORT pExport = pUVM->stam.s.pExport;
+    if (!pExport)
+        return;
+
+    ASMAtomicWriteBool(&pExport->fShutdown, true);
+    RTSemEventSignal(pExport->hEvtWait);
+    int rc = RTThreadWait(pExport->hThread, RT_MS_30SEC, NULL);
+    AssertLogRelRC(rc);
+    if (RT_FAILURE(rc))
+        return; /* Leak it rather than pulling the mapping from under the thread. */
+
+    pUVM->stam.s.pExport = NULL;
+    RTSemEventDestroy(pExport->hEvtWait);
+    ASMAtomicWriteU32(&pExport->pHdr->u32Magic, ~STAMEXPORTHDR_MAGIC);
+    RTShMemUnmapRegion(pExport->hShMem, pExport->pHdr);
+    RTShMemClose(pExport->hShMem); /* The creator closing it deletes the object. */
+    RTMemFree(pExport);
+}
+
+
+/**
+ * Ring-3 init finalizing, starts the binary export if configured.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ */
+VMMR3_INT_DECL(int) STAMR3InitCompleted(PVM pVM)
+{
+    PCFGMNODE pCfg = CFGMR3GetChild(CFGMR3GetRoot(pVM), "STAM");
+    int rc = CFGMR3ValidateConfig(pCfg, "/STAM/", "ExportName|ExportIntervalMs|ExportSize", "", "STAM", 0);
+    AssertRCReturn(rc, rc);
+
+    /** @cfgm{/STAM/ExportName, string, none}
+     * The name of the shared memory object to publish the statistics in, see
+     * grp_stam_export.  The export is disabled when not present. */
+    char szName[64];
+    rc = CFGMR3QueryStringDef(pCfg, "ExportName", szName, sizeof(szName), "");
+    AssertLogRelRCReturn(rc, rc);
+    if (!szName[0])
+        return VINF_SUCCESS;
+
+    /** @cfgm{/STAM/ExportIntervalMs, uint32_t, ms, 10, 3600000, 1000}
+     * How often to update the exported values. */
+    uint32_t cMsInterval;
+    rc = CFGMR3QueryU32Def(pCfg, "ExportIntervalMs", &cMsInterval, 1000);
+    AssertLogRelRCReturn(rc, rc);
+    if (cMsInterval < 10 || cMsInterval > RT_MS_1HOUR)
+        return VMSetError(pVM, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                          "Configuration error: /STAM/ExportIntervalMs=%u is out of range (10..3600000)", cMsInterval);
+
+    /** @cfgm{/STAM/ExportSize, uint32_t, bytes, 64K, 256M, 8M}
+     * The size of the shared memory object.  Samples not fitting are left out. */
+    uint32_t cbShMem;
+    rc = CFGMR3QueryU32Def(pCfg, "ExportSize", &cbShMem, _8M);
+    AssertLogRelRCReturn(rc, rc);
+    if (cbShMem < _64K || cbShMem > _256M)
+        return VMSetError(pVM, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                          "Configuration error: /STAM/ExportSize=%u is out of range (64K..256M)", cbShMem);
+    cbShMem = RT_ALIGN_32(cbShMem, _64K);
+
+    /* Failing to export must not prevent the VM from starting. */
+    rc = stamR3ExportStart(pVM->pUVM, szName, cbShMem, cMsInterval);
+    if (RT_SUCCESS(rc))
+        LogRel(("STAM: Exporting statistics in '%s' (%u bytes) every %u ms\n", szName, cbShMem, cMsInterval));
+    else
+        LogRel(("STAM: Failed to export statistics in '%s': %Rrc\n", szName, rc));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Stops the binary export.
+ *
+ * This is called early during VM destruction, before the other components
+ * free the memory backing their samples.
+ *
+ * @param   pVM         The cross context VM structure.
+ */
+VMMR3_INT_DECL(void) STAMR3Term(PVM pVM)
+{
+    stamR3ExportStop(pVM->pUVM);
+}
+
+
 #ifdef VBOX_WITH_DEBUGGER
 
 /**
@@ -151,7 +151,9 @@
 #include <iprt/env.h>
 #include <iprt/file.h>
 #include <iprt/getopt.h>
+#include <iprt/mem.h>
 #include <iprt/semaphore.h>
+#include <iprt/sort.h>
 #include <iprt/string.h>
 #include <iprt/thread.h>
 #include <iprt/time.h>
@@ -219,6 +221,7 @@ VMM_INT_DECL(int) TMR3Init(PVM pVM)
     pVM->tm.s.paTimerQueuesRC = MMHyperR3ToRC(pVM, pv);
 
     pVM->tm.s.offVM = RT_UOFFSETOF(VM, tm.s);
+    pVM->tm.s.hEvtHandlerDone = NIL_RTSEMEVENTMULTI;
     pVM->tm.s.idTimerCpu = pVM->cCpus - 1; /* The last CPU. */
     pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL].enmClock        = TMCLOCK_VIRTUAL;
     pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL].u64Expire       = INT64_MAX;
@@ -228,6 +231,8 @@ VMM_INT_DECL(int) TMR3Init(PVM pVM)
     pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL].u64Expire          = INT64_MAX;
     pVM->tm.s.paTimerQueuesR3[TMCLOCK_TSC].enmClock            = TMCLOCK_TSC;
     pVM->tm.s.paTimerQueuesR3[TMCLOCK_TSC].u64Expire           = INT64_MAX;
+    for (unsigned i = 0; i < TMCLOCK_MAX; i++)
+        pVM->tm.s.paTimerQueuesR3[i].idCpuOwner = pVM->tm.s.idTimerCpu;
 
 
     /*
@@ -361,6 +366,8 @@ VMM_INT_DECL(int) TMR3Init(PVM pVM)
                               "HostHzFudgeFactorCatchUp100|"
                               "HostHzFudgeFactorCatchUp200|"
                               "HostHzFudgeFactorCatchUp400|"
+                              "TimerQueueCpuVirtual|"
+                              "TimerQueueCpuReal|"
                               "TimerMillies"
                               ,
                               "",
@@ -641,6 +648,41 @@ VMM_INT_DECL(int) TMR3Init(PVM pVM)
         return VMSetError(pVM, rc, RT_SRC_POS,
                           N_("Configuration error: Failed to querying uint32_t value \"HostHzFudgeFactorCatchUp400\""));
 
+    /*
+     * Timer queue distribution.  The virtual sync queue is tied to the
+     * dedicated timer EMT, but the virtual and real clock queues, where most
+     * device timers live, can be handed to other EMTs so their callbacks
+     * don't all eat into the guest time of one virtual CPU.
+     */
+    /** @cfgm{/TM/TimerQueueCpuVirtual, uint32_t, VCPU id, 0, cCpus - 1, cCpus - 1}
+     * The EMT running the TMCLOCK_VIRTUAL timer queue. */
+    rc = CFGMR3QueryU32Def(pCfgHandle, "TimerQueueCpuVirtual", &pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL].idCpuOwner,
+                           pVM->tm.s.idTimerCpu);
+    if (RT_FAILURE(rc))
+        return VMSetError(pVM, rc, RT_SRC_POS,
+                          N_("Configuration error: Failed to querying uint32_t value \"TimerQueueCpuVirtual\""));
+    if (pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL].idCpuOwner >= pVM->cCpus)
+        return VMSetError(pVM, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                          N_("Configuration error: \"TimerQueueCpuVirtual\" = %RU32 is not in the range 0..%RU32"),
+                          pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL].idCpuOwner, pVM->cCpus - 1);
+
+    /** @cfgm{/TM/TimerQueueCpuReal, uint32_t, VCPU id, 0, cCpus - 1, cCpus - 1}
+     * The EMT running the TMCLOCK_REAL timer queue. */
+    rc = CFGMR3QueryU32Def(pCfgHandle, "TimerQueueCpuReal", &pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL].idCpuOwner,
+                           pVM->tm.s.idTimerCpu);
+    if (RT_FAILURE(rc))
+        return VMSetError(pVM, rc, RT_SRC_POS,
+                          N_("Configuration error: Failed to querying uint32_t value \"TimerQueueCpuReal\""));
+    if (pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL].idCpuOwner >= pVM->cCpus)
+        return VMSetError(pVM, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                          N_("Configuration error: \"TimerQueueCpuReal\" = %RU32 is not in the range 0..%RU32"),
+                          pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL].idCpuOwner, pVM->cCpus - 1);
+
+    if (   pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL].idCpuOwner != pVM->tm.s.idTimerCpu
+        || pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL].idCpuOwner    != pVM->tm.s.idTimerCpu)
+        LogRel(("TM: Timer queues distributed: VirtualSync=#%u Virtual=#%u Real=#%u\n", pVM->tm.s.idTimerCpu,
+                pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL].idCpuOwner, pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL].idCpuOwner));
+
     /*
      * Finally, setup and report.
      */
@@ -672,6 +714,9 @@ VMM_INT_DECL(int) TMR3Init(PVM pVM)
     Log(("TM: Created timer %p firing every %d milliseconds\n", pVM->tm.s.pTimer, u32Millies));
     pVM->tm.s.u32TimerMillies = u32Millies;
 
+    rc = RTSemEventMultiCreate(&pVM->tm.s.hEvtHandlerDone);
+    AssertRCReturn(rc, rc);
+
     /*
      * Register saved state.
      */
@@ -694,6 +739,9 @@ VMM_INT_DECL(int) TMR3Init(PVM pVM)
     STAM_REL_REG(     pVM,(void*)&pVM->tm.s.offVirtualSync,               STAMTYPE_U64, "/TM/VirtualSync/CurrentOffset",               STAMUNIT_NS, "The current offset. (subtract GivenUp to get the lag)");
     STAM_REL_REG_USED(pVM,(void*)&pVM->tm.s.offVirtualSyncGivenUp,        STAMTYPE_U64, "/TM/VirtualSync/GivenUp",                     STAMUNIT_NS, "Nanoseconds of the 'CurrentOffset' that's been given up and won't ever be attempted caught up with.");
     STAM_REL_REG(     pVM,(void*)&pVM->tm.s.uMaxHzHint,                   STAMTYPE_U32, "/TM/MaxHzHint",                               STAMUNIT_HZ, "Max guest timer frequency hint.");
+    STAM_REL_REG(pVM, &pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL].StatLatency,      STAMTYPE_PROFILE, "/TM/TimerLatency/Virtual",      STAMUNIT_NS_PER_CALL, "Delay from the expire time until a virtual clock timer is run.");
+    STAM_REL_REG(pVM, &pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL_SYNC].StatLatency, STAMTYPE_PROFILE, "/TM/TimerLatency/VirtualSync",  STAMUNIT_NS_PER_CALL, "Delay from the expire time until a virtual sync clock timer is run (lag included).");
+    STAM_REL_REG(pVM, &pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL].StatLatency,         STAMTYPE_PROFILE, "/TM/TimerLatency/Real",         STAMUNIT_NS_PER_CALL, "Delay from the expire time until a real clock timer is run.");
 
 #ifdef VBOX_WITH_STATISTICS
     STAM_REG_USED(pVM,(void *)&pVM->tm.s.VirtualGetRawDataR3.cExpired,    STAMTYPE_U32, "/TM/R3/cExpired",                     STAMUNIT_OCCURENCES, "Times the TSC interval expired (overlaps 1ns steps).");
@@ -1169,6 +1217,11 @@ VMM_INT_DECL(int) TMR3Term(PVM pVM)
         AssertRC(rc);
         pVM->tm.s.pTimer = NULL;
     }
+    if (pVM->tm.s.hEvtHandlerDone != NIL_RTSEMEVENTMULTI)
+    {
+        RTSemEventMultiDestroy(pVM->tm.s.hEvtHandlerDone);
+        pVM->tm.s.hEvtHandlerDone = NIL_RTSEMEVENTMULTI;
+    }
 
     return VINF_SUCCESS;
 }
@@ -1220,8 +1273,8 @@ VMM_INT_DECL(void) TMR3Reset(PVM pVM)
     tmTimerQueuesSanityChecks(pVM, "TMR3Reset");
 #endif
 
-    PVMCPU pVCpuDst = pVM->apCpusR3[pVM->tm.s.idTimerCpu];
-    VMCPU_FF_CLEAR(pVCpuDst, VMCPU_FF_TIMER); /** @todo FIXME: this isn't right. */
+    for (int i = 0; i < TMCLOCK_MAX; i++)
+        VMCPU_FF_CLEAR(pVM->apCpusR3[pVM->tm.s.paTimerQueuesR3[i].idCpuOwner], VMCPU_FF_TIMER); /** @todo FIXME: this isn't right. */
 
     /*
      * Switch TM TSC mode back to the original mode after a reset for
@@ -1479,8 +1532,8 @@ static DECLCALLBACK(int) tmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, u
     /*
      * Make sure timers get rescheduled immediately.
      */
-    PVMCPU pVCpuDst = pVM->apCpusR3[pVM->tm.s.idTimerCpu];
-    VMCPU_FF_SET(pVCpuDst, VMCPU_FF_TIMER);
+    for (int i = 0; i < TMCLOCK_MAX; i++)
+        VMCPU_FF_SET(pVM->apCpusR3[pVM->tm.s.paTimerQueuesR3[i].idCpuOwner], VMCPU_FF_TIMER);
 
     return VINF_SUCCESS;
 }
@@ -1546,6 +1599,8 @@ static int tmr3TimerCreate(PVM pVM, TMCLOCK enmClock, const char *pszDesc, PPTMT
     pTimer->offScheduleNext = 0;
     pTimer->offNext         = 0;
     pTimer->offPrev         = 0;
+    pTimer->offChild        = 0;
+    pTimer->uRunGen         = 0;
     pTimer->pvUser          = NULL;
     pTimer->pCritSect       = NULL;
     pTimer->pszDesc         = pszDesc;
@@ -1810,8 +1865,28 @@ VMMR3DECL(int) TMR3TimerDestroy(PTMTIMER pTimer)
               pTimer, tmTimerState(enmState), R3STRING(pTimer->pszDesc), cRetries));
         switch (enmState)
         {
-            case TMTIMERSTATE_STOPPED:
             case TMTIMERSTATE_EXPIRED_DELIVER:
+                /* The owner of a virtual or real clock queue calls the handler without
+                   the timer lock, wait for it unless this is the handler itself.  The
+                   event is reset while we own the timer lock and tmR3TimerQueueRun
+                   signals it after taking the lock again, so no wakeup is missed.
+                   This doesn't count as a retry, the handler may take its time. */
+                if (   pTimer->enmClock != TMCLOCK_VIRTUAL_SYNC
+                    && pQueue->idCpuOwner != VMMGetCpuId(pVM))
+                {
+                    pVM->tm.s.cDestroyWaiters++;
+                    RTSemEventMultiReset(pVM->tm.s.hEvtHandlerDone);
+                    TM_UNLOCK_TIMERS(pVM);
+                    int rc = RTSemEventMultiWait(pVM->tm.s.hEvtHandlerDone, RT_INDEFINITE_WAIT);
+                    AssertRC(rc);
+                    TM_LOCK_TIMERS(pVM);
+                    pVM->tm.s.cDestroyWaiters--;
+                    cRetries++;
+                    continue;
+                }
+                break;
+
+            case TMTIMERSTATE_STOPPED:
                 break;
 
             case TMTIMERSTATE_ACTIVE:
@@ -1874,24 +1949,10 @@ VMMR3DECL(int) TMR3TimerDestroy(PTMTIMER pTimer)
     }
 
     /*
-     * Unlink from the active list.
+     * Unlink from the active heap.
      */
     if (fActive)
-    {
-        const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
-        const PTMTIMER pNext = TMTIMER_GET_NEXT(pTimer);
-        if (pPrev)
-            TMTIMER_SET_NEXT(pPrev, pNext);
-        else
-        {
-            TMTIMER_SET_HEAD(pQueue, pNext);
-            pQueue->u64Expire = pNext ? pNext->u64Expire : INT64_MAX;
-        }
-        if (pNext)
-            TMTIMER_SET_PREV(pNext, pPrev);
-        pTimer->offNext = 0;
-        pTimer->offPrev = 0;
-    }
+        tmTimerHeapRemove(pQueue, pTimer);
 
     /*
      * Unlink from the schedule list by running it.
@@ -1917,7 +1978,7 @@ VMMR3DECL(int) TMR3TimerDestroy(PTMTIMER pTimer)
     /*
      * Ready to move the timer from the created list and onto the free list.
      */
-    Assert(!pTimer->offNext); Assert(!pTimer->offPrev); Assert(!pTimer->offScheduleNext);
+    Assert(!pTimer->offNext); Assert(!pTimer->offPrev); Assert(!pTimer->offChild); Assert(!pTimer->offScheduleNext);
 
     /* unlink from created list */
     if (pTimer->pBigPrev)
@@ -2080,32 +2141,45 @@ DECLINLINE(bool) tmR3HasExpiredTimer(PVM pVM, TMCLOCK enmClock)
 
 
 /**
- * Checks for expired timers in all the queues.
+ * Checks for expired or pending timers in the queues run by the given EMT.
  *
  * @returns true / false.
  * @param   pVM         The cross context VM structure.
+ * @param   idCpu       The EMT which queues to check.
  */
-DECLINLINE(bool) tmR3AnyExpiredTimers(PVM pVM)
+DECLINLINE(bool) tmR3AnyExpiredTimers(PVM pVM, VMCPUID idCpu)
 {
+    PTMTIMERQUEUE const paQueues = pVM->tm.s.CTX_SUFF(paTimerQueues);
+    for (unsigned i = 0; i < TMCLOCK_MAX; i++)
+        if (   paQueues[i].idCpuOwner == idCpu
+            && paQueues[i].offSchedule) /** @todo FIXME - reconsider offSchedule as a reason for running the timer queues. */
+            return true;
+
     /*
      * Combine the time calculation for the first two since we're not on EMT
      * TMVirtualSyncGet only permits EMT.
      */
     uint64_t u64Now = TMVirtualGetNoCheck(pVM);
-    if (pVM->tm.s.CTX_SUFF(paTimerQueues)[TMCLOCK_VIRTUAL].u64Expire <= u64Now)
-        return true;
-    u64Now = pVM->tm.s.fVirtualSyncTicking
-           ? u64Now - pVM->tm.s.offVirtualSync
-           : pVM->tm.s.u64VirtualSync;
-    if (pVM->tm.s.CTX_SUFF(paTimerQueues)[TMCLOCK_VIRTUAL_SYNC].u64Expire <= u64Now)
+    if (   paQueues[TMCLOCK_VIRTUAL].idCpuOwner == idCpu
+        && paQueues[TMCLOCK_VIRTUAL].u64Expire <= u64Now)
         return true;
+    if (paQueues[TMCLOCK_VIRTUAL_SYNC].idCpuOwner == idCpu)
+    {
+        u64Now = pVM->tm.s.fVirtualSyncTicking
+               ? u64Now - pVM->tm.s.offVirtualSync
+               : pVM->tm.s.u64VirtualSync;
+        if (paQueues[TMCLOCK_VIRTUAL_SYNC].u64Expire <= u64Now)
+            return true;
+    }
 
     /*
      * The remaining timers.
      */
-    if (tmR3HasExpiredTimer(pVM, TMCLOCK_REAL))
+    if (   paQueues[TMCLOCK_REAL].idCpuOwner == idCpu
+        && tmR3HasExpiredTimer(pVM, TMCLOCK_REAL))
         return true;
-    if (tmR3HasExpiredTimer(pVM, TMCLOCK_TSC))
+    if (   paQueues[TMCLOCK_TSC].idCpuOwner == idCpu
+        && tmR3HasExpiredTimer(pVM, TMCLOCK_TSC))
         return true;
     return false;
 }
@@ -2125,32 +2199,41 @@ DECLINLINE(bool) tmR3AnyExpiredTimers(PVM pVM)
  */
 static DECLCALLBACK(void) tmR3TimerCallback(PRTTIMER pTimer, void *pvUser, uint64_t /*iTick*/)
 {
-    PVM     pVM      = (PVM)pvUser;
-    PVMCPU  pVCpuDst = pVM->apCpusR3[pVM->tm.s.idTimerCpu];
+    PVM                 pVM      = (PVM)pvUser;
+    PTMTIMERQUEUE const paQueues = pVM->tm.s.paTimerQueuesR3;
     NOREF(pTimer);
 
     AssertCompile(TMCLOCK_MAX == 4);
     STAM_COUNTER_INC(&pVM->tm.s.StatTimerCallback);
 
+    /*
+     * Check each of the EMTs running timer queues once.
+     */
+    for (unsigned iQueue = 0; iQueue < TMCLOCK_MAX; iQueue++)
+    {
+        VMCPUID const idCpu = paQueues[iQueue].idCpuOwner;
+        unsigned      iPrev = 0;
+        while (iPrev < iQueue && paQueues[iPrev].idCpuOwner != idCpu)
+            iPrev++;
+        if (iPrev < iQueue)
+            continue;
+
+        PVMCPU pVCpuDst = pVM->apCpusR3[idCpu];
 #ifdef DEBUG_Sander /* very annoying, keep it private. */
-    if (VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER))
-        Log(("tmR3TimerCallback: timer event still pending!!\n"));
+        if (VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER))
+            Log(("tmR3TimerCallback: timer event still pending!!\n"));
 #endif
-    if (    !VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER)
-        &&  (   pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL_SYNC].offSchedule /** @todo FIXME - reconsider offSchedule as a reason for running the timer queues. */
-            ||  pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL].offSchedule
-            ||  pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL].offSchedule
-            ||  pVM->tm.s.paTimerQueuesR3[TMCLOCK_TSC].offSchedule
-            ||  tmR3AnyExpiredTimers(pVM)
-            )
-        && !VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER)
-        && !pVM->tm.s.fRunningQueues
-       )
-    {
-        Log5(("TM(%u): FF: 0 -> 1\n", __LINE__));
-        VMCPU_FF_SET(pVCpuDst, VMCPU_FF_TIMER);
-        VMR3NotifyCpuFFU(pVCpuDst->pUVCpu, VMNOTIFYFF_FLAGS_DONE_REM | VMNOTIFYFF_FLAGS_POKE);
-        STAM_COUNTER_INC(&pVM->tm.s.StatTimerCallbackSetFF);
+        if (    !VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER)
+            &&  tmR3AnyExpiredTimers(pVM, idCpu)
+            && !VMCPU_FF_IS_SET(pVCpuDst, VMCPU_FF_TIMER)
+            && !pVCpuDst->tm.s.fRunningQueues
+           )
+        {
+            Log5(("TM(%u): FF: 0 -> 1\n", __LINE__));
+            VMCPU_FF_SET(pVCpuDst, VMCPU_FF_TIMER);
+            VMR3NotifyCpuFFU(pVCpuDst->pUVCpu, VMNOTIFYFF_FLAGS_DONE_REM | VMNOTIFYFF_FLAGS_POKE);
+            STAM_COUNTER_INC(&pVM->tm.s.StatTimerCallbackSetFF);
+        }
     }
 }
 
@@ -2162,73 +2245,103 @@ static DECLCALLBACK(void) tmR3TimerCallback(PRTTIMER pTimer, void *pvUser, uint6
  *
  * @param   pVM             The cross context VM structure.
  *
- * @thread  EMT (actually EMT0, but we fend off the others)
+ * @thread  EMT (the dedicated timer EMT and any EMTs configured to run the
+ *          virtual or real clock queues, we fend off the others)
  */
 VMMR3DECL(void) TMR3TimerQueuesDo(PVM pVM)
 {
     /*
-     * Only the dedicated timer EMT should do stuff here.
-     * (fRunningQueues is only used as an indicator.)
+     * Only the EMTs running one or more queues should do stuff here, by
+     * default that is just the dedicated timer EMT.
+     * (TMCPU::fRunningQueues is only used as an indicator.)
      */
     Assert(pVM->tm.s.idTimerCpu < pVM->cCpus);
-    PVMCPU pVCpuDst = pVM->apCpusR3[pVM->tm.s.idTimerCpu];
-    if (VMMGetCpu(pVM) != pVCpuDst)
+    PVMCPU              pVCpuDst = pVM->apCpusR3[pVM->tm.s.idTimerCpu];
+    PVMCPU              pVCpu    = VMMGetCpu(pVM);
+    PTMTIMERQUEUE const paQueues = pVM->tm.s.paTimerQueuesR3;
+    AssertPtrReturnVoid(pVCpu);
+    bool const fVirtual = paQueues[TMCLOCK_VIRTUAL].idCpuOwner == pVCpu->idCpu;
+    bool const fReal    = paQueues[TMCLOCK_REAL].idCpuOwner    == pVCpu->idCpu;
+    if (pVCpu != pVCpuDst && !fVirtual && !fReal)
     {
         Assert(pVM->cCpus > 1);
         return;
     }
     STAM_PROFILE_START(&pVM->tm.s.StatDoQueues, a);
     Log2(("TMR3TimerQueuesDo:\n"));
-    Assert(!pVM->tm.s.fRunningQueues);
-    ASMAtomicWriteBool(&pVM->tm.s.fRunningQueues, true);
-    TM_LOCK_TIMERS(pVM);
+    Assert(!pVCpu->tm.s.fRunningQueues);
+    ASMAtomicWriteBool(&pVCpu->tm.s.fRunningQueues, true);
 
     /*
      * Process the queues.
+     *
+     * The timer lock is taken for each queue separately.  The virtual sync
+     * queue keeps it across the callbacks as the lock order is TM lock before
+     * the virtual sync lock, the other queues drop it while calling out (see
+     * tmR3TimerQueueRun).  So EMTs owning different queues only serialize on
+     * the queue bookkeeping and not on each others callbacks.
      */
     AssertCompile(TMCLOCK_MAX == 4);
 
     /* TMCLOCK_VIRTUAL_SYNC (see also TMR3VirtualSyncFF) */
-    STAM_PROFILE_ADV_START(&pVM->tm.s.aStatDoQueues[TMCLOCK_VIRTUAL_SYNC], s1);
-    PDMCritSectEnter(&pVM->tm.s.VirtualSyncLock, VERR_IGNORED);
-    ASMAtomicWriteBool(&pVM->tm.s.fRunningVirtualSyncQueue, true);
-    VMCPU_FF_CLEAR(pVCpuDst, VMCPU_FF_TIMER);   /* Clear the FF once we started working for real. */
+    if (pVCpu == pVCpuDst)
+    {
+        STAM_PROFILE_ADV_START(&pVM->tm.s.aStatDoQueues[TMCLOCK_VIRTUAL_SYNC], s1);
+        TM_LOCK_TIMERS(pVM);
+        PDMCritSectEnter(&pVM->tm.s.VirtualSyncLock, VERR_IGNORED);
+        ASMAtomicWriteBool(&pVM->tm.s.fRunningVirtualSyncQueue, true);
+        VMCPU_FF_CLEAR(pVCpuDst, VMCPU_FF_TIMER);   /* Clear the FF once we started working for real. */
 
-    Assert(!pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL_SYNC].offSchedule);
-    tmR3TimerQueueRunVirtualSync(pVM);
-    if (pVM->tm.s.fVirtualSyncTicking) /** @todo move into tmR3TimerQueueRunVirtualSync - FIXME */
-        VM_FF_CLEAR(pVM, VM_FF_TM_VIRTUAL_SYNC);
+        Assert(!paQueues[TMCLOCK_VIRTUAL_SYNC].offSchedule);
+        tmR3TimerQueueRunVirtualSync(pVM);
+        if (pVM->tm.s.fVirtualSyncTicking) /** @todo move into tmR3TimerQueueRunVirtualSync - FIXME */
+            VM_FF_CLEAR(pVM, VM_FF_TM_VIRTUAL_SYNC);
 
-    ASMAtomicWriteBool(&pVM->tm.s.fRunningVirtualSyncQueue, false);
-    PDMCritSectLeave(&pVM->tm.s.VirtualSyncLock);
-    STAM_PROFILE_ADV_STOP(&pVM->tm.s.aStatDoQueues[TMCLOCK_VIRTUAL_SYNC], s1);
+        ASMAtomicWriteBool(&pVM->tm.s.fRunningVirtualSyncQueue, false);
+        PDMCritSectLeave(&pVM->tm.s.VirtualSyncLock);
+        TM_UNLOCK_TIMERS(pVM);
+        STAM_PROFILE_ADV_STOP(&pVM->tm.s.aStatDoQueues[TMCLOCK_VIRTUAL_SYNC], s1);
+    }
+    else
+        VMCPU_FF_CLEAR(pVCpu, VMCPU_FF_TIMER);
 
     /* TMCLOCK_VIRTUAL */
-    STAM_PROFILE_ADV_START(&pVM->tm.s.aStatDoQueues[TMCLOCK_VIRTUAL], s2);
-    if (pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL].offSchedule)
-        tmTimerQueueSchedule(pVM, &pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL]);
-    tmR3TimerQueueRun(pVM, &pVM->tm.s.paTimerQueuesR3[TMCLOCK_VIRTUAL]);
-    STAM_PROFILE_ADV_STOP(&pVM->tm.s.aStatDoQueues[TMCLOCK_VIRTUAL], s2);
+    if (fVirtual)
+    {
+        STAM_PROFILE_ADV_START(&pVM->tm.s.aStatDoQueues[TMCLOCK_VIRTUAL], s2);
+        TM_LOCK_TIMERS(pVM);
+        if (paQueues[TMCLOCK_VIRTUAL].offSchedule)
+            tmTimerQueueSchedule(pVM, &paQueues[TMCLOCK_VIRTUAL]);
+        tmR3TimerQueueRun(pVM, &paQueues[TMCLOCK_VIRTUAL]);
+        TM_UNLOCK_TIMERS(pVM);
+        STAM_PROFILE_ADV_STOP(&pVM->tm.s.aStatDoQueues[TMCLOCK_VIRTUAL], s2);
+    }
 
     /* TMCLOCK_TSC */
-    Assert(!pVM->tm.s.paTimerQueuesR3[TMCLOCK_TSC].offActive); /* not used */
+    Assert(!paQueues[TMCLOCK_TSC].offActive); /* not used */
 
     /* TMCLOCK_REAL */
-    STAM_PROFILE_ADV_START(&pVM->tm.s.aStatDoQueues[TMCLOCK_REAL], s3);
-    if (pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL].offSchedule)
-        tmTimerQueueSchedule(pVM, &pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL]);
-    tmR3TimerQueueRun(pVM, &pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL]);
-    STAM_PROFILE_ADV_STOP(&pVM->tm.s.aStatDoQueues[TMCLOCK_REAL], s3);
+    if (fReal)
+    {
+        STAM_PROFILE_ADV_START(&pVM->tm.s.aStatDoQueues[TMCLOCK_REAL], s3);
+        TM_LOCK_TIMERS(pVM);
+        if (paQueues[TMCLOCK_REAL].offSchedule)
+            tmTimerQueueSchedule(pVM, &paQueues[TMCLOCK_REAL]);
+        tmR3TimerQueueRun(pVM, &paQueues[TMCLOCK_REAL]);
+        TM_UNLOCK_TIMERS(pVM);
+        STAM_PROFILE_ADV_STOP(&pVM->tm.s.aStatDoQueues[TMCLOCK_REAL], s3);
+    }
 
 #ifdef VBOX_STRICT
     /* check that we didn't screw up. */
+    TM_LOCK_TIMERS(pVM);
     tmTimerQueuesSanityChecks(pVM, "TMR3TimerQueuesDo");
+    TM_UNLOCK_TIMERS(pVM);
 #endif
 
     /* done */
     Log2(("TMR3TimerQueuesDo: returns void\n"));
-    ASMAtomicWriteBool(&pVM->tm.s.fRunningQueues, false);
-    TM_UNLOCK_TIMERS(pVM);
+    ASMAtomicWriteBool(&pVCpu->tm.s.fRunningQueues, false);
     STAM_PROFILE_STOP(&pVM->tm.s.StatDoQueues, a);
 }
 
@@ -2238,6 +2351,22 @@ VMMR3DECL(void) TMR3TimerQueuesDo(PVM pVM)
 //RT_C_DECLS_END
 
 
+/**
+ * Starts a new run of the given queue.
+ *
+ * @returns The generation of the new run, never zero.
+ * @param   pQueue          The queue about to be run.
+ */
+DECLINLINE(uint32_t) tmR3TimerQueueRunGenNext(PTMTIMERQUEUE pQueue)
+{
+    uint32_t uRunGen = pQueue->uRunGen + 1;
+    if (RT_UNLIKELY(!uRunGen))
+        uRunGen = 1;
+    pQueue->uRunGen = uRunGen;
+    return uRunGen;
+}
+
+
 /**
  * Schedules and runs any pending times in the specified queue.
  *
@@ -2245,10 +2374,14 @@ VMMR3DECL(void) TMR3TimerQueuesDo(PVM pVM)
  *
  * @param   pVM             The cross context VM structure.
  * @param   pQueue          The queue to run.
+ *
+ * @remarks The caller must own the timer lock.  It is dropped while calling
+ *          the timer handlers, they run with just the lock of the timer.
  */
 static void tmR3TimerQueueRun(PVM pVM, PTMTIMERQUEUE pQueue)
 {
     VM_ASSERT_EMT(pVM);
+    TM_ASSERT_TIMER_LOCK_OWNERSHIP(pVM);
 
     /*
      * Run timers.
@@ -2261,15 +2394,24 @@ static void tmR3TimerQueueRun(PVM pVM, PTMTIMERQUEUE pQueue)
      *      However, we only allow EMT to handle EXPIRED_PENDING
      *      timers, thus enabling the timer handler function to
      *      arm the timer again.
+     *
+     * The timers are taken off the head of the active heap one by one, so
+     * the handlers are free to arm and stop other timers in between.
+     *
+     * Each timer fires at most once per run.  A handler re-arming its timer
+     * with an expire time which is already due would otherwise have it fire
+     * again and again here.  Hitting such a timer at the head ends the run,
+     * the timers behind it are left to the next one.
      */
-    PTMTIMER pNext = TMTIMER_GET_HEAD(pQueue);
-    if (!pNext)
+    PTMTIMER pTimer = TMTIMER_GET_HEAD(pQueue);
+    if (!pTimer)
         return;
-    const uint64_t u64Now = tmClock(pVM, pQueue->enmClock);
-    while (pNext && pNext->u64Expire <= u64Now)
+    const uint64_t u64Now  = tmClock(pVM, pQueue->enmClock);
+    const uint32_t uRunGen = tmR3TimerQueueRunGenNext(pQueue);
+    while (   pTimer
+           && pTimer->u64Expire <= u64Now
+           && pTimer->uRunGen != uRunGen)
     {
-        PTMTIMER        pTimer    = pNext;
-        pNext = TMTIMER_GET_NEXT(pTimer);
         PPDMCRITSECT    pCritSect = pTimer->pCritSect;
         if (pCritSect)
         {
@@ -2286,21 +2428,13 @@ static void tmR3TimerQueueRun(PVM pVM, PTMTIMERQUEUE pQueue)
             Assert(!pTimer->offScheduleNext); /* this can trigger falsely */
 
             /* unlink */
-            const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
-            if (pPrev)
-                TMTIMER_SET_NEXT(pPrev, pNext);
-            else
-            {
-                TMTIMER_SET_HEAD(pQueue, pNext);
-                pQueue->u64Expire = pNext ? pNext->u64Expire : INT64_MAX;
-            }
-            if (pNext)
-                TMTIMER_SET_PREV(pNext, pPrev);
-            pTimer->offNext = 0;
-            pTimer->offPrev = 0;
+            tmTimerHeapRemove(pQueue, pTimer);
+            STAM_REL_PROFILE_ADD_PERIOD(&pQueue->StatLatency, TMTimerToNano(pTimer, u64Now - pTimer->u64Expire));
+            pTimer->uRunGen = uRunGen;
 
-            /* fire */
+            /* fire, without the timer lock so the owners of other queues aren't held up. */
             TM_SET_STATE(pTimer, TMTIMERSTATE_EXPIRED_DELIVER);
+            TM_UNLOCK_TIMERS(pVM);
             STAM_PROFILE_START(&pTimer->StatTimer, PrfTimer);
             switch (pTimer->enmType)
             {
@@ -2318,9 +2452,36 @@ static void tmR3TimerQueueRun(PVM pVM, PTMTIMERQUEUE pQueue)
             /* change the state if it wasn't changed already in the handler. */
             TM_TRY_SET_STATE(pTimer, TMTIMERSTATE_STOPPED, TMTIMERSTATE_EXPIRED_DELIVER, fRc);
             Log2(("tmR3TimerQueueRun: new state %s\n", tmTimerState(pTimer->enmState)));
+
+            /* Leave the timer lock before taking the TM lock again, others take them the other way around. */
+            if (pCritSect)
+                PDMCritSectLeave(pCritSect);
+            TM_LOCK_TIMERS(pVM);
+            if (pVM->tm.s.cDestroyWaiters)
+                RTSemEventMultiSignal(pVM->tm.s.hEvtHandlerDone);
+            pTimer = TMTIMER_GET_HEAD(pQueue);
+            continue;
+        }
+        else
+        {
+            /*
+             * Another thread changed the timer and put it on the schedule list.
+             * Process the list so it gets out of the way of the timers behind it,
+             * stop if it is still in transition and leave it to the next run.
+             */
+            PTMTIMER const pTimerBusy = pTimer;
+            tmTimerQueueSchedule(pVM, pQueue);
+            if (TMTIMER_GET_HEAD(pQueue) == pTimerBusy)
+            {
+                if (pCritSect)
+                    PDMCritSectLeave(pCritSect);
+                break;
+            }
         }
         if (pCritSect)
             PDMCritSectLeave(pCritSect);
+
+        pTimer = TMTIMER_GET_HEAD(pQueue);
     } /* run loop */
 }
 
@@ -2452,15 +2613,19 @@ static void tmR3TimerQueueRunVirtualSync(PVM pVM)
 
     /*
      * Process the expired timers moving the clock along as we progress.
+     * As in tmR3TimerQueueRun each timer fires at most once per run, a timer
+     * re-armed within the frame ends it.
      */
 #ifdef VBOX_STRICT
     uint64_t u64Prev = u64Now; NOREF(u64Prev);
 #endif
-    while (pNext && pNext->u64Expire <= u64Max)
+    uint32_t const uRunGen = tmR3TimerQueueRunGenNext(pQueue);
+    while (   pNext
+           && pNext->u64Expire <= u64Max
+           && pNext->uRunGen != uRunGen)
     {
-        /* Advance */
+        /* Advance, the handler of the previous timer may have changed the heap. */
         PTMTIMER pTimer = pNext;
-        pNext = TMTIMER_GET_NEXT(pTimer);
 
         /* Take the associated lock. */
         PPDMCRITSECT pCritSect = pTimer->pCritSect;
@@ -2483,8 +2648,14 @@ static void tmR3TimerQueueRunVirtualSync(PVM pVM)
         ASMAtomicWriteU64(&pVM->tm.s.u64VirtualSync, pTimer->u64Expire);
         ASMAtomicWriteBool(&pVM->tm.s.fVirtualSyncTicking, false);
 
-        /* Unlink it, change the state and do the callout. */
+        /* Unlink it, change the state and do the callout.  The latency is taken
+           against the virtual clock less what's been given up on, i.e. the lag
+           we're still trying to catch up on is included. */
         tmTimerQueueUnlinkActive(pQueue, pTimer);
+        pTimer->uRunGen = uRunGen;
+        STAM_REL_PROFILE_ADD_PERIOD(&pQueue->StatLatency,
+                                    u64VirtualNow - offSyncGivenUp > pTimer->u64Expire
+                                    ? u64VirtualNow - offSyncGivenUp - pTimer->u64Expire : 0);
         TM_SET_STATE(pTimer, TMTIMERSTATE_EXPIRED_DELIVER);
         STAM_PROFILE_START(&pTimer->StatTimer, PrfTimer);
         switch (pTimer->enmType)
@@ -2515,6 +2686,8 @@ static void tmR3TimerQueueRunVirtualSync(PVM pVM)
         /* Leave the associated lock. */
         if (pCritSect)
             PDMCritSectLeave(pCritSect);
+
+        pNext = TMTIMER_GET_HEAD(pQueue);
     } /* run loop */
 
 
@@ -3655,11 +3828,12 @@ static DECLCALLBACK(void) tmR3TimerInfo(PVM pVM, PCDBGFINFOHLP pHlp, const char
     NOREF(pszArgs);
     pHlp->pfnPrintf(pHlp,
                     "Timers (pVM=%p)\n"
-                    "%.*s %.*s %.*s %.*s Clock %18s %18s %6s %-25s Description\n",
+                    "%.*s %.*s %.*s %.*s %.*s Clock %18s %18s %6s %-25s Description\n",
                     pVM,
                     sizeof(RTR3PTR) * 2,        "pTimerR3        ",
                     sizeof(int32_t) * 2,        "offNext         ",
                     sizeof(int32_t) * 2,        "offPrev         ",
+                    sizeof(int32_t) * 2,        "offChild        ",
                     sizeof(int32_t) * 2,        "offSched        ",
                                                 "Time",
                                                 "Expire",
@@ -3669,10 +3843,11 @@ static DECLCALLBACK(void) tmR3TimerInfo(PVM pVM, PCDBGFINFOHLP pHlp, const char
     for (PTMTIMERR3 pTimer = pVM->tm.s.pCreated; pTimer; pTimer = pTimer->pBigNext)
     {
         pHlp->pfnPrintf(pHlp,
-                        "%p %08RX32 %08RX32 %08RX32 %s %18RU64 %18RU64 %6RU32 %-25s %s\n",
+                        "%p %08RX32 %08RX32 %08RX32 %08RX32 %s %18RU64 %18RU64 %6RU32 %-25s %s\n",
                         pTimer,
                         pTimer->offNext,
                         pTimer->offPrev,
+                        pTimer->offChild,
                         pTimer->offScheduleNext,
                         tmR3Get5CharClockName(pTimer->enmClock),
                         TMTimerGet(pTimer),
@@ -3685,6 +3860,18 @@ static DECLCALLBACK(void) tmR3TimerInfo(PVM pVM, PCDBGFINFOHLP pHlp, const char
 }
 
 
+/**
+ * @callback_method_impl{FNRTSORTCMP, Orders timers by expire time.}
+ */
+static DECLCALLBACK(int) tmR3TimerInfoActiveCompare(void const *pvElement1, void const *pvElement2, void *pvUser)
+{
+    PTMTIMERR3 const pTimer1 = (PTMTIMERR3)pvElement1;
+    PTMTIMERR3 const pTimer2 = (PTMTIMERR3)pvElement2;
+    NOREF(pvUser);
+    return pTimer1->u64Expire < pTimer2->u64Expire ? -1 : pTimer1->u64Expire > pTimer2->u64Expire ? 1 : 0;
+}
+
+
 /**
  * Display all active timers.
  *
@@ -3697,11 +3884,12 @@ static DECLCALLBACK(void) tmR3TimerInfoActive(PVM pVM, PCDBGFINFOHLP pHlp, const
     NOREF(pszArgs);
     pHlp->pfnPrintf(pHlp,
                     "Active Timers (pVM=%p)\n"
-                    "%.*s %.*s %.*s %.*s Clock %18s %18s %6s %-25s Description\n",
+                    "%.*s %.*s %.*s %.*s %.*s Clock %18s %18s %6s %-25s Description\n",
                     pVM,
                     sizeof(RTR3PTR) * 2,        "pTimerR3        ",
                     sizeof(int32_t) * 2,        "offNext         ",
                     sizeof(int32_t) * 2,        "offPrev         ",
+                    sizeof(int32_t) * 2,        "offChild        ",
                     sizeof(int32_t) * 2,        "offSched        ",
                                                 "Time",
                                                 "Expire",
@@ -3710,15 +3898,43 @@ static DECLCALLBACK(void) tmR3TimerInfoActive(PVM pVM, PCDBGFINFOHLP pHlp, const
     for (unsigned iQueue = 0; iQueue < TMCLOCK_MAX; iQueue++)
     {
         TM_LOCK_TIMERS(pVM);
+
+        /* The active timers are kept in a heap, so collect and sort them to
+           present them in the order they will expire. */
+        size_t cTimers = 0;
+        for (PTMTIMERR3 pTimer = TMTIMER_GET_HEAD(&pVM->tm.s.paTimerQueuesR3[iQueue]);
+             pTimer;
+             pTimer = tmTimerHeapWalkNext(pTimer))
+            cTimers++;
+        if (!cTimers)
+        {
+            TM_UNLOCK_TIMERS(pVM);
+            continue;
+        }
+
+        void **papvTimers = (void **)RTMemTmpAlloc(cTimers * sizeof(papvTimers[0]));
+        if (!papvTimers)
+        {
+            TM_UNLOCK_TIMERS(pVM);
+            pHlp->pfnPrintf(pHlp, "Out of memory collecting %zu active timers!\n", cTimers);
+            continue;
+        }
+        size_t iTimer = 0;
         for (PTMTIMERR3 pTimer = TMTIMER_GET_HEAD(&pVM->tm.s.paTimerQueuesR3[iQueue]);
              pTimer;
-             pTimer = TMTIMER_GET_NEXT(pTimer))
+             pTimer = tmTimerHeapWalkNext(pTimer))
+            papvTimers[iTimer++] = pTimer;
+        RTSortApvShell(papvTimers, cTimers, tmR3TimerInfoActiveCompare, NULL);
+
+        for (iTimer = 0; iTimer < cTimers; iTimer++)
         {
+            PTMTIMERR3 pTimer = (PTMTIMERR3)papvTimers[iTimer];
             pHlp->pfnPrintf(pHlp,
-                            "%p %08RX32 %08RX32 %08RX32 %s %18RU64 %18RU64 %6RU32 %-25s %s\n",
+                            "%p %08RX32 %08RX32 %08RX32 %08RX32 %s %18RU64 %18RU64 %6RU32 %-25s %s\n",
                             pTimer,
                             pTimer->offNext,
                             pTimer->offPrev,
+                            pTimer->offChild,
                             pTimer->offScheduleNext,
                             tmR3Get5CharClockName(pTimer->enmClock),
                             TMTimerGet(pTimer),
@@ -3728,6 +3944,7 @@ static DECLCALLBACK(void) tmR3TimerInfoActive(PVM pVM, PCDBGFINFOHLP pHlp, const
                             pTimer->pszDesc);
         }
         TM_UNLOCK_TIMERS(pVM);
+        RTMemTmpFree(papvTimers);
     }
 }
 
@@ -1044,6 +1044,11 @@ static int vmR3InitDoCompleted(PVM pVM, VMINITCOMPLETED enmWhat)
        handlers in their init completion method. */
     if (RT_SUCCESS(rc))
         rc = IOMR3InitCompleted(pVM, enmWhat);
+
+    /* STAM goes last so the export starts out with all the samples. */
+    if (   enmWhat == VMINITCOMPLETED_RING3
+        && RT_SUCCESS(rc))
+        rc = STAMR3InitCompleted(pVM);
     return rc;
 }
 
@@ -2193,6 +2198,7 @@ DECLCALLBACK(int) vmR3Destroy(PVM pVM)
         /*
          * Destroy the VM components.
          */
+        STAMR3Term(pVM); /* Stop the export before samples are freed. */
         int rc = TMR3Term(pVM);
         AssertRC(rc);
 #ifdef VBOX_WITH_DEBUGGER
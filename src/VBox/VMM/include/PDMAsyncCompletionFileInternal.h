@@ -26,6 +26,7 @@
 #include <VBox/vmm/tm.h>
 #include <iprt/types.h>
 #include <iprt/file.h>
+#include <iprt/ioqueue.h>
 #include <iprt/thread.h>
 #include <iprt/semaphore.h>
 #include <iprt/critsect.h>
@@ -46,6 +47,11 @@
  *  instead of managing larger blocks) to have this global for the whole VM.
  */
 
+/** The default number of requests an I/O queue manager keeps in flight. */
+#define PDMACEPFILEMGR_IOQUEUE_DEPTH_DEFAULT    256
+/** The maximum number of requests an I/O queue manager keeps in flight. */
+#define PDMACEPFILEMGR_IOQUEUE_DEPTH_MAX        _4K
+
 /** Enable for delay injection from the debugger. */
 #if 0
 # define PDM_ASYNC_COMPLETION_FILE_WITH_DELAY
@@ -100,6 +106,8 @@ typedef enum PDMACEPFILEMGRTYPE
     PDMACEPFILEMGRTYPE_SIMPLE = 0,
     /** Async I/O with host cache enabled. */
     PDMACEPFILEMGRTYPE_ASYNC,
+    /** Async I/O using the RTIoQueue API (io_uring on Linux). */
+    PDMACEPFILEMGRTYPE_IOQUEUE,
     /** 32bit hack */
     PDMACEPFILEMGRTYPE_32BIT_HACK = 0x7fffffff
 } PDMACEPFILEMGRTYPE;
@@ -158,6 +166,10 @@ typedef struct PDMACEPFILEMGR
     RTTHREAD                               Thread;
     /** The async I/O context for this manager. */
     RTFILEAIOCTX                           hAioCtx;
+    /** The I/O queue for this manager (PDMACEPFILEMGRTYPE_IOQUEUE only). */
+    RTIOQUEUE                              hIoQueue;
+    /** Flag whether the thread waits for completion events in the I/O queue. */
+    volatile bool                          fWaitingIoQueue;
     /** Flag whether the I/O manager was woken up. */
     volatile bool                          fWokenUp;
     /** List of endpoints assigned to this manager. */
@@ -274,6 +286,14 @@ typedef struct PDMASYNCCOMPLETIONEPCLASSFILE
     RTR3UINTPTR                         uBitmaskAlignment;
     /** Flag whether the out of resources warning was printed already. */
     bool                                fOutOfResourcesWarningPrinted;
+    /** The I/O queue provider used by PDMACEPFILEMGRTYPE_IOQUEUE managers. */
+    PCRTIOQUEUEPROVVTABLE               pIoQueueProv;
+    /** Flag whether the I/O queue provider can do async I/O on buffered files. */
+    bool                                fIoQueueBufferedAsync;
+    /** Flag whether to ask the I/O queue provider to poll the submission queue. */
+    bool                                fIoQueuePollSq;
+    /** Number of requests an I/O queue manager keeps in flight. */
+    uint32_t                            cIoQueueDepth;
 #ifdef PDM_ASYNC_COMPLETION_FILE_WITH_DELAY
     /** Timer for delayed request completion. */
     PTMTIMERR3                          pTimer;
@@ -499,6 +519,9 @@ typedef struct PDMACTASKFILE
     uint32_t                             offBounceBuffer;
     /** Flag whether this is a prefetch request. */
     bool                                 fPrefetch;
+    /** Flag whether the task was started already and only the next part has to
+     * be put into the I/O queue again (I/O queue manager, the queue was full). */
+    bool                                 fRestart;
     /** Already prepared native I/O request.
      * Used if the request is prepared already but
      * was not queued because the host has not enough
@@ -532,9 +555,12 @@ typedef struct PDMASYNCCOMPLETIONTASKFILE
 
 DECLCALLBACK(int) pdmacFileAioMgrFailsafe(RTTHREAD hThreadSelf, void *pvUser);
 DECLCALLBACK(int) pdmacFileAioMgrNormal(RTTHREAD hThreadSelf, void *pvUser);
+DECLCALLBACK(int) pdmacFileAioMgrIoQueue(RTTHREAD hThreadSelf, void *pvUser);
 
 int pdmacFileAioMgrNormalInit(PPDMACEPFILEMGR pAioMgr);
 void pdmacFileAioMgrNormalDestroy(PPDMACEPFILEMGR pAioMgr);
+int pdmacFileAioMgrIoQueueInit(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPDMACEPFILEMGR pAioMgr);
+void pdmacFileAioMgrIoQueueDestroy(PPDMACEPFILEMGR pAioMgr);
 
 int pdmacFileAioMgrCreate(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPPDMACEPFILEMGR ppAioMgr, PDMACEPFILEMGRTYPE enmMgrType);
 
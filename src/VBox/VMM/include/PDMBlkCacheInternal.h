@@ -44,6 +44,8 @@ RT_C_DECLS_BEGIN
 typedef struct PDMBLKLRULIST *PPDMBLKLRULIST;
 /** Pointer to the global cache structure. */
 typedef struct PDMBLKCACHEGLOBAL *PPDMBLKCACHEGLOBAL;
+/** Pointer to a cache shard. */
+typedef struct PDMBLKCACHESHARD *PPDMBLKCACHESHARD;
 /** Pointer to a cache entry waiter structure. */
 typedef struct PDMBLKCACHEWAITER *PPDMBLKCACHEWAITER;
 
@@ -62,12 +64,19 @@ typedef struct PDMBLKCACHEENTRY
     PPDMBLKLRULIST                  pList;
     /** Cache the entry belongs to. */
     PPDMBLKCACHE                    pBlkCache;
+    /** The shard whose LRU lists the entry is kept in. */
+    PPDMBLKCACHESHARD               pShard;
     /** Flags for this entry. Combinations of PDMACFILECACHE_* \#defines */
     volatile uint32_t               fFlags;
     /** Reference counter. Prevents eviction of the entry if > 0. */
     volatile uint32_t               cRefs;
     /** Size of the entry. */
     uint32_t                        cbData;
+    /** Flag whether the entry was accessed since it was last looked at by the
+     * eviction code. Set without holding any lock on a cache hit. */
+    volatile bool                   fReferenced;
+    /** Flag whether the entry was filled by read ahead and wasn't accessed yet. */
+    volatile bool                   fReadAhead;
     /** Pointer to the memory containing the data. */
     uint8_t                        *pbData;
     /** Head of list of tasks waiting for this one to finish. */
@@ -100,32 +109,93 @@ typedef struct PDMBLKLRULIST
 } PDMBLKLRULIST;
 
 /**
- * Global cache data.
+ * Cache replacement policy.
  */
-typedef struct PDMBLKCACHEGLOBAL
+typedef enum PDMBLKCACHEPOLICY
 {
-    /** Pointer to the owning VM instance. */
-    PVM                 pVM;
-    /** Maximum size of the cache in bytes. */
+    /** Invalid policy. */
+    PDMBLKCACHEPOLICY_INVALID = 0,
+    /** 2Q with fixed sized recently used and paged out lists (default). */
+    PDMBLKCACHEPOLICY_2Q,
+    /** Adaptive replacement cache (ARC) tuning the size of the recently used
+     * list based on the hits in the two ghost lists. */
+    PDMBLKCACHEPOLICY_ARC,
+    /** 32bit hack. */
+    PDMBLKCACHEPOLICY_32BIT_HACK = 0x7fffffff
+} PDMBLKCACHEPOLICY;
+
+/**
+ * Cache shard.
+ *
+ * The cache is split into several shards each managing a fixed part of the
+ * global cache size with its own LRU lists and lock so that I/O to different
+ * endpoints (or different regions of the same endpoint) doesn't serialize on
+ * a single lock. In ARC terms the recently used list is T1, the recently used
+ * but paged out list is B1, the frequently used list is T2 and the frequently
+ * used but paged out list is B2 (the latter is only used by the ARC policy).
+ */
+typedef struct PDMBLKCACHESHARD
+{
+    /** Critical section protecting the shard. */
+    RTCRITSECT          CritSect;
+    /** Pointer to the global cache data. */
+    PPDMBLKCACHEGLOBAL  pCache;
+    /** Maximum size of the shard in bytes. */
     uint32_t            cbMax;
-    /** Current size of the cache in bytes. */
+    /** Current size of the shard in bytes. */
     uint32_t            cbCached;
-    /** Critical section protecting the cache. */
-    RTCRITSECT          CritSect;
-    /** Maximum number of bytes cached. */
+    /** Maximum number of bytes in the recently used list (2Q). */
     uint32_t            cbRecentlyUsedInMax;
-    /** Maximum number of bytes in the paged out list .*/
+    /** Maximum number of bytes in the paged out list (2Q). */
     uint32_t            cbRecentlyUsedOutMax;
+    /** Adaptive target size of the recently used list in bytes (ARC). */
+    uint32_t            cbRecentlyUsedInTarget;
     /** Recently used cache entries list */
     PDMBLKLRULIST       LruRecentlyUsedIn;
     /** Scorecard cache entry list. */
     PDMBLKLRULIST       LruRecentlyUsedOut;
     /** List of frequently used cache entries */
     PDMBLKLRULIST       LruFrequentlyUsed;
+    /** Scorecard list of paged out frequently used entries (ARC). */
+    PDMBLKLRULIST       LruFrequentlyUsedOut;
+    /** Number of accesses served from the shard. */
+    STAMCOUNTER         StatHits;
+    /** Number of accesses which had to go to the medium. */
+    STAMCOUNTER         StatMisses;
+    /** Number of hits in the recently used ghost list. */
+    STAMCOUNTER         StatGhostHitsRecent;
+    /** Number of hits in the frequently used ghost list. */
+    STAMCOUNTER         StatGhostHitsFrequent;
+    /** Number of entries kept because they were referenced when up for eviction. */
+    STAMCOUNTER         StatSecondChance;
+    /** Number of times the shard lock was contended. */
+    STAMCOUNTER         StatLockContention;
+} PDMBLKCACHESHARD;
+AssertCompileMemberAlignment(PDMBLKCACHESHARD, StatHits, sizeof(uint64_t));
+
+/**
+ * Global cache data.
+ */
+typedef struct PDMBLKCACHEGLOBAL
+{
+    /** Pointer to the owning VM instance. */
+    PVM                 pVM;
+    /** Maximum size of the cache in bytes. */
+    uint32_t            cbMax;
+    /** The replacement policy used by all shards. */
+    PDMBLKCACHEPOLICY   enmPolicy;
+    /** Critical section protecting the list of users. */
+    RTCRITSECT          CritSect;
+    /** Number of shards. */
+    uint32_t            cShards;
+    /** Shard index handed to the next user of the cache. */
+    uint32_t            idxShardNext;
     /** Commit timeout in milli seconds */
     uint32_t            u32CommitTimeoutMs;
     /** Number of dirty bytes needed to start a commit of the data to the disk. */
     uint32_t            cbCommitDirtyThreshold;
+    /** Default maximum read ahead window for new users in bytes, 0 disables read ahead. */
+    uint32_t            cbReadAheadMaxDef;
     /** Current number of dirty bytes in the cache. */
     volatile uint32_t   cbDirty;
     /** Flag whether the VM was suspended becaus of an I/O error. */
@@ -158,10 +228,13 @@ typedef struct PDMBLKCACHEGLOBAL
     /** Number of times a buffer could be reused. */
     STAMCOUNTER         StatBuffersReused;
 #endif
+    /** The shards (variable size). */
+    PDMBLKCACHESHARD    aShards[1];
 } PDMBLKCACHEGLOBAL;
 #ifdef VBOX_WITH_STATISTICS
 AssertCompileMemberAlignment(PDMBLKCACHEGLOBAL, cHits, sizeof(uint64_t));
 #endif
+AssertCompileMemberAlignment(PDMBLKCACHEGLOBAL, aShards, sizeof(uint64_t));
 
 /**
  * Block cache type.
@@ -191,7 +264,9 @@ typedef struct PDMBLKCACHE
     RTSEMRW                       SemRWEntries;
     /** Pointer to the gobal cache data */
     PPDMBLKCACHEGLOBAL            pCache;
-    /** Lock protecting the dirty entries list. */
+    /** Index of the first shard used for entries of this user. */
+    uint32_t                      idxShardBase;
+    /** Lock protecting the dirty entries list and the read ahead state. */
     RTSPINLOCK                    LockList;
     /** List of dirty but not committed entries for this endpoint. */
     RTLISTANCHOR                  ListDirtyNotCommitted;
@@ -268,6 +343,27 @@ typedef struct PDMBLKCACHE
     /** Number of outstanding I/O transfers. */
     volatile uint32_t             cIoXfersActive;
 
+    /** Maximum size of the read ahead window in bytes, 0 if read ahead is disabled. */
+    volatile uint32_t             cbReadAheadMax;
+    /** Current size of the read ahead window in bytes. */
+    uint32_t                      cbReadAheadWindow;
+    /** Size of the medium in bytes, read ahead never goes beyond, UINT64_MAX if unknown. */
+    volatile uint64_t             cbMedium;
+    /** Offset where the next read of a sequential stream is expected. */
+    uint64_t                      offReadNext;
+    /** End of the range which was read ahead for the current stream. */
+    uint64_t                      offReadAheadEnd;
+    /** Number of consecutive sequential reads. */
+    uint32_t                      cReadsSequential;
+    /** Number of bytes read ahead. */
+    STAMCOUNTER                   StatReadAheadBytes;
+    /** Number of entries created by read ahead. */
+    STAMCOUNTER                   StatReadAheadEntries;
+    /** Number of read ahead entries accessed later on. */
+    STAMCOUNTER                   StatReadAheadUsed;
+    /** Number of read ahead entries evicted or dropped without being accessed. */
+    STAMCOUNTER                   StatReadAheadWasted;
+
 } PDMBLKCACHE, *PPDMBLKCACHE;
 #ifdef VBOX_WITH_STATISTICS
 AssertCompileMemberAlignment(PDMBLKCACHE, StatWriteDeferred, sizeof(uint64_t));
@@ -1266,6 +1266,10 @@ typedef PGMLIVESAVERAMPAGE *PPGMLIVESAVERAMPAGE;
 /** The max value of PGMLIVESAVERAMPAGE::cDirtied. */
 #define PGMLIVSAVEPAGE_MAX_DIRTIED 0x00fffff0
 
+/** The max number of threads scanning RAM during live save, see
+ * PGM::LiveSave::cScanThreads. */
+#define PGM_LIVE_SAVE_MAX_SCAN_THREADS  64
+
 
 /**
  * RAM range for GC Phys to HC Phys conversion.
@@ -3210,6 +3214,18 @@ typedef struct PGM
     PGMPHYSHANDLERTYPE              hRomPhysHandlerType;
     /** Physical access handler type for MMIO2 dirty page tracing. */
     PGMPHYSHANDLERTYPE              hMmio2DirtyPhysHandlerType;
+    /** Physical access handler type for RAM pages still in the saved state
+     * during a lazy (post-copy) restore. */
+    PGMPHYSHANDLERTYPE              hLazyRestorePhysHandlerType;
+    /** @cfgm{/PGM/LazyRestore, boolean, false}
+     * Whether to resume the VM before all RAM has been read back from a saved
+     * state written with /PGM/SaveForLazyRestore, fetching the remaining pages
+     * on first access and in the background. */
+    bool                            fLazyRestore;
+    /** Padding (keeps the alignment of ChunkR3Map and the TLBs). */
+    bool                            afPadding1[19];
+    /** The lazy restore state (PGMSavedState.cpp), NULL if not active. */
+    R3PTRTYPE(struct PGMLAZYRESTORE *) pLazyRestoreR3;
 
     /** 4 MB page mask; 32 or 36 bits depending on PSE-36 (identical for all VCPUs) */
     RTGCPHYS                        GCPhys4MBPSEMask;
@@ -3447,8 +3463,16 @@ typedef struct PGM
         uint32_t                    cIgnoredPages;
         /** Indicates that a live save operation is active. */
         bool                        fActive;
-        /** Padding. */
-        bool                        afReserved[2];
+        /** @cfgm{/PGM/SaveDedup, boolean, true}
+         * Whether to elide RAM pages whose content was already sent in the
+         * current saved state stream (see PGM_STATE_REC_RAM_DUP). */
+        bool                        fDedup;
+        /** @cfgm{/PGM/SaveForLazyRestore, boolean, false}
+         * Whether to save RAM in a separate unit in the final pass and follow it
+         * by a page index, so the state can be restored lazily (see
+         * PGM::fLazyRestore).  Live saving RAM in earlier passes and deduplication
+         * are disabled by this. */
+        bool                        fRamIndex;
         /** The next history index. */
         uint8_t                     iDirtyPagesHistory;
         /** History of the total amount of dirty pages. */
@@ -3466,7 +3490,27 @@ typedef struct PGM
         uint64_t                    uSaveStartNS;
         /** Pages per second (for statistics). */
         uint32_t                    cPagesPerSecond;
-        uint32_t                    cAlignment;
+        /** Percentage of the RAM pages sent by the current save that were
+         *  elided because they were zero or duplicates (for statistics). */
+        uint32_t                    uDedupPct;
+        /** Number of RAM pages sent as raw page data by the current save. */
+        uint64_t                    cDedupRawPages;
+        /** Number of RAM pages found to be all zeros by the current save. */
+        uint64_t                    cDedupZeroPages;
+        /** Number of RAM pages sent as references to an identical page. */
+        uint64_t                    cDedupDupPages;
+        /** The content hash dictionary of the current save (PGMSavedState.cpp). */
+        R3PTRTYPE(struct PGMLSDEDUP *) pDedupR3;
+        /** @cfgm{/PGM/LiveSaveScanThreads, uint32_t, min(host CPUs / 2, 8)}
+         * The number of threads (including the saving one) to scan RAM for
+         * dirty pages with.  Zero or one means no worker pool.  Max
+         * PGM_LIVE_SAVE_MAX_SCAN_THREADS. */
+        uint32_t                    cScanThreads;
+        uint32_t                    u32Padding;
+        /** The worker pool used for scanning RAM, NULL if not used. */
+        R3PTRTYPE(struct RTREQPOOLINT *) hScanPoolR3;
+        /** The RAM page index of the current save (PGMSavedState.cpp). */
+        R3PTRTYPE(struct PGMRAMIDX *) pRamIdxR3;
     } LiveSave;
 
     /** @name   Error injection.
@@ -4006,6 +4050,12 @@ void            pgmHandlerPhysicalResetAliasedPage(PVMCC pVM, PPGMPAGE pPage, RT
 DECLHIDDEN(int) pgmHandlerPhysicalResetMmio2WithBitmap(PVMCC pVM, RTGCPHYS GCPhys, void *pvBitmap, uint32_t offBitmap);
 DECLCALLBACK(void) pgmR3InfoHandlers(PVM pVM, PCDBGFINFOHLP pHlp, const char *pszArgs);
 int             pgmR3InitSavedState(PVM pVM, uint64_t cbRam);
+#ifdef IN_RING3
+int             pgmR3LazyRestoreFetchLocked(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
+void            pgmR3LazyRestoreReset(PVM pVM);
+void            pgmR3LazyRestoreTerm(PVM pVM);
+FNPGMPHYSHANDLER pgmR3LazyRestoreHandler;
+#endif
 
 int             pgmPhysAllocPage(PVMCC pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
 int             pgmPhysAllocLargePage(PVMCC pVM, RTGCPHYS GCPhys);
@@ -24,6 +24,7 @@
 #include <VBox/cdefs.h>
 #include <VBox/types.h>
 #include <VBox/vmm/ssm.h>
+#include <VBox/vmm/stam.h>
 #include <iprt/critsect.h>
 
 RT_C_DECLS_BEGIN
@@ -316,7 +317,19 @@ typedef struct SSM
     bool                    fInitialized;
     /** Current pass (for STAM). */
     uint32_t                uPass;
-    uint32_t                u32Alignment;
+    /** The number of blocks currently queued in the save compression pipeline. */
+    uint32_t volatile       cZipQueueDepth;
+
+    /** Compression pipeline: compressing a block (worker threads). */
+    STAMPROFILE             StatZipCompress;
+    /** Compression pipeline: writing finished records to the stream in order. */
+    STAMPROFILE             StatZipWrite;
+    /** Compression pipeline: uncompressed bytes submitted. */
+    STAMCOUNTER             StatZipBytesIn;
+    /** Compression pipeline: record bytes written to the stream. */
+    STAMCOUNTER             StatZipBytesOut;
+    /** Compression pipeline: times the producer had to wait for a worker. */
+    STAMCOUNTER             StatZipStalls;
 } SSM;
 /** Pointer to SSM VM instance data. */
 typedef SSM *PSSM;
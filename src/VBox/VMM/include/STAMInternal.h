@@ -28,6 +28,8 @@
 #include <VBox/vmm/gmm.h>
 #include <iprt/list.h>
 #include <iprt/semaphore.h>
+#include <iprt/shmem.h>
+#include <iprt/thread.h>
 
 
 
@@ -96,6 +98,8 @@ typedef struct STAMDESC
         PSTAMPROFILEADV pProfileAdv;
         /** Ratio, unsigned 32-bit. */
         PSTAMRATIOU32   pRatioU32;
+        /** Log2 histogram. */
+        PSTAMHISTOGRAM  pHistogram;
         /** unsigned 8-bit. */
         uint8_t        *pu8;
         /** unsigned 16-bit. */
@@ -128,6 +132,36 @@ typedef struct STAMDESC
 } STAMDESC;
 
 
+/**
+ * The binary export state, see grp_stam_export.
+ */
+typedef struct STAMEXPORT
+{
+    /** The shared memory object. */
+    RTSHMEM                 hShMem;
+    /** The mapping of the object (header first). */
+    PSTAMEXPORTHDR          pHdr;
+    /** The size of the object. */
+    size_t                  cbShMem;
+    /** The update thread. */
+    RTTHREAD                hThread;
+    /** Event semaphore the update thread waits on between updates. */
+    RTSEMEVENT              hEvtWait;
+    /** Set when the update thread should quit. */
+    bool volatile           fShutdown;
+    /** Set when the sample table needs rewriting. */
+    bool                    fLayoutDirty;
+    /** The update interval in milliseconds. */
+    uint32_t                cMsInterval;
+    /** The STAMUSERPERVM::uGeneration value the sample table was written for. */
+    uint32_t                uGeneration;
+    /** The name of the shared memory object. */
+    char                    szName[64];
+} STAMEXPORT;
+/** Pointer to the binary export state. */
+typedef STAMEXPORT *PSTAMEXPORT;
+
+
 /**
  * STAM data kept in the UVM.
  */
@@ -146,10 +180,12 @@ typedef struct STAMUSERPERVM
     /** The number of registered host CPU leaves. */
     uint32_t                cRegisteredHostCpus;
 
-    /** Explicit alignment padding. */
-    uint32_t                uAlignment;
+    /** Incremented whenever samples are registered or deregistered. */
+    uint32_t                uGeneration;
     /** The copy of the GMM statistics. */
     GMMSTATS                GMMStats;
+    /** The binary export state, NULL if not exporting. */
+    PSTAMEXPORT             pExport;
 } STAMUSERPERVM;
 #ifdef IN_RING3
 AssertCompileMemberAlignment(STAMUSERPERVM, GMMStats, 8);
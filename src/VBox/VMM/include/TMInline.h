@@ -22,8 +22,213 @@
 #endif
 
 
+/*
+ * The active timers of a queue are kept in a pairing heap ordered by expire
+ * time.  The heap is intrusive and uses the self relative offsets in the
+ * timer structure, so it works the same in all contexts and never allocates:
+ *      - offChild points to the first (leftmost) child,
+ *      - offNext points to the next sibling,
+ *      - offPrev points to the previous sibling, or to the parent for the
+ *        leftmost child.  It is 0 only for the root.
+ * The root is TMTIMERQUEUE::offActive and always the timer expiring first.
+ *
+ * Linking is O(1), unlinking any timer is O(log n) amortized.
+ */
+
+
+/**
+ * Melds two pairing heaps.
+ *
+ * @returns The root of the combined heap.
+ * @param   pA          Root of the first heap, NULL if empty.
+ * @param   pB          Root of the second heap, NULL if empty.
+ *
+ * @remarks Both roots must not have any siblings.
+ */
+DECL_FORCE_INLINE(PTMTIMER) tmTimerHeapMeld(PTMTIMER pA, PTMTIMER pB)
+{
+    if (!pA)
+        return pB;
+    if (!pB)
+        return pA;
+
+    if (pB->u64Expire < pA->u64Expire)
+    {
+        PTMTIMER pTmp = pA;
+        pA = pB;
+        pB = pTmp;
+    }
+
+    /* pB becomes the leftmost child of pA. */
+    PTMTIMER pChild = TMTIMER_GET_CHILD(pA);
+    TMTIMER_SET_NEXT(pB, pChild);
+    if (pChild)
+        TMTIMER_SET_PREV(pChild, pB);
+    TMTIMER_SET_PREV(pB, pA);
+    TMTIMER_SET_CHILD(pA, pB);
+    return pA;
+}
+
+
+/**
+ * Combines a list of sibling heaps into a single heap (two pass pairing).
+ *
+ * @returns The root of the combined heap, NULL if the list is empty.
+ * @param   pFirst      The first sibling, NULL if none.
+ */
+DECLINLINE(PTMTIMER) tmTimerHeapMergePairs(PTMTIMER pFirst)
+{
+    /* Pass 1: Meld pairs from left to right, stacking the results using offNext. */
+    PTMTIMER pStack = NULL;
+    while (pFirst)
+    {
+        PTMTIMER pA = pFirst;
+        PTMTIMER pB = TMTIMER_GET_NEXT(pA);
+        pFirst = pB ? TMTIMER_GET_NEXT(pB) : NULL;
+
+        pA->offNext = 0;
+        pA->offPrev = 0;
+        if (pB)
+        {
+            pB->offNext = 0;
+            pB->offPrev = 0;
+        }
+
+        PTMTIMER pPair = tmTimerHeapMeld(pA, pB);
+        TMTIMER_SET_NEXT(pPair, pStack);
+        pStack = pPair;
+    }
+
+    /* Pass 2: Meld the pairs from right to left. */
+    PTMTIMER pRoot = NULL;
+    while (pStack)
+    {
+        PTMTIMER pCur = pStack;
+        pStack = TMTIMER_GET_NEXT(pCur);
+        pCur->offNext = 0;
+        pRoot = tmTimerHeapMeld(pRoot, pCur);
+    }
+
+    return pRoot;
+}
+
+
+/**
+ * Returns the parent of a timer in the active heap.
+ *
+ * @returns The parent timer, NULL for the root.
+ * @param   pTimer      The timer.
+ */
+DECLINLINE(PTMTIMER) tmTimerHeapGetParent(PTMTIMER pTimer)
+{
+    PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
+    while (pPrev && TMTIMER_GET_CHILD(pPrev) != pTimer)
+    {
+        pTimer = pPrev;
+        pPrev  = TMTIMER_GET_PREV(pTimer);
+    }
+    return pPrev;
+}
+
+
+/**
+ * Walks the active heap in pre-order, for code which has to look at all
+ * active timers but doesn't care about their order.
+ *
+ * @returns The next timer, NULL when done.
+ * @param   pTimer      The current timer.
+ */
+DECLINLINE(PTMTIMER) tmTimerHeapWalkNext(PTMTIMER pTimer)
+{
+    if (pTimer->offChild)
+        return TMTIMER_GET_CHILD(pTimer);
+    while (pTimer)
+    {
+        if (pTimer->offNext)
+            return TMTIMER_GET_NEXT(pTimer);
+        pTimer = tmTimerHeapGetParent(pTimer);
+    }
+    return NULL;
+}
+
+
 /**
- * Used to unlink a timer from the active list.
+ * Removes a timer from the active heap without looking at its state.
+ *
+ * @param   pQueue      The timer queue.
+ * @param   pTimer      The timer to remove.
+ *
+ * @remarks Called while owning the relevant queue lock.
+ */
+DECLINLINE(void) tmTimerHeapRemove(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
+{
+    PTMTIMER pSubHeap = tmTimerHeapMergePairs(TMTIMER_GET_CHILD(pTimer));
+    pTimer->offChild = 0;
+
+    PTMTIMER const pHead = TMTIMER_GET_HEAD(pQueue);
+    PTMTIMER       pRoot;
+    if (pTimer == pHead)
+        pRoot = pSubHeap;
+    else
+    {
+        /* Detach it from the parent or the left sibling and meld the children with the rest. */
+        const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
+        const PTMTIMER pNext = TMTIMER_GET_NEXT(pTimer);
+        Assert(pPrev);
+        if (TMTIMER_GET_CHILD(pPrev) == pTimer)
+            TMTIMER_SET_CHILD(pPrev, pNext);
+        else
+            TMTIMER_SET_NEXT(pPrev, pNext);
+        if (pNext)
+            TMTIMER_SET_PREV(pNext, pPrev);
+        pTimer->offNext = 0;
+        pTimer->offPrev = 0;
+
+        /* The expire time of a timer pending rescheduling can change while it is
+           linked, so the children might well end up in front of the current head. */
+        pRoot = tmTimerHeapMeld(pHead, pSubHeap);
+    }
+
+    if (pRoot != pHead)
+    {
+        TMTIMER_SET_HEAD(pQueue, pRoot);
+        pQueue->u64Expire = pRoot ? pRoot->u64Expire : INT64_MAX;
+        DBGFTRACE_U64_TAG(pTimer->CTX_SUFF(pVM), pQueue->u64Expire, "tmTimerQueueUnlinkActive");
+    }
+}
+
+
+/**
+ * Links a timer into the active heap of a timer queue.
+ *
+ * @param   pQueue          The queue.
+ * @param   pTimer          The timer.
+ * @param   u64Expire       The timer expiration time.
+ *
+ * @remarks Called while owning the relevant queue lock.
+ */
+DECL_FORCE_INLINE(void) tmTimerQueueLinkActive(PTMTIMERQUEUE pQueue, PTMTIMER pTimer, uint64_t u64Expire)
+{
+    Assert(!pTimer->offNext);
+    Assert(!pTimer->offPrev);
+    Assert(!pTimer->offChild);
+    Assert(pTimer->u64Expire == u64Expire);
+    Assert(pTimer->enmState == TMTIMERSTATE_ACTIVE || pTimer->enmClock != TMCLOCK_VIRTUAL_SYNC); /* (active is not a stable state) */
+
+    PTMTIMER const pHead = TMTIMER_GET_HEAD(pQueue);
+    if (tmTimerHeapMeld(pHead, pTimer) == pTimer)
+    {
+        TMTIMER_SET_HEAD(pQueue, pTimer);
+        ASMAtomicWriteU64(&pQueue->u64Expire, u64Expire);
+        DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive head", R3STRING(pTimer->pszDesc));
+    }
+    else
+        DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive", R3STRING(pTimer->pszDesc));
+}
+
+
+/**
+ * Used to unlink a timer from the active heap.
  *
  * @param   pQueue      The timer queue.
  * @param   pTimer      The timer that needs linking.
@@ -39,20 +244,7 @@ DECL_FORCE_INLINE(void) tmTimerQueueUnlinkActive(PTMTIMERQUEUE pQueue, PTMTIMER
            : enmState == TMTIMERSTATE_PENDING_SCHEDULE || enmState == TMTIMERSTATE_PENDING_STOP_SCHEDULE);
 #endif
 
-    const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
-    const PTMTIMER pNext = TMTIMER_GET_NEXT(pTimer);
-    if (pPrev)
-        TMTIMER_SET_NEXT(pPrev, pNext);
-    else
-    {
-        TMTIMER_SET_HEAD(pQueue, pNext);
-        pQueue->u64Expire = pNext ? pNext->u64Expire : INT64_MAX;
-        DBGFTRACE_U64_TAG(pTimer->CTX_SUFF(pVM), pQueue->u64Expire, "tmTimerQueueUnlinkActive");
-    }
-    if (pNext)
-        TMTIMER_SET_PREV(pNext, pPrev);
-    pTimer->offNext = 0;
-    pTimer->offPrev = 0;
+    tmTimerHeapRemove(pQueue, pTimer);
 }
 
 #endif /* !VMM_INCLUDED_SRC_include_TMInline_h */
@@ -177,10 +177,16 @@ typedef struct TMTIMER
     /** Timer relative offset to the next timer in the schedule list. */
     int32_t volatile        offScheduleNext;
 
-    /** Timer relative offset to the next timer in the chain. */
+    /** Timer relative offset to the next sibling in the active heap. */
     int32_t                 offNext;
-    /** Timer relative offset to the previous timer in the chain. */
+    /** Timer relative offset to the previous sibling in the active heap, or to
+     * the parent if this is the leftmost child. */
     int32_t                 offPrev;
+    /** Timer relative offset to the first child in the active heap. */
+    int32_t                 offChild;
+    /** The run of the queue which fired the timer last (TMTIMERQUEUE::uRunGen),
+     * zero if it never fired. */
+    uint32_t                uRunGen;
 
     /** Pointer to the VM the timer belongs to - R3 Ptr. */
     PVMR3                   pVMR3;
@@ -254,6 +260,10 @@ AssertCompileMemberSize(TMTIMER, enmState, sizeof(uint32_t));
 #define TMTIMER_SET_PREV(pTimer, pPrev) ((pTimer)->offPrev = (pPrev) ? (intptr_t)(pPrev) - (intptr_t)(pTimer) : 0)
 /** Set the next timer link. */
 #define TMTIMER_SET_NEXT(pTimer, pNext) ((pTimer)->offNext = (pNext) ? (intptr_t)(pNext) - (intptr_t)(pTimer) : 0)
+/** Get the first child timer. */
+#define TMTIMER_GET_CHILD(pTimer) ((PTMTIMER)((pTimer)->offChild ? (intptr_t)(pTimer) + (pTimer)->offChild : 0))
+/** Set the first child timer link. */
+#define TMTIMER_SET_CHILD(pTimer, pChild) ((pTimer)->offChild = (pChild) ? (intptr_t)(pChild) - (intptr_t)(pTimer) : 0)
 
 
 /**
@@ -267,9 +277,9 @@ typedef struct TMTIMERQUEUE
      * Updated by EMT when scheduling the queue or modifying the head timer.
      * Assigned UINT64_MAX when there is no head timer. */
     uint64_t                u64Expire;
-    /** Doubly linked list of active timers.
+    /** Root of the pairing heap of active timers (see TMInline.h).
      *
-     * When no scheduling is pending, this list is will be ordered by expire time (ascending).
+     * When no scheduling is pending, this is the timer expiring first.
      * Access is serialized by only letting the emulation thread (EMT) do changes.
      *
      * The offset is relative to the queue structure.
@@ -286,18 +296,33 @@ typedef struct TMTIMERQUEUE
     int32_t volatile        offSchedule;
     /** The clock for this queue. */
     TMCLOCK                 enmClock;
-    /** Pad the structure up to 32 bytes. */
-    uint32_t                au32Padding[3];
+    /** The EMT running this queue (see TMR3TimerQueuesDo).
+     * This is TM::idTimerCpu unless configured otherwise, and always so for
+     * TMCLOCK_VIRTUAL_SYNC and TMCLOCK_TSC. */
+    VMCPUID                 idCpuOwner;
+    /** Delay from the expire time until a timer gets run (ns).
+     * Lives here rather than in TM as the VM structure has no room to spare. */
+    STAMPROFILE             StatLatency;
+    /** Generation of the current or last run of the queue, never zero.
+     * Each timer fires at most once per run, see tmR3TimerQueueRun. */
+    uint32_t                uRunGen;
+    /** Pad the structure up to 64 bytes. */
+    uint32_t                u32Padding;
 } TMTIMERQUEUE;
+AssertCompileSize(TMTIMERQUEUE, 64);
 
 /** Pointer to a timer queue. */
 typedef TMTIMERQUEUE *PTMTIMERQUEUE;
 
-/** Get the head of the active timer list. */
+/** Get the root of the active timer heap, i.e. the timer expiring first. */
 #define TMTIMER_GET_HEAD(pQueue)        ((PTMTIMER)((pQueue)->offActive ? (intptr_t)(pQueue) + (pQueue)->offActive : 0))
-/** Set the head of the active timer list. */
+/** Set the root of the active timer heap. */
 #define TMTIMER_SET_HEAD(pQueue, pHead) ((pQueue)->offActive = pHead ? (intptr_t)pHead - (intptr_t)(pQueue) : 0)
 
+/** Get the EMT running the timer queue of the given clock. */
+#define TMQUEUE_GET_OWNER_CPU(a_pVM, a_enmClock) \
+    VMCC_GET_CPU(a_pVM, (a_pVM)->tm.s.CTX_SUFF(paTimerQueues)[a_enmClock].idCpuOwner)
+
 
 /**
  * CPU load data set.
@@ -555,12 +580,16 @@ typedef struct TM
     /** Interval in milliseconds of the pTimer timer. */
     uint32_t                    u32TimerMillies;
 
-    /** Indicates that queues are being run. */
-    bool volatile               fRunningQueues;
     /** Indicates that the virtual sync queue is being run. */
     bool volatile               fRunningVirtualSyncQueue;
     /** Alignment */
-    bool                        afAlignment3[2];
+    bool                        afAlignment3[3];
+    /** Number of TMR3TimerDestroy calls waiting for a handler running on
+     * another EMT to return.  Protected by the timer lock. */
+    uint32_t                    cDestroyWaiters;
+    /** Signalled by tmR3TimerQueueRun when a handler returns while
+     * cDestroyWaiters is non-zero. */
+    R3PTRTYPE(RTSEMEVENTMULTI)  hEvtHandlerDone;
 
     /** Lock serializing access to the timer lists. */
     PDMCRITSECT                 TimerCritSect;
@@ -721,7 +750,10 @@ typedef struct TMCPU
 
     /** CPU timestamp ticking enabled indicator (bool). (RDTSC) */
     bool                        fTSCTicking;
-    bool                        afAlignment0[3]; /**< alignment padding */
+    /** Indicates that the EMT is running the timer queues it owns (see
+     * TMR3TimerQueuesDo), so there is no point in raising VMCPU_FF_TIMER. */
+    bool volatile               fRunningQueues;
+    bool                        afAlignment0[2]; /**< alignment padding */
 
     /** The offset between the host tick (TSC/virtual depending on the TSC mode) and
      *  the guest tick. */
@@ -399,6 +399,8 @@ int main(int argc, char **argv)
         { 0, 0, 0, VINF_SUCCESS, true,  RTZIPTYPE_LZF,   RTZIPLEVEL_DEFAULT, "RTZipBlock/LZF"   },
         { 0, 0, 0, VINF_SUCCESS, true,  RTZIPTYPE_LZJB,  RTZIPLEVEL_DEFAULT, "RTZipBlock/LZJB"  },
         { 0, 0, 0, VINF_SUCCESS, true,  RTZIPTYPE_LZO,   RTZIPLEVEL_DEFAULT, "RTZipBlock/LZO"   },
+        { 0, 0, 0, VINF_SUCCESS, true,  RTZIPTYPE_LZ4,   RTZIPLEVEL_DEFAULT, "RTZipBlock/LZ4"   },
+        { 0, 0, 0, VINF_SUCCESS, true,  RTZIPTYPE_ZSTD,  RTZIPLEVEL_FAST,    "RTZipBlock/Zstd"  },
     };
     RTPrintf("tstCompressionBenchmark: TESTING..");
     for (uint32_t i = 0; i < cIterations; i++)
@@ -26,6 +26,7 @@
 #include "VMInternal.h" /* UVM */
 #include <VBox/vmm/vm.h>
 #include <VBox/vmm/uvm.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/pdmasynccompletion.h>
 #include <VBox/vmm/vmm.h>
 #include <VBox/vmm/cpum.h>
@@ -37,6 +38,7 @@
 #include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/file.h>
+#include <iprt/getopt.h>
 #include <iprt/initterm.h>
 #include <iprt/semaphore.h>
 #include <iprt/rand.h>
@@ -44,6 +46,7 @@
 #include <iprt/path.h>
 #include <iprt/stream.h>
 #include <iprt/thread.h>
+#include <iprt/time.h>
 #include <iprt/param.h>
 #include <iprt/message.h>
 
@@ -155,6 +158,16 @@ uint8_t *g_pbTestPattern = NULL;
 size_t   g_cbTestPattern;
 /** Array holding test files. */
 PDMACTESTFILE g_aTestFiles[NR_OPEN_ENDPOINTS];
+/** The I/O manager to use, NULL for the default. */
+const char   *g_pszIoMgr = NULL;
+/** The I/O queue depth to configure, 0 for the default. */
+uint32_t      g_cIoQueueDepth = 0;
+/** Maximum number of active tasks per endpoint. */
+uint32_t      g_cTasksActiveMax = TASK_ACTIVE_MAX;
+/** Number of completed requests. */
+volatile uint64_t g_cReqsCompleted = 0;
+/** Number of bytes transferred by the completed requests. */
+volatile uint64_t g_cbTransferred = 0;
 
 static DECLCALLBACK(void) tstPDMACStressTestFileTaskCompleted(PVM pVM, void *pvUser, void *pvUser2, int rcReq);
 
@@ -403,6 +416,9 @@ static DECLCALLBACK(void) tstPDMACStressTestFileTaskCompleted(PVM pVM, void *pvU
         tstPDMACStressTestFileVerify(pTestFile, pTestTask); /* Will assert if it fails */
     }
 
+    ASMAtomicIncU64(&g_cReqsCompleted);
+    ASMAtomicAddU64(&g_cbTransferred, pTestTask->DataSeg.cbSeg);
+
     RTMemFree(pTestTask->DataSeg.pvSeg);
     pTestTask->fActive = false;
     AssertMsg(pTestFile->cTasksActiveCurr > 0, ("Trying to complete a non active task\n"));
@@ -450,7 +466,7 @@ static int tstPDMACStressTestFileOpen(PVM pVM, PPDMACTESTFILE pTestFile, unsigne
         }
 
         /* Init task array. */
-        pTestFile->cTasksActiveMax = RTRandU32Ex(1, TASK_ACTIVE_MAX);
+        pTestFile->cTasksActiveMax = RTRandU32Ex(1, g_cTasksActiveMax);
         pTestFile->paTasks         = (PPDMACTESTFILETASK)RTMemAllocZ(pTestFile->cTasksActiveMax * sizeof(PDMACTESTFILETASK));
         if (pTestFile->paTasks)
         {
@@ -569,6 +585,33 @@ static void tstPDMACStressTestPatternDestroy(void)
     RTMemFree(g_pbTestPattern);
 }
 
+/**
+ * Constructs the default configuration and applies the async completion
+ * settings given on the command line.
+ */
+static DECLCALLBACK(int) tstPDMACStressTestConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    RT_NOREF2(pUVM, pvUser);
+
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (   RT_SUCCESS(rc)
+        && (g_pszIoMgr || g_cIoQueueDepth))
+    {
+        PCFGMNODE pCfgFile = NULL;
+        rc = CFGMR3InsertNode(CFGMR3GetRoot(pVM), "PDM", NULL);
+        if (RT_SUCCESS(rc) || rc == VERR_CFGM_NODE_EXISTS)
+            rc = CFGMR3InsertNode(CFGMR3GetChild(CFGMR3GetRoot(pVM), "PDM"), "AsyncCompletion", NULL);
+        if (RT_SUCCESS(rc) || rc == VERR_CFGM_NODE_EXISTS)
+            rc = CFGMR3InsertNode(CFGMR3GetChild(CFGMR3GetRoot(pVM), "PDM/AsyncCompletion"), "File", &pCfgFile);
+        if (RT_SUCCESS(rc) && g_pszIoMgr)
+            rc = CFGMR3InsertString(pCfgFile, "IoMgr", g_pszIoMgr);
+        if (RT_SUCCESS(rc) && g_cIoQueueDepth)
+            rc = CFGMR3InsertInteger(pCfgFile, "IoQueueDepth", g_cIoQueueDepth);
+    }
+
+    return rc;
+}
+
 /**
  *  Entry point.
  */
@@ -576,12 +619,68 @@ extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
 {
     RT_NOREF1(envp);
     int rcRet = 0; /* error count */
+    uint32_t cSecsRuntime = 0;
 
     RTR3InitExe(argc, &argv, RTR3INIT_FLAGS_SUPLIB);
 
+    /*
+     * Parse arguments.
+     */
+    static const RTGETOPTDEF s_aOptions[] =
+    {
+        { "--io-mgr",         'm', RTGETOPT_REQ_STRING },
+        { "--queue-depth",    'q', RTGETOPT_REQ_UINT32 },
+        { "--tasks-max",      't', RTGETOPT_REQ_UINT32 },
+        { "--runtime",        'r', RTGETOPT_REQ_UINT32 },
+    };
+
+    RTGETOPTUNION   Val;
+    RTGETOPTSTATE   State;
+    int rc = RTGetOptInit(&State, argc, argv, &s_aOptions[0], RT_ELEMENTS(s_aOptions), 1, 0);
+    AssertRCReturn(rc, 1);
+
+    while ((rc = RTGetOpt(&State, &Val)))
+    {
+        switch (rc)
+        {
+            case 'm':
+                g_pszIoMgr = Val.psz;
+                break;
+            case 'q':
+                g_cIoQueueDepth = Val.u32;
+                break;
+            case 't':
+                if (Val.u32 < 1)
+                    return RTMsgErrorExitFailure("The maximum number of tasks must be 1 or higher\n");
+                g_cTasksActiveMax = Val.u32;
+                break;
+            case 'r':
+                cSecsRuntime = Val.u32;
+                break;
+            case 'h':
+                RTPrintf("syntax: " TESTCASE " [options]\n"
+                         "\n"
+                         "Options:\n"
+                         "  -h, --help\n"
+                         "    Show this help page\n"
+                         "  -m, --io-mgr <Simple|Async|IoQueue>\n"
+                         "    The I/O manager to use for the endpoints.\n"
+                         "  -q, --queue-depth <num>\n"
+                         "    The queue depth for the IoQueue manager.\n"
+                         "  -t, --tasks-max <num>\n"
+                         "    Maximum number of active tasks per endpoint.\n"
+                         "  -r, --runtime <seconds>\n"
+                         "    Run the test for the given time and report the throughput,\n"
+                         "    the default is to run forever.\n");
+                return 0;
+            default:
+                return RTGetOptPrintError(rc, &Val);
+        }
+    }
+
     PVM pVM;
     PUVM pUVM;
-    int rc = VMR3Create(1, NULL, NULL, NULL, NULL, NULL, &pVM, &pUVM);
+    rc = VMR3Create(1, NULL, NULL, NULL, tstPDMACStressTestConfigConstructor, NULL, &pVM, &pUVM);
     if (RT_SUCCESS(rc))
     {
         /*
@@ -607,8 +706,24 @@ extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
             if (RT_SUCCESS(rc))
             {
                 /* Tests are running now. */
-                RTPrintf(TESTCASE ": Successfully opened all files. Running tests forever now or until an error is hit :)\n");
-                RTThreadSleep(RT_INDEFINITE_WAIT);
+                if (!cSecsRuntime)
+                {
+                    RTPrintf(TESTCASE ": Successfully opened all files. Running tests forever now or until an error is hit :)\n");
+                    RTThreadSleep(RT_INDEFINITE_WAIT);
+                }
+                else
+                {
+                    RTPrintf(TESTCASE ": Successfully opened all files. Running tests for %u seconds\n", cSecsRuntime);
+                    uint64_t const msStart = RTTimeMilliTS();
+                    RTThreadSleep(cSecsRuntime * RT_MS_1SEC);
+                    uint64_t const cMsElapsed = RT_MAX(RTTimeMilliTS() - msStart, 1);
+                    uint64_t const cReqs = ASMAtomicReadU64(&g_cReqsCompleted);
+                    uint64_t const cbXfer = ASMAtomicReadU64(&g_cbTransferred);
+
+                    RTPrintf(TESTCASE ": I/O manager %s: %llu requests (%llu IOPS), %llu KB/s\n",
+                             g_pszIoMgr ? g_pszIoMgr : "<default>", cReqs, cReqs * RT_MS_1SEC / cMsElapsed,
+                             cbXfer * RT_MS_1SEC / cMsElapsed / _1K);
+                }
             }
 
             /* Close opened endpoints. */
@@ -0,0 +1,301 @@
+/* $Id: tstPGMLazyRestore.cpp $ */
+/** @file
+ * VMM Testcase - Saving state while a lazy RAM restore is in progress.
+ */
+
+/*
+ * Copyright (C) 2006-2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <iprt/assert.h>
+#include <iprt/file.h>
+#include <iprt/initterm.h>
+#include <iprt/path.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+#define TESTCASE    "tstPGMLazyRestore"
+
+/** The start of the RAM area we check, above anything the BIOS touches. */
+#define TST_GCPHYS_FIRST    UINT64_C(0x02000000)
+/** The size of the RAM area we check. */
+#define TST_CB_AREA         (64 * _1M)
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** the error count. */
+static int g_cErrors = 0;
+
+
+/**
+ * Gets the value for a dword of the test pattern.
+ *
+ * Every 16th page is left zero so zero page records are restored too.
+ */
+static uint32_t tstPattern(RTGCPHYS GCPhys, uint32_t uSeed)
+{
+    if (!((GCPhys >> PAGE_SHIFT) & 15))
+        return 0;
+    return (uint32_t)(GCPhys >> 2) ^ uSeed;
+}
+
+
+/**
+ * EMT worker filling the test area with a pattern.
+ *
+ * @returns VBox status code.
+ * @param   pUVM        The user mode VM handle.
+ * @param   uSeed       The pattern seed, UINT32_MAX for filling it with 0xff.
+ */
+static DECLCALLBACK(int) tstFill(PUVM pUVM, uint32_t uSeed)
+{
+    PVM pVM = VMR3GetVM(pUVM);
+    uint32_t au32Page[PAGE_SIZE / sizeof(uint32_t)];
+    for (RTGCPHYS GCPhys = TST_GCPHYS_FIRST; GCPhys < TST_GCPHYS_FIRST + TST_CB_AREA; GCPhys += PAGE_SIZE)
+    {
+        for (uint32_t i = 0; i < RT_ELEMENTS(au32Page); i++)
+            au32Page[i] = uSeed == UINT32_MAX ? UINT32_MAX : tstPattern(GCPhys + i * sizeof(uint32_t), uSeed);
+        int rc = PGMPhysSimpleWriteGCPhys(pVM, GCPhys, au32Page, sizeof(au32Page));
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf(TESTCASE ": FAILURE - PGMPhysSimpleWriteGCPhys(%RGp) -> %Rrc\n", GCPhys, rc);
+            return rc;
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * EMT worker checking the test area for the pattern.
+ *
+ * @returns VBox status code, VERR_MISMATCH if the content is wrong.
+ * @param   pUVM        The user mode VM handle.
+ * @param   uSeed       The pattern seed.
+ */
+static DECLCALLBACK(int) tstCheck(PUVM pUVM, uint32_t uSeed)
+{
+    PVM pVM = VMR3GetVM(pUVM);
+    uint32_t au32Page[PAGE_SIZE / sizeof(uint32_t)];
+    for (RTGCPHYS GCPhys = TST_GCPHYS_FIRST; GCPhys < TST_GCPHYS_FIRST + TST_CB_AREA; GCPhys += PAGE_SIZE)
+    {
+        int rc = PGMPhysSimpleReadGCPhys(pVM, au32Page, GCPhys, sizeof(au32Page));
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf(TESTCASE ": FAILURE - PGMPhysSimpleReadGCPhys(%RGp) -> %Rrc\n", GCPhys, rc);
+            return rc;
+        }
+        for (uint32_t i = 0; i < RT_ELEMENTS(au32Page); i++)
+            if (au32Page[i] != tstPattern(GCPhys + i * sizeof(uint32_t), uSeed))
+            {
+                RTPrintf(TESTCASE ": FAILURE - %RGp: %#RX32, expected %#RX32\n", GCPhys + i * sizeof(uint32_t),
+                         au32Page[i], tstPattern(GCPhys + i * sizeof(uint32_t), uSeed));
+                return VERR_MISMATCH;
+            }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Runs a worker on EMT(0), counting failures.
+ */
+static int tstOnEmt(PUVM pUVM, PFNRT pfnWorker, uint32_t uSeed, const char *pszWhat)
+{
+    int rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, pfnWorker, 2, pUVM, uSeed);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": FAILURE - %s -> %Rrc\n", pszWhat, rc);
+        g_cErrors++;
+    }
+    return rc;
+}
+
+
+static DECLCALLBACK(int)
+tstPGMLazyRestoreConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    RT_NOREF2(pUVM, pvUser);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        PCFGMNODE pRoot = CFGMR3GetRoot(pVM);
+        PCFGMNODE pPGM  = CFGMR3GetChild(pRoot, "PGM");
+        if (!pPGM)
+            rc = CFGMR3InsertNode(pRoot, "PGM", &pPGM);
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertInteger(pPGM, "SaveForLazyRestore", 1);
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertInteger(pPGM, "LazyRestore", 1);
+    }
+    return rc;
+}
+
+
+/**
+ * Does the actual testing.
+ */
+static void tstPGMLazyRestore(PUVM pUVM, const char *pszFile1, const char *pszFile2)
+{
+    int rc = VMR3PowerOn(pUVM);
+    if (RT_SUCCESS(rc))
+        rc = VMR3Suspend(pUVM, VMSUSPENDREASON_USER);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": FAILURE - failed to power on and suspend the VM: %Rrc\n", rc);
+        g_cErrors++;
+        return;
+    }
+
+    /*
+     * Save a known pattern and clobber it.
+     */
+    if (RT_FAILURE(tstOnEmt(pUVM, (PFNRT)tstFill, 0x5a5a0000, "filling")))
+        return;
+    bool fSuspended = false;
+    rc = VMR3Save(pUVM, pszFile1, true /*fContinueAfterwards*/, NULL, NULL, &fSuspended);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": FAILURE - VMR3Save(%s) -> %Rrc\n", pszFile1, rc);
+        g_cErrors++;
+        return;
+    }
+    if (RT_FAILURE(tstOnEmt(pUVM, (PFNRT)tstFill, UINT32_MAX, "clobbering")))
+        return;
+
+    /*
+     * Load it lazily and save again right away, before the pages have been
+     * touched.  The second save must contain the pattern, not zero pages.
+     */
+    rc = VMR3LoadFromFile(pUVM, pszFile1, NULL, NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": FAILURE - VMR3LoadFromFile(%s) -> %Rrc\n", pszFile1, rc);
+        g_cErrors++;
+        return;
+    }
+    rc = VMR3Save(pUVM, pszFile2, true /*fContinueAfterwards*/, NULL, NULL, &fSuspended);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": FAILURE - VMR3Save(%s) during lazy restore -> %Rrc\n", pszFile2, rc);
+        g_cErrors++;
+        return;
+    }
+    tstOnEmt(pUVM, (PFNRT)tstCheck, 0x5a5a0000, "checking after the save during lazy restore");
+
+    /*
+     * Load the second one and check that it got all the pages.  The checking
+     * touches every page and so exercises the on demand fetching as well.
+     */
+    if (RT_FAILURE(tstOnEmt(pUVM, (PFNRT)tstFill, UINT32_MAX, "clobbering")))
+        return;
+    rc = VMR3LoadFromFile(pUVM, pszFile2, NULL, NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": FAILURE - VMR3LoadFromFile(%s) -> %Rrc\n", pszFile2, rc);
+        g_cErrors++;
+        return;
+    }
+    tstOnEmt(pUVM, (PFNRT)tstCheck, 0x5a5a0000, "checking the second saved state");
+}
+
+
+/**
+ *  Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    RT_NOREF1(envp);
+    RTR3InitExe(argc, &argv, RTR3INIT_FLAGS_SUPLIB);
+    RTPrintf(TESTCASE ": TESTING...\n");
+    RTStrmFlush(g_pStdOut);
+
+    char szFile1[RTPATH_MAX];
+    char szFile2[RTPATH_MAX];
+    RTStrPrintf(szFile1, sizeof(szFile1), "%s-1.sav", TESTCASE);
+    RTStrPrintf(szFile2, sizeof(szFile2), "%s-2.sav", TESTCASE);
+
+    /*
+     * Create the VM.
+     */
+    PUVM pUVM;
+    int rc = VMR3Create(1, NULL, NULL, NULL, tstPGMLazyRestoreConfigConstructor, NULL, NULL, &pUVM);
+    if (RT_SUCCESS(rc))
+    {
+        tstPGMLazyRestore(pUVM, szFile1, szFile2);
+
+        /*
+         * Cleanup.
+         */
+        rc = VMR3PowerOff(pUVM);
+        if (!RT_SUCCESS(rc))
+        {
+            RTPrintf(TESTCASE ": error: failed to power off vm! rc=%Rrc\n", rc);
+            g_cErrors++;
+        }
+        rc = VMR3Destroy(pUVM);
+        if (!RT_SUCCESS(rc))
+        {
+            RTPrintf(TESTCASE ": error: failed to destroy vm! rc=%Rrc\n", rc);
+            g_cErrors++;
+        }
+        VMR3ReleaseUVM(pUVM);
+    }
+    else if (rc == VERR_SVM_NO_SVM || rc == VERR_VMX_NO_VMX)
+    {
+        RTPrintf(TESTCASE ": Skipped: %Rrc\n", rc);
+        return RTEXITCODE_SKIPPED;
+    }
+    else
+    {
+        RTPrintf(TESTCASE ": fatal error: failed to create vm! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
+    RTFileDelete(szFile1);
+    RTFileDelete(szFile2);
+
+    /*
+     * Summary and return.
+     */
+    if (!g_cErrors)
+        RTPrintf(TESTCASE ": SUCCESS\n");
+    else
+        RTPrintf(TESTCASE ": FAILURE - %d errors\n", g_cErrors);
+
+    return !!g_cErrors;
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
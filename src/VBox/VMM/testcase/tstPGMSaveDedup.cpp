@@ -0,0 +1,333 @@
+/* $Id: tstPGMSaveDedup.cpp $ */
+/** @file
+ * VMM Testcase - Saving and restoring RAM with duplicate page records.
+ */
+
+/*
+ * Copyright (C) 2006-2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/file.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/path.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+#define TESTCASE    "tstPGMSaveDedup"
+
+/** The start of the RAM area we check, above anything the BIOS touches. */
+#define TST_GCPHYS_FIRST    UINT64_C(0x02000000)
+/** The number of pages in the RAM area we check. */
+#define TST_CPAGES          (16 * _1M / PAGE_SIZE)
+/** The number of distinct page contents per generation, page class 0 is zero. */
+#define TST_CCLASSES        8
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** the error count. */
+static int g_cErrors = 0;
+/** The number of times the progress callback has re-dirtied pages. */
+static uint32_t volatile g_cRedirties = 0;
+
+
+/**
+ * Fills a page buffer with the content of the given page class.
+ *
+ * Pages of the same class and generation are identical, so most of the pages
+ * are sent as references to a page sent before them.
+ */
+static void tstMakePage(uint32_t *pau32Page, uint32_t iPage, uint32_t uGen)
+{
+    uint32_t const iClass = iPage % TST_CCLASSES;
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++)
+        pau32Page[i] = iClass ? (iClass * UINT32_C(0x01010101)) ^ (uGen << 16) ^ i : 0;
+}
+
+
+/**
+ * Writes the pages selected by @a uStride and @a uFirst with the content of
+ * generation @a uGen.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   uGen        The generation.
+ * @param   uStride     Which pages to write.
+ * @param   uFirst      The first page to write.
+ */
+static int tstWritePages(PVM pVM, uint32_t uGen, uint32_t uStride, uint32_t uFirst)
+{
+    uint32_t au32Page[PAGE_SIZE / sizeof(uint32_t)];
+    for (uint32_t iPage = uFirst; iPage < TST_CPAGES; iPage += uStride)
+    {
+        tstMakePage(au32Page, iPage, uGen);
+        RTGCPHYS const GCPhys = TST_GCPHYS_FIRST + ((RTGCPHYS)iPage << PAGE_SHIFT);
+        int rc = PGMR3PhysWriteExternal(pVM, GCPhys, au32Page, sizeof(au32Page), PGMACCESSORIGIN_DEBUGGER);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf(TESTCASE ": FAILURE - PGMR3PhysWriteExternal(%RGp) -> %Rrc\n", GCPhys, rc);
+            g_cErrors++;
+            return rc;
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Reads the test area.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pbDst       Where to put it (TST_CPAGES pages).
+ */
+static int tstReadArea(PVM pVM, uint8_t *pbDst)
+{
+    for (uint32_t iPage = 0; iPage < TST_CPAGES; iPage++)
+    {
+        RTGCPHYS const GCPhys = TST_GCPHYS_FIRST + ((RTGCPHYS)iPage << PAGE_SHIFT);
+        int rc = PGMR3PhysReadExternal(pVM, GCPhys, &pbDst[(size_t)iPage << PAGE_SHIFT], PAGE_SIZE, PGMACCESSORIGIN_DEBUGGER);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf(TESTCASE ": FAILURE - PGMR3PhysReadExternal(%RGp) -> %Rrc\n", GCPhys, rc);
+            g_cErrors++;
+            return rc;
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNVMPROGRESS,
+ *      Re-dirties a third of the pages between the live passes.}
+ *
+ * The new content of a re-dirtied page matches that of pages sent earlier,
+ * and pages already referenced by duplicate records get new content, so the
+ * loader has to resolve every reference against the stream order.
+ */
+static DECLCALLBACK(int) tstProgress(PUVM pUVM, unsigned uPercent, void *pvUser)
+{
+    RT_NOREF2(uPercent, pvUser);
+    if (   VMR3GetStateU(pUVM) == VMSTATE_RUNNING_LS
+        && VMR3GetVMCPUThread(pUVM) == NIL_RTTHREAD)
+    {
+        uint32_t const uGen = ASMAtomicIncU32(&g_cRedirties);
+        tstWritePages(VMR3GetVM(pUVM), uGen, 3, uGen % 3);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNSTAMR3ENUM, Gets the duplicate page count.}
+ */
+static DECLCALLBACK(int) tstEnumDupPages(const char *pszName, STAMTYPE enmType, void *pvSample, STAMUNIT enmUnit,
+                                         STAMVISIBILITY enmVisiblity, const char *pszDesc, void *pvUser)
+{
+    RT_NOREF4(pszName, enmUnit, enmVisiblity, pszDesc);
+    if (enmType == STAMTYPE_U64)
+        *(uint64_t *)pvUser = *(uint64_t *)pvSample;
+    return VINF_SUCCESS;
+}
+
+
+static DECLCALLBACK(int)
+tstPGMSaveDedupConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    RT_NOREF2(pUVM, pvUser);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        PCFGMNODE pRoot = CFGMR3GetRoot(pVM);
+        PCFGMNODE pPGM  = CFGMR3GetChild(pRoot, "PGM");
+        if (!pPGM)
+            rc = CFGMR3InsertNode(pRoot, "PGM", &pPGM);
+        if (RT_SUCCESS(rc))
+            rc = CFGMR3InsertInteger(pPGM, "SaveDedup", 1);
+    }
+    return rc;
+}
+
+
+/**
+ * Does the actual testing.
+ */
+static void tstPGMSaveDedup(PUVM pUVM, const char *pszFile, uint8_t *pbExpect, uint8_t *pbActual)
+{
+    PVM pVM = VMR3GetVM(pUVM);
+    int rc = VMR3PowerOn(pUVM);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": FAILURE - failed to power on the VM: %Rrc\n", rc);
+        g_cErrors++;
+        return;
+    }
+
+    /*
+     * Fill the area with duplicates and do a live save of the running VM,
+     * re-dirtying pages between the passes.
+     */
+    if (RT_FAILURE(tstWritePages(pVM, 0, 1, 0)))
+        return;
+    bool fSuspended = false;
+    rc = VMR3Save(pUVM, pszFile, true /*fContinueAfterwards*/, tstProgress, NULL, &fSuspended);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": FAILURE - VMR3Save(%s) -> %Rrc\n", pszFile, rc);
+        g_cErrors++;
+        return;
+    }
+    uint64_t cDupPages = 0;
+    STAMR3Enum(pUVM, "/PGM/LiveSave/Dedup/cDupPages", tstEnumDupPages, &cDupPages);
+    RTPrintf(TESTCASE ": %RU64 duplicate pages, re-dirtied %u times\n", cDupPages, g_cRedirties);
+    if (cDupPages < TST_CPAGES / 2)
+    {
+        RTPrintf(TESTCASE ": FAILURE - expected at least %u duplicate pages\n", TST_CPAGES / 2);
+        g_cErrors++;
+    }
+
+    /*
+     * Remember what was saved, clobber it and check that loading gets it back.
+     */
+    rc = VMR3Suspend(pUVM, VMSUSPENDREASON_USER);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": FAILURE - VMR3Suspend -> %Rrc\n", rc);
+        g_cErrors++;
+        return;
+    }
+    if (RT_FAILURE(tstReadArea(pVM, pbExpect)))
+        return;
+    if (RT_FAILURE(tstWritePages(pVM, UINT32_C(0xdead), 1, 0)))
+        return;
+
+    rc = VMR3LoadFromFile(pUVM, pszFile, NULL, NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": FAILURE - VMR3LoadFromFile(%s) -> %Rrc\n", pszFile, rc);
+        g_cErrors++;
+        return;
+    }
+    if (RT_FAILURE(tstReadArea(pVM, pbActual)))
+        return;
+    for (uint32_t iPage = 0; iPage < TST_CPAGES; iPage++)
+        if (memcmp(&pbActual[(size_t)iPage << PAGE_SHIFT], &pbExpect[(size_t)iPage << PAGE_SHIFT], PAGE_SIZE))
+        {
+            RTPrintf(TESTCASE ": FAILURE - page %RGp differs after loading\n",
+                     TST_GCPHYS_FIRST + ((RTGCPHYS)iPage << PAGE_SHIFT));
+            g_cErrors++;
+            break;
+        }
+}
+
+
+/**
+ *  Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    RT_NOREF1(envp);
+    RTR3InitExe(argc, &argv, RTR3INIT_FLAGS_SUPLIB);
+    RTPrintf(TESTCASE ": TESTING...\n");
+    RTStrmFlush(g_pStdOut);
+
+    char szFile[RTPATH_MAX];
+    RTStrPrintf(szFile, sizeof(szFile), "%s.sav", TESTCASE);
+    uint8_t *pbExpect = (uint8_t *)RTMemAlloc((size_t)TST_CPAGES << PAGE_SHIFT);
+    uint8_t *pbActual = (uint8_t *)RTMemAlloc((size_t)TST_CPAGES << PAGE_SHIFT);
+    if (!pbExpect || !pbActual)
+    {
+        RTPrintf(TESTCASE ": fatal error: out of memory\n");
+        return 1;
+    }
+
+    /*
+     * Create the VM.
+     */
+    PUVM pUVM;
+    int rc = VMR3Create(1, NULL, NULL, NULL, tstPGMSaveDedupConfigConstructor, NULL, NULL, &pUVM);
+    if (RT_SUCCESS(rc))
+    {
+        tstPGMSaveDedup(pUVM, szFile, pbExpect, pbActual);
+
+        /*
+         * Cleanup.
+         */
+        rc = VMR3PowerOff(pUVM);
+        if (!RT_SUCCESS(rc))
+        {
+            RTPrintf(TESTCASE ": error: failed to power off vm! rc=%Rrc\n", rc);
+            g_cErrors++;
+        }
+        rc = VMR3Destroy(pUVM);
+        if (!RT_SUCCESS(rc))
+        {
+            RTPrintf(TESTCASE ": error: failed to destroy vm! rc=%Rrc\n", rc);
+            g_cErrors++;
+        }
+        VMR3ReleaseUVM(pUVM);
+    }
+    else if (rc == VERR_SVM_NO_SVM || rc == VERR_VMX_NO_VMX)
+    {
+        RTPrintf(TESTCASE ": Skipped: %Rrc\n", rc);
+        return RTEXITCODE_SKIPPED;
+    }
+    else
+    {
+        RTPrintf(TESTCASE ": fatal error: failed to create vm! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
+    RTFileDelete(szFile);
+    RTMemFree(pbExpect);
+    RTMemFree(pbActual);
+
+    /*
+     * Summary and return.
+     */
+    if (!g_cErrors)
+        RTPrintf(TESTCASE ": SUCCESS\n");
+    else
+        RTPrintf(TESTCASE ": FAILURE - %d errors\n", g_cErrors);
+
+    return !!g_cErrors;
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
+
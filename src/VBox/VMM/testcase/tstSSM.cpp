@@ -21,6 +21,8 @@
 *********************************************************************************************************************************/
 #include <VBox/vmm/ssm.h>
 #include "VMInternal.h" /* createFakeVM */
+#include "SSMInternal.h" /* compression statistics */
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/vm.h>
 #include <VBox/vmm/uvm.h>
 #include <VBox/vmm/mm.h>
@@ -52,6 +54,9 @@
 # define TSTSSM_ITEM_SIZE    (5*_1M)
 #endif
 
+/** The number of indexed pages, taken from the start of gabBigMem. */
+#define TSTSSM_INDEXED_PAGES    (_1M / PAGE_SIZE)
+
 
 /*********************************************************************************************************************************
 *   Global Variables                                                                                                             *
@@ -63,6 +68,8 @@ uint8_t         gabBigMem[_1M];
 #else
 uint8_t         gabBigMem[8*_1M];
 #endif
+/** The record offsets of the indexed pages (Item05Save). */
+uint64_t        gau64PageRecs[TSTSSM_INDEXED_PAGES];
 
 
 /** initializes gabBigMem with some non zero stuff. */
@@ -619,6 +626,252 @@ DECLCALLBACK(int) Item04Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32
 }
 
 
+/**
+ * Execute state save operation.
+ *
+ * Saves gabBigMem page by page as indexed records, like the "pgmram" unit
+ * does for a lazy restore.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM handle.
+ * @param   pSSM            SSM operation handle.
+ */
+DECLCALLBACK(int) Item05Save(PVM pVM, PSSMHANDLE pSSM)
+{
+    NOREF(pVM);
+    for (uint32_t iPage = 0; iPage < TSTSSM_INDEXED_PAGES; iPage++)
+    {
+        int rc = SSMR3PutPageIndexed(pSSM, &gabBigMem[iPage * PAGE_SIZE], &gau64PageRecs[iPage]);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("Item05: PutPageIndexed(,,) -> %Rrc page %#x\n", rc, iPage);
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Prepare state load operation.
+ *
+ * Leaves the pages in the file, Item06Load reads them via the index.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM handle.
+ * @param   pSSM            SSM operation handle.
+ * @param   uVersion        The data layout version.
+ * @param   uPass           The data pass.
+ */
+DECLCALLBACK(int) Item05Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+{
+    NOREF(pVM); NOREF(uPass);
+    if (uVersion != 5)
+    {
+        RTPrintf("Item05: uVersion=%#x, expected 5\n", uVersion);
+        return VERR_GENERAL_FAILURE;
+    }
+
+    int rc = SSMR3SeekToEndOfUnit(pSSM);
+    if (RT_FAILURE(rc))
+        RTPrintf("Item05: SSMR3SeekToEndOfUnit -> %Rrc\n", rc);
+    return rc;
+}
+
+
+/**
+ * Execute state save operation.
+ *
+ * Saves the record offsets of the 5th item, like the "pgmidx" unit.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM handle.
+ * @param   pSSM            SSM operation handle.
+ */
+DECLCALLBACK(int) Item06Save(PVM pVM, PSSMHANDLE pSSM)
+{
+    NOREF(pVM);
+    SSMR3PutU32(pSSM, TSTSSM_INDEXED_PAGES);
+    int rc = SSMR3PutMem(pSSM, gau64PageRecs, sizeof(gau64PageRecs));
+    if (RT_FAILURE(rc))
+        RTPrintf("Item06: PutMem(,,%#zx) -> %Rrc\n", sizeof(gau64PageRecs), rc);
+    return rc;
+}
+
+/**
+ * Prepare state load operation.
+ *
+ * Loads the index and reads the pages of the 5th item in reverse order
+ * through a second handle, like the lazy restore does.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM handle.
+ * @param   pSSM            SSM operation handle.
+ * @param   uVersion        The data layout version.
+ * @param   uPass           The data pass.
+ */
+DECLCALLBACK(int) Item06Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+{
+    NOREF(pVM); NOREF(uPass);
+    if (uVersion != 6)
+    {
+        RTPrintf("Item06: uVersion=%#x, expected 6\n", uVersion);
+        return VERR_GENERAL_FAILURE;
+    }
+
+    uint32_t cPages = 0;
+    int rc = SSMR3GetU32(pSSM, &cPages);
+    if (RT_FAILURE(rc) || cPages != TSTSSM_INDEXED_PAGES)
+    {
+        RTPrintf("Item06: SSMR3GetU32 -> %Rrc cPages=%#x\n", rc, cPages);
+        return RT_FAILURE(rc) ? rc : VERR_GENERAL_FAILURE;
+    }
+    static uint64_t s_au64PageRecs[TSTSSM_INDEXED_PAGES];
+    rc = SSMR3GetMem(pSSM, s_au64PageRecs, sizeof(s_au64PageRecs));
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("Item06: SSMR3GetMem(,,%#zx) -> %Rrc\n", sizeof(s_au64PageRecs), rc);
+        return rc;
+    }
+
+    PSSMHANDLE pSSMPages;
+    rc = SSMR3Open(SSMR3HandleFilename(pSSM), 0, &pSSMPages);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("Item06: SSMR3Open -> %Rrc\n", rc);
+        return rc;
+    }
+
+    for (uint32_t iPage = TSTSSM_INDEXED_PAGES; iPage-- > 0 && RT_SUCCESS(rc);)
+    {
+        uint8_t abPage[PAGE_SIZE];
+        rc = SSMR3ReadPageAt(pSSMPages, s_au64PageRecs[iPage], abPage);
+        if (RT_FAILURE(rc))
+            RTPrintf("Item06: SSMR3ReadPageAt(,%#RX64,) -> %Rrc page %#x\n", s_au64PageRecs[iPage], rc, iPage);
+        else if (memcmp(abPage, &gabBigMem[iPage * PAGE_SIZE], PAGE_SIZE))
+        {
+            RTPrintf("Item06: compare failed. page %#x\n", iPage);
+            rc = VERR_GENERAL_FAILURE;
+        }
+    }
+
+    int rc2 = SSMR3Close(pSSMPages);
+    if (RT_SUCCESS(rc))
+        rc = rc2;
+    return rc;
+}
+
+
+/**
+ * Sets the number of compression worker threads for the next save.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM handle.
+ * @param   cThreads    The number of threads, 0 for compressing inline.
+ */
+static int tstSetCompressionThreads(PVM pVM, uint32_t cThreads)
+{
+    PCFGMNODE pSSMNode = CFGMR3GetChild(CFGMR3GetRoot(pVM), "SSM");
+    int rc = VINF_SUCCESS;
+    if (!pSSMNode)
+        rc = CFGMR3InsertNode(CFGMR3GetRoot(pVM), "SSM", &pSSMNode);
+    if (RT_SUCCESS(rc))
+    {
+        CFGMR3RemoveValue(pSSMNode, "CompressionThreads");
+        rc = CFGMR3InsertInteger(pSSMNode, "CompressionThreads", cThreads);
+    }
+    return rc;
+}
+
+
+/** State of the failing stream (tstFailStrmOps). */
+typedef struct TSTFAILSTRM
+{
+    /** The current stream offset. */
+    uint64_t    offStream;
+    /** The offset at which writes start failing. */
+    uint64_t    offFail;
+    /** Set if pfnClose was called. */
+    bool        fClosed;
+} TSTFAILSTRM;
+
+
+/** @interface_method_impl{SSMSTRMOPS,pfnWrite} */
+static DECLCALLBACK(int) tstFailStrmWrite(void *pvUser, uint64_t offStream, const void *pvBuf, size_t cbToWrite)
+{
+    TSTFAILSTRM *pStrm = (TSTFAILSTRM *)pvUser;
+    RT_NOREF(pvBuf);
+    if (offStream != pStrm->offStream)
+        return VERR_SSM_STREAM_ERROR;
+    if (offStream + cbToWrite > pStrm->offFail)
+        return VERR_DISK_FULL;
+    pStrm->offStream += cbToWrite;
+    return VINF_SUCCESS;
+}
+
+
+/** @interface_method_impl{SSMSTRMOPS,pfnRead} */
+static DECLCALLBACK(int) tstFailStrmRead(void *pvUser, uint64_t offStream, void *pvBuf, size_t cbToRead, size_t *pcbRead)
+{
+    RT_NOREF(pvUser, offStream, pvBuf, cbToRead, pcbRead);
+    return VERR_NOT_SUPPORTED;
+}
+
+
+/** @interface_method_impl{SSMSTRMOPS,pfnSeek} */
+static DECLCALLBACK(int) tstFailStrmSeek(void *pvUser, int64_t offSeek, unsigned uMethod, uint64_t *poffActual)
+{
+    RT_NOREF(pvUser, offSeek, uMethod, poffActual);
+    return VERR_NOT_SUPPORTED;
+}
+
+
+/** @interface_method_impl{SSMSTRMOPS,pfnTell} */
+static DECLCALLBACK(uint64_t) tstFailStrmTell(void *pvUser)
+{
+    return ((TSTFAILSTRM *)pvUser)->offStream;
+}
+
+
+/** @interface_method_impl{SSMSTRMOPS,pfnSize} */
+static DECLCALLBACK(int) tstFailStrmSize(void *pvUser, uint64_t *pcb)
+{
+    RT_NOREF(pvUser, pcb);
+    return VERR_NOT_SUPPORTED;
+}
+
+
+/** @interface_method_impl{SSMSTRMOPS,pfnIsOk} */
+static DECLCALLBACK(int) tstFailStrmIsOk(void *pvUser)
+{
+    RT_NOREF(pvUser);
+    return VINF_SUCCESS;
+}
+
+
+/** @interface_method_impl{SSMSTRMOPS,pfnClose} */
+static DECLCALLBACK(int) tstFailStrmClose(void *pvUser, bool fCancelled)
+{
+    RT_NOREF(fCancelled);
+    ((TSTFAILSTRM *)pvUser)->fClosed = true;
+    return VINF_SUCCESS;
+}
+
+
+/** Stream methods which discard the data and fail writing past a given offset. */
+static SSMSTRMOPS const g_tstFailStrmOps =
+{
+    SSMSTRMOPS_VERSION,
+    tstFailStrmWrite,
+    tstFailStrmRead,
+    tstFailStrmSeek,
+    tstFailStrmTell,
+    tstFailStrmSize,
+    tstFailStrmIsOk,
+    tstFailStrmClose,
+    SSMSTRMOPS_VERSION
+};
+
+
 /**
  * Creates a mockup VM structure for testing SSM.
  *
@@ -666,11 +919,17 @@ static int createFakeVM(PVM *ppVM)
                     pVM->apCpusR3[0] = pVCpu;
 
                     pUVM->pVM = pVM;
-                    *ppVM = pVM;
-                    return 0;
+                    rc = CFGMR3Init(pVM, NULL, NULL);
+                    if (RT_SUCCESS(rc))
+                    {
+                        *ppVM = pVM;
+                        return 0;
+                    }
+
+                    RTPrintf("Fatal error: CFGMR3Init failed, rc=%Rrc\n", rc);
                 }
-
-                RTPrintf("Fatal error: failed to allocated pages for the VM structure, rc=%Rrc\n", rc);
+                else
+                    RTPrintf("Fatal error: failed to allocated pages for the VM structure, rc=%Rrc\n", rc);
             }
             else
                 RTPrintf("Fatal error: MMR3InitUVM failed, rc=%Rrc\n", rc);
@@ -695,6 +954,7 @@ static int createFakeVM(PVM *ppVM)
  */
 static void destroyFakeVM(PVM pVM)
 {
+    CFGMR3Term(pVM);
     STAMR3TermUVM(pVM->pUVM);
     MMR3TermUVM(pVM->pUVM);
 }
@@ -764,6 +1024,26 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    rc = SSMR3RegisterInternal(pVM, "SSM Testcase Data Item no.5 (indexed pages)", 0, 5, _1M,
+                               NULL, NULL, NULL,
+                               NULL, Item05Save, NULL,
+                               NULL, Item05Load, NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("SSMR3Register #5 -> %Rrc\n", rc);
+        return 1;
+    }
+
+    rc = SSMR3RegisterInternal(pVM, "SSM Testcase Data Item no.6 (page index)", 0, 6, _4K,
+                               NULL, NULL, NULL,
+                               NULL, Item06Save, NULL,
+                               NULL, Item06Load, NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("SSMR3Register #6 -> %Rrc\n", rc);
+        return 1;
+    }
+
     /*
      * Attempt a save.
      */
@@ -924,6 +1204,76 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    /*
+     * Save with inline compression and with a pool of compression workers.
+     * The pool doesn't change the stream, so the files must be identical and
+     * load back the same data.
+     */
+    const char *pszFilename2 = "SSMTestSave#2";
+    static const uint32_t s_acThreads[] = { 0, 4 };
+    for (unsigned i = 0; i < RT_ELEMENTS(s_acThreads); i++)
+    {
+        const char *pszFile = i == 0 ? pszFilename : pszFilename2;
+        rc = tstSetCompressionThreads(pVM, s_acThreads[i]);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("tstSSM: failed to configure %u compression threads: %Rrc\n", s_acThreads[i], rc);
+            return 1;
+        }
+
+        uint64_t const cbZipIn = pVM->ssm.s.StatZipBytesIn.c;
+        u64Start = RTTimeNanoTS();
+        rc = SSMR3Save(pVM, pszFile, NULL, NULL, SSMAFTER_DESTROY, NULL, NULL);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("SSMR3Save #%u (%u compression threads) -> %Rrc\n", i + 2, s_acThreads[i], rc);
+            return 1;
+        }
+        u64Elapsed = RTTimeNanoTS() - u64Start;
+        RTPrintf("tstSSM: Saved with %u compression threads in %'RI64 ns\n", s_acThreads[i], u64Elapsed);
+        if ((pVM->ssm.s.StatZipBytesIn.c != cbZipIn) != (s_acThreads[i] != 0))
+        {
+            RTPrintf("tstSSM: compression pipeline %s used with %u threads\n",
+                     s_acThreads[i] ? "wasn't" : "was", s_acThreads[i]);
+            return 1;
+        }
+
+        rc = SSMR3Load(pVM, pszFile, NULL /*pStreamOps*/, NULL /*pStreamOpsUser*/,
+                       SSMAFTER_RESUME, NULL /*pfnProgress*/, NULL /*pvProgressUser*/);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("SSMR3Load #%u (%u compression threads) -> %Rrc\n", i + 2, s_acThreads[i], rc);
+            return 1;
+        }
+    }
+    rc = RTFileCompare(pszFilename, pszFilename2);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstSSM: RTFileCompare(%s, %s) -> %Rrc\n", pszFilename, pszFilename2, rc);
+        return 1;
+    }
+    RTFileDelete(pszFilename2);
+
+    /*
+     * Fail writing half way through while the workers are busy.  The error
+     * must come back out of SSMR3Save and the stream still be closed.
+     */
+    TSTFAILSTRM FailStrm;
+    RT_ZERO(FailStrm);
+    FailStrm.offFail = (uint64_t)Info.cbObject / 2;
+    rc = SSMR3Save(pVM, NULL, &g_tstFailStrmOps, &FailStrm, SSMAFTER_DESTROY, NULL, NULL);
+    if (rc != VERR_DISK_FULL)
+    {
+        RTPrintf("SSMR3Save with failing stream -> %Rrc, expected VERR_DISK_FULL\n", rc);
+        return 1;
+    }
+    if (!FailStrm.fClosed)
+    {
+        RTPrintf("tstSSM: failing stream wasn't closed\n");
+        return 1;
+    }
+    RTPrintf("tstSSM: Save failure propagated from the compression pipeline\n");
+
     destroyFakeVM(pVM);
 
     /* delete */
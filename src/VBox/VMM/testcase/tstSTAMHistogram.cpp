@@ -0,0 +1,114 @@
+/* $Id: tstSTAMHistogram.cpp $ */
+/** @file
+ * STAM - Histogram sample testcase.
+ */
+
+/*
+ * Copyright (C) 2006-2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/stam.h>
+
+#include <iprt/asm.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+
+
+static void tstSTAMHistogramBuckets(void)
+{
+    RTTestISub("Buckets");
+
+    STAMHISTOGRAM Histogram;
+    RT_ZERO(Histogram);
+
+    /* An empty histogram has no percentiles. */
+    RTTESTI_CHECK(STAMHistogramPercentile(&Histogram, 500) == 0);
+    RTTESTI_CHECK(STAMHistogramPercentile(&Histogram, 999) == 0);
+
+    STAM_REL_HISTOGRAM_ADD(&Histogram, 0);
+    STAM_REL_HISTOGRAM_ADD(&Histogram, 1);
+    STAM_REL_HISTOGRAM_ADD(&Histogram, 2);
+    STAM_REL_HISTOGRAM_ADD(&Histogram, 3);
+    STAM_REL_HISTOGRAM_ADD(&Histogram, 1000);
+    STAM_REL_HISTOGRAM_ADD(&Histogram, UINT64_MAX / 2);
+
+    RTTESTI_CHECK(Histogram.cSamples == 6);
+    RTTESTI_CHECK(Histogram.cMax == UINT64_MAX / 2);
+    RTTESTI_CHECK(Histogram.acBuckets[0] == 1);
+    RTTESTI_CHECK(Histogram.acBuckets[1] == 1);
+    RTTESTI_CHECK(Histogram.acBuckets[2] == 2);
+    RTTESTI_CHECK(Histogram.acBuckets[10] == 1);
+    RTTESTI_CHECK(Histogram.acBuckets[STAM_HISTOGRAM_BUCKETS - 1] == 1); /* Clipped to the last bucket. */
+}
+
+
+static void tstSTAMHistogramPercentiles(void)
+{
+    RTTestISub("Percentiles");
+
+    /* A single value reports itself for every percentile. */
+    STAMHISTOGRAM Histogram;
+    RT_ZERO(Histogram);
+    STAM_REL_HISTOGRAM_ADD(&Histogram, 100);
+    RTTESTI_CHECK(STAMHistogramPercentile(&Histogram, 500) == 100);
+    RTTESTI_CHECK(STAMHistogramPercentile(&Histogram, 1000) == 100);
+
+    /*
+     * 990 fast samples in the [64, 128) bucket and 10 slow ones in [4096, 8192):
+     * p50 and p99 are in the fast bucket, p999 in the slow one clipped to the maximum.
+     */
+    RT_ZERO(Histogram);
+    for (unsigned i = 0; i < 990; i++)
+        STAM_REL_HISTOGRAM_ADD(&Histogram, 64 + i % 64);
+    for (unsigned i = 0; i < 10; i++)
+        STAM_REL_HISTOGRAM_ADD(&Histogram, 5000 + i);
+
+    uint64_t uP50  = STAMHistogramPercentile(&Histogram, 500);
+    uint64_t uP99  = STAMHistogramPercentile(&Histogram, 990);
+    uint64_t uP999 = STAMHistogramPercentile(&Histogram, 999);
+    RTTESTI_CHECK_MSG(uP50 == 127, ("p50=%RU64\n", uP50));
+    RTTESTI_CHECK_MSG(uP99 == 127, ("p99=%RU64\n", uP99));
+    RTTESTI_CHECK_MSG(uP999 == 5009, ("p999=%RU64\n", uP999));
+
+    /* One more slow sample pushes p99 over the edge (rank 991 of 1001 rounds up). */
+    STAM_REL_HISTOGRAM_ADD(&Histogram, 5000);
+    uP99 = STAMHistogramPercentile(&Histogram, 990);
+    RTTESTI_CHECK_MSG(uP99 == 5009, ("p99=%RU64\n", uP99));
+
+    /* The rank calculation must not overflow for huge sample counts. */
+    RT_ZERO(Histogram);
+    Histogram.acBuckets[1]  = UINT64_MAX / 8 * 3;
+    Histogram.acBuckets[20] = UINT64_MAX / 4;
+    Histogram.cMax          = 700000;
+    uP50 = STAMHistogramPercentile(&Histogram, 500);
+    uP99 = STAMHistogramPercentile(&Histogram, 990);
+    RTTESTI_CHECK_MSG(uP50 == 1, ("p50=%RU64\n", uP50));
+    RTTESTI_CHECK_MSG(uP99 == 700000, ("p99=%RU64\n", uP99));
+}
+
+
+int main()
+{
+    RTTEST hTest;
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstSTAMHistogram", &hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(hTest);
+
+    tstSTAMHistogramBuckets();
+    tstSTAMHistogramPercentiles();
+
+    return RTTestSummaryAndDestroy(hTest);
+}
@@ -0,0 +1,197 @@
+/* $Id: tstTMHeap.cpp $ */
+/** @file
+ * TM - Active timer heap testcase and micro benchmark.
+ */
+
+/*
+ * Copyright (C) 2006-2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/tm.h>
+#include <VBox/vmm/dbgftrace.h>
+#include "TMInternal.h"
+#include <VBox/vmm/vm.h>
+
+#include <iprt/mem.h>
+#include <iprt/rand.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/time.h>
+
+#include "TMInline.h"
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * The queue and the timers, kept in one block so the self relative offsets
+ * stay small just like they do in the hyper heap.
+ */
+typedef struct TSTTMHEAP
+{
+    TMTIMERQUEUE    Queue;
+    uint32_t        cTimers;
+    TMTIMER         aTimers[1];
+} TSTTMHEAP;
+typedef TSTTMHEAP *PTSTTMHEAP;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The test handle. */
+static RTTEST   g_hTest;
+/** Zeroed VM structure the timers point at (trace buffer is NIL). */
+static PVM      g_pVM;
+/** Number of operations for each benchmark. */
+static uint32_t g_cIterations = _256K;
+
+
+/**
+ * Creates a heap with @a cTimers timers and arms all of them.
+ */
+static PTSTTMHEAP tstTMHeapCreate(uint32_t cTimers)
+{
+    PTSTTMHEAP pHeap = (PTSTTMHEAP)RTMemAllocZ(RT_UOFFSETOF_DYN(TSTTMHEAP, aTimers[cTimers]));
+    if (!pHeap)
+        return NULL;
+    pHeap->Queue.u64Expire = INT64_MAX;
+    pHeap->Queue.enmClock  = TMCLOCK_VIRTUAL;
+    pHeap->cTimers         = cTimers;
+
+    for (uint32_t i = 0; i < cTimers; i++)
+    {
+        PTMTIMER pTimer = &pHeap->aTimers[i];
+        pTimer->enmClock  = TMCLOCK_VIRTUAL;
+        pTimer->enmState  = TMTIMERSTATE_ACTIVE;
+        pTimer->pVMR3     = g_pVM;
+        pTimer->pszDesc   = "tstTMHeap";
+        pTimer->u64Expire = RTRandU64Ex(0, _1G);
+        tmTimerQueueLinkActive(&pHeap->Queue, pTimer, pTimer->u64Expire);
+    }
+    return pHeap;
+}
+
+
+/**
+ * Empties the heap, checking that the timers come out in order.
+ */
+static void tstTMHeapDrain(PTSTTMHEAP pHeap)
+{
+    uint32_t cTimers   = 0;
+    uint64_t u64Prev   = 0;
+    PTMTIMER pTimer;
+    while ((pTimer = TMTIMER_GET_HEAD(&pHeap->Queue)) != NULL)
+    {
+        RTTESTI_CHECK_MSG_RETV(pTimer->u64Expire >= u64Prev, ("%RU64 < %RU64\n", pTimer->u64Expire, u64Prev));
+        RTTESTI_CHECK_RETV(pHeap->Queue.u64Expire == pTimer->u64Expire);
+        u64Prev = pTimer->u64Expire;
+        tmTimerHeapRemove(&pHeap->Queue, pTimer);
+        RTTESTI_CHECK_RETV(!pTimer->offNext && !pTimer->offPrev && !pTimer->offChild);
+        cTimers++;
+    }
+    RTTESTI_CHECK_MSG(cTimers == pHeap->cTimers, ("%u != %u\n", cTimers, pHeap->cTimers));
+    RTTESTI_CHECK(pHeap->Queue.u64Expire == INT64_MAX);
+}
+
+
+/**
+ * Arm/fire benchmark: Takes the first timer off the heap and rearms it a bit
+ * later, the way periodic timers behave in tmR3TimerQueueRun.
+ */
+static void tstTMHeapArmFire(uint32_t cTimers)
+{
+    PTSTTMHEAP pHeap = tstTMHeapCreate(cTimers);
+    RTTESTI_CHECK_RETV(pHeap);
+
+    uint64_t u64Prev = 0;
+    uint64_t nsStart = RTTimeNanoTS();
+    for (uint32_t i = 0; i < g_cIterations; i++)
+    {
+        PTMTIMER pTimer = TMTIMER_GET_HEAD(&pHeap->Queue);
+        if (RT_UNLIKELY(pTimer->u64Expire < u64Prev))
+        {
+            RTTestIFailed("Fired out of order: %RU64 < %RU64\n", pTimer->u64Expire, u64Prev);
+            break;
+        }
+        u64Prev = pTimer->u64Expire;
+        tmTimerHeapRemove(&pHeap->Queue, pTimer);
+        pTimer->u64Expire = u64Prev + 1 + (i * UINT32_C(0x9e3779b1) & _1M);
+        tmTimerQueueLinkActive(&pHeap->Queue, pTimer, pTimer->u64Expire);
+    }
+    uint64_t cNsElapsed = RTTimeNanoTS() - nsStart;
+    RTTestValueF(g_hTest, cNsElapsed / g_cIterations, RTTESTUNIT_NS_PER_CALL, "arm/fire, %u timers", cTimers);
+
+    tstTMHeapDrain(pHeap);
+    RTMemFree(pHeap);
+}
+
+
+/**
+ * Arm/cancel benchmark: Stops a random timer and rearms it again, the way a
+ * device reprogramming its timer behaves.
+ */
+static void tstTMHeapArmCancel(uint32_t cTimers)
+{
+    /* Pick the victims up front so the RNG doesn't show up in the numbers. */
+    uint32_t *pauVictims = (uint32_t *)RTMemAlloc(sizeof(uint32_t) * g_cIterations);
+    RTTESTI_CHECK_RETV(pauVictims);
+
+    PTSTTMHEAP pHeap = tstTMHeapCreate(cTimers);
+    RTTESTI_CHECK_RETV(pHeap);
+    for (uint32_t i = 0; i < g_cIterations; i++)
+        pauVictims[i] = RTRandU32Ex(0, cTimers - 1);
+
+    uint64_t nsStart = RTTimeNanoTS();
+    for (uint32_t i = 0; i < g_cIterations; i++)
+    {
+        PTMTIMER pTimer = &pHeap->aTimers[pauVictims[i]];
+        tmTimerHeapRemove(&pHeap->Queue, pTimer);
+        pTimer->u64Expire = (pTimer->u64Expire + i * UINT32_C(0x9e3779b1)) & (_1G - 1);
+        tmTimerQueueLinkActive(&pHeap->Queue, pTimer, pTimer->u64Expire);
+    }
+    uint64_t cNsElapsed = RTTimeNanoTS() - nsStart;
+    RTTestValueF(g_hTest, cNsElapsed / g_cIterations, RTTESTUNIT_NS_PER_CALL, "arm/cancel, %u timers", cTimers);
+
+    tstTMHeapDrain(pHeap);
+    RTMemFree(pauVictims);
+    RTMemFree(pHeap);
+}
+
+
+int main(int argc, char **argv)
+{
+    RTEXITCODE rcExit = RTTestInitExAndCreate(argc, &argv, 0, "tstTMHeap", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    g_pVM = (PVM)RTMemPageAllocZ(RT_ALIGN_Z(sizeof(VM), PAGE_SIZE));
+    RTTESTI_CHECK_RET(g_pVM, RTTestSummaryAndDestroy(g_hTest));
+
+    static uint32_t const s_acTimers[] = { 1, 10, 100, 1000 };
+    RTTestSub(g_hTest, "arm/fire");
+    for (unsigned i = 0; i < RT_ELEMENTS(s_acTimers); i++)
+        tstTMHeapArmFire(s_acTimers[i]);
+
+    RTTestSub(g_hTest, "arm/cancel");
+    for (unsigned i = 0; i < RT_ELEMENTS(s_acTimers); i++)
+        tstTMHeapArmCancel(s_acTimers[i]);
+
+    RTMemPageFree(g_pVM, RT_ALIGN_Z(sizeof(VM), PAGE_SIZE));
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
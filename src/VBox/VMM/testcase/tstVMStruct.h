@@ -1089,6 +1089,7 @@
     //GEN_CHECK_OFF(TM, pvGIPR0);
     GEN_CHECK_OFF(TM, pvGIPRC);
     GEN_CHECK_OFF(TMCPU, fTSCTicking);
+    GEN_CHECK_OFF(TMCPU, fRunningQueues);
     GEN_CHECK_OFF(TM, enmTSCMode);
     GEN_CHECK_OFF(TM, fTSCTiedToExecution);
     GEN_CHECK_OFF(TMCPU, offTSCRawSrc);
@@ -1168,6 +1169,8 @@
     GEN_CHECK_OFF(TMTIMER, offScheduleNext);
     GEN_CHECK_OFF(TMTIMER, offNext);
     GEN_CHECK_OFF(TMTIMER, offPrev);
+    GEN_CHECK_OFF(TMTIMER, offChild);
+    GEN_CHECK_OFF(TMTIMER, uRunGen);
     GEN_CHECK_OFF(TMTIMER, pVMR0);
     GEN_CHECK_OFF(TMTIMER, pVMR3);
     GEN_CHECK_OFF(TMTIMER, pVMRC);
@@ -1181,6 +1184,9 @@
     GEN_CHECK_OFF(TMTIMERQUEUE, offActive);
     GEN_CHECK_OFF(TMTIMERQUEUE, offSchedule);
     GEN_CHECK_OFF(TMTIMERQUEUE, enmClock);
+    GEN_CHECK_OFF(TMTIMERQUEUE, idCpuOwner);
+    GEN_CHECK_OFF(TMTIMERQUEUE, StatLatency);
+    GEN_CHECK_OFF(TMTIMERQUEUE, uRunGen);
 
     GEN_CHECK_SIZE(TRPM);
     GEN_CHECK_SIZE(TRPMCPU);
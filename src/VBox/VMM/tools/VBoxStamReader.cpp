@@ -0,0 +1,358 @@
+/* $Id: VBoxStamReader.cpp $ */
+/** @file
+ * VBoxStamReader - Reads the statistics a VM exports in shared memory.
+ */
+
+/*
+ * Copyright (C) 2006-2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/stam.h>
+#include <VBox/version.h>
+
+#include <iprt/asm.h>
+#include <iprt/buildconfig.h>
+#include <iprt/err.h>
+#include <iprt/getopt.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/message.h>
+#include <iprt/shmem.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The sample name pattern(s), NULL for all. */
+static const char  *g_pszPattern = NULL;
+/** Whether to include samples with all-zero values. */
+static bool         g_fAll       = false;
+/** Whether to print the descriptions. */
+static bool         g_fDesc      = false;
+
+
+/**
+ * Takes a consistent copy of the exported data.
+ *
+ * @returns IPRT status code.
+ * @param   pbShMem         The read-only mapping of the shared memory object.
+ * @param   cbShMem         The size of the mapping.
+ * @param   pbCopy          Where to copy the data, @a cbShMem in size.
+ */
+static int stamReaderSnapshot(uint8_t const *pbShMem, size_t cbShMem, uint8_t *pbCopy)
+{
+    PCSTAMEXPORTHDR pHdr = (PCSTAMEXPORTHDR)pbShMem;
+    for (uint32_t cTries = 0; cTries < 1000; cTries++)
+    {
+        uint64_t const uSeqNo = ASMAtomicReadU64((uint64_t volatile *)&pHdr->uSeqNo);
+        if (!(uSeqNo & 1))
+        {
+            ASMReadFence();
+
+            /* The header first, then whatever it says is in use. */
+            memcpy(pbCopy, pbShMem, sizeof(*pHdr));
+            PCSTAMEXPORTHDR pCopyHdr = (PCSTAMEXPORTHDR)pbCopy;
+            if (   pCopyHdr->offStrings <= cbShMem
+                && pCopyHdr->cbStrings  <= cbShMem - pCopyHdr->offStrings
+                && pCopyHdr->offStrings >= sizeof(*pHdr))
+                memcpy(&pbCopy[sizeof(*pHdr)], &pbShMem[sizeof(*pHdr)],
+                       pCopyHdr->offStrings + pCopyHdr->cbStrings - sizeof(*pHdr));
+
+            ASMReadFence();
+            if (ASMAtomicReadU64((uint64_t volatile *)&pHdr->uSeqNo) == uSeqNo)
+                return VINF_SUCCESS;
+        }
+        RTThreadSleep(1);
+    }
+    return VERR_TIMEOUT;
+}
+
+
+/**
+ * Validates the header of a snapshot.
+ *
+ * @returns RTEXITCODE_SUCCESS if fine, otherwise an error has been displayed.
+ * @param   pHdr            The header of the copy.
+ * @param   cbShMem         The size of the copy.
+ */
+static RTEXITCODE stamReaderValidate(PCSTAMEXPORTHDR pHdr, size_t cbShMem)
+{
+    if (pHdr->u32Magic != STAMEXPORTHDR_MAGIC)
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "Bad magic %#RX32, the VM is not exporting (anymore)", pHdr->u32Magic);
+    if (RT_HI_U16(pHdr->u32Version) != RT_HI_U16(STAMEXPORTHDR_VERSION))
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "Unsupported layout version %#RX32 (expected %#RX32)",
+                              pHdr->u32Version, STAMEXPORTHDR_VERSION);
+    if (   pHdr->offSamples > cbShMem
+        || (uint64_t)pHdr->cSamples * sizeof(STAMEXPORTSAMPLE) > cbShMem - pHdr->offSamples
+        || pHdr->offValues > cbShMem
+        || (uint64_t)pHdr->cValues * sizeof(uint64_t) > cbShMem - pHdr->offValues
+        || pHdr->offStrings > cbShMem
+        || pHdr->cbStrings > cbShMem - pHdr->offStrings)
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "The header is inconsistent");
+    return RTEXITCODE_SUCCESS;
+}
+
+
+/**
+ * Gets a string from the string table of a snapshot.
+ */
+static const char *stamReaderString(PCSTAMEXPORTHDR pHdr, uint32_t offString)
+{
+    if (offString >= pHdr->cbStrings)
+        return "";
+    const char *psz = (const char *)pHdr + pHdr->offStrings + offString;
+    if (!RTStrEnd(psz, pHdr->cbStrings - offString))
+        return "";
+    return psz;
+}
+
+
+/**
+ * Prints the samples of a snapshot, in the same format as the 'stats' command.
+ */
+static void stamReaderPrint(PCSTAMEXPORTHDR pHdr)
+{
+    PCSTAMEXPORTSAMPLE paSamples = (PCSTAMEXPORTSAMPLE)((uint8_t const *)pHdr + pHdr->offSamples);
+    uint64_t const    *pau64     = (uint64_t const *)((uint8_t const *)pHdr + pHdr->offValues);
+
+    RTTIMESPEC Timestamp;
+    char       szTimestamp[64];
+    RTTimeSpecToString(RTTimeSpecSetNano(&Timestamp, pHdr->nsTimestamp), szTimestamp, sizeof(szTimestamp));
+    RTPrintf("# %s, %u samples, generation %RU64%s\n", szTimestamp, pHdr->cSamples, pHdr->uGeneration,
+             pHdr->fFlags & STAMEXPORTHDR_F_TRUNCATED ? " (truncated)" : "");
+
+    for (uint32_t iSample = 0; iSample < pHdr->cSamples; iSample++)
+    {
+        PCSTAMEXPORTSAMPLE pSample = &paSamples[iSample];
+        if (   pSample->iValue > pHdr->cValues
+            || pSample->cValues > pHdr->cValues - pSample->iValue)
+            continue;
+        uint64_t const *pu64 = &pau64[pSample->iValue];
+
+        const char *pszName = stamReaderString(pHdr, pSample->offName);
+        if (   g_pszPattern
+            && !RTStrSimplePatternMultiMatch(g_pszPattern, RTSTR_MAX, pszName, RTSTR_MAX, NULL))
+            continue;
+        if (!g_fAll)
+        {
+            uint32_t i = 0;
+            while (i < pSample->cValues && !pu64[i])
+                i++;
+            if (i >= pSample->cValues)
+                continue;
+        }
+        const char *pszUnit = stamReaderString(pHdr, pSample->offUnit);
+
+        switch (pSample->enmType)
+        {
+            case STAMTYPE_PROFILE:
+            case STAMTYPE_PROFILE_ADV:
+                if (pSample->cValues == 4)
+                {
+                    uint64_t const cPeriods = pu64[0] ? pu64[0] : 1;
+                    RTPrintf("%-32s %8llu %s (%12llu ticks, %7llu times, max %9llu, min %7lld)\n", pszName,
+                             pu64[1] / cPeriods, pszUnit, pu64[1], pu64[0], pu64[3], pu64[2]);
+                }
+                break;
+
+            case STAMTYPE_RATIO_U32:
+            case STAMTYPE_RATIO_U32_RESET:
+                if (pSample->cValues == 2)
+                    RTPrintf("%-32s %8llu:%-8llu %s\n", pszName, pu64[0], pu64[1], pszUnit);
+                break;
+
+            case STAMTYPE_HISTOGRAM:
+                if (pSample->cValues == 3 + STAM_HISTOGRAM_BUCKETS)
+                {
+                    STAMHISTOGRAM Histogram;
+                    Histogram.cSamples = pu64[0];
+                    Histogram.cTotal   = pu64[1];
+                    Histogram.cMax     = pu64[2];
+                    for (unsigned i = 0; i < STAM_HISTOGRAM_BUCKETS; i++)
+                        Histogram.acBuckets[i] = pu64[3 + i];
+                    uint64_t const cSamples = Histogram.cSamples ? Histogram.cSamples : 1;
+                    RTPrintf("%-32s %8llu %s (%7llu times, p50 %7llu, p99 %9llu, p999 %9llu, max %9llu)\n", pszName,
+                             Histogram.cTotal / cSamples, pszUnit, Histogram.cSamples,
+                             STAMHistogramPercentile(&Histogram, 500), STAMHistogramPercentile(&Histogram, 990),
+                             STAMHistogramPercentile(&Histogram, 999), Histogram.cMax);
+                }
+                break;
+
+            case STAMTYPE_X8:
+            case STAMTYPE_X8_RESET:
+            case STAMTYPE_X16:
+            case STAMTYPE_X16_RESET:
+            case STAMTYPE_X32:
+            case STAMTYPE_X32_RESET:
+            case STAMTYPE_X64:
+            case STAMTYPE_X64_RESET:
+                RTPrintf("%-32s %8llx %s\n", pszName, pu64[0], pszUnit);
+                break;
+
+            case STAMTYPE_BOOL:
+            case STAMTYPE_BOOL_RESET:
+                RTPrintf("%-32s %s %s\n", pszName, pu64[0] ? "true    " : "false   ", pszUnit);
+                break;
+
+            default:
+                RTPrintf("%-32s %8llu %s\n", pszName, pu64[0], pszUnit);
+                break;
+        }
+
+        if (g_fDesc && pSample->offDesc != UINT32_MAX)
+            RTPrintf("    %s\n", stamReaderString(pHdr, pSample->offDesc));
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    int rc = RTR3InitExe(argc, &argv, 0);
+    if (RT_FAILURE(rc))
+        return RTMsgInitFailure(rc);
+
+    /*
+     * Parse arguments.
+     */
+    static const RTGETOPTDEF s_aOptions[] =
+    {
+        { "--pattern",      'p', RTGETOPT_REQ_STRING  },
+        { "--all",          'a', RTGETOPT_REQ_NOTHING },
+        { "--descriptions", 'd', RTGETOPT_REQ_NOTHING },
+        { "--watch",        'w', RTGETOPT_REQ_UINT32  },
+        { "--count",        'c', RTGETOPT_REQ_UINT32  },
+    };
+
+    const char     *pszName     = NULL;
+    uint32_t        cMsWatch    = 0;
+    uint32_t        cRounds     = 1;
+    bool            fCountGiven = false;
+
+    int             ch;
+    RTGETOPTUNION   ValueUnion;
+    RTGETOPTSTATE   GetState;
+    RTGetOptInit(&GetState, argc, argv, s_aOptions, RT_ELEMENTS(s_aOptions), 1, 0 /* fFlags */);
+    while ((ch = RTGetOpt(&GetState, &ValueUnion)))
+    {
+        switch (ch)
+        {
+            case 'p':
+                g_pszPattern = ValueUnion.psz;
+                break;
+
+            case 'a':
+                g_fAll = true;
+                break;
+
+            case 'd':
+                g_fDesc = true;
+                break;
+
+            case 'w':
+                cMsWatch = ValueUnion.u32;
+                break;
+
+            case 'c':
+                cRounds     = ValueUnion.u32;
+                fCountGiven = true;
+                break;
+
+            case VINF_GETOPT_NOT_OPTION:
+                if (pszName)
+                    return RTMsgErrorExit(RTEXITCODE_SYNTAX, "Only one shared memory object name, please");
+                pszName = ValueUnion.psz;
+                break;
+
+            case 'h':
+                RTPrintf(VBOX_PRODUCT " Statistics Reader Version " VBOX_VERSION_STRING "\n"
+                         "(C) 2005-" VBOX_C_YEAR " " VBOX_VENDOR "\n"
+                         "All rights reserved.\n"
+                         "\n"
+                         "Usage: VBoxStamReader [-ad] [-p|--pattern <pat>] [-w|--watch <ms>] [-c|--count <n>] <name>\n"
+                         "\n"
+                         "Reads the statistics a VM exports when the /STAM/ExportName config key\n"
+                         "(VBoxInternal/STAM/ExportName extra data) is set to <name>.\n"
+                         "\n");
+                return RTEXITCODE_SUCCESS;
+
+            case 'V':
+                RTPrintf("%sr%s\n", RTBldCfgVersion(), RTBldCfgRevisionStr());
+                return RTEXITCODE_SUCCESS;
+
+            default:
+                return RTGetOptPrintError(ch, &ValueUnion);
+        }
+    }
+    if (!pszName)
+        return RTMsgErrorExit(RTEXITCODE_SYNTAX, "No shared memory object name given");
+    if (cMsWatch && !fCountGiven)
+        cRounds = UINT32_MAX;
+
+    /*
+     * Map the object and dump it.
+     */
+    RTSHMEM hShMem;
+    rc = RTShMemOpen(&hShMem, pszName, RTSHMEM_O_F_READ, 0 /*cbMax*/, 1 /*cMappingsHint*/);
+    if (RT_FAILURE(rc))
+        return RTMsgErrorExit(RTEXITCODE_FAILURE, "Failed to open '%s': %Rrc", pszName, rc);
+
+    RTEXITCODE rcExit  = RTEXITCODE_SUCCESS;
+    size_t     cbShMem = 0;
+    rc = RTShMemQuerySize(hShMem, &cbShMem);
+    if (RT_SUCCESS(rc) && cbShMem < sizeof(STAMEXPORTHDR))
+        rc = VERR_BUFFER_UNDERFLOW;
+    void *pvShMem = NULL;
+    if (RT_SUCCESS(rc))
+        rc = RTShMemMapRegion(hShMem, 0, cbShMem, RTSHMEM_MAP_F_READ, &pvShMem);
+    if (RT_SUCCESS(rc))
+    {
+        uint8_t *pbCopy = (uint8_t *)RTMemAllocZ(cbShMem);
+        if (pbCopy)
+        {
+            for (uint32_t iRound = 0; iRound < cRounds; iRound++)
+            {
+                if (iRound)
+                {
+                    RTThreadSleep(cMsWatch);
+                    RTPrintf("\n");
+                }
+                rc = stamReaderSnapshot((uint8_t const *)pvShMem, cbShMem, pbCopy);
+                if (RT_FAILURE(rc))
+                {
+                    rcExit = RTMsgErrorExit(RTEXITCODE_FAILURE, "Failed to get a consistent copy: %Rrc", rc);
+                    break;
+                }
+                rcExit = stamReaderValidate((PCSTAMEXPORTHDR)pbCopy, cbShMem);
+                if (rcExit != RTEXITCODE_SUCCESS)
+                    break;
+                stamReaderPrint((PCSTAMEXPORTHDR)pbCopy);
+                RTStrmFlush(g_pStdOut);
+            }
+            RTMemFree(pbCopy);
+        }
+        else
+            rcExit = RTMsgErrorExit(RTEXITCODE_FAILURE, "Out of memory");
+        RTShMemUnmapRegion(hShMem, pvShMem);
+    }
+    else
+        rcExit = RTMsgErrorExit(RTEXITCODE_FAILURE, "Failed to map '%s': %Rrc", pszName, rc);
+    RTShMemClose(hShMem);
+    return rcExit;
+}
+